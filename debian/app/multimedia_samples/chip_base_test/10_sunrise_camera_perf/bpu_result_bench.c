@@ -0,0 +1,331 @@
+/**
+ * bpu_wrap 算法结果序列化测试
+ * bpu_result 把检测结果直接写到每路 pipeline 预分配的缓存里，这里检查输出并和原来的方式对比耗时:
+ * 1. 定点格式化: bpu_result_fmt_fixed 和 snprintf("%.*f") 对比，随机的 float 位模式和正好在两个数中间的值
+ * 2. json: 和 snprintf 按同样格式拼出来的字符串逐字节对比，并且能被 cJSON 解析，
+ *    二进制格式解码后和输入一致，检测框超过缓存大小时截断后 json 仍然完整
+ * 3. 耗时: 不同检测框个数下，原来的方式(逐个 snprintf 到 malloc 的缓冲区，外面再 malloc 一次加上 kind 和 pipeline)
+ *    和 bpu_result 每帧的耗时，只输出不判断
+ * 检查失败时返回 -1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "utils/utils_log.h"
+#include "utils/time_utils.h"
+#include "utils/cJSON.h"
+#include "bpu_result.h"
+
+#define BENCH_FMT_RANDOM	2000000
+#define BENCH_MAX_COUNTS	16
+#define BENCH_JSON_SIZE		(BPU_RESULT_JSON_SIZE * 2)
+
+static int32_t s_failed = 0;
+static int32_t s_frames = 2000;
+static const char *s_names[] = {"person", "car", "traffic light", "dog", ""};
+
+static uint32_t rand_u32(void)
+{
+	return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static void check_fmt_fixed(void)
+{
+	char buf[64], expected[64];
+	int32_t i, k, decimals, len, mismatch = 0;
+	uint32_t bits;
+	float v;
+
+	for (i = 0; i < BENCH_FMT_RANDOM; i++) {
+		// 随机位模式覆盖各个数量级，超出范围的值 bpu_result_fmt_fixed 输出 0，跳过
+		bits = rand_u32();
+		memcpy(&v, &bits, sizeof(v));
+		if (!(fabsf(v) < 1e12f))
+			continue;
+		decimals = i % 7;
+		len = bpu_result_fmt_fixed(buf, v, decimals);
+		buf[len] = '\0';
+		snprintf(expected, sizeof(expected), "%.*f", decimals, v);
+		if (strcmp(buf, expected) != 0 && mismatch++ < 5)
+			printf("[%s] %.9g decimals %d: %s, expected %s\n", __FUNCTION__, v, decimals, buf, expected);
+	}
+
+	// k / 2^n 是 float 能精确表示的中间值，小数位数少于 n 时要按 round half to even 取整
+	for (k = -4096; k <= 4096; k++) {
+		for (i = 1; i <= 10; i++) {
+			v = ldexpf((float)k, -i);
+			for (decimals = 0; decimals <= 6; decimals++) {
+				len = bpu_result_fmt_fixed(buf, v, decimals);
+				buf[len] = '\0';
+				snprintf(expected, sizeof(expected), "%.*f", decimals, v);
+				if (strcmp(buf, expected) != 0 && mismatch++ < 5)
+					printf("[%s] %.9g decimals %d: %s, expected %s\n", __FUNCTION__, v, decimals, buf, expected);
+			}
+		}
+	}
+
+	if (mismatch > 0)
+		s_failed++;
+	printf("bpu_result_fmt_fixed: %d mismatches with snprintf\n", mismatch);
+}
+
+static void gen_detections(float (*bbox)[4], float *score, int32_t *id, int32_t count)
+{
+	int32_t i;
+
+	for (i = 0; i < count; i++) {
+		bbox[i][0] = (rand() % 1920000) / 1000.0f;
+		bbox[i][1] = (rand() % 1080000) / 1000.0f;
+		bbox[i][2] = bbox[i][0] + (rand() % 300000) / 1000.0f;
+		bbox[i][3] = bbox[i][1] + (rand() % 300000) / 1000.0f;
+		score[i] = (float)rand() / RAND_MAX;
+		id[i] = rand() % (sizeof(s_names) / sizeof(s_names[0]));
+	}
+}
+
+// 按 bpu_result 的格式用 snprintf 拼出期望的 json
+static int32_t ref_json(char *buf, int32_t size, int32_t pipeline, uint64_t timestamp, float (*bbox)[4],
+	float *score, int32_t *id, int32_t count)
+{
+	int32_t i, len;
+
+	len = snprintf(buf, size, "{\"kind\":10,\"pipeline\":%d,\"timestamp\":%llu,\"detection_result\":[",
+		pipeline, (unsigned long long)timestamp);
+	for (i = 0; i < count; i++) {
+		len += snprintf(buf + len, size - len,
+			"%s{\"bbox\":[%.6f,%.6f,%.6f,%.6f],\"score\":%.6f,\"id\":%d,\"name\":\"%s\"}", i > 0 ? "," : "",
+			bbox[i][0], bbox[i][1], bbox[i][2], bbox[i][3], score[i], id[i], s_names[id[i]]);
+	}
+	len += snprintf(buf + len, size - len, "]}");
+	return len;
+}
+
+static int32_t check_bin(bpu_result_t *result, int32_t pipeline, uint64_t timestamp, float (*bbox)[4],
+	float *score, int32_t *id)
+{
+	const uint8_t *b = result->m_bin;
+	uint32_t magic, bin_pipeline, count, i;
+	uint64_t bin_timestamp;
+	float values[5];
+	uint16_t bin_id;
+	uint8_t name_len;
+
+	memcpy(&magic, b, 4);
+	memcpy(&bin_pipeline, b + 4, 4);
+	memcpy(&bin_timestamp, b + 8, 8);
+	memcpy(&count, b + 16, 4);
+	if (magic != BPU_RESULT_BIN_MAGIC || bin_pipeline != (uint32_t)pipeline || bin_timestamp != timestamp
+		|| count != result->m_count)
+		return -1;
+	b += BPU_RESULT_BIN_HEADER_SIZE;
+	for (i = 0; i < count; i++) {
+		memcpy(values, b, sizeof(values));
+		memcpy(&bin_id, b + 20, 2);
+		name_len = b[22];
+		if (memcmp(values, bbox[i], 4 * sizeof(float)) != 0 || values[4] != score[i] || bin_id != id[i]
+			|| name_len != strlen(s_names[id[i]]) || memcmp(b + 24, s_names[id[i]], name_len) != 0)
+			return -1;
+		b += 24 + name_len;
+	}
+	return b - result->m_bin == (int32_t)result->m_bin_len ? 0 : -1;
+}
+
+static void check_json(void)
+{
+	static const int32_t counts[] = {0, 1, 2, 50, 500, 5000};
+	float (*bbox)[4] = malloc(5000 * sizeof(*bbox));
+	float *score = malloc(5000 * sizeof(float));
+	int32_t *id = malloc(5000 * sizeof(int32_t));
+	char *expected = malloc(BENCH_JSON_SIZE);
+	bpu_result_t result;
+	cJSON *root;
+	int32_t i, j, len, failed = s_failed;
+
+	bpu_result_init(&result);
+	for (i = 0; i < (int32_t)(sizeof(counts) / sizeof(counts[0])); i++) {
+		gen_detections(bbox, score, id, counts[i]);
+		bpu_result_begin_detection(&result, i + 1, 1700000000000000ULL + i);
+		for (j = 0; j < counts[i]; j++)
+			bpu_result_add_detection(&result, bbox[j], score[j], id[j], s_names[id[j]]);
+		bpu_result_end_detection(&result);
+
+		// 超过缓存大小时只保留前 m_count 个
+		if (result.m_count + result.m_truncated != (uint32_t)counts[i]
+			|| (result.m_truncated > 0 && counts[i] < 500)) {
+			printf("[%s] %d detections: %u written, %d truncated\n", __FUNCTION__, counts[i], result.m_count,
+				result.m_truncated);
+			s_failed++;
+			continue;
+		}
+		len = ref_json(expected, BENCH_JSON_SIZE, i + 1, 1700000000000000ULL + i, bbox, score, id,
+			result.m_count);
+		if (len != (int32_t)result.m_json_len || strcmp(expected, result.m_json) != 0) {
+			printf("[%s] %d detections: json differs from snprintf\n", __FUNCTION__, counts[i]);
+			s_failed++;
+		}
+		root = cJSON_Parse(result.m_json);
+		if (root == NULL || cJSON_GetArraySize(cJSON_GetObjectItem(root, "detection_result"))
+			!= (int32_t)result.m_count) {
+			printf("[%s] %d detections: cJSON can not parse the result\n", __FUNCTION__, counts[i]);
+			s_failed++;
+		}
+		cJSON_Delete(root);
+		if (check_bin(&result, i + 1, 1700000000000000ULL + i, bbox, score, id) != 0) {
+			printf("[%s] %d detections: binary result differs from the input\n", __FUNCTION__, counts[i]);
+			s_failed++;
+		}
+		printf("%5d detections: %u written, json %u bytes, binary %u bytes\n", counts[i], result.m_count,
+			result.m_json_len, result.m_bin_len);
+	}
+
+	bpu_result_classification(&result, 3, 12345, 281, 0.87654f);
+	if (strcmp(result.m_json, "{\"kind\":10,\"pipeline\":3,\"timestamp\":12345,"
+		"\"classification_result\":\"id=281, score=0.877\"}") != 0 || result.m_bin_len != 0) {
+		printf("[%s] classification: %s\n", __FUNCTION__, result.m_json);
+		s_failed++;
+	}
+	bpu_result_deinit(&result);
+	free(bbox);
+	free(score);
+	free(id);
+	free(expected);
+	printf("json and binary results %s\n", s_failed == failed ? "are correct" : "are wrong");
+}
+
+// 原来的方式: 后处理拼出 "timestamp" 和 "detection_result"，回调里再 malloc 一次加上 kind 和 pipeline
+static char *old_serialize(int32_t pipeline, uint64_t timestamp, float (*bbox)[4], float *score, int32_t *id,
+	int32_t count)
+{
+	size_t size = 64, len;
+	char *dets, *msg, item[256];
+	int32_t i;
+
+	dets = malloc(size);
+	len = snprintf(dets, size, "\"timestamp\": %llu,\"detection_result\": [", (unsigned long long)timestamp);
+	for (i = 0; i < count; i++) {
+		int32_t n = snprintf(item, sizeof(item),
+			"{\"bbox\":[%.6f,%.6f,%.6f,%.6f],\"score\":%.6f,\"id\":%d,\"name\":\"%s\"}%s",
+			bbox[i][0], bbox[i][1], bbox[i][2], bbox[i][3], score[i], id[i], s_names[id[i]],
+			i < count - 1 ? "," : "");
+		if (len + n + 3 > size) {
+			while (len + n + 3 > size)
+				size *= 2;
+			dets = realloc(dets, size);
+		}
+		memcpy(dets + len, item, n + 1);
+		len += n;
+	}
+	memcpy(dets + len, "]\n", 3);
+
+	msg = malloc(strlen(dets) + 32);
+	sprintf(msg, "{\"kind\":10, \"pipeline\":%d,", pipeline);
+	strcat(msg, dets);
+	strcat(msg, "}");
+	free(dets);
+	return msg;
+}
+
+static void run_speed(int32_t count)
+{
+	float (*bbox)[4] = malloc(count * sizeof(*bbox));
+	float *score = malloc(count * sizeof(float));
+	int32_t *id = malloc(count * sizeof(int32_t));
+	bpu_result_t result;
+	uint64_t start_ns, old_ns, new_ns;
+	size_t sink = 0;
+	int32_t i, j;
+	char *msg;
+
+	gen_detections(bbox, score, id, count);
+	start_ns = get_monotonic_ns();
+	for (i = 0; i < s_frames; i++) {
+		msg = old_serialize(1, i, bbox, score, id, count);
+		sink += strlen(msg);
+		free(msg);
+	}
+	old_ns = get_monotonic_ns() - start_ns;
+
+	bpu_result_init(&result);
+	start_ns = get_monotonic_ns();
+	for (i = 0; i < s_frames; i++) {
+		bpu_result_begin_detection(&result, 1, i);
+		for (j = 0; j < count; j++)
+			bpu_result_add_detection(&result, bbox[j], score[j], id[j], s_names[id[j]]);
+		bpu_result_end_detection(&result);
+		sink += result.m_json_len;
+	}
+	new_ns = get_monotonic_ns() - start_ns;
+	bpu_result_deinit(&result);
+
+	printf("%10d %12.2f %12.2f %8.1fx\n", count, old_ns / 1e3 / s_frames, new_ns / 1e3 / s_frames,
+		(double)old_ns / new_ns);
+	free(bbox);
+	free(score);
+	free(id);
+	(void)sink;
+}
+
+static int32_t parse_list(const char *str, int32_t *list, int32_t max)
+{
+	int32_t count = 0;
+	char *end;
+
+	while (*str != '\0' && count < max) {
+		list[count] = strtol(str, &end, 10);
+		if (end == str || list[count] <= 0)
+			return -1;
+		count++;
+		str = (*end == ',') ? end + 1 : end;
+	}
+	return count;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-d counts] [-n frames]\n", name);
+	printf("  -d  每帧的检测框个数，逗号分隔，默认 10,100,500\n");
+	printf("  -n  每轮序列化的帧数，默认 2000\n");
+}
+
+int main(int argc, char **argv)
+{
+	int32_t counts[BENCH_MAX_COUNTS] = {10, 100, 500};
+	int32_t count_num = 3, opt, i;
+
+	while ((opt = getopt(argc, argv, "d:n:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			count_num = parse_list(optarg, counts, BENCH_MAX_COUNTS);
+			break;
+		case 'n':
+			s_frames = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (count_num <= 0 || s_frames <= 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	// 截断时的 WARN 日志是预期的
+	log_ctrl_level_set(NULL, LOG_ERR);
+	srand(1);
+	check_fmt_fixed();
+	check_json();
+
+	printf("\n%d frames per round\n", s_frames);
+	printf("%10s %12s %12s %9s\n", "detections", "old us", "arena us", "speedup");
+	for (i = 0; i < count_num; i++)
+		run_speed(counts[i]);
+
+	printf("\n%s\n", s_failed == 0 ? "all checks passed" : "some checks failed");
+	return s_failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,395 @@
+/**
+ * cmap 性能测试
+ * 1. 8/128/4096 个节点(字符串 key 和整数 key 各一份)时 pkey_find、pkey_find_interned、ikey_find、
+ *    删除再插入、index_get 遍历一次的耗时，以及 N 个读线程同时 pkey_find 的吞吐，
+ *    同时测原来的链表实现作为对照(list 行，没有 pkey_find_interned)
+ * 2. 反复插入新 key、删除旧 key，检查扩容留下的旧表和驻留字符串会被释放，堆内存不随插入次数增长
+ * 有检查失败时返回 -1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <malloc.h>
+
+#include "utils_log.h"
+#include "time_utils.h"
+#include "cmap.h"
+
+#define BENCH_MAX_ENTRIES	4096
+#define BENCH_MAX_THREADS	32
+#define BENCH_KEY_FMT		"shm_stream_video_%d"
+
+// 原来 cmap 的链表实现，每次操作都加锁从头遍历
+typedef struct list_node_s
+{
+	cmap_key			key;
+	void				*data;
+	struct list_node_s	*next;
+} list_node_t;
+
+typedef struct
+{
+	list_node_t	*front;
+	list_node_t	*rear;
+	int32_t		size;
+	CMtx		lock;
+} list_map_t;
+
+typedef struct
+{
+	cmap		*map;
+	list_map_t	*list;		// 不为 NULL 时测链表
+	int32_t		entries;
+	uint64_t	ops;
+} reader_arg_t;
+
+static char s_keys[BENCH_MAX_ENTRIES][CMAP_PKEY_MAX];
+static const char *s_interned[BENCH_MAX_ENTRIES];
+static volatile uintptr_t s_sink;
+static int32_t s_start = 0;
+static int32_t s_stop = 0;
+static int32_t s_failed = 0;
+
+// 每次操作的平均耗时，单位 ns
+#define BENCH_NS(iters, body) ({							\
+	uint64_t __start = get_monotonic_ns();				\
+	int64_t it;											\
+	for (it = 0; it < (iters); it++) { body; }			\
+	(double)(get_monotonic_ns() - __start) / (iters);	\
+})
+
+static void list_init(list_map_t *q)
+{
+	q->front = (list_node_t *)calloc(1, sizeof(list_node_t));
+	q->front->key.i_key = 0xffffffff;
+	q->rear = q->front;
+	q->size = 0;
+	q->lock = cmtx_create();
+}
+
+static void list_destory(list_map_t *q)
+{
+	list_node_t *next;
+
+	while (q->front) {
+		next = q->front->next;
+		free(q->front);
+		q->front = next;
+	}
+	cmtx_delete(q->lock);
+}
+
+static void *list_ikey_find(list_map_t *q, int32_t key)
+{
+	list_node_t *p;
+	void *v = NULL;
+
+	cmtx_enter(q->lock);
+	for (p = q->front->next; p; p = p->next) {
+		if (p->key.i_key == key) {
+			v = p->data;
+			break;
+		}
+	}
+	cmtx_leave(q->lock);
+	return v;
+}
+
+static void *list_pkey_find(list_map_t *q, const char *key)
+{
+	list_node_t *p;
+	void *v = NULL;
+
+	cmtx_enter(q->lock);
+	for (p = q->front->next; p; p = p->next) {
+		if (strcmp(p->key.p_key, key) == 0) {
+			v = p->data;
+			break;
+		}
+	}
+	cmtx_leave(q->lock);
+	return v;
+}
+
+// 和原来一样先查找再加锁插入，查找用 data 判断是否存在，所以 data 不能为 NULL
+static int32_t list_insert(list_map_t *q, int32_t ikey, const char *pkey, void *e)
+{
+	list_node_t *node;
+
+	if ((pkey ? list_pkey_find(q, pkey) : list_ikey_find(q, ikey)) != NULL)
+		return -2;
+	node = (list_node_t *)calloc(1, sizeof(list_node_t));
+	if (node == NULL)
+		return -1;
+	if (pkey)
+		strcpy(node->key.p_key, pkey);
+	else
+		node->key.i_key = ikey;
+	node->data = e;
+	cmtx_enter(q->lock);
+	q->rear->next = node;
+	q->rear = node;
+	q->size++;
+	cmtx_leave(q->lock);
+	return 0;
+}
+
+static int32_t list_pkey_erase(list_map_t *q, const char *key)
+{
+	list_node_t *t, *p;
+
+	cmtx_enter(q->lock);
+	for (t = q->front, p = t->next; p; t = p, p = p->next) {
+		if (strcmp(p->key.p_key, key) == 0) {
+			t->next = p->next;
+			if (q->rear == p)
+				q->rear = t;
+			free(p);
+			q->size--;
+			cmtx_leave(q->lock);
+			return 0;
+		}
+	}
+	cmtx_leave(q->lock);
+	return -1;
+}
+
+static list_node_t *list_index_get(list_map_t *q, int32_t index)
+{
+	list_node_t *p, *v = NULL;
+	int32_t idx = 0;
+
+	cmtx_enter(q->lock);
+	for (p = q->front->next; p; p = p->next, idx++) {
+		if (idx == index) {
+			v = p;
+			break;
+		}
+	}
+	cmtx_leave(q->lock);
+	return v;
+}
+
+static size_t heap_in_use(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	return mallinfo2().uordblks;
+#else
+	return 0;
+#endif
+}
+
+static void *reader_proc(void *arg)
+{
+	reader_arg_t *ctx = (reader_arg_t *)arg;
+	uint32_t seed = (uint32_t)(uintptr_t)ctx;
+	uint64_t ops = 0;
+	uintptr_t sink = 0;
+
+	while (!__atomic_load_n(&s_start, __ATOMIC_ACQUIRE))
+		;
+	while (!__atomic_load_n(&s_stop, __ATOMIC_RELAXED)) {
+		seed = seed * 1103515245 + 12345;
+		if (ctx->list)
+			sink += (uintptr_t)list_pkey_find(ctx->list, s_keys[(seed >> 8) % ctx->entries]);
+		else
+			sink += (uintptr_t)cmap_pkey_find(ctx->map, s_keys[(seed >> 8) % ctx->entries]);
+		ops++;
+	}
+	s_sink += sink;
+	ctx->ops = ops;
+	return NULL;
+}
+
+// 返回所有读线程加起来每秒的查找次数
+static double bench_readers(cmap *map, list_map_t *list, int32_t entries, int32_t threads, int32_t ms)
+{
+	pthread_t tids[BENCH_MAX_THREADS];
+	reader_arg_t args[BENCH_MAX_THREADS];
+	uint64_t start_ns, ops = 0;
+	double seconds;
+	int32_t i;
+
+	__atomic_store_n(&s_start, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&s_stop, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < threads; i++) {
+		args[i].map = map;
+		args[i].list = list;
+		args[i].entries = entries;
+		args[i].ops = 0;
+		pthread_create(&tids[i], NULL, reader_proc, &args[i]);
+	}
+	start_ns = get_monotonic_ns();
+	__atomic_store_n(&s_start, 1, __ATOMIC_RELEASE);
+	usleep(ms * 1000);
+	__atomic_store_n(&s_stop, 1, __ATOMIC_RELAXED);
+	seconds = (get_monotonic_ns() - start_ns) / 1e9;
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+		ops += args[i].ops;
+	}
+	return ops / seconds;
+}
+
+static void bench_size(int32_t entries, int32_t threads, int32_t ms)
+{
+	int64_t iters = entries >= 1024 ? 200000 : 2000000;
+	int64_t walks = 2000000 / entries;
+	double pkey, interned, ikey, churn, walk, mops;
+	cmap map;
+	int32_t i, j;
+
+	cmap_init(&map);
+	for (i = 0; i < entries; i++) {
+		cmap_pkey_insert(&map, s_keys[i], NULL);
+		cmap_ikey_insert(&map, i, NULL);
+		s_interned[i] = cmap_pkey_intern(&map, s_keys[i]);
+	}
+	if (cmap_size(&map) != entries * 2) {
+		printf("%d entries: size %d, expect %d\n", entries, cmap_size(&map), entries * 2);
+		s_failed++;
+	}
+	// 先查一遍，让节点进缓存
+	for (i = 0; i < entries; i++)
+		s_sink += (uintptr_t)cmap_pkey_find(&map, s_keys[i]);
+
+	pkey = BENCH_NS(iters, s_sink += (uintptr_t)cmap_pkey_find(&map, s_keys[it % entries]));
+	interned = BENCH_NS(iters, s_sink += (uintptr_t)cmap_pkey_find_interned(&map, s_interned[it % entries]));
+	ikey = BENCH_NS(iters, s_sink += (uintptr_t)cmap_ikey_find(&map, it % entries));
+	churn = BENCH_NS(iters / 2, cmap_pkey_erase(&map, s_keys[it % entries]);
+		cmap_pkey_insert(&map, s_keys[it % entries], NULL));
+	walk = BENCH_NS(walks, for (j = 0; j < cmap_size(&map); j++) s_sink += (uintptr_t)cmap_index_get(&map, j));
+	mops = bench_readers(&map, NULL, entries, threads, ms) / 1e6;
+
+	printf("%7d %5s %9.1f %9.1f %9.1f %9.1f %9.1f %9.2f\n", entries, "hash", pkey, interned, ikey, churn, walk / 1e3,
+		mops);
+	cmap_destory(&map);
+}
+
+// 同样的操作测原来的链表，查找是 O(n)、遍历是 O(n^2)，按节点个数减少次数
+static void bench_list_size(int32_t entries, int32_t threads, int32_t ms)
+{
+	int64_t iters = 16000000 / entries;
+	int64_t walks = 40000000 / (4 * (int64_t)entries * entries);
+	double pkey, ikey, churn, walk, mops;
+	list_map_t list;
+	int32_t i, j;
+
+	if (walks < 1)
+		walks = 1;
+	list_init(&list);
+	for (i = 0; i < entries; i++) {
+		list_insert(&list, 0, s_keys[i], s_keys[i]);
+		list_insert(&list, i, NULL, s_keys[i]);
+	}
+	if (list.size != entries * 2) {
+		printf("%d entries: list size %d, expect %d\n", entries, list.size, entries * 2);
+		s_failed++;
+	}
+	for (i = 0; i < entries; i++)
+		s_sink += (uintptr_t)list_pkey_find(&list, s_keys[i]);
+
+	pkey = BENCH_NS(iters, s_sink += (uintptr_t)list_pkey_find(&list, s_keys[it % entries]));
+	ikey = BENCH_NS(iters, s_sink += (uintptr_t)list_ikey_find(&list, it % entries));
+	churn = BENCH_NS(iters / 2, list_pkey_erase(&list, s_keys[it % entries]);
+		list_insert(&list, 0, s_keys[it % entries], s_keys[it % entries]));
+	walk = BENCH_NS(walks, for (j = 0; j < list.size; j++) s_sink += (uintptr_t)list_index_get(&list, j));
+	mops = bench_readers(NULL, &list, entries, threads, ms) / 1e6;
+
+	printf("%7d %5s %9.1f %9s %9.1f %9.1f %9.1f %9.2f\n", entries, "list", pkey, "-", ikey, churn, walk / 1e3, mops);
+	list_destory(&list);
+}
+
+// 每次插入一个新 key、删除 window 次之前插入的 key，节点个数保持在 window 附近
+static void check_churn(int32_t rounds, int32_t window)
+{
+	char key[CMAP_PKEY_MAX];
+	size_t base = 0, grow;
+	cmap map;
+	int32_t i;
+
+	cmap_init(&map);
+	for (i = 0; i < rounds; i++) {
+		snprintf(key, sizeof(key), "churn_%d", i);
+		cmap_pkey_insert(&map, key, NULL);
+		cmap_ikey_insert(&map, i, NULL);
+		if (i >= window) {
+			snprintf(key, sizeof(key), "churn_%d", i - window);
+			cmap_pkey_erase(&map, key);
+			cmap_ikey_erase(&map, i - window);
+		}
+		if (i == window * 4)
+			base = heap_in_use();
+	}
+	grow = heap_in_use() - base;
+
+	printf("\n%d inserts with %d live keys: size %d, heap grew %zu bytes after warm-up\n",
+		rounds, window, cmap_size(&map), base ? grow : 0);
+	if (cmap_size(&map) != window * 2) {
+		printf("churn size %d, expect %d\n", cmap_size(&map), window * 2);
+		s_failed++;
+	}
+	// 旧表和驻留字符串没有释放时每次插入至少多占 CMAP_PKEY_MAX 字节
+	if (base && grow > (size_t)rounds) {
+		printf("heap keeps growing under churn\n");
+		s_failed++;
+	}
+	cmap_destory(&map);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-t threads] [-m ms] [-c rounds]\n", name);
+	printf("  -t  同时查找的读线程个数，默认 4，最多 %d\n", BENCH_MAX_THREADS);
+	printf("  -m  多线程查找每轮的时长，单位 ms，默认 300\n");
+	printf("  -c  内存检查插入新 key 的次数，默认 1000000\n");
+}
+
+int main(int argc, char **argv)
+{
+	int32_t sizes[] = {8, 128, BENCH_MAX_ENTRIES};
+	int32_t threads = 4, ms = 300, rounds = 1000000;
+	int32_t opt, i;
+
+	while ((opt = getopt(argc, argv, "t:m:c:h")) != -1) {
+		switch (opt) {
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'm':
+			ms = atoi(optarg);
+			break;
+		case 'c':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (threads <= 0 || threads > BENCH_MAX_THREADS || ms <= 0 || rounds <= 1000) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	log_ctrl_level_set(NULL, LOG_ERR);
+	for (i = 0; i < BENCH_MAX_ENTRIES; i++)
+		snprintf(s_keys[i], sizeof(s_keys[i]), BENCH_KEY_FMT, i);
+
+	printf("string and int key per entry, find/churn in ns per op, walk in us, %d reader threads\n", threads);
+	printf("%7s %5s %9s %9s %9s %9s %9s %9s\n", "entries", "impl", "pkey", "interned", "ikey", "churn", "walk",
+		"Mfind/s");
+	for (i = 0; i < (int32_t)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+		bench_list_size(sizes[i], threads, ms);
+		bench_size(sizes[i], threads, ms);
+	}
+
+	check_churn(rounds, 200);
+
+	printf("\n%s\n", s_failed == 0 ? "all checks passed" : "some checks failed");
+	return s_failed == 0 ? 0 : -1;
+}
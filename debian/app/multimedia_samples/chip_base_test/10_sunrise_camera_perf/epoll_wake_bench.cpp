@@ -0,0 +1,252 @@
+/**
+ * live555 任务调度器唤醒耗时测试
+ * 注册 N-1 个空闲的 socket(模拟空闲的 RTSP/RTCP 连接)和 1 个活跃的 socket，活跃的 socket 乒乓收发，
+ * 同时跑一个 1ms 的定时任务(模拟码流的帧定时器)，统计 BasicTaskScheduler(select)和
+ * EpollTaskScheduler(epoll)每次唤醒的耗时
+ * select 不处理 FD_SETSIZE 以上的 socket，活跃 socket 超过这个值时 1 秒没有进展就结束这一轮，结果显示为 "-"
+ * epoll 每一轮都必须跑完，否则返回 -1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "BasicUsageEnvironment.hh"
+#include "EpollTaskScheduler.hh"
+
+#include "time_utils.h"
+
+#define BENCH_MAX_ROUNDS	16
+#define BENCH_STALL_NS		1000000000ULL
+
+typedef struct
+{
+	TaskScheduler	*scheduler;
+	int32_t		ping_fd;	// 往这一端写，活跃 socket 就可读
+	int32_t		pong_fd;	// 注册到调度器的活跃 socket
+	uint64_t	wakeups;
+	uint64_t	target;
+	uint64_t	progress_wakeups;
+	uint64_t	progress_ns;
+	int32_t		stalled;
+	char		done;
+} wake_ctx_t;
+
+typedef struct
+{
+	int32_t		stalled;
+	int32_t		active_fd;
+	double		wall_us_per_wakeup;
+	double		cpu_us_per_wakeup;
+} wake_result_t;
+
+static uint64_t s_target = 20000;
+
+// 空闲的 socket 不会可读，注册上只是为了让调度器每次都要处理它
+static void on_idle_readable(void *client_data, int mask)
+{
+	char c;
+
+	(void)mask;
+	if (read((int32_t)(intptr_t)client_data, &c, 1) < 0)
+		return;
+}
+
+static void on_active_readable(void *client_data, int mask)
+{
+	wake_ctx_t *ctx = (wake_ctx_t *)client_data;
+	char c;
+
+	(void)mask;
+	if (read(ctx->pong_fd, &c, 1) != 1)
+		return;
+	if (++ctx->wakeups >= ctx->target) {
+		ctx->done = 1;
+		return;
+	}
+	if (write(ctx->ping_fd, &c, 1) != 1)
+		ctx->done = 1;
+}
+
+// 1ms 的定时任务，顺便检查是否 1 秒没有进展
+static void on_tick(void *client_data)
+{
+	wake_ctx_t *ctx = (wake_ctx_t *)client_data;
+	uint64_t now_ns = get_monotonic_ns();
+
+	if (ctx->wakeups != ctx->progress_wakeups) {
+		ctx->progress_wakeups = ctx->wakeups;
+		ctx->progress_ns = now_ns;
+	} else if (now_ns - ctx->progress_ns > BENCH_STALL_NS) {
+		ctx->stalled = 1;
+		ctx->done = 1;
+		return;
+	}
+	ctx->scheduler->scheduleDelayedTask(1000, on_tick, ctx);
+}
+
+static double rusage_seconds(const struct rusage *r)
+{
+	return r->ru_utime.tv_sec + r->ru_utime.tv_usec / 1e6 + r->ru_stime.tv_sec + r->ru_stime.tv_usec / 1e6;
+}
+
+static int32_t run_wake(int32_t use_epoll, int32_t sockets, wake_result_t *result)
+{
+	TaskScheduler *scheduler;
+	wake_ctx_t ctx;
+	struct rusage r0, r1;
+	uint64_t start_ns, end_ns;
+	int32_t *fds, sp[2], i;
+	char c = 1;
+
+	if (use_epoll)
+		scheduler = EpollTaskScheduler::createNew();
+	else
+		scheduler = BasicTaskScheduler::createNew(0);
+	if (scheduler == NULL) {
+		printf("create %s scheduler failed\n", use_epoll ? "epoll" : "select");
+		return -1;
+	}
+
+	// 每个 socketpair 两个 fd，活跃的 socket 最后创建，编号最大
+	fds = (int32_t *)calloc(sockets * 2, sizeof(int32_t));
+	memset(&ctx, 0, sizeof(ctx));
+	for (i = 0; i < sockets; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) != 0) {
+			printf("socketpair failed after %d sockets, raise the open files limit\n", i);
+			sockets = i;
+			goto error;
+		}
+		fds[i * 2] = sp[0];
+		fds[i * 2 + 1] = sp[1];
+		if (i < sockets - 1)
+			scheduler->turnOnBackgroundReadHandling(sp[1], on_idle_readable, (void *)(intptr_t)sp[1]);
+	}
+	ctx.scheduler = scheduler;
+	ctx.ping_fd = sp[0];
+	ctx.pong_fd = sp[1];
+	ctx.target = s_target;
+	ctx.progress_ns = get_monotonic_ns();
+	scheduler->turnOnBackgroundReadHandling(ctx.pong_fd, on_active_readable, &ctx);
+	scheduler->scheduleDelayedTask(1000, on_tick, &ctx);
+
+	getrusage(RUSAGE_THREAD, &r0);
+	start_ns = get_monotonic_ns();
+	if (write(ctx.ping_fd, &c, 1) == 1)
+		scheduler->doEventLoop(&ctx.done);
+	end_ns = get_monotonic_ns();
+	getrusage(RUSAGE_THREAD, &r1);
+
+	result->stalled = ctx.stalled || ctx.wakeups == 0;
+	result->active_fd = ctx.pong_fd;
+	if (!result->stalled) {
+		result->wall_us_per_wakeup = (end_ns - start_ns) / 1e3 / ctx.wakeups;
+		result->cpu_us_per_wakeup = (rusage_seconds(&r1) - rusage_seconds(&r0)) * 1e6 / ctx.wakeups;
+	}
+
+	for (i = 0; i < sockets; i++)
+		scheduler->turnOffBackgroundReadHandling(fds[i * 2 + 1]);
+	for (i = 0; i < sockets * 2; i++)
+		close(fds[i]);
+	free(fds);
+	delete scheduler;
+	return 0;
+
+error:
+	for (i = 0; i < sockets * 2; i++)
+		close(fds[i]);
+	free(fds);
+	delete scheduler;
+	return -1;
+}
+
+static int32_t parse_list(const char *str, int32_t *list, int32_t max)
+{
+	int32_t count = 0;
+	char *end;
+
+	while (*str != '\0' && count < max) {
+		list[count] = strtol(str, &end, 10);
+		if (end == str || list[count] <= 0)
+			return -1;
+		count++;
+		str = (*end == ',') ? end + 1 : end;
+	}
+	return count;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-c counts] [-i wakeups]\n", name);
+	printf("  -c  注册的 socket 个数，逗号分隔，默认 16,256,1024\n");
+	printf("  -i  每轮的唤醒次数，默认 20000\n");
+}
+
+int main(int argc, char **argv)
+{
+	int32_t counts[BENCH_MAX_ROUNDS] = {16, 256, 1024};
+	int32_t count_num = 3, opt, failed = 0, i, use_epoll;
+	wake_result_t results[BENCH_MAX_ROUNDS][2];
+	struct rlimit rl;
+
+	while ((opt = getopt(argc, argv, "c:i:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			count_num = parse_list(optarg, counts, BENCH_MAX_ROUNDS);
+			if (count_num <= 0) {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'i':
+			s_target = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (s_target == 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	// 每个 socket 用两个 fd，尽量把打开文件数的限制调到最大
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	for (i = 0; i < count_num; i++) {
+		for (use_epoll = 0; use_epoll < 2; use_epoll++) {
+			if (run_wake(use_epoll, counts[i], &results[i][use_epoll]) != 0)
+				return -1;
+			if (use_epoll && results[i][use_epoll].stalled) {
+				printf("epoll: %d sockets stalled\n", counts[i]);
+				failed++;
+			}
+		}
+	}
+
+	printf("\n%llu wakeups per round, FD_SETSIZE %d\n", (unsigned long long)s_target, FD_SETSIZE);
+	printf("%7s %9s %12s %12s %12s %12s\n", "sockets", "active fd", "select us", "select cpu", "epoll us",
+		"epoll cpu");
+	for (i = 0; i < count_num; i++) {
+		printf("%7d %9d", counts[i], results[i][1].active_fd);
+		for (use_epoll = 0; use_epoll < 2; use_epoll++) {
+			wake_result_t *r = &results[i][use_epoll];
+			if (r->stalled)
+				printf(" %12s %12s", "-", "-");
+			else
+				printf(" %12.2f %12.2f", r->wall_us_per_wakeup, r->cpu_us_per_wakeup);
+		}
+		printf("\n");
+	}
+
+	printf("\n%s\n", failed == 0 ? "all checks passed" : "some checks failed");
+	return failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,272 @@
+/**
+ * tsQueue(mqueue) 性能测试
+ * 1. ping-pong: 两个线程通过两个长度为 2 的队列来回传一个消息，测一次往返的延时，
+ *    对应 vse -> 编码 -> vse 这种一来一回的用法，主要看睡眠、唤醒的开销
+ * 2. 多生产者多消费者: P 个生产者、C 个消费者共用一个队列，测每秒出队的个数，
+ *    同时检查每个消息正好出队一次
+ * 3. 容量: 长度为 N 的队列最多存 N - 1 个，长度为 1 时存不下任何数据
+ * 有检查失败时返回 -1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "utils_log.h"
+#include "time_utils.h"
+#include "mqueue.h"
+#include "perf_common.h"
+
+#define BENCH_MAX_THREADS	32
+
+typedef struct
+{
+	tsQueue		ping;
+	tsQueue		pong;
+	int32_t		rounds;
+} pingpong_t;
+
+typedef struct
+{
+	tsQueue		queue;
+	int32_t		per_producer;
+	int32_t		producers_done;
+	uint8_t		*seen;		// 每个消息出队的次数
+	uint64_t	dequeued;
+} mpmc_t;
+
+typedef struct
+{
+	mpmc_t		*mpmc;
+	int32_t		index;
+} mpmc_arg_t;
+
+static int32_t s_stage_round = -1;
+static int32_t s_failed = 0;
+
+static void *pingpong_proc(void *arg)
+{
+	pingpong_t *pp = (pingpong_t *)arg;
+	void *data;
+	int32_t i;
+
+	for (i = 0; i < pp->rounds; i++) {
+		if (mQueueDequeueTimed(&pp->ping, 1000, &data) != E_QUEUE_OK)
+			break;
+		mQueueEnqueue(&pp->pong, data);
+	}
+	return NULL;
+}
+
+static void bench_pingpong(int32_t rounds)
+{
+	latency_snapshot_t snapshot;
+	latency_stage_summary_t *stage;
+	pingpong_t pp;
+	pthread_t thread;
+	uint64_t start_ns;
+	void *data;
+	int32_t i;
+
+	pp.rounds = rounds;
+	mQueueCreate(&pp.ping, 2);
+	mQueueCreate(&pp.pong, 2);
+	pthread_create(&thread, NULL, pingpong_proc, &pp);
+
+	latency_stats_snapshot(NULL);
+	for (i = 0; i < rounds; i++) {
+		start_ns = get_monotonic_ns();
+		mQueueEnqueue(&pp.ping, (void *)(intptr_t)(i + 1));
+		if (mQueueDequeueTimed(&pp.pong, 1000, &data) != E_QUEUE_OK || data != (void *)(intptr_t)(i + 1)) {
+			printf("ping-pong round %d failed\n", i);
+			s_failed++;
+			break;
+		}
+		latency_stats_record_since(s_stage_round, start_ns);
+	}
+	pthread_join(thread, NULL);
+	latency_stats_snapshot(&snapshot);
+	mQueueDestroy(&pp.ping);
+	mQueueDestroy(&pp.pong);
+
+	stage = perf_stage_find(&snapshot, "round");
+	printf("\nping-pong %d rounds, round trip in us\n", rounds);
+	printf("%8s %8s %9s\n", "p50", "p99", "max");
+	if (stage != NULL && stage->count > 0)
+		printf("%8.1f %8.1f %9.1f\n", stage->p50_ns / 1e3, stage->p99_ns / 1e3, stage->max_ns / 1e3);
+}
+
+static void *mpmc_producer_proc(void *arg)
+{
+	mpmc_arg_t *ctx = (mpmc_arg_t *)arg;
+	mpmc_t *mpmc = ctx->mpmc;
+	intptr_t base = (intptr_t)ctx->index * mpmc->per_producer;
+	int32_t i;
+
+	// 消息是从 1 开始的序号，NULL 不能入队
+	for (i = 0; i < mpmc->per_producer; i++)
+		mQueueEnqueue(&mpmc->queue, (void *)(base + i + 1));
+	return NULL;
+}
+
+static void *mpmc_consumer_proc(void *arg)
+{
+	mpmc_arg_t *ctx = (mpmc_arg_t *)arg;
+	mpmc_t *mpmc = ctx->mpmc;
+	uint64_t count = 0;
+	void *data;
+
+	for (;;) {
+		if (mQueueDequeueTimed(&mpmc->queue, 10, &data) != E_QUEUE_OK) {
+			if (__atomic_load_n(&mpmc->producers_done, __ATOMIC_ACQUIRE) && mQueueIsEmpty(&mpmc->queue))
+				break;
+			continue;
+		}
+		__atomic_add_fetch(&mpmc->seen[(intptr_t)data - 1], 1, __ATOMIC_RELAXED);
+		count++;
+	}
+	__atomic_add_fetch(&mpmc->dequeued, count, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static double bench_mpmc(int32_t producers, int32_t consumers, int32_t depth, int32_t per_producer)
+{
+	pthread_t threads[BENCH_MAX_THREADS * 2];
+	mpmc_arg_t args[BENCH_MAX_THREADS * 2];
+	mpmc_t mpmc;
+	uint64_t start_ns, total = (uint64_t)producers * per_producer, i;
+	double seconds;
+	int32_t n, errors = 0;
+
+	memset(&mpmc, 0, sizeof(mpmc));
+	mpmc.per_producer = per_producer;
+	mpmc.seen = calloc(total, 1);
+	if (mpmc.seen == NULL)
+		return 0;
+	mQueueCreate(&mpmc.queue, depth + 1);
+
+	start_ns = get_monotonic_ns();
+	for (n = 0; n < consumers; n++) {
+		args[n].mpmc = &mpmc;
+		args[n].index = n;
+		pthread_create(&threads[n], NULL, mpmc_consumer_proc, &args[n]);
+	}
+	for (n = consumers; n < consumers + producers; n++) {
+		args[n].mpmc = &mpmc;
+		args[n].index = n - consumers;
+		pthread_create(&threads[n], NULL, mpmc_producer_proc, &args[n]);
+	}
+	for (n = consumers; n < consumers + producers; n++)
+		pthread_join(threads[n], NULL);
+	__atomic_store_n(&mpmc.producers_done, 1, __ATOMIC_RELEASE);
+	for (n = 0; n < consumers; n++)
+		pthread_join(threads[n], NULL);
+	seconds = (get_monotonic_ns() - start_ns) / 1e9;
+
+	for (i = 0; i < total; i++) {
+		if (mpmc.seen[i] != 1)
+			errors++;
+	}
+	if (errors != 0 || mpmc.dequeued != total) {
+		printf("%d producers %d consumers: %d messages lost or duplicated\n", producers, consumers, errors);
+		s_failed++;
+	}
+
+	mQueueDestroy(&mpmc.queue);
+	free(mpmc.seen);
+	return total / seconds;
+}
+
+static void check_capacity(uint32_t length, uint32_t expect)
+{
+	tsQueue queue;
+	uint32_t stored = 0;
+	void *data;
+
+	mQueueCreate(&queue, length);
+	while (stored <= length && mQueueEnqueueEx(&queue, (void *)(intptr_t)(stored + 1)) == E_QUEUE_OK)
+		stored++;
+	if (stored != expect || !mQueueIsFull(&queue)) {
+		printf("queue length %u stored %u, expect %u\n", length, stored, expect);
+		s_failed++;
+	}
+	while (mQueueDequeueTimed(&queue, 0, &data) == E_QUEUE_OK)
+		;
+	mQueueDestroy(&queue);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-p producers] [-c consumers] [-q depth] [-n messages] [-r rounds]\n", name);
+	printf("  -p  生产者个数列表，逗号分隔，默认 1,2,4，最多 %d\n", BENCH_MAX_THREADS);
+	printf("  -c  消费者个数，默认 2\n");
+	printf("  -q  队列能存的消息个数，默认 64\n");
+	printf("  -n  每个生产者入队的消息个数，默认 200000\n");
+	printf("  -r  ping-pong 的往返次数，默认 50000\n");
+}
+
+int main(int argc, char **argv)
+{
+	int32_t producers[16] = {1, 2, 4}, producer_count = 3;
+	int32_t consumers = 2, depth = 64, per_producer = 200000, rounds = 50000;
+	double rates[16];
+	char *token, *save = NULL;
+	int32_t opt, i, n;
+
+	while ((opt = getopt(argc, argv, "p:c:q:n:r:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			producer_count = 0;
+			for (token = strtok_r(optarg, ",", &save); token != NULL && producer_count < 16;
+				token = strtok_r(NULL, ",", &save)) {
+				n = atoi(token);
+				if (n > 0 && n <= BENCH_MAX_THREADS)
+					producers[producer_count++] = n;
+			}
+			break;
+		case 'c':
+			consumers = atoi(optarg);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 'n':
+			per_producer = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (producer_count == 0 || consumers <= 0 || consumers > BENCH_MAX_THREADS || depth <= 0
+		|| per_producer <= 0 || rounds <= 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	log_ctrl_level_set(NULL, LOG_ERR);
+	s_stage_round = latency_stats_stage("round");
+
+	check_capacity(1, 0);
+	check_capacity(2, 1);
+	check_capacity(3, 2);
+	check_capacity(65, 64);
+
+	bench_pingpong(rounds);
+
+	for (i = 0; i < producer_count; i++)
+		rates[i] = bench_mpmc(producers[i], consumers, depth, per_producer);
+	printf("\nqueue depth %d, %d consumers, %d messages per producer\n", depth, consumers, per_producer);
+	printf("%9s %12s\n", "producers", "msgs/s");
+	for (i = 0; i < producer_count; i++)
+		printf("%9d %12.0f\n", producers[i], rates[i]);
+
+	printf("\n%s\n", s_failed == 0 ? "all checks passed" : "some checks failed");
+	return s_failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,335 @@
+/**
+ * nalu_utils 起始码查找测试
+ * find_annexb_start_code 按编译目标使用 NEON/AVX2/SSE2 一次比较 16/32 个位置，这里用逐字节查找的参考实现对比:
+ * 1. 随机数据: 大量 0 和 1 的随机缓冲区，随机的起始位置和长度，包括向量处理和尾部标量处理的边界
+ * 2. 单个起始码: 起始码放在每一个位置，从每一个起始位置查找，以及缓冲区末尾不完整的起始码
+ * 3. NALU 索引: get_annexb_nalu_index 对码流文件和构造的帧建立索引，和参考实现逐项对比，
+ *    包括 3/4 字节起始码、空的 NALU 和 max_count 截断
+ * 4. 速度: 没有起始码的数据上对比参考实现和 find_annexb_start_code 的扫描速度，只输出不判断
+ * 全部通过返回 0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "utils_log.h"
+#include "time_utils.h"
+#include "nalu_utils.h"
+
+#define TEST_RANDOM_ROUNDS	200000
+#define TEST_RANDOM_MAX_LEN	300
+#define TEST_SINGLE_LEN		128
+#define TEST_SPEED_SIZE		(16 * 1024 * 1024)
+#define TEST_SPEED_ROUNDS	8
+#define TEST_MISMATCH		-2
+
+#define TEST_CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("[%s][%d] check failed: %s\n", __FUNCTION__, __LINE__, #cond); \
+		s_failed++; \
+		return -1; \
+	} \
+} while (0)
+
+static int32_t s_failed = 0;
+static const char *s_files[8] = {
+	"../../sunrise_camera/Platform/x5/test_data/example_640x360_3MG.h264",
+	"../../sample_codec/640x480_30fps.h264",
+};
+static int32_t s_file_count = 2;
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+static const char *s_simd_name = "neon";
+#elif defined(__AVX2__)
+static const char *s_simd_name = "avx2";
+#elif defined(__SSE2__)
+static const char *s_simd_name = "sse2";
+#else
+static const char *s_simd_name = "scalar";
+#endif
+
+static int32_t ref_find_start_code(const unsigned char *data, int32_t from, int32_t length)
+{
+	int32_t i;
+
+	for (i = from; i + 2 < length; i++) {
+		if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+			return i;
+	}
+	return -1;
+}
+
+// 按 get_annexb_nalu_index 的约定逐字节建立索引: 起始码前面的 0 属于 4 字节起始码，不算上一个 NALU 的数据
+static int32_t ref_nalu_index(unsigned char *frame, int32_t length, NALU_index_t *index, int32_t max_count,
+	int32_t is_h265)
+{
+	int32_t count = 0, pos, next, start, end;
+
+	pos = ref_find_start_code(frame, 0, length);
+	if (pos < 0 || pos > 1 || (pos == 1 && frame[0] != 0))
+		return -1;
+
+	index[0].startcodeprefix_len = pos == 1 ? 4 : 3;
+	while (pos >= 0 && count < max_count) {
+		start = pos + 3;
+		next = ref_find_start_code(frame, start, length);
+		end = next < 0 ? length : next;
+		if (next > start && frame[next - 1] == 0)
+			end--;
+
+		index[count].offset = start;
+		index[count].len = end > start ? end - start : 0;
+		index[count].nal_unit_type = 0;
+		if (index[count].len > 0)
+			index[count].nal_unit_type = is_h265 ? (frame[start] >> 1) & 0x3f : frame[start] & 0x1f;
+		count++;
+
+		if (next >= 0 && count < max_count)
+			index[count].startcodeprefix_len = end != next ? 4 : 3;
+		pos = next;
+	}
+	return count;
+}
+
+// 返回索引到的 NALU 个数(帧不是以起始码开始时为 -1)，和参考实现不一致时返回 TEST_MISMATCH
+static int32_t check_nalu_index(unsigned char *frame, int32_t length, int32_t max_count, int32_t is_h265)
+{
+	NALU_index_t *index, *ref;
+	int32_t count, ref_count, i, ret = 0;
+
+	index = (NALU_index_t *)calloc(max_count, sizeof(NALU_index_t));
+	ref = (NALU_index_t *)calloc(max_count, sizeof(NALU_index_t));
+	count = get_annexb_nalu_index(frame, length, index, max_count, is_h265);
+	ref_count = ref_nalu_index(frame, length, ref, max_count, is_h265);
+	if (count != ref_count) {
+		printf("[%s] nalu count %d, expected %d\n", __FUNCTION__, count, ref_count);
+		ret = -1;
+	}
+	for (i = 0; ret == 0 && i < count; i++) {
+		if (index[i].offset != ref[i].offset || index[i].len != ref[i].len
+			|| index[i].startcodeprefix_len != ref[i].startcodeprefix_len
+			|| index[i].nal_unit_type != ref[i].nal_unit_type) {
+			printf("[%s] nalu %d: offset %u len %u prefix %u type %u, expected %u %u %u %u\n", __FUNCTION__, i,
+				index[i].offset, index[i].len, index[i].startcodeprefix_len, index[i].nal_unit_type,
+				ref[i].offset, ref[i].len, ref[i].startcodeprefix_len, ref[i].nal_unit_type);
+			ret = -1;
+		}
+	}
+	free(index);
+	free(ref);
+	return ret < 0 ? TEST_MISMATCH : count;
+}
+
+static int32_t test_random(void)
+{
+	unsigned char buf[TEST_RANDOM_MAX_LEN];
+	int32_t round, i, r, length, from, found, expected;
+
+	srand(1);
+	for (round = 0; round < TEST_RANDOM_ROUNDS; round++) {
+		length = rand() % TEST_RANDOM_MAX_LEN;
+		for (i = 0; i < length; i++) {
+			r = rand() % 8;
+			buf[i] = r < 4 ? 0 : (r < 6 ? 1 : rand() % 256);
+		}
+		from = rand() % (length + 1);
+		found = find_annexb_start_code(buf, from, length);
+		expected = ref_find_start_code(buf, from, length);
+		if (found != expected) {
+			printf("[%s] round %d length %d from %d: found %d, expected %d\n", __FUNCTION__, round,
+				length, from, found, expected);
+			s_failed++;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int32_t test_single(void)
+{
+	unsigned char buf[TEST_SINGLE_LEN];
+	int32_t pos, from, length;
+
+	for (pos = 0; pos + 3 <= TEST_SINGLE_LEN; pos++) {
+		memset(buf, 0x55, sizeof(buf));
+		buf[pos] = 0;
+		buf[pos + 1] = 0;
+		buf[pos + 2] = 1;
+		for (from = 0; from <= pos; from++)
+			TEST_CHECK(find_annexb_start_code(buf, from, TEST_SINGLE_LEN) == pos);
+		TEST_CHECK(find_annexb_start_code(buf, pos + 1, TEST_SINGLE_LEN) == -1);
+		// 长度截断了起始码就找不到
+		TEST_CHECK(find_annexb_start_code(buf, 0, pos + 2) == -1);
+		TEST_CHECK(find_annexb_start_code(buf, 0, pos + 3) == pos);
+	}
+
+	// 全是 0 和末尾不完整的起始码
+	for (length = 0; length <= TEST_SINGLE_LEN; length++) {
+		memset(buf, 0, sizeof(buf));
+		TEST_CHECK(find_annexb_start_code(buf, 0, length) == -1);
+		if (length >= 2) {
+			buf[length - 1] = 1;
+			TEST_CHECK(find_annexb_start_code(buf, 0, length) == (length >= 3 ? length - 3 : -1));
+		}
+	}
+	return 0;
+}
+
+static int32_t test_index_frames(void)
+{
+	static unsigned char frames[][24] = {
+		{0, 0, 0, 1, 0x67, 0x42, 0, 0, 1, 0x68, 0xce, 0, 0, 0, 1, 0x65, 0x88},	// 4/3/4 字节起始码
+		{0, 0, 1, 0x41, 0x9a, 0, 0, 1, 0, 0, 1, 0x41, 0x00},					// 空的 NALU
+		{0, 0, 0, 1, 0x40, 0x01, 0, 0, 0, 1, 0x42, 0x01, 0, 0, 1, 0x26, 0x01},	// H.265 VPS/SPS/IDR
+		{0, 0, 0, 1},															// 只有起始码
+		{0, 0, 0, 0, 1, 0x65},													// 起始码不在开头
+		{0x12, 0, 0, 1, 0x65},
+	};
+	static const int32_t lengths[] = {17, 13, 17, 4, 6, 5};
+	NALU_index_t index[2];
+	NALU_t nalu;
+	int32_t i, is_h265, max_count;
+
+	for (i = 0; i < (int32_t)(sizeof(lengths) / sizeof(lengths[0])); i++) {
+		for (is_h265 = 0; is_h265 < 2; is_h265++) {
+			for (max_count = 1; max_count <= 4; max_count++)
+				TEST_CHECK(check_nalu_index(frames[i], lengths[i], max_count, is_h265) != TEST_MISMATCH);
+		}
+	}
+	TEST_CHECK(check_nalu_index(frames[0], lengths[0], 4, 0) == 3);
+	TEST_CHECK(check_nalu_index(frames[1], lengths[1], 4, 0) == 3);
+	TEST_CHECK(check_nalu_index(frames[3], lengths[3], 4, 0) == 1);
+	TEST_CHECK(get_annexb_nalu_index(frames[4], lengths[4], index, 2, 0) == -1);
+	TEST_CHECK(get_annexb_nalu_index(frames[5], lengths[5], index, 2, 0) == -1);
+
+	// get_annexb_nalu 返回第一个 NALU 的结束位置
+	TEST_CHECK(get_annexb_nalu(frames[0], lengths[0], &nalu, 0) == 6);
+	TEST_CHECK(nalu.startcodeprefix_len == 4 && nalu.len == 2 && nalu.nal_unit_type == 7);
+	TEST_CHECK(nalu.buf == &frames[0][4]);
+	return 0;
+}
+
+static unsigned char *load_file(const char *path, int32_t *length)
+{
+	unsigned char *data;
+	FILE *fp;
+	long size;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = (unsigned char *)malloc(size > 0 ? size : 1);
+	if (size <= 0 || fread(data, 1, size, fp) != (size_t)size) {
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	*length = (int32_t)size;
+	return data;
+}
+
+// 整个码流文件当作一帧建立索引
+static int32_t test_index_files(void)
+{
+	unsigned char *data;
+	int32_t i, length, count, is_h265;
+
+	for (i = 0; i < s_file_count; i++) {
+		data = load_file(s_files[i], &length);
+		if (data == NULL) {
+			printf("[%s] skip %s: can not read\n", __FUNCTION__, s_files[i]);
+			continue;
+		}
+		is_h265 = strstr(s_files[i], "265") != NULL;
+		count = check_nalu_index(data, length, length / 3 + 1, is_h265);
+		free(data);
+		TEST_CHECK(count > 0);
+		printf("[%s] %s: %d bytes, %d nalus\n", __FUNCTION__, s_files[i], length, count);
+	}
+	return 0;
+}
+
+static int32_t test_speed(void)
+{
+	unsigned char *data;
+	uint64_t start_ns, ref_ns, simd_ns;
+	int32_t i, ref_pos = 0, simd_pos = 0;
+
+	data = (unsigned char *)malloc(TEST_SPEED_SIZE);
+	srand(2);
+	for (i = 0; i < TEST_SPEED_SIZE; i++)
+		data[i] = rand() % 256;
+	// 去掉随机出现的起始码，整个缓冲区都要扫描
+	for (i = 0; i + 2 < TEST_SPEED_SIZE; i++) {
+		if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+			data[i + 2] = 2;
+	}
+
+	start_ns = get_monotonic_ns();
+	for (i = 0; i < TEST_SPEED_ROUNDS; i++)
+		ref_pos += ref_find_start_code(data, i, TEST_SPEED_SIZE);
+	ref_ns = get_monotonic_ns() - start_ns;
+	start_ns = get_monotonic_ns();
+	for (i = 0; i < TEST_SPEED_ROUNDS; i++)
+		simd_pos += find_annexb_start_code(data, i, TEST_SPEED_SIZE);
+	simd_ns = get_monotonic_ns() - start_ns;
+	free(data);
+
+	TEST_CHECK(ref_pos == -TEST_SPEED_ROUNDS && simd_pos == -TEST_SPEED_ROUNDS);
+	printf("[%s] byte by byte %.2f GB/s, %s %.2f GB/s\n", __FUNCTION__,
+		(double)TEST_SPEED_SIZE * TEST_SPEED_ROUNDS / ref_ns, s_simd_name,
+		(double)TEST_SPEED_SIZE * TEST_SPEED_ROUNDS / simd_ns);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-f file] ...\n", name);
+	printf("  -f  建立 NALU 索引的码流文件，可以指定多个，文件名包含 265 时按 H.265 处理，\n");
+	printf("      默认使用 sunrise_camera 和 sample_codec 自带的 H.264 码流\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct
+	{
+		const char	*name;
+		int32_t		(*func)(void);
+	} tests[] = {
+		{"random", test_random},
+		{"single", test_single},
+		{"index_frames", test_index_frames},
+		{"index_files", test_index_files},
+		{"speed", test_speed},
+	};
+	int32_t i, opt, failed, user_files = 0;
+
+	while ((opt = getopt(argc, argv, "f:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (user_files < (int32_t)(sizeof(s_files) / sizeof(s_files[0])))
+				s_files[user_files++] = optarg;
+			s_file_count = user_files;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+
+	log_ctrl_level_set(NULL, LOG_ERR);
+	printf("find_annexb_start_code uses %s\n", s_simd_name);
+	for (i = 0; i < (int32_t)(sizeof(tests) / sizeof(tests[0])); i++) {
+		failed = s_failed;
+		tests[i].func();
+		printf("%-16s %s\n", tests[i].name, s_failed == failed ? "PASS" : "FAIL");
+	}
+	return s_failed == 0 ? 0 : -1;
+}
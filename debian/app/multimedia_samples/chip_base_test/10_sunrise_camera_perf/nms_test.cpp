@@ -0,0 +1,240 @@
+/**
+ * bpu_wrap NMS 一致性测试
+ * bpu_nms 的结果必须和原来按分数稳定排序后两两比较的实现完全一致，这里保留原来的实现作为参考:
+ * 1. 随机检测框: 一部分框聚集在固定位置(同一个目标的多个候选框)，一部分随机分布，包括宽高为负的框，
+ *    分数只有 3 位小数，有大量分数相同的框，检查 LINEAR/GRID/AUTO 三种方式，类别内抑制和跨类别抑制，
+ *    以及 top_k 截断
+ * 2. 特殊输入: 空输入、top_k 为 0、所有框完全重合、所有框退化成一个点、大框覆盖整个画面
+ * 3. 耗时: 输出不同检测框个数下参考实现和三种方式的耗时，只输出不判断
+ * 全部通过返回 0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "time_utils.h"
+#include "nms.h"
+
+#define TEST_IOU_THRESHOLD	0.65f
+#define TEST_CLASS_NUM		10
+
+#define TEST_CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("[%s][%d] check failed: %s\n", __FUNCTION__, __LINE__, #cond); \
+		s_failed++; \
+		return -1; \
+	} \
+} while (0)
+
+static int32_t s_failed = 0;
+
+static float rand_float(void)
+{
+	return (float)rand() / RAND_MAX;
+}
+
+// 原来 yolov5_nms/fcos_nms 中的实现
+static void ref_nms(const NmsBoxes &boxes, float iou_threshold, int top_k, bool suppress, std::vector<int> &keep)
+{
+	std::vector<int> order(boxes.size());
+	std::vector<bool> skip(boxes.size(), false);
+	std::vector<float> areas(boxes.size());
+	size_t i, j;
+	int count = 0;
+
+	for (i = 0; i < boxes.size(); i++) {
+		order[i] = i;
+		areas[i] = (boxes.xmax[i] - boxes.xmin[i]) * (boxes.ymax[i] - boxes.ymin[i]);
+	}
+	std::stable_sort(order.begin(), order.end(), [&boxes](int a, int b) {
+		return boxes.score[a] > boxes.score[b];
+	});
+
+	keep.clear();
+	for (i = 0; count < top_k && i < order.size(); i++) {
+		if (skip[i])
+			continue;
+		skip[i] = true;
+		++count;
+		int a = order[i];
+		for (j = i + 1; j < order.size(); j++) {
+			int b = order[j];
+			if (skip[j] || (!suppress && boxes.id[a] != boxes.id[b]))
+				continue;
+			float xx1 = std::max(boxes.xmin[a], boxes.xmin[b]);
+			float yy1 = std::max(boxes.ymin[a], boxes.ymin[b]);
+			float xx2 = std::min(boxes.xmax[a], boxes.xmax[b]);
+			float yy2 = std::min(boxes.ymax[a], boxes.ymax[b]);
+			if (xx2 > xx1 && yy2 > yy1) {
+				float inter = (xx2 - xx1) * (yy2 - yy1);
+				if (inter / (areas[b] + areas[a] - inter) > iou_threshold)
+					skip[j] = true;
+			}
+		}
+		keep.push_back(a);
+	}
+}
+
+// 2/3 的框聚集在 50 个目标附近，其余随机分布，每 97 个框有一个高度为负
+static void gen_boxes(NmsBoxes &boxes, int n)
+{
+	float cx, cy, w, h, y1, y2;
+	int i, target;
+
+	boxes.clear();
+	boxes.reserve(n);
+	for (i = 0; i < n; i++) {
+		if (i % 3) {
+			target = i % 50;
+			cx = (target * 37) % 1920 + rand_float() * 8;
+			cy = (target * 91) % 1080 + rand_float() * 8;
+			w = 60 + rand_float() * 10;
+			h = 80 + rand_float() * 10;
+		} else {
+			cx = rand_float() * 1920;
+			cy = rand_float() * 1080;
+			w = 10 + rand_float() * 200;
+			h = 10 + rand_float() * 200;
+		}
+		y1 = cy - h / 2;
+		y2 = cy + h / 2;
+		if (i % 97 == 0)
+			std::swap(y1, y2);
+		boxes.push_back(cx - w / 2, y1, cx + w / 2, y2, (float)(rand() % 1000) / 1000.0f,
+			rand() % TEST_CLASS_NUM);
+	}
+}
+
+static int32_t check_nms(const NmsBoxes &boxes, int top_k, bool suppress, const char *tag)
+{
+	static const struct
+	{
+		NmsMode		mode;
+		const char	*name;
+	} modes[] = {
+		{NMS_MODE_LINEAR, "linear"},
+		{NMS_MODE_GRID, "grid"},
+		{NMS_MODE_AUTO, "auto"},
+	};
+	std::vector<int> expected, keep;
+	size_t i;
+
+	ref_nms(boxes, TEST_IOU_THRESHOLD, top_k, suppress, expected);
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		bpu_nms(boxes, TEST_IOU_THRESHOLD, top_k, suppress, keep, modes[i].mode);
+		if (keep != expected) {
+			printf("[%s] %s: %zu boxes, top_k %d, suppress %d: %s kept %zu boxes, expected %zu\n", __FUNCTION__,
+				tag, boxes.size(), top_k, suppress, modes[i].name, keep.size(), expected.size());
+			s_failed++;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int32_t test_random(void)
+{
+	static const int counts[] = {1, 2, 10, 100, 500, 1000, 2000, 5000, 20000};
+	static const int top_ks[] = {1, 100, 5000};
+	NmsBoxes boxes;
+	size_t i, k;
+	int suppress, round;
+
+	srand(7);
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		for (round = 0; round < (counts[i] < 1000 ? 20 : 2); round++) {
+			gen_boxes(boxes, counts[i]);
+			for (suppress = 0; suppress < 2; suppress++) {
+				for (k = 0; k < sizeof(top_ks) / sizeof(top_ks[0]); k++)
+					TEST_CHECK(check_nms(boxes, top_ks[k], suppress, "random") == 0);
+			}
+		}
+	}
+	return 0;
+}
+
+static int32_t test_special(void)
+{
+	NmsBoxes boxes;
+	std::vector<int> keep;
+	int i, suppress;
+
+	// 空输入和 top_k 为 0
+	bpu_nms(boxes, TEST_IOU_THRESHOLD, 100, false, keep);
+	TEST_CHECK(keep.empty());
+	gen_boxes(boxes, 100);
+	bpu_nms(boxes, TEST_IOU_THRESHOLD, 0, false, keep);
+	TEST_CHECK(keep.empty());
+
+	for (suppress = 0; suppress < 2; suppress++) {
+		// 完全重合、分数相同的框按下标顺序只保留每个类别的第一个
+		boxes.clear();
+		for (i = 0; i < 2000; i++)
+			boxes.push_back(100, 100, 200, 300, 0.5f, i % TEST_CLASS_NUM);
+		TEST_CHECK(check_nms(boxes, 5000, suppress, "same") == 0);
+
+		// 退化成一个点的框面积为 0，互相不抑制
+		boxes.clear();
+		for (i = 0; i < 2000; i++)
+			boxes.push_back(50, 50, 50, 50, (float)(i % 7) / 7.0f, i % TEST_CLASS_NUM);
+		TEST_CHECK(check_nms(boxes, 5000, suppress, "point") == 0);
+
+		// 覆盖整个画面的大框和大量小框
+		gen_boxes(boxes, 3000);
+		for (i = 0; i < 20; i++)
+			boxes.push_back(-10, -10, 1930, 1090, 0.9f + i / 1000.0f, i % TEST_CLASS_NUM);
+		TEST_CHECK(check_nms(boxes, 5000, suppress, "large") == 0);
+	}
+	return 0;
+}
+
+static int32_t test_speed(void)
+{
+	static const int counts[] = {100, 1000, 5000, 20000};
+	static const NmsMode modes[] = {NMS_MODE_LINEAR, NMS_MODE_GRID, NMS_MODE_AUTO};
+	NmsBoxes boxes;
+	std::vector<int> keep;
+	uint64_t start_ns;
+	double ms[4];
+	size_t i, m;
+
+	srand(9);
+	printf("%7s %7s %10s %10s %10s %10s\n", "boxes", "kept", "ref ms", "linear ms", "grid ms", "auto ms");
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		gen_boxes(boxes, counts[i]);
+		start_ns = get_monotonic_ns();
+		ref_nms(boxes, TEST_IOU_THRESHOLD, 5000, false, keep);
+		ms[0] = (get_monotonic_ns() - start_ns) / 1e6;
+		for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+			start_ns = get_monotonic_ns();
+			bpu_nms(boxes, TEST_IOU_THRESHOLD, 5000, false, keep, modes[m]);
+			ms[m + 1] = (get_monotonic_ns() - start_ns) / 1e6;
+		}
+		printf("%7d %7zu %10.3f %10.3f %10.3f %10.3f\n", counts[i], keep.size(), ms[0], ms[1], ms[2], ms[3]);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct
+	{
+		const char	*name;
+		int32_t		(*func)(void);
+	} tests[] = {
+		{"random", test_random},
+		{"special", test_special},
+		{"speed", test_speed},
+	};
+	int32_t i, failed;
+
+	for (i = 0; i < (int32_t)(sizeof(tests) / sizeof(tests[0])); i++) {
+		failed = s_failed;
+		tests[i].func();
+		printf("%-16s %s\n", tests[i].name, s_failed == failed ? "PASS" : "FAIL");
+	}
+	return s_failed == 0 ? 0 : -1;
+}
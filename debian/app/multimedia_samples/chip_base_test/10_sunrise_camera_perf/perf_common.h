@@ -0,0 +1,39 @@
+#ifndef PERF_COMMON_H_
+#define PERF_COMMON_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "latency_stats.h"
+
+/**
+ * 各测试程序共用的输出函数
+ * 耗时统计直接使用 sunrise_camera 的 latency_stats，每轮测试前后各做一次快照，
+ * 第二次快照就是这一轮的统计
+ */
+
+static inline latency_stage_summary_t *perf_stage_find(latency_snapshot_t *snapshot, const char *name)
+{
+	int32_t i;
+
+	for (i = 0; i < snapshot->stage_count; i++) {
+		if (strcmp(snapshot->stages[i].name, name) == 0)
+			return &snapshot->stages[i];
+	}
+	return NULL;
+}
+
+// 输出 "p50/p99/max" 三列，单位 us
+static inline void perf_print_latency(latency_snapshot_t *snapshot, const char *name)
+{
+	latency_stage_summary_t *stage = perf_stage_find(snapshot, name);
+
+	if (stage == NULL || stage->count == 0) {
+		printf(" %8s %8s %9s", "-", "-", "-");
+		return;
+	}
+	printf(" %8.1f %8.1f %9.1f", stage->p50_ns / 1e3, stage->p99_ns / 1e3, stage->max_ns / 1e3);
+}
+
+#endif // PERF_COMMON_H_
@@ -0,0 +1,245 @@
+/**
+ * RTP 发送性能测试
+ * live555 的 H264VideoRTPSink 通过本机回环发送 H.264 帧，一个线程接收，统计发送线程每秒发出的包数和每个包的 CPU 耗时
+ * 每轮分别测试逐包发送(sendto)和批量发送(RTPInterface 批量 + sendmmsg，内核支持时使用 UDP GSO)
+ * 接收端检查 RTP 序号，乱序或重复时返回 -1，回环接收缓存不够时的丢包只统计不判失败
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "liveMedia.hh"
+#include "BasicUsageEnvironment.hh"
+#include "GroupsockHelper.hh"
+
+#include "time_utils.h"
+
+#define BENCH_RTP_PORT	45678
+
+typedef struct
+{
+	const char	*name;
+	int32_t		batch;
+	double		packets_per_sec;
+	double		cpu_us_per_packet;
+	uint64_t	sent;
+	uint64_t	received;
+	uint64_t	lost;
+	uint64_t	disorder;
+} send_result_t;
+
+typedef struct
+{
+	int32_t		fd;
+	int32_t		stop;
+	int32_t		last_seq;
+	uint64_t	packets;
+	uint64_t	lost;
+	uint64_t	disorder;	// 乱序或重复的包
+} receiver_t;
+
+static uint32_t s_frames = 3000;
+static uint32_t s_frame_size = 150000;
+
+// 每次调用立即给出一帧，第一个字节是 NAL 头，每 30 帧一个 IDR
+class BenchFrameSource: public FramedSource {
+public:
+	BenchFrameSource(UsageEnvironment& env): FramedSource(env), fSent(0) {}
+
+private:
+	virtual void doGetNextFrame() {
+		if (fSent == s_frames) {
+			handleClosure();
+			return;
+		}
+		fFrameSize = s_frame_size < fMaxSize ? s_frame_size : fMaxSize;
+		fTo[0] = (fSent % 30 == 0) ? 0x65 : 0x41;
+		memset(fTo + 1, fSent & 0xff, fFrameSize - 1);
+		gettimeofday(&fPresentationTime, NULL);
+		fDurationInMicroseconds = 0;
+		fSent++;
+		nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*)FramedSource::afterGetting, this);
+	}
+
+	uint32_t fSent;
+};
+
+// 构造后可以关掉 RTPInterface 的批量发送，回到每个包一次 sendto
+class BenchRTPSink: public H264VideoRTPSink {
+public:
+	BenchRTPSink(UsageEnvironment& env, Groupsock* gs, Boolean batch): H264VideoRTPSink(env, gs, 96) {
+		if (!batch)
+			fRTPInterface.setPacketBatching(ourMaxPacketSize(), 0);
+	}
+	unsigned sentPackets() const { return packetCount(); }
+};
+
+static void *receiver_proc(void *arg)
+{
+	receiver_t *rx = (receiver_t *)arg;
+	uint8_t buf[65536];
+	int32_t ret, seq, gap;
+
+	while (!__atomic_load_n(&rx->stop, __ATOMIC_RELAXED)) {
+		ret = recv(rx->fd, buf, sizeof(buf), 0);
+		if (ret < 12)
+			continue;
+		seq = (buf[2] << 8) | buf[3];
+		if (rx->last_seq >= 0) {
+			gap = (uint16_t)(seq - rx->last_seq);
+			if (gap == 0 || gap > 0x8000)
+				rx->disorder++;
+			else
+				rx->lost += gap - 1;
+		}
+		rx->last_seq = seq;
+		rx->packets++;
+	}
+	return NULL;
+}
+
+static double rusage_seconds(const struct rusage *r)
+{
+	return r->ru_utime.tv_sec + r->ru_utime.tv_usec / 1e6 + r->ru_stime.tv_sec + r->ru_stime.tv_usec / 1e6;
+}
+
+static void after_playing(void *client_data)
+{
+	*(char *)client_data = 1;
+}
+
+static int32_t run_send(UsageEnvironment *env, send_result_t *result)
+{
+	struct sockaddr_in addr;
+	struct timeval timeout = {0, 100000};
+	struct rusage r0, r1;
+	struct in_addr dst;
+	receiver_t rx;
+	pthread_t thread;
+	uint64_t start_ns, end_ns;
+	int32_t buf_size = 64 << 20;
+	char done = 0;
+
+	memset(&rx, 0, sizeof(rx));
+	rx.last_seq = -1;
+	rx.fd = socket(AF_INET, SOCK_DGRAM, 0);
+	setsockopt(rx.fd, SOL_SOCKET, SO_RCVBUFFORCE, &buf_size, sizeof(buf_size));
+	setsockopt(rx.fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+	setsockopt(rx.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(BENCH_RTP_PORT);
+	if (bind(rx.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		printf("bind udp port %d failed\n", BENCH_RTP_PORT);
+		close(rx.fd);
+		return -1;
+	}
+	pthread_create(&thread, NULL, receiver_proc, &rx);
+
+	dst.s_addr = htonl(INADDR_LOOPBACK);
+	Groupsock gs(*env, dst, Port(0), 255);
+	gs.changeDestinationParameters(dst, Port(BENCH_RTP_PORT), 255);
+	BenchRTPSink *sink = new BenchRTPSink(*env, &gs, result->batch);
+	FramedSource *source = H264VideoStreamDiscreteFramer::createNew(*env, new BenchFrameSource(*env));
+
+	getrusage(RUSAGE_THREAD, &r0);
+	start_ns = get_monotonic_ns();
+	sink->startPlaying(*source, after_playing, &done);
+	env->taskScheduler().doEventLoop(&done);
+	end_ns = get_monotonic_ns();
+	getrusage(RUSAGE_THREAD, &r1);
+
+	// 等接收线程收完
+	usleep(200 * 1000);
+	__atomic_store_n(&rx.stop, 1, __ATOMIC_RELAXED);
+	pthread_join(thread, NULL);
+	close(rx.fd);
+
+	result->sent = sink->sentPackets();
+	result->received = rx.packets;
+	result->lost = rx.lost;
+	result->disorder = rx.disorder;
+	result->packets_per_sec = result->sent * 1e9 / (end_ns - start_ns);
+	result->cpu_us_per_packet = (rusage_seconds(&r1) - rusage_seconds(&r0)) * 1e6 / result->sent;
+
+	sink->stopPlaying();
+	Medium::close(sink);
+	Medium::close(source);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n frames] [-s size]\n", name);
+	printf("  -n  每轮发送的帧数，默认 3000\n");
+	printf("  -s  每帧的字节数，默认 150000\n");
+}
+
+int main(int argc, char **argv)
+{
+	send_result_t results[] = {
+		{"sendto", 0, 0, 0, 0, 0, 0, 0},
+		{"batch", 1, 0, 0, 0, 0, 0, 0},
+	};
+	int32_t opt, failed = 0;
+	uint32_t i;
+
+	while ((opt = getopt(argc, argv, "n:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			s_frames = atoi(optarg);
+			break;
+		case 's':
+			s_frame_size = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (s_frames == 0 || s_frame_size < 2) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	TaskScheduler *scheduler = BasicTaskScheduler::createNew();
+	UsageEnvironment *env = BasicUsageEnvironment::createNew(*scheduler);
+	OutPacketBuffer::maxSize = s_frame_size + 1024;
+
+	// 探测一下内核是否支持 UDP GSO，批量发送时会自动使用
+	int32_t probe = socket(AF_INET, SOCK_DGRAM, 0);
+	Boolean gso = socketSupportsGSO(probe);
+	close(probe);
+
+	for (i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+		if (run_send(env, &results[i]) != 0)
+			return -1;
+		if (results[i].disorder != 0) {
+			printf("%s: %llu packets out of order or duplicated\n", results[i].name,
+				(unsigned long long)results[i].disorder);
+			failed++;
+		}
+	}
+
+	printf("\n%u frames of %u bytes over loopback, udp gso %s\n", s_frames, s_frame_size,
+		gso ? "supported" : "not supported");
+	printf("%7s %9s %10s %10s %9s %7s\n", "mode", "packets", "pkt/s", "cpu us/pkt", "received", "lost");
+	for (i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+		send_result_t *r = &results[i];
+		printf("%7s %9llu %10.0f %10.2f %9llu %7llu\n", r->name, (unsigned long long)r->sent,
+			r->packets_per_sec, r->cpu_us_per_packet, (unsigned long long)r->received,
+			(unsigned long long)r->lost);
+	}
+
+	env->reclaim();
+	delete scheduler;
+
+	printf("\n%s\n", failed == 0 ? "all checks passed" : "some checks failed");
+	return failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,423 @@
+/**
+ * RTSP 服务压力测试
+ * 在本机打开 M 个 RTSP 客户端(DESCRIBE/SETUP/PLAY，RTP over UDP)轮流拉取 sunrise_camera 的码流，
+ * 用 RTP 序号统计每个客户端的丢包，同时统计服务进程的 CPU 占用，输出持续拉流成功的路数和每个核能支撑的路数
+ * 持续拉流成功: 每秒都收到数据，丢包不超过 1%
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <dirent.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+
+#include "time_utils.h"
+
+#define LOAD_MAX_CLIENTS	1024
+#define LOAD_MAX_ROUNDS		16
+#define LOAD_MAX_STREAMS	8
+#define LOAD_RTP_PORT_BASE	30000
+#define LOAD_LOSS_LIMIT		0.01
+
+typedef struct
+{
+	int32_t		tcp;
+	int32_t		udp;
+	char		url[256];
+	char		session[64];
+	int32_t		playing;
+	int32_t		last_seq;		// 上一个 RTP 包的序号，-1 表示还没收到
+	uint64_t	packets;
+	uint64_t	bytes;
+	uint64_t	lost;
+	uint64_t	window_packets;	// 当前 1 秒内收到的包数
+	int32_t		stalls;			// 一个包都没收到的秒数
+} load_client_t;
+
+typedef struct
+{
+	int32_t		clients;
+	int32_t		playing;
+	int32_t		sustained;
+	double		packets_per_sec;
+	double		mbps;
+	double		loss;
+	double		cpu;			// 服务进程占用的核数，小于 0 表示没有统计
+} load_result_t;
+
+static const char *s_host = "127.0.0.1";
+static int32_t s_port = 554;
+static char *s_streams[LOAD_MAX_STREAMS];
+static int32_t s_stream_count = 0;
+static int32_t s_seq = 1;
+
+// 读一个完整的 RTSP 回复(头部 + Content-Length 的内容)
+static int32_t rtsp_recv(int32_t fd, char *buf, int32_t size)
+{
+	int32_t total = 0, ret, need;
+	char *end, *length;
+
+	while (total < size - 1) {
+		ret = recv(fd, buf + total, size - 1 - total, 0);
+		if (ret <= 0)
+			return -1;
+		total += ret;
+		buf[total] = '\0';
+		end = strstr(buf, "\r\n\r\n");
+		if (end == NULL)
+			continue;
+		length = strcasestr(buf, "Content-Length:");
+		need = (end - buf) + 4 + (length != NULL && length < end ? atoi(length + 15) : 0);
+		if (total >= need)
+			return total;
+	}
+	return -1;
+}
+
+static int32_t rtsp_request(load_client_t *client, const char *method, const char *url,
+	const char *headers, char *reply, int32_t size)
+{
+	char request[1024], session[96] = "";
+	int32_t len;
+
+	if (client->session[0] != '\0')
+		snprintf(session, sizeof(session), "Session: %s\r\n", client->session);
+	len = snprintf(request, sizeof(request), "%s %s RTSP/1.0\r\nCSeq: %d\r\n%s%s\r\n",
+		method, url, s_seq++, headers, session);
+	if (send(client->tcp, request, len, MSG_NOSIGNAL) != len)
+		return -1;
+	if (rtsp_recv(client->tcp, reply, size) < 0 || strncmp(reply, "RTSP/1.0 200", 12) != 0)
+		return -1;
+	return 0;
+}
+
+// 绑定一对相邻的 RTP/RTCP 端口，返回 RTP 端口
+static int32_t client_bind_udp(load_client_t *client, int32_t index)
+{
+	struct sockaddr_in addr;
+	int32_t port, buf_size = 4 << 20;
+
+	client->udp = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (client->udp < 0)
+		return -1;
+	setsockopt(client->udp, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	for (port = LOAD_RTP_PORT_BASE + index * 2; port < 65534; port += LOAD_MAX_CLIENTS * 2) {
+		addr.sin_port = htons(port);
+		if (bind(client->udp, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			return port;
+	}
+	return -1;
+}
+
+static int32_t client_open(load_client_t *client, int32_t index)
+{
+	struct sockaddr_in addr;
+	struct timeval timeout = {3, 0};
+	char reply[8192], headers[256], track[512], *control, *session;
+	int32_t port;
+
+	memset(client, 0, sizeof(*client));
+	client->udp = -1;
+	client->last_seq = -1;
+	snprintf(client->url, sizeof(client->url), "rtsp://%s:%d/%s",
+		s_host, s_port, s_streams[index % s_stream_count]);
+
+	client->tcp = socket(AF_INET, SOCK_STREAM, 0);
+	if (client->tcp < 0)
+		return -1;
+	setsockopt(client->tcp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(s_port);
+	inet_pton(AF_INET, s_host, &addr.sin_addr);
+	if (connect(client->tcp, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		printf("client %d connect failed: %s\n", index, strerror(errno));
+		return -1;
+	}
+
+	if (rtsp_request(client, "DESCRIBE", client->url, "Accept: application/sdp\r\n", reply, sizeof(reply)) != 0) {
+		printf("client %d DESCRIBE %s failed\n", index, client->url);
+		return -1;
+	}
+	// 第一个媒体的 a=control 可能是绝对路径，也可能相对于请求的 url
+	control = strstr(reply, "m=");
+	control = control != NULL ? strstr(control, "a=control:") : NULL;
+	if (control != NULL && sscanf(control + 10, "%255s", headers) == 1) {
+		if (strncmp(headers, "rtsp://", 7) == 0)
+			snprintf(track, sizeof(track), "%s", headers);
+		else
+			snprintf(track, sizeof(track), "%s/%s", client->url, headers);
+	} else {
+		snprintf(track, sizeof(track), "%s", client->url);
+	}
+
+	port = client_bind_udp(client, index);
+	if (port < 0) {
+		printf("client %d no free udp port\n", index);
+		return -1;
+	}
+	snprintf(headers, sizeof(headers), "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n", port, port + 1);
+	if (rtsp_request(client, "SETUP", track, headers, reply, sizeof(reply)) != 0) {
+		printf("client %d SETUP %s failed\n", index, track);
+		return -1;
+	}
+	session = strcasestr(reply, "Session:");
+	if (session == NULL || sscanf(session + 8, " %63[^;\r\n]", client->session) != 1) {
+		printf("client %d no session in SETUP reply\n", index);
+		return -1;
+	}
+
+	if (rtsp_request(client, "PLAY", client->url, "Range: npt=0.000-\r\n", reply, sizeof(reply)) != 0) {
+		printf("client %d PLAY failed\n", index);
+		return -1;
+	}
+	client->playing = 1;
+	return 0;
+}
+
+static void client_close(load_client_t *client)
+{
+	char reply[1024];
+
+	if (client->playing)
+		rtsp_request(client, "TEARDOWN", client->url, "", reply, sizeof(reply));
+	if (client->tcp >= 0)
+		close(client->tcp);
+	if (client->udp >= 0)
+		close(client->udp);
+	client->tcp = -1;
+	client->udp = -1;
+	client->playing = 0;
+}
+
+static void client_receive(load_client_t *client, int32_t counting)
+{
+	uint8_t buf[2048];
+	int32_t ret, seq;
+
+	while ((ret = recv(client->udp, buf, sizeof(buf), 0)) > 0) {
+		if (ret < 12 || (buf[0] >> 6) != 2)
+			continue;
+		seq = (buf[2] << 8) | buf[3];
+		if (!counting) {
+			client->last_seq = seq;
+			continue;
+		}
+		if (client->last_seq >= 0)
+			client->lost += (uint16_t)(seq - client->last_seq - 1);
+		client->last_seq = seq;
+		client->packets++;
+		client->bytes += ret;
+		client->window_packets++;
+	}
+}
+
+// 服务进程用掉的 CPU 时间，单位秒
+static double process_cpu_seconds(int32_t pid)
+{
+	char path[64], buf[1024], *p;
+	unsigned long utime, stime;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	p = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+	// comm 里可能有空格，从最后一个 ')' 之后开始数，utime 和 stime 是第 14、15 个字段
+	p = p != NULL ? strrchr(buf, ')') : NULL;
+	if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+		return -1;
+	return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static int32_t process_find(const char *name)
+{
+	char path[300], comm[64];
+	struct dirent *entry;
+	int32_t pid = -1;
+	DIR *dir;
+	FILE *fp;
+
+	dir = opendir("/proc");
+	if (dir == NULL)
+		return -1;
+	while (pid < 0 && (entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+		fp = fopen(path, "r");
+		if (fp == NULL)
+			continue;
+		if (fgets(comm, sizeof(comm), fp) != NULL && strncmp(comm, name, strlen(name)) == 0)
+			pid = atoi(entry->d_name);
+		fclose(fp);
+	}
+	closedir(dir);
+	return pid;
+}
+
+static void run_round(load_client_t *clients, int32_t count, int32_t seconds, int32_t pid, load_result_t *result)
+{
+	struct epoll_event ev, events[256];
+	uint64_t start_ns, window_ns, now_ns, packets = 0, bytes = 0, lost = 0;
+	double cpu_start = -1, cpu_end;
+	int32_t epfd, i, n, counting = 0;
+
+	memset(result, 0, sizeof(*result));
+	result->clients = count;
+	result->cpu = -1;
+	epfd = epoll_create1(0);
+	for (i = 0; i < count; i++) {
+		if (client_open(&clients[i], i) != 0) {
+			client_close(&clients[i]);
+			continue;
+		}
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].udp, &ev);
+		result->playing++;
+	}
+
+	// 先收 1 秒不统计，等所有客户端都开始收到数据
+	start_ns = get_monotonic_ns();
+	window_ns = start_ns + 1000000000ULL;
+	for (;;) {
+		n = epoll_wait(epfd, events, 256, 100);
+		for (i = 0; i < n; i++)
+			client_receive(&clients[events[i].data.u32], counting);
+		now_ns = get_monotonic_ns();
+		if (now_ns < window_ns)
+			continue;
+		if (!counting) {
+			counting = 1;
+			start_ns = now_ns;
+			if (pid > 0)
+				cpu_start = process_cpu_seconds(pid);
+		} else {
+			for (i = 0; i < count; i++) {
+				if (clients[i].playing && clients[i].window_packets == 0)
+					clients[i].stalls++;
+				clients[i].window_packets = 0;
+			}
+		}
+		window_ns = now_ns + 1000000000ULL;
+		if (now_ns - start_ns >= (uint64_t)seconds * 1000000000ULL)
+			break;
+	}
+	now_ns = get_monotonic_ns();
+	cpu_end = pid > 0 ? process_cpu_seconds(pid) : -1;
+	close(epfd);
+
+	for (i = 0; i < count; i++) {
+		if (!clients[i].playing)
+			continue;
+		packets += clients[i].packets;
+		bytes += clients[i].bytes;
+		lost += clients[i].lost;
+		if (clients[i].stalls == 0 && clients[i].packets > 0
+			&& clients[i].lost <= (clients[i].packets + clients[i].lost) * LOAD_LOSS_LIMIT)
+			result->sustained++;
+		client_close(&clients[i]);
+	}
+	result->packets_per_sec = packets * 1e9 / (now_ns - start_ns);
+	result->mbps = bytes * 8e3 / (now_ns - start_ns);
+	result->loss = packets + lost > 0 ? (double)lost / (packets + lost) : 0;
+	if (cpu_start >= 0 && cpu_end >= 0)
+		result->cpu = (cpu_end - cpu_start) * 1e9 / (now_ns - start_ns);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-a addr] [-P port] [-u streams] [-c clients] [-t seconds] [-p pid]\n", name);
+	printf("  -a  服务地址，默认 127.0.0.1\n");
+	printf("  -P  RTSP 端口，默认 554\n");
+	printf("  -u  码流名字列表，逗号分隔，客户端轮流拉取，默认 stream_chn0.h264，最多 %d 个\n", LOAD_MAX_STREAMS);
+	printf("  -c  客户端个数列表，逗号分隔，每个跑一轮，默认 1,4,16,32，最多 %d\n", LOAD_MAX_CLIENTS);
+	printf("  -t  每轮统计的时长，单位秒，默认 10\n");
+	printf("  -p  服务进程号，默认查找名字为 sunrise_camera 的进程，用来统计 CPU 占用\n");
+}
+
+int main(int argc, char **argv)
+{
+	static load_client_t clients[LOAD_MAX_CLIENTS];
+	int32_t counts[LOAD_MAX_ROUNDS] = {1, 4, 16, 32}, round_count = 4;
+	load_result_t results[LOAD_MAX_ROUNDS];
+	int32_t seconds = 10, pid = -1, opt, i, n;
+	char *token, *save = NULL, default_stream[] = "stream_chn0.h264";
+
+	while ((opt = getopt(argc, argv, "a:P:u:c:t:p:h")) != -1) {
+		switch (opt) {
+		case 'a':
+			s_host = optarg;
+			break;
+		case 'P':
+			s_port = atoi(optarg);
+			break;
+		case 'u':
+			for (token = strtok_r(optarg, ",", &save); token != NULL && s_stream_count < LOAD_MAX_STREAMS;
+				token = strtok_r(NULL, ",", &save))
+				s_streams[s_stream_count++] = token;
+			break;
+		case 'c':
+			round_count = 0;
+			for (token = strtok_r(optarg, ",", &save); token != NULL && round_count < LOAD_MAX_ROUNDS;
+				token = strtok_r(NULL, ",", &save)) {
+				n = atoi(token);
+				if (n > 0 && n <= LOAD_MAX_CLIENTS)
+					counts[round_count++] = n;
+			}
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'p':
+			pid = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (round_count == 0 || seconds <= 0 || s_port <= 0) {
+		usage(argv[0]);
+		return -1;
+	}
+	if (s_stream_count == 0)
+		s_streams[s_stream_count++] = default_stream;
+	if (pid <= 0)
+		pid = process_find("sunrise_camera");
+	if (pid <= 0 || process_cpu_seconds(pid) < 0)
+		printf("server process not found, cpu usage is not counted\n");
+
+	for (i = 0; i < round_count; i++) {
+		run_round(clients, counts[i], seconds, pid, &results[i]);
+		// 等服务端把上一轮的会话清理完
+		sleep(1);
+	}
+
+	printf("\n%s:%d, %d streams, %d seconds per round\n", s_host, s_port, s_stream_count, seconds);
+	printf("%7s %7s %9s %10s %8s %7s %6s %12s\n",
+		"clients", "playing", "sustained", "pkt/s", "Mbps", "loss%", "cores", "streams/core");
+	for (i = 0; i < round_count; i++) {
+		load_result_t *r = &results[i];
+		printf("%7d %7d %9d %10.0f %8.2f %7.2f", r->clients, r->playing, r->sustained,
+			r->packets_per_sec, r->mbps, r->loss * 100);
+		if (r->cpu > 0)
+			printf(" %6.2f %12.1f\n", r->cpu, r->sustained / r->cpu);
+		else
+			printf(" %6s %12s\n", "-", "-");
+	}
+	return 0;
+}
@@ -0,0 +1,320 @@
+/**
+ * RTSP 视频源端到端延时测试
+ * 写线程按帧率向无锁模式的共享内存写入 H.264 帧(和 vpp_camera_impl 一样用 shm_stream_put_annexb，带采集时间)，
+ * live555 线程用 H264MainVideoSource + H264VideoRTPSink 通过本机回环发送，接收线程收到一帧的最后一个包时统计延时
+ * 每轮分别测试两种唤醒方式:
+ * 1. poll:   shm_stream_notify_fd 返回 -1，视频源回退为轮询(没有新帧时 10 ms 后再读，帧间隔 1 ms)
+ * 2. notify: 写端发布新帧时通过 eventfd 唤醒视频源
+ * 输出 latency_stats 的 capture_to_rtsp(采集到交给 RTP 打包，视频源自己统计)和 capture_to_recv(采集到接收端收到整帧)
+ * 接收端收到的帧数和写入的帧数不一致时返回 -1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "liveMedia.hh"
+#include "BasicUsageEnvironment.hh"
+#include "GroupsockHelper.hh"
+
+#include "time_utils.h"
+#include "latency_stats.h"
+#include "stream_manager.h"
+#include "stream_define.h"
+#include "communicate/sdk_communicate.h"
+#include "H264MainVideoSource.hh"
+
+#define BENCH_RTP_PORT		45680
+#define BENCH_ITEM_COUNT	32
+#define BENCH_REGION_SIZE	(4 * 1024 * 1024)
+#define BENCH_GOP			30
+
+typedef struct
+{
+	const char	*name;
+	int32_t		poll;
+	uint64_t	put;
+	uint64_t	received;
+	latency_stage_summary_t	rtsp;
+	latency_stage_summary_t	recv;
+} latency_result_t;
+
+typedef struct
+{
+	shm_stream_t	*writer;
+	uint64_t		*capture_ns;	// 每一帧的采集时间，接收端按帧序号查找
+	uint32_t		frames;
+	uint32_t		put;
+} writer_t;
+
+typedef struct
+{
+	int32_t		fd;
+	int32_t		stop;
+	int32_t		stage;
+	uint64_t	*capture_ns;
+	uint32_t	frames;
+	uint32_t	received;
+} receiver_t;
+
+static uint32_t s_fps = 30;
+static uint32_t s_seconds = 5;
+static uint32_t s_frame_size = 30000;
+static int32_t s_poll = 0;
+
+// 模拟 poll 模式时不给视频源 eventfd，视频源回退为轮询
+extern "C" int __real_shm_stream_notify_fd(shm_stream_t* handle);
+extern "C" int __wrap_shm_stream_notify_fd(shm_stream_t* handle)
+{
+	return s_poll ? -1 : __real_shm_stream_notify_fd(handle);
+}
+
+// H264MainVideoSource::idr 会调用，测试中不需要
+int sdk_cmd_impl(SDK_CMD_E cmd, void* param)
+{
+	return 0;
+}
+
+// 每 BENCH_GOP 帧一个 SPS + PPS + IDR，其余为 P 帧
+static uint32_t build_frame(uint8_t *buf, uint32_t index)
+{
+	static const uint8_t sps[] = {0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1f, 0x8c, 0x8d, 0x40};
+	static const uint8_t pps[] = {0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80};
+	uint32_t len = 0;
+
+	if (index % BENCH_GOP == 0) {
+		memcpy(buf, sps, sizeof(sps));
+		len += sizeof(sps);
+		memcpy(buf + len, pps, sizeof(pps));
+		len += sizeof(pps);
+	}
+	buf[len++] = 0;
+	buf[len++] = 0;
+	buf[len++] = 0;
+	buf[len++] = 1;
+	buf[len++] = index % BENCH_GOP == 0 ? 0x65 : 0x41;
+	memset(buf + len, 0x55, s_frame_size - len);
+	return s_frame_size;
+}
+
+static void *writer_proc(void *arg)
+{
+	writer_t *w = (writer_t *)arg;
+	uint8_t *buf = (uint8_t *)malloc(s_frame_size);
+	uint64_t start_ns = get_monotonic_ns(), due_ns, now_ns;
+	frame_info info;
+	uint32_t i, len;
+
+	memset(&info, 0, sizeof(info));
+	for (i = 0; i < w->frames; i++) {
+		due_ns = start_ns + (uint64_t)i * 1000000000ULL / s_fps;
+		now_ns = get_monotonic_ns();
+		if (due_ns > now_ns)
+			usleep((due_ns - now_ns) / 1000);
+
+		len = build_frame(buf, i);
+		info.seq = i;
+		info.length = len;
+		info.capture_ns = get_monotonic_ns();
+		__atomic_store_n(&w->capture_ns[i], info.capture_ns, __ATOMIC_RELEASE);
+		if (shm_stream_put_annexb(w->writer, info, buf, len, 0) == 0)
+			w->put++;
+	}
+	free(buf);
+	return NULL;
+}
+
+// RTP 包的 marker 位表示一帧的最后一个包
+static void *receiver_proc(void *arg)
+{
+	receiver_t *rx = (receiver_t *)arg;
+	uint8_t buf[65536];
+	uint64_t capture_ns;
+	int32_t ret;
+
+	while (!__atomic_load_n(&rx->stop, __ATOMIC_RELAXED)) {
+		ret = recv(rx->fd, buf, sizeof(buf), 0);
+		if (ret < 12 || !(buf[1] & 0x80))
+			continue;
+		if (rx->received < rx->frames) {
+			capture_ns = __atomic_load_n(&rx->capture_ns[rx->received], __ATOMIC_ACQUIRE);
+			if (capture_ns != 0)
+				latency_stats_record_since(rx->stage, capture_ns);
+		}
+		rx->received++;
+	}
+	return NULL;
+}
+
+static void stop_loop(void *client_data)
+{
+	*(char *)client_data = 1;
+}
+
+static void find_stage(const latency_snapshot_t *snapshot, const char *name, latency_stage_summary_t *summary)
+{
+	int32_t i;
+
+	memset(summary, 0, sizeof(*summary));
+	for (i = 0; i < snapshot->stage_count; i++) {
+		if (strcmp(snapshot->stages[i].name, name) == 0) {
+			*summary = snapshot->stages[i];
+			return;
+		}
+	}
+}
+
+static int32_t run_latency(UsageEnvironment *env, latency_result_t *result)
+{
+	char shm_id[32], reader_id[32], shm_name[32];
+	struct sockaddr_in addr;
+	struct timeval timeout = {0, 100000};
+	latency_snapshot_t snapshot;
+	struct in_addr dst;
+	pthread_t wthread, rthread;
+	writer_t w;
+	receiver_t rx;
+	char done = 0;
+
+	memset(&w, 0, sizeof(w));
+	memset(&rx, 0, sizeof(rx));
+	w.frames = s_fps * s_seconds;
+	w.capture_ns = (uint64_t *)calloc(w.frames, sizeof(uint64_t));
+	snprintf(shm_id, sizeof(shm_id), "bench_w_%s", result->name);
+	snprintf(reader_id, sizeof(reader_id), "bench_r_%s", result->name);
+	snprintf(shm_name, sizeof(shm_name), "bench_%s", result->name);
+	w.writer = shm_stream_create(shm_id, shm_name, STREAM_MAX_USER, BENCH_ITEM_COUNT, BENCH_REGION_SIZE,
+		SHM_STREAM_WRITE_SPMC, SHM_STREAM_MALLOC);
+
+	rx.stage = latency_stats_stage("capture_to_recv");
+	rx.capture_ns = w.capture_ns;
+	rx.frames = w.frames;
+	rx.fd = socket(AF_INET, SOCK_DGRAM, 0);
+	setsockopt(rx.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(BENCH_RTP_PORT);
+	if (w.writer == NULL || bind(rx.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		printf("create shm stream or bind udp port %d failed\n", BENCH_RTP_PORT);
+		close(rx.fd);
+		shm_stream_destory(w.writer);
+		free(w.capture_ns);
+		return -1;
+	}
+
+	s_poll = result->poll;
+	dst.s_addr = htonl(INADDR_LOOPBACK);
+	Groupsock gs(*env, dst, Port(0), 255);
+	gs.changeDestinationParameters(dst, Port(BENCH_RTP_PORT), 255);
+	RTPSink *sink = H264VideoRTPSink::createNew(*env, &gs, 96);
+	H264MainVideoSource *main_source = H264MainVideoSource::createNew(*env, reader_id, shm_name, BENCH_REGION_SIZE,
+		s_fps, BENCH_REGION_SIZE, BENCH_ITEM_COUNT, false);
+	FramedSource *source = H264VideoStreamDiscreteFramer::createNew(*env, main_source);
+
+	// 清掉之前的统计
+	latency_stats_snapshot(NULL);
+	pthread_create(&rthread, NULL, receiver_proc, &rx);
+	pthread_create(&wthread, NULL, writer_proc, &w);
+	sink->startPlaying(*source, NULL, NULL);
+	// 写完之后再多跑一会，把最后几帧发出去
+	env->taskScheduler().scheduleDelayedTask((int64_t)s_seconds * 1000000 + 200000, stop_loop, &done);
+	env->taskScheduler().doEventLoop(&done);
+
+	pthread_join(wthread, NULL);
+	usleep(200 * 1000);
+	__atomic_store_n(&rx.stop, 1, __ATOMIC_RELAXED);
+	pthread_join(rthread, NULL);
+	close(rx.fd);
+
+	latency_stats_snapshot(&snapshot);
+	find_stage(&snapshot, "capture_to_rtsp", &result->rtsp);
+	find_stage(&snapshot, "capture_to_recv", &result->recv);
+	result->put = w.put;
+	result->received = rx.received;
+
+	sink->stopPlaying();
+	Medium::close(sink);
+	Medium::close(source);
+	shm_stream_destory(w.writer);
+	free(w.capture_ns);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-f fps] [-d seconds] [-s size]\n", name);
+	printf("  -f  帧率，默认 30\n");
+	printf("  -d  每轮的秒数，默认 5\n");
+	printf("  -s  每帧的字节数，默认 30000\n");
+}
+
+static void print_stage(const char *mode, const char *stage, const latency_stage_summary_t *s)
+{
+	printf("%7s %16s %7llu %9.3f %9.3f %9.3f %9.3f %9.3f\n", mode, stage, (unsigned long long)s->count,
+		s->mean_ns / 1e6, s->p50_ns / 1e6, s->p90_ns / 1e6, s->p99_ns / 1e6, s->max_ns / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	latency_result_t results[2];
+	int32_t opt, failed = 0;
+	uint32_t i;
+
+	while ((opt = getopt(argc, argv, "f:d:s:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			s_fps = atoi(optarg);
+			break;
+		case 'd':
+			s_seconds = atoi(optarg);
+			break;
+		case 's':
+			s_frame_size = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (s_fps == 0 || s_seconds == 0 || s_frame_size < 64) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	memset(results, 0, sizeof(results));
+	results[0].name = "poll";
+	results[0].poll = 1;
+	results[1].name = "notify";
+
+	TaskScheduler *scheduler = BasicTaskScheduler::createNew();
+	UsageEnvironment *env = BasicUsageEnvironment::createNew(*scheduler);
+	OutPacketBuffer::maxSize = s_frame_size + 1024;
+
+	for (i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+		if (run_latency(env, &results[i]) != 0)
+			return -1;
+		if (results[i].received != results[i].put) {
+			printf("%s: put %llu frames, received %llu\n", results[i].name,
+				(unsigned long long)results[i].put, (unsigned long long)results[i].received);
+			failed++;
+		}
+	}
+
+	printf("\n%u fps, %u frames of %u bytes per round over loopback\n", s_fps, s_fps * s_seconds, s_frame_size);
+	printf("%7s %16s %7s %9s %9s %9s %9s %9s\n", "mode", "stage", "count", "mean ms", "p50 ms", "p90 ms",
+		"p99 ms", "max ms");
+	for (i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+		print_stage(results[i].name, "capture_to_rtsp", &results[i].rtsp);
+		print_stage(results[i].name, "capture_to_recv", &results[i].recv);
+	}
+
+	env->reclaim();
+	delete scheduler;
+
+	printf("\n%s\n", failed == 0 ? "all checks passed" : "some checks failed");
+	return failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,285 @@
+/**
+ * stream_manager 读写性能测试
+ * 一个写线程按指定帧率(或不限速)写入，N 个读线程用 eventfd 等待新帧，front/post 读取，
+ * 分别测试加锁模式(SHM_STREAM_WRITE)和无锁模式(SHM_STREAM_WRITE_SPMC)，输出:
+ *   put/s      写端每秒写入帧数
+ *   read/s     每个读端每秒读到的帧数
+ *   lost       读端没读到(被覆盖或跳过)的帧占比
+ *   put        一次 shm_stream_put 的耗时
+ *   deliver    从写端开始 put 到读端 front 到这一帧的延时
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "utils_log.h"
+#include "time_utils.h"
+#include "stream_manager.h"
+#include "perf_common.h"
+
+#define BENCH_SHM_NAME		"bench_stream"
+#define BENCH_MAX_READERS	32
+#define BENCH_MAX_FRAMES	64
+#define BENCH_REGION_SIZE	(8 * 1024 * 1024)
+
+typedef struct
+{
+	SHM_STREAM_MODE_E	mode;
+	int32_t		readers;
+	int32_t		frame_size;
+	int32_t		fps;		// 0 表示不限速
+	int32_t		seconds;
+} bench_config_t;
+
+typedef struct
+{
+	bench_config_t		config;
+	double				put_rate;
+	double				read_rate;
+	double				lost;
+	latency_snapshot_t	snapshot;
+} bench_result_t;
+
+static volatile int32_t s_running = 0;
+static int32_t s_ready = 0;
+static uint64_t s_read_frames = 0;
+static int32_t s_stage_put = -1;
+static int32_t s_stage_read = -1;
+static int32_t s_stage_deliver = -1;
+
+static void *bench_reader_proc(void *arg)
+{
+	shm_stream_t *stream;
+	struct pollfd pfd;
+	frame_info info;
+	unsigned char *data;
+	unsigned int length;
+	uint64_t frames = 0, start_ns;
+	uint32_t sum = 0;
+	char id[32];
+
+	snprintf(id, sizeof(id), "bench_r%d", (int32_t)(intptr_t)arg);
+	stream = shm_stream_create(id, BENCH_SHM_NAME, BENCH_MAX_READERS + 1, BENCH_MAX_FRAMES,
+		BENCH_REGION_SIZE, SHM_STREAM_READ, SHM_STREAM_MALLOC);
+	if (stream == NULL)
+		return NULL;
+	pfd.fd = shm_stream_notify_fd(stream);
+	pfd.events = POLLIN;
+	__atomic_fetch_add(&s_ready, 1, __ATOMIC_RELEASE);
+
+	while (s_running) {
+		shm_stream_notify_clear(stream);
+		for (;;) {
+			start_ns = get_monotonic_ns();
+			if (shm_stream_front(stream, &info, &data, &length) != 0)
+				break;
+			latency_stats_record(s_stage_deliver, start_ns - info.capture_ns);
+			// 只摸一下首尾，模拟读端访问数据，不把拷贝的耗时算进来
+			if (length > 0)
+				sum += data[0] + data[length - 1];
+			shm_stream_post(stream);
+			latency_stats_record_since(s_stage_read, start_ns);
+			frames++;
+		}
+		if (pfd.fd >= 0)
+			poll(&pfd, 1, 10);
+		else
+			usleep(1000);
+	}
+
+	__atomic_fetch_add(&s_read_frames, frames, __ATOMIC_RELAXED);
+	shm_stream_destory(stream);
+	return (void *)(uintptr_t)sum;
+}
+
+static void bench_sleep_until(uint64_t deadline_ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline_ns / 1000000000ULL;
+	ts.tv_nsec = deadline_ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+		;
+}
+
+static int32_t bench_run(bench_config_t *config, bench_result_t *result)
+{
+	pthread_t threads[BENCH_MAX_READERS];
+	shm_stream_t *writer;
+	frame_info info;
+	unsigned char *buffer;
+	uint64_t start_ns, now_ns, next_ns, end_ns, puts = 0;
+	double seconds;
+	int32_t i;
+
+	buffer = malloc(config->frame_size);
+	if (buffer == NULL)
+		return -1;
+	memset(buffer, 0x5a, config->frame_size);
+
+	writer = shm_stream_create("bench_w", BENCH_SHM_NAME, BENCH_MAX_READERS + 1, BENCH_MAX_FRAMES,
+		BENCH_REGION_SIZE, config->mode, SHM_STREAM_MALLOC);
+	if (writer == NULL) {
+		free(buffer);
+		return -1;
+	}
+
+	s_running = 1;
+	s_ready = 0;
+	s_read_frames = 0;
+	for (i = 0; i < config->readers; i++)
+		pthread_create(&threads[i], NULL, bench_reader_proc, (void *)(intptr_t)i);
+	while (__atomic_load_n(&s_ready, __ATOMIC_ACQUIRE) < config->readers)
+		usleep(1000);
+
+	latency_stats_snapshot(NULL);
+	memset(&info, 0, sizeof(info));
+	start_ns = get_monotonic_ns();
+	end_ns = start_ns + (uint64_t)config->seconds * 1000000000ULL;
+	next_ns = start_ns;
+	do {
+		now_ns = get_monotonic_ns();
+		info.seq = (int)puts;
+		info.capture_ns = now_ns;
+		shm_stream_put(writer, info, buffer, config->frame_size);
+		latency_stats_record_since(s_stage_put, now_ns);
+		puts++;
+
+		if (config->fps > 0) {
+			next_ns += 1000000000ULL / config->fps;
+			bench_sleep_until(next_ns);
+		}
+	} while (get_monotonic_ns() < end_ns);
+	seconds = (get_monotonic_ns() - start_ns) / 1e9;
+
+	s_running = 0;
+	for (i = 0; i < config->readers; i++)
+		pthread_join(threads[i], NULL);
+	latency_stats_snapshot(&result->snapshot);
+
+	memcpy(&result->config, config, sizeof(*config));
+	result->put_rate = puts / seconds;
+	result->read_rate = s_read_frames / seconds / config->readers;
+	result->lost = 100.0 - 100.0 * s_read_frames / ((double)puts * config->readers);
+
+	shm_stream_destory(writer);
+	free(buffer);
+	return 0;
+}
+
+// shm_stream_create 会直接打印读端列表，结果等全部跑完再一起输出
+static void bench_print(bench_result_t *results, int32_t count)
+{
+	bench_result_t *result;
+	int32_t i;
+
+	printf("\n%-6s %7s %6s %10s %10s %7s %8s %8s %9s %8s %8s %9s %8s %8s %9s\n",
+		"mode", "readers", "fps", "put/s", "read/s", "lost",
+		"put_p50", "put_p99", "put_max", "get_p50", "get_p99", "get_max",
+		"dlv_p50", "dlv_p99", "dlv_max");
+	for (i = 0; i < count; i++) {
+		result = &results[i];
+		printf("%-6s %7d %6d %10.0f %10.0f %6.2f%%",
+			result->config.mode == SHM_STREAM_WRITE_SPMC ? "spmc" : "mutex",
+			result->config.readers, result->config.fps,
+			result->put_rate, result->read_rate, result->lost);
+		perf_print_latency(&result->snapshot, "put");
+		perf_print_latency(&result->snapshot, "read");
+		perf_print_latency(&result->snapshot, "deliver");
+		printf("\n");
+	}
+	printf("latency columns are in us, get is front + post\n");
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-m mutex|spmc|all] [-r readers] [-s frame_size] [-f fps] [-t seconds]\n", name);
+	printf("  -m  测试的模式，默认 all\n");
+	printf("  -r  读端个数列表，逗号分隔，默认 1,4,16，最多 %d\n", BENCH_MAX_READERS);
+	printf("  -s  帧大小，默认 65536\n");
+	printf("  -f  限速测试的写入帧率，默认 1000，每组读端个数先跑一次不限速再跑一次限速\n");
+	printf("  -t  每一轮的时间(秒)，默认 3\n");
+}
+
+int main(int argc, char **argv)
+{
+	SHM_STREAM_MODE_E modes[2] = {SHM_STREAM_WRITE, SHM_STREAM_WRITE_SPMC};
+	int32_t readers[16] = {1, 4, 16}, reader_count = 3;
+	int32_t mode_begin = 0, mode_end = 2, fps = 1000;
+	static bench_result_t results[2 * 16 * 2];
+	int32_t result_count = 0;
+	bench_config_t config;
+	char *token, *save = NULL;
+	int32_t opt, m, r, f;
+
+	memset(&config, 0, sizeof(config));
+	config.frame_size = 65536;
+	config.seconds = 3;
+
+	while ((opt = getopt(argc, argv, "m:r:s:f:t:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			mode_begin = strcmp(optarg, "spmc") == 0 ? 1 : 0;
+			mode_end = strcmp(optarg, "mutex") == 0 ? 1 : 2;
+			break;
+		case 'r':
+			reader_count = 0;
+			for (token = strtok_r(optarg, ",", &save); token != NULL && reader_count < 16;
+				token = strtok_r(NULL, ",", &save)) {
+				r = atoi(token);
+				if (r > 0 && r <= BENCH_MAX_READERS)
+					readers[reader_count++] = r;
+			}
+			break;
+		case 's':
+			config.frame_size = atoi(optarg);
+			break;
+		case 'f':
+			fps = atoi(optarg);
+			break;
+		case 't':
+			config.seconds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (reader_count == 0 || config.frame_size <= 0 || config.frame_size > BENCH_REGION_SIZE
+		|| config.seconds <= 0 || fps < 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	log_ctrl_level_set(NULL, LOG_ERR);
+	s_stage_put = latency_stats_stage("put");
+	s_stage_read = latency_stats_stage("read");
+	s_stage_deliver = latency_stats_stage("deliver");
+
+	for (m = mode_begin; m < mode_end; m++) {
+		for (r = 0; r < reader_count; r++) {
+			for (f = 0; f < 2; f++) {
+				config.mode = modes[m];
+				config.readers = readers[r];
+				config.fps = f == 0 ? 0 : fps;
+				if (f == 1 && fps == 0)
+					continue;
+				if (bench_run(&config, &results[result_count++]) != 0) {
+					printf("run %s with %d readers failed\n", m ? "spmc" : "mutex", readers[r]);
+					return -1;
+				}
+			}
+		}
+	}
+
+	printf("\nframe size %d, %d frames, region %d bytes, %ds per run\n",
+		config.frame_size, BENCH_MAX_FRAMES, BENCH_REGION_SIZE, config.seconds);
+	bench_print(results, result_count);
+	return 0;
+}
@@ -0,0 +1,521 @@
+/**
+ * stream_manager 外部缓冲区(shm_stream_put_external)引用计数测试
+ * 1. 单线程用例: 两个读端按 front/post、get、sync、destory、被写端套圈、写端先销毁等方式读取，
+ *    检查 release 回调在最后一个读端放开之前不会被调用，读端正在使用的缓冲区写端不会归还，并且每个缓冲区只归还一次
+ * 2. 多线程用例: 写端从一个比 info 数组小(或大)的缓冲池取缓冲区，写入帧序号后发布，
+ *    读端随机使用 front/post、get、sync 和重新创建读端(包括 front 之后不 post)，持有期间检查缓冲区内容，
+ *    缓冲区被提前归还时会被写端改写，读端就能发现
+ * 3. shm_stream_front_valid: 共享内存中的帧被写端覆盖后作废，外部缓冲区帧在 post 之前始终有效
+ * 全部通过返回 0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "utils_log.h"
+#include "stream_manager.h"
+
+#define TEST_MAX_USERS		8
+#define TEST_MAX_FRAMES		16
+#define TEST_REGION_SIZE	(64 * 1024)
+#define TEST_BUFFER_SIZE	256
+#define TEST_POOL_SIZE		8
+#define TEST_READERS		4
+#define TEST_FRAMES			200000
+
+#define TEST_CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("[%s][%d] check failed: %s\n", __FUNCTION__, __LINE__, #cond); \
+		s_failed++; \
+		return -1; \
+	} \
+} while (0)
+
+typedef struct
+{
+	unsigned char	data[TEST_BUFFER_SIZE];
+	int32_t			released;	// release 回调次数
+	int32_t			in_use;		// 已经交给 stream_manager，还没有归还
+} test_buffer_t;
+
+static int32_t s_failed = 0;
+static const char *s_shm_name = NULL;	// 每个用例用自己的名字，失败的用例没有销毁的读端不会影响后面的用例
+static test_buffer_t s_buffers[TEST_MAX_FRAMES * 2];
+
+static void test_buffer_release(void *opaque, unsigned char *data)
+{
+	test_buffer_t *buffer = (test_buffer_t *)opaque;
+
+	if (data != buffer->data || !__atomic_load_n(&buffer->in_use, __ATOMIC_ACQUIRE)) {
+		printf("[%s] buffer %p released twice or with wrong data\n", __FUNCTION__, (void *)buffer);
+		__atomic_fetch_add(&s_failed, 1, __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_add(&buffer->released, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&buffer->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static int32_t test_put(shm_stream_t *writer, test_buffer_t *buffer, int32_t seq)
+{
+	frame_info info;
+
+	memset(&info, 0, sizeof(info));
+	info.seq = seq;
+	memset(buffer->data, seq & 0xff, sizeof(buffer->data));
+	buffer->released = 0;
+	__atomic_store_n(&buffer->in_use, 1, __ATOMIC_RELEASE);
+	if (shm_stream_put_external(writer, info, buffer->data, sizeof(buffer->data), test_buffer_release, buffer) != 0) {
+		buffer->in_use = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static shm_stream_t *test_reader(const char *id)
+{
+	return shm_stream_create((char *)id, s_shm_name, TEST_MAX_USERS, TEST_MAX_FRAMES,
+		TEST_REGION_SIZE, SHM_STREAM_READ, SHM_STREAM_MALLOC);
+}
+
+static shm_stream_t *test_writer(void)
+{
+	return shm_stream_create("test_w", s_shm_name, TEST_MAX_USERS, TEST_MAX_FRAMES,
+		TEST_REGION_SIZE, SHM_STREAM_WRITE_SPMC, SHM_STREAM_MALLOC);
+}
+
+static int32_t test_front(shm_stream_t *reader, test_buffer_t *buffer)
+{
+	frame_info info;
+	unsigned char *data;
+	unsigned int length;
+
+	TEST_CHECK(shm_stream_front(reader, &info, &data, &length) == 0);
+	TEST_CHECK(data == buffer->data && length == TEST_BUFFER_SIZE);
+	return 0;
+}
+
+static int32_t test_get(shm_stream_t *reader, test_buffer_t *buffer)
+{
+	frame_info info;
+	unsigned char *data;
+	unsigned int length;
+
+	TEST_CHECK(shm_stream_get(reader, &info, &data, &length) == 0);
+	TEST_CHECK(data == buffer->data && length == TEST_BUFFER_SIZE);
+	return 0;
+}
+
+// 两个读端都 front/post，最后一个 post 之后才归还
+static int32_t test_front_post(void)
+{
+	shm_stream_t *writer = test_writer();
+	shm_stream_t *a = test_reader("test_a");
+	shm_stream_t *b = test_reader("test_b");
+	test_buffer_t *buffer = &s_buffers[0];
+
+	TEST_CHECK(test_put(writer, buffer, 1) == 0);
+	TEST_CHECK(test_front(a, buffer) == 0);
+	TEST_CHECK(test_front(b, buffer) == 0);
+	shm_stream_post(a);
+	TEST_CHECK(buffer->released == 0);
+	TEST_CHECK(test_front(b, buffer) == 0);
+	shm_stream_post(b);
+	TEST_CHECK(buffer->released == 1);
+
+	shm_stream_destory(a);
+	shm_stream_destory(b);
+	shm_stream_destory(writer);
+	TEST_CHECK(buffer->released == 1);
+	return 0;
+}
+
+// front 之后 sync，只释放一次
+static int32_t test_front_sync(void)
+{
+	shm_stream_t *writer = test_writer();
+	shm_stream_t *a = test_reader("test_a");
+	shm_stream_t *b = test_reader("test_b");
+	test_buffer_t *first = &s_buffers[0], *second = &s_buffers[1];
+
+	TEST_CHECK(test_put(writer, first, 1) == 0);
+	TEST_CHECK(test_put(writer, second, 2) == 0);
+	TEST_CHECK(test_front(a, first) == 0);
+	TEST_CHECK(shm_stream_sync(a) == 0);
+	TEST_CHECK(first->released == 0 && second->released == 0);
+
+	TEST_CHECK(test_front(b, first) == 0);
+	shm_stream_post(b);
+	TEST_CHECK(first->released == 1);
+	TEST_CHECK(test_front(b, second) == 0);
+	TEST_CHECK(second->released == 0);
+	shm_stream_post(b);
+	TEST_CHECK(second->released == 1);
+
+	shm_stream_destory(a);
+	shm_stream_destory(b);
+	shm_stream_destory(writer);
+	TEST_CHECK(first->released == 1 && second->released == 1);
+	return 0;
+}
+
+// front 之后直接退出读端，只释放一次
+static int32_t test_front_destory(void)
+{
+	shm_stream_t *writer = test_writer();
+	shm_stream_t *a = test_reader("test_a");
+	shm_stream_t *b = test_reader("test_b");
+	test_buffer_t *first = &s_buffers[0], *second = &s_buffers[1];
+
+	TEST_CHECK(test_put(writer, first, 1) == 0);
+	TEST_CHECK(test_put(writer, second, 2) == 0);
+	TEST_CHECK(test_front(a, first) == 0);
+	shm_stream_destory(a);
+	TEST_CHECK(first->released == 0 && second->released == 0);
+
+	TEST_CHECK(test_front(b, first) == 0);
+	shm_stream_post(b);
+	TEST_CHECK(first->released == 1);
+	TEST_CHECK(test_front(b, second) == 0);
+	shm_stream_post(b);
+	TEST_CHECK(second->released == 1);
+
+	shm_stream_destory(b);
+	shm_stream_destory(writer);
+	TEST_CHECK(first->released == 1 && second->released == 1);
+	return 0;
+}
+
+// get 持有到下一次 get，中间不会被另一个读端的释放带走
+static int32_t test_get_hold(void)
+{
+	shm_stream_t *writer = test_writer();
+	shm_stream_t *a = test_reader("test_a");
+	shm_stream_t *b = test_reader("test_b");
+	test_buffer_t *first = &s_buffers[0], *second = &s_buffers[1];
+
+	TEST_CHECK(test_put(writer, first, 1) == 0);
+	TEST_CHECK(test_get(a, first) == 0);
+	TEST_CHECK(test_get(b, first) == 0);
+	TEST_CHECK(test_put(writer, second, 2) == 0);
+	TEST_CHECK(test_get(a, second) == 0);
+	TEST_CHECK(first->released == 0);
+	TEST_CHECK(test_get(b, second) == 0);
+	TEST_CHECK(first->released == 1 && second->released == 0);
+
+	shm_stream_destory(a);
+	TEST_CHECK(second->released == 0);
+	shm_stream_destory(b);
+	TEST_CHECK(second->released == 1);
+	shm_stream_destory(writer);
+	return 0;
+}
+
+// 读端 front 着一帧被写端套圈，写端跳过这一帧的 info，持有期间不归还也不改写，跳过的帧和持有的帧都只释放一次
+static int32_t test_front_overrun(void)
+{
+	shm_stream_t *writer = test_writer();
+	shm_stream_t *a = test_reader("test_a");
+	shm_stream_t *b = test_reader("test_b");
+	int32_t count = TEST_MAX_FRAMES * 2, i;
+	frame_info info;
+	unsigned char *data;
+	unsigned int length;
+
+	TEST_CHECK(test_put(writer, &s_buffers[0], 0) == 0);
+	TEST_CHECK(test_front(a, &s_buffers[0]) == 0);
+	for (i = 1; i < TEST_MAX_FRAMES; i++)
+		TEST_CHECK(test_put(writer, &s_buffers[i], i) == 0);
+	// b 读完所有帧，之后只剩 a 的引用
+	shm_stream_sync(b);
+	TEST_CHECK(s_buffers[0].released == 0);
+
+	// 写端已经写满，a 仍然在使用第 0 帧
+	for (i = TEST_MAX_FRAMES; i < count; i++) {
+		TEST_CHECK(test_put(writer, &s_buffers[i], i) == 0);
+		shm_stream_sync(b);
+		TEST_CHECK(s_buffers[0].released == 0);
+	}
+	for (i = 0; i < TEST_BUFFER_SIZE; i++)
+		TEST_CHECK(s_buffers[0].data[i] == 0);
+	TEST_CHECK(shm_stream_front_valid(a) == 1);
+
+	// a 再次 front 时第 0 帧已经作废，跳到仍然有效的帧，同时放开第 0 帧
+	TEST_CHECK(shm_stream_front(a, &info, &data, &length) == 0);
+	TEST_CHECK(info.seq > 0 && info.seq < count && data == s_buffers[info.seq].data);
+	TEST_CHECK(s_buffers[0].released == 1);
+	shm_stream_post(a);
+
+	shm_stream_destory(a);
+	shm_stream_destory(b);
+	shm_stream_destory(writer);
+	for (i = 0; i < count; i++)
+		TEST_CHECK(s_buffers[i].released == 1);
+	return 0;
+}
+
+// 共享内存中的帧在数据区或 info 被写端复用后作废
+static int32_t test_front_valid(void)
+{
+	shm_stream_t *writer = test_writer();
+	shm_stream_t *a = test_reader("test_a");
+	static unsigned char payload[TEST_REGION_SIZE / 4];
+	frame_info info;
+	unsigned char *data;
+	unsigned int length;
+	int32_t i;
+
+	memset(&info, 0, sizeof(info));
+
+	// 数据区被覆盖
+	TEST_CHECK(shm_stream_put(writer, info, payload, sizeof(payload)) == 0);
+	TEST_CHECK(shm_stream_front(a, &info, &data, &length) == 0 && length == sizeof(payload));
+	for (i = 0; i < 3; i++) {
+		TEST_CHECK(shm_stream_put(writer, info, payload, sizeof(payload)) == 0);
+		TEST_CHECK(shm_stream_front_valid(a) == 1);
+	}
+	TEST_CHECK(shm_stream_put(writer, info, payload, sizeof(payload)) == 0);
+	TEST_CHECK(shm_stream_front_valid(a) == 0);
+	shm_stream_post(a);
+	shm_stream_sync(a);
+
+	// info 被复用
+	TEST_CHECK(shm_stream_put(writer, info, payload, 16) == 0);
+	TEST_CHECK(shm_stream_front(a, &info, &data, &length) == 0 && length == 16);
+	for (i = 1; i < TEST_MAX_FRAMES; i++)
+		TEST_CHECK(shm_stream_put(writer, info, payload, 16) == 0);
+	TEST_CHECK(shm_stream_front_valid(a) == 1);
+	TEST_CHECK(shm_stream_put(writer, info, payload, 16) == 0);
+	TEST_CHECK(shm_stream_front_valid(a) == 0);
+	shm_stream_post(a);
+
+	shm_stream_destory(a);
+	shm_stream_destory(writer);
+	return 0;
+}
+
+// 写端先销毁，读端正在使用的帧由读端 post 时归还，没读过的帧写端销毁时归还
+static int32_t test_writer_destory(void)
+{
+	shm_stream_t *writer = test_writer();
+	shm_stream_t *a = test_reader("test_a");
+	shm_stream_t *b = test_reader("test_b");
+	test_buffer_t *first = &s_buffers[0], *second = &s_buffers[1];
+
+	TEST_CHECK(test_put(writer, first, 1) == 0);
+	TEST_CHECK(test_put(writer, second, 2) == 0);
+	TEST_CHECK(test_front(a, first) == 0);
+	shm_stream_destory(writer);
+	TEST_CHECK(first->released == 0 && second->released == 1);
+
+	// b 没有读过第一帧，销毁时不能归还 a 正在使用的缓冲区
+	shm_stream_destory(b);
+	TEST_CHECK(first->released == 0);
+	shm_stream_post(a);
+	TEST_CHECK(first->released == 1);
+	shm_stream_destory(a);
+	TEST_CHECK(first->released == 1 && second->released == 1);
+	return 0;
+}
+
+typedef struct
+{
+	shm_stream_t	*writer;
+	pthread_mutex_t	lock;
+	int32_t			running;
+	int32_t			readers;
+	uint64_t		checked;
+} test_stress_t;
+
+static int32_t test_check_frame(frame_info *info, unsigned char *data, unsigned int length)
+{
+	unsigned int i;
+
+	if (length != TEST_BUFFER_SIZE)
+		return -1;
+	for (i = 0; i < length; i += 31) {
+		if (data[i] != (unsigned char)(info->seq & 0xff))
+			return -1;
+	}
+	return data[length - 1] == (unsigned char)(info->seq & 0xff) ? 0 : -1;
+}
+
+static void *test_stress_reader(void *arg)
+{
+	test_stress_t *stress = (test_stress_t *)arg;
+	unsigned int seed = (unsigned int)(uintptr_t)pthread_self();
+	shm_stream_t *reader;
+	frame_info info;
+	unsigned char *data;
+	unsigned int length;
+	uint64_t checked = 0;
+	char id[32];
+	int32_t op;
+
+	snprintf(id, sizeof(id), "test_r%d", __atomic_fetch_add(&stress->readers, 1, __ATOMIC_RELAXED));
+	pthread_mutex_lock(&stress->lock);
+	reader = test_reader(id);
+	pthread_mutex_unlock(&stress->lock);
+
+	while (__atomic_load_n(&stress->running, __ATOMIC_ACQUIRE)) {
+		op = rand_r(&seed) % 100;
+		if (op < 60) {
+			if (shm_stream_front(reader, &info, &data, &length) != 0) {
+				sched_yield();
+				continue;
+			}
+			sched_yield();
+			if (test_check_frame(&info, data, length) != 0) {
+				printf("[%s] reader %s frame %d changed while reading by front\n", __FUNCTION__, id, info.seq);
+				__atomic_fetch_add(&s_failed, 1, __ATOMIC_RELAXED);
+			}
+			checked++;
+			// front 之后不 post，直接 sync 或退出读端
+			op = rand_r(&seed) % 100;
+			if (op < 90) {
+				shm_stream_post(reader);
+			} else if (op < 95) {
+				shm_stream_sync(reader);
+			} else {
+				pthread_mutex_lock(&stress->lock);
+				shm_stream_destory(reader);
+				reader = test_reader(id);
+				pthread_mutex_unlock(&stress->lock);
+			}
+		} else if (op < 95) {
+			if (shm_stream_get(reader, &info, &data, &length) != 0) {
+				sched_yield();
+				continue;
+			}
+			sched_yield();
+			if (test_check_frame(&info, data, length) != 0) {
+				printf("[%s] reader %s frame %d changed while reading by get\n", __FUNCTION__, id, info.seq);
+				__atomic_fetch_add(&s_failed, 1, __ATOMIC_RELAXED);
+			}
+			checked++;
+		} else if (op < 98) {
+			shm_stream_sync(reader);
+		} else {
+			// 读端退出再重新注册
+			pthread_mutex_lock(&stress->lock);
+			shm_stream_destory(reader);
+			reader = test_reader(id);
+			pthread_mutex_unlock(&stress->lock);
+		}
+	}
+
+	pthread_mutex_lock(&stress->lock);
+	shm_stream_destory(reader);
+	pthread_mutex_unlock(&stress->lock);
+	__atomic_fetch_add(&stress->checked, checked, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/**
+ * 缓冲池比 info 数组小时写端不会复用还没归还的 info，读端看到的内容变化只可能是提前归还
+ * 缓冲池比 info 数组大时写端会复用还没读完的 info，读端正在使用的缓冲区必须跳过，不能归还后被改写
+*/
+static int32_t test_stress_pool(int32_t pool)
+{
+	test_stress_t stress;
+	pthread_t threads[TEST_READERS];
+	test_buffer_t *buffer;
+	int32_t i, seq, put = 0, released = 0;
+
+	memset(&stress, 0, sizeof(stress));
+	pthread_mutex_init(&stress.lock, NULL);
+	stress.writer = test_writer();
+	stress.running = 1;
+	for (i = 0; i < pool; i++)
+		memset(&s_buffers[i], 0, sizeof(s_buffers[i]));
+	for (i = 0; i < TEST_READERS; i++)
+		pthread_create(&threads[i], NULL, test_stress_reader, &stress);
+	for (;;) {
+		pthread_mutex_lock(&stress.lock);
+		i = shm_stream_readers(stress.writer);
+		pthread_mutex_unlock(&stress.lock);
+		if (i >= TEST_READERS)
+			break;
+		usleep(1000);
+	}
+
+	for (seq = 0; seq < TEST_FRAMES; seq++) {
+		buffer = NULL;
+		while (buffer == NULL) {
+			for (i = 0; i < pool; i++) {
+				if (!__atomic_load_n(&s_buffers[i].in_use, __ATOMIC_ACQUIRE)) {
+					buffer = &s_buffers[i];
+					break;
+				}
+			}
+			if (buffer == NULL)
+				sched_yield();
+		}
+		released += buffer->released;
+		// 读端注册和退出时修改读用户数没有原子操作，测试里和写端互斥
+		pthread_mutex_lock(&stress.lock);
+		if (test_put(stress.writer, buffer, seq) == 0)
+			put++;
+		pthread_mutex_unlock(&stress.lock);
+		// 缓冲池够大时写端不会等读端，让出 CPU 让读端跟上，否则读端总是被套圈
+		if (pool > TEST_MAX_FRAMES)
+			sched_yield();
+	}
+
+	__atomic_store_n(&stress.running, 0, __ATOMIC_RELEASE);
+	for (i = 0; i < TEST_READERS; i++)
+		pthread_join(threads[i], NULL);
+	shm_stream_destory(stress.writer);
+	for (i = 0; i < pool; i++) {
+		released += s_buffers[i].released;
+		TEST_CHECK(s_buffers[i].in_use == 0);
+	}
+	pthread_mutex_destroy(&stress.lock);
+
+	printf("[%s] pool %d, put %d frames, released %d, readers checked %llu frames\n",
+		__FUNCTION__, pool, put, released, (unsigned long long)stress.checked);
+	TEST_CHECK(released == put);
+	return 0;
+}
+
+static int32_t test_stress(void)
+{
+	return test_stress_pool(TEST_POOL_SIZE);
+}
+
+static int32_t test_stress_reuse(void)
+{
+	return test_stress_pool(TEST_MAX_FRAMES * 2);
+}
+
+int main(int argc, char **argv)
+{
+	struct
+	{
+		const char	*name;
+		int32_t		(*func)(void);
+	} tests[] = {
+		{"front_post", test_front_post},
+		{"front_sync", test_front_sync},
+		{"front_destory", test_front_destory},
+		{"get_hold", test_get_hold},
+		{"front_overrun", test_front_overrun},
+		{"writer_destory", test_writer_destory},
+		{"front_valid", test_front_valid},
+		{"stress", test_stress},
+		{"stress_reuse", test_stress_reuse},
+	};
+	int32_t i, failed;
+
+	log_ctrl_level_set(NULL, LOG_ERR);
+	for (i = 0; i < (int32_t)(sizeof(tests) / sizeof(tests[0])); i++) {
+		memset(s_buffers, 0, sizeof(s_buffers));
+		failed = s_failed;
+		s_shm_name = tests[i].name;
+		tests[i].func();
+		printf("%-16s %s\n", tests[i].name, s_failed == failed ? "PASS" : "FAIL");
+	}
+	return s_failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,379 @@
+/**
+ * websocket 发送视频帧性能测试
+ * 对比原来的拷贝发送(malloc 一帧大小的缓冲区拷贝 wfs 头和数据，encodeBinary 再拷贝一次，然后 send)
+ * 和现在的 ws_sendv(帧头在栈上，和 wfs 头、数据一起 sendmsg，socket 忙时剩余部分才拷贝到发送队列)
+ * 1. 一致性: RFC6455 和 Hybi-00 客户端，不同长度的数据，ws_sendv 发出的字节必须和 encodeBinary 完全一致
+ * 2. 性能: M 个客户端(socketpair)，一个线程发送，一个线程用 epoll 接收，
+ *    统计发送线程每帧每个客户端的 CPU 耗时和吞吐，socket 忙时和 reactor 一样用 ws_client_flush 发送剩余部分
+ * 一致性检查失败或收到的字节数不对时返回 -1
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "utils/utils_log.h"
+#include "utils/time_utils.h"
+#include "Communicate.h"
+
+#define BENCH_MAX_CLIENTS	64
+#define BENCH_MAX_SIZES		16
+#define BENCH_WFS_HEADER	12
+#define BENCH_SOCKET_BUFFER	(4 * 1024 * 1024)
+
+typedef struct
+{
+	int32_t		count;
+	int32_t		fds[BENCH_MAX_CLIENTS];	// 接收端
+	uint64_t	expected;
+	uint64_t	received;
+} receiver_t;
+
+static int32_t s_failed = 0;
+static int32_t s_frames = 1000;
+
+static double rusage_seconds(const struct rusage *r)
+{
+	return r->ru_utime.tv_sec + r->ru_utime.tv_usec / 1e6 + r->ru_stime.tv_sec + r->ru_stime.tv_usec / 1e6;
+}
+
+static ws_client *bench_client_new(int32_t fd, ws_header *headers)
+{
+	ws_client *n = client_new(fd, "bench");
+
+	n->headers = headers;
+	return n;
+}
+
+// 原来 ws_send_nalu_to_wfs 的发送方式
+static int32_t copy_send(ws_client *n, uint32_t header_info, uint64_t timestamp, unsigned char *data, uint64_t length)
+{
+	ws_message *m = message_new();
+	char *buf, *temp;
+	uint64_t len, sent = 0;
+	ssize_t ret;
+
+	m->len = length + sizeof(header_info) + sizeof(timestamp);
+	temp = malloc(m->len + 1);
+	memset(temp, '\0', m->len + 1);
+	memcpy(temp, &header_info, sizeof(header_info));
+	memcpy(temp + sizeof(header_info), &timestamp, sizeof(timestamp));
+	memcpy(temp + sizeof(header_info) + sizeof(timestamp), data, length);
+	m->msg = temp;
+	if (encodeBinary(m) != CONTINUE) {
+		message_free(m);
+		free(m);
+		return -1;
+	}
+
+	buf = n->headers->type == HYBI00 ? m->hybi00 : m->enc;
+	len = n->headers->type == HYBI00 ? m->len + 2 : m->enc_len;
+	while (sent < len) {
+		ret = send(n->socket_id, buf + sent, len - sent, MSG_NOSIGNAL);
+		if (ret <= 0)
+			break;
+		sent += ret;
+	}
+	message_free(m);
+	free(m);
+	return sent == len ? 0 : -1;
+}
+
+// 发送后像 reactor 一样把发送队列里剩余的数据发完
+static int32_t iov_send(ws_client *n, uint32_t header_info, uint64_t timestamp, unsigned char *data, uint64_t length)
+{
+	char wfs_header[BENCH_WFS_HEADER];
+	struct iovec iov[2];
+	struct pollfd pfd;
+	int32_t ret;
+
+	memcpy(wfs_header, &header_info, sizeof(header_info));
+	memcpy(wfs_header + sizeof(header_info), &timestamp, sizeof(timestamp));
+	iov[0].iov_base = wfs_header;
+	iov[0].iov_len = sizeof(wfs_header);
+	iov[1].iov_base = data;
+	iov[1].iov_len = length;
+	if (ws_sendv(n, iov, 2) != 0)
+		return -1;
+
+	pfd.fd = n->socket_id;
+	pfd.events = POLLOUT;
+	while (1) {
+		pthread_mutex_lock(&n->out_lock);
+		ret = ws_client_flush(n);
+		pthread_mutex_unlock(&n->out_lock);
+		if (ret <= 0)
+			return ret;
+		poll(&pfd, 1, 100);
+	}
+}
+
+static void *receiver_proc(void *arg)
+{
+	receiver_t *rx = (receiver_t *)arg;
+	struct epoll_event ev, events[BENCH_MAX_CLIENTS];
+	char buf[65536];
+	int32_t epfd, i, count;
+	ssize_t ret;
+
+	epfd = epoll_create1(0);
+	for (i = 0; i < rx->count; i++) {
+		ev.events = EPOLLIN;
+		ev.data.fd = rx->fds[i];
+		epoll_ctl(epfd, EPOLL_CTL_ADD, rx->fds[i], &ev);
+	}
+	while (rx->received < rx->expected) {
+		count = epoll_wait(epfd, events, BENCH_MAX_CLIENTS, 1000);
+		if (count <= 0)
+			break;
+		for (i = 0; i < count; i++) {
+			ret = recv(events[i].data.fd, buf, sizeof(buf), MSG_DONTWAIT);
+			if (ret > 0)
+				rx->received += ret;
+		}
+	}
+	close(epfd);
+	return NULL;
+}
+
+static int32_t socket_pair(int32_t sv[2])
+{
+	int32_t size = BENCH_SOCKET_BUFFER;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+		return -1;
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	return 0;
+}
+
+typedef struct
+{
+	int32_t		fd;
+	unsigned char	*buf;
+	uint64_t	size;
+	uint64_t	len;
+} capture_t;
+
+static void *capture_proc(void *arg)
+{
+	capture_t *cap = (capture_t *)arg;
+	ssize_t ret;
+
+	while (cap->len < cap->size && (ret = read(cap->fd, cap->buf + cap->len, cap->size - cap->len)) > 0)
+		cap->len += ret;
+	return NULL;
+}
+
+// 用 copy_send 或 iov_send 发送一帧，接收端收到的字节放在 cap 里
+static int32_t capture_send(int32_t use_iov, ws_header *headers, unsigned char *data, uint64_t length,
+	capture_t *cap)
+{
+	pthread_t thread;
+	ws_client *n;
+	int32_t sv[2], ret;
+
+	if (socket_pair(sv) != 0)
+		return -1;
+	cap->fd = sv[1];
+	cap->len = 0;
+	pthread_create(&thread, NULL, capture_proc, cap);
+	n = bench_client_new(sv[0], headers);
+	if (use_iov)
+		ret = iov_send(n, 0x12345678, length, data, length);
+	else
+		ret = copy_send(n, 0x12345678, length, data, length);
+	shutdown(sv[0], SHUT_WR);
+	pthread_join(thread, NULL);
+	close(sv[0]);
+	close(sv[1]);
+	pthread_mutex_destroy(&n->out_lock);
+	free(n);
+	return ret;
+}
+
+static void check_same_bytes(void)
+{
+	// 覆盖 RFC6455 7 位、16 位、64 位长度的边界(数据前面还有 12 字节的 wfs 头)
+	static const uint64_t lengths[] = {0, 5, 113, 114, 1000, 65523, 65524, 300000};
+	ws_header headers;
+	capture_t expected, got;
+	unsigned char *data;
+	int32_t type, i, failed = s_failed;
+
+	data = malloc(300000);
+	for (i = 0; i < 300000; i++)
+		data[i] = rand();
+	expected.size = got.size = 300000 + 64;
+	expected.buf = malloc(expected.size);
+	got.buf = malloc(got.size);
+
+	for (type = 0; type < 2; type++) {
+		memset(&headers, 0, sizeof(headers));
+		headers.type = type ? HYBI00 : RFC6455;
+		for (i = 0; i < (int32_t)(sizeof(lengths) / sizeof(lengths[0])); i++) {
+			if (capture_send(0, &headers, data, lengths[i], &expected) != 0
+				|| capture_send(1, &headers, data, lengths[i], &got) != 0
+				|| got.len != expected.len || memcmp(got.buf, expected.buf, got.len) != 0) {
+				printf("[%s] %s %llu bytes: ws_sendv sent %llu bytes, expected %llu\n", __FUNCTION__,
+					type ? "hybi00" : "rfc6455", (unsigned long long)lengths[i],
+					(unsigned long long)got.len, (unsigned long long)expected.len);
+				s_failed++;
+			}
+		}
+	}
+	free(expected.buf);
+	free(got.buf);
+	free(data);
+	printf("ws_sendv output %s encodeBinary\n", s_failed == failed ? "matches" : "differs from");
+}
+
+// 每帧依次发给所有客户端，输出发送线程每帧每个客户端的 CPU 耗时(us)和接收端的吞吐
+static int32_t run_send(int32_t use_iov, int32_t clients, uint64_t length, double *cpu_us, double *mbps)
+{
+	ws_client *n[BENCH_MAX_CLIENTS];
+	ws_header headers;
+	receiver_t rx;
+	pthread_t thread;
+	struct rusage r0, r1;
+	unsigned char *data;
+	uint64_t frame_len, start_ns, end_ns;
+	int32_t sv[2], i, j, ret = 0;
+
+	memset(&headers, 0, sizeof(headers));
+	headers.type = RFC6455;
+	memset(&rx, 0, sizeof(rx));
+	for (i = 0; i < clients; i++) {
+		if (socket_pair(sv) != 0) {
+			printf("socketpair failed\n");
+			clients = i;
+			ret = -1;
+			goto exit;
+		}
+		n[i] = bench_client_new(sv[0], &headers);
+		rx.fds[i] = sv[1];
+		rx.count++;
+	}
+	data = malloc(length);
+	memset(data, 0x5a, length);
+	frame_len = BENCH_WFS_HEADER + length;
+	frame_len += frame_len < 126 ? 2 : (frame_len <= 0xffff ? 4 : 10);
+	rx.expected = frame_len * clients * s_frames;
+	pthread_create(&thread, NULL, receiver_proc, &rx);
+
+	getrusage(RUSAGE_THREAD, &r0);
+	start_ns = get_monotonic_ns();
+	for (i = 0; i < s_frames && ret == 0; i++) {
+		for (j = 0; j < clients && ret == 0; j++) {
+			if (use_iov)
+				ret = iov_send(n[j], 0x1, i, data, length);
+			else
+				ret = copy_send(n[j], 0x1, i, data, length);
+		}
+	}
+	end_ns = get_monotonic_ns();
+	getrusage(RUSAGE_THREAD, &r1);
+	pthread_join(thread, NULL);
+	free(data);
+
+	*cpu_us = (rusage_seconds(&r1) - rusage_seconds(&r0)) * 1e6 / ((double)s_frames * clients);
+	*mbps = rx.received * 8.0 * 1e3 / (end_ns - start_ns);
+	if (ret != 0 || rx.received != rx.expected) {
+		printf("%s %d clients %llu bytes: received %llu bytes, expected %llu\n", use_iov ? "writev" : "copy",
+			clients, (unsigned long long)length, (unsigned long long)rx.received,
+			(unsigned long long)rx.expected);
+		s_failed++;
+		ret = -1;
+	}
+
+exit:
+	for (i = 0; i < clients; i++) {
+		close(n[i]->socket_id);
+		close(rx.fds[i]);
+		pthread_mutex_destroy(&n[i]->out_lock);
+		free(n[i]);
+	}
+	return ret;
+}
+
+static int32_t parse_list(const char *str, int32_t *list, int32_t max)
+{
+	int32_t count = 0;
+	char *end;
+
+	while (*str != '\0' && count < max) {
+		list[count] = strtol(str, &end, 10);
+		if (end == str || list[count] < 0)
+			return -1;
+		count++;
+		str = (*end == ',') ? end + 1 : end;
+	}
+	return count;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-c clients] [-s sizes] [-n frames]\n", name);
+	printf("  -c  客户端个数，逗号分隔，默认 1,8，最多 %d\n", BENCH_MAX_CLIENTS);
+	printf("  -s  每帧数据的字节数，逗号分隔，默认 4096,65536,262144\n");
+	printf("  -n  每轮发送的帧数，默认 1000\n");
+}
+
+int main(int argc, char **argv)
+{
+	int32_t clients[BENCH_MAX_SIZES] = {1, 8};
+	int32_t sizes[BENCH_MAX_SIZES] = {4096, 65536, 262144};
+	int32_t client_num = 2, size_num = 3, opt, i, j;
+	double copy_cpu, copy_mbps, iov_cpu, iov_mbps;
+
+	while ((opt = getopt(argc, argv, "c:s:n:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			client_num = parse_list(optarg, clients, BENCH_MAX_SIZES);
+			break;
+		case 's':
+			size_num = parse_list(optarg, sizes, BENCH_MAX_SIZES);
+			break;
+		case 'n':
+			s_frames = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	for (i = 0; i < client_num; i++) {
+		if (clients[i] <= 0 || clients[i] > BENCH_MAX_CLIENTS)
+			client_num = -1;
+	}
+	if (client_num <= 0 || size_num <= 0 || s_frames <= 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	log_ctrl_level_set(NULL, LOG_ERR);
+	check_same_bytes();
+
+	printf("\n%d frames per round\n", s_frames);
+	printf("%7s %8s %14s %10s %14s %10s\n", "clients", "size", "copy cpu us", "copy Mbps", "writev cpu us",
+		"writev Mbps");
+	for (i = 0; i < client_num; i++) {
+		for (j = 0; j < size_num; j++) {
+			if (run_send(0, clients[i], sizes[j], &copy_cpu, &copy_mbps) != 0
+				|| run_send(1, clients[i], sizes[j], &iov_cpu, &iov_mbps) != 0)
+				continue;
+			printf("%7d %8d %14.2f %10.0f %14.2f %10.0f\n", clients[i], sizes[j], copy_cpu, copy_mbps,
+				iov_cpu, iov_mbps);
+		}
+	}
+
+	printf("\n%s\n", s_failed == 0 ? "all checks passed" : "some checks failed");
+	return s_failed == 0 ? 0 : -1;
+}
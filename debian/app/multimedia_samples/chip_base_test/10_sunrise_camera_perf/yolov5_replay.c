@@ -0,0 +1,427 @@
+/**
+ * yolov5 后处理回放测试
+ * 读取板子上录制的模型输出 tensor(bpu_wrap.c 打开 BPU_DUMP_OUTPUT)，反复调用 Yolov5PostProcess，
+ * 统计每帧后处理的耗时，不需要 BPU，PC 和板子上都可以跑
+ * 没有录制的数据时可以用 -g 生成随机的输出 tensor，格式和录制的一样
+ * 量化输出(S8/S16/S32)还会反量化成 F32 再跑一遍，两次的检测结果必须完全一致，不一致时返回 -1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "utils_log.h"
+#include "time_utils.h"
+#include "latency_stats.h"
+#include "perf_common.h"
+
+#include "yolov5_post_process.h"
+
+// 和 bpu_wrap.c 里 bpu_dump_output 写的格式一致
+#define BPU_DUMP_MAGIC		0x54555042 // "BPUT"
+#define BPU_DUMP_FILE_FMT	"%s/bpu_yolov5_%04d.bin"
+#define YOLOV5_OUTPUTS		3
+#define YOLOV5_CHANNELS		255 // 3 个 anchor * (80 个分类 + 4 + 1)
+#define REPLAY_MAX_FRAMES	1000
+
+typedef struct
+{
+	int32_t		width;
+	int32_t		height;
+	int32_t		ori_width;
+	int32_t		ori_height;
+	hbDNNTensor	tensor[YOLOV5_OUTPUTS];
+	hbDNNTensor	dequant[YOLOV5_OUTPUTS];	// 量化输出反量化后的 F32 tensor，不是量化输出时不用
+	int32_t		quantized;
+} replay_frame_t;
+
+static int32_t s_stage_post = -1;
+static int32_t s_failed = 0;
+
+static int32_t element_size(int32_t type)
+{
+	switch (type) {
+	case HB_DNN_TENSOR_TYPE_S8:
+		return 1;
+	case HB_DNN_TENSOR_TYPE_S16:
+		return 2;
+	case HB_DNN_TENSOR_TYPE_S32:
+	case HB_DNN_TENSOR_TYPE_F32:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+static void tensor_free(hbDNNTensor *tensor)
+{
+	free(tensor->sysMem[0].virAddr);
+	free(tensor->properties.scale.scaleData);
+	memset(tensor, 0, sizeof(*tensor));
+}
+
+static void frame_free(replay_frame_t *frame)
+{
+	int32_t i;
+
+	for (i = 0; i < YOLOV5_OUTPUTS; i++) {
+		tensor_free(&frame->tensor[i]);
+		tensor_free(&frame->dequant[i]);
+	}
+}
+
+// NHWC 量化 tensor 按通道反量化成 F32，shape 不变
+static int32_t tensor_dequantize(const hbDNNTensor *src, hbDNNTensor *dst)
+{
+	const hbDNNTensorProperties *prop = &src->properties;
+	int32_t size = element_size(prop->tensorType);
+	int32_t channels = prop->alignedShape.dimensionSize[3];
+	int32_t count = prop->alignedByteSize / size;
+	float *data;
+	int32_t i, c;
+
+	data = malloc((size_t)count * sizeof(float));
+	if (data == NULL)
+		return -1;
+	for (i = 0; i < count; i++) {
+		c = i % channels;
+		float scale = prop->scale.scaleLen > c ? prop->scale.scaleData[c] : prop->scale.scaleData[0];
+		switch (prop->tensorType) {
+		case HB_DNN_TENSOR_TYPE_S8:
+			data[i] = ((int8_t *)src->sysMem[0].virAddr)[i] * scale;
+			break;
+		case HB_DNN_TENSOR_TYPE_S16:
+			data[i] = ((int16_t *)src->sysMem[0].virAddr)[i] * scale;
+			break;
+		default:
+			data[i] = ((int32_t *)src->sysMem[0].virAddr)[i] * scale;
+			break;
+		}
+	}
+	memset(dst, 0, sizeof(*dst));
+	dst->properties = *prop;
+	dst->properties.tensorType = HB_DNN_TENSOR_TYPE_F32;
+	dst->properties.quantiType = NONE;
+	dst->properties.scale.scaleLen = 0;
+	dst->properties.scale.scaleData = NULL;
+	dst->properties.alignedByteSize = count * sizeof(float);
+	dst->sysMem[0].virAddr = data;
+	dst->sysMem[0].memSize = dst->properties.alignedByteSize;
+	return 0;
+}
+
+static int32_t frame_load(const char *file_name, replay_frame_t *frame)
+{
+	int32_t header[6], desc[13];
+	FILE *fp;
+	int32_t i, j;
+
+	memset(frame, 0, sizeof(*frame));
+	fp = fopen(file_name, "rb");
+	if (fp == NULL)
+		return -1;
+	if (fread(header, sizeof(header), 1, fp) != 1 || header[0] != BPU_DUMP_MAGIC
+		|| header[5] != YOLOV5_OUTPUTS) {
+		printf("%s: not a yolov5 output dump\n", file_name);
+		goto err;
+	}
+	frame->width = header[1];
+	frame->height = header[2];
+	frame->ori_width = header[3];
+	frame->ori_height = header[4];
+
+	for (i = 0; i < YOLOV5_OUTPUTS; i++) {
+		hbDNNTensor *tensor = &frame->tensor[i];
+		hbDNNTensorProperties *prop = &tensor->properties;
+
+		if (fread(desc, sizeof(desc), 1, fp) != 1 || element_size(desc[1]) == 0
+			|| desc[3] < 0 || desc[3] > 4096 || desc[12] <= 0)
+			goto bad;
+		prop->tensorLayout = desc[0];
+		prop->tensorType = desc[1];
+		prop->quantiType = desc[2];
+		prop->scale.scaleLen = desc[3];
+		prop->validShape.numDimensions = 4;
+		prop->alignedShape.numDimensions = 4;
+		for (j = 0; j < 4; j++) {
+			prop->validShape.dimensionSize[j] = desc[4 + j];
+			prop->alignedShape.dimensionSize[j] = desc[8 + j];
+		}
+		prop->alignedByteSize = desc[12];
+		if (prop->scale.scaleLen > 0) {
+			prop->scale.scaleData = malloc(prop->scale.scaleLen * sizeof(float));
+			if (prop->scale.scaleData == NULL
+				|| fread(prop->scale.scaleData, sizeof(float), prop->scale.scaleLen, fp) != (size_t)prop->scale.scaleLen)
+				goto bad;
+		}
+		tensor->sysMem[0].virAddr = malloc(prop->alignedByteSize);
+		tensor->sysMem[0].memSize = prop->alignedByteSize;
+		if (tensor->sysMem[0].virAddr == NULL
+			|| fread(tensor->sysMem[0].virAddr, 1, prop->alignedByteSize, fp) != (size_t)prop->alignedByteSize)
+			goto bad;
+
+		if (prop->tensorType != HB_DNN_TENSOR_TYPE_F32 && prop->quantiType == SCALE
+			&& prop->scale.scaleLen > 0 && prop->tensorLayout == HB_DNN_LAYOUT_NHWC) {
+			if (tensor_dequantize(tensor, &frame->dequant[i]) != 0)
+				goto bad;
+			frame->quantized = 1;
+		}
+	}
+	fclose(fp);
+	return 0;
+
+bad:
+	printf("%s: output %d is truncated or not supported\n", file_name, i);
+err:
+	fclose(fp);
+	frame_free(frame);
+	return -1;
+}
+
+// 均值 -7、标准差 2 的正态分布，和真实场景一样绝大部分 anchor 的置信度很低
+static float random_logit(uint32_t *seed)
+{
+	float u1 = (rand_r(seed) + 1.0f) / (RAND_MAX + 2.0f);
+	float u2 = (rand_r(seed) + 1.0f) / (RAND_MAX + 2.0f);
+	return -7.0f + 2.0f * sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+}
+
+// 生成随机的输出 tensor，NHWC，每个通道一个量化系数
+// 背景 anchor 的值都很小，每帧再随机放 objects 个目标，目标周围的几个 anchor 置信度也比较高，留给 nms 合并
+static int32_t generate_frames(const char *dir, int32_t frames, int32_t objects, int32_t type,
+	int32_t model_size, int32_t ori_width, int32_t ori_height)
+{
+	static const int32_t strides[YOLOV5_OUTPUTS] = {8, 16, 32};
+	int32_t header[6] = {BPU_DUMP_MAGIC, model_size, model_size, ori_width, ori_height, YOLOV5_OUTPUTS};
+	int32_t size = element_size(type);
+	float scale[YOLOV5_CHANNELS];
+	char file_name[256];
+	uint32_t seed = 1;
+	float *values;
+	int32_t f, i, c, n, k;
+
+	mkdir(dir, 0755);
+	for (c = 0; c < YOLOV5_CHANNELS; c++)
+		scale[c] = type == HB_DNN_TENSOR_TYPE_S8 ? 0.05f + 0.001f * (c % 7) : 0.0005f + 0.00001f * (c % 7);
+	values = malloc((size_t)(model_size / strides[0]) * (model_size / strides[0]) * YOLOV5_CHANNELS * sizeof(float));
+	if (values == NULL)
+		return -1;
+
+	for (f = 0; f < frames; f++) {
+		FILE *fp;
+
+		snprintf(file_name, sizeof(file_name), BPU_DUMP_FILE_FMT, dir, f);
+		fp = fopen(file_name, "wb");
+		if (fp == NULL) {
+			printf("open %s failed\n", file_name);
+			free(values);
+			return -1;
+		}
+		fwrite(header, sizeof(header), 1, fp);
+		for (i = 0; i < YOLOV5_OUTPUTS; i++) {
+			int32_t hw = model_size / strides[i];
+			int32_t count = hw * hw * YOLOV5_CHANNELS;
+			int32_t scale_len = type == HB_DNN_TENSOR_TYPE_F32 ? 0 : YOLOV5_CHANNELS;
+			int32_t desc[13] = {HB_DNN_LAYOUT_NHWC, type, scale_len ? SCALE : NONE, scale_len,
+				1, hw, hw, YOLOV5_CHANNELS, 1, hw, hw, YOLOV5_CHANNELS, count * size};
+
+			for (n = 0; n < count; n++)
+				values[n] = random_logit(&seed);
+			for (k = 0; k < objects / YOLOV5_OUTPUTS + (i < objects % YOLOV5_OUTPUTS); k++) {
+				int32_t cell = rand_r(&seed) % (hw * hw), id = rand_r(&seed) % 80;
+				for (n = 0; n < 3; n++) {
+					// 同一个 grid cell 的 3 个 anchor 都预测到这个目标，分数依次降低
+					float *pred = &values[cell * YOLOV5_CHANNELS + n * 85];
+					pred[4] = 3.0f - n;
+					pred[5 + id] = 3.0f - n;
+					for (c = 0; c < 4; c++)
+						pred[c] = (rand_r(&seed) % 100) / 100.0f - 0.5f;
+				}
+			}
+
+			fwrite(desc, sizeof(desc), 1, fp);
+			fwrite(scale, sizeof(float), scale_len, fp);
+			for (n = 0; n < count; n++) {
+				float v = values[n];
+				c = n % YOLOV5_CHANNELS;
+				if (type == HB_DNN_TENSOR_TYPE_F32) {
+					fwrite(&v, sizeof(v), 1, fp);
+				} else if (type == HB_DNN_TENSOR_TYPE_S8) {
+					int8_t q = (int8_t)fmaxf(-128.0f, fminf(127.0f, rintf(v / scale[c])));
+					fwrite(&q, sizeof(q), 1, fp);
+				} else {
+					int16_t q = (int16_t)fmaxf(-32768.0f, fminf(32767.0f, rintf(v / scale[c])));
+					fwrite(&q, sizeof(q), 1, fp);
+				}
+			}
+		}
+		fclose(fp);
+	}
+	free(values);
+	printf("generated %d frames with %d objects in %s\n", frames, objects, dir);
+	return 0;
+}
+
+static void frame_post_info(replay_frame_t *frame, Yolov5PostProcessInfo_t *post_info, hbDNNTensor *tensor)
+{
+	// 和 bpu_wrap.c 推理线程里的参数一致
+	memset(post_info, 0, sizeof(*post_info));
+	post_info->is_pad_resize = 0;
+	post_info->score_threshold = 0.3;
+	post_info->nms_threshold = 0.45;
+	post_info->nms_top_k = 500;
+	post_info->width = frame->width;
+	post_info->height = frame->height;
+	post_info->ori_width = frame->ori_width;
+	post_info->ori_height = frame->ori_height;
+	post_info->pipeline = 1;
+	post_info->output_tensor = tensor;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-d dir] [-r rounds] [-g dir [-n frames] [-o objects] [-t s8|s16|f32] [-s size] [-W width] [-H height]]\n", name);
+	printf("  -d  录制文件所在目录，读取 bpu_yolov5_0000.bin 开始的连续文件，默认 /tmp\n");
+	printf("  -r  所有帧回放的轮数，默认 20\n");
+	printf("  -g  生成随机的输出 tensor 到这个目录，然后回放\n");
+	printf("  -n  生成的帧数，默认 10\n");
+	printf("  -o  生成时每帧的目标个数，默认 20\n");
+	printf("  -t  生成的 tensor 类型，默认 s8\n");
+	printf("  -s  生成时的模型输入大小，默认 672\n");
+	printf("  -W  生成时的原始图像宽，默认 1920\n");
+	printf("  -H  生成时的原始图像高，默认 1080\n");
+}
+
+int main(int argc, char **argv)
+{
+	static replay_frame_t frames[REPLAY_MAX_FRAMES];
+	const char *dir = "/tmp", *gen_dir = NULL;
+	int32_t rounds = 20, gen_frames = 10, gen_objects = 20, gen_type = HB_DNN_TENSOR_TYPE_S8;
+	int32_t model_size = 672, ori_width = 1920, ori_height = 1080;
+	Yolov5PostProcessInfo_t post_info;
+	latency_snapshot_t snapshot;
+	latency_stage_summary_t *stage;
+	bpu_result_t result, check;
+	char file_name[256];
+	uint64_t start_ns, end_ns, total_ns = 0, detections = 0;
+	int32_t frame_count, opt, i, r;
+
+	while ((opt = getopt(argc, argv, "d:r:g:n:o:t:s:W:H:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'g':
+			gen_dir = optarg;
+			break;
+		case 'n':
+			gen_frames = atoi(optarg);
+			break;
+		case 'o':
+			gen_objects = atoi(optarg);
+			break;
+		case 't':
+			if (strcmp(optarg, "s8") == 0)
+				gen_type = HB_DNN_TENSOR_TYPE_S8;
+			else if (strcmp(optarg, "s16") == 0)
+				gen_type = HB_DNN_TENSOR_TYPE_S16;
+			else if (strcmp(optarg, "f32") == 0)
+				gen_type = HB_DNN_TENSOR_TYPE_F32;
+			else
+				gen_type = -1;
+			break;
+		case 's':
+			model_size = atoi(optarg);
+			break;
+		case 'W':
+			ori_width = atoi(optarg);
+			break;
+		case 'H':
+			ori_height = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (rounds <= 0 || gen_objects < 0 || gen_frames <= 0 || gen_frames > REPLAY_MAX_FRAMES || gen_type < 0
+		|| model_size < 32 || model_size % 32 != 0 || ori_width <= 0 || ori_height <= 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	log_ctrl_level_set(NULL, LOG_ERR);
+	s_stage_post = latency_stats_stage("post_process");
+
+	if (gen_dir != NULL) {
+		if (generate_frames(gen_dir, gen_frames, gen_objects, gen_type, model_size, ori_width, ori_height) != 0)
+			return -1;
+		dir = gen_dir;
+	}
+
+	for (frame_count = 0; frame_count < REPLAY_MAX_FRAMES; frame_count++) {
+		snprintf(file_name, sizeof(file_name), BPU_DUMP_FILE_FMT, dir, frame_count);
+		if (access(file_name, F_OK) != 0 || frame_load(file_name, &frames[frame_count]) != 0)
+			break;
+	}
+	if (frame_count == 0) {
+		printf("no recorded frames in %s\n", dir);
+		return -1;
+	}
+	if (bpu_result_init(&result) != 0 || bpu_result_init(&check) != 0)
+		return -1;
+
+	// 量化输出和反量化后的 F32 输出，检测结果必须一致
+	for (i = 0; i < frame_count; i++) {
+		if (!frames[i].quantized)
+			continue;
+		frame_post_info(&frames[i], &post_info, frames[i].tensor);
+		Yolov5PostProcess(&post_info, &result);
+		frame_post_info(&frames[i], &post_info, frames[i].dequant);
+		Yolov5PostProcess(&post_info, &check);
+		if (strcmp(result.m_json, check.m_json) != 0) {
+			printf("frame %d: quantized and float outputs give different detections\n", i);
+			printf("  quantized: %.200s\n  float:     %.200s\n", result.m_json, check.m_json);
+			s_failed++;
+		}
+	}
+
+	latency_stats_snapshot(NULL);
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < frame_count; i++) {
+			frame_post_info(&frames[i], &post_info, frames[i].tensor);
+			start_ns = get_monotonic_ns();
+			Yolov5PostProcess(&post_info, &result);
+			end_ns = get_monotonic_ns();
+			latency_stats_record(s_stage_post, end_ns - start_ns);
+			total_ns += end_ns - start_ns;
+			detections += result.m_count;
+		}
+	}
+	latency_stats_snapshot(&snapshot);
+
+	stage = perf_stage_find(&snapshot, "post_process");
+	printf("\n%d frames %dx%d -> %dx%d, tensor type %d, %d rounds\n", frame_count,
+		frames[0].ori_width, frames[0].ori_height, frames[0].width, frames[0].height,
+		frames[0].tensor[0].properties.tensorType, rounds);
+	printf("%10s %8s %8s %9s %10s\n", "frames/s", "p50(ms)", "p99(ms)", "max(ms)", "dets/frame");
+	if (stage != NULL && stage->count > 0)
+		printf("%10.1f %8.3f %8.3f %9.3f %10.1f\n", (double)stage->count * 1e9 / total_ns,
+			stage->p50_ns / 1e6, stage->p99_ns / 1e6, stage->max_ns / 1e6,
+			(double)detections / stage->count);
+
+	for (i = 0; i < frame_count; i++)
+		frame_free(&frames[i]);
+	bpu_result_deinit(&result);
+	bpu_result_deinit(&check);
+
+	printf("\n%s\n", s_failed == 0 ? "all checks passed" : "some checks failed");
+	return s_failed == 0 ? 0 : -1;
+}
@@ -11,6 +11,12 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
@@ -23,6 +29,9 @@ atomic_int running = 1;
 static int verbose = 0;
 static int decode_output_exit = 0;
 
+// 非 free_run 模式下两帧输入之间的间隔
+#define ENCODE_INPUT_INTERVAL_US (30 * 1000)
+
 static struct option const long_options[] = {
 	{"config_file", required_argument, NULL, 'f'},
 	{"encode", required_argument, NULL, 'e'},
@@ -63,10 +72,10 @@ static void print_help() {
 static void print_encode_params(EncodeParams *params) {
 	printf("Encode params...\n codec_type: %d, width: %d, height: %d, frame_rate: %d, "
 			"bit_rate: %u, input_file: %s, output_file: %s, frame_num: %d, profile: %s, "
-			"external_buffer: %d performance_test:%d\n",
+			"external_buffer: %d performance_test:%d free_run: %d\n",
 			params->codec_type, params->width, params->height, params->frame_rate,
 			params->bit_rate, params->input, params->output, params->frame_num,
-			params->profile, params->external_buffer, params->performance_test);
+			params->profile, params->external_buffer, params->performance_test, params->free_run);
 }
 
 static void print_decode_params(DecodeParams *params) {
@@ -734,115 +743,369 @@ int32_t vp_decode_config_param(media_codec_context_t *context, media_codec_id_t
 	return 0;
 }
 
-static int32_t read_nv12_file(char *addr0, char *addr1, FILE *fd, uint32_t y_size)
+// 编码输入 yuv 文件:
+// 1. 整个文件 mmap，按帧直接从映射区拷贝，不再每帧 malloc 临时 buffer、fread 再 memcpy
+// 2. external buffer 模式使用固定个数的 hb_mem 图像 buffer 循环使用，编码器用完后还回池里，
+//    预读线程提前把下一帧拷进空闲 buffer，编码循环取到的总是已经准备好的 buffer
+// 3. buffer 里已经是要读的那一帧时不再拷贝；文件帧数不超过池大小时，池大小取帧数的整数倍，
+//    每个 buffer 固定对应一帧，填充一次后不再拷贝
+// 编码器需要物理连续的 hb_mem 内存，文件的页缓存不能直接给编码器用，所以至少保留一次拷贝
+#define NV12_SOURCE_POOL_SIZE 6 // 编码器最多持有 frame_buf_count(3) 个，其余给预读线程
+
+typedef struct {
+	hb_mem_graphic_buf_t graph_buf;
+	int32_t frame_index; // buffer 里是文件中的第几帧，-1 表示还没有数据
+} nv12_pool_buf_t;
+
+typedef struct {
+	int32_t fd;
+	uint8_t *data; // mmap 的整个 yuv 文件
+	size_t file_size;
+	uint32_t y_size;
+	uint32_t frame_size;
+	int32_t frame_count; // 文件里完整的帧数，不足一帧的尾部忽略
+	int32_t next_frame; // 下一次读取的帧，读到末尾后回到第 0 帧
+
+	// 以下只在 external buffer 模式使用
+	nv12_pool_buf_t pool[NV12_SOURCE_POOL_SIZE];
+	int32_t pool_count;
+	int32_t free_list[NV12_SOURCE_POOL_SIZE]; // 空闲 buffer 下标，先进先出
+	int32_t free_head;
+	int32_t free_count;
+	int32_t ready_list[NV12_SOURCE_POOL_SIZE]; // 已经填好数据的 buffer 下标，先进先出
+	int32_t ready_head;
+	int32_t ready_count;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t read_thread;
+	bool thread_started;
+	bool exit;
+	uint32_t copy_count; // 实际拷贝的帧数，external buffer 模式下由 lock 保护
+} nv12_source_t;
+
+static int64_t get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int32_t nv12_source_open(nv12_source_t *src, const char *filename, int32_t width, int32_t height)
 {
-	char *buffer = NULL;
-	if (fd == NULL || addr0 == NULL || addr1 == NULL || y_size == 0) {
+	struct stat st;
+
+	if (src == NULL || filename == NULL || width <= 0 || height <= 0) {
 		printf("ERR(%s):null param.\n", __func__);
 		return -1;
 	}
 
-	buffer = (char *)malloc(y_size + y_size / 2);
+	memset(src, 0, sizeof(nv12_source_t));
+	src->y_size = width * height;
+	src->frame_size = src->y_size + src->y_size / 2;
+
+	src->fd = open(filename, O_RDONLY);
+	if (src->fd < 0) {
+		printf("Failed to open input file: %s, %s\n", filename, strerror(errno));
+		return -1;
+	}
 
-	if (fread(buffer, 1, y_size, fd) != y_size) {
-		if (buffer)
-			free(buffer);
+	if (fstat(src->fd, &st) != 0 || st.st_size < src->frame_size) {
+		printf("Input file %s is smaller than one %dx%d NV12 frame\n", filename, width, height);
+		close(src->fd);
+		src->fd = -1;
 		return -1;
 	}
+	src->file_size = st.st_size;
+	src->frame_count = src->file_size / src->frame_size;
 
-	if (fread(buffer + y_size, 1, y_size / 2, fd) != y_size / 2) {
-		if (buffer)
-			free(buffer);
+	src->data = mmap(NULL, src->file_size, PROT_READ, MAP_PRIVATE, src->fd, 0);
+	if (src->data == MAP_FAILED) {
+		printf("Failed to mmap input file: %s, %s\n", filename, strerror(errno));
+		close(src->fd);
+		src->fd = -1;
 		return -1;
 	}
+	madvise(src->data, src->file_size, MADV_SEQUENTIAL);
+
+	printf("input file %s: %d frames of %dx%d\n", filename, src->frame_count, width, height);
+	return 0;
+}
 
-	memcpy(addr0, buffer, y_size);
-	memcpy(addr1, buffer + y_size, y_size / 2);
+// 返回下一帧在映射区中的地址，并提示内核预读再下一帧
+static const uint8_t *nv12_source_next_frame(nv12_source_t *src, int32_t *frame_index)
+{
+	const uint8_t *frame = src->data + (size_t)src->next_frame * src->frame_size;
+	size_t ahead_offset, ahead_page;
 
-	if (buffer)
-		free(buffer);
+	*frame_index = src->next_frame;
+	src->next_frame = (src->next_frame + 1) % src->frame_count;
+
+	if (src->frame_count > 1) {
+		ahead_offset = (size_t)src->next_frame * src->frame_size;
+		ahead_page = ahead_offset & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+		madvise(src->data + ahead_page, ahead_offset - ahead_page + src->frame_size, MADV_WILLNEED);
+	}
+	return frame;
+}
+
+// 拷贝下一帧到编码器自己的输入 buffer
+static int32_t nv12_source_read(nv12_source_t *src, uint8_t *y_data, uint8_t *uv_data)
+{
+	const uint8_t *frame;
+	int32_t frame_index;
+
+	if (src == NULL || y_data == NULL || uv_data == NULL) {
+		printf("ERR(%s):null param.\n", __func__);
+		return -1;
+	}
+
+	frame = nv12_source_next_frame(src, &frame_index);
+	memcpy(y_data, frame, src->y_size);
+	memcpy(uv_data, frame + src->y_size, src->y_size / 2);
+	src->copy_count++;
 
 	return 0;
 }
-static void on_encode_input_buffer_consumed(hb_ptr userdata, media_codec_buffer_t *inputBuffer)
+
+// 返回是否拷贝了数据
+static bool nv12_source_fill_buffer(nv12_source_t *src, nv12_pool_buf_t *buf)
 {
-	hb_mem_graphic_buf_t *buffer;
+	hb_mem_graphic_buf_t *graph_buf = &buf->graph_buf;
+	const uint8_t *frame;
+	int32_t frame_index;
 
-	if (!inputBuffer)
-		return;
+	frame = nv12_source_next_frame(src, &frame_index);
+	if (buf->frame_index == frame_index)
+		return false;
 
-	printf("%s userdata(%p), inputBuffer->user_ptr(%p)\n", __func__,
-			userdata, inputBuffer->user_ptr);
+	memcpy(graph_buf->virt_addr[0], frame, src->y_size);
+	memcpy(graph_buf->virt_addr[1], frame + src->y_size, src->y_size / 2);
+	// buffer 是 cached 的，编码器直接读 DDR，拷贝后刷 cache
+	hb_mem_flush_buf_with_vaddr((uint64_t)graph_buf->virt_addr[0], src->y_size);
+	hb_mem_flush_buf_with_vaddr((uint64_t)graph_buf->virt_addr[1], src->y_size / 2);
+	buf->frame_index = frame_index;
+	return true;
+}
 
-	if (inputBuffer->user_ptr) {
-		buffer = (hb_mem_graphic_buf_t *)inputBuffer->user_ptr;
+// 预读线程: 有空闲 buffer 就填入下一帧，放进就绪队列
+static void *nv12_source_read_ahead_thread(void *arg)
+{
+	nv12_source_t *src = (nv12_source_t *)arg;
+	nv12_pool_buf_t *buf;
+	int32_t index;
+	bool copied;
+
+	pthread_mutex_lock(&src->lock);
+	while (!src->exit) {
+		if (src->free_count == 0) {
+			pthread_cond_wait(&src->cond, &src->lock);
+			continue;
+		}
+		index = src->free_list[src->free_head];
+		src->free_head = (src->free_head + 1) % NV12_SOURCE_POOL_SIZE;
+		src->free_count--;
+		buf = &src->pool[index];
+		pthread_mutex_unlock(&src->lock);
 
-		hb_mem_free_buf(buffer->fd[0]);
-		free(buffer);
+		copied = nv12_source_fill_buffer(src, buf);
+
+		pthread_mutex_lock(&src->lock);
+		if (copied)
+			src->copy_count++;
+		src->ready_list[(src->ready_head + src->ready_count) % NV12_SOURCE_POOL_SIZE] = index;
+		src->ready_count++;
+		pthread_cond_broadcast(&src->cond);
 	}
+	pthread_mutex_unlock(&src->lock);
+
+	return NULL;
 }
 
-/* fill input buffer with external buffer */
-static int32_t read_input_frame(media_codec_buffer_t *input_buffer, FILE *fd)
+// 分配 buffer 池并启动预读线程
+static int32_t nv12_source_start_pool(nv12_source_t *src, int32_t width, int32_t height)
 {
-	hb_mem_graphic_buf_t *buffer;
+	pthread_condattr_t cond_attr;
 	int64_t flags;
-	uint32_t y_size;
-	int32_t width, height;
-	uint8_t *y_data;
-	uint8_t *uv_data;
-	int32_t ret;
+	int32_t i, ret;
 
-	if (fd == NULL || input_buffer == NULL) {
-		printf("ERR(%s):null param.\n", __func__);
+	src->pool_count = NV12_SOURCE_POOL_SIZE;
+	if (src->frame_count <= NV12_SOURCE_POOL_SIZE)
+		src->pool_count = NV12_SOURCE_POOL_SIZE / src->frame_count * src->frame_count;
+
+	flags = HB_MEM_USAGE_CPU_READ_OFTEN | HB_MEM_USAGE_CPU_WRITE_OFTEN | HB_MEM_USAGE_CACHED;
+	for (i = 0; i < src->pool_count; i++) {
+		ret = hb_mem_alloc_graph_buf(width, height, MEM_PIX_FMT_NV12, flags, 0, 0, &src->pool[i].graph_buf);
+		if (ret < 0) {
+			printf("hb_mem_alloc_graph_buf ret %d failed \n", ret);
+			while (--i >= 0)
+				hb_mem_free_buf(src->pool[i].graph_buf.fd[0]);
+			src->pool_count = 0;
+			return ret;
+		}
+		src->pool[i].frame_index = -1;
+		src->free_list[i] = i;
+	}
+	src->free_head = 0;
+	src->free_count = src->pool_count;
+	src->ready_head = 0;
+	src->ready_count = 0;
+	src->exit = false;
+
+	pthread_mutex_init(&src->lock, NULL);
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&src->cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+
+	ret = pthread_create(&src->read_thread, NULL, nv12_source_read_ahead_thread, src);
+	if (ret != 0) {
+		printf("create read ahead thread failed, %s\n", strerror(ret));
 		return -1;
 	}
+	src->thread_started = true;
 
-	width = input_buffer->vframe_buf.width;
-	height = input_buffer->vframe_buf.height;
-	y_size = input_buffer->vframe_buf.width * input_buffer->vframe_buf.height;
+	printf("input buffer pool: %d buffers\n", src->pool_count);
+	return 0;
+}
 
-	buffer = malloc(sizeof(hb_mem_graphic_buf_t));
-	memset(buffer, 0, sizeof(hb_mem_graphic_buf_t));
+// 取一个已经填好数据的 buffer，超时返回 NULL
+static nv12_pool_buf_t *nv12_source_get_buffer(nv12_source_t *src, int32_t timeout_ms)
+{
+	nv12_pool_buf_t *buf = NULL;
+	struct timespec ts;
 
-	flags = HB_MEM_USAGE_CPU_READ_OFTEN | HB_MEM_USAGE_CPU_WRITE_OFTEN | HB_MEM_USAGE_CACHED;
-	ret = hb_mem_alloc_graph_buf(width, height, MEM_PIX_FMT_NV12, flags, 0, 0, buffer);
-	if (ret < 0) {
-		printf("hb_mem_alloc_graph_buf ret %d failed \n", ret);
-		return ret;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
 	}
 
-	y_data = buffer->virt_addr[0];
-	uv_data = buffer->virt_addr[1];
+	pthread_mutex_lock(&src->lock);
+	while (src->ready_count == 0) {
+		if (pthread_cond_timedwait(&src->cond, &src->lock, &ts) == ETIMEDOUT)
+			break;
+	}
+	if (src->ready_count > 0) {
+		buf = &src->pool[src->ready_list[src->ready_head]];
+		src->ready_head = (src->ready_head + 1) % NV12_SOURCE_POOL_SIZE;
+		src->ready_count--;
+	}
+	pthread_mutex_unlock(&src->lock);
+
+	return buf;
+}
 
-#if 0
-	printf("hb_mem alloc. y_data(%p), uv_data(%p), y_size(%d), size[0]: %lu, size[1]: %lu\n",
-			y_data, uv_data, y_size, buffer->size[0], buffer->size[1]);
-#endif
+// 编码器用完后还回池里
+static void nv12_source_put_buffer(nv12_source_t *src, nv12_pool_buf_t *buf)
+{
+	pthread_mutex_lock(&src->lock);
+	src->free_list[(src->free_head + src->free_count) % NV12_SOURCE_POOL_SIZE] = buf - src->pool;
+	src->free_count++;
+	pthread_cond_broadcast(&src->cond);
+	pthread_mutex_unlock(&src->lock);
+}
+
+static uint32_t nv12_source_copy_count(nv12_source_t *src)
+{
+	uint32_t copy_count;
 
-	if (fread(y_data, 1, y_size, fd) != y_size) {
-		hb_mem_free_buf(buffer->fd[0]);
-		free(buffer);
+	if (!src->thread_started)
+		return src->copy_count;
+
+	pthread_mutex_lock(&src->lock);
+	copy_count = src->copy_count;
+	pthread_mutex_unlock(&src->lock);
+	return copy_count;
+}
+
+static void nv12_source_close(nv12_source_t *src)
+{
+	int32_t i;
+
+	if (src->thread_started) {
+		pthread_mutex_lock(&src->lock);
+		src->exit = true;
+		pthread_cond_broadcast(&src->cond);
+		pthread_mutex_unlock(&src->lock);
+		pthread_join(src->read_thread, NULL);
+		src->thread_started = false;
+	}
+	if (src->pool_count > 0) {
+		for (i = 0; i < src->pool_count; i++)
+			hb_mem_free_buf(src->pool[i].graph_buf.fd[0]);
+		src->pool_count = 0;
+		pthread_mutex_destroy(&src->lock);
+		pthread_cond_destroy(&src->cond);
+	}
+
+	if (src->data != NULL && src->data != MAP_FAILED)
+		munmap(src->data, src->file_size);
+	src->data = NULL;
+	if (src->fd >= 0)
+		close(src->fd);
+	src->fd = -1;
+}
+
+static void on_encode_input_buffer_consumed(hb_ptr userdata, media_codec_buffer_t *inputBuffer)
+{
+	nv12_source_t *src = (nv12_source_t *)userdata;
+
+	if (!inputBuffer)
+		return;
+
+	if (verbose) {
+		printf("%s userdata(%p), inputBuffer->user_ptr(%p)\n", __func__,
+				userdata, inputBuffer->user_ptr);
+	}
+
+	if (src && inputBuffer->user_ptr)
+		nv12_source_put_buffer(src, (nv12_pool_buf_t *)inputBuffer->user_ptr);
+}
+
+/* fill input buffer with external buffer from the pool */
+static int32_t read_input_frame(media_codec_buffer_t *input_buffer, nv12_source_t *src)
+{
+	nv12_pool_buf_t *buf;
+
+	if (src == NULL || input_buffer == NULL) {
+		printf("ERR(%s):null param.\n", __func__);
 		return -1;
 	}
 
-	if (fread(uv_data, 1, y_size / 2, fd) != y_size / 2) {
-		hb_mem_free_buf(buffer->fd[0]);
-		free(buffer);
+	buf = nv12_source_get_buffer(src, 2000);
+	if (buf == NULL) {
+		printf("ERR(%s):no input buffer ready.\n", __func__);
 		return -1;
 	}
 
-	input_buffer->vframe_buf.vir_ptr[0] = y_data;
-	input_buffer->vframe_buf.vir_ptr[1] = uv_data;
-	input_buffer->vframe_buf.phy_ptr[0] = buffer->phys_addr[0];
-	input_buffer->vframe_buf.phy_ptr[1] = buffer->phys_addr[1];
+	input_buffer->vframe_buf.vir_ptr[0] = buf->graph_buf.virt_addr[0];
+	input_buffer->vframe_buf.vir_ptr[1] = buf->graph_buf.virt_addr[1];
+	input_buffer->vframe_buf.phy_ptr[0] = buf->graph_buf.phys_addr[0];
+	input_buffer->vframe_buf.phy_ptr[1] = buf->graph_buf.phys_addr[1];
 
-	/* set external buffer ptr to user_ptr, using on_input_buffer_consumed to release it */
-	input_buffer->user_ptr = buffer;
+	/* set pool buffer to user_ptr, on_encode_input_buffer_consumed returns it to the pool */
+	input_buffer->user_ptr = buf;
 
 	return 0;
 }
 
+// 打印编码吞吐和每帧准备输入数据的耗时
+// 没有设置 free_run 时帧率被送帧间隔限制在 33fps 左右，不代表编码器的吞吐
+static void print_encode_throughput(media_codec_context_t *context, int32_t frame_count,
+	int64_t elapsed_us, int64_t input_sum_us, int64_t input_max_us, uint32_t copy_count, int32_t free_run)
+{
+	if (frame_count <= 0 || elapsed_us <= 0)
+		return;
+
+	printf("Encode idx: %d, %d frames in %.2f s, %.1f fps%s, input avg %lld us max %lld us, %u frames copied\n",
+		context->instance_index, frame_count, elapsed_us / 1000000.0,
+		frame_count * 1000000.0 / elapsed_us, free_run ? "" : " (paced)",
+		(long long)(input_sum_us / frame_count), (long long)input_max_us, copy_count);
+}
+
 // 解析配置文件
 int parse_config(const char *filename,
 		EncodeParams encode_params[], int *encode_streams,
@@ -917,6 +1180,8 @@ int parse_config(const char *filename,
 				params->external_buffer = atoi(trimmed_value);
 			else if (strcmp(trimmed_key, "performance_test") == 0)
 				params->performance_test = atoi(trimmed_value);
+			else if (strcmp(trimmed_key, "free_run") == 0)
+				params->free_run = atoi(trimmed_value);
 			else if (strcmp(trimmed_key, "profile") == 0)
 				strcpy(params->profile, trimmed_value);
 		}
@@ -1211,6 +1476,9 @@ int32_t encode_video(media_codec_context_t *context, EncodeParams *params) {
 	media_codec_buffer_t input_buffer = {0};
 	media_codec_buffer_t ouput_buffer = {0};
 	media_codec_output_buffer_info_t info;
+	nv12_source_t src;
+	int64_t start_us, input_start_us, input_us;
+	int64_t input_sum_us = 0, input_max_us = 0;
 
 	printf("%s...\n", __func__);
 
@@ -1240,20 +1508,23 @@ int32_t encode_video(media_codec_context_t *context, EncodeParams *params) {
 
 	printf("%s idx: %d, start successful\n", context->encoder ? "Encode" : "Decode", context->instance_index);
 
-	FILE *fp_input = fopen(params->input, "rb");
-	if (NULL == fp_input) {
-		printf("Failed to open input file: %s\n", params->input);
+	if (nv12_source_open(&src, params->input, context->video_enc_params.width,
+		context->video_enc_params.height) != 0) {
 		return -1;
 	}
 
 	FILE *fp_output = fopen(params->output, "w+b");
 	if (NULL == fp_output) {
 		printf("Failed to open output file: %s\n", params->output);
+		nv12_source_close(&src);
 		return -1;
 	}
 
+	start_us = get_time_us();
 	while (frame_count < params->frame_num) {
-		usleep(30*1000);
+		// 默认每 30ms 送一帧模拟实时输入，free_run 时不等待，用来测编码器能达到的最大帧率
+		if (!params->free_run)
+			usleep(ENCODE_INPUT_INTERVAL_US);
 		memset(&input_buffer, 0x00, sizeof(media_codec_buffer_t));
 		// input_buffer.type = MC_VIDEO_FRAME_BUFFER;
 		ret = hb_mm_mc_dequeue_input_buffer(context, &input_buffer, 2000);
@@ -1269,17 +1540,16 @@ int32_t encode_video(media_codec_context_t *context, EncodeParams *params) {
 		input_buffer.vframe_buf.pix_fmt = MC_PIXEL_FORMAT_NV12;
 		input_buffer.vframe_buf.size = input_buffer.vframe_buf.width * input_buffer.vframe_buf.height * 3 / 2;
 
-		// 如果从 emmc 上读取数据，会在一定程度上影响性能
-		ret = read_nv12_file((char *)input_buffer.vframe_buf.vir_ptr[0],
-			(char *)input_buffer.vframe_buf.vir_ptr[1],
-			fp_input, input_buffer.vframe_buf.width * input_buffer.vframe_buf.height);
-		if (ret != 0 || feof(fp_input)) {
-			clearerr(fp_input);
-			rewind(fp_input);
-
-			ret = read_nv12_file((char *)input_buffer.vframe_buf.vir_ptr[0],
-			(char *)input_buffer.vframe_buf.vir_ptr[1],
-			fp_input, input_buffer.vframe_buf.width * input_buffer.vframe_buf.height);
+		// 从 mmap 的输入文件直接拷贝到编码器的输入 buffer，读到文件末尾后从头开始
+		input_start_us = get_time_us();
+		ret = nv12_source_read(&src, (uint8_t *)input_buffer.vframe_buf.vir_ptr[0],
+			(uint8_t *)input_buffer.vframe_buf.vir_ptr[1]);
+		input_us = get_time_us() - input_start_us;
+		input_sum_us += input_us;
+		if (input_us > input_max_us)
+			input_max_us = input_us;
+		if (ret != 0) {
+			goto venc_exit;
 		}
 		frame_count++;
 
@@ -1326,22 +1596,24 @@ int32_t encode_video(media_codec_context_t *context, EncodeParams *params) {
 	}
 
 venc_exit:
+	print_encode_throughput(context, frame_count, get_time_us() - start_us,
+		input_sum_us, input_max_us, nv12_source_copy_count(&src), params->free_run);
+
 	if (fp_output) {
 		fclose(fp_output);
 	}
 
-	if (fp_input) {
-		fclose(fp_input);
-	}
-
 	ret = hb_mm_mc_pause(context);
 	if (ret != 0)
 	{
 		printf("Failed to hb_mm_mc_pause ret = %d \n", ret);
+		nv12_source_close(&src);
 		return -1;
 	}
 
 	ret = hb_mm_mc_release(context);
+	// 编码器释放之后不会再回调，池里的 buffer 才可以释放
+	nv12_source_close(&src);
 	if (ret != 0)
 	{
 		printf("Failed to hb_mm_mc_release ret = %d \n", ret);
@@ -1360,6 +1632,9 @@ int32_t encode_video_external_buffer(media_codec_context_t *context, EncodeParam
 	media_codec_buffer_t ouput_buffer = {0};
 	media_codec_output_buffer_info_t info;
 	media_codec_callback_t callback;
+	nv12_source_t src;
+	int64_t start_us, input_start_us, input_us;
+	int64_t input_sum_us = 0, input_max_us = 0;
 
 	printf("%s...\n", __func__);
 
@@ -1370,11 +1645,25 @@ int32_t encode_video_external_buffer(media_codec_context_t *context, EncodeParam
 		return -1;
 	}
 
+	// 编码器用完的 buffer 在回调里还给 src 的 buffer 池
+	if (nv12_source_open(&src, params->input, context->video_enc_params.width,
+		context->video_enc_params.height) != 0) {
+		hb_mm_mc_release(context);
+		return -1;
+	}
+	if (nv12_source_start_pool(&src, context->video_enc_params.width,
+		context->video_enc_params.height) != 0) {
+		nv12_source_close(&src);
+		hb_mm_mc_release(context);
+		return -1;
+	}
+
 	callback.on_input_buffer_consumed = on_encode_input_buffer_consumed;
-	ret = hb_mm_mc_set_input_buffer_listener(context, &callback, NULL);
+	ret = hb_mm_mc_set_input_buffer_listener(context, &callback, &src);
 	if (0 != ret)
 	{
 		printf("hbmm_mc_set_input_buffer_listener failed.\n");
+		nv12_source_close(&src);
 		return -1;
 	}
 
@@ -1383,6 +1672,7 @@ int32_t encode_video_external_buffer(media_codec_context_t *context, EncodeParam
 	{
 		printf("hb_mm_mc_configure failed.\n");
 		hb_mm_mc_release(context);
+		nv12_source_close(&src);
 		return -1;
 	}
 
@@ -1392,25 +1682,24 @@ int32_t encode_video_external_buffer(media_codec_context_t *context, EncodeParam
 	if (ret != 0)
 	{
 		printf("%s:%d hb_mm_mc_start failed.\n", __FUNCTION__, __LINE__);
+		nv12_source_close(&src);
 		return -1;
 	}
 
 	printf("%s idx: %d, start successful\n", context->encoder ? "Encode" : "Decode", context->instance_index);
 
-	FILE *fp_input = fopen(params->input, "rb");
-	if (NULL == fp_input) {
-		printf("Failed to open input file: %s\n", params->input);
-		return -1;
-	}
-
 	FILE *fp_output = fopen(params->output, "w+b");
 	if (NULL == fp_output) {
 		printf("Failed to open output file: %s\n", params->output);
+		nv12_source_close(&src);
 		return -1;
 	}
 
+	start_us = get_time_us();
 	while (frame_count < params->frame_num) {
-		usleep(30*1000);
+		// 与 encode_video 相同，free_run 时不等待
+		if (!params->free_run)
+			usleep(ENCODE_INPUT_INTERVAL_US);
 		memset(&input_buffer, 0x00, sizeof(media_codec_buffer_t));
 		// input_buffer.type = MC_VIDEO_FRAME_BUFFER;
 		ret = hb_mm_mc_dequeue_input_buffer(context, &input_buffer, 2000);
@@ -1426,15 +1715,19 @@ int32_t encode_video_external_buffer(media_codec_context_t *context, EncodeParam
 		input_buffer.vframe_buf.pix_fmt = MC_PIXEL_FORMAT_NV12;
 		input_buffer.vframe_buf.size = input_buffer.vframe_buf.width * input_buffer.vframe_buf.height * 3 / 2;
 
-		printf("dequeue input buffer. src_idx(%d), user_ptr(%p)\n", input_buffer.vframe_buf.src_idx, input_buffer.user_ptr);
-
-		// 如果从 emmc 上读取数据，会在一定程度上影响性能
-		ret = read_input_frame(&input_buffer, fp_input);
-		if (ret != 0 || feof(fp_input)) {
-			clearerr(fp_input);
-			rewind(fp_input);
+		if (verbose) {
+			printf("dequeue input buffer. src_idx(%d), user_ptr(%p)\n", input_buffer.vframe_buf.src_idx, input_buffer.user_ptr);
+		}
 
-			ret = read_input_frame(&input_buffer, fp_input);
+		// 预读线程已经把数据填进池里的 buffer，这里只取出来
+		input_start_us = get_time_us();
+		ret = read_input_frame(&input_buffer, &src);
+		input_us = get_time_us() - input_start_us;
+		input_sum_us += input_us;
+		if (input_us > input_max_us)
+			input_max_us = input_us;
+		if (ret != 0) {
+			goto venc_exit;
 		}
 		frame_count++;
 
@@ -1481,22 +1774,24 @@ int32_t encode_video_external_buffer(media_codec_context_t *context, EncodeParam
 	}
 
 venc_exit:
+	print_encode_throughput(context, frame_count, get_time_us() - start_us,
+		input_sum_us, input_max_us, nv12_source_copy_count(&src), params->free_run);
+
 	if (fp_output) {
 		fclose(fp_output);
 	}
 
-	if (fp_input) {
-		fclose(fp_input);
-	}
-
 	ret = hb_mm_mc_pause(context);
 	if (ret != 0)
 	{
 		printf("Failed to hb_mm_mc_pause ret = %d \n", ret);
+		nv12_source_close(&src);
 		return -1;
 	}
 
 	ret = hb_mm_mc_release(context);
+	// 编码器释放之后不会再回调，池里的 buffer 才可以释放
+	nv12_source_close(&src);
 	if (ret != 0)
 	{
 		printf("Failed to hb_mm_mc_release ret = %d \n", ret);
@@ -2034,6 +2329,10 @@ int main(int argc, char *argv[]) {
 	DecodeParams decode_params[MAX_STREAMS];
 	int decode_streams = 0x0;
 
+	// 配置文件里没有写的选项保持为 0
+	memset(encode_params, 0, sizeof(encode_params));
+	memset(decode_params, 0, sizeof(decode_params));
+
 	while ((opt = getopt_long(argc, argv, "f:e:d:vh", long_options, NULL)) != -1) {
 		switch (opt) {
 			case 'f':
@@ -30,6 +30,7 @@ typedef struct {
 	int32_t frame_num;
 	int32_t external_buffer;
 	int32_t performance_test;
+	int32_t free_run;	// 为 1 时不按 30ms 间隔送帧，测编码器的最大吞吐
 	char profile[32];
 } EncodeParams;
 
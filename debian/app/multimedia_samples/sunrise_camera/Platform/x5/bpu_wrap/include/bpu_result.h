@@ -0,0 +1,60 @@
+#ifndef BPU_RESULT_H_
+#define BPU_RESULT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// json 格式算法结果的缓存大小，nms_top_k 为 500 时也足够
+#define BPU_RESULT_JSON_SIZE	(96 * 1024)
+// 二进制格式检测结果的缓存大小
+#define BPU_RESULT_BIN_SIZE		(48 * 1024)
+
+/* 二进制格式的检测结果，web 端通过 websocket 命令协商后才发送，全部为小端:
+ *   u32 magic(BPU_RESULT_BIN_MAGIC) u32 pipeline u64 timestamp(us) u32 count
+ *   count 个检测框:
+ *   f32 xmin f32 ymin f32 xmax f32 ymax f32 score u16 id u8 name_len u8 reserved char name[name_len]
+ * 码流帧开头 4 个字节是通道号，用魔数 "BDET" 区分
+ */
+#define BPU_RESULT_BIN_MAGIC		0x54454442
+#define BPU_RESULT_BIN_HEADER_SIZE	20
+
+// 每路 pipeline 预分配一个，后处理线程直接把结果写成最终的 websocket 消息，避免每帧申请内存
+typedef struct {
+	char		*m_json;		// {"kind":10,...} 完整的 json 消息，以 '\0' 结尾
+	uint32_t	m_json_len;
+	uint8_t		*m_bin;			// 二进制格式的检测结果
+	uint32_t	m_bin_len;		// 0 表示本次结果没有二进制格式，比如分类结果
+	uint32_t	m_count;		// 已写入的检测框数量
+	int32_t		m_truncated;	// 缓存不足时丢弃的检测框数量
+} bpu_result_t;
+
+int32_t bpu_result_init(bpu_result_t *result);
+void bpu_result_deinit(bpu_result_t *result);
+
+// 检测结果: begin 之后逐个 add，最后 end
+void bpu_result_begin_detection(bpu_result_t *result, int32_t pipeline, uint64_t timestamp);
+void bpu_result_add_detection(bpu_result_t *result, const float bbox[4],
+	float score, int32_t id, const char *name);
+void bpu_result_end_detection(bpu_result_t *result);
+
+// 分类结果只有 json 格式
+void bpu_result_classification(bpu_result_t *result, int32_t pipeline, uint64_t timestamp,
+	int32_t id, float score);
+
+/**
+ * 按定点小数格式化浮点数，结果和 printf("%.*f") 完全一致
+ * @param[out] buf: 至少 32 字节，不会写入 '\0'
+ * @param[in] v: 绝对值大于等于 1e12 或者不是有限值时输出 0
+ * @param[in] decimals: 小数位数，0 ~ 6
+ * @return 写入的字节数
+ */
+int32_t bpu_result_fmt_fixed(char *buf, float v, int32_t decimals);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BPU_RESULT_H_
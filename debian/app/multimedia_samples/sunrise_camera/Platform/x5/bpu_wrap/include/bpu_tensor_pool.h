@@ -0,0 +1,76 @@
+#ifndef BPU_TENSOR_POOL_H_
+#define BPU_TENSOR_POOL_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "utils/mqueue.h"
+
+#include "dnn/hb_dnn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 模型输出节点个数的上限(fcos 有 15 个)
+#define BPU_OUTPUT_TENSOR_MAX	15
+
+// 一组输出 tensor 当前的持有者，归还时检查，避免重复归还或者归还没有获取的 tensor
+typedef enum {
+	BPU_TENSOR_OWNER_POOL = 0,	// 空闲
+	BPU_TENSOR_OWNER_INFER,		// 推理线程正在使用
+	BPU_TENSOR_OWNER_POST,		// 已经交给后处理线程
+} bpu_tensor_owner_e;
+
+typedef struct {
+	hbDNNTensor	m_tensors[BPU_OUTPUT_TENSOR_MAX];
+	int32_t		m_owner;	// bpu_tensor_owner_e
+} bpu_tensor_slot_t;
+
+typedef struct {
+	uint64_t	m_acquired;		// 获取成功的次数
+	uint64_t	m_starved;		// 获取时没有空闲，需要等待的次数
+	uint64_t	m_dropped;		// 等待超时，丢弃输入帧的次数
+	int32_t		m_depth;
+	int32_t		m_in_use;		// 当前被推理和后处理持有的组数
+	int32_t		m_max_in_use;	// 持有组数的最大值，等于 m_depth 说明池子不够用
+} bpu_tensor_pool_stats_t;
+
+// 模型输出 tensor 池
+// 推理线程在 hbDNNInfer 之前获取一组输出，后处理完成后再归还，
+// 后处理跟不上时推理线程等待或者丢帧，不会覆盖还在后处理的输出
+typedef struct {
+	bpu_tensor_slot_t	*m_slots;
+	int32_t				m_depth;
+	int32_t				m_output_count;
+	tsQueue				m_free_queue;	// 空闲的 slot
+	pthread_mutex_t		m_mutex;		// 保护 m_owner 和统计数据
+	bpu_tensor_pool_stats_t	m_stats;
+} bpu_tensor_pool_t;
+
+/**
+ * 按模型的输出节点属性分配 depth 组输出 tensor
+ * @return 0 成功
+ */
+int32_t bpu_tensor_pool_init(bpu_tensor_pool_t *pool, hbDNNHandle_t dnn_handle, int32_t depth);
+void bpu_tensor_pool_deinit(bpu_tensor_pool_t *pool);
+
+/**
+ * 获取一组空闲的输出 tensor，最多等待 timeout_ms
+ * @return 没有空闲时返回 NULL，并记为一次丢帧
+ */
+hbDNNTensor *bpu_tensor_pool_acquire(bpu_tensor_pool_t *pool, uint32_t timeout_ms);
+// 推理完成后把输出交给后处理线程
+void bpu_tensor_pool_hand_over(bpu_tensor_pool_t *pool, hbDNNTensor *tensors);
+// 归还 acquire 获取的输出 tensor，推理失败或者后处理完成后调用
+void bpu_tensor_pool_release(bpu_tensor_pool_t *pool, hbDNNTensor *tensors);
+// 推理和后处理线程都已经停止后，收回所有输出 tensor
+void bpu_tensor_pool_reclaim(bpu_tensor_pool_t *pool);
+
+void bpu_tensor_pool_get_stats(bpu_tensor_pool_t *pool, bpu_tensor_pool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BPU_TENSOR_POOL_H_
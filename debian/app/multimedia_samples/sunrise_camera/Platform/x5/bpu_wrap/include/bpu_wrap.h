@@ -6,7 +6,10 @@
 
 #include "dnn/hb_dnn.h"
 
-typedef int (*bpu_post_process_callback)(char* result, void *userdata);
+#include "bpu_result.h"
+#include "bpu_tensor_pool.h"
+
+typedef int (*bpu_post_process_callback)(bpu_result_t *result, void *userdata);
 
 // 模型推理函数的原型
 typedef void *(*inference_function)(void *);
@@ -22,6 +25,16 @@ typedef struct {
 	post_processing_function post_proc_func; // 模型后处理函数指针
 } bpu_model_descriptor;
 
+// 零拷贝输入时对输入图像的引用(比如 vse 输出的 vnode buffer)，由送帧方实现
+// 引用计数归零时调用 release 把图像归还给送帧方
+typedef struct bpu_frame_ref_s {
+	int32_t refcnt;
+	void (*release)(struct bpu_frame_ref_s *ref);
+} bpu_frame_ref_t;
+
+void bpu_frame_ref_get(bpu_frame_ref_t *ref);
+void bpu_frame_ref_put(bpu_frame_ref_t *ref);
+
 /* info :
  * y,uv             2 plane
  * raw              1 plane
@@ -36,6 +49,9 @@ typedef struct bpu_buffer_info_s {
 	uint8_t *addr[16];
 	uint64_t paddr[16];
 	struct timeval tv; // 送入数据对应的时间戳，在视频和算法结果同步时需要使用
+	// 非空时 bpu 可以直接使用 addr/paddr 指向的内存做推理，不再拷贝
+	// bpu 持有图像期间会增加引用计数，推理完成后释放
+	bpu_frame_ref_t *ref;
 } bpu_buffer_info_t;
 
 // 这个结构体中存储的数据用来后处理时进行坐标还原
@@ -49,10 +65,33 @@ typedef struct {
 typedef struct {
 	hbDNNTensor m_dnn_tensor;
 	struct timeval tv; // 送入数据对应的时间戳，在视频和算法结果同步时需要使用
+	hbSysMem m_sys_mem[2]; // 拷贝模式下使用的预分配内存，y 和 uv
+	bpu_frame_ref_t *m_frame_ref; // 零拷贝模式下 m_dnn_tensor 直接指向的输入图像，推理完成后释放
 } bpu_tensor_info_t;
 
 #define BPU_INPUT_BUFFER_NUM 5
 
+// 是否直接使用送入图像的内存做推理(需要送帧方提供 bpu_buffer_info_t.ref)
+#ifndef BPU_ZERO_COPY
+#define BPU_ZERO_COPY 1
+#endif
+
+// 模型输出 tensor 池的深度，也是推理和后处理同时持有的输出组数上限
+#ifndef BPU_OUTPUT_POOL_DEPTH
+#define BPU_OUTPUT_POOL_DEPTH 4
+#endif
+
+// 没有空闲的输出 tensor 时推理线程最多等待的时间，超时丢弃这一帧输入
+#ifndef BPU_OUTPUT_POOL_WAIT_MS
+#define BPU_OUTPUT_POOL_WAIT_MS 50
+#endif
+
+// 零拷贝模式下最多同时持有的输入图像个数，超过时退回拷贝模式
+// vse 每个通道只有 3 个 buffer，至少留一个给 vse 继续出图
+#ifndef BPU_ZERO_COPY_MAX_HOLD
+#define BPU_ZERO_COPY_MAX_HOLD 2
+#endif
+
 typedef struct {
 	int32_t				m_vpp_id; // vedio pipeline id
 	char				m_model_name[32];
@@ -62,9 +101,15 @@ typedef struct {
 	tsThread 			m_run_model_thread; // 运算模型的线程
 	bpu_tensor_info_t	m_input_tensors[BPU_INPUT_BUFFER_NUM]; // 给bpu输入tensor预分配内存，避免每一帧数据都进行内存的申请和释放
 	int32_t				m_cur_input_tensor; // 当前使用的 bpu input 内存序号
+	int32_t				m_zero_copy; // 是否使用零拷贝输入
+	int32_t				m_held_frames; // 零拷贝模式下当前持有的输入图像个数
 	tsQueue				m_input_queue; // 用于算法预测的yuv数据
 	tsThread 			m_post_process_thread; // 算法后处理线程
 	tsQueue				m_output_queue; // 算法输出结果队列，yolo5的后处理时间太长了，用线程分开处理
+	bpu_tensor_pool_t	m_output_pool; // 模型输出 tensor 池，推理线程获取，后处理完成后归还
+	int32_t				m_output_pool_depth; // 0 表示使用 BPU_OUTPUT_POOL_DEPTH
+	int32_t				m_output_wait_ms; // 0 表示使用 BPU_OUTPUT_POOL_WAIT_MS，小于 0 表示不等待直接丢帧
+	bpu_result_t		m_result; // 算法结果的 websocket 消息，预分配避免每帧申请内存，只由后处理线程写入
 	bpu_post_process_callback	callback; // 算法结果处理后的回调，目前直接通过websocket发给web
 	void				*m_userdata; // 回调函数中使用到的数据
 } bpu_handle_t;
@@ -77,17 +122,23 @@ int bpu_wrap_deinit(bpu_handle_t *handle);
 // 对bpu_wrap_init再次封装，主要是根据alog_id使用不同的模型文件
 int32_t bpu_wrap_model_init(bpu_handle_t *bpu_handle, char *model_name);
 void bpu_wrap_set_ori_hw(bpu_handle_t *handle, int32_t width, int32_t height);
+// 设置输出 tensor 池的深度和等待时间，需要在 bpu_wrap_init 之前调用
+void bpu_wrap_set_output_pool(bpu_handle_t *handle, int32_t depth, int32_t wait_ms);
+// 获取输出 tensor 池的使用情况，m_starved/m_dropped 增长说明后处理跟不上推理
+void bpu_wrap_get_output_pool_stats(bpu_handle_t *handle, bpu_tensor_pool_stats_t *stats);
 int32_t bpu_wrap_get_model_hw(char *model_name, int32_t *width, int32_t *height);
 
 int32_t bpu_wrap_start(bpu_handle_t *handle);
 int32_t bpu_wrap_stop(bpu_handle_t *handle);
 
 int32_t bpu_wrap_send_frame(bpu_handle_t *handle, bpu_buffer_info_t *input_buffer);
+// 丢弃还没有推理的输入，释放零拷贝模式下持有的图像，送帧方退出前调用
+void bpu_wrap_flush_input(bpu_handle_t *handle);
 
 void bpu_wrap_callback_register(bpu_handle_t* handle, bpu_post_process_callback callback, void *userdata);
 void bpu_wrap_callback_unregister(bpu_handle_t* handle);
 
-int32_t bpu_wrap_general_result_handle(char *result, void *userdata);
+int32_t bpu_wrap_general_result_handle(bpu_result_t *result, void *userdata);
 
 void print_bpu_buffer_info(const bpu_buffer_info_t *buffer_info);
 
@@ -11,6 +11,8 @@
 
 #include "dnn/hb_dnn.h"
 
+#include "bpu_result.h"
+
 #ifdef __cplusplus
 	extern "C"{
 #endif
@@ -24,18 +26,18 @@ typedef struct {
 	float nms_threshold; // 0.60
 	int nms_top_k; // 500
 	int is_pad_resize;
+	int pipeline; // 算法结果对应 web 上的通道号，从 1 开始
 	struct timeval tv; // 送入数据对应的时间戳，在视频和算法结果同步时需要使用
 	hbDNNTensor *output_tensor;
 } FcosPostProcessInfo_t;
 
 	/**
 	 * Post process
-	 * @param[in] tensor: Model output tensors
-	 * @param[in] image_tensor: Input image tensor
-	 * @param[out] perception: Perception output data
+	 * @param[in] post_info: Model output tensors and post process params
+	 * @param[out] result: Websocket message of the detections
 	 * @return 0 if success
 	 */
-	char* FcosPostProcess(FcosPostProcessInfo_t *post_info);
+	int32_t FcosPostProcess(FcosPostProcessInfo_t *post_info, bpu_result_t *result);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,78 @@
+// Copyright (c) 2024 D-Robotics.All Rights Reserved.
+//
+// The material in this file is confidential and contains trade secrets
+// of D-Robotics Inc. This is proprietary information owned by
+// D-Robotics Inc. No part of this work may be disclosed,
+// reproduced, copied, transmitted, or used in any way for any purpose,
+// without the express written permission of D-Robotics Inc.
+
+#ifndef _POST_PROCESS_NMS_H_
+#define _POST_PROCESS_NMS_H_
+
+#include <vector>
+
+typedef enum {
+	NMS_MODE_AUTO = 0,	// 检测框较多时使用 NMS_MODE_GRID，否则使用 NMS_MODE_LINEAR
+	NMS_MODE_LINEAR,	// 每个候选框和同类别已保留的框逐一比较
+	NMS_MODE_GRID,		// 按网格划分已保留的框，候选框只和相交网格中的框比较
+} NmsMode;
+
+/**
+ * NMS 输入的检测框，按结构体数组(SoA)存放，方便向量化计算
+ */
+struct NmsBoxes {
+	std::vector<float> xmin;
+	std::vector<float> ymin;
+	std::vector<float> xmax;
+	std::vector<float> ymax;
+	std::vector<float> score;
+	std::vector<int> id;
+
+	size_t size() const { return score.size(); }
+
+	void clear() {
+		xmin.clear();
+		ymin.clear();
+		xmax.clear();
+		ymax.clear();
+		score.clear();
+		id.clear();
+	}
+
+	void reserve(size_t n) {
+		xmin.reserve(n);
+		ymin.reserve(n);
+		xmax.reserve(n);
+		ymax.reserve(n);
+		score.reserve(n);
+		id.reserve(n);
+	}
+
+	void push_back(float x1, float y1, float x2, float y2, float s, int class_id) {
+		xmin.push_back(x1);
+		ymin.push_back(y1);
+		xmax.push_back(x2);
+		ymax.push_back(y2);
+		score.push_back(s);
+		id.push_back(class_id);
+	}
+};
+
+/**
+ * Greedy non maximum suppression
+ * 结果和按分数稳定排序后两两比较的实现完全一致
+ * @param[in] boxes: 检测框
+ * @param[in] iou_threshold: 和已保留的框交并比大于该值的框被抑制
+ * @param[in] top_k: 最多保留的框数
+ * @param[in] suppress: true 表示不同类别之间也互相抑制
+ * @param[out] keep: 保留的框在 boxes 中的下标，按分数从高到低排列
+ * @param[in] mode: 候选框的查找方式
+ */
+void bpu_nms(const NmsBoxes &boxes,
+			 float iou_threshold,
+			 int top_k,
+			 bool suppress,
+			 std::vector<int> &keep,
+			 NmsMode mode = NMS_MODE_AUTO);
+
+#endif  // _POST_PROCESS_NMS_H_
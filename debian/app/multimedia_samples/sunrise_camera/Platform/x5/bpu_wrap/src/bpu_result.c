@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "utils/utils_log.h"
+
+#include "bpu_result.h"
+
+// 坐标和分数保留的小数位数，和之前 std::setprecision(6) 的输出一致
+#define BPU_RESULT_DECIMALS 6
+// 一个数字最多占用的字节数: 符号 + 12 位整数 + 小数点 + 6 位小数
+#define BPU_RESULT_NUMBER_MAX 24
+
+static const double s_fixed_scale[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6};
+
+int32_t bpu_result_fmt_fixed(char *buf, float v, int32_t decimals)
+{
+	char digits[BPU_RESULT_NUMBER_MAX];
+	char *p = buf;
+	double scaled, frac;
+	uint64_t q;
+	int32_t n = 0, i;
+
+	if (decimals < 0)
+		decimals = 0;
+	else if (decimals > 6)
+		decimals = 6;
+
+	// json 不支持 nan 和 inf
+	if (!(v > -1e12f && v < 1e12f))
+		v = 0;
+	if (signbit(v)) {
+		*p++ = '-';
+		v = -v;
+	}
+
+	// float 只有 24 位有效位，乘以 10^6 以内的数在 double 中是精确的，
+	// 按 round half to even 取整后和 printf 的结果完全一致
+	scaled = (double)v * s_fixed_scale[decimals];
+	q = (uint64_t)scaled;
+	frac = scaled - (double)q;
+	if (frac > 0.5 || (frac == 0.5 && (q & 1)))
+		q++;
+
+	for (i = 0; i < decimals; i++) {
+		digits[n++] = '0' + q % 10;
+		q /= 10;
+	}
+	if (decimals > 0)
+		digits[n++] = '.';
+	do {
+		digits[n++] = '0' + q % 10;
+		q /= 10;
+	} while (q);
+
+	while (n > 0)
+		*p++ = digits[--n];
+	return p - buf;
+}
+
+static char *fmt_u64(char *p, uint64_t v)
+{
+	char digits[24];
+	int32_t n = 0;
+
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (n > 0)
+		*p++ = digits[--n];
+	return p;
+}
+
+static char *fmt_i32(char *p, int32_t v)
+{
+	if (v < 0) {
+		*p++ = '-';
+		return fmt_u64(p, -(int64_t)v);
+	}
+	return fmt_u64(p, v);
+}
+
+static char *fmt_str(char *p, const char *s, size_t len)
+{
+	memcpy(p, s, len);
+	return p + len;
+}
+
+#define FMT_LITERAL(p, s) fmt_str(p, s, sizeof(s) - 1)
+
+static void *bin_put(void *p, const void *v, size_t len)
+{
+	memcpy(p, v, len);
+	return (uint8_t *)p + len;
+}
+
+int32_t bpu_result_init(bpu_result_t *result)
+{
+	if (result == NULL)
+		return -1;
+
+	memset(result, 0, sizeof(bpu_result_t));
+	result->m_json = malloc(BPU_RESULT_JSON_SIZE);
+	result->m_bin = malloc(BPU_RESULT_BIN_SIZE);
+	if (result->m_json == NULL || result->m_bin == NULL) {
+		SC_LOGE("Failed to allocate memory for bpu result");
+		bpu_result_deinit(result);
+		return -1;
+	}
+	result->m_json[0] = '\0';
+	return 0;
+}
+
+void bpu_result_deinit(bpu_result_t *result)
+{
+	if (result == NULL)
+		return;
+
+	free(result->m_json);
+	free(result->m_bin);
+	memset(result, 0, sizeof(bpu_result_t));
+}
+
+static char *begin_json(bpu_result_t *result, int32_t pipeline, uint64_t timestamp)
+{
+	char *p = result->m_json;
+
+	p = FMT_LITERAL(p, "{\"kind\":10,\"pipeline\":");
+	p = fmt_i32(p, pipeline);
+	p = FMT_LITERAL(p, ",\"timestamp\":");
+	p = fmt_u64(p, timestamp);
+	return p;
+}
+
+void bpu_result_begin_detection(bpu_result_t *result, int32_t pipeline, uint64_t timestamp)
+{
+	uint32_t u32;
+	uint8_t *b = result->m_bin;
+	char *p;
+
+	p = begin_json(result, pipeline, timestamp);
+	p = FMT_LITERAL(p, ",\"detection_result\":[");
+	result->m_json_len = p - result->m_json;
+
+	u32 = BPU_RESULT_BIN_MAGIC;
+	b = bin_put(b, &u32, sizeof(u32));
+	u32 = pipeline;
+	b = bin_put(b, &u32, sizeof(u32));
+	b = bin_put(b, &timestamp, sizeof(timestamp));
+	u32 = 0; // count 在 end 时回填
+	b = bin_put(b, &u32, sizeof(u32));
+	result->m_bin_len = b - result->m_bin;
+
+	result->m_count = 0;
+	result->m_truncated = 0;
+}
+
+void bpu_result_add_detection(bpu_result_t *result, const float bbox[4],
+	float score, int32_t id, const char *name)
+{
+	size_t name_len, json_need, bin_need;
+	uint16_t u16 = id;
+	uint8_t u8;
+	uint8_t *b;
+	char *p;
+
+	if (name == NULL)
+		name = "";
+	name_len = strlen(name);
+	if (name_len > 255)
+		name_len = 255;
+	json_need = 10 * BPU_RESULT_NUMBER_MAX + name_len;
+	bin_need = 5 * sizeof(float) + 4 + name_len;
+
+	// 结尾的 "]}" 也要留出空间
+	if (result->m_json_len + json_need + 2 >= BPU_RESULT_JSON_SIZE
+		|| result->m_bin_len + bin_need > BPU_RESULT_BIN_SIZE) {
+		result->m_truncated++;
+		return;
+	}
+
+	p = result->m_json + result->m_json_len;
+	if (result->m_count > 0)
+		*p++ = ',';
+	p = FMT_LITERAL(p, "{\"bbox\":[");
+	p += bpu_result_fmt_fixed(p, bbox[0], BPU_RESULT_DECIMALS);
+	*p++ = ',';
+	p += bpu_result_fmt_fixed(p, bbox[1], BPU_RESULT_DECIMALS);
+	*p++ = ',';
+	p += bpu_result_fmt_fixed(p, bbox[2], BPU_RESULT_DECIMALS);
+	*p++ = ',';
+	p += bpu_result_fmt_fixed(p, bbox[3], BPU_RESULT_DECIMALS);
+	p = FMT_LITERAL(p, "],\"score\":");
+	p += bpu_result_fmt_fixed(p, score, BPU_RESULT_DECIMALS);
+	p = FMT_LITERAL(p, ",\"id\":");
+	p = fmt_i32(p, id);
+	p = FMT_LITERAL(p, ",\"name\":\"");
+	p = fmt_str(p, name, name_len);
+	p = FMT_LITERAL(p, "\"}");
+	result->m_json_len = p - result->m_json;
+
+	b = result->m_bin + result->m_bin_len;
+	b = bin_put(b, bbox, 4 * sizeof(float));
+	b = bin_put(b, &score, sizeof(score));
+	b = bin_put(b, &u16, sizeof(u16));
+	u8 = name_len;
+	b = bin_put(b, &u8, sizeof(u8));
+	u8 = 0;
+	b = bin_put(b, &u8, sizeof(u8));
+	b = bin_put(b, name, name_len);
+	result->m_bin_len = b - result->m_bin;
+
+	result->m_count++;
+}
+
+void bpu_result_end_detection(bpu_result_t *result)
+{
+	char *p = result->m_json + result->m_json_len;
+
+	p = FMT_LITERAL(p, "]}");
+	*p = '\0';
+	result->m_json_len = p - result->m_json;
+
+	memcpy(result->m_bin + BPU_RESULT_BIN_HEADER_SIZE - sizeof(uint32_t),
+		&result->m_count, sizeof(uint32_t));
+
+	if (result->m_truncated > 0)
+		SC_LOGW("bpu result buffer is full, drop %d detections", result->m_truncated);
+}
+
+void bpu_result_classification(bpu_result_t *result, int32_t pipeline, uint64_t timestamp,
+	int32_t id, float score)
+{
+	char *p;
+
+	p = begin_json(result, pipeline, timestamp);
+	p = FMT_LITERAL(p, ",\"classification_result\":\"id=");
+	p = fmt_i32(p, id);
+	p = FMT_LITERAL(p, ", score=");
+	p += bpu_result_fmt_fixed(p, score, 3);
+	p = FMT_LITERAL(p, "\"}");
+	*p = '\0';
+	result->m_json_len = p - result->m_json;
+	result->m_bin_len = 0;
+	result->m_count = 0;
+	result->m_truncated = 0;
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "utils/utils_log.h"
+
+#include "bpu_tensor_pool.h"
+
+static bpu_tensor_slot_t *bpu_tensor_pool_find_slot(bpu_tensor_pool_t *pool, hbDNNTensor *tensors)
+{
+	for (int32_t i = 0; i < pool->m_depth; i++) {
+		if (pool->m_slots[i].m_tensors == tensors)
+			return &pool->m_slots[i];
+	}
+	return NULL;
+}
+
+int32_t bpu_tensor_pool_init(bpu_tensor_pool_t *pool, hbDNNHandle_t dnn_handle, int32_t depth)
+{
+	int32_t i = 0, j = 0, ret = 0;
+
+	memset(pool, 0, sizeof(bpu_tensor_pool_t));
+
+	hbDNNGetOutputCount(&pool->m_output_count, dnn_handle);
+	if (pool->m_output_count <= 0 || pool->m_output_count > BPU_OUTPUT_TENSOR_MAX) {
+		SC_LOGE("unsupported model output count %d", pool->m_output_count);
+		return -1;
+	}
+
+	pool->m_slots = (bpu_tensor_slot_t *)calloc(depth, sizeof(bpu_tensor_slot_t));
+	if (pool->m_slots == NULL) {
+		SC_LOGE("malloc bpu tensor pool failed");
+		return -1;
+	}
+	pool->m_depth = depth;
+	pool->m_stats.m_depth = depth;
+
+	for (i = 0; i < depth; i++) {
+		for (j = 0; j < pool->m_output_count; j++) {
+			hbDNNTensor *tensor = &pool->m_slots[i].m_tensors[j];
+			ret = hbDNNGetOutputTensorProperties(&tensor->properties, dnn_handle, j);
+			if (ret == 0)
+				ret = hbSysAllocCachedMem(&tensor->sysMem[0], tensor->properties.alignedByteSize);
+			if (ret != 0) {
+				SC_LOGE("prepare model output tensor failed(%d)", ret);
+				bpu_tensor_pool_deinit(pool);
+				return -1;
+			}
+		}
+	}
+
+	// 队列里最多存 length - 1 个
+	mQueueCreate(&pool->m_free_queue, depth + 1);
+	pthread_mutex_init(&pool->m_mutex, NULL);
+	for (i = 0; i < depth; i++)
+		mQueueEnqueueEx(&pool->m_free_queue, &pool->m_slots[i]);
+
+	return 0;
+}
+
+void bpu_tensor_pool_deinit(bpu_tensor_pool_t *pool)
+{
+	int32_t i = 0, j = 0;
+
+	if (pool->m_slots == NULL)
+		return;
+
+	for (i = 0; i < pool->m_depth; i++) {
+		for (j = 0; j < pool->m_output_count; j++) {
+			hbDNNTensor *tensor = &pool->m_slots[i].m_tensors[j];
+			if (tensor->sysMem[0].virAddr != NULL && hbSysFreeMem(&tensor->sysMem[0]) != 0)
+				SC_LOGE("hbSysFreeMem failed");
+		}
+	}
+	if (pool->m_free_queue.psCells != NULL) {
+		mQueueDestroy(&pool->m_free_queue);
+		pthread_mutex_destroy(&pool->m_mutex);
+	}
+	free(pool->m_slots);
+	memset(pool, 0, sizeof(bpu_tensor_pool_t));
+}
+
+hbDNNTensor *bpu_tensor_pool_acquire(bpu_tensor_pool_t *pool, uint32_t timeout_ms)
+{
+	bpu_tensor_slot_t *slot = NULL;
+	int32_t starved = 0;
+
+	if (mQueueDequeueTimed(&pool->m_free_queue, 0, (void**)&slot) != E_QUEUE_OK) {
+		starved = 1;
+		if (timeout_ms == 0
+			|| mQueueDequeueTimed(&pool->m_free_queue, timeout_ms, (void**)&slot) != E_QUEUE_OK)
+			slot = NULL;
+	}
+
+	pthread_mutex_lock(&pool->m_mutex);
+	pool->m_stats.m_starved += starved;
+	if (slot == NULL) {
+		pool->m_stats.m_dropped++;
+	} else {
+		slot->m_owner = BPU_TENSOR_OWNER_INFER;
+		pool->m_stats.m_acquired++;
+		pool->m_stats.m_in_use++;
+		if (pool->m_stats.m_in_use > pool->m_stats.m_max_in_use)
+			pool->m_stats.m_max_in_use = pool->m_stats.m_in_use;
+	}
+	pthread_mutex_unlock(&pool->m_mutex);
+
+	return slot == NULL ? NULL : slot->m_tensors;
+}
+
+void bpu_tensor_pool_hand_over(bpu_tensor_pool_t *pool, hbDNNTensor *tensors)
+{
+	bpu_tensor_slot_t *slot = bpu_tensor_pool_find_slot(pool, tensors);
+
+	pthread_mutex_lock(&pool->m_mutex);
+	if (slot == NULL || slot->m_owner != BPU_TENSOR_OWNER_INFER)
+		SC_LOGE("output tensor %p is not owned by inference", tensors);
+	else
+		slot->m_owner = BPU_TENSOR_OWNER_POST;
+	pthread_mutex_unlock(&pool->m_mutex);
+}
+
+void bpu_tensor_pool_release(bpu_tensor_pool_t *pool, hbDNNTensor *tensors)
+{
+	bpu_tensor_slot_t *slot = bpu_tensor_pool_find_slot(pool, tensors);
+
+	pthread_mutex_lock(&pool->m_mutex);
+	if (slot == NULL || slot->m_owner == BPU_TENSOR_OWNER_POOL) {
+		pthread_mutex_unlock(&pool->m_mutex);
+		SC_LOGE("output tensor %p released twice or not from pool", tensors);
+		return;
+	}
+	slot->m_owner = BPU_TENSOR_OWNER_POOL;
+	pool->m_stats.m_in_use--;
+	pthread_mutex_unlock(&pool->m_mutex);
+
+	mQueueEnqueueEx(&pool->m_free_queue, slot);
+}
+
+void bpu_tensor_pool_reclaim(bpu_tensor_pool_t *pool)
+{
+	bpu_tensor_slot_t *slot = NULL;
+
+	if (pool->m_slots == NULL)
+		return;
+
+	while (mQueueDequeueTimed(&pool->m_free_queue, 0, (void**)&slot) == E_QUEUE_OK)
+		;
+
+	pthread_mutex_lock(&pool->m_mutex);
+	for (int32_t i = 0; i < pool->m_depth; i++) {
+		pool->m_slots[i].m_owner = BPU_TENSOR_OWNER_POOL;
+		mQueueEnqueueEx(&pool->m_free_queue, &pool->m_slots[i]);
+	}
+	pool->m_stats.m_in_use = 0;
+	pthread_mutex_unlock(&pool->m_mutex);
+}
+
+void bpu_tensor_pool_get_stats(bpu_tensor_pool_t *pool, bpu_tensor_pool_stats_t *stats)
+{
+	pthread_mutex_lock(&pool->m_mutex);
+	*stats = pool->m_stats;
+	pthread_mutex_unlock(&pool->m_mutex);
+}
@@ -19,6 +19,7 @@
 #include "utils/utils_log.h"
 #include "utils/mthread.h"
 #include "utils/time_utils.h"
+#include "utils/latency_stats.h"
 
 #include "bpu_wrap.h"
 #include "yolov5_post_process.h"
@@ -39,6 +40,28 @@
 		}                                                                \
 	} while (0);
 
+void bpu_frame_ref_get(bpu_frame_ref_t *ref)
+{
+	__atomic_add_fetch(&ref->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+void bpu_frame_ref_put(bpu_frame_ref_t *ref)
+{
+	if (__atomic_sub_fetch(&ref->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+		ref->release(ref);
+}
+
+// 推理完成(或者丢弃)后归还零拷贝模式下持有的输入图像
+static void bpu_input_tensor_done(bpu_handle_t *handle, bpu_tensor_info_t *input_tensor)
+{
+	if (input_tensor->m_frame_ref == NULL)
+		return;
+
+	bpu_frame_ref_put(input_tensor->m_frame_ref);
+	input_tensor->m_frame_ref = NULL;
+	__atomic_sub_fetch(&handle->m_held_frames, 1, __ATOMIC_RELAXED);
+}
+
 void print_bpu_buffer_info(const bpu_buffer_info_t *buffer_info)
 {
 	printf("=== Bpu Buffer Info ===");
@@ -123,35 +146,76 @@ static int32_t print_model_info(hbPackedDNNHandle_t *packed_dnn_handle)
 	return 0;
 }
 
-static int32_t prepare_output_tensor(hbDNNTensor *output_tensor,
-						   hbDNNHandle_t dnn_handle) {
-	int32_t ret = 0;
+static uint32_t bpu_output_wait_ms(bpu_handle_t *handle)
+{
+	if (handle->m_output_wait_ms == 0)
+		return BPU_OUTPUT_POOL_WAIT_MS;
+	return handle->m_output_wait_ms < 0 ? 0 : handle->m_output_wait_ms;
+}
 
-	int32_t i = 0;
-	int32_t output_count = 0;
-	// hbDNNTensorProperties properties;
-	hbDNNTensor *output = output_tensor;
+// 每 10 秒检查一次输出 tensor 池，后处理跟不上推理时打印
+static void bpu_output_pool_report(bpu_handle_t *handle, time_t *last_time,
+	bpu_tensor_pool_stats_t *last_stats)
+{
+	bpu_tensor_pool_stats_t stats;
+	time_t now = time(NULL);
 
-	hbDNNGetOutputCount(&output_count, dnn_handle);
-	for (i = 0; i < output_count; ++i) {
-	HB_CHECK_SUCCESS(
-			hbDNNGetOutputTensorProperties(&output[i].properties, dnn_handle, i),
-			"hbDNNGetOutputTensorProperties failed");
-	HB_CHECK_SUCCESS(hbSysAllocCachedMem(&output[i].sysMem[0], output[i].properties.alignedByteSize),
-			"hbSysAllocCachedMem failed");
+	if (now - *last_time < 10)
+		return;
+	*last_time = now;
+
+	bpu_tensor_pool_get_stats(&handle->m_output_pool, &stats);
+	if (stats.m_starved != last_stats->m_starved || stats.m_dropped != last_stats->m_dropped) {
+		SC_LOGW("[%d] output tensor pool starved %llu, dropped %llu frames, max in use %d/%d",
+			handle->m_vpp_id,
+			(unsigned long long)(stats.m_starved - last_stats->m_starved),
+			(unsigned long long)(stats.m_dropped - last_stats->m_dropped),
+			stats.m_max_in_use, stats.m_depth);
 	}
-
-  return ret;
+	*last_stats = stats;
 }
 
-static int32_t release_output_tensor(hbDNNTensor *output, int32_t len)
+// 录制模型输出 tensor，给 chip_base_test/10_sunrise_camera_perf/yolov5_replay 在 PC 或板子上回放
+// 每帧一个文件，全部为小端 int32:
+//   magic(BPU_DUMP_MAGIC) width height ori_width ori_height tensor_count
+//   每个 tensor: layout type quanti_type scale_len valid_shape[4] aligned_shape[4] byte_size
+//                float scale[scale_len] 和 byte_size 字节的数据
+// #define BPU_DUMP_OUTPUT 1
+#ifdef BPU_DUMP_OUTPUT
+#define BPU_DUMP_MAGIC 0x54555042 // "BPUT"
+static void bpu_dump_output(Yolov5PostProcessInfo_t *post_info, int32_t tensor_count, int32_t index)
 {
-	for (int32_t i = 0; i < len; i++) {
-		HB_CHECK_SUCCESS(hbSysFreeMem(&(output[i].sysMem[0])),
-					   "hbSysFreeMem failed");
+	char file_name[128];
+	int32_t header[6] = {BPU_DUMP_MAGIC, post_info->width, post_info->height,
+		post_info->ori_width, post_info->ori_height, tensor_count};
+	FILE *fp;
+	int32_t i;
+
+	snprintf(file_name, sizeof(file_name), "/tmp/bpu_yolov5_%04d.bin", index);
+	fp = fopen(file_name, "wb");
+	if (fp == NULL) {
+		SC_LOGE("open %s failed: %s", file_name, strerror(errno));
+		return;
 	}
-	return 0;
+	fwrite(header, sizeof(header), 1, fp);
+	for (i = 0; i < tensor_count; i++) {
+		hbDNNTensorProperties *prop = &post_info->output_tensor[i].properties;
+		int32_t scale_len = prop->quantiType == SCALE ? prop->scale.scaleLen : 0;
+		int32_t desc[13] = {prop->tensorLayout, prop->tensorType, prop->quantiType, scale_len,
+			prop->validShape.dimensionSize[0], prop->validShape.dimensionSize[1],
+			prop->validShape.dimensionSize[2], prop->validShape.dimensionSize[3],
+			prop->alignedShape.dimensionSize[0], prop->alignedShape.dimensionSize[1],
+			prop->alignedShape.dimensionSize[2], prop->alignedShape.dimensionSize[3],
+			prop->alignedByteSize};
+		fwrite(desc, sizeof(desc), 1, fp);
+		if (scale_len > 0)
+			fwrite(prop->scale.scaleData, sizeof(float), scale_len, fp);
+		fwrite(post_info->output_tensor[i].sysMem[0].virAddr, 1, prop->alignedByteSize, fp);
+	}
+	fclose(fp);
+	SC_LOGI("dump output tensors to %s", file_name);
 }
+#endif
 
 static void *post_process_yolov5s(void *ptr)
 {
@@ -159,10 +223,13 @@ static void *post_process_yolov5s(void *ptr)
 	Yolov5PostProcessInfo_t *post_info;
 
 	int count = 0;
+#ifdef BPU_DUMP_OUTPUT
+	int dump_count = 0;
+#endif
 	mThreadSetName(privThread, __func__);
 
 	SC_LOGI("thread [post_process_yolov5s] start .");
-	struct TimeStatistics time_statistics;
+	int32_t post_process_stage = latency_stats_stage("post_process");
 	bpu_handle_t *bpu_handle = (bpu_handle_t *)privThread->pvThreadData;
 	while (privThread->eState == E_THREAD_RUNNING) {
 		if (mQueueDequeueTimed(&bpu_handle->m_output_queue, 100, (void**)&post_info) != E_QUEUE_OK){
@@ -170,11 +237,16 @@ static void *post_process_yolov5s(void *ptr)
 			continue;
 		}
 
-		time_statistics_at_beginning_of_loop(&time_statistics);
-		char *results = Yolov5PostProcess(post_info);
-		time_statistics_at_ending_of_loop(&time_statistics);
-		time_statistics_info_show(&time_statistics, "yolov5 post process", false);
-		if (results) {
+#ifdef BPU_DUMP_OUTPUT
+		// yolov5 固定 3 个输出，每 30 帧录一帧，最多 100 帧
+		if (dump_count % 30 == 0 && dump_count / 30 < 100)
+			bpu_dump_output(post_info, 3, dump_count / 30);
+		dump_count++;
+#endif
+		uint64_t post_start_ns = get_monotonic_ns();
+		int32_t ret = Yolov5PostProcess(post_info, &bpu_handle->m_result);
+		latency_stats_record_since(post_process_stage, post_start_ns);
+		if (ret == 0) {
 			if (NULL != bpu_handle->callback) {
 
 				{
@@ -183,17 +255,18 @@ static void *post_process_yolov5s(void *ptr)
 						pipeline_id = *(int*)bpu_handle->m_userdata;
 
 					if(count % 3300 == 0){
-						SC_LOGD("[%d] inference:[%s]", pipeline_id, results);
+						SC_LOGD("[%d] inference:[%s]", pipeline_id, bpu_handle->m_result.m_json);
 					}
 					count++;
 				}
-				bpu_handle->callback(results, bpu_handle->m_userdata);
+				bpu_handle->callback(&bpu_handle->m_result, bpu_handle->m_userdata);
 			} else {
-				SC_LOGI("%s", results);
+				SC_LOGI("%s", bpu_handle->m_result.m_json);
 			}
-			free(results);
 		}
 		if (post_info) {
+			// 后处理完成，输出 tensor 还给推理线程
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, post_info->output_tensor);
 			free(post_info);
 			post_info = NULL;
 		}
@@ -207,7 +280,7 @@ static void *post_process_yolov5s(void *ptr)
 static void *inference_yolov5s(void *ptr)
 {
 	tsThread *privThread = (tsThread*)ptr;
-	int32_t i = 0, ret = 0;
+	int32_t ret = 0;
 	bpu_tensor_info_t *input_tensor;
 	int32_t output_count = 0;
 
@@ -225,37 +298,37 @@ static void *inference_yolov5s(void *ptr)
 
 	hbDNNGetOutputCount(&output_count, dnn_handle);
 
-	// 准备模型输出节点tensor，5组输出buff轮转，简单处理，理论上后处理的速度是要比算法推理更快的
-	hbDNNTensor output_tensors[5][3];
-	int32_t cur_ouput_buf_idx = 0;
-	for (i = 0; i < 5; i++) {
-		ret = prepare_output_tensor(output_tensors[i], dnn_handle);
-		if (ret) {
-			SC_LOGE("prepare model output tensor failed");
-			goto exit;
-		}
-	}
+	// 模型输出 tensor 从 m_output_pool 获取，后处理线程处理完成后归还
+	hbDNNTensor *output = NULL;
+	time_t pool_report_time = time(NULL);
+	bpu_tensor_pool_stats_t pool_stats = {0};
 
 	hbDNNTaskHandle_t task_handle = NULL;
-
-	struct TimeStatistics time_statistics;
-	char time_sts_tag[32];
-	sprintf(time_sts_tag, "yolov5 infer process:%d", bpu_handle->m_vpp_id);
+	int32_t infer_stage = latency_stats_stage("bpu_infer");
+	uint64_t infer_start_ns = 0;
 
 	while (privThread->eState == E_THREAD_RUNNING) {
 
 		if (mQueueDequeueTimed(&bpu_handle->m_input_queue, 100, (void**)&input_tensor) != E_QUEUE_OK)
 			continue;
 
-		time_statistics_at_beginning_of_loop(&time_statistics);
 		// make sure memory data is flushed to DDR before inference
-		hbSysFlushMem(&input_tensor->m_dnn_tensor.sysMem[0], HB_SYS_MEM_CACHE_CLEAN);
-
-		hbDNNTensor *output = &output_tensors[cur_ouput_buf_idx][0];
+		// 零拷贝的输入由 vse 硬件直接写入 DDR，不需要刷 cache
+		if (input_tensor->m_frame_ref == NULL)
+			hbSysFlushMem(&input_tensor->m_dnn_tensor.sysMem[0], HB_SYS_MEM_CACHE_CLEAN);
+
+		bpu_output_pool_report(bpu_handle, &pool_report_time, &pool_stats);
+		// 后处理还没有归还输出 tensor 时等待，超时就丢弃这一帧，不占用 bpu
+		output = bpu_tensor_pool_acquire(&bpu_handle->m_output_pool, bpu_output_wait_ms(bpu_handle));
+		if (output == NULL) {
+			bpu_input_tensor_done(bpu_handle, input_tensor);
+			continue;
+		}
 
 		// 模型推理infer
 		hbDNNInferCtrlParam infer_ctrl_param;
 		HB_DNN_INITIALIZE_INFER_CTRL_PARAM(&infer_ctrl_param);
+		infer_start_ns = get_monotonic_ns();
 		ret = hbDNNInfer(&task_handle,
 				&output,
 				&input_tensor->m_dnn_tensor,
@@ -263,44 +336,42 @@ static void *inference_yolov5s(void *ptr)
 				&infer_ctrl_param);
 		if (ret) {
 			SC_LOGE("hbDNNInfer failed");
+			bpu_input_tensor_done(bpu_handle, input_tensor);
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			break;
 		}
 		// wait task done
 		ret = hbDNNWaitTaskDone(task_handle, 0);
+		// 推理完成，输入图像可以归还给 vse 了
+		bpu_input_tensor_done(bpu_handle, input_tensor);
 		if (ret) {
 			SC_LOGE("hbDNNWaitTaskDone failed");
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			break;
 		}
 
 		// make sure CPU read data from DDR before using output tensor data
 		for (int32_t i = 0; i < output_count; i++) {
-			hbSysFlushMem(&output_tensors[cur_ouput_buf_idx][i].sysMem[0], HB_SYS_MEM_CACHE_INVALIDATE);
+			hbSysFlushMem(&output[i].sysMem[0], HB_SYS_MEM_CACHE_INVALIDATE);
 		}
 
 		// release task handle
 		ret = hbDNNReleaseTask(task_handle);
 		if (ret) {
 			SC_LOGE("hbDNNReleaseTask failed");
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			break;
 		}
 		task_handle = NULL;
-		time_statistics_at_ending_of_loop(&time_statistics);
-		time_statistics_info_show(&time_statistics, time_sts_tag, false);
-
-		// 如果后处理队列满的，直接返回
-		if (mQueueIsFull(&bpu_handle->m_output_queue)) {
-			SC_LOGI("post process queue full, skip it, queue length is %d",
-				bpu_handle->m_output_queue.u32Length);
-			cur_ouput_buf_idx++;
-			cur_ouput_buf_idx %= 5;
-			continue;
-		}
+		latency_stats_record_since(infer_stage, infer_start_ns);
 
 		// 后处理数据
+		// 后处理队列和输出 tensor 池一样深，持有输出 tensor 时入队不会失败
 		Yolov5PostProcessInfo_t *post_info;
 		post_info = (Yolov5PostProcessInfo_t *)malloc(sizeof(Yolov5PostProcessInfo_t));
 		if (NULL == post_info) {
 			SC_LOGE("Failed to allocate memory for post_info");
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			continue;
 		}
 		post_info->is_pad_resize = 0;
@@ -311,17 +382,13 @@ static void *inference_yolov5s(void *ptr)
 		post_info->height = bpu_handle->m_image_info.m_model_h;
 		post_info->ori_width = bpu_handle->m_image_info.m_ori_width;
 		post_info->ori_height = bpu_handle->m_image_info.m_ori_height;
+		post_info->pipeline = bpu_handle->m_vpp_id + 1;
 		post_info->tv = input_tensor->tv;
-		post_info->output_tensor = output_tensors[cur_ouput_buf_idx];
+		post_info->output_tensor = output;
+		bpu_tensor_pool_hand_over(&bpu_handle->m_output_pool, output);
 		mQueueEnqueue(&bpu_handle->m_output_queue, post_info);
-		cur_ouput_buf_idx++;
-		cur_ouput_buf_idx %= 5;
-
-
 	}
 
-	for (i = 0; i < 5; i++)
-		release_output_tensor(output_tensors[i], 3);	// 释放模型输出资源
 exit:
 	mThreadFinish(privThread);
 	return NULL;
@@ -335,23 +402,26 @@ static void *post_process_fcos(void *ptr)
 
 	mThreadSetName(privThread, __func__);
 
+	int32_t post_process_stage = latency_stats_stage("post_process");
 	bpu_handle_t *bpu_handle = (bpu_handle_t *)privThread->pvThreadData;
 	while (privThread->eState == E_THREAD_RUNNING) {
 		if (mQueueDequeueTimed(&bpu_handle->m_output_queue, 100, (void**)&post_info) != E_QUEUE_OK)
 			continue;
 
-		char *results = FcosPostProcess(post_info);
-
-		if (results) {
+		uint64_t post_start_ns = get_monotonic_ns();
+		int32_t ret = FcosPostProcess(post_info, &bpu_handle->m_result);
+		latency_stats_record_since(post_process_stage, post_start_ns);
+		if (ret == 0) {
 			if (NULL != bpu_handle->callback) {
-				bpu_handle->callback(results, bpu_handle->m_userdata);
+				bpu_handle->callback(&bpu_handle->m_result, bpu_handle->m_userdata);
 			} else {
-				SC_LOGI("%s", results);
+				SC_LOGI("%s", bpu_handle->m_result.m_json);
 			}
-			free(results);
 		}
 
 		if (post_info) {
+			// 后处理完成，输出 tensor 还给推理线程
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, post_info->output_tensor);
 			free(post_info);
 			post_info = NULL;
 		}
@@ -363,7 +433,7 @@ static void *post_process_fcos(void *ptr)
 static void *inference_fcos(void *ptr)
 {
 	tsThread *privThread = (tsThread*)ptr;
-	int32_t i = 0, ret = 0;
+	int32_t ret = 0;
 	bpu_tensor_info_t *input_tensor;
 	int32_t output_count = 0;
 
@@ -380,31 +450,36 @@ static void *inference_fcos(void *ptr)
 	hbDNNGetOutputCount(&output_count, dnn_handle);
 
 	SC_LOGI("packed_dnn_handle: %p, dnn_handle: %p output count:%d.", packed_dnn_handle, dnn_handle, output_count);
-	// 准备模型输出节点tensor，5组输出buff轮转，简单处理，理论上后处理的速度是要比算法推理更快的
-	hbDNNTensor output_tensors[5][15];
-	int32_t cur_ouput_buf_idx = 0;
-	for (i = 0; i < 5; i++) {
-		ret = prepare_output_tensor(output_tensors[i], dnn_handle);
-		if (ret) {
-			SC_LOGE("prepare model output tensor failed");
-			goto exit;
-		}
-	}
+	// 模型输出 tensor 从 m_output_pool 获取，后处理线程处理完成后归还
+	hbDNNTensor *output = NULL;
+	time_t pool_report_time = time(NULL);
+	bpu_tensor_pool_stats_t pool_stats = {0};
 
 	hbDNNTaskHandle_t task_handle = NULL;
+	int32_t infer_stage = latency_stats_stage("bpu_infer");
+	uint64_t infer_start_ns = 0;
 
 	while (privThread->eState == E_THREAD_RUNNING) {
 		if (mQueueDequeueTimed(&bpu_handle->m_input_queue, 100, (void**)&input_tensor) != E_QUEUE_OK)
 			continue;
 
 		// make sure memory data is flushed to DDR before inference
-		hbSysFlushMem(&input_tensor->m_dnn_tensor.sysMem[0], HB_SYS_MEM_CACHE_CLEAN);
-
-		hbDNNTensor *output = &output_tensors[cur_ouput_buf_idx][0];
+		// 零拷贝的输入由 vse 硬件直接写入 DDR，不需要刷 cache
+		if (input_tensor->m_frame_ref == NULL)
+			hbSysFlushMem(&input_tensor->m_dnn_tensor.sysMem[0], HB_SYS_MEM_CACHE_CLEAN);
+
+		bpu_output_pool_report(bpu_handle, &pool_report_time, &pool_stats);
+		// 后处理还没有归还输出 tensor 时等待，超时就丢弃这一帧，不占用 bpu
+		output = bpu_tensor_pool_acquire(&bpu_handle->m_output_pool, bpu_output_wait_ms(bpu_handle));
+		if (output == NULL) {
+			bpu_input_tensor_done(bpu_handle, input_tensor);
+			continue;
+		}
 
 		// 模型推理infer
 		hbDNNInferCtrlParam infer_ctrl_param;
 		HB_DNN_INITIALIZE_INFER_CTRL_PARAM(&infer_ctrl_param);
+		infer_start_ns = get_monotonic_ns();
 		ret = hbDNNInfer(&task_handle,
 				&output,
 				&input_tensor->m_dnn_tensor,
@@ -412,41 +487,42 @@ static void *inference_fcos(void *ptr)
 				&infer_ctrl_param);
 		if (ret) {
 			SC_LOGE("hbDNNInfer failed");
+			bpu_input_tensor_done(bpu_handle, input_tensor);
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			break;
 		}
 		// wait task done
 		ret = hbDNNWaitTaskDone(task_handle, 0);
+		// 推理完成，输入图像可以归还给 vse 了
+		bpu_input_tensor_done(bpu_handle, input_tensor);
 		if (ret) {
 			SC_LOGE("hbDNNWaitTaskDone failed");
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			break;
 		}
 
 		// make sure CPU read data from DDR before using output tensor data
 		for (int32_t i = 0; i < output_count; i++) {
-			hbSysFlushMem(&output_tensors[cur_ouput_buf_idx][i].sysMem[0], HB_SYS_MEM_CACHE_INVALIDATE);
+			hbSysFlushMem(&output[i].sysMem[0], HB_SYS_MEM_CACHE_INVALIDATE);
 		}
 
 		// release task handle
 		ret = hbDNNReleaseTask(task_handle);
 		if (ret) {
 			SC_LOGE("hbDNNReleaseTask failed");
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			break;
 		}
 		task_handle = NULL;
-
-		// 如果后处理队列满的，直接返回
-		if (mQueueIsFull(&bpu_handle->m_output_queue)) {
-			SC_LOGI("post process queue full, skip it");
-			cur_ouput_buf_idx++;
-			cur_ouput_buf_idx %= 5;
-			continue;
-		}
+		latency_stats_record_since(infer_stage, infer_start_ns);
 
 		// 后处理数据
+		// 后处理队列和输出 tensor 池一样深，持有输出 tensor 时入队不会失败
 		FcosPostProcessInfo_t *post_info;
 		post_info = (FcosPostProcessInfo_t *)malloc(sizeof(FcosPostProcessInfo_t));
 		if (NULL == post_info) {
 			SC_LOGE("Failed to allocate memory for post_info");
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			continue;
 		}
 		post_info->is_pad_resize = 0;
@@ -457,15 +533,13 @@ static void *inference_fcos(void *ptr)
 		post_info->height = bpu_handle->m_image_info.m_model_h;
 		post_info->ori_width = bpu_handle->m_image_info.m_ori_width;
 		post_info->ori_height = bpu_handle->m_image_info.m_ori_height;
+		post_info->pipeline = bpu_handle->m_vpp_id + 1;
 		post_info->tv = input_tensor->tv;
-		post_info->output_tensor = output_tensors[cur_ouput_buf_idx];
+		post_info->output_tensor = output;
+		bpu_tensor_pool_hand_over(&bpu_handle->m_output_pool, output);
 		mQueueEnqueue(&bpu_handle->m_output_queue, post_info);
-		cur_ouput_buf_idx++;
-		cur_ouput_buf_idx %= 5;
 	}
 
-	for (i = 0; i < 5; i++)
-		release_output_tensor(output_tensors[i], output_count);	// 释放模型输出资源
 exit:
 	mThreadFinish(privThread);
 	return NULL;
@@ -509,27 +583,36 @@ static void *inference_mobilenetv2(void *ptr)
 
 	hbDNNGetOutputCount(&output_count, dnn_handle);
 
-	// 准备模型输出节点tensor
-	hbDNNTensor output_tensors[1];
-	ret = prepare_output_tensor(output_tensors, dnn_handle);
-	if (ret) {
-		printf("prepare model output tensor failed\n");
-		goto exit;
-	}
+	// 模型输出 tensor 从 m_output_pool 获取，同步后处理，用完马上归还
+	hbDNNTensor *output = NULL;
+	time_t pool_report_time = time(NULL);
+	bpu_tensor_pool_stats_t pool_stats = {0};
 
 	hbDNNTaskHandle_t task_handle = NULL;
-	hbDNNTensor *output = &output_tensors[0];
+	int32_t infer_stage = latency_stats_stage("bpu_infer");
+	uint64_t infer_start_ns = 0;
 
 	while (privThread->eState == E_THREAD_RUNNING) {
 		if (mQueueDequeueTimed(&bpu_handle->m_input_queue, 100, (void**)&input_tensor) != E_QUEUE_OK)
 			continue;
 
 		// make sure memory data is flushed to DDR before inference
-		hbSysFlushMem(&input_tensor->m_dnn_tensor.sysMem[0], HB_SYS_MEM_CACHE_CLEAN);
+		// 零拷贝的输入由 vse 硬件直接写入 DDR，不需要刷 cache
+		if (input_tensor->m_frame_ref == NULL)
+			hbSysFlushMem(&input_tensor->m_dnn_tensor.sysMem[0], HB_SYS_MEM_CACHE_CLEAN);
+
+		bpu_output_pool_report(bpu_handle, &pool_report_time, &pool_stats);
+		// 后处理还没有归还输出 tensor 时等待，超时就丢弃这一帧，不占用 bpu
+		output = bpu_tensor_pool_acquire(&bpu_handle->m_output_pool, bpu_output_wait_ms(bpu_handle));
+		if (output == NULL) {
+			bpu_input_tensor_done(bpu_handle, input_tensor);
+			continue;
+		}
 
 		// 模型推理infer
 		hbDNNInferCtrlParam infer_ctrl_param;
 		HB_DNN_INITIALIZE_INFER_CTRL_PARAM(&infer_ctrl_param);
+		infer_start_ns = get_monotonic_ns();
 		ret = hbDNNInfer(&task_handle,
 				&output,
 				&input_tensor->m_dnn_tensor,
@@ -537,50 +620,54 @@ static void *inference_mobilenetv2(void *ptr)
 				&infer_ctrl_param);
 		if (ret) {
 			SC_LOGE("hbDNNInfer failed");
+			bpu_input_tensor_done(bpu_handle, input_tensor);
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			break;
 		}
 		// wait task done
 		ret = hbDNNWaitTaskDone(task_handle, 0);
+		// 推理完成，输入图像可以归还给 vse 了
+		bpu_input_tensor_done(bpu_handle, input_tensor);
 		if (ret) {
 			SC_LOGE("hbDNNWaitTaskDone failed");
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			break;
 		}
 
 		// make sure CPU read data from DDR before using output tensor data
 		for (int32_t i = 0; i < output_count; i++) {
-			hbSysFlushMem(&output_tensors[i].sysMem[0], HB_SYS_MEM_CACHE_INVALIDATE);
+			hbSysFlushMem(&output[i].sysMem[0], HB_SYS_MEM_CACHE_INVALIDATE);
 		}
 
 		// release task handle
 		ret = hbDNNReleaseTask(task_handle);
 		if (ret) {
 			SC_LOGE("hbDNNReleaseTask failed");
+			bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 			break;
 		}
 		task_handle = NULL;
+		latency_stats_record_since(infer_stage, infer_start_ns);
 
 		// 同步模式下的后处理, 测试用，每个模型都要一份独立的后处理接口
 		float score_top1 = 0.0;
 		int32_t idx = 0;
-		char result[128] = {0};
 		parse_classification_result(
-				&output_tensors[0], &idx, &score_top1);
+				&output[0], &idx, &score_top1);
+		bpu_tensor_pool_release(&bpu_handle->m_output_pool, output);
 
 		// 通过websocket把算法结果发送给web页面
-		sprintf(result, "\"timestamp\": %ld,\"classification_result\": \"id=%d, score=%.3f\"",
+		bpu_result_classification(&bpu_handle->m_result, bpu_handle->m_vpp_id + 1,
 			input_tensor->tv.tv_sec * 1000000 + input_tensor->tv.tv_usec,
 			idx, score_top1);
 
 		if (NULL != bpu_handle->callback) {
-			bpu_handle->callback(result, bpu_handle->m_userdata);
+			bpu_handle->callback(&bpu_handle->m_result, bpu_handle->m_userdata);
 		} else {
-			SC_LOGI("%s", result);
+			SC_LOGI("%s", bpu_handle->m_result.m_json);
 		}
 	}
 
-	ret = hbSysFreeMem(&(output_tensors[0].sysMem[0]));			  // 释放模型输出资源
-	if (ret)
-		printf("output data free failed\n");
 exit:
 	mThreadFinish(privThread);
 	return NULL;
@@ -730,19 +817,35 @@ int32_t bpu_wrap_init(bpu_handle_t *bpu_handle, char *model_file_name, char *mod
 	bpu_handle->m_image_info.m_ori_height = 1080;
 	bpu_handle->m_image_info.m_ori_width = 1920;
 
+	if (bpu_result_init(&bpu_handle->m_result) != 0)
+		return -1;
+
+	// 模型输出 tensor 池，推理线程获取，后处理完成后归还
+	if (bpu_handle->m_output_pool_depth <= 0)
+		bpu_handle->m_output_pool_depth = BPU_OUTPUT_POOL_DEPTH;
+	if (bpu_tensor_pool_init(&bpu_handle->m_output_pool, dnn_handle, bpu_handle->m_output_pool_depth) != 0)
+		return -1;
+	SC_LOGI("output tensor pool depth: %d, wait: %u ms",
+		bpu_handle->m_output_pool_depth, bpu_output_wait_ms(bpu_handle));
+
 	// 队列中存2个，解决算法结果延迟较大的问题
 	mQueueCreate(&bpu_handle->m_input_queue, 2);//the length of queue is 2
-	mQueueCreate(&bpu_handle->m_output_queue, 3);//the length of queue is 3
+	// 后处理队列能放下所有输出 tensor，入队不会阻塞推理线程
+	mQueueCreate(&bpu_handle->m_output_queue, bpu_handle->m_output_pool_depth + 1);
 
 	// 分配 bpu input buffer 使用的内存
+	// 零拷贝模式下送帧方没有提供图像引用或者持有的图像太多时，仍然拷贝到这里的内存
 	bpu_handle->m_cur_input_tensor = 0;
+	bpu_handle->m_zero_copy = BPU_ZERO_COPY;
+	bpu_handle->m_held_frames = 0;
 	for (i = 0; i < BPU_INPUT_BUFFER_NUM; i++) {
-		HB_CHECK_SUCCESS(hbSysAllocCachedMem(&bpu_handle->m_input_tensors[i].m_dnn_tensor.sysMem[0],
+		HB_CHECK_SUCCESS(hbSysAllocCachedMem(&bpu_handle->m_input_tensors[i].m_sys_mem[0],
 			bpu_handle->m_image_info.m_model_h * bpu_handle->m_image_info.m_model_w),
 			"hbSysAllocCachedMem failed");
-		HB_CHECK_SUCCESS(hbSysAllocCachedMem(&bpu_handle->m_input_tensors[i].m_dnn_tensor.sysMem[1],
+		HB_CHECK_SUCCESS(hbSysAllocCachedMem(&bpu_handle->m_input_tensors[i].m_sys_mem[1],
 			bpu_handle->m_image_info.m_model_h * bpu_handle->m_image_info.m_model_w / 2),
 			"hbSysAllocCachedMem failed");
+		bpu_handle->m_input_tensors[i].m_frame_ref = NULL;
 	}
 
 	return ret;
@@ -756,15 +859,18 @@ int32_t bpu_wrap_deinit(bpu_handle_t *handle)
 	if (handle == NULL)
 		return 0;
 
+	bpu_wrap_flush_input(handle);
 	for (i = 0; i < BPU_INPUT_BUFFER_NUM; i++) {
-		ret = hbSysFreeMem(&handle->m_input_tensors[i].m_dnn_tensor.sysMem[0]);	   // 释放模型输入资源
-		ret |= hbSysFreeMem(&handle->m_input_tensors[i].m_dnn_tensor.sysMem[1]);
+		ret = hbSysFreeMem(&handle->m_input_tensors[i].m_sys_mem[0]);	   // 释放模型输入资源
+		ret |= hbSysFreeMem(&handle->m_input_tensors[i].m_sys_mem[1]);
 		if (ret)
 			SC_LOGE("input data free failed");
 	}
 	// 销毁队列
 	mQueueDestroy(&handle->m_output_queue);
 	mQueueDestroy(&handle->m_input_queue);
+	bpu_tensor_pool_deinit(&handle->m_output_pool);
+	bpu_result_deinit(&handle->m_result);
 
 	// 释放模型资源
 	HB_CHECK_SUCCESS(hbDNNRelease(handle->m_packed_dnn_handle), "hbDNNRelease failed");
@@ -798,6 +904,21 @@ void bpu_wrap_set_ori_hw(bpu_handle_t *handle, int32_t width, int32_t height)
 	handle->m_image_info.m_ori_width = width;
 }
 
+void bpu_wrap_set_output_pool(bpu_handle_t *handle, int32_t depth, int32_t wait_ms)
+{
+	if (handle == NULL) return;
+
+	handle->m_output_pool_depth = depth;
+	handle->m_output_wait_ms = wait_ms;
+}
+
+void bpu_wrap_get_output_pool_stats(bpu_handle_t *handle, bpu_tensor_pool_stats_t *stats)
+{
+	if (handle == NULL || stats == NULL) return;
+
+	bpu_tensor_pool_get_stats(&handle->m_output_pool, stats);
+}
+
 int32_t bpu_wrap_get_model_hw(char *model_name, int32_t *width, int32_t *height)
 {
 	hbDNNTensorProperties properties = {0};
@@ -855,6 +976,13 @@ int32_t bpu_wrap_stop(bpu_handle_t *handle)
 
 	mThreadStop(&handle->m_post_process_thread);
 	mThreadStop(&handle->m_run_model_thread);
+	bpu_wrap_flush_input(handle);
+
+	// 丢弃还没有后处理的结果，收回所有输出 tensor，重新 start 时池子是满的
+	void *post_info = NULL;
+	while (mQueueDequeueTimed(&handle->m_output_queue, 0, &post_info) == E_QUEUE_OK)
+		free(post_info);
+	bpu_tensor_pool_reclaim(&handle->m_output_pool);
 	SC_LOGI("bpu_wrap_stop complete .");
 
 	return 0;
@@ -896,22 +1024,39 @@ extern int32_t vp_dump_2plane_yuv_to_file(char *filename, uint8_t *src_buffer, u
 #endif
 
 	// 准备输入数据（用于存放yuv数据）
-	hbDNNTensor *input_tensor = &handle->m_input_tensors[handle->m_cur_input_tensor].m_dnn_tensor;
-	handle->m_input_tensors[handle->m_cur_input_tensor].tv = input_buffer->tv;
+	bpu_tensor_info_t *tensor_info = &handle->m_input_tensors[handle->m_cur_input_tensor];
+	hbDNNTensor *input_tensor = &tensor_info->m_dnn_tensor;
+	tensor_info->tv = input_buffer->tv;
 
 	input_tensor->properties.tensorLayout = HB_DNN_LAYOUT_NCHW;
 	// 张量类型为Y通道及UV通道为输入的图片, 方便直接使用 vpu出来的y和uv分离的数据
 	input_tensor->properties.tensorType = HB_DNN_IMG_TYPE_NV12_SEPARATE; // 用于Y和UV分离的场景，主要为我们摄像头数据通路场景
-	// 填充 input_tensor->sysMem 成员变量 Y 分量
-	hbSysWriteMem(&input_tensor->sysMem[0],
-		(char *)input_buffer->addr[0],
-		input_buffer->w_stride * input_buffer->height);
-	input_tensor->sysMem[0].memSize = input_buffer->w_stride * input_buffer->height;
-	// 填充 input_tensor->data_ext 成员变量， UV 分量
-	hbSysWriteMem(&input_tensor->sysMem[1],
-		(char *)input_buffer->addr[1],
-		(input_buffer->w_stride * input_buffer->height) / 2);
-	input_tensor->sysMem[1].memSize = (input_buffer->w_stride * input_buffer->height) / 2;
+	if (handle->m_zero_copy && input_buffer->ref != NULL && input_buffer->plane_cnt >= 2
+		&& __atomic_load_n(&handle->m_held_frames, __ATOMIC_RELAXED) < BPU_ZERO_COPY_MAX_HOLD) {
+		// 零拷贝: tensor 直接指向 vse 输出的 y 和 uv 分量，推理完成后才释放图像
+		input_tensor->sysMem[0].phyAddr = input_buffer->paddr[0];
+		input_tensor->sysMem[0].virAddr = input_buffer->addr[0];
+		input_tensor->sysMem[0].memSize = input_buffer->w_stride * input_buffer->height;
+		input_tensor->sysMem[1].phyAddr = input_buffer->paddr[1];
+		input_tensor->sysMem[1].virAddr = input_buffer->addr[1];
+		input_tensor->sysMem[1].memSize = (input_buffer->w_stride * input_buffer->height) / 2;
+		bpu_frame_ref_get(input_buffer->ref);
+		tensor_info->m_frame_ref = input_buffer->ref;
+		__atomic_add_fetch(&handle->m_held_frames, 1, __ATOMIC_RELAXED);
+	} else {
+		input_tensor->sysMem[0] = tensor_info->m_sys_mem[0];
+		input_tensor->sysMem[1] = tensor_info->m_sys_mem[1];
+		// 填充 input_tensor->sysMem 成员变量 Y 分量
+		hbSysWriteMem(&input_tensor->sysMem[0],
+			(char *)input_buffer->addr[0],
+			input_buffer->w_stride * input_buffer->height);
+		input_tensor->sysMem[0].memSize = input_buffer->w_stride * input_buffer->height;
+		// 填充 input_tensor->data_ext 成员变量， UV 分量
+		hbSysWriteMem(&input_tensor->sysMem[1],
+			(char *)input_buffer->addr[1],
+			(input_buffer->w_stride * input_buffer->height) / 2);
+		input_tensor->sysMem[1].memSize = (input_buffer->w_stride * input_buffer->height) / 2;
+	}
 
 	// HB_DNN_IMG_TYPE_NV12_SEPARATE 类型的 layout 为 (1, 3, h, w)
 	input_tensor->properties.validShape.numDimensions = 4;
@@ -931,16 +1076,28 @@ extern int32_t vp_dump_2plane_yuv_to_file(char *filename, uint8_t *src_buffer, u
 #endif
 
 	// 把图像数据推送进BPU处理队列
-	if (mQueueEnqueueEx(&handle->m_input_queue, &handle->m_input_tensors[handle->m_cur_input_tensor]) == E_QUEUE_OK) {
+	if (mQueueEnqueueEx(&handle->m_input_queue, tensor_info) == E_QUEUE_OK) {
 		handle->m_cur_input_tensor++;
 		handle->m_cur_input_tensor %= BPU_INPUT_BUFFER_NUM;
 	} else {
 		SC_LOGI("m_input_queue full, skip it");
+		bpu_input_tensor_done(handle, tensor_info);
 	}
 
 	return 0;
 }
 
+void bpu_wrap_flush_input(bpu_handle_t *handle)
+{
+	bpu_tensor_info_t *input_tensor = NULL;
+
+	if (handle == NULL)
+		return;
+
+	while (mQueueDequeueTimed(&handle->m_input_queue, 0, (void**)&input_tensor) == E_QUEUE_OK)
+		bpu_input_tensor_done(handle, input_tensor);
+}
+
 void bpu_wrap_callback_register(bpu_handle_t* handle, bpu_post_process_callback callback, void *userdata)
 {
 	if (handle == NULL)
@@ -960,27 +1117,15 @@ void bpu_wrap_callback_unregister(bpu_handle_t* handle)
 
 
 // 通用的算法回调函数，目前都是通过websocket想web上发送
-int32_t bpu_wrap_general_result_handle(char *result, void *userdata)
+int32_t bpu_wrap_general_result_handle(bpu_result_t *result, void *userdata)
 {
-	int32_t ret = 0;
-	int32_t pipeline_id = 0;
-	char *ws_msg = NULL;
+	T_SDK_WEBSOCKET_ALOG_RESULT msg;
 
-	if (userdata)
-		pipeline_id = *(int*)userdata;
+	// 后处理时已经写好了完整的 {"kind":10,...} 消息，这里直接发送，不再申请内存和拼接
+	msg.json = result->m_json;
+	msg.json_len = result->m_json_len;
+	msg.bin = result->m_bin_len > 0 ? result->m_bin : NULL;
+	msg.bin_len = result->m_bin_len;
 
-	// json 算法结果添加标志信息
-	// 分配内存
-	ws_msg = malloc(strlen(result) + 32);
-	if (NULL == ws_msg) {
-		SC_LOGE("Failed to allocate memory for ws_msg");
-		return -1;
-	}
-	sprintf(ws_msg, "{\"kind\":10, \"pipeline\":%d,", pipeline_id + 1);
-	strcat(ws_msg, result);
-	strcat(ws_msg, "}");
-
-	ret = SDK_Cmd_Impl(SDK_CMD_WEBSOCKET_SEND_MSG, (void*)ws_msg);
-	free(ws_msg);
-	return ret;
+	return SDK_Cmd_Impl(SDK_CMD_WEBSOCKET_SEND_ALOG_RESULT, (void*)&msg);
 }
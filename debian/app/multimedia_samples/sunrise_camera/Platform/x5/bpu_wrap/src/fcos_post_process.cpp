@@ -13,12 +13,13 @@
 #include <utility>
 #include <vector>
 #include <iostream>
-#include <iomanip>
+#include <sstream>
 #include <algorithm>
 
 #include "utils/utils_log.h"
 
 #include "fcos_post_process.h"
+#include "nms.h"
 
 /**
  * Config definition for Fcos
@@ -122,17 +123,6 @@ typedef struct Bbox
 	Bbox(float xmin, float ymin, float xmax, float ymax)
 		: xmin(xmin), ymin(ymin), xmax(xmax), ymax(ymax) {}
 
-	friend std::ostream &operator<<(std::ostream &os, const Bbox &bbox)
-	{
-		const auto precision = os.precision();
-		const auto flags = os.flags();
-		os << "[" << std::fixed << std::setprecision(6) << bbox.xmin << ","
-		   << bbox.ymin << "," << bbox.xmax << "," << bbox.ymax << "]";
-		os.flags(flags);
-		os.precision(precision);
-		return os;
-	}
-
 	~Bbox() {}
 } Bbox;
 
@@ -155,24 +145,6 @@ typedef struct Detection
 		return (lhs.score > rhs.score);
 	}
 
-	friend std::ostream &operator<<(std::ostream &os, const Detection &det)
-	{
-		const auto precision = os.precision();
-		const auto flags = os.flags();
-		os << "{"
-		   << R"("bbox")"
-		   << ":" << det.bbox << ","
-		   << R"("prob")"
-		   << ":" << std::fixed << std::setprecision(6) << det.score << ","
-		   << R"("label")"
-		   << ":" << det.id << ","
-		   << R"("class_name")"
-		   << ":\"" << det.class_name << "\"}";
-		os.flags(flags);
-		os.precision(precision);
-		return os;
-	}
-
 	~Detection() {}
 } Detection;
 
@@ -206,63 +178,23 @@ static void fcos_nms(std::vector<Detection> &input,
 					 std::vector<Detection> &result,
 					 bool suppress)
 {
-	// sort order by score desc
-	std::stable_sort(input.begin(), input.end(), std::greater<Detection>());
-
-	std::vector<bool> skip(input.size(), false);
+	NmsBoxes boxes;
+	std::vector<int> keep;
 
-	// pre-calculate boxes area
-	std::vector<float> areas;
-	areas.reserve(input.size());
+	boxes.reserve(input.size());
 	for (size_t i = 0; i < input.size(); i++)
 	{
-		float width = input[i].bbox.xmax - input[i].bbox.xmin;
-		float height = input[i].bbox.ymax - input[i].bbox.ymin;
-		areas.push_back(width * height);
+		const Bbox &bbox = input[i].bbox;
+		boxes.push_back(bbox.xmin, bbox.ymin, bbox.xmax, bbox.ymax,
+						input[i].score, input[i].id);
 	}
 
-	int count = 0;
-	for (size_t i = 0; count < top_k && i < skip.size(); i++)
-	{
-		if (skip[i])
-		{
-			continue;
-		}
-		skip[i] = true;
-		++count;
-
-		for (size_t j = i + 1; j < skip.size(); ++j)
-		{
-			if (skip[j])
-			{
-				continue;
-			}
-			if (suppress == false)
-			{
-				if (input[i].id != input[j].id)
-				{
-					continue;
-				}
-			}
-
-			// intersection area
-			float xx1 = std::max(input[i].bbox.xmin, input[j].bbox.xmin);
-			float yy1 = std::max(input[i].bbox.ymin, input[j].bbox.ymin);
-			float xx2 = std::min(input[i].bbox.xmax, input[j].bbox.xmax);
-			float yy2 = std::min(input[i].bbox.ymax, input[j].bbox.ymax);
+	bpu_nms(boxes, iou_threshold, top_k, suppress, keep);
 
-			if (xx2 > xx1 && yy2 > yy1)
-			{
-				float area_intersection = (xx2 - xx1) * (yy2 - yy1);
-				float iou_ratio =
-					area_intersection / (areas[j] + areas[i] - area_intersection);
-				if (iou_ratio > iou_threshold)
-				{
-					skip[j] = true;
-				}
-			}
-		}
-		result.push_back(input[i]);
+	result.reserve(keep.size());
+	for (size_t i = 0; i < keep.size(); i++)
+	{
+		result.push_back(input[keep[i]]);
 	}
 }
 
@@ -668,13 +600,12 @@ static void GetBboxAndScoresScaleNCHW(
 	}
 }
 
-char *FcosPostProcess(FcosPostProcessInfo_t *post_info)
+int32_t FcosPostProcess(FcosPostProcessInfo_t *post_info, bpu_result_t *result)
 {
 	hbDNNTensor *tensors = post_info->output_tensor;
 
 	std::vector<Detection> dets;
 	std::vector<Detection> det_restuls;
-	char *str_dets;
 
 	int h_index = 0, w_index = 0, c_index = 0;
 	get_tensor_hwc_index(&tensors[0], &h_index, &w_index, &c_index);
@@ -693,24 +624,16 @@ char *FcosPostProcess(FcosPostProcessInfo_t *post_info)
 	}
 	// 计算交并比来合并检测框，传入交并比阈值和返回box数量
 	fcos_nms(dets, post_info->nms_threshold, post_info->nms_top_k, det_restuls, false);
-	std::stringstream out_string;
 
-	// 算法结果转换成json格式
-	out_string << "\"timestamp\": ";
-	unsigned long timestamp = post_info->tv.tv_sec * 1000000 + post_info->tv.tv_usec;
-	out_string << timestamp;
-	out_string << ",\"detection_result\": [";
+	// 算法结果直接写成 websocket 发送的 json 消息
+	uint64_t timestamp = post_info->tv.tv_sec * 1000000 + post_info->tv.tv_usec;
+	bpu_result_begin_detection(result, post_info->pipeline, timestamp);
 	for (uint32_t i = 0; i < det_restuls.size(); i++)
 	{
-		auto det_ret = det_restuls[i];
-		out_string << det_ret;
-		if (i < det_restuls.size() - 1)
-			out_string << ",";
+		const Detection &det = det_restuls[i];
+		const float bbox[4] = {det.bbox.xmin, det.bbox.ymin, det.bbox.xmax, det.bbox.ymax};
+		bpu_result_add_detection(result, bbox, det.score, det.id, det.class_name);
 	}
-	out_string << "]" << std::endl;
-
-	str_dets = (char *)malloc(out_string.str().length() + 1);
-	str_dets[out_string.str().length()] = '\0';
-	snprintf(str_dets, out_string.str().length(), "%s", out_string.str().c_str());
-	return str_dets;
+	bpu_result_end_detection(result);
+	return 0;
 }
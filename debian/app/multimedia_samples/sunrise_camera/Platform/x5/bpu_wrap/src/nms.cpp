@@ -0,0 +1,290 @@
+// Copyright (c) 2024 D-Robotics.All Rights Reserved.
+//
+// The material in this file is confidential and contains trade secrets
+// of D-Robotics Inc. This is proprietary information owned by
+// D-Robotics Inc. No part of this work may be disclosed,
+// reproduced, copied, transmitted, or used in any way for any purpose,
+// without the express written permission of D-Robotics Inc.
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "nms.h"
+
+// 检测框数量达到该值时 NMS_MODE_AUTO 使用网格查找
+#define NMS_GRID_MIN_BOXES 1024
+// 网格每个方向最多的格子数
+#define NMS_GRID_MAX_CELLS 64
+// 覆盖超过该数量格子的框不放入网格，和每个候选框都比较
+#define NMS_GRID_LARGE_CELLS 64
+
+/**
+ * 已保留的框
+ */
+struct NmsKept {
+	std::vector<float> xmin;
+	std::vector<float> ymin;
+	std::vector<float> xmax;
+	std::vector<float> ymax;
+	std::vector<float> area;
+	std::vector<int> id;
+
+	size_t size() const { return area.size(); }
+
+	void push_back(float x1, float y1, float x2, float y2, float a, int class_id) {
+		xmin.push_back(x1);
+		ymin.push_back(y1);
+		xmax.push_back(x2);
+		ymax.push_back(y2);
+		area.push_back(a);
+		id.push_back(class_id);
+	}
+};
+
+/**
+ * 交并比是否大于阈值，a 为已保留的框，b 为候选框
+ */
+static inline bool nms_iou_over(const NmsKept &a, size_t i,
+								float x1, float y1, float x2, float y2, float area,
+								float iou_threshold) {
+	float xx1 = std::max(a.xmin[i], x1);
+	float yy1 = std::max(a.ymin[i], y1);
+	float xx2 = std::min(a.xmax[i], x2);
+	float yy2 = std::min(a.ymax[i], y2);
+
+	if (xx2 > xx1 && yy2 > yy1) {
+		float area_intersection = (xx2 - xx1) * (yy2 - yy1);
+		float iou_ratio = area_intersection / (area + a.area[i] - area_intersection);
+		return iou_ratio > iou_threshold;
+	}
+	return false;
+}
+
+/**
+ * 候选框和 kept 中的任一个框交并比大于阈值时返回 true，找到一个就返回
+ */
+static bool nms_overlap_linear(const NmsKept &kept,
+							   float x1, float y1, float x2, float y2, float area,
+							   float iou_threshold) {
+	size_t i = 0;
+	size_t n = kept.size();
+
+#if defined(__aarch64__)
+	// aarch64 才有向量除法，和标量的计算顺序一致，结果也完全一致
+	float32x4_t v_x1 = vdupq_n_f32(x1);
+	float32x4_t v_y1 = vdupq_n_f32(y1);
+	float32x4_t v_x2 = vdupq_n_f32(x2);
+	float32x4_t v_y2 = vdupq_n_f32(y2);
+	float32x4_t v_area = vdupq_n_f32(area);
+	float32x4_t v_thr = vdupq_n_f32(iou_threshold);
+
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t xx1 = vmaxq_f32(vld1q_f32(&kept.xmin[i]), v_x1);
+		float32x4_t yy1 = vmaxq_f32(vld1q_f32(&kept.ymin[i]), v_y1);
+		float32x4_t xx2 = vminq_f32(vld1q_f32(&kept.xmax[i]), v_x2);
+		float32x4_t yy2 = vminq_f32(vld1q_f32(&kept.ymax[i]), v_y2);
+
+		uint32x4_t valid = vandq_u32(vcgtq_f32(xx2, xx1), vcgtq_f32(yy2, yy1));
+		float32x4_t inter = vmulq_f32(vsubq_f32(xx2, xx1), vsubq_f32(yy2, yy1));
+		float32x4_t uni = vsubq_f32(vaddq_f32(v_area, vld1q_f32(&kept.area[i])), inter);
+		uint32x4_t over = vandq_u32(valid, vcgtq_f32(vdivq_f32(inter, uni), v_thr));
+		if (vmaxvq_u32(over) != 0) {
+			return true;
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		if (nms_iou_over(kept, i, x1, y1, x2, y2, area, iou_threshold)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * 已保留的框按类别分桶，候选框只和同类别的框比较
+ */
+static void nms_linear(const NmsBoxes &boxes,
+					   const std::vector<std::pair<float, int>> &order,
+					   float iou_threshold,
+					   int top_k,
+					   bool suppress,
+					   std::vector<int> &keep) {
+	int min_id = 0, max_id = 0;
+	if (!suppress && boxes.size() > 0) {
+		auto range = std::minmax_element(boxes.id.begin(), boxes.id.end());
+		min_id = *range.first;
+		max_id = *range.second;
+	}
+	std::vector<NmsKept> buckets(max_id - min_id + 1);
+
+	for (size_t k = 0; k < order.size() && (int)keep.size() < top_k; k++) {
+		int i = order[k].second;
+		float x1 = boxes.xmin[i];
+		float y1 = boxes.ymin[i];
+		float x2 = boxes.xmax[i];
+		float y2 = boxes.ymax[i];
+		float area = (x2 - x1) * (y2 - y1);
+		NmsKept &kept = buckets[suppress ? 0 : boxes.id[i] - min_id];
+
+		if (nms_overlap_linear(kept, x1, y1, x2, y2, area, iou_threshold)) {
+			continue;
+		}
+		kept.push_back(x1, y1, x2, y2, area, boxes.id[i]);
+		keep.push_back(i);
+	}
+}
+
+/**
+ * 已保留的框按位置放入均匀网格，交并比大于 0 的两个框一定有共同的格子，
+ * 所以候选框只需要和它覆盖的格子中的框比较，结果和 nms_linear 一致
+ */
+static void nms_grid(const NmsBoxes &boxes,
+					 const std::vector<std::pair<float, int>> &order,
+					 float iou_threshold,
+					 int top_k,
+					 bool suppress,
+					 std::vector<int> &keep) {
+	// 网格范围取所有有效框的外接矩形，格子大小取框的平均宽高
+	float gx0 = 0, gy0 = 0, gx1 = 0, gy1 = 0, sum_w = 0, sum_h = 0;
+	int valid = 0;
+	for (size_t i = 0; i < boxes.size(); i++) {
+		if (!(boxes.xmax[i] > boxes.xmin[i] && boxes.ymax[i] > boxes.ymin[i])) {
+			continue;
+		}
+		if (valid++ == 0) {
+			gx0 = boxes.xmin[i];
+			gy0 = boxes.ymin[i];
+			gx1 = boxes.xmax[i];
+			gy1 = boxes.ymax[i];
+		} else {
+			gx0 = std::min(gx0, boxes.xmin[i]);
+			gy0 = std::min(gy0, boxes.ymin[i]);
+			gx1 = std::max(gx1, boxes.xmax[i]);
+			gy1 = std::max(gy1, boxes.ymax[i]);
+		}
+		sum_w += boxes.xmax[i] - boxes.xmin[i];
+		sum_h += boxes.ymax[i] - boxes.ymin[i];
+	}
+	if (valid == 0) {
+		nms_linear(boxes, order, iou_threshold, top_k, suppress, keep);
+		return;
+	}
+
+	float cell_w = std::max(sum_w / valid, (gx1 - gx0) / NMS_GRID_MAX_CELLS);
+	float cell_h = std::max(sum_h / valid, (gy1 - gy0) / NMS_GRID_MAX_CELLS);
+	int grid_w = std::min((int)((gx1 - gx0) / cell_w) + 1, NMS_GRID_MAX_CELLS);
+	int grid_h = std::min((int)((gy1 - gy0) / cell_h) + 1, NMS_GRID_MAX_CELLS);
+	float inv_w = 1.0f / cell_w;
+	float inv_h = 1.0f / cell_h;
+
+	std::vector<std::vector<int>> cells(grid_w * grid_h);
+	std::vector<int> large;
+	std::vector<int> stamp;
+	NmsKept kept;
+
+	for (size_t k = 0; k < order.size() && (int)keep.size() < top_k; k++) {
+		int i = order[k].second;
+		float x1 = boxes.xmin[i];
+		float y1 = boxes.ymin[i];
+		float x2 = boxes.xmax[i];
+		float y2 = boxes.ymax[i];
+		float area = (x2 - x1) * (y2 - y1);
+		int id = boxes.id[i];
+
+		// 宽或高不大于 0 的框和任何框都没有交集，直接保留并且不放入网格
+		if (!(x2 > x1 && y2 > y1)) {
+			keep.push_back(i);
+			continue;
+		}
+
+		int cx0 = std::min(std::max((int)((x1 - gx0) * inv_w), 0), grid_w - 1);
+		int cy0 = std::min(std::max((int)((y1 - gy0) * inv_h), 0), grid_h - 1);
+		int cx1 = std::min(std::max((int)((x2 - gx0) * inv_w), 0), grid_w - 1);
+		int cy1 = std::min(std::max((int)((y2 - gy0) * inv_h), 0), grid_h - 1);
+		int stamp_value = (int)k + 1;
+		bool over = false;
+
+		for (size_t l = 0; l < large.size() && !over; l++) {
+			int s = large[l];
+			if (suppress || kept.id[s] == id) {
+				over = nms_iou_over(kept, s, x1, y1, x2, y2, area, iou_threshold);
+			}
+		}
+		for (int cy = cy0; cy <= cy1 && !over; cy++) {
+			for (int cx = cx0; cx <= cx1 && !over; cx++) {
+				const std::vector<int> &cell = cells[cy * grid_w + cx];
+				for (size_t l = 0; l < cell.size(); l++) {
+					int s = cell[l];
+					// 跨多个格子的框只比较一次
+					if (stamp[s] == stamp_value) {
+						continue;
+					}
+					stamp[s] = stamp_value;
+					if (!suppress && kept.id[s] != id) {
+						continue;
+					}
+					if (nms_iou_over(kept, s, x1, y1, x2, y2, area, iou_threshold)) {
+						over = true;
+						break;
+					}
+				}
+			}
+		}
+		if (over) {
+			continue;
+		}
+
+		int slot = kept.size();
+		kept.push_back(x1, y1, x2, y2, area, id);
+		stamp.push_back(0);
+		keep.push_back(i);
+		if ((cx1 - cx0 + 1) * (cy1 - cy0 + 1) > NMS_GRID_LARGE_CELLS) {
+			large.push_back(slot);
+			continue;
+		}
+		for (int cy = cy0; cy <= cy1; cy++) {
+			for (int cx = cx0; cx <= cx1; cx++) {
+				cells[cy * grid_w + cx].push_back(slot);
+			}
+		}
+	}
+}
+
+void bpu_nms(const NmsBoxes &boxes,
+			 float iou_threshold,
+			 int top_k,
+			 bool suppress,
+			 std::vector<int> &keep,
+			 NmsMode mode) {
+	keep.clear();
+	if (top_k <= 0 || boxes.size() == 0) {
+		return;
+	}
+
+	// 按分数从高到低排序，分数相同时保持原来的顺序，和 std::stable_sort 的结果一致
+	std::vector<std::pair<float, int>> order(boxes.size());
+	for (size_t i = 0; i < boxes.size(); i++) {
+		order[i] = std::make_pair(boxes.score[i], (int)i);
+	}
+	std::sort(order.begin(), order.end(),
+			  [](const std::pair<float, int> &a, const std::pair<float, int> &b) {
+				  return a.first > b.first || (a.first == b.first && a.second < b.second);
+			  });
+
+	keep.reserve(std::min((size_t)top_k, boxes.size()));
+	if (mode == NMS_MODE_AUTO) {
+		mode = boxes.size() >= NMS_GRID_MIN_BOXES ? NMS_MODE_GRID : NMS_MODE_LINEAR;
+	}
+	if (mode == NMS_MODE_GRID) {
+		nms_grid(boxes, order, iou_threshold, top_k, suppress, keep);
+	} else {
+		nms_linear(boxes, order, iou_threshold, top_k, suppress, keep);
+	}
+}
@@ -13,12 +13,16 @@
 #include <utility>
 #include <vector>
 #include <iostream>
-#include <iomanip>
 #include <algorithm>
+#include <cstring>
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #include "utils/utils_log.h"
 
 #include "yolov5_post_process.h"
+#include "nms.h"
 
 /**
  * Config definition for Yolov5
@@ -141,12 +145,6 @@ typedef struct Bbox {
 	Bbox(float xmin, float ymin, float xmax, float ymax)
 			: xmin(xmin), ymin(ymin), xmax(xmax), ymax(ymax) {}
 
-	friend std::ostream &operator<<(std::ostream &os, const Bbox &bbox) {
-		os << "[" << std::fixed << std::setprecision(6) << bbox.xmin << ","
-			 << bbox.ymin << "," << bbox.xmax << "," << bbox.ymax << "]";
-		return os;
-	}
-
 	~Bbox() {}
 } Bbox;
 
@@ -167,19 +165,6 @@ typedef struct Detection {
 		return (lhs.score > rhs.score);
 	}
 
-	friend std::ostream &operator<<(std::ostream &os, const Detection &det) {
-		os << "{"
-			 << R"("bbox")"
-			 << ":" << det.bbox << ","
-			 << R"("score")"
-			 << ":" << det.score << ","
-			 << R"("id")"
-			 << ":" << det.id << ","
-			 << R"("name")"
-			 << ":\"" << default_yolov5_config.class_names[det.id] << "\"}";
-		return os;
-	}
-
 	~Detection() {}
 } Detection;
 
@@ -205,66 +190,175 @@ static void yolov5_nms(std::vector<Detection> &input,
 							 int top_k,
 							 std::vector<Detection> &result,
 							 bool suppress) {
-	// sort order by score desc
-	std::stable_sort(input.begin(), input.end(), std::greater<Detection>());
-
-	std::vector<bool> skip(input.size(), false);
+	NmsBoxes boxes;
+	std::vector<int> keep;
 
-	// pre-calculate boxes area
-	std::vector<float> areas;
-	areas.reserve(input.size());
+	boxes.reserve(input.size());
 	for (size_t i = 0; i < input.size(); i++) {
-		float width = input[i].bbox.xmax - input[i].bbox.xmin;
-		float height = input[i].bbox.ymax - input[i].bbox.ymin;
-		areas.push_back(width * height);
+		const Bbox &bbox = input[i].bbox;
+		boxes.push_back(bbox.xmin, bbox.ymin, bbox.xmax, bbox.ymax,
+						input[i].score, input[i].id);
 	}
 
-	int count = 0;
-	for (size_t i = 0; count < top_k && i < skip.size(); i++) {
-		if (skip[i]) {
-			continue;
+	bpu_nms(boxes, iou_threshold, top_k, suppress, keep);
+
+	result.reserve(keep.size());
+	for (size_t i = 0; i < keep.size(); i++) {
+		result.push_back(input[keep[i]]);
+	}
+}
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+/**
+ * 把 4 个输出值转换成 float 并乘以反量化系数
+ */
+static inline float32x4_t load_dequanti4(const float *data, const float *scale) {
+	return vmulq_f32(vld1q_f32(data), vld1q_f32(scale));
+}
+
+static inline float32x4_t load_dequanti4(const int32_t *data, const float *scale) {
+	return vmulq_f32(vcvtq_f32_s32(vld1q_s32(data)), vld1q_f32(scale));
+}
+
+static inline float32x4_t load_dequanti4(const int16_t *data, const float *scale) {
+	return vmulq_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(data))), vld1q_f32(scale));
+}
+
+static inline float32x4_t load_dequanti4(const int8_t *data, const float *scale) {
+	uint32_t raw;
+	memcpy(&raw, data, sizeof(raw));
+	int16x4_t v = vget_low_s16(vmovl_s8(vreinterpret_s8_u32(vdup_n_u32(raw))));
+	return vmulq_f32(vcvtq_f32_s32(vmovl_s16(v)), vld1q_f32(scale));
+}
+
+/**
+ * exp 的多项式近似，4 路并行，在 [-87, 88] 范围内相对误差约 1e-7
+ */
+static inline float32x4_t fast_exp4(float32x4_t x) {
+	x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-87.0f)), vdupq_n_f32(88.0f));
+
+	// exp(x) = 2^n * exp(r), n = floor(x / ln2 + 0.5), r = x - n * ln2
+	float32x4_t fx = vmlaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(1.44269504088896341f));
+	int32x4_t n = vcvtq_s32_f32(fx);
+	float32x4_t fn = vcvtq_f32_s32(n);
+	uint32x4_t mask = vcgtq_f32(fn, fx);
+	n = vsubq_s32(n, vreinterpretq_s32_u32(vandq_u32(mask, vdupq_n_u32(1))));
+	fn = vcvtq_f32_s32(n);
+
+	x = vmlsq_f32(x, fn, vdupq_n_f32(0.693359375f));
+	x = vmlsq_f32(x, fn, vdupq_n_f32(-2.12194440e-4f));
+
+	float32x4_t y = vdupq_n_f32(1.9875691500e-4f);
+	y = vmlaq_f32(vdupq_n_f32(1.3981999507e-3f), y, x);
+	y = vmlaq_f32(vdupq_n_f32(8.3334519073e-3f), y, x);
+	y = vmlaq_f32(vdupq_n_f32(4.1665795894e-2f), y, x);
+	y = vmlaq_f32(vdupq_n_f32(1.6666665459e-1f), y, x);
+	y = vmlaq_f32(vdupq_n_f32(5.0000001201e-1f), y, x);
+	y = vmlaq_f32(vaddq_f32(x, vdupq_n_f32(1.0f)), y, vmulq_f32(x, x));
+
+	int32x4_t pow2n = vshlq_n_s32(vaddq_s32(n, vdupq_n_s32(127)), 23);
+	return vmulq_f32(y, vreinterpretq_f32_s32(pow2n));
+}
+
+static inline void sigmoid4(const float *in, float *out) {
+	float32x4_t e = fast_exp4(vnegq_f32(vld1q_f32(in)));
+	float32x4_t d = vaddq_f32(vdupq_n_f32(1.0f), e);
+	// 倒数估计再做两次牛顿迭代
+	float32x4_t r = vrecpeq_f32(d);
+	r = vmulq_f32(vrecpsq_f32(d, r), r);
+	r = vmulq_f32(vrecpsq_f32(d, r), r);
+	vst1q_f32(out, r);
+}
+
+/**
+ * 反量化后取最大值及其编号，相同最大值时返回编号最小的，和 std::max_element 一致
+ */
+template <typename T>
+static inline int class_argmax(const T *data, const float *scale, int num, float *max_score) {
+	int i = 0;
+	int id = 0;
+	float best = data[0] * scale[0];
+
+	if (num >= 4) {
+		float32x4_t max_v = load_dequanti4(data, scale);
+		uint32x4_t idx_v = {0, 1, 2, 3};
+		uint32x4_t max_idx = idx_v;
+		const uint32x4_t step = vdupq_n_u32(4);
+
+		for (i = 4; i + 4 <= num; i += 4) {
+			float32x4_t v = load_dequanti4(data + i, scale + i);
+			idx_v = vaddq_u32(idx_v, step);
+			uint32x4_t gt = vcgtq_f32(v, max_v);
+			max_v = vbslq_f32(gt, v, max_v);
+			max_idx = vbslq_u32(gt, idx_v, max_idx);
 		}
-		skip[i] = true;
-		++count;
 
-		for (size_t j = i + 1; j < skip.size(); ++j) {
-			if (skip[j]) {
-				continue;
-			}
-			if (suppress == false) {
-				if (input[i].id != input[j].id) {
-					continue;
-				}
+		float lane_max[4];
+		uint32_t lane_idx[4];
+		vst1q_f32(lane_max, max_v);
+		vst1q_u32(lane_idx, max_idx);
+		best = lane_max[0];
+		id = lane_idx[0];
+		for (int l = 1; l < 4; l++) {
+			if (lane_max[l] > best || (lane_max[l] == best && (int)lane_idx[l] < id)) {
+				best = lane_max[l];
+				id = lane_idx[l];
 			}
+		}
+	}
 
-			// intersection area
-			float xx1 = std::max(input[i].bbox.xmin, input[j].bbox.xmin);
-			float yy1 = std::max(input[i].bbox.ymin, input[j].bbox.ymin);
-			float xx2 = std::min(input[i].bbox.xmax, input[j].bbox.xmax);
-			float yy2 = std::min(input[i].bbox.ymax, input[j].bbox.ymax);
-
-			if (xx2 > xx1 && yy2 > yy1) {
-				float area_intersection = (xx2 - xx1) * (yy2 - yy1);
-				float iou_ratio =
-						area_intersection / (areas[j] + areas[i] - area_intersection);
-				if (iou_ratio > iou_threshold) {
-					skip[j] = true;
-				}
-			}
+	for (; i < num; i++) {
+		float v = data[i] * scale[i];
+		if (v > best) {
+			best = v;
+			id = i;
+		}
+	}
+	*max_score = best;
+	return id;
+}
+#else
+static inline void sigmoid4(const float *in, float *out) {
+	for (int i = 0; i < 4; i++) {
+		out[i] = 1.0f / (1.0f + std::exp(-in[i]));
+	}
+}
+
+template <typename T>
+static inline int class_argmax(const T *data, const float *scale, int num, float *max_score) {
+	int id = 0;
+	float best = data[0] * scale[0];
+
+	for (int i = 1; i < num; i++) {
+		float v = data[i] * scale[i];
+		if (v > best) {
+			best = v;
+			id = i;
 		}
-		result.push_back(input[i]);
 	}
+	*max_score = best;
+	return id;
+}
+#endif
+
+static inline float sigmoid(float x) {
+	return 1.0f / (1.0f + std::exp(-x));
 }
 
+/**
+ * T 为输出 tensor 的数据类型，float 输出时反量化系数全部为 1，
+ * int8/int16/int32 输出直接用 quantiScale 的系数反量化，不需要先转换成 float tensor
+ */
+template <typename T>
 static void _postProcess(hbDNNTensor *tensor,
-																				 Yolov5PostProcessInfo_t *post_info,
-																				 int layer,
-																				 std::vector<Detection> &dets) {
-	auto *data = reinterpret_cast<float *>(tensor->sysMem[0].virAddr);
+						 Yolov5PostProcessInfo_t *post_info,
+						 int layer,
+						 std::vector<Detection> &dets) {
+	auto *data = reinterpret_cast<const T *>(tensor->sysMem[0].virAddr);
 	// 80个分类
 	int num_classes = default_yolov5_config.class_num;
 	// 下采样值 8 16 32
-	int stride = default_yolov5_config.strides[layer];
+	float stride = default_yolov5_config.strides[layer];
 	// 每个预测值占用多少空间
 	// 一组条件类别概率，都是区间在[0,1]之间的值，代表概率。
 	// box参数即box的中心点坐标（x,y）和box的宽和高（w,h）
@@ -275,102 +369,110 @@ static void _postProcess(hbDNNTensor *tensor,
 	 */
 	int num_pred = default_yolov5_config.class_num + 4 + 1;
 
-	std::vector<float> class_pred(default_yolov5_config.class_num, 0.0);
 	// 3组 预设检测框类型
 	std::vector<std::pair<double, double>> &anchors =
 			default_yolov5_config.anchors_table[layer];
+	int anchor_num = anchors.size();
 
-	// 计算原始图像与算法推理实际使用图像的缩放比
-	double h_ratio = post_info->height * 1.0 / post_info->ori_height;
-	double w_ratio = post_info->width * 1.0 / post_info->ori_width;
-	double resize_ratio = std::min(w_ratio, h_ratio);
-	if (post_info->is_pad_resize) {
-		w_ratio = resize_ratio;
-		h_ratio = resize_ratio;
+	if (tensor->properties.tensorLayout != HB_DNN_LAYOUT_NHWC) {
+		SC_LOGE("yolov5 output tensor %d layout %d is not supported",
+			layer, tensor->properties.tensorLayout);
+		return;
 	}
 
 	int32_t height = 0, width = 0;
 	auto ret = get_tensor_hw(*tensor, &height, &width);
 	if (ret != 0) {
 		printf("get_tensor_hw failed\n");
+		return;
+	}
+	// 按对齐后的 shape 计算每个 grid cell 和每一行的步长
+	int cell_stride = tensor->properties.alignedShape.dimensionSize[3];
+	int row_stride = tensor->properties.alignedShape.dimensionSize[2] * cell_stride;
+	if (cell_stride < num_pred * anchor_num) {
+		SC_LOGE("yolov5 output tensor %d has %d channels, need %d",
+			layer, cell_stride, num_pred * anchor_num);
+		return;
 	}
 
-#if 0
-	printf("height=%d, width=%d\n", height, width);
-
-	hbDNNTensorProperties properties = tensor->properties;
-	int j = 0;
-	printf("tensorLayout: %d tensorType: %d validShape:(",
-		properties.tensorLayout, properties.tensorType);
-	for (j = 0; j < properties.validShape.numDimensions; j++)
-		printf("%d, ", properties.validShape.dimensionSize[j]);
-	printf("), ");
-	printf("alignedShape:(");
-	for (j = 0; j < properties.alignedShape.numDimensions; j++)
-		printf("%d, ", properties.alignedShape.dimensionSize[j]);
-	printf(")\n");
-#endif
-	int anchor_num = anchors.size();
-	//  for (int32_t a = 0; a < anchors.size(); a++) {
-	/*SC_LOGI("height:%d width:%d anchors.size:%d", height, width, anchors.size());*/
+	// 每个通道的反量化系数，per-tensor 量化时所有通道共用一个系数
+	std::vector<float> scale(num_pred * anchor_num, 1.0f);
+	if (tensor->properties.quantiType == SCALE) {
+		const hbDNNQuantiScale &quanti = tensor->properties.scale;
+		for (size_t c = 0; c < scale.size(); c++) {
+			scale[c] = quanti.scaleLen > (int)c ? quanti.scaleData[c] : quanti.scaleData[0];
+		}
+	}
+
+	// 计算原始图像与算法推理实际使用图像的缩放比
+	float h_ratio = post_info->height * 1.0f / post_info->ori_height;
+	float w_ratio = post_info->width * 1.0f / post_info->ori_width;
+	float resize_ratio = std::min(w_ratio, h_ratio);
+	if (post_info->is_pad_resize) {
+		w_ratio = resize_ratio;
+		h_ratio = resize_ratio;
+	}
+	float w_padding = (post_info->width - w_ratio * post_info->ori_width) / 2.0f;
+	float h_padding = (post_info->height - h_ratio * post_info->ori_height) / 2.0f;
+
+	/* confidence = sigmoid(objness) * sigmoid(class) <= sigmoid(objness)，
+	 * 所以 objness < -ln(1 / score_threshold - 1) 时 confidence 一定小于 score_threshold，
+	 * 不需要再找最大分类和计算 exp，class 同理
+	 */
+	float score_threshold = post_info->score_threshold;
+	float pre_thresh = -std::log(1.0f / score_threshold - 1.0f);
+
 	for (int32_t h = 0; h < height; h++) {
+		const T *row = data + h * row_stride;
 		for (int32_t w = 0; w < width; w++) {
+			const T *cell = row + w * cell_stride;
 			for (int k = 0; k < anchor_num; k++) {
-				double anchor_x = anchors[k].first;
-				double anchor_y = anchors[k].second;
-			// 取出一个预测结果
-				float *cur_data = data + k * num_pred;
-		// 置信度
-				float objness = cur_data[4];
-		// 每个分类的概率值
-				for (int index = 0; index < num_classes; ++index) {
-					class_pred[index] = cur_data[5 + index];
-				}
+				// 取出一个预测结果
+				const T *cur_data = cell + k * num_pred;
+				const float *cur_scale = scale.data() + k * num_pred;
 
-		// 获得概率值最大的分类对应的编号，作为id
-					int id = argmax(cur_data + 5, cur_data + 5 + num_classes);
-		// 计算置信度
-				double x1 = 1 / (1 + std::exp(-objness)) * 1;
-					double x2 = 1 / (1 + std::exp(-cur_data[id + 5]));
-				double confidence = x1 * x2;
-
-		// 过滤置信度不足的检测框
-				if (confidence < post_info->score_threshold) {
+				// 置信度
+				float objness = cur_data[4] * cur_scale[4];
+				if (objness < pre_thresh) {
 					continue;
 				}
 
-		/*printf("confidence: %f\n", confidence);*/
-
-		// box参数即box的中心点坐标（x,y）和box的宽和高（w,h）
-				float center_x = cur_data[0];
-				float center_y = cur_data[1];
-				float scale_x = cur_data[2];
-				float scale_y = cur_data[3];
+				// 获得概率值最大的分类对应的编号，作为id
+				float class_score;
+				int id = class_argmax(cur_data + 5, cur_scale + 5, num_classes, &class_score);
+				if (class_score < pre_thresh) {
+					continue;
+				}
 
-				double box_center_x =
-						((1.0 / (1.0 + std::exp(-center_x))) * 2 - 0.5 + w) * stride;
-				double box_center_y =
-						((1.0 / (1.0 + std::exp(-center_y))) * 2 - 0.5 + h) * stride;
+				// 计算置信度，过滤置信度不足的检测框
+				float confidence = sigmoid(objness) * sigmoid(class_score);
+				if (confidence < score_threshold) {
+					continue;
+				}
 
-				double box_scale_x =
-						std::pow((1.0 / (1.0 + std::exp(-scale_x))) * 2, 2) * anchor_x;
-				double box_scale_y =
-						std::pow((1.0 / (1.0 + std::exp(-scale_y))) * 2, 2) * anchor_y;
+				// box参数即box的中心点坐标（x,y）和box的宽和高（w,h）
+				float box[4], box_sig[4];
+				for (int i = 0; i < 4; i++) {
+					box[i] = cur_data[i] * cur_scale[i];
+				}
+				sigmoid4(box, box_sig);
 
-				double xmin = (box_center_x - box_scale_x / 2.0);
-				double ymin = (box_center_y - box_scale_y / 2.0);
-				double xmax = (box_center_x + box_scale_x / 2.0);
-				double ymax = (box_center_y + box_scale_y / 2.0);
+				float box_center_x = (box_sig[0] * 2 - 0.5f + w) * stride;
+				float box_center_y = (box_sig[1] * 2 - 0.5f + h) * stride;
+				float box_scale_x = box_sig[2] * 2;
+				float box_scale_y = box_sig[3] * 2;
+				box_scale_x = box_scale_x * box_scale_x * anchors[k].first;
+				box_scale_y = box_scale_y * box_scale_y * anchors[k].second;
 
-				double w_padding =
-						(post_info->width - w_ratio * post_info->ori_width) / 2.0;
-				double h_padding =
-						(post_info->height - h_ratio * post_info->ori_height) / 2.0;
+				float xmin = (box_center_x - box_scale_x / 2.0f);
+				float ymin = (box_center_y - box_scale_y / 2.0f);
+				float xmax = (box_center_x + box_scale_x / 2.0f);
+				float ymax = (box_center_y + box_scale_y / 2.0f);
 
-				double xmin_org = (xmin - w_padding) / w_ratio;
-				double xmax_org = (xmax - w_padding) / w_ratio;
-				double ymin_org = (ymin - h_padding) / h_ratio;
-				double ymax_org = (ymax - h_padding) / h_ratio;
+				float xmin_org = (xmin - w_padding) / w_ratio;
+				float xmax_org = (xmax - w_padding) / w_ratio;
+				float ymin_org = (ymin - h_padding) / h_ratio;
+				float ymax_org = (ymax - h_padding) / h_ratio;
 
 				if (xmax_org <= 0 || ymax_org <= 0) {
 					continue;
@@ -380,36 +482,55 @@ static void _postProcess(hbDNNTensor *tensor,
 					continue;
 				}
 
-		// 把box的坐标限制在图像大小范围内
-				xmin_org = std::max(xmin_org, 0.0);
-				xmax_org = std::min(xmax_org, post_info->ori_width - 1.0);
-				ymin_org = std::max(ymin_org, 0.0);
-				ymax_org = std::min(ymax_org, post_info->ori_height - 1.0);
-
-		/*printf("xmin_org: %f xmax_org: %f ymin_org:%f ymax_org:%f\n",*/
-			/*xmin_org, xmax_org, ymin_org, ymax_org);*/
+				// 把box的坐标限制在图像大小范围内
+				xmin_org = std::max(xmin_org, 0.0f);
+				xmax_org = std::min(xmax_org, post_info->ori_width - 1.0f);
+				ymin_org = std::max(ymin_org, 0.0f);
+				ymax_org = std::min(ymax_org, post_info->ori_height - 1.0f);
 
-		// 实际在原图上的box，添加到检测结果中
+				// 实际在原图上的box，添加到检测结果中
 				Bbox bbox(xmin_org, ymin_org, xmax_org, ymax_org);
-				dets.push_back(Detection((int)id,
-																 confidence,
-																 bbox,
-																 default_yolov5_config.class_names[(int)id].c_str()));
+				dets.push_back(Detection(id,
+										 confidence,
+										 bbox,
+										 default_yolov5_config.class_names[id].c_str()));
 			}
-			data = data + num_pred * anchors.size();
 		}
 	}
 }
 
+static void _postProcess(hbDNNTensor *tensor,
+						 Yolov5PostProcessInfo_t *post_info,
+						 int layer,
+						 std::vector<Detection> &dets) {
+	switch (tensor->properties.tensorType) {
+	case HB_DNN_TENSOR_TYPE_F32:
+		_postProcess<float>(tensor, post_info, layer, dets);
+		break;
+	case HB_DNN_TENSOR_TYPE_S8:
+		_postProcess<int8_t>(tensor, post_info, layer, dets);
+		break;
+	case HB_DNN_TENSOR_TYPE_S16:
+		_postProcess<int16_t>(tensor, post_info, layer, dets);
+		break;
+	case HB_DNN_TENSOR_TYPE_S32:
+		_postProcess<int32_t>(tensor, post_info, layer, dets);
+		break;
+	default:
+		SC_LOGE("yolov5 output tensor %d type %d is not supported",
+			layer, tensor->properties.tensorType);
+		break;
+	}
+}
+
 // Yolov5 输出tensor格式
 // 3次下采样得到三组缩小后的gred，然后对每个gred进行三次预测，最后输出结果
-char* Yolov5PostProcess(Yolov5PostProcessInfo_t *post_info) {
+int32_t Yolov5PostProcess(Yolov5PostProcessInfo_t *post_info, bpu_result_t *result) {
 	hbDNNTensor *tensor = post_info->output_tensor;
 
 	std::vector<Detection> dets;
 	std::vector<Detection> det_restuls;
 	uint32_t i = 0;
-	char *str_dets;
 
 	// 根据置信度过滤检测框
 	for (i = 0; i < default_yolov5_config.strides.size(); i++) {
@@ -417,24 +538,16 @@ char* Yolov5PostProcess(Yolov5PostProcessInfo_t *post_info) {
 	}
 	// 计算交并比来合并检测框，传入交并比阈值(0.65)和返回box数量(5000)
 	yolov5_nms(dets, post_info->nms_threshold, post_info->nms_top_k, det_restuls, false);
-	std::stringstream out_string;
 
-	// 算法结果转换成json格式
-	out_string << "\"timestamp\": ";
-	unsigned long timestamp = post_info->tv.tv_sec * 1000000 + post_info->tv.tv_usec;
-	out_string << timestamp;
-	out_string << ",\"detection_result\": [";
+	// 算法结果直接写成 websocket 发送的 json 消息
+	uint64_t timestamp = post_info->tv.tv_sec * 1000000 + post_info->tv.tv_usec;
+	bpu_result_begin_detection(result, post_info->pipeline, timestamp);
 	for (i = 0; i < det_restuls.size(); i++) {
-		auto det_ret = det_restuls[i];
-		out_string << det_ret;
-		if (i < det_restuls.size() - 1)
-		out_string << ",";
+		const Detection &det = det_restuls[i];
+		const float bbox[4] = {det.bbox.xmin, det.bbox.ymin, det.bbox.xmax, det.bbox.ymax};
+		bpu_result_add_detection(result, bbox, det.score, det.id,
+			default_yolov5_config.class_names[det.id].c_str());
 	}
-	out_string << "]" << std::endl;
-
-	str_dets = (char *)malloc(out_string.str().length() + 1);
-	str_dets[out_string.str().length()] = '\0';
-	snprintf(str_dets, out_string.str().length(), "%s", out_string.str().c_str());
-	return str_dets;
+	bpu_result_end_detection(result);
+	return 0;
 }
-
@@ -43,6 +43,7 @@ typedef struct {
 	int32_t decode_width;
 	int32_t decode_height;
 	int32_t decode_frame_rate;
+	int32_t decode_mode; // 0: 按码流时间戳实时送帧; 1: 解码器空闲就送帧，尽快解码
 	int32_t encode_type; // 编码类型
 	int32_t encode_width;
 	int32_t encode_height;
@@ -76,6 +76,7 @@ static key_info_t cfg_box_vpp_key[] = {
 	MAKE_KEY_INFO(solution_cfg_box_vpp_t, KEY_TYPE_S32, decode_width, NULL),
 	MAKE_KEY_INFO(solution_cfg_box_vpp_t, KEY_TYPE_S32, decode_height, NULL),
 	MAKE_KEY_INFO(solution_cfg_box_vpp_t, KEY_TYPE_S32, decode_frame_rate, NULL),
+	MAKE_KEY_INFO(solution_cfg_box_vpp_t, KEY_TYPE_S32, decode_mode, NULL),
 	MAKE_KEY_INFO(solution_cfg_box_vpp_t, KEY_TYPE_S32, encode_type, NULL),
 	MAKE_KEY_INFO(solution_cfg_box_vpp_t, KEY_TYPE_S32, encode_width, NULL),
 	MAKE_KEY_INFO(solution_cfg_box_vpp_t, KEY_TYPE_S32, encode_height, NULL),
@@ -158,6 +159,7 @@ void print_solution_cfg(const solution_cfg_t *config)
 		printf("    Decode Width: %d\n", config->box_solution.box_vpp[i].decode_width);
 		printf("    Decode Height: %d\n", config->box_solution.box_vpp[i].decode_height);
 		printf("    Decode Frame Rate: %d\n", config->box_solution.box_vpp[i].decode_frame_rate);
+		printf("    Decode Mode: %d\n", config->box_solution.box_vpp[i].decode_mode);
 		printf("    Encode Type: %d\n", config->box_solution.box_vpp[i].encode_type);
 		printf("    Encode Width: %d\n", config->box_solution.box_vpp[i].encode_width);
 		printf("    Encode Height: %d\n", config->box_solution.box_vpp[i].encode_height);
@@ -418,6 +420,7 @@ int32_t solution_cfg_load_default_config()
 	g_solution_config.box_solution.box_vpp[0].decode_width = 1920;
 	g_solution_config.box_solution.box_vpp[0].decode_height = 1080;
 	g_solution_config.box_solution.box_vpp[0].decode_frame_rate = 30;
+	g_solution_config.box_solution.box_vpp[0].decode_mode = 0;
 	g_solution_config.box_solution.box_vpp[0].encode_type = 0;
 	g_solution_config.box_solution.box_vpp[0].encode_width = 1920;
 	g_solution_config.box_solution.box_vpp[0].encode_height = 1080;
@@ -27,10 +27,18 @@ extern "C" {
 }
 #endif /* extern "C" */
 
+// 解码线程给解码器送码流的节奏
+typedef enum {
+	VP_DECODE_MODE_REALTIME = 0,	// 按码流时间戳送帧，播放速度和原始帧率一致
+	VP_DECODE_MODE_FAST,			// 解码器有空闲的输入 buffer 就送帧，用于离线分析
+} vp_decode_mode_e;
+
 typedef struct {
 	media_codec_context_t *context;
 	char stream_path[256];
 	int32_t frame_count;
+	int32_t decode_mode;	// vp_decode_mode_e
+	int32_t frame_rate;		// 裸码流没有时间戳，按这个帧率送帧，0 表示使用码流里的帧率
 } vp_decode_param_t;
 
 #ifdef __cplusplus
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -17,6 +18,7 @@
 
 #include "utils/utils_log.h"
 #include "utils/mthread.h"
+#include "utils/mqueue.h"
 
 #include "vp_common.h"
 #include "vp_wrap.h"
@@ -956,20 +958,246 @@ int32_t vp_codec_release_output(media_codec_context_t *context, ImageFrame *fram
 	return ret;
 }
 
-void *vp_decode_work_func(void *param)
+#define VP_DEMUX_QUEUE_DEPTH			16		// 预读的码流包个数
+#define VP_DECODE_LATE_RESET_US			(500 * 1000)	// 送帧落后超过这个时间就重新对齐时钟，不追帧
+#define VP_DECODE_REPORT_INTERVAL_US	(10 * 1000000LL)
+
+// 解封装线程读出的一个码流包
+typedef struct {
+	AVPacket	*packet;		// NULL 表示码流结束
+	int64_t		ts_us;			// 相对码流开头的解码时间，AV_NOPTS_VALUE 表示不需要等待(序列头)
+	int32_t		discontinuity;	// 重新打开码流后的第一个包，需要重新对齐时钟
+} vp_demux_packet_t;
+
+typedef struct {
+	vp_decode_param_t	*param;
+	tsThread			thread;
+	tsQueue				queue;	// vp_demux_packet_t，最多预读 VP_DEMUX_QUEUE_DEPTH 个
+} vp_demuxer_t;
+
+static vp_demux_packet_t *vp_demux_packet_alloc(int32_t size)
+{
+	vp_demux_packet_t *item = (vp_demux_packet_t *)calloc(1, sizeof(vp_demux_packet_t));
+	if (item == NULL)
+		return NULL;
+	item->ts_us = AV_NOPTS_VALUE;
+	if (size < 0)
+		return item;
+
+	item->packet = av_packet_alloc();
+	if (item->packet == NULL || (size > 0 && av_new_packet(item->packet, size) != 0)) {
+		av_packet_free(&item->packet);
+		free(item);
+		return NULL;
+	}
+	return item;
+}
+
+static void vp_demux_packet_free(vp_demux_packet_t *item)
+{
+	if (item == NULL)
+		return;
+	av_packet_free(&item->packet);
+	free(item);
+}
+
+// 送进预读队列，队列满时等待送帧线程取走，线程退出时丢弃
+static int32_t vp_demux_push(tsThread *privThread, vp_demuxer_t *demuxer, vp_demux_packet_t *item)
+{
+	while (mQueueEnqueueEx(&demuxer->queue, item) != E_QUEUE_OK) {
+		if (privThread->eState != E_THREAD_RUNNING) {
+			vp_demux_packet_free(item);
+			return -1;
+		}
+		usleep(2 * 1000);
+	}
+	return 0;
+}
+
+// 码流包的解码时间，换算成相对码流开头的微秒数
+// 裸码流(h264/h265 文件)没有时间戳，按配置的帧率计算
+static int64_t vp_demux_packet_time_us(AVFormatContext *avContext, AVPacket *avpacket,
+	int64_t frame_duration_us, int64_t *start_ts, int64_t *last_ts_us, int64_t *frame_index)
+{
+	AVStream *stream = avContext->streams[avpacket->stream_index];
+	int64_t ts = avpacket->dts != AV_NOPTS_VALUE ? avpacket->dts : avpacket->pts;
+	int64_t ts_us = 0;
+
+	if ((avContext->iformat->flags & AVFMT_NOTIMESTAMPS) || ts == AV_NOPTS_VALUE) {
+		ts_us = *frame_index > 0 ? *last_ts_us + frame_duration_us : 0;
+	} else {
+		if (*start_ts == AV_NOPTS_VALUE)
+			*start_ts = ts;
+		ts_us = av_rescale_q(ts - *start_ts, stream->time_base, AV_TIME_BASE_Q);
+	}
+
+	*last_ts_us = ts_us;
+	(*frame_index)++;
+	return ts_us;
+}
+
+// 解封装线程: 读取码流包放进预读队列，文件读完后重新打开循环播放
+static void *vp_demux_work_func(void *param)
 {
 	tsThread *privThread = (tsThread*)param;
-	vp_decode_param_t *decode_param = (vp_decode_param_t *)(privThread->pvThreadData);
+	vp_demuxer_t *demuxer = (vp_demuxer_t *)(privThread->pvThreadData);
+	vp_decode_param_t *decode_param = demuxer->param;
+	media_codec_context_t *context = decode_param->context;
 	int32_t error = 0;
 	AVFormatContext *avContext = NULL;
 	AVPacket avpacket = {0};
 	int32_t video_idx = -1;
-	uint8_t *seqHeader = NULL;
-	int32_t seqHeaderSize = 0;
 	int32_t firstPacket = 1;
+	int32_t discontinuity = 1;
+	int64_t frame_duration_us = 0;
+	int64_t start_ts = AV_NOPTS_VALUE, last_ts_us = 0, frame_index = 0;
+	vp_demux_packet_t *item = NULL;
+
+	mThreadSetName(privThread, __func__);
+
+	video_idx = AV_open_stream(decode_param, &avContext, &avpacket);
+	if (video_idx < 0)
+	{
+		SC_LOGE("failed to AV_open_stream");
+		goto exit;
+	}
+
+	while (privThread->eState == E_THREAD_RUNNING) {
+		if (frame_duration_us == 0) {
+			AVStream *stream = avContext->streams[video_idx];
+			double fps = decode_param->frame_rate;
+			if (fps <= 0 || !(avContext->iformat->flags & AVFMT_NOTIMESTAMPS))
+				fps = av_q2d(stream->avg_frame_rate);
+			if (fps <= 0)
+				fps = av_q2d(stream->r_frame_rate);
+			if (fps <= 0)
+				fps = 30;
+			frame_duration_us = (int64_t)(1000000 / fps);
+			SC_LOGI("%s: %s, %.2f fps", decode_param->stream_path, avContext->iformat->name, fps);
+		}
+
+		error = av_read_frame(avContext, &avpacket);
+		if (error < 0)
+		{
+			if (error == AVERROR_EOF || avContext->pb->eof_reached == true)
+			{
+				SC_LOGI("No more input data available, re-cycling to send again.");
+			}
+			else
+			{
+				SC_LOGE("Failed to av_read_frame error(0x%08x)", error);
+			}
+
+			avformat_close_input(&avContext);
+			memset(&avpacket, 0, sizeof(avpacket));
+			video_idx = AV_open_stream(decode_param, &avContext, &avpacket);
+			if (video_idx < 0)
+			{
+				SC_LOGE("failed to AV_open_stream");
+				goto exit;
+			}
+			discontinuity = 1;
+			frame_duration_us = 0;
+			start_ts = AV_NOPTS_VALUE;
+			last_ts_us = 0;
+			frame_index = 0;
+			continue;
+		}
+
+		// 只送视频包，其他流(音频等)的包直接丢掉
+		if (avpacket.stream_index != video_idx) {
+			av_packet_unref(&avpacket);
+			continue;
+		}
+
+		if (firstPacket)
+		{
+			int32_t retSize = 0;
+			int32_t seqHeaderSize = 0;
+			AVCodecParameters *codec = avContext->streams[video_idx]->codecpar;
+			uint8_t *seqHeader = (uint8_t *)calloc(1U, codec->extradata_size + 1024);
+			if (seqHeader == NULL)
+			{
+				SC_LOGE("Failed to mallock seqHeader");
+				av_packet_unref(&avpacket);
+				goto exit;
+			}
+
+			seqHeaderSize = AV_build_dec_seq_header(seqHeader,
+											context->codec_id,
+											avContext->streams[video_idx], &retSize);
+			if (seqHeaderSize < 0)
+			{
+				SC_LOGE("Failed to build seqHeader");
+				free(seqHeader);
+				av_packet_unref(&avpacket);
+				goto exit;
+			}
+			if (seqHeaderSize > 0) {
+				item = vp_demux_packet_alloc(seqHeaderSize);
+				if (item != NULL) {
+					memcpy(item->packet->data, seqHeader, seqHeaderSize);
+					vp_demux_push(privThread, demuxer, item);
+				}
+			}
+			free(seqHeader);
+			firstPacket = 0;
+		}
+
+		item = vp_demux_packet_alloc(0);
+		if (item == NULL) {
+			SC_LOGE("malloc demux packet failed");
+			av_packet_unref(&avpacket);
+			goto exit;
+		}
+		item->ts_us = vp_demux_packet_time_us(avContext, &avpacket, frame_duration_us,
+			&start_ts, &last_ts_us, &frame_index);
+		item->discontinuity = discontinuity;
+		discontinuity = 0;
+		av_packet_move_ref(item->packet, &avpacket);
+		vp_demux_push(privThread, demuxer, item);
+	}
+
+exit:
+	// 异常退出时通知送帧线程码流结束
+	if (privThread->eState == E_THREAD_RUNNING) {
+		item = vp_demux_packet_alloc(-1);
+		if (item != NULL)
+			vp_demux_push(privThread, demuxer, item);
+	}
+	if (avContext)
+		avformat_close_input(&avContext);
+	mThreadFinish(privThread);
+	return NULL;
+}
+
+// 解码器还有没有空闲的输入 buffer，查询失败时返回 true，由 dequeue_input_buffer 阻塞等待
+static bool vp_decode_input_available(media_codec_context_t *context)
+{
+	mc_inter_status_t status;
+
+	memset(&status, 0, sizeof(status));
+	if (hb_mm_mc_get_status(context, &status) != 0 || status.total_input_buf_cnt == 0)
+		return true;
+	return status.cur_input_buf_cnt < status.total_input_buf_cnt;
+}
+
+// 送帧线程: 从预读队列取码流包送进解码器
+// VP_DECODE_MODE_REALTIME 按码流时间戳送帧，VP_DECODE_MODE_FAST 解码器有空闲输入 buffer 就送
+void *vp_decode_work_func(void *param)
+{
+	tsThread *privThread = (tsThread*)param;
+	vp_decode_param_t *decode_param = (vp_decode_param_t *)(privThread->pvThreadData);
 	bool eos = false;
 	media_codec_context_t *context = NULL;
 	ImageFrame frame = {0};
+	vp_demuxer_t demuxer;
+	vp_demux_packet_t *item = NULL;
+	int64_t clock_base_us = 0;	// 码流时间 0 对应的系统时间
+	int64_t now_us = 0, last_report_us = 0;
+	uint32_t fed_count = 0, underrun_count = 0, reset_count = 0;
+
+	memset(&demuxer, 0, sizeof(demuxer));
 
 	frame.frame_buffer = (media_codec_buffer_t *)malloc(sizeof(media_codec_buffer_t));
 	if (frame.frame_buffer == NULL)
@@ -984,7 +1212,6 @@ void *vp_decode_work_func(void *param)
 	if (frame.buffer_info == NULL)
 	{
 		SC_LOGE("malloc media_codec_output_buffer_info_t failed.");
-		free(frame.frame_buffer);
 		goto exit;
 	}
 
@@ -994,142 +1221,117 @@ void *vp_decode_work_func(void *param)
 
 	context = decode_param->context;
 
-	video_idx = AV_open_stream(decode_param, &avContext, &avpacket);
-	if (video_idx < 0)
+	// 队列里最多存 length - 1 个
+	if (mQueueCreate(&demuxer.queue, VP_DEMUX_QUEUE_DEPTH + 1) != E_QUEUE_OK)
 	{
-		SC_LOGE("failed to AV_open_stream");
-		goto err_av_open;
+		SC_LOGE("create demux queue failed");
+		goto exit;
 	}
+	demuxer.param = decode_param;
+	demuxer.thread.pvThreadData = (void *)&demuxer;
+	mThreadStart(vp_demux_work_func, &demuxer.thread, E_THREAD_JOINABLE);
 
+	last_report_us = get_current_time_us();
 	while(privThread->eState == E_THREAD_RUNNING) {
-		mc_inter_status_t pstStatus;
-		hb_mm_mc_get_status(context, &pstStatus);
+		now_us = get_current_time_us();
+		if (now_us - last_report_us >= VP_DECODE_REPORT_INTERVAL_US) {
+			SC_LOGI("decode instance %d (%s): fed %.1f fps, read-ahead underruns %u, clock resets %u",
+				context->instance_index,
+				decode_param->decode_mode == VP_DECODE_MODE_FAST ? "fast" : "realtime",
+				fed_count * 1000000.0 / (now_us - last_report_us), underrun_count, reset_count);
+			fed_count = 0;
+			underrun_count = 0;
+			reset_count = 0;
+			last_report_us = now_us;
+		}
 
-		// wait for each frame for decoding
-		usleep(30 * 1000);
+		if (item == NULL && mQueueDequeueTimed(&demuxer.queue, 100, (void**)&item) != E_QUEUE_OK)
+		{
+			item = NULL;
+			underrun_count++;
+			continue;
+		}
 
-		if (!avpacket.size)
+		if (item->packet == NULL)
 		{
-			error = av_read_frame(avContext, &avpacket);
+			SC_LOGE("demux stopped, end of stream");
+			eos = true;
+			break;
 		}
 
-		if (error < 0)
+		if (item->packet->size > context->video_dec_params.bitstream_buf_size)
 		{
-			if (error == AVERROR_EOF || avContext->pb->eof_reached == true)
-			{
-				SC_LOGI("No more input data available, avpacket.size: %d."
-					" Re-cycling to send again.", avpacket.size);
-				// if decode done, continue decode current file
-				eos = false;
-			}
-			else
-			{
-				SC_LOGE("Failed to av_read_frame error(0x%08x)", error);
-			}
+			SC_LOGE("The external stream buffer is too small!"
+					"avpacket.size:%d, buffer size:%d",
+					item->packet->size,
+					context->video_dec_params.bitstream_buf_size);
+			eos = true;
+			break;
+		}
 
-			if (avContext)
-			{
-				avformat_close_input(&avContext);
-			}
-			if (decode_param->stream_path != NULL)
-			{
-				avContext = NULL;
-				memset(&avpacket, 0, sizeof(avpacket));
-				video_idx = AV_open_stream(decode_param, &avContext, &avpacket);
-				if (video_idx < 0)
-				{
-					SC_LOGE("failed to AV_open_stream");
-					goto err_av_open;
-				}
-			}
-			else
+		if (decode_param->decode_mode == VP_DECODE_MODE_FAST)
+		{
+			// 解码器的输入 buffer 都在使用中，稍后再送，避免在 dequeue_input_buffer 里长时间阻塞
+			if (!vp_decode_input_available(context))
 			{
-				eos = true;
+				usleep(1000);
+				continue;
 			}
 		}
-		else
+		else if (item->ts_us != AV_NOPTS_VALUE)
 		{
-			seqHeaderSize = 0;
-			if (firstPacket)
-			{
-				AVCodecParameters *codec;
-				int32_t retSize = 0;
-				codec = avContext->streams[video_idx]->codecpar;
-				seqHeader = (uint8_t *)calloc(1U, codec->extradata_size + 1024);
-				if (seqHeader == NULL)
-				{
-					SC_LOGE("Failed to mallock seqHeader");
-					eos = true;
-					break;
-				}
-
-				seqHeaderSize = AV_build_dec_seq_header(seqHeader,
-												context->codec_id,
-												avContext->streams[video_idx], &retSize);
-				if (seqHeaderSize < 0)
-				{
-					SC_LOGE("Failed to build seqHeader");
-					eos = true;
-					break;
-				}
-				firstPacket = 0;
-			}
-			if (avpacket.size <= context->video_dec_params.bitstream_buf_size)
+			if (item->discontinuity || clock_base_us == 0)
 			{
-				if (seqHeaderSize)
-				{
-					frame.data[0] = (void *)seqHeader;
-					frame.data_size[0] = seqHeaderSize;
-					vp_codec_set_input(context, &frame, eos);
-				}
-				else
-				{
-					frame.data[0] = (void *)avpacket.data;
-					frame.data_size[0] = avpacket.size;
-					vp_codec_set_input(context, &frame, eos);
-					if (log_ctrl_level_get(NULL) == LOG_TRACE) {
-						print_avpacket_info(&avpacket);
-						vp_codec_print_media_codec_output_buffer_info(&frame);
-					}
-					av_packet_unref(&avpacket);
-					avpacket.size = 0;
-				}
+				clock_base_us = now_us - item->ts_us;
+				item->discontinuity = 0;
 			}
-			else
+			else if (now_us - (clock_base_us + item->ts_us) > VP_DECODE_LATE_RESET_US)
 			{
-				SC_LOGE("The external stream buffer is too small!"
-						"avpacket.size:%d, buffer size:%d",
-						avpacket.size,
-						context->video_dec_params.bitstream_buf_size);
-				eos = true;
-				break;
+				// 解码器或者码流源跟不上，从当前帧重新计时，不连续快速送帧追赶
+				clock_base_us = now_us - item->ts_us;
+				reset_count++;
 			}
 
-			if (seqHeader)
+			if (clock_base_us + item->ts_us > now_us)
 			{
-				free(seqHeader);
-				seqHeader = NULL;
+				int64_t wait_us = clock_base_us + item->ts_us - now_us;
+				usleep(wait_us > 100 * 1000 ? 100 * 1000 : wait_us);
+				continue;
 			}
 		}
+
+		frame.data[0] = (void *)item->packet->data;
+		frame.data_size[0] = item->packet->size;
+		vp_codec_set_input(context, &frame, eos);
+		if (log_ctrl_level_get(NULL) == LOG_TRACE) {
+			print_avpacket_info(item->packet);
+			vp_codec_print_media_codec_output_buffer_info(&frame);
+		}
+		vp_demux_packet_free(item);
+		item = NULL;
+		fed_count++;
 	}
 
 	if (eos)
 	{
-		frame.data[0] = (void *)seqHeader;
-		frame.data_size[0] = seqHeaderSize;
+		frame.data[0] = NULL;
+		frame.data_size[0] = 0;
 		vp_codec_set_input(context, &frame, eos);
 	}
 
-	if (seqHeader)
+	vp_demux_packet_free(item);
+	if (demuxer.queue.psCells != NULL)
 	{
-		free(seqHeader);
-		seqHeader = NULL;
+		// 解封装线程出错时会自己退出，mThreadStop 同样会回收
+		mThreadStop(&demuxer.thread);
+		while (mQueueDequeueTimed(&demuxer.queue, 0, (void**)&item) == E_QUEUE_OK)
+			vp_demux_packet_free(item);
+		mQueueDestroy(&demuxer.queue);
 	}
 
-err_av_open:
-	if (avContext)
-		avformat_close_input(&avContext);
 exit:
+	free(frame.buffer_info);
+	free(frame.frame_buffer);
 	mThreadFinish(privThread);
 	return NULL;
 }
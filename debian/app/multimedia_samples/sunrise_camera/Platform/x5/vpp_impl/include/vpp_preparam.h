@@ -4,8 +4,28 @@
 #include "vp_wrap.h"
 #include "bpu_wrap.h"
 
+// 零拷贝送给 bpu 的 vse 输出图像
+// bpu 推理完成、引用计数归零后才调用 releaseframe 把 buffer 还给 vse
+typedef struct {
+	bpu_frame_ref_t ref; // 必须是第一个成员
+	int32_t in_use; // 从 getframe 到 releaseframe 完成之前不能复用
+	vp_vflow_contex_t *vp_vflow_contex;
+	int32_t ochn_id;
+	hbn_vnode_image_t image;
+	ImageFrame frame; // frame.hbn_vnode_image 指向 image
+} vpp_vse_frame_ref_t;
+
+// bpu 最多持有 BPU_ZERO_COPY_MAX_HOLD 个，再加上正在获取的一个
+#define VPP_VSE_FRAME_REF_NUM (BPU_ZERO_COPY_MAX_HOLD + 1)
+
 void* vpp_osd_set_timestamp_thread(void *ptr);
 
+void vpp_vse_frame_ref_init(vpp_vse_frame_ref_t *frame_refs, int32_t count,
+	vp_vflow_contex_t *vp_vflow_contex, int32_t ochn_id);
+vpp_vse_frame_ref_t *vpp_vse_frame_ref_get_frame(vpp_vse_frame_ref_t *frame_refs, int32_t count,
+	int32_t *ret);
+int32_t vpp_vse_frame_ref_wait_idle(vpp_vse_frame_ref_t *frame_refs, int32_t count, int32_t timeout_ms);
+
 void vpp_graphic_buf_to_bpu_buffer_info(const hbn_vnode_image_t *src, bpu_buffer_info_t *dst);
 void vpp_video_frame_buffer_info_to_bpu_buffer_info(const mc_video_frame_buffer_info_t *src,
 	bpu_buffer_info_t *dst);
@@ -34,6 +34,7 @@
 #include "vpp_box_impl.h"
 
 #define VPP_BOX_MAX_CHANNELS 8
+#define VPP_BOX_REPORT_INTERVAL_US (10 * 1000000LL)
 
 typedef struct
 {
@@ -55,6 +56,8 @@ typedef struct
 	tsThread 		m_venc_thread; /* 图像编码、输出给vo、算法图像前处理 */
 	tsThread 		m_vdec_thread; /* 读取h264视频文件解码 */
 	tsThread		m_bpu_thread;
+	/* bpu 零拷贝持有的 vse 图像，bpu 线程可能在编码线程退出后才归还，所以不能放在线程栈上 */
+	vpp_vse_frame_ref_t	m_vse_frame_refs[VPP_VSE_FRAME_REF_NUM];
 } vpp_box_t;
 
 static vpp_box_t g_vpp_box[VPP_BOX_MAX_CHANNELS];
@@ -87,8 +90,14 @@ static void vpp_box_push_stream(vpp_box_t *vpp_box, ImageFrame *stream, int pipl
 	info.framerate	= frame_rate;
 	info.width		= vpp_box->m_encode_context.video_enc_params.width;
 	info.height		= vpp_box->m_encode_context.video_enc_params.height;
-
-	shm_stream_put(vpp_box->venc_shm, info, (unsigned char*)buffer->vstream_buf.vir_ptr, buffer->vstream_buf.size);
+	info.capture_ns	= 0;
+
+	// H264/H265 在写端解析一次 NALU 索引，读端不再重复解析
+	if (codec_type == MEDIA_CODEC_ID_H264 || codec_type == MEDIA_CODEC_ID_H265)
+		shm_stream_put_annexb(vpp_box->venc_shm, info, (unsigned char*)buffer->vstream_buf.vir_ptr, buffer->vstream_buf.size,
+			codec_type == MEDIA_CODEC_ID_H265);
+	else
+		shm_stream_put(vpp_box->venc_shm, info, (unsigned char*)buffer->vstream_buf.vir_ptr, buffer->vstream_buf.size);
 }
 
 static int32_t alloc_graphic_buffer(hbn_vnode_image_t *img, int w, int h, int32_t format)
@@ -114,6 +123,28 @@ static int32_t alloc_graphic_buffer(hbn_vnode_image_t *img, int w, int h, int32_
 	return 0;
 }
 
+static int64_t vpp_box_time_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 定时打印解码器实际的出图帧率
+static void vpp_box_decode_report(vpp_box_t *vpp_box, uint32_t *decoded_count, int64_t *last_report_us)
+{
+	int64_t now_us = vpp_box_time_us();
+	int64_t elapsed_us = now_us - *last_report_us;
+
+	if (elapsed_us < VPP_BOX_REPORT_INTERVAL_US)
+		return;
+
+	SC_LOGI("channel %d decode: %.1f fps (%s mode)", vpp_box->pipline_id,
+		*decoded_count * 1000000.0 / elapsed_us,
+		vpp_box->m_decode_param.decode_mode == VP_DECODE_MODE_FAST ? "fast" : "realtime");
+	*decoded_count = 0;
+	*last_report_us = now_us;
+}
 
 // 从解码器获取输出图像，然后送进vse模块
 // 从 vse 的第一个通道里面获取编码图像，然后送进编码器
@@ -131,8 +162,15 @@ static void *get_decode_output_thread(void *ptr) {
 
 	media_codec_buffer_t *decode_frame_buffer = NULL;
 	bpu_buffer_info_t bpu_input_buffer = {0};
+	vpp_vse_frame_ref_t *frame_ref = NULL;
 
 	vpp_box_t *vpp_box = (vpp_box_t *)privThread->pvThreadData;
+	// bpu 零拷贝使用 vse 第二通道的 buffer，推理完成后才归还给 vse
+	vpp_vse_frame_ref_t *frame_refs = vpp_box->m_vse_frame_refs;
+	uint32_t decoded_count = 0;
+	int64_t last_report_us = vpp_box_time_us();
+
+	vpp_vse_frame_ref_init(frame_refs, VPP_VSE_FRAME_REF_NUM, &vpp_box->vp_vflow_contex, 1);
 
 	if (vp_allocate_image_frame(&decode_frame) == NULL) {
 		SC_LOGE("vp_allocate_image_frame for decode_frame failed, so exit program.");
@@ -166,11 +204,13 @@ static void *get_decode_output_thread(void *ptr) {
 	char nv12_file_name[128];
 
 	while (privThread->eState == E_THREAD_RUNNING) {
+		vpp_box_decode_report(vpp_box, &decoded_count, &last_report_us);
 		ret = vp_codec_get_output(&vpp_box->m_decode_context, &decode_frame, VP_GET_FRAME_TIMEOUT);
 		if (ret != 0) {
 			usleep(30 * 1000);
 			continue;
 		}
+		decoded_count++;
 
 		// 把解码后的数据送进vse模块，出两路图像
 		decode_frame_buffer = (media_codec_buffer_t *)decode_frame.frame_buffer;
@@ -212,8 +252,8 @@ static void *get_decode_output_thread(void *ptr) {
 		// 编码推流的时间一般比较短，而且时间固定，但是算法的运算时间与模型的选择强相关，并且模型的运行时异步进行的，所以先处理算法
 		// 从第二通道获取数据给编码模块使用
 		if (strlen(vpp_box->m_bpu_handle.m_model_name) > 0) {
-			ret = vp_vse_get_frame(&vpp_box->vp_vflow_contex, 1, &vse_frame);
-			if (ret != 0) {
+			frame_ref = vpp_vse_frame_ref_get_frame(frame_refs, VPP_VSE_FRAME_REF_NUM, &ret);
+			if (frame_ref == NULL) {
 				// 当线程接收到退出信号时，getframe 接口会立即报超时退出
 				// 所以只有当线程是正常运行状态下的异常才属于真异常
 				if (privThread->eState == E_THREAD_RUNNING) {
@@ -224,25 +264,27 @@ static void *get_decode_output_thread(void *ptr) {
 
 			if (log_ctrl_level_get(NULL) == LOG_TRACE) {
 				sprintf(nv12_file_name, "/tmp/box_vse_chn1_%dx%d_nv12_size_%lu.yuv",
-					vse_frame.hbn_vnode_image->buffer.width, vse_frame.hbn_vnode_image->buffer.height,
-					vse_frame.hbn_vnode_image->buffer.size[0] + vse_frame.hbn_vnode_image->buffer.size[1]);
+					frame_ref->image.buffer.width, frame_ref->image.buffer.height,
+					frame_ref->image.buffer.size[0] + frame_ref->image.buffer.size[1]);
 				vp_dump_yuv_to_file(nv12_file_name,
-					vse_frame.hbn_vnode_image->buffer.virt_addr[0],
-					vse_frame.hbn_vnode_image->buffer.size[0] + vse_frame.hbn_vnode_image->buffer.size[1]);
+					frame_ref->image.buffer.virt_addr[0],
+					frame_ref->image.buffer.size[0] + frame_ref->image.buffer.size[1]);
 			}
 			// 把yuv数据送进bpu进行算法运算
 			// SC_LOGW("+++++++++++++++++++ VSE 0-1 +++++++++++++++++++++++");
-			// vp_vin_print_hbn_vnode_image_t(vse_frame.hbn_vnode_image);
+			// vp_vin_print_hbn_vnode_image_t(&frame_ref->image);
 			memset(&bpu_input_buffer, 0, sizeof(bpu_buffer_info_t));
-			vpp_graphic_buf_to_bpu_buffer_info(vse_frame.hbn_vnode_image,
+			vpp_graphic_buf_to_bpu_buffer_info(&frame_ref->image,
 				&bpu_input_buffer);
 			// 这个地方一定要设置，从vse 获取的图像的时间戳在 tv 里面，如果是sensor出来的图像，时间戳在 timestamps 里面
 			bpu_input_buffer.tv = src_img.info.tv;
+			bpu_input_buffer.ref = &frame_ref->ref;
 			// print_bpu_buffer_info(&bpu_input_buffer);
 
 			bpu_wrap_send_frame(&vpp_box->m_bpu_handle, &bpu_input_buffer);
 
-			vp_vse_release_frame(&vpp_box->vp_vflow_contex, 1, &vse_frame);
+			// 释放本线程的引用，bpu 没有持有这帧图像时会直接 releaseframe
+			bpu_frame_ref_put(&frame_ref->ref);
 		}
 
 		// 从第一通道获取数据给编码模块使用
@@ -301,6 +343,10 @@ static void *get_decode_output_thread(void *ptr) {
 
 		// usleep(10 * 1000);
 	}
+	// 还没推理的图像直接丢弃，正在推理的由 vpp_box_stop 停止 bpu 线程时归还给 vse
+	if (strlen(vpp_box->m_bpu_handle.m_model_name) > 0)
+		bpu_wrap_flush_input(&vpp_box->m_bpu_handle);
+
 	vp_free_image_frame(&decode_frame);
 	vp_free_image_frame(&vse_frame);
 	vp_free_image_frame(&encode_frame);
@@ -334,6 +380,8 @@ int32_t vpp_box_init_param(void)
 		cfg_box_vpp = &g_solution_config.box_solution.box_vpp[i];
 		strncpy(vpp_box->m_stream_path, cfg_box_vpp->stream,
 				sizeof(vpp_box->m_stream_path) - 1);
+		vpp_box->m_decode_param.decode_mode = cfg_box_vpp->decode_mode;
+		vpp_box->m_decode_param.frame_rate = cfg_box_vpp->decode_frame_rate;
 
 		// 配置算法模型
 		if (strlen(cfg_box_vpp->model) > 1 && strcmp(cfg_box_vpp->model, "null") != 0) {
@@ -558,7 +606,7 @@ int32_t vpp_box_start(void)
 			g_vpp_box[i].venc_shm = shm_stream_create(shm_id, shm_name,
 					STREAM_MAX_USER, venc_chn_info.suggest_buffer_item_count,
 					venc_chn_info.suggest_buffer_region_size,
-					SHM_STREAM_WRITE, SHM_STREAM_MALLOC);
+					SHM_STREAM_WRITE_SPMC, SHM_STREAM_MALLOC);
 
 			SC_LOGI("video_stream_create => shm_id: %s, shm_name: %s, max user: %d, framerate: %d, stream_buf_size: %d bitrate:%d region size:%d, item count %d.",
 				shm_id, shm_name, STREAM_MAX_USER,
@@ -650,6 +698,14 @@ int32_t vpp_box_stop(void)
 			shm_stream_destory(g_vpp_box[i].venc_shm);
 			g_vpp_box[i].venc_shm = NULL;
 		}
+
+		if (strlen(g_vpp_box[i].m_bpu_handle.m_model_name) == 0)
+			continue;
+		// 推理线程可能还持有 vse 的图像，要在停止 vse 之前停掉 bpu，等它把图像都还回去
+		ret = bpu_wrap_stop(&g_vpp_box[i].m_bpu_handle);
+		if (ret != 0)
+			SC_LOGE("bpu_wrap_stop failed");
+		vpp_vse_frame_ref_wait_idle(g_vpp_box[i].m_vse_frame_refs, VPP_VSE_FRAME_REF_NUM, 1000);
 	}
 
 	for (i = 0; i < VPP_BOX_MAX_CHANNELS; i++) {
@@ -680,15 +736,6 @@ int32_t vpp_box_stop(void)
 		ret = vp_vflow_stop(vp_vflow_contex);
 		ret |= vp_vse_stop(vp_vflow_contex);
 		SC_ERR_CON_EQ(ret, 0, "vp_vflow_stop or vp_vse_stop failed");
-
-		if (strlen(g_vpp_box[i].m_bpu_handle.m_model_name) == 0)
-			continue;
-		// mThreadStop(&g_vpp_box[i].m_bpu_thread);
-		ret = bpu_wrap_stop(&g_vpp_box[i].m_bpu_handle);
-		if (ret != 0) {
-			SC_LOGE("bpu_wrap_start failed");
-			return -1;
-		}
 	}
 
 	return 0;
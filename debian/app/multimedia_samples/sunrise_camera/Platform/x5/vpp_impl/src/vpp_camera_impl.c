@@ -24,6 +24,7 @@
 #include "utils/mthread.h"
 #include "utils/mqueue.h"
 #include "utils/time_utils.h"
+#include "utils/latency_stats.h"
 
 #include "bpu_wrap.h"
 #include "vp_wrap.h"
@@ -41,6 +42,72 @@
 
 #define VPP_CAM_MAX_CHANNELS 32
 
+// 同时送进编码器、还没有拿到码流的图像个数
+// 编码器直接读 vse 的 buffer(external_frame_buf)，vse 每个通道只有 3 个 buffer，至少留一个给 vse 出图
+#ifndef VPP_VENC_INFLIGHT_DEPTH
+#define VPP_VENC_INFLIGHT_DEPTH 2
+#endif
+#define VPP_VENC_MAX_INFLIGHT 8
+
+// 编码器利用率和编码延时的打印间隔
+#define VPP_VENC_REPORT_INTERVAL_US (10 * 1000000LL)
+
+// 最多同时借给共享内存读端的码流 buffer 个数，编码器一共 5 个(bitstream_buf_count)，至少留两个继续出码流
+// 借满之后的码流退回到拷贝写入，读端慢不会卡住编码器
+#ifndef VPP_VENC_EXTERNAL_MAX
+#define VPP_VENC_EXTERNAL_MAX 3
+#endif
+// 停止时读端还在使用借出的码流 buffer，每等这么久打印一次
+#define VPP_VENC_EXTERNAL_WARN_MS 1000
+
+// 已经送进编码器的图像，拿到对应的码流后才能还给 vse
+typedef struct
+{
+	hbn_vnode_image_t *hbn_vnode_image;
+	uint64_t pts;			// 和编码器输出码流的 pts 对应
+	int64_t queue_time_us;	// 送进编码器的时间
+} venc_inflight_t;
+
+// 在队列里流转的 vse 图像，带上从 vse 拿到图像的时间，用来统计采集到推流的延时
+// hbn_vnode_image 必须是第一个成员，队列里传的是 hbn_vnode_image 的地址
+typedef struct
+{
+	hbn_vnode_image_t hbn_vnode_image;
+	uint64_t capture_ns;
+} vpp_vse_image_t;
+
+typedef enum
+{
+	VENC_EXTERNAL_FREE = 0,
+	VENC_EXTERNAL_LENT,			// 已经交给共享内存
+	VENC_EXTERNAL_RETURNED,		// 读端用完了，等输出线程还给编码器
+} venc_external_state_e;
+
+// 借给共享内存读端的码流 buffer
+// 读端用完时只标记，由输出线程还给编码器，编码器接口只在输出线程里调用
+typedef struct
+{
+	media_codec_buffer_t	buffer;
+	int32_t					state;
+} venc_external_t;
+
+typedef struct
+{
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;		// 有图像编码完成
+	int32_t			depth;		// 允许同时在编码的图像个数
+	int32_t			head;
+	int32_t			count;
+	venc_inflight_t	frames[VPP_VENC_MAX_INFLIGHT];
+
+	// 统计，输出线程定时打印
+	int64_t			busy_start_us;	// count 从 0 变成 1 的时间
+	int64_t			busy_us;		// 编码器里有图像的总时间
+	int64_t			latency_sum_us;
+	int64_t			latency_max_us;
+	uint32_t		frames_done;
+} venc_pipeline_t;
+
 typedef struct
 {
 	int pipline_id;
@@ -53,17 +120,88 @@ typedef struct
 
 	shm_stream_t 	*venc_shm; /* H264 H265 码流，最大可能是32路 */
 	tsThread 		m_vse_thread; /* 从vse获取图像，送入编码 */
+	tsThread 		m_venc_input_thread; /* 把vse图像送进编码器，不等待码流 */
 	tsThread 		m_venc_thread; /*从编码器获取图像，送入共享内存 */
+	venc_pipeline_t	m_venc_pipeline; /* 已经送进编码器还没有出码流的图像 */
+	venc_external_t	m_venc_external[VPP_VENC_EXTERNAL_MAX]; /* 借给共享内存读端的码流 buffer */
 	tsQueue			m_vse_to_enc_queue;
 	tsQueue			m_enc_to_vse_queue;
 
 	tsThread		m_bpu_thread;
+	/* bpu 零拷贝持有的 vse 图像，bpu 线程可能在 m_bpu_thread 退出后才归还，所以不能放在线程栈上 */
+	vpp_vse_frame_ref_t	m_vse_frame_refs[VPP_VSE_FRAME_REF_NUM];
 } vpp_camera_t;
 
 static vp_drm_context_t g_drm_context;
 static vpp_camera_t g_vpp_camera[VPP_CAM_MAX_CHANNELS];
 
-static void vpp_camera_push_stream(vpp_camera_t *vpp_camera, ImageFrame *stream)
+// 各阶段耗时统计，所有通道共用
+static int32_t g_stage_vse_get = -1;		// 等待 vse 出图
+static int32_t g_stage_encode = -1;			// 送进编码器到出码流
+static int32_t g_stage_shm_put = -1;		// 码流写入共享内存
+static int32_t g_stage_capture_to_shm = -1;	// vse 出图到码流写入共享内存
+
+// 共享内存最后一个读端用完码流 buffer，在读端线程或者写端线程里调用
+static void venc_external_release(void *opaque, unsigned char *data)
+{
+	venc_external_t *external = (venc_external_t *)opaque;
+
+	(void)data;
+	__atomic_store_n(&external->state, VENC_EXTERNAL_RETURNED, __ATOMIC_RELEASE);
+}
+
+// 把读端用完的码流 buffer 还给编码器，返回还在借出的个数，只在输出线程(或者输出线程退出后)调用
+static int32_t venc_external_recycle(vpp_camera_t *vpp_camera)
+{
+	venc_external_t *external;
+	ImageFrame stream = {0};
+	int32_t i, lent = 0;
+
+	for (i = 0; i < VPP_VENC_EXTERNAL_MAX; i++) {
+		external = &vpp_camera->m_venc_external[i];
+		switch (__atomic_load_n(&external->state, __ATOMIC_ACQUIRE)) {
+		case VENC_EXTERNAL_RETURNED:
+			stream.frame_buffer = &external->buffer;
+			if (vp_codec_release_output(&vpp_camera->m_encode_context, &stream) != 0)
+				SC_LOGE("channel %d release lent stream buffer failed.", vpp_camera->pipline_id);
+			external->state = VENC_EXTERNAL_FREE;
+			break;
+		case VENC_EXTERNAL_LENT:
+			lent++;
+			break;
+		default:
+			break;
+		}
+	}
+	return lent;
+}
+
+/**
+ * 停止时收回借出的码流 buffer，全部还给编码器之后才能返回
+ * 销毁写端时没有读端正在使用的 buffer 立即归还，读端正在使用的要等读端 post 之后归还，不能按超时强制收回
+*/
+static void venc_external_drain(vpp_camera_t *vpp_camera)
+{
+	int32_t waited_ms = 0, lent;
+
+	if (vpp_camera->venc_shm != NULL) {
+		shm_stream_destory(vpp_camera->venc_shm);
+		vpp_camera->venc_shm = NULL;
+	}
+	while ((lent = venc_external_recycle(vpp_camera)) > 0) {
+		if (waited_ms > 0 && waited_ms % VPP_VENC_EXTERNAL_WARN_MS == 0)
+			SC_LOGW("channel %d %d stream buffers still used by readers, waited %d ms.",
+				vpp_camera->pipline_id, lent, waited_ms);
+		usleep(1000);
+		waited_ms++;
+	}
+}
+
+/**
+ * 码流写入共享内存，返回 1 表示码流 buffer 已经借给共享内存，调用者不能再还给编码器
+ * H264/H265 优先借出编码器的 buffer，不拷贝；借出的个数到上限、没有读端或者其他编码格式时拷贝
+ */
+static int32_t vpp_camera_push_stream(vpp_camera_t *vpp_camera, ImageFrame *stream, uint64_t capture_ns)
 {
 	int32_t frame_rate = 0;
 	int32_t venc_ist_id = 0;
@@ -71,10 +209,12 @@ static void vpp_camera_push_stream(vpp_camera_t *vpp_camera, ImageFrame *stream)
 	media_codec_context_t *codec_context = &vpp_camera->m_encode_context;
 
 	media_codec_buffer_t *buffer = NULL;
+	venc_external_t *external = NULL;
+	int32_t i, lent = 0;
 
 	if(codec_context == NULL || stream == NULL) {
 		SC_LOGE("Param is NULL");
-		return;
+		return 0;
 	}
 
 	venc_ist_id = codec_context->instance_index;
@@ -93,9 +233,38 @@ static void vpp_camera_push_stream(vpp_camera_t *vpp_camera, ImageFrame *stream)
 	info.framerate	= frame_rate;
 	info.width		= vpp_camera->m_encode_context.video_enc_params.width;
 	info.height		= vpp_camera->m_encode_context.video_enc_params.height;
+	info.capture_ns	= capture_ns;
 
 	// SC_LOGI("codec put size %lld", buffer->vstream_buf.size);
-	shm_stream_put(vpp_camera->venc_shm, info, (unsigned char*)buffer->vstream_buf.vir_ptr, buffer->vstream_buf.size);
+	uint64_t put_start_ns = get_monotonic_ns();
+	// H264/H265 在写端解析一次 NALU 索引，读端不再重复解析
+	if (codec_type == MEDIA_CODEC_ID_H264 || codec_type == MEDIA_CODEC_ID_H265) {
+		for (i = 0; i < VPP_VENC_EXTERNAL_MAX; i++) {
+			if (vpp_camera->m_venc_external[i].state == VENC_EXTERNAL_FREE) {
+				external = &vpp_camera->m_venc_external[i];
+				break;
+			}
+		}
+		if (external != NULL) {
+			memcpy(&external->buffer, buffer, sizeof(media_codec_buffer_t));
+			external->state = VENC_EXTERNAL_LENT;
+			if (shm_stream_put_external_annexb(vpp_camera->venc_shm, info, (unsigned char*)buffer->vstream_buf.vir_ptr,
+				buffer->vstream_buf.size, codec_type == MEDIA_CODEC_ID_H265, venc_external_release, external) == 0) {
+				lent = 1;
+			} else {
+				external->state = VENC_EXTERNAL_FREE;
+			}
+		} else {
+			shm_stream_put_annexb(vpp_camera->venc_shm, info, (unsigned char*)buffer->vstream_buf.vir_ptr, buffer->vstream_buf.size,
+				codec_type == MEDIA_CODEC_ID_H265);
+		}
+	} else {
+		shm_stream_put(vpp_camera->venc_shm, info, (unsigned char*)buffer->vstream_buf.vir_ptr, buffer->vstream_buf.size);
+	}
+	latency_stats_record_since(g_stage_shm_put, put_start_ns);
+	if (capture_ns != 0)
+		latency_stats_record_since(g_stage_capture_to_shm, capture_ns);
+	return lent;
 }
 static void update_osd_info(vp_vflow_contex_t* vp_vflow_contex, uint64_t *next_update_time_ms){
 	uint64_t current_time_ms = get_timestamp_ms();
@@ -107,24 +276,119 @@ static void update_osd_info(vp_vflow_contex_t* vp_vflow_contex, uint64_t *next_u
 		*next_update_time_ms = (current_time_ms / 1000) * 1000 + 1000;
 	}
 }
-static void* venc_get_stream_proc(void *ptr)
+static int64_t venc_time_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec) * 1000000 + (ts.tv_nsec / 1000);
+}
+
+static void venc_pipeline_init(venc_pipeline_t *pipeline, int32_t depth)
+{
+	memset(pipeline, 0, sizeof(venc_pipeline_t));
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+	if (depth < 1)
+		depth = 1;
+	if (depth > VPP_VENC_MAX_INFLIGHT)
+		depth = VPP_VENC_MAX_INFLIGHT;
+	pipeline->depth = depth;
+}
+
+static void venc_pipeline_deinit(venc_pipeline_t *pipeline)
+{
+	pthread_mutex_destroy(&pipeline->mutex);
+	pthread_cond_destroy(&pipeline->cond);
+}
+
+// 编码完成一帧，或者退出时清理，调用者持有锁
+static hbn_vnode_image_t *venc_pipeline_pop_locked(venc_pipeline_t *pipeline, int64_t now_us)
+{
+	venc_inflight_t *frame = &pipeline->frames[pipeline->head];
+	int64_t latency_us = now_us - frame->queue_time_us;
+
+	pipeline->head = (pipeline->head + 1) % VPP_VENC_MAX_INFLIGHT;
+	pipeline->count--;
+	if (pipeline->count == 0)
+		pipeline->busy_us += now_us - pipeline->busy_start_us;
+
+	latency_stats_record(g_stage_encode, (uint64_t)latency_us * 1000);
+	pipeline->latency_sum_us += latency_us;
+	if (latency_us > pipeline->latency_max_us)
+		pipeline->latency_max_us = latency_us;
+	pipeline->frames_done++;
+
+	pthread_cond_broadcast(&pipeline->cond);
+	return frame->hbn_vnode_image;
+}
+
+// 编码器用完VnodeBuffer,就归还给 VSE
+static int32_t venc_return_vse_frame(vpp_camera_t *vpp_camera, hbn_vnode_image_t *hbn_vnode_image)
+{
+	ImageFrame vse_frame = {0};
+	int32_t ret = 0;
+
+	vse_frame.hbn_vnode_image = hbn_vnode_image;
+	ret = vp_vse_release_frame(&vpp_camera->vp_vflow_contex, 0, &vse_frame);
+	if (ret != 0)
+		SC_LOGE("vp_vse_release_frame failed.");
+
+	if (mQueueEnqueueEx(&vpp_camera->m_enc_to_vse_queue, hbn_vnode_image) != E_QUEUE_OK) {
+		// 队列长度和 hbn_vnode_image 的个数一样，不会满
+		SC_LOGE("channel %d enqueue to enc_to_vse_queue failed", vpp_camera->pipline_id);
+		free(hbn_vnode_image);
+		return -1;
+	}
+	return ret;
+}
+
+// 定时打印编码器利用率(编码器里有图像的时间占比)和每帧从送入到出码流的延时
+static void venc_pipeline_report(vpp_camera_t *vpp_camera, int64_t *last_report_us)
+{
+	venc_pipeline_t *pipeline = &vpp_camera->m_venc_pipeline;
+	int64_t now_us = venc_time_us();
+	int64_t elapsed_us = now_us - *last_report_us;
+
+	if (elapsed_us < VPP_VENC_REPORT_INTERVAL_US)
+		return;
+	*last_report_us = now_us;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	int64_t busy_us = pipeline->busy_us;
+	if (pipeline->count > 0) {
+		busy_us += now_us - pipeline->busy_start_us;
+		pipeline->busy_start_us = now_us;
+	}
+	uint32_t frames = pipeline->frames_done;
+	int64_t latency_avg_us = frames > 0 ? pipeline->latency_sum_us / frames : 0;
+	int64_t latency_max_us = pipeline->latency_max_us;
+	pipeline->busy_us = 0;
+	pipeline->latency_sum_us = 0;
+	pipeline->latency_max_us = 0;
+	pipeline->frames_done = 0;
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	SC_LOGI("channel %d encoder: %.1f fps, utilization %d%%, latency avg %lld us max %lld us, in-flight depth %d",
+		vpp_camera->pipline_id, frames * 1000000.0 / elapsed_us,
+		(int)(busy_us * 100 / elapsed_us),
+		(long long)latency_avg_us, (long long)latency_max_us, pipeline->depth);
+}
+
+// 从 m_vse_to_enc_queue 取出 vse 图像马上送进编码器，不等待码流
+// 编码器里最多同时有 depth 帧，码流由 venc_get_stream_proc 取出
+static void* venc_set_input_proc(void *ptr)
 {
 	int32_t ret = 0;
 	tsThread *privThread = (tsThread*)ptr;
 	vpp_camera_t *vpp_camera = (vpp_camera_t *)privThread->pvThreadData;
+	venc_pipeline_t *pipeline = &vpp_camera->m_venc_pipeline;
+	mThreadSetNameWidthIndex(privThread, __func__, vpp_camera->pipline_id);
 
-	ImageFrame encode_stream = {0};
-	if (vp_allocate_image_frame(&encode_stream) == NULL) {
-		SC_LOGE("vp_allocate_image_frame for encode_stream failed, so exit program.");
-		exit(-1);
-	}
 	teQueueStatus status = E_QUEUE_OK;
 	ImageFrame vse_frame = {0};
 	hbn_vnode_image_t *hbn_vnode_image = NULL;
 
 	int dequeue_enc_count = 0;
-	int enqueue_vse_count = 0;
-	//线程退出时，保证hbn_vnode_image 已经处理完： 放到 m_enc_to_vse_queue
 	while (privThread->eState == E_THREAD_RUNNING){
 		status = mQueueDequeueTimed(&vpp_camera->m_vse_to_enc_queue, 2000, (void **)&hbn_vnode_image);
 		if(status != E_QUEUE_OK){
@@ -133,8 +397,25 @@ static void* venc_get_stream_proc(void *ptr)
 		}
 		dequeue_enc_count++;
 
+		// 等待编码器里有空位
+		pthread_mutex_lock(&pipeline->mutex);
+		while (pipeline->count >= pipeline->depth && privThread->eState == E_THREAD_RUNNING) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 100 * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&pipeline->cond, &pipeline->mutex, &ts);
+		}
+		pthread_mutex_unlock(&pipeline->mutex);
+		if (privThread->eState != E_THREAD_RUNNING)
+			break;
+
 		// 送进编码器
 		vse_frame.hbn_vnode_image = hbn_vnode_image;
+		int64_t queue_time_us = venc_time_us();
 		ret = vp_codec_encoder_set_input(&vpp_camera->m_encode_context, &vse_frame);
 		if(ret != 0){
 			if (privThread->eState == E_THREAD_RUNNING) {
@@ -143,6 +424,67 @@ static void* venc_get_stream_proc(void *ptr)
 			break;
 		}
 
+		// 编码器直接读 vse 的 buffer，出码流之后才能释放
+		pthread_mutex_lock(&pipeline->mutex);
+		venc_inflight_t *frame = &pipeline->frames[(pipeline->head + pipeline->count) % VPP_VENC_MAX_INFLIGHT];
+		frame->hbn_vnode_image = hbn_vnode_image;
+		frame->pts = hbn_vnode_image->info.timestamps / 1000;
+		frame->queue_time_us = queue_time_us;
+		if (pipeline->count == 0)
+			pipeline->busy_start_us = queue_time_us;
+		pipeline->count++;
+		pthread_cond_broadcast(&pipeline->cond);
+		pthread_mutex_unlock(&pipeline->mutex);
+		hbn_vnode_image = NULL;
+	}
+
+	// 没送进编码器的图像还给 vse
+	if (hbn_vnode_image != NULL)
+		venc_return_vse_frame(vpp_camera, hbn_vnode_image);
+	SC_LOGI("channel %d dequeue enc %d.\n", vpp_camera->pipline_id, dequeue_enc_count);
+
+	mThreadFinish(privThread);
+	return NULL;
+}
+
+// 从编码器获取码流送入共享内存，同时把编码完成的 vse 图像还回去
+static void* venc_get_stream_proc(void *ptr)
+{
+	int32_t ret = 0;
+	tsThread *privThread = (tsThread*)ptr;
+	vpp_camera_t *vpp_camera = (vpp_camera_t *)privThread->pvThreadData;
+	venc_pipeline_t *pipeline = &vpp_camera->m_venc_pipeline;
+	mThreadSetNameWidthIndex(privThread, __func__, vpp_camera->pipline_id);
+
+	ImageFrame encode_stream = {0};
+	if (vp_allocate_image_frame(&encode_stream) == NULL) {
+		SC_LOGE("vp_allocate_image_frame for encode_stream failed, so exit program.");
+		exit(-1);
+	}
+	hbn_vnode_image_t *done_images[VPP_VENC_MAX_INFLIGHT];
+	int32_t done_count = 0;
+	int64_t last_report_us = venc_time_us();
+
+	int enqueue_vse_count = 0;
+	while (privThread->eState == E_THREAD_RUNNING){
+		venc_pipeline_report(vpp_camera, &last_report_us);
+
+		// 编码器里没有图像时等输入线程送帧
+		pthread_mutex_lock(&pipeline->mutex);
+		if (pipeline->count == 0) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 100 * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&pipeline->cond, &pipeline->mutex, &ts);
+			pthread_mutex_unlock(&pipeline->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&pipeline->mutex);
+
 		// 从编码器获取码流
 		ret = vp_codec_get_output(&vpp_camera->m_encode_context, &encode_stream, 2000);
 		if(ret != 0){
@@ -152,28 +494,34 @@ static void* venc_get_stream_proc(void *ptr)
 			break;
 		}
 
-		// 编码器用完VSE的数据 就释放
-		ret = vp_vse_release_frame(&vpp_camera->vp_vflow_contex, 0, &vse_frame);
-		if (ret != 0) {
-			SC_LOGE("vp_vse_release_frame failed.");
-			break;
-		}
-
-		// 编码器用完VnodeBuffer,就归还给 VSE
-		while(privThread->eState == E_THREAD_RUNNING){
-			status = mQueueEnqueueEx(&vpp_camera->m_enc_to_vse_queue, hbn_vnode_image);
-			if (status != E_QUEUE_OK){
-				SC_LOGE("channel %d enqueue from enc_to_vse_queue failed:%d\n", vpp_camera->pipline_id ,status);
-				sleep(1);
-				continue;
+		// 编码器不支持 B 帧，码流按送入顺序输出，这一帧以及更早送入的图像都已经用完
+		// 编码器跳帧时更早的图像没有码流，按 pts 找到对应的图像一起释放
+		int64_t now_us = venc_time_us();
+		uint64_t pts = ((media_codec_buffer_t *)encode_stream.frame_buffer)->vstream_buf.pts;
+		pthread_mutex_lock(&pipeline->mutex);
+		int32_t n = 1;
+		for (int32_t k = 0; k < pipeline->count; k++) {
+			if (pipeline->frames[(pipeline->head + k) % VPP_VENC_MAX_INFLIGHT].pts == pts) {
+				n = k + 1;
+				break;
 			}
-			hbn_vnode_image = NULL;
+		}
+		done_count = 0;
+		while (n-- > 0 && pipeline->count > 0)
+			done_images[done_count++] = venc_pipeline_pop_locked(pipeline, now_us);
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		// 图像还给 vse 之后会被重新填写，先取出这一帧的出图时间
+		uint64_t capture_ns = done_count > 0 ? ((vpp_vse_image_t *)done_images[done_count - 1])->capture_ns : 0;
+		for (int32_t k = 0; k < done_count; k++) {
+			venc_return_vse_frame(vpp_camera, done_images[k]);
 			enqueue_vse_count++;
-			break;
 		}
 
-
-		vpp_camera_push_stream(vpp_camera, &encode_stream);
+		// 先把读端用完的码流 buffer 还给编码器，再借出新的
+		venc_external_recycle(vpp_camera);
+		if (vpp_camera_push_stream(vpp_camera, &encode_stream, capture_ns))
+			continue;
 		ret = vp_codec_release_output(&vpp_camera->m_encode_context, &encode_stream);
 		if (ret != 0) {
 			SC_LOGE("vp_codec_release_output failed.");
@@ -181,14 +529,17 @@ static void* venc_get_stream_proc(void *ptr)
 		}
 	}
 
-	int free_dissociate_count = 0;
-	if(hbn_vnode_image != NULL){
-		free(hbn_vnode_image);
-		free_dissociate_count = 1;
+	// 输入线程已经先退出了，还在编码器里的图像直接还给 vse
+	pthread_mutex_lock(&pipeline->mutex);
+	done_count = 0;
+	while (pipeline->count > 0)
+		done_images[done_count++] = venc_pipeline_pop_locked(pipeline, venc_time_us());
+	pthread_mutex_unlock(&pipeline->mutex);
+	for (int32_t k = 0; k < done_count; k++) {
+		venc_return_vse_frame(vpp_camera, done_images[k]);
+		enqueue_vse_count++;
 	}
-	SC_LOGI("channel %d dequeue enc %d = enqueue vse %d + free_dissociate_count %d.\n",
-		vpp_camera->pipline_id , dequeue_enc_count, enqueue_vse_count, free_dissociate_count);
-
+	SC_LOGI("channel %d enqueue vse %d.\n", vpp_camera->pipline_id, enqueue_vse_count);
 
 	vp_free_image_frame(&encode_stream);
 	mThreadFinish(privThread);
@@ -211,13 +562,12 @@ static void* vse_get_stream_proc(void *ptr)
 	hbn_vnode_image_t *hbn_vnode_image = NULL;
 
 	uint64_t next_update_time_ms = ((get_timestamp_ms() + 999) / 1000) * 1000;
-	struct TimeStatistics time_statistics;
+	uint64_t get_start_ns = 0;
 
 	int dequeue_vse_count = 0;
 	int enqueue_enc_count = 0;
 
 	while (privThread->eState == E_THREAD_RUNNING){
-		time_statistics_at_beginning_of_loop(&time_statistics);
 		status = mQueueDequeueTimed(&vpp_camera->m_enc_to_vse_queue, 2000, (void **)&hbn_vnode_image);
 		if (status != E_QUEUE_OK){
 			SC_LOGW("channel %d dequeue from enc_to_vse_queue failed:%d\n", vpp_camera->pipline_id ,status);
@@ -226,6 +576,7 @@ static void* vse_get_stream_proc(void *ptr)
 		dequeue_vse_count++;
 
 		vse_frame.hbn_vnode_image = hbn_vnode_image;
+		get_start_ns = get_monotonic_ns();
 		ret = vp_vse_get_frame(&vpp_camera->vp_vflow_contex, 0, &vse_frame);
 		if (ret != 0) {
 			// 当线程接收到退出信号时，getframe 接口会立即报超时退出
@@ -235,6 +586,8 @@ static void* vse_get_stream_proc(void *ptr)
 			}
 			break;
 		}
+		((vpp_vse_image_t *)hbn_vnode_image)->capture_ns = get_monotonic_ns();
+		latency_stats_record(g_stage_vse_get, ((vpp_vse_image_t *)hbn_vnode_image)->capture_ns - get_start_ns);
 		while(privThread->eState == E_THREAD_RUNNING){
 			status = mQueueEnqueueEx(&vpp_camera->m_vse_to_enc_queue, hbn_vnode_image);
 			if (status != E_QUEUE_OK){
@@ -254,9 +607,6 @@ static void* vse_get_stream_proc(void *ptr)
 				SC_LOGW("vp_display_set_frame chn failed(%d).", ret);
 			}
 		}
-
-		time_statistics_at_ending_of_loop(&time_statistics);
-		time_statistics_info_show(&time_statistics, "read_camera", false);
 	}
 	int free_dissociate_count = 0;
 	if(hbn_vnode_image != NULL){
@@ -274,21 +624,19 @@ static void* vse_get_stream_proc(void *ptr)
 static void *send_yuv_to_bpu(void *ptr) {
 	tsThread *privThread = (tsThread*)ptr;
 	int ret = 0;
-	ImageFrame vse_frame = {0};
-	hbn_vnode_image_t *hbn_vnode_image = NULL;
+	vpp_vse_frame_ref_t *frame_ref = NULL;
 	bpu_buffer_info_t bpu_input_buffer;
 
 	vpp_camera_t *vpp_camera = (vpp_camera_t *)privThread->pvThreadData;
+	// bpu 零拷贝使用 vse 的 buffer，推理完成后才归还给 vse
+	vpp_vse_frame_ref_t *frame_refs = vpp_camera->m_vse_frame_refs;
 
-	if (vp_allocate_image_frame(&vse_frame) == NULL) {
-		SC_LOGE("vp_allocate_image_frame for vse_frame failed, so exit program.");
-		exit(-1);
-	};
+	vpp_vse_frame_ref_init(frame_refs, VPP_VSE_FRAME_REF_NUM, &vpp_camera->vp_vflow_contex, 1);
 	mThreadSetNameWidthIndex(privThread, __func__, vpp_camera->pipline_id);
 
 	while(privThread->eState == E_THREAD_RUNNING) {
-		ret = vp_vse_get_frame(&vpp_camera->vp_vflow_contex, 1, &vse_frame);
-		if (ret != 0) {
+		frame_ref = vpp_vse_frame_ref_get_frame(frame_refs, VPP_VSE_FRAME_REF_NUM, &ret);
+		if (frame_ref == NULL) {
 			// 当线程接收到退出信号时，getframe 接口会立即报超时退出
 			// 所以只有当线程是正常运行状态下的异常才属于真异常
 			if (privThread->eState == E_THREAD_RUNNING) {
@@ -297,23 +645,21 @@ static void *send_yuv_to_bpu(void *ptr) {
 			break;
 		}
 
-		hbn_vnode_image = (hbn_vnode_image_t *)vse_frame.hbn_vnode_image;
-		// vp_vin_print_hbn_vnode_image_t(hbn_vnode_image);
+		// vp_vin_print_hbn_vnode_image_t(&frame_ref->image);
 
 		// 把yuv数据送进bpu进行算法运算
 		memset(&bpu_input_buffer, 0, sizeof(bpu_buffer_info_t));
-		vpp_graphic_buf_to_bpu_buffer_info(hbn_vnode_image, &bpu_input_buffer);
+		vpp_graphic_buf_to_bpu_buffer_info(&frame_ref->image, &bpu_input_buffer);
+		bpu_input_buffer.ref = &frame_ref->ref;
 		// print_bpu_buffer_info(&bpu_input_buffer);
 
 		bpu_wrap_send_frame(&vpp_camera->m_bpu_handle, &bpu_input_buffer);
-		ret = vp_vse_release_frame(&vpp_camera->vp_vflow_contex, 1, &vse_frame);
-		if (ret != 0) {
-			SC_LOGE("vp_vse_release_frame failed");
-			break;
-		}
+		// 释放本线程的引用，bpu 没有持有这帧图像时会直接 releaseframe
+		bpu_frame_ref_put(&frame_ref->ref);
 	}
 
-	vp_free_image_frame(&vse_frame);
+	// 还没推理的图像直接丢弃，正在推理的由 vpp_camera_stop 停止 bpu 线程时归还给 vse
+	bpu_wrap_flush_input(&vpp_camera->m_bpu_handle);
 
 	mThreadFinish(privThread);
 	return NULL;
@@ -578,6 +924,11 @@ int32_t vpp_camera_start(void)
 	int32_t i = 0;
 	vp_vflow_contex_t *vp_vflow_contex = NULL;
 
+	g_stage_vse_get = latency_stats_stage("vse_get");
+	g_stage_encode = latency_stats_stage("encode");
+	g_stage_shm_put = latency_stats_stage("shm_put");
+	g_stage_capture_to_shm = latency_stats_stage("capture_to_shm");
+
 	for (i = 0; i < VPP_CAM_MAX_CHANNELS; i++) {
 		if (g_vpp_camera[i].vp_vflow_contex.sensor_config == NULL)
 			continue;
@@ -599,12 +950,12 @@ int32_t vpp_camera_start(void)
 		}
 
 		for (size_t j = 0; j < vse_buffer_count; j++){
-			hbn_vnode_image_t *hbn_vnode_image = (hbn_vnode_image_t *)malloc(sizeof(hbn_vnode_image_t));
+			hbn_vnode_image_t *hbn_vnode_image = (hbn_vnode_image_t *)malloc(sizeof(vpp_vse_image_t));
 			if (hbn_vnode_image == NULL){
 				SC_LOGE("malloc failed\n");
 				exit(-1);
 			}
-			memset(hbn_vnode_image, 0, sizeof(hbn_vnode_image_t));
+			memset(hbn_vnode_image, 0, sizeof(vpp_vse_image_t));
 
 			teQueueStatus status = mQueueEnqueue(&g_vpp_camera[i].m_enc_to_vse_queue, (void *)hbn_vnode_image);
 			if (status != E_QUEUE_OK){
@@ -648,7 +999,7 @@ int32_t vpp_camera_start(void)
 			g_vpp_camera[i].venc_shm = shm_stream_create(shm_id, shm_name,
 					STREAM_MAX_USER, venc_chn_info.suggest_buffer_item_count,
 					venc_chn_info.suggest_buffer_region_size,
-					SHM_STREAM_WRITE, SHM_STREAM_MALLOC);
+					SHM_STREAM_WRITE_SPMC, SHM_STREAM_MALLOC);
 
 			SC_LOGI("video_stream_create => shm_id: %s, shm_name: %s, max user: %d, framerate: %d, stream_buf_size: %d bitrate:%d region size:%d, item count %d.",
 				shm_id, shm_name, STREAM_MAX_USER,
@@ -662,8 +1013,11 @@ int32_t vpp_camera_start(void)
 		g_vpp_camera[i].m_vse_thread.pvThreadData = (void*)&g_vpp_camera[i];
 		mThreadStart(vse_get_stream_proc, &g_vpp_camera[i].m_vse_thread, E_THREAD_JOINABLE);
 
+		venc_pipeline_init(&g_vpp_camera[i].m_venc_pipeline, VPP_VENC_INFLIGHT_DEPTH);
 		g_vpp_camera[i].m_venc_thread.pvThreadData = (void*)&g_vpp_camera[i];
 		mThreadStart(venc_get_stream_proc, &g_vpp_camera[i].m_venc_thread, E_THREAD_JOINABLE);
+		g_vpp_camera[i].m_venc_input_thread.pvThreadData = (void*)&g_vpp_camera[i];
+		mThreadStart(venc_set_input_proc, &g_vpp_camera[i].m_venc_input_thread, E_THREAD_JOINABLE);
 
 		if (strlen(g_vpp_camera[i].m_bpu_handle.m_model_name) == 0)
 			continue;
@@ -698,12 +1052,13 @@ int32_t vpp_camera_stop(void)
 			continue;
 
 		vp_vflow_contex = &g_vpp_camera[i].vp_vflow_contex;
+		// 先停输入线程，输出线程退出时把还在编码器里的图像还给 vse
+		mThreadStop(&g_vpp_camera[i].m_venc_input_thread);
 		mThreadStop(&g_vpp_camera[i].m_venc_thread);
 		mThreadStop(&g_vpp_camera[i].m_vse_thread);
-		if(g_vpp_camera[i].venc_shm != NULL){
-			shm_stream_destory(g_vpp_camera[i].venc_shm);
-			g_vpp_camera[i].venc_shm = NULL;
-		}
+		venc_pipeline_deinit(&g_vpp_camera[i].m_venc_pipeline);
+		// 借给读端的码流 buffer 要在编码器停止之前还回去
+		venc_external_drain(&g_vpp_camera[i]);
 
 		int enc_remain_count = 0;
 		int vse_remain_count = 0;
@@ -738,7 +1093,12 @@ int32_t vpp_camera_stop(void)
 
 		if (strlen(g_vpp_camera[i].m_bpu_handle.m_model_name) == 0)
 			continue;
+		// 推理线程可能还持有 vse 的图像，要在停止 vse 之前停掉 bpu，等它把图像都还回去
 		mThreadStop(&g_vpp_camera[i].m_bpu_thread);
+		ret = bpu_wrap_stop(&g_vpp_camera[i].m_bpu_handle);
+		if (ret != 0)
+			SC_LOGE("bpu_wrap_stop failed");
+		vpp_vse_frame_ref_wait_idle(g_vpp_camera[i].m_vse_frame_refs, VPP_VSE_FRAME_REF_NUM, 1000);
 	}
 
 	for (i = 0; i < VPP_CAM_MAX_CHANNELS; i++) {
@@ -755,14 +1115,6 @@ int32_t vpp_camera_stop(void)
 		ret |= vp_gdc_stop(vp_vflow_contex);
 		ret |= vp_vse_stop(vp_vflow_contex);
 		SC_ERR_CON_EQ(ret, 0, "vpp_camera_stop");
-
-		if (strlen(g_vpp_camera[i].m_bpu_handle.m_model_name) == 0)
-			continue;
-		ret = bpu_wrap_stop(&g_vpp_camera[i].m_bpu_handle);
-		if (ret != 0) {
-			SC_LOGE("bpu_wrap_start failed");
-			return -1;
-		}
 	}
 
 	return ret;
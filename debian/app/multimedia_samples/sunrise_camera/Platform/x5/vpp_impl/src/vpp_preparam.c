@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <string.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -31,6 +32,77 @@ void* vpp_osd_set_timestamp_thread(void *ptr)
 	return NULL;
 }
 
+static void vpp_vse_frame_ref_release(bpu_frame_ref_t *ref)
+{
+	vpp_vse_frame_ref_t *frame_ref = (vpp_vse_frame_ref_t *)ref;
+	int32_t ret = 0;
+
+	ret = vp_vse_release_frame(frame_ref->vp_vflow_contex, frame_ref->ochn_id, &frame_ref->frame);
+	if (ret != 0)
+		SC_LOGE("vp_vse_release_frame chn %d failed(%d)", frame_ref->ochn_id, ret);
+	__atomic_store_n(&frame_ref->in_use, 0, __ATOMIC_RELEASE);
+}
+
+void vpp_vse_frame_ref_init(vpp_vse_frame_ref_t *frame_refs, int32_t count,
+	vp_vflow_contex_t *vp_vflow_contex, int32_t ochn_id)
+{
+	memset(frame_refs, 0, sizeof(vpp_vse_frame_ref_t) * count);
+	for (int i = 0; i < count; i++) {
+		frame_refs[i].ref.release = vpp_vse_frame_ref_release;
+		frame_refs[i].vp_vflow_contex = vp_vflow_contex;
+		frame_refs[i].ochn_id = ochn_id;
+		frame_refs[i].frame.hbn_vnode_image = &frame_refs[i].image;
+	}
+}
+
+// 找一个空闲的 frame_ref 从 vse 获取图像，返回时持有一个引用，用完后调用 bpu_frame_ref_put
+// 获取失败时返回 NULL，ret 为 vp_vse_get_frame 的返回值
+vpp_vse_frame_ref_t *vpp_vse_frame_ref_get_frame(vpp_vse_frame_ref_t *frame_refs, int32_t count,
+	int32_t *ret)
+{
+	vpp_vse_frame_ref_t *frame_ref = NULL;
+
+	for (int i = 0; i < count; i++) {
+		if (__atomic_load_n(&frame_refs[i].in_use, __ATOMIC_ACQUIRE) == 0) {
+			frame_ref = &frame_refs[i];
+			break;
+		}
+	}
+	// bpu 持有的图像个数有上限，正常不会走到这里
+	if (frame_ref == NULL) {
+		*ret = -1;
+		return NULL;
+	}
+
+	*ret = vp_vse_get_frame(frame_ref->vp_vflow_contex, frame_ref->ochn_id, &frame_ref->frame);
+	if (*ret != 0)
+		return NULL;
+
+	frame_ref->in_use = 1;
+	frame_ref->ref.refcnt = 1;
+	return frame_ref;
+}
+
+// 等待 bpu 归还所有图像，返回超时后仍被持有的个数
+// 在 bpu_wrap_stop 之后、停止 vse 之前调用，bpu 线程都已经退出，正常应该返回 0
+int32_t vpp_vse_frame_ref_wait_idle(vpp_vse_frame_ref_t *frame_refs, int32_t count, int32_t timeout_ms)
+{
+	int32_t held = 0;
+
+	for (int i = 0; i < count; i++) {
+		while (__atomic_load_n(&frame_refs[i].in_use, __ATOMIC_ACQUIRE) != 0) {
+			if (timeout_ms <= 0) {
+				SC_LOGE("vse chn %d frame still held by bpu", frame_refs[i].ochn_id);
+				held++;
+				break;
+			}
+			usleep(1000);
+			timeout_ms--;
+		}
+	}
+	return held;
+}
+
 void vpp_graphic_buf_to_bpu_buffer_info(const hbn_vnode_image_t *src, bpu_buffer_info_t *dst)
 {
 	if (!src || !dst) return;
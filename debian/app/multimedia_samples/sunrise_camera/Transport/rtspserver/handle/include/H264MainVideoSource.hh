@@ -3,6 +3,7 @@
 
 #include "FramedSource.hh"
 #include "utils/time_utils.h"
+#include "utils/latency_stats.h"
 #include "utils/stream_manager.h"
 
 /*extern shm_stream_t* 		fH264LiveShmSource;*/
@@ -33,21 +34,25 @@ protected:
 	virtual ~H264MainVideoSource();
 
 	static void incomingDataHandler(H264MainVideoSource* source);
+	static void notifyHandler(H264MainVideoSource* source, int mask);
 	void incomingDataHandler1();
+	void waitForData();
 
 private:
 	// redefined virtual functions:
 	virtual void doGetNextFrame();
+	virtual void doStopGettingFrames();
 
 private:
 	shm_stream_t* 		fShmSource;
+	int					fNotifyFd; // 写端发布新帧时可读，-1 表示回退为轮询
 	unsigned 	fPreferredFrameSize;
 	unsigned 	fPlayTimePerFrame;
 	unsigned 	fLastPlayTime;
 	Boolean  	fLimitNumBytesToStream;
 	u_int64_t 	fNumBytesToStream; // used iff "fLimitNumBytesToStream" is True
 	unsigned long long	fPts;
-	unsigned int		fNaluLen;
+	shm_nalu_iter_t		fNaluIter; // 当前帧的 NALU 索引，由写端在 put 时解析
 	int fBufferRegionSize;
 	int fBufferItemCount;
 
@@ -55,7 +60,8 @@ private:
 	//for debug
 	char fShmName[32];
 	char fShmId[32];
-	struct TimeStatistics fTimeStatistics;
+	int fSendStage;		// 从共享内存取出一个 NALU 交给 RTP 打包的耗时
+	int fCaptureStage;	// 采集到整帧交给 RTP 打包的延时
 };
 
 
@@ -54,9 +54,6 @@ protected:
 					unsigned& rtpTimestamp,
 		   ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
 					void* serverRequestAlternativeByteHandlerClientData);
-	virtual void pauseStream(unsigned /*clientSessionId*/, void* streamToken);
-	virtual void seekStream(unsigned clientSessionId, void* streamToken, double& seekNPT, double streamDuration, u_int64_t& numBytes);
-	virtual void seekStream(unsigned clientSessionId, void* streamToken, char*& absStart, char*& absEnd);
 
 
 protected: // redefined virtual functions
@@ -67,13 +64,12 @@ protected: // redefined virtual functions
 	virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock,
 		unsigned char rtpPayloadTypeIfDynamic,
 		FramedSource* inputSource);
+	virtual void closeStreamSource(FramedSource* inputSource);
 
 private:
-	Boolean fReuseFirstSource;
 	char* fAuxSDPLine;
 	char fDoneFlag; // used when setting up "fAuxSDPLine"
 	RTPSink* fDummyRTPSink; // ditto
-	H265MainVideoSource* fVideoSource;
 	char fShmId[32];
 	char fShmName[32];
 	int fStreamBufSize;
@@ -81,6 +77,9 @@ private:
 	int fBufferRegionSize;
 	int fBufferItemCount;
 	int fDummyVideoSourceCount;
+	int fOutBufferSize; // RTP sink 的发送缓存大小
+	// RTP over TCP 的客户端发送队列满，丢弃视频后请求 I 帧，按码流源索引每个 sink 的请求上下文
+	HashTable* fKeyFrameRequests;
 };
 
 #endif
@@ -64,7 +64,6 @@ private:
 	unsigned fBitsPerSample;
 	unsigned fSamplingFrequencyIndex;
 	unsigned fNumChannels;
-	LPCMAudioSource* fAudioSource;
 };
 
 #endif
@@ -35,7 +35,6 @@ public:
 		u_int8_t bitsPerSample, 
 		u_int8_t samplingFrequencyIndex, 
 		u_int8_t channelConfiguration);
-	PCMAAudioSource* fAudioSource;
 
 protected:
 	PCMAAudioLiveServerMediaSubsession(UsageEnvironment& env, Boolean reuseFirstSource,
@@ -4,29 +4,22 @@
 #include <pthread.h>
 #include "BasicUsageEnvironment.hh"
 #include "RTSPServer.hh"
-#include "H264VideoLiveServerMediaSubsession.hh"
-#include "H265VideoLiveServerMediaSubsession.hh"
-#include "LPCMAudioLiveServerMediaSubsession.hh"
-#include "PCMAAudioLiveServerMediaSubsession.hh"
-#include "utils/cqueue.h"
+#include "RtspSvrWorker.hh"
+#include "rtsp_server_default_param.h"
 
-struct SmsParam{
-	int actionType; //0: 删除， 1:添加
+// 码流所属的工作线程，接收线程按请求 URL 中的码流名把连接转交给对应的工作线程
+struct SmsOwner{
 	char streamName[128];
-	bool audioEnable;
-	int audioType;
-	int audioSampleRate;
-	int audioBitPerSample;
-	int audioChannels;
-	bool videoEnable;
-	int videoType;
-	int videoFrameRate;
-	char shmId[32];
-	char shmName[32];
-	int streamBufSize;
-	int frameRate;
-	int suggest_buffer_item_count;
-	int suggest_buffer_region_size;
+	int worker;
+};
+
+// 接收线程等待客户端第一行请求的连接
+struct PendingConn{
+	int sock;
+	struct sockaddr_in addr;
+	unsigned waitMs;			// 已经等待的时间
+	TaskToken retryTask;
+	class CRtspServer* server;
 };
 
 class CRtspServer
@@ -45,6 +38,14 @@ public:
 		char *shmId, char *shmName, int streamBufSize, int frameRate,
 		int suggest_buffer_region_size, int suggest_buffer_item_count);
 	bool DynamicDelSms(const char* streamName);
+	bool SetCastMode(bool reuseSource, bool multicast, const char* multicastAddr,
+		int multicastPort, int multicastTTL);
+	// 运行 live555 事件循环的工作线程数，0 表示和 CPU 核数相同，需要在 Create 之前设置
+	bool SetWorkerThreads(int workerThreads);
+	// 事件循环使用 EpollTaskScheduler 还是 BasicTaskScheduler(select)，需要在 Create 之前设置
+	bool SetEpoll(bool useEpoll);
+	// RTP over TCP 每个客户端的发送队列大小，需要在 Create 之前设置
+	bool SetTcpSendQueue(int sizeKB);
 	bool DynamicProcessSmsCommonProcess(int actionType, const char*streamName,
 		bool audioEnable, int audioType, int audioSampleRate, int audioBitPerSample,
 		int audioChannels, bool videoEnable, int videoType, int videoFrameRate,
@@ -60,22 +61,44 @@ protected:
 	static void* ThreadRtspServerProcImpl(void* arg);
 	void ThreadRtspServer();
 
-	static void AsyncProcessSms(void *param);
-	static void DynamicDelSmsInternal(CRtspServer *rtsp_server, struct SmsParam *sms_param);
-	static void DynamicAddSmsInternal(CRtspServer *rtsp_server, struct SmsParam *sms_param);
+	static void WakeHandler(void* param, int mask);
+	static void IncomingConnectionHandler(void* param, int mask);
+	static void PendingConnReadable(void* param, int mask);
+	static void PendingConnRetry(void* param);
+	void PeekPendingConn(PendingConn* conn);
+	void ClosePendingConn(PendingConn* conn);
+	int LookupOwner(const char* urlSuffix, bool exact);
+	int AssignOwner(const char* streamName);
+	void RemoveOwner(const char* streamName);
+	static void ReportTcpSendQueue(int socketNum, TCPSendQueueStats const& stats);
 
 private:
 	static  CRtspServer* instance;
 	bool 	m_Stop;
+	portNumBits			m_port;
+	int					m_worker_threads;	// 工作线程数
+	bool				m_use_epoll;
+	CRtspWorker*		m_workers[RTSPSERVER_MAX_WORKERS];
+	// 多个工作线程时由接收线程 accept 连接，只有一个工作线程时由它自己监听端口
 	char 	m_watchVariable;
 	TaskScheduler* 		m_scheduler;
 	UsageEnvironment* 	m_env;
-	RTSPServer* 		m_rtspServer;
 	pthread_t 			m_pThread;
-	portNumBits			m_port;
-	cqueue m_sms_action_queue;
-
-	EventTriggerId m_process_sms;
+	int					m_listen_sock;
+	int					m_wake_fd;			// Stop 时唤醒接收线程的 eventfd
+	HashTable*			m_pending_conns;	// 还没有收到第一行请求的连接
+	UserAuthenticationDatabase* m_authDB;
+	volatile int		m_acceptor_state;	// 0: 未启动，1: 运行中，-1: 启动失败
+	pthread_mutex_t		m_owner_lock;		// 保护 m_owners，接收线程和添加/删除 sms 的线程都会访问
+	SmsOwner			m_owners[RTSPSERVER_MAX_SMS];
+	int					m_owner_count;
+	// 码流分发方式，只对之后添加的 sms 生效
+	bool m_reuse_source;			// 同一路码流的客户端共享码流源和 RTP 打包
+	bool m_multicast;				// UDP 客户端通过组播接收
+	netAddressBits m_multicast_addr;	// 0 表示每路码流随机选择 SSM 地址
+	portNumBits m_multicast_port;
+	u_int8_t m_multicast_ttl;
+	unsigned m_multicast_index;		// 下一路码流使用的端口序号
 	/*char				m_streamName[128];*/
 	/*bool 				m_audioEnable;*/
 	/*int 				m_audioType;*/
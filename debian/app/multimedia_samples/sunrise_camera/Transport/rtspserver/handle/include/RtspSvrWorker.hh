@@ -0,0 +1,111 @@
+#ifndef __RTSP_SVR_WORKER_HH__
+#define __RTSP_SVR_WORKER_HH__
+
+#include <pthread.h>
+#include "BasicUsageEnvironment.hh"
+#include "RTSPServer.hh"
+#include "utils/cqueue.h"
+
+struct SmsParam{
+	int actionType; //0: 删除， 1:添加
+	char streamName[128];
+	bool audioEnable;
+	int audioType;
+	int audioSampleRate;
+	int audioBitPerSample;
+	int audioChannels;
+	bool videoEnable;
+	int videoType;
+	int videoFrameRate;
+	char shmId[32];
+	char shmName[32];
+	int streamBufSize;
+	int frameRate;
+	int suggest_buffer_item_count;
+	int suggest_buffer_region_size;
+	// 码流分发方式，入队时从 CRtspServer 复制，工作线程里不再访问 CRtspServer 的成员
+	bool reuseSource;
+	bool multicast;
+	netAddressBits multicastAddr;	// 0 表示随机选择 SSM 地址
+	portNumBits multicastPort;		// 视频使用的端口，音频 +2
+	u_int8_t multicastTTL;
+};
+
+// 由接收线程分发给工作线程的客户端连接
+struct ConnParam{
+	int sock;
+	struct sockaddr_in addr;
+};
+
+// 没有监听 socket 的 RTSPServer，只处理接收线程 accept 后转交过来的连接
+// rtspURL() 等仍然使用真实的监听端口
+class CRtspWorkerServer : public RTSPServer
+{
+public:
+	static CRtspWorkerServer* createNew(UsageEnvironment& env, portNumBits port,
+		UserAuthenticationDatabase* authDatabase);
+	void Adopt(int sock, struct sockaddr_in addr);
+
+	// 和 RTSPServer::createNew 相同的方式创建监听 socket，给接收线程使用
+	static int SetUpListenSocket(UsageEnvironment& env, Port& port);
+
+protected:
+	CRtspWorkerServer(UsageEnvironment& env, Port port,
+		UserAuthenticationDatabase* authDatabase);
+};
+
+// 一个工作线程: 独立的 TaskScheduler/UsageEnvironment 和 RTSPServer，
+// 一路码流(ServerMediaSession)及其所有客户端连接都只在所属的工作线程里处理
+class CRtspWorker
+{
+public:
+	CRtspWorker(int index, portNumBits port);
+	~CRtspWorker();
+
+	// listen 为 true 时自己监听端口(单线程模式)，否则只接收 PostConnection 转交的连接
+	bool Create(bool listen, bool useEpoll, UserAuthenticationDatabase* authDB);
+	bool Destory();
+	bool Start();
+	bool Stop();
+
+	// 其他线程调用，入队后通过 eventfd 唤醒工作线程处理
+	bool PostSms(SmsParam* sms_param);
+	bool PostConnection(int sock, struct sockaddr_in addr);
+	// 等待之前投递的 sms 处理完成，最多 1s
+	bool WaitSmsComplete();
+
+	int Index() const { return m_index; }
+
+	// useEpoll 为 true 时创建 EpollTaskScheduler，失败时退回 BasicTaskScheduler
+	static TaskScheduler* CreateScheduler(bool useEpoll);
+
+private:
+	static void* ThreadWorkerProcImpl(void* arg);
+	void ThreadWorker();
+
+	static void WakeHandler(void* param, int mask);
+	void ProcessQueues();
+	void AddSms(SmsParam* sms_param);
+	void DelSms(SmsParam* sms_param);
+	static void ReportOutBufferPool(void* param);
+
+	int 				m_index;
+	portNumBits			m_port;
+	bool 				m_listen;
+	UserAuthenticationDatabase* m_authDB;
+	volatile int		m_state;		// 0: 未启动，1: 运行中，-1: 启动失败
+	char 				m_watchVariable;
+	TaskScheduler* 		m_scheduler;
+	UsageEnvironment* 	m_env;
+	RTSPServer* 		m_rtspServer;
+	pthread_t 			m_pThread;
+	int					m_wake_fd;		// 唤醒事件循环的 eventfd
+	cqueue				m_sms_queue;
+	cqueue				m_conn_queue;
+
+	TaskToken m_pool_report_task;	// 定时打印 RTP 发送缓存池的使用情况(只在 0 号线程)
+	unsigned m_pool_bytes_in_use;	// 上次打印时的值，没有变化时不重复打印
+	unsigned m_pool_bytes_cached;
+};
+
+#endif
@@ -15,6 +15,11 @@ int rtspsvr_wrap_add_sms(void* instance, const char* streamName,
 	char *shmId, char *shmName, int streamBufSize, int frameRate,
 	int suggest_buffer_region_size, int suggest_buffer_item_count);
 int rtspsvr_wrap_del_sms(void* instance, const char* streamName);
+int rtspsvr_wrap_set_cast(void* instance, int reuseSource, int multicast,
+	const char* multicastAddr, int multicastPort, int multicastTTL);
+int rtspsvr_wrap_set_workers(void* instance, int workerThreads);
+int rtspsvr_wrap_set_epoll(void* instance, int useEpoll);
+int rtspsvr_wrap_set_tcp_send_queue(void* instance, int sizeKB);
 #if 0
 int rtspsvr_wrap_h264_data_put(void* instance, frame_info info, unsigned char* data, unsigned int length);
 int rtspsvr_wrap_pcma_data_put(void* instance, frame_info info, unsigned char* data, unsigned int length);
@@ -40,12 +40,20 @@ H264MainVideoSource::H264MainVideoSource(UsageEnvironment& env,
 	fShmSource = shm_stream_create(shmId, shmName, STREAM_MAX_USER,
 		buffer_item_count, buffer_region_size, SHM_STREAM_READ, SHM_STREAM_MALLOC);
 
+	fNotifyFd = shm_stream_notify_fd(fShmSource);
+	if(fNotifyFd < 0){
+		SC_LOGW("shm_id: %s, shm_name: %s has no notify fd, fall back to polling.", shmId, shmName);
+	}
+
 	strncpy(fShmName, shmName, sizeof(fShmName) - 1);
 	strncpy(fShmId, shmId, sizeof(fShmId) - 1);
 	fBufferRegionSize = buffer_region_size;
 	fBufferItemCount = buffer_item_count;
 	fPts = 0;
-	fNaluLen = 0;
+	fNaluIter.count = 0;
+	fNaluIter.pos = 0;
+	fSendStage = latency_stats_stage("rtsp_send");
+	fCaptureStage = latency_stats_stage("capture_to_rtsp");
 
 	SC_LOGI("video_stream_create => shm_id: %s, shm_name: %s, STREAM_MAX_USER: %d, framerate: %d, stream_buf_size: %d, region size:%d, item count %d",
 		 shmId, shmName, STREAM_MAX_USER, frameRate, streamBufSize, buffer_region_size, buffer_item_count);
@@ -55,6 +63,10 @@ H264MainVideoSource::~H264MainVideoSource()
 {
 
 	SC_LOGI("video source deleted shm_id: %s, shm_name: %s, is dummy %d", fShmId, fShmName, fIsDummy);
+	if(fNotifyFd >= 0){
+		envir().taskScheduler().disableBackgroundHandling(fNotifyFd);
+		fNotifyFd = -1;
+	}
 	if(fShmSource != NULL)
 	{
 		shm_stream_destory(fShmSource);
@@ -87,6 +99,31 @@ void H264MainVideoSource::doGetNextFrame() {
 	incomingDataHandler(this);
 }
 
+void H264MainVideoSource::doStopGettingFrames() {
+	if(fNotifyFd >= 0){
+		envir().taskScheduler().disableBackgroundHandling(fNotifyFd);
+	}
+	FramedSource::doStopGettingFrames();
+}
+
+void H264MainVideoSource::waitForData() {
+	if(fNotifyFd >= 0){
+		// 写端发布新帧后立即唤醒，不再轮询
+		envir().taskScheduler().setBackgroundHandling(fNotifyFd, SOCKET_READABLE,
+			(TaskScheduler::BackgroundHandlerProc*)&notifyHandler, this);
+	}else{
+		nextTask() = envir().taskScheduler().scheduleDelayedTask(10 * 1000,
+			(TaskFunc*)incomingDataHandler, this);
+	}
+}
+
+void H264MainVideoSource::notifyHandler(H264MainVideoSource* source, int /*mask*/) {
+	source->envir().taskScheduler().disableBackgroundHandling(source->fNotifyFd);
+	// 先清除通知再读数据，清除之后发布的帧会让 fd 重新可读，不会丢失唤醒
+	shm_stream_notify_clear(source->fShmSource);
+	incomingDataHandler(source);
+}
+
 void H264MainVideoSource::incomingDataHandler(H264MainVideoSource* source) {
 	if (!source->isCurrentlyAwaitingData())
 	{
@@ -105,43 +142,41 @@ void H264MainVideoSource::incomingDataHandler1()
 	frame_info info;
 	unsigned int length;
 	unsigned char* data = NULL;
-	time_statistics_at_beginning_of_loop(&fTimeStatistics);
-	if (shm_stream_front(fShmSource, &info, &data, &length) == 0)
+	u_int64_t startNs = get_monotonic_ns();
+	if (shm_stream_front_nalu(fShmSource, &info, &data, &length, &fNaluIter, 0) == 0)
 	{
-		NALU_t nalu;
-		fFrameSize = length;
-		if (fFrameSize > fMaxSize)
+		NALU_index_t *nalu = shm_stream_next_nalu(&fNaluIter);
+		if (nalu == NULL)
 		{
-			fNumTruncatedBytes = fFrameSize - fMaxSize;
-			fFrameSize = fMaxSize;
-		}
-		else
-		{
-			fNumTruncatedBytes = 0;
+			SC_LOGE("shm_id: %s, shm_name: %s frame has no start code, so ignore it. length:%u", fShmId, fShmName, length);
+			shm_stream_post(fShmSource);
+			fDurationInMicroseconds = fNotifyFd >= 0 ? 0 : 1000 * 1;
+			nextTask() = envir().taskScheduler().scheduleDelayedTask(fDurationInMicroseconds,
+				(TaskFunc*)incomingDataHandler, this);
+			return;
 		}
-		int ret = get_annexb_nalu(data + fNaluLen, fFrameSize - fNaluLen, &nalu, 0);
-		if (ret > 0) fNaluLen += nalu.len + nalu.startcodeprefix_len;    //记录nalu偏移总长
+		bool lastNalu = fNaluIter.pos >= fNaluIter.count;
+		fNumTruncatedBytes = 0;
 
 		//只发送sps pps i p nalu, 其他抛弃
-		if (nalu.nal_unit_type == 7 || nalu.nal_unit_type == 8
-			|| nalu.nal_unit_type == 1 || nalu.nal_unit_type == 5)
+		if (nalu->nal_unit_type == 7 || nalu->nal_unit_type == 8
+			|| nalu->nal_unit_type == 1 || nalu->nal_unit_type == 5)
 		{
-				/*SC_LOGI("nal_unit_type:%d data:%p buf:%p len:%u", nalu.nal_unit_type, data,*/
-						   /*nalu.buf, nalu.len);*/
+				/*SC_LOGI("nal_unit_type:%d data:%p buf:%p len:%u", nalu->nal_unit_type, data,*/
+						   /*nalu->offset, nalu->len);*/
 				/*SC_LOGI("framer video pts:%llu remains:%d length:%d \n", info.pts,*/
 						   /*shm_stream_remains(fShmSource), length);*/
-			fFrameSize = nalu.len;
-			ret = nalu_is_beyond_source_data_range(nalu.buf, nalu.len, data, length, fShmId);
-			if((ret != 0) || (nalu.len > fMaxSize)){
-				SC_LOGE("shm_id: %s, shm_name: %s data range is error, so ignore this pkt. nalu len:%d dst max len:%d", fShmId, fShmName, nalu.len, fMaxSize);
-				fNaluLen = 0;
+			fFrameSize = nalu->len;
+			if(nalu->len > fMaxSize){
+				SC_LOGE("shm_id: %s, shm_name: %s data range is error, so ignore this pkt. nalu len:%d dst max len:%d", fShmId, fShmName, nalu->len, fMaxSize);
+				fNaluIter.pos = 0;
 				shm_stream_post(fShmSource);
-				fDurationInMicroseconds = 1000 * 1;
+				fDurationInMicroseconds = fNotifyFd >= 0 ? 0 : 1000 * 1;
 				nextTask() = envir().taskScheduler().scheduleDelayedTask(fDurationInMicroseconds,
 					(TaskFunc*)incomingDataHandler, this);
 				return;
 			}
-			memcpy(fTo, nalu.buf, nalu.len);
+			memcpy(fTo, data + nalu->offset, nalu->len);
 
 			/*printf("fMaxSize=%d, fFrameSize = %d, fNumTruncatedBytes=%d\n", fMaxSize, fFrameSize, fNumTruncatedBytes);*/
 
@@ -152,7 +187,7 @@ void H264MainVideoSource::incomingDataHandler1()
 				fPts = info.pts;
 				//SC_LOGI("fPts: %llu\n", fPts);
 			}
-			else if (nalu.nal_unit_type == 1 || nalu.nal_unit_type == 5)
+			else if (nalu->nal_unit_type == 1 || nalu->nal_unit_type == 5)
 			{
 				unsigned uSeconds = fPresentationTime.tv_usec + (info.pts  - fPts);
 				fPresentationTime.tv_sec += uSeconds / 1000000;
@@ -162,14 +197,14 @@ void H264MainVideoSource::incomingDataHandler1()
 			}
 
 #if 0
-			if (nalu.nal_unit_type == 5) {
-				printf("I frame size:%d\n", nalu.len);
+			if (nalu->nal_unit_type == 5) {
+				printf("I frame size:%d\n", nalu->len);
 			}
 #endif
 
-			if (nalu.nal_unit_type == 1 || nalu.nal_unit_type == 5)
+			fDurationInMicroseconds = 0;
+			if (lastNalu)
 			{
-				fNaluLen = 0;
 				fDurationInMicroseconds = 1000 * 1; //1ms
 
 				int remains = shm_stream_remains(fShmSource);
@@ -177,33 +212,35 @@ void H264MainVideoSource::incomingDataHandler1()
 					SC_LOGI("shm_id: %s, shm_name: %s, length:%d fFrameSize:%d remains:%d",
 						fShmId, fShmName, length, fFrameSize, remains);
 				}
-				//数据压力大时，立即发送
-				if(remains >= 3){
+				//数据压力大时，或者下一帧由写端通知唤醒时，立即发送
+				if(remains >= 3 || fNotifyFd >= 0){
 					fDurationInMicroseconds = 0;
 				}
 				//该帧发送完毕，包括sps pps等nalu拆分完毕，可以释放
 				shm_stream_post(fShmSource);
 			}
 
+			latency_stats_record_since(fSendStage, startNs);
+			if (lastNalu && info.capture_ns != 0)
+			{
+				latency_stats_record_since(fCaptureStage, info.capture_ns);
+			}
 			nextTask() = envir().taskScheduler().scheduleDelayedTask(fDurationInMicroseconds, (TaskFunc*)FramedSource::afterGetting, this);
 		}
 		else
 		{
-			SC_LOGI("shm_id: %s, shm_name: %s, other nal_unit_type %d\n", fShmId, fShmName, nalu.nal_unit_type);
-			fNaluLen = 0;
-			shm_stream_post(fShmSource);
-			fDurationInMicroseconds = 1000 * 2;
+			SC_LOGI("shm_id: %s, shm_name: %s, other nal_unit_type %d\n", fShmId, fShmName, nalu->nal_unit_type);
+			if (lastNalu)
+			{
+				shm_stream_post(fShmSource);
+			}
+			fDurationInMicroseconds = fNotifyFd >= 0 ? 0 : 1000 * 2;
 			nextTask() = envir().taskScheduler().scheduleDelayedTask(fDurationInMicroseconds,
 				(TaskFunc*)incomingDataHandler, this);
 		}
 	}
 	else
 	{
-		// SC_LOGI("no data");
-		nextTask() = envir().taskScheduler().scheduleDelayedTask(10 * 1000,
-			(TaskFunc*)incomingDataHandler, this);
+		waitForData();
 	}
-
-	time_statistics_at_ending_of_loop(&fTimeStatistics);
-	time_statistics_info_show(&fTimeStatistics, "rtsp-h264", false);
 }
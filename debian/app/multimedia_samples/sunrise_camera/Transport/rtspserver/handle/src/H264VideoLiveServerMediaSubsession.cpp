@@ -26,6 +26,12 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 #include "H264VideoLiveServerMediaSubsession.hh"
 #include "H264VideoLiveDiscreteFramer.hh"
 #include "utils/utils_log.h"
+#include "rtsp_server_default_param.h"
+
+// 每个 RTP sink 一个，只指向这个 sink 自己的码流源
+struct H264KeyFrameRequest {
+	H264MainVideoSource* fSource;
+};
 
 H264VideoLiveServerMediaSubsession*
 H264VideoLiveServerMediaSubsession::createNew(UsageEnvironment& env, Boolean reuseFirstSource,
@@ -36,7 +42,7 @@ H264VideoLiveServerMediaSubsession::createNew(UsageEnvironment& env, Boolean reu
 
 H264VideoLiveServerMediaSubsession::H264VideoLiveServerMediaSubsession(UsageEnvironment& env, Boolean reuseFirstSource,
 char *shmId, char *shmName, int streamBufSize, int frameRate, int buffer_region_size, int buffer_item_count)
-	: OnDemandServerMediaSubsession(env, True/*reuse the first source*/, 6970, True),
+	: OnDemandServerMediaSubsession(env, reuseFirstSource, 6970, True),
 	fAuxSDPLine(NULL), fDoneFlag(0), fDummyRTPSink(NULL) {
 	// 外部的shm参数终于传进来了，后面有时间看看怎么传递会更合适吧
 	// 使用 memcpy 函数复制字符串，并确保在目标字符串的末尾添加终止符
@@ -48,13 +54,36 @@ char *shmId, char *shmName, int streamBufSize, int frameRate, int buffer_region_
 	fBufferItemCount = buffer_item_count;
 	fBufferRegionSize = buffer_region_size;
 	fDummyVideoSourceCount = 0;
-	SC_LOGI("media subsession created for :%s [%d:%d]", shmName, fBufferRegionSize, fBufferItemCount);
+	fKeyFrameRequests = HashTable::create(ONE_WORD_HASH_KEYS);
+
+	// 一帧码流不会超过编码器的 bitstream buffer(streamBufSize，由分辨率决定)，
+	// 也不会超过按码率计算的共享内存区域(vp_codec_get_user_buffer_param)，取较小值作为 RTP 发送缓存大小
+	fOutBufferSize = streamBufSize;
+	if (buffer_region_size > 0 && (fOutBufferSize <= 0 || buffer_region_size < fOutBufferSize))
+		fOutBufferSize = buffer_region_size;
+	if (fOutBufferSize < RTSPSERVER_MIN_OUT_BUFFER_SIZE)
+		fOutBufferSize = RTSPSERVER_MIN_OUT_BUFFER_SIZE;
+	SC_LOGI("media subsession created for :%s [%d:%d] out buffer size:%d",
+		shmName, fBufferRegionSize, fBufferItemCount, fOutBufferSize);
 }
 
 H264VideoLiveServerMediaSubsession::~H264VideoLiveServerMediaSubsession() {
 
 	SC_LOGI("media subsession destroyed for :%s", fShmName);
 	delete[] fAuxSDPLine;
+
+	// 码流源都关闭后表应该是空的，这里只是兜底
+	H264KeyFrameRequest* request;
+	while ((request = (H264KeyFrameRequest*)fKeyFrameRequests->RemoveNext()) != NULL)
+		delete request;
+	delete fKeyFrameRequests;
+}
+
+// createNewStreamSource 返回的是 framer，它的输入才是 H264MainVideoSource
+static H264MainVideoSource* mainVideoSource(StreamState* streamState) {
+	if (streamState == NULL || streamState->mediaSource() == NULL)
+		return NULL;
+	return (H264MainVideoSource*)((H264VideoLiveDiscreteFramer*)streamState->mediaSource())->inputSource();
 }
 
 void H264VideoLiveServerMediaSubsession::startStream(unsigned clientSessionId,
@@ -66,70 +95,21 @@ void H264VideoLiveServerMediaSubsession::startStream(unsigned clientSessionId,
 						ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
 						void* serverRequestAlternativeByteHandlerClientData) {
 
-	fVideoSource->idr();
-	//sync
-	fVideoSource->sync();
-
-	StreamState* streamState = (StreamState*)streamToken;
-	Destinations* destinations
-		= (Destinations*)(fDestinationsHashTable->Lookup((char const*)clientSessionId));
-	if (streamState != NULL)
-	{
-		streamState->startPlaying(destinations, clientSessionId,
-				      rtcpRRHandler, rtcpRRHandlerClientData,
-				      serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
-		RTPSink* rtpSink = streamState->rtpSink(); // alias
-		if (rtpSink != NULL)
-		{
-			rtpSeqNum = rtpSink->currentSeqNo();
-			rtpTimestamp = rtpSink->presetNextTimestamp();
-		}
-	}
-
-}
-
-
-void H264VideoLiveServerMediaSubsession::pauseStream(unsigned /*clientSessionId*/,
-						void* streamToken) {
-	// Pausing isn't allowed if multiple clients are receiving data from
-	// the same source:
-	if (fReuseFirstSource) return;
-
-	StreamState* streamState = (StreamState*)streamToken;
-	if (streamState != NULL) streamState->pause();
-}
-
-
-void H264VideoLiveServerMediaSubsession::seekStream(unsigned /*clientSessionId*/,
-					       void* streamToken, double& seekNPT, double streamDuration, u_int64_t& numBytes) {
-	SC_LOGI("H264VideoLiveServerMediaSubsession::seekStream1");
-	//call out size seek -- add by donyj
-
-	numBytes = 0; // by default: unknown
-
-	// Seeking isn't allowed if multiple clients are receiving data from the same source:
-	if (fReuseFirstSource) return;
-
+	// 只能操作这个客户端自己的码流源，最后创建的码流源可能属于其他客户端或者已经关闭的 SDP 探测源
 	StreamState* streamState = (StreamState*)streamToken;
-	if (streamState != NULL && streamState->mediaSource() != NULL) {
-		seekStreamSource(streamState->mediaSource(), seekNPT, streamDuration, numBytes);
-
-		streamState->startNPT() = (float)seekNPT;
-		RTPSink* rtpSink = streamState->rtpSink(); // alias
-		if (rtpSink != NULL) rtpSink->resetPresentationTimes();
+	H264MainVideoSource* videoSource = mainVideoSource(streamState);
+	if (videoSource != NULL) {
+		// 新的客户端需要尽快拿到 I 帧，多个客户端共享码流时其他客户端也会多收到一个 I 帧
+		videoSource->idr();
+		// 共享的码流(reuseFirstSource 或组播)已经在给其他客户端发送时，新客户端只是加入，
+		// 不能 sync 共享的读指针，否则其他客户端会丢帧
+		if (!streamState->isCurrentlyPlaying())
+			videoSource->sync();
 	}
-}
-
-void H264VideoLiveServerMediaSubsession::seekStream(unsigned /*clientSessionId*/,
-					       void* streamToken, char*& absStart, char*& absEnd) {
-	SC_LOGI("H264VideoLiveServerMediaSubsession::seekStream2");
-	// Seeking isn't allowed if multiple clients are receiving data from the same source:
-	if (fReuseFirstSource) return;
 
-	StreamState* streamState = (StreamState*)streamToken;
-	if (streamState != NULL && streamState->mediaSource() != NULL) {
-		seekStreamSource(streamState->mediaSource(), absStart, absEnd);
-	}
+	OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken,
+		rtcpRRHandler, rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp,
+		serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
 }
 
 
@@ -145,6 +125,13 @@ void H264VideoLiveServerMediaSubsession::afterPlayingDummy1() {
 	setDoneFlag();
 }
 
+static void requestKeyFrame(void* clientData) {
+	H264KeyFrameRequest* request = (H264KeyFrameRequest*)clientData;
+	// 丢弃的视频帧之后的 P 帧都无法解码，让编码器立即编码一个 I 帧，不用等到下一个 GOP
+	if (request != NULL && request->fSource != NULL)
+		request->fSource->idr();
+}
+
 static void checkForAuxSDPLine(void* clientData) {
 	H264VideoLiveServerMediaSubsession* subsess = (H264VideoLiveServerMediaSubsession*)clientData;
 	subsess->checkForAuxSDPLine1();
@@ -209,7 +196,7 @@ FramedSource* H264VideoLiveServerMediaSubsession::createNewStreamSource(unsigned
 	SC_LOGI("create stream source %s %s bitrate:%d clientSessionId:%d fDummyVideoSourceCount:%d",
 		fShmId, fShmName, estBitrate, clientSessionId, fDummyVideoSourceCount);
 
-	fVideoSource = H264MainVideoSource::createNew(envir(), fShmId_tmp, fShmName, fStreamBufSize, fFrameRate,
+	H264MainVideoSource* mainSource = H264MainVideoSource::createNew(envir(), fShmId_tmp, fShmName, fStreamBufSize, fFrameRate,
 		fBufferRegionSize, fBufferItemCount, is_dummy);
 
 	if(clientSessionId == 0){
@@ -217,12 +204,12 @@ FramedSource* H264VideoLiveServerMediaSubsession::createNewStreamSource(unsigned
 	}
 
 	estBitrate = fBufferRegionSize; // kbps, estimate
-	if (fVideoSource == NULL) {
+	if (mainSource == NULL) {
 		SC_LOGE("createNewStreamSource create video source failed.");
 		return NULL;
 	}
 
-	H264VideoLiveDiscreteFramer* videoSource = H264VideoLiveDiscreteFramer::createNew(envir(), (FramedSource*)fVideoSource);
+	H264VideoLiveDiscreteFramer* videoSource = H264VideoLiveDiscreteFramer::createNew(envir(), (FramedSource*)mainSource);
 	if (videoSource == NULL) {
 		SC_LOGE("createNewStreamSource create discrete framer failed.");
 		return NULL;
@@ -232,7 +219,35 @@ FramedSource* H264VideoLiveServerMediaSubsession::createNewStreamSource(unsigned
 
 RTPSink* H264VideoLiveServerMediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock,
 		unsigned char rtpPayloadTypeIfDynamic,
-		FramedSource* /*inputSource*/)
+		FramedSource* inputSource)
 {
-	return H264VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
+	H264VideoRTPSink* rtpSink = H264VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
+	if (rtpSink != NULL) {
+		rtpSink->setOutBufferSize(fOutBufferSize);
+		// inputSource 是 createNewStreamSource 返回的 framer，请求 I 帧要发给它的输入
+		H264MainVideoSource* mainSource = (H264MainVideoSource*)((H264VideoLiveDiscreteFramer*)inputSource)->inputSource();
+		H264KeyFrameRequest* request = (H264KeyFrameRequest*)fKeyFrameRequests->Lookup((char const*)mainSource);
+		if (request == NULL) {
+			request = new H264KeyFrameRequest;
+			request->fSource = mainSource;
+			fKeyFrameRequests->Add((char const*)mainSource, request);
+		}
+		rtpSink->setKeyFrameRequestHandler(requestKeyFrame, request);
+	}
+	return rtpSink;
+}
+
+void H264VideoLiveServerMediaSubsession::closeStreamSource(FramedSource* inputSource) {
+	// StreamState::reclaim() 和 sdpLines() 都是先关闭 RTP sink 再关闭码流源，
+	// 这时已经没有 sink 会再调用 requestKeyFrame，可以直接释放
+	if (inputSource != NULL) {
+		FramedSource* mainSource = ((H264VideoLiveDiscreteFramer*)inputSource)->inputSource();
+		H264KeyFrameRequest* request = (H264KeyFrameRequest*)fKeyFrameRequests->Lookup((char const*)mainSource);
+		if (request != NULL) {
+			request->fSource = NULL;
+			fKeyFrameRequests->Remove((char const*)mainSource);
+			delete request;
+		}
+	}
+	OnDemandServerMediaSubsession::closeStreamSource(inputSource);
 }
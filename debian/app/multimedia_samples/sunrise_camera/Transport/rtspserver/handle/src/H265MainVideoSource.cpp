@@ -42,12 +42,20 @@ H265MainVideoSource::H265MainVideoSource(UsageEnvironment& env,
 		buffer_item_count, buffer_region_size,
 		SHM_STREAM_READ, SHM_STREAM_MALLOC);
 
+	fNotifyFd = shm_stream_notify_fd(fShmSource);
+	if(fNotifyFd < 0){
+		SC_LOGW("shm_id: %s, shm_name: %s has no notify fd, fall back to polling.", shmId, shmName);
+	}
+
 	strncpy(fShmName, shmName, sizeof(fShmName) - 1);
 	strncpy(fShmId, shmId, sizeof(fShmId) - 1);
 	fBufferRegionSize = buffer_region_size;
 	fBufferItemCount = buffer_item_count;
 	fPts = 0;
-	fNaluLen = 0;
+	fNaluIter.count = 0;
+	fNaluIter.pos = 0;
+	fSendStage = latency_stats_stage("rtsp_send");
+	fCaptureStage = latency_stats_stage("capture_to_rtsp");
 
 	SC_LOGI("video_stream_create => shm_id: %s, shm_name: %s, STREAM_MAX_USER: %d, framerate: %d, stream_buf_size: %d, region size:%d, item count %d",
 		 shmId, shmName, STREAM_MAX_USER, frameRate, streamBufSize, buffer_region_size, buffer_item_count);
@@ -56,6 +64,10 @@ H265MainVideoSource::H265MainVideoSource(UsageEnvironment& env,
 H265MainVideoSource::~H265MainVideoSource()
 {
 	SC_LOGI("video source deleted shm_id: %s, shm_name: %s, is dummy %d", fShmId, fShmName, fIsDummy);
+	if(fNotifyFd >= 0){
+		envir().taskScheduler().disableBackgroundHandling(fNotifyFd);
+		fNotifyFd = -1;
+	}
 	if(fShmSource != NULL)
 	{
 		shm_stream_destory(fShmSource);
@@ -88,6 +100,31 @@ void H265MainVideoSource::doGetNextFrame() {
 	incomingDataHandler(this);
 }
 
+void H265MainVideoSource::doStopGettingFrames() {
+	if(fNotifyFd >= 0){
+		envir().taskScheduler().disableBackgroundHandling(fNotifyFd);
+	}
+	FramedSource::doStopGettingFrames();
+}
+
+void H265MainVideoSource::waitForData() {
+	if(fNotifyFd >= 0){
+		// 写端发布新帧后立即唤醒，不再轮询
+		envir().taskScheduler().setBackgroundHandling(fNotifyFd, SOCKET_READABLE,
+			(TaskScheduler::BackgroundHandlerProc*)&notifyHandler, this);
+	}else{
+		nextTask() = envir().taskScheduler().scheduleDelayedTask(10 * 1000,
+			(TaskFunc*)incomingDataHandler, this);
+	}
+}
+
+void H265MainVideoSource::notifyHandler(H265MainVideoSource* source, int /*mask*/) {
+	source->envir().taskScheduler().disableBackgroundHandling(source->fNotifyFd);
+	// 先清除通知再读数据，清除之后发布的帧会让 fd 重新可读，不会丢失唤醒
+	shm_stream_notify_clear(source->fShmSource);
+	incomingDataHandler(source);
+}
+
 void H265MainVideoSource::incomingDataHandler(H265MainVideoSource* source) {
 	if (!source->isCurrentlyAwaitingData())
 	{
@@ -108,27 +145,26 @@ void H265MainVideoSource::incomingDataHandler1()
 	unsigned int length;
 	unsigned char* data = NULL;
 
-	time_statistics_at_beginning_of_loop(&fTimeStatistics);
-	if (shm_stream_front(fShmSource, &info, &data, &length) == 0)
+	u_int64_t startNs = get_monotonic_ns();
+	if (shm_stream_front_nalu(fShmSource, &info, &data, &length, &fNaluIter, 1) == 0)
 	{
-		NALU_t nalu;
-		fFrameSize = length;
-		if (fFrameSize > fMaxSize)
+		NALU_index_t *nalu = shm_stream_next_nalu(&fNaluIter);
+		if (nalu == NULL)
 		{
-			fNumTruncatedBytes = fFrameSize - fMaxSize;
-			fFrameSize = fMaxSize;
-		}
-		else
-		{
-			fNumTruncatedBytes = 0;
+			SC_LOGE("shm_id: %s, shm_name: %s frame has no start code, so ignore it. length:%u", fShmId, fShmName, length);
+			shm_stream_post(fShmSource);
+			fDurationInMicroseconds = fNotifyFd >= 0 ? 0 : 1000 * 1;
+			nextTask() = envir().taskScheduler().scheduleDelayedTask(fDurationInMicroseconds,
+				(TaskFunc*)incomingDataHandler, this);
+			return;
 		}
-		int ret = get_annexb_nalu(data + fNaluLen, fFrameSize - fNaluLen, &nalu, 1);
-		if (ret > 0) fNaluLen += nalu.len + nalu.startcodeprefix_len;    //记录nalu偏移总长
+		bool lastNalu = fNaluIter.pos >= fNaluIter.count;
+		fNumTruncatedBytes = 0;
 
 		#if 0
 		static FILE *enc_data_file = NULL;
 		if(enc_data_file == NULL){
-			if(nalu.nal_unit_type == 32){
+			if(nalu->nal_unit_type == 32){
 					char enc_file_name [100];
 					sprintf(enc_file_name, "/tmp/front_rtsp_%s.h265", fShmSource->name);
 
@@ -137,7 +173,7 @@ void H265MainVideoSource::incomingDataHandler1()
 						SC_LOGE("open file %s failed.", (char *)enc_file_name);
 					}
 			}else{
-				printf("ignore nalu type [%d], before idr.\n", nalu.nal_unit_type);
+				printf("ignore nalu type [%d], before idr.\n", nalu->nal_unit_type);
 			}
 		}
 		if(enc_data_file != NULL){
@@ -150,24 +186,20 @@ void H265MainVideoSource::incomingDataHandler1()
 		#endif
 
 		//只发送sps pps i p nalu, 其他抛弃
-		if ( nalu.nal_unit_type == 1 || nalu.nal_unit_type == 32
-			|| nalu.nal_unit_type == 33 || nalu.nal_unit_type == 34 || nalu.nal_unit_type == 19)
+		if ( nalu->nal_unit_type == 1 || nalu->nal_unit_type == 32
+			|| nalu->nal_unit_type == 33 || nalu->nal_unit_type == 34 || nalu->nal_unit_type == 19)
 		{
-			fFrameSize = nalu.len;
-			//在使用 nalu 内存前做如下检测
-			//码流数据在大压力的情况下，可能会被覆盖，所以此处判断web 发送的数据范围是否合法
-			//数据被覆盖后，发送出去也没问题，但是要保证程序不会奔溃
-			ret = nalu_is_beyond_source_data_range(nalu.buf, nalu.len, data, length, fShmId);
-			if((ret != 0) || (nalu.len > fMaxSize)){
-				SC_LOGE("shm_id: %s, shm_name: %s data range is error, so ignore this pkt. nalu len:%d dst max len:%d", fShmId, fShmName, nalu.len, fMaxSize);
-				fNaluLen = 0;
+			fFrameSize = nalu->len;
+			if(nalu->len > fMaxSize){
+				SC_LOGE("shm_id: %s, shm_name: %s data range is error, so ignore this pkt. nalu len:%d dst max len:%d", fShmId, fShmName, nalu->len, fMaxSize);
+				fNaluIter.pos = 0;
 				shm_stream_post(fShmSource);
-				fDurationInMicroseconds = 1000 * 1;
+				fDurationInMicroseconds = fNotifyFd >= 0 ? 0 : 1000 * 1;
 				nextTask() = envir().taskScheduler().scheduleDelayedTask(fDurationInMicroseconds,
 					(TaskFunc*)incomingDataHandler, this);
 				return;
 			}
-			memcpy(fTo, nalu.buf, nalu.len);
+			memcpy(fTo, data + nalu->offset, nalu->len);
 
 			if (fPresentationTime.tv_sec == 0 && fPresentationTime.tv_usec == 0)
 			{
@@ -175,7 +207,7 @@ void H265MainVideoSource::incomingDataHandler1()
 				gettimeofday(&fPresentationTime, NULL);
 				fPts = info.pts;
 			}
-			else if (nalu.nal_unit_type == 1)
+			else if (nalu->nal_unit_type == 1)
 			{
 				unsigned uSeconds = fPresentationTime.tv_usec + (info.pts  - fPts);
 				fPresentationTime.tv_sec += uSeconds / 1000000;
@@ -184,9 +216,9 @@ void H265MainVideoSource::incomingDataHandler1()
 				gettimeofday(&fPresentationTime, NULL);
 			}
 
-			if (nalu.nal_unit_type == 1 || nalu.nal_unit_type == 19)
+			fDurationInMicroseconds = 0;
+			if (lastNalu)
 			{
-				fNaluLen = 0;
 				fDurationInMicroseconds = 1000 * 1; //1ms
 
 				int remains = shm_stream_remains(fShmSource);
@@ -194,7 +226,8 @@ void H265MainVideoSource::incomingDataHandler1()
 					SC_LOGI("shm_id: %s, shm_name: %s, length:%d fFrameSize:%d remains:%d",
 						fShmId, fShmName, length, fFrameSize, remains);
 				}
-				if(remains >= 3){
+				//数据压力大时，或者下一帧由写端通知唤醒时，立即发送
+				if(remains >= 3 || fNotifyFd >= 0){
 					fDurationInMicroseconds = 0;
 				}
 				//该帧发送完毕，包括sps pps等nalu拆分完毕，可以释放
@@ -203,24 +236,27 @@ void H265MainVideoSource::incomingDataHandler1()
 				//do noting, 拆包
 			}
 
+			latency_stats_record_since(fSendStage, startNs);
+			if (lastNalu && info.capture_ns != 0)
+			{
+				latency_stats_record_since(fCaptureStage, info.capture_ns);
+			}
 			nextTask() = envir().taskScheduler().scheduleDelayedTask(fDurationInMicroseconds, (TaskFunc*)FramedSource::afterGetting, this);
 		}
 		else
 		{
-			SC_LOGI("shm_id: %s, shm_name: %s, other nal_unit_type %d\n", fShmId, fShmName, nalu.nal_unit_type);
-			fNaluLen = 0;
-			shm_stream_post(fShmSource);
-			fDurationInMicroseconds = 1000 * 2;
+			SC_LOGI("shm_id: %s, shm_name: %s, other nal_unit_type %d\n", fShmId, fShmName, nalu->nal_unit_type);
+			if (lastNalu)
+			{
+				shm_stream_post(fShmSource);
+			}
+			fDurationInMicroseconds = fNotifyFd >= 0 ? 0 : 1000 * 2;
 			nextTask() = envir().taskScheduler().scheduleDelayedTask(fDurationInMicroseconds,
 				(TaskFunc*)incomingDataHandler, this);
 		}
 	}
 	else
 	{
-		nextTask() = envir().taskScheduler().scheduleDelayedTask(10 * 1000,
-			(TaskFunc*)incomingDataHandler, this);
+		waitForData();
 	}
-
-	time_statistics_at_ending_of_loop(&fTimeStatistics);
-	time_statistics_info_show(&fTimeStatistics, "rtsp-h265", false);
 }
@@ -26,6 +26,12 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 #include "H265VideoLiveServerMediaSubsession.hh"
 #include "H265VideoLiveDiscreteFramer.hh"
 #include "utils/utils_log.h"
+#include "rtsp_server_default_param.h"
+
+// 每个 RTP sink 一个，只指向这个 sink 自己的码流源
+struct H265KeyFrameRequest {
+	H265MainVideoSource* fSource;
+};
 
 H265VideoLiveServerMediaSubsession*
 H265VideoLiveServerMediaSubsession::createNew(UsageEnvironment& env, Boolean reuseFirstSource,
@@ -38,7 +44,7 @@ H265VideoLiveServerMediaSubsession::createNew(UsageEnvironment& env, Boolean reu
 H265VideoLiveServerMediaSubsession::H265VideoLiveServerMediaSubsession(UsageEnvironment& env, Boolean reuseFirstSource,
 char *shmId, char *shmName, int streamBufSize, int frameRate,
 	int buffer_region_size, int buffer_item_count)
-	: OnDemandServerMediaSubsession(env, True/*reuse the first source*/, 6970, True),
+	: OnDemandServerMediaSubsession(env, reuseFirstSource, 6970, True),
 	fAuxSDPLine(NULL), fDoneFlag(0), fDummyRTPSink(NULL) {
 	// 外部的shm参数终于传进来了，后面有时间看看怎么传递会更合适吧
 	// 使用 memcpy 函数复制字符串，并确保在目标字符串的末尾添加终止符
@@ -50,12 +56,35 @@ char *shmId, char *shmName, int streamBufSize, int frameRate,
 	fBufferRegionSize = buffer_region_size;
 	fBufferItemCount = buffer_item_count;
 	fDummyVideoSourceCount = 0;
-	SC_LOGI("media subsession created for :%s [%d:%d]", shmName, fBufferRegionSize, fBufferItemCount);
+	fKeyFrameRequests = HashTable::create(ONE_WORD_HASH_KEYS);
+
+	// 一帧码流不会超过编码器的 bitstream buffer(streamBufSize，由分辨率决定)，
+	// 也不会超过按码率计算的共享内存区域(vp_codec_get_user_buffer_param)，取较小值作为 RTP 发送缓存大小
+	fOutBufferSize = streamBufSize;
+	if (buffer_region_size > 0 && (fOutBufferSize <= 0 || buffer_region_size < fOutBufferSize))
+		fOutBufferSize = buffer_region_size;
+	if (fOutBufferSize < RTSPSERVER_MIN_OUT_BUFFER_SIZE)
+		fOutBufferSize = RTSPSERVER_MIN_OUT_BUFFER_SIZE;
+	SC_LOGI("media subsession created for :%s [%d:%d] out buffer size:%d",
+		shmName, fBufferRegionSize, fBufferItemCount, fOutBufferSize);
 }
 
 H265VideoLiveServerMediaSubsession::~H265VideoLiveServerMediaSubsession() {
 	SC_LOGI("media subsession destroyed for :%s", fShmName);
 	delete[] fAuxSDPLine;
+
+	// 码流源都关闭后表应该是空的，这里只是兜底
+	H265KeyFrameRequest* request;
+	while ((request = (H265KeyFrameRequest*)fKeyFrameRequests->RemoveNext()) != NULL)
+		delete request;
+	delete fKeyFrameRequests;
+}
+
+// createNewStreamSource 返回的是 framer，它的输入才是 H265MainVideoSource
+static H265MainVideoSource* mainVideoSource(StreamState* streamState) {
+	if (streamState == NULL || streamState->mediaSource() == NULL)
+		return NULL;
+	return (H265MainVideoSource*)((H265VideoLiveDiscreteFramer*)streamState->mediaSource())->inputSource();
 }
 
 void H265VideoLiveServerMediaSubsession::startStream(unsigned clientSessionId,
@@ -67,70 +96,21 @@ void H265VideoLiveServerMediaSubsession::startStream(unsigned clientSessionId,
 						ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
 						void* serverRequestAlternativeByteHandlerClientData) {
 
-	fVideoSource->idr();
-	//sync
-	fVideoSource->sync();
-
-	StreamState* streamState = (StreamState*)streamToken;
-	Destinations* destinations
-		= (Destinations*)(fDestinationsHashTable->Lookup((char const*)clientSessionId));
-	if (streamState != NULL)
-	{
-		streamState->startPlaying(destinations, clientSessionId,
-				      rtcpRRHandler, rtcpRRHandlerClientData,
-				      serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
-		RTPSink* rtpSink = streamState->rtpSink(); // alias
-		if (rtpSink != NULL)
-		{
-			rtpSeqNum = rtpSink->currentSeqNo();
-			rtpTimestamp = rtpSink->presetNextTimestamp();
-		}
-	}
-
-}
-
-
-void H265VideoLiveServerMediaSubsession::pauseStream(unsigned /*clientSessionId*/,
-						void* streamToken) {
-	// Pausing isn't allowed if multiple clients are receiving data from
-	// the same source:
-	if (fReuseFirstSource) return;
-
-	StreamState* streamState = (StreamState*)streamToken;
-	if (streamState != NULL) streamState->pause();
-}
-
-
-void H265VideoLiveServerMediaSubsession::seekStream(unsigned /*clientSessionId*/,
-					       void* streamToken, double& seekNPT, double streamDuration, u_int64_t& numBytes) {
-	SC_LOGI("H265VideoLiveServerMediaSubsession::seekStream1");
-	//call out size seek -- add by donyj
-
-	numBytes = 0; // by default: unknown
-
-	// Seeking isn't allowed if multiple clients are receiving data from the same source:
-	if (fReuseFirstSource) return;
-
+	// 只能操作这个客户端自己的码流源，最后创建的码流源可能属于其他客户端或者已经关闭的 SDP 探测源
 	StreamState* streamState = (StreamState*)streamToken;
-	if (streamState != NULL && streamState->mediaSource() != NULL) {
-		seekStreamSource(streamState->mediaSource(), seekNPT, streamDuration, numBytes);
-
-		streamState->startNPT() = (float)seekNPT;
-		RTPSink* rtpSink = streamState->rtpSink(); // alias
-		if (rtpSink != NULL) rtpSink->resetPresentationTimes();
+	H265MainVideoSource* videoSource = mainVideoSource(streamState);
+	if (videoSource != NULL) {
+		// 新的客户端需要尽快拿到 I 帧，多个客户端共享码流时其他客户端也会多收到一个 I 帧
+		videoSource->idr();
+		// 共享的码流(reuseFirstSource 或组播)已经在给其他客户端发送时，新客户端只是加入，
+		// 不能 sync 共享的读指针，否则其他客户端会丢帧
+		if (!streamState->isCurrentlyPlaying())
+			videoSource->sync();
 	}
-}
-
-void H265VideoLiveServerMediaSubsession::seekStream(unsigned /*clientSessionId*/,
-					       void* streamToken, char*& absStart, char*& absEnd) {
-	SC_LOGI("H265VideoLiveServerMediaSubsession::seekStream2");
-	// Seeking isn't allowed if multiple clients are receiving data from the same source:
-	if (fReuseFirstSource) return;
 
-	StreamState* streamState = (StreamState*)streamToken;
-	if (streamState != NULL && streamState->mediaSource() != NULL) {
-		seekStreamSource(streamState->mediaSource(), absStart, absEnd);
-	}
+	OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken,
+		rtcpRRHandler, rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp,
+		serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
 }
 
 
@@ -146,6 +126,13 @@ void H265VideoLiveServerMediaSubsession::afterPlayingDummy1() {
 	setDoneFlag();
 }
 
+static void requestKeyFrame(void* clientData) {
+	H265KeyFrameRequest* request = (H265KeyFrameRequest*)clientData;
+	// 丢弃的视频帧之后的 P 帧都无法解码，让编码器立即编码一个 I 帧，不用等到下一个 GOP
+	if (request != NULL && request->fSource != NULL)
+		request->fSource->idr();
+}
+
 static void checkForAuxSDPLine(void* clientData) {
 	H265VideoLiveServerMediaSubsession* subsess = (H265VideoLiveServerMediaSubsession*)clientData;
 	subsess->checkForAuxSDPLine1();
@@ -208,19 +195,19 @@ FramedSource* H265VideoLiveServerMediaSubsession::createNewStreamSource(unsigned
 
 	SC_LOGI("create stream source %s %s bitrate:%d clientSessionId:%d fDummyVideoSourceCount:%d",
 		fShmId, fShmName, estBitrate, clientSessionId, fDummyVideoSourceCount);
-	fVideoSource = H265MainVideoSource::createNew(envir(), fShmId, fShmName, fStreamBufSize, fFrameRate,
+	H265MainVideoSource* mainSource = H265MainVideoSource::createNew(envir(), fShmId, fShmName, fStreamBufSize, fFrameRate,
 		fBufferRegionSize, fBufferItemCount, is_dummy);
 
 	if(clientSessionId == 0){
 		free(fShmId_tmp);
 	}
 	estBitrate = fBufferRegionSize; // kbps, estimate
-	if (fVideoSource == NULL) {
+	if (mainSource == NULL) {
 		SC_LOGE("createNewStreamSource create video source failed.");
 		return NULL;
 	}
 
-	H265VideoLiveDiscreteFramer* videoSource = H265VideoLiveDiscreteFramer::createNew(envir(), (FramedSource*)fVideoSource);
+	H265VideoLiveDiscreteFramer* videoSource = H265VideoLiveDiscreteFramer::createNew(envir(), (FramedSource*)mainSource);
 	if (videoSource == NULL) {
 		SC_LOGE("createNewStreamSource create discrete framer failed.");
 		return NULL;
@@ -230,7 +217,35 @@ FramedSource* H265VideoLiveServerMediaSubsession::createNewStreamSource(unsigned
 
 RTPSink* H265VideoLiveServerMediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock,
 		unsigned char rtpPayloadTypeIfDynamic,
-		FramedSource* /*inputSource*/)
+		FramedSource* inputSource)
 {
-	return H265VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
+	H265VideoRTPSink* rtpSink = H265VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
+	if (rtpSink != NULL) {
+		rtpSink->setOutBufferSize(fOutBufferSize);
+		// inputSource 是 createNewStreamSource 返回的 framer，请求 I 帧要发给它的输入
+		H265MainVideoSource* mainSource = (H265MainVideoSource*)((H265VideoLiveDiscreteFramer*)inputSource)->inputSource();
+		H265KeyFrameRequest* request = (H265KeyFrameRequest*)fKeyFrameRequests->Lookup((char const*)mainSource);
+		if (request == NULL) {
+			request = new H265KeyFrameRequest;
+			request->fSource = mainSource;
+			fKeyFrameRequests->Add((char const*)mainSource, request);
+		}
+		rtpSink->setKeyFrameRequestHandler(requestKeyFrame, request);
+	}
+	return rtpSink;
+}
+
+void H265VideoLiveServerMediaSubsession::closeStreamSource(FramedSource* inputSource) {
+	// StreamState::reclaim() 和 sdpLines() 都是先关闭 RTP sink 再关闭码流源，
+	// 这时已经没有 sink 会再调用 requestKeyFrame，可以直接释放
+	if (inputSource != NULL) {
+		FramedSource* mainSource = ((H265VideoLiveDiscreteFramer*)inputSource)->inputSource();
+		H265KeyFrameRequest* request = (H265KeyFrameRequest*)fKeyFrameRequests->Lookup((char const*)mainSource);
+		if (request != NULL) {
+			request->fSource = NULL;
+			fKeyFrameRequests->Remove((char const*)mainSource);
+			delete request;
+		}
+	}
+	OnDemandServerMediaSubsession::closeStreamSource(inputSource);
 }
@@ -24,6 +24,7 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 #include "uLawAudioFilter.hh"
 
 #include "utils/utils_log.h"
+#include "rtsp_server_default_param.h"
 
 static unsigned const samplingFrequencyTable[16] =
 {
@@ -45,7 +46,7 @@ LPCMAudioLiveServerMediaSubsession::LPCMAudioLiveServerMediaSubsession(UsageEnvi
 		u_int8_t bitsPerSample, 
 		u_int8_t samplingFrequencyIndex, 
 		u_int8_t channelConfiguration)
-	: OnDemandServerMediaSubsession(env, True/*reuse the first source*/, 6972, True){
+	: OnDemandServerMediaSubsession(env, reuseFirstSource, 6972, True){
 	
 	fBitsPerSample = bitsPerSample;
 	fSamplingFrequencyIndex = samplingFrequencyIndex;
@@ -64,36 +65,27 @@ void LPCMAudioLiveServerMediaSubsession::startStream(unsigned clientSessionId,
 						ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
 						void* serverRequestAlternativeByteHandlerClientData) {
 
-	//sync
-	fAudioSource->sync();
-	
+	// 共享的码流(reuseFirstSource 或组播)已经在给其他客户端发送时，新客户端只是加入，
+	// 不能 sync 共享的读指针，否则其他客户端会丢帧
+	// 只能操作这个客户端自己的码流源，mediaSource() 是 EndianSwap16，它的输入才是 LPCMAudioSource
 	StreamState* streamState = (StreamState*)streamToken;
-	Destinations* destinations
-		= (Destinations*)(fDestinationsHashTable->Lookup((char const*)clientSessionId));
-	if (streamState != NULL) 
-	{
-		streamState->startPlaying(destinations, clientSessionId,
-				      rtcpRRHandler, rtcpRRHandlerClientData,
-				      serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
-		RTPSink* rtpSink = streamState->rtpSink(); // alias
-		if (rtpSink != NULL) 
-		{
-			rtpSeqNum = rtpSink->currentSeqNo();
-			rtpTimestamp = rtpSink->presetNextTimestamp();
-		}
-	}
+	if (streamState != NULL && streamState->mediaSource() != NULL && !streamState->isCurrentlyPlaying())
+		((LPCMAudioSource*)((FramedFilter*)streamState->mediaSource())->inputSource())->sync();
 
+	OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken,
+		rtcpRRHandler, rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp,
+		serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
 }
 
 
 FramedSource* LPCMAudioLiveServerMediaSubsession::createNewStreamSource(unsigned /*clientSessionId*/, unsigned& estBitrate) {
 
-	fAudioSource = LPCMAudioSource::createNew(envir(), fBitsPerSample, fSamplingFrequencyIndex, fNumChannels);
-	if (fAudioSource == NULL) return NULL;
+	LPCMAudioSource* audioSource = LPCMAudioSource::createNew(envir(), fBitsPerSample, fSamplingFrequencyIndex, fNumChannels);
+	if (audioSource == NULL) return NULL;
 
-	FramedSource* fInputSource = EndianSwap16::createNew(envir(), fAudioSource);
+	FramedSource* fInputSource = EndianSwap16::createNew(envir(), audioSource);
 	
-	unsigned bitsPerSecond = fAudioSource->samplingFrequency()*fAudioSource->bitsPerSample()*fAudioSource->numChannels();
+	unsigned bitsPerSecond = audioSource->samplingFrequency()*audioSource->bitsPerSample()*audioSource->numChannels();
 	estBitrate = (bitsPerSecond+500)/1000;; // kbps, estimate
 	
 	return fInputSource;
@@ -105,9 +97,13 @@ RTPSink* LPCMAudioLiveServerMediaSubsession::createNewRTPSink(
 	FramedSource* inputSource) 
 {
 	SC_LOGI("fSamplingFrequency:%d fNumChannels:%d", samplingFrequencyTable[fSamplingFrequencyIndex], fNumChannels);
-	return SimpleRTPSink::createNew(envir(), rtpGroupsock, 
+	SimpleRTPSink* rtpSink = SimpleRTPSink::createNew(envir(), rtpGroupsock, 
 		11, 
 		samplingFrequencyTable[fSamplingFrequencyIndex], 
 		"audio", "L16", 
 		fNumChannels, False);//for test
+	// 音频帧很小，不需要和视频一样大的发送缓存
+	if (rtpSink != NULL)
+		rtpSink->setOutBufferSize(RTSPSERVER_AUDIO_OUT_BUFFER_SIZE);
+	return rtpSink;
 }
@@ -1,19 +1,18 @@
 #include "RtspSvr.hh"
+#include "GroupsockHelper.hh"
 #include <sched.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
 #include <sys/prctl.h>
 #include "utils/utils_log.h"
 #include "utils/common_utils.h"
-#include "rtsp_server_default_param.h"
+
+// 接收线程等待客户端第一行请求的重试间隔和超时时间
+#define RTSPSERVER_PEEK_RETRY_MS	10
+#define RTSPSERVER_PEEK_TIMEOUT_MS	10000
 
 CRtspServer* CRtspServer::instance = NULL;
 
-static int const samplingFrequencyTable[16] =
-{
-	96000, 88200, 64000, 48000,
-	44100, 32000, 24000, 22050,
-	16000, 12000, 11025, 8000,
-	7350, 0, 0, 0
-};
 static int StringCopyWithCheck(char *dst, const char *src, int dst_len){
 
 	int src_len = strlen(src) + 1;
@@ -26,39 +25,6 @@ static int StringCopyWithCheck(char *dst, const char *src, int dst_len){
 
 	return 0;
 }
-static bool CheckAsyncProcessSmsIsComplete(cqueue *queue){
-	int check_period_ms = 100;
-	//等待1s 查询是否删除完毕
-	for(int i = 0; i< 10; i++){
-		if(i == 0){
-			usleep(1 * 1000); //wait 1ms
-		}else{
-			usleep(check_period_ms * 1000); //wait 100ms
-		}
-		int is_empty = cqueue_is_empty(queue);
-		if(is_empty){
-			SC_LOGI("rtsp server sms async process consumed %d ms", check_period_ms * i + 1);
-			return true;
-		}
-	}
-	return false;
-}
-
-static int GetSamplingFrequencyIndex(int sampleate)
-{
-	int index = 0;
-	unsigned int i = 0;
-	for(i = 0; i < ARRAY_SIZE(samplingFrequencyTable); i++)
-	{
-		if(samplingFrequencyTable[i] == sampleate)
-		{
-			index = i;
-			break;
-		}
-	}
-
-	return index;
-}
 
 CRtspServer* CRtspServer::GetInstance()
 {
@@ -71,18 +37,24 @@ CRtspServer* CRtspServer::GetInstance()
 }
 
 CRtspServer::CRtspServer()
-	:m_Stop(true),m_watchVariable(0),m_scheduler(NULL),m_env(NULL),
-	m_rtspServer(NULL),m_pThread(0)
+	:m_Stop(true),m_port(0),m_worker_threads(1),m_use_epoll(true),m_watchVariable(0),
+	m_scheduler(NULL),m_env(NULL),m_pThread(0),m_listen_sock(-1),m_wake_fd(-1),
+	m_pending_conns(NULL),m_authDB(NULL),m_acceptor_state(0),m_owner_count(0),
+	m_reuse_source(true),m_multicast(false),m_multicast_addr(0),
+	m_multicast_port(RTSPSERVER_MULTICAST_PORT),m_multicast_ttl(RTSPSERVER_MULTICAST_TTL),
+	m_multicast_index(0)
 {
-
+	memset(m_workers, 0, sizeof(m_workers));
+	pthread_mutex_init(&m_owner_lock, NULL);
 }
 
 CRtspServer::~CRtspServer()
 {
-	if(m_env == NULL && m_scheduler == NULL)
+	if(m_env != NULL && m_scheduler != NULL)
 	{
 		Destory();
 	}
+	pthread_mutex_destroy(&m_owner_lock);
 }
 
 void * CRtspServer::ThreadRtspServerProcImpl(void* arg)
@@ -94,33 +66,89 @@ void * CRtspServer::ThreadRtspServerProcImpl(void* arg)
 	return NULL;
 }
 
+// 接收线程: 只负责 accept 和读取第一行请求，然后把连接交给码流所属的工作线程
 void CRtspServer::ThreadRtspServer()
 {
-	/*Boolean reuseFirstSource = False;*/
+	prctl(PR_SET_NAME, "rtsp acceptor");
 
-	UserAuthenticationDatabase* authDB = NULL;
-#ifdef ACCESS_CONTROL
-	authDB = new UserAuthenticationDatabase;
-	authDB->addUserRecord("admin", "admin123"); // replace these with real strings
-#endif
+	Port port(m_port);
+	m_listen_sock = CRtspWorkerServer::SetUpListenSocket(*m_env, port);
+	if(m_listen_sock < 0)
+	{
+		SC_LOGE("rtsp acceptor listen error, port:%d, %s", m_port, m_env->getResultMsg());
+		m_acceptor_state = -1;
+		return;
+	}
+	m_env->taskScheduler().turnOnBackgroundReadHandling(m_listen_sock, IncomingConnectionHandler, this);
 
-	prctl(PR_SET_NAME, "rtsp server");
+	SC_LOGI("CRtspServer Start At Port: %d, %d worker threads", m_port, m_worker_threads);
+	m_acceptor_state = 1;
+	m_env->taskScheduler().doEventLoop(&m_watchVariable);
+}
 
-	do{
-		portNumBits rtspServerPortNum = m_port;
-		m_rtspServer = RTSPServer::createNew(*m_env, rtspServerPortNum, authDB);
-		if (m_rtspServer == NULL) {
-			SC_LOGE("m_rtspServer create error, port:%d", rtspServerPortNum);
-			break;
-		}
-		SC_LOGI("CRtspServer Start At Port: %d", m_port);
-		m_Stop = false;
-		m_env->taskScheduler().doEventLoop(&m_watchVariable); // does not return
-	}while(0);
+bool CRtspServer::SetWorkerThreads(int workerThreads)
+{
+	if(m_env != NULL)
+	{
+		SC_LOGE("CRtspServer is already Create yet, worker threads can't be changed");
+		return false;
+	}
 
-#ifdef ACCESS_CONTROL
-	delete authDB;
-#endif
+	if(workerThreads <= 0)
+		workerThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(workerThreads <= 0)
+		workerThreads = 1;
+	if(workerThreads > RTSPSERVER_MAX_WORKERS)
+		workerThreads = RTSPSERVER_MAX_WORKERS;
+	m_worker_threads = workerThreads;
+
+	return true;
+}
+
+bool CRtspServer::SetEpoll(bool useEpoll)
+{
+	if(m_env != NULL)
+	{
+		SC_LOGE("CRtspServer is already Create yet, scheduler can't be changed");
+		return false;
+	}
+
+	m_use_epoll = useEpoll;
+	return true;
+}
+
+bool CRtspServer::SetTcpSendQueue(int sizeKB)
+{
+	if(m_env != NULL)
+	{
+		SC_LOGE("CRtspServer is already Create yet, tcp send queue can't be changed");
+		return false;
+	}
+
+	// 所有工作线程共用这两个设置，只能在工作线程启动之前修改
+	RTPInterface::tcpSendQueueMaxSize = sizeKB * 1024;
+	RTPInterface::setTCPSendQueueReportFunc(ReportTcpSendQueue);
+	return true;
+}
+
+// 在工作线程里调用: 客户端开始整个 GOP 丢帧时(最多 10s 一次)，以及丢过包的连接关闭时
+void CRtspServer::ReportTcpSendQueue(int socketNum, TCPSendQueueStats const& stats)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	char ip[INET_ADDRSTRLEN] = "unknown";
+	int port = 0;
+	if(getpeername(socketNum, (struct sockaddr*)&addr, &len) == 0)
+	{
+		inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+		port = ntohs(addr.sin_port);
+	}
+
+	SC_LOGW("rtp over tcp client %s:%d too slow, queue %u bytes %u packets (max %u bytes), "
+		"dropped non-ref %u gop %u other %u packets, idr requests %u",
+		ip, port, stats.queuedBytes, stats.queuedPackets, stats.maxQueuedBytes,
+		stats.numDroppedNonRefPackets, stats.numDroppedGOPPackets, stats.numDroppedOtherPackets,
+		stats.numKeyFrameRequests);
 }
 
 bool CRtspServer::Create(portNumBits port)
@@ -135,16 +163,35 @@ bool CRtspServer::Create(portNumBits port)
 		SC_LOGE("CRtspServer is already Create yet");
 		return false;
 	}
-	cqueue_init(&m_sms_action_queue);
-	m_scheduler = BasicTaskScheduler::createNew();
+	m_scheduler = CRtspWorker::CreateScheduler(m_use_epoll);
 	m_env = BasicUsageEnvironment::createNew(*m_scheduler);
-	m_process_sms = m_env->taskScheduler().createEventTrigger(AsyncProcessSms);
-	if(m_process_sms == 0){
-		SC_LOGE("CRtspServer user event create faield.");
+	m_pending_conns = HashTable::create(ONE_WORD_HASH_KEYS);
+	m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(m_wake_fd < 0){
+		SC_LOGE("CRtspServer eventfd failed, %s", strerror(errno));
 		return false;
 	}
+	m_scheduler->turnOnBackgroundReadHandling(m_wake_fd, WakeHandler, this);
+	// 本机地址由 groupsock 缓存在全局变量中，在工作线程启动之前确定下来
+	ourIPAddress(*m_env);
 
-	SC_LOGI("CRtspServer created, live555 user event id [%x]", m_process_sms);
+#ifdef ACCESS_CONTROL
+	m_authDB = new UserAuthenticationDatabase;
+	m_authDB->addUserRecord("admin", "admin123"); // replace these with real strings
+#endif
+
+	for(int i = 0; i < m_worker_threads; i++)
+	{
+		m_workers[i] = new CRtspWorker(i, m_port);
+		if(!m_workers[i]->Create(m_worker_threads == 1, m_use_epoll, m_authDB))
+		{
+			SC_LOGE("CRtspServer create worker %d failed.", i);
+			return false;
+		}
+	}
+
+	SC_LOGI("CRtspServer created, %d worker threads, %s", m_worker_threads,
+		m_use_epoll ? "epoll" : "select");
 	return true;
 }
 
@@ -161,6 +208,20 @@ bool CRtspServer::Destory()
 		return false;
 	}
 
+	for(int i = 0; i < RTSPSERVER_MAX_WORKERS; i++)
+	{
+		delete m_workers[i]; m_workers[i] = NULL;
+	}
+#ifdef ACCESS_CONTROL
+	delete m_authDB; m_authDB = NULL;
+#endif
+
+	if(m_wake_fd >= 0)
+	{
+		m_scheduler->turnOffBackgroundReadHandling(m_wake_fd);
+		close(m_wake_fd); m_wake_fd = -1;
+	}
+	delete m_pending_conns; m_pending_conns = NULL;
 	m_env->reclaim(); m_env = NULL;
     delete m_scheduler; m_scheduler = NULL;
 
@@ -182,15 +243,37 @@ bool CRtspServer::Start()
 		return false;
 	}
 
-	m_watchVariable = 0;
-	if(pthread_create(&m_pThread,NULL, ThreadRtspServerProcImpl, this))
+	for(int i = 0; i < m_worker_threads; i++)
 	{
-		SC_LOGE("ThreadRtspServerProcImpl false!\n");
-		return false;
+		if(!m_workers[i]->Start())
+		{
+			while(--i >= 0) m_workers[i]->Stop();
+			return false;
+		}
 	}
 
-	// 等待线程执行完成，代表rtsp server已经启动完成
-	while(m_Stop) usleep(5);
+	if(m_worker_threads > 1)
+	{
+		m_watchVariable = 0;
+		m_acceptor_state = 0;
+		if(pthread_create(&m_pThread,NULL, ThreadRtspServerProcImpl, this))
+		{
+			SC_LOGE("ThreadRtspServerProcImpl false!\n");
+			for(int i = 0; i < m_worker_threads; i++) m_workers[i]->Stop();
+			return false;
+		}
+
+		// 等待线程执行完成，代表rtsp server已经启动完成
+		while(m_acceptor_state == 0) usleep(5);
+		if(m_acceptor_state != 1)
+		{
+			::pthread_join(m_pThread, 0);
+			m_pThread = 0;
+			for(int i = 0; i < m_worker_threads; i++) m_workers[i]->Stop();
+			return false;
+		}
+	}
+	m_Stop = false;
 
 	return true;
 }
@@ -203,10 +286,33 @@ bool CRtspServer::Stop()
 		return false;
 	}
 
-	m_watchVariable = 1;
-	::pthread_join(m_pThread, 0);
-	m_pThread = 0;
-	Medium::close(m_rtspServer); m_rtspServer = NULL;
+	// 先停止接收线程，不再有新的连接转交给工作线程
+	if(m_worker_threads > 1)
+	{
+		m_watchVariable = 1;
+		uint64_t one = 1;
+		if(write(m_wake_fd, &one, sizeof(one)) < 0)
+			SC_LOGW("CRtspServer wake acceptor failed, %s", strerror(errno));
+		::pthread_join(m_pThread, 0);
+		m_pThread = 0;
+
+		PendingConn* conn;
+		while((conn = (PendingConn*)m_pending_conns->getFirst()) != NULL)
+			ClosePendingConn(conn);
+		m_env->taskScheduler().turnOffBackgroundReadHandling(m_listen_sock);
+		::closeSocket(m_listen_sock); m_listen_sock = -1;
+		m_acceptor_state = 0;
+	}
+
+	for(int i = 0; i < m_worker_threads; i++)
+	{
+		m_workers[i]->Stop();
+	}
+	pthread_mutex_lock(&m_owner_lock);
+	m_owner_count = 0;
+	pthread_mutex_unlock(&m_owner_lock);
+	// 所有 RTP sink 都已经释放，把缓存池中空闲的缓存还给系统
+	OutPacketBuffer::releaseCachedBuffers();
 	m_Stop = true;
 
 	return true;
@@ -248,10 +354,7 @@ bool CRtspServer::DynamicAddSms(const char* streamName,
 bool CRtspServer::DynamicDelSms(const char* streamName)
 {
 	SC_LOGI("Del sms <%s>.", streamName);
-	ServerMediaSession* sms = m_rtspServer->lookupServerMediaSession(streamName);
-	Boolean const smsExists = (sms != NULL);
-
-	if (smsExists) {
+	if (LookupOwner(streamName, true) >= 0) {
 		bool is_ok = DynamicProcessSmsCommonProcess(0, streamName,
 			false, 0, 0, 0,
 			0, false, 0, 0,
@@ -270,103 +373,215 @@ bool CRtspServer::DynamicDelSms(const char* streamName)
 	return true;
 }
 
-void CRtspServer::DynamicAddSmsInternal(CRtspServer *rtsp_server, struct SmsParam *sms_param){
+bool CRtspServer::SetCastMode(bool reuseSource, bool multicast, const char* multicastAddr,
+	int multicastPort, int multicastTTL)
+{
+	netAddressBits addr = 0;
+	if(multicastAddr != NULL && multicastAddr[0] != '\0')
+	{
+		addr = our_inet_addr(multicastAddr);
+		if(!IsMulticastAddress(addr))
+		{
+			SC_LOGE("%s is not a multicast address, multicast disabled.", multicastAddr);
+			multicast = false;
+		}
+	}
 
-	Boolean reuseFirstSource = False;
-	OutPacketBuffer::maxSize = 4*1024*1024; // 此处的配置客户根据码流的分辨率和bitrate调整，避免内存浪费
+	m_reuse_source = reuseSource;
+	m_multicast = multicast;
+	m_multicast_addr = addr;
+	m_multicast_port = multicastPort;
+	m_multicast_ttl = multicastTTL;
+	SC_LOGI("rtsp server cast mode: reuse source %d, multicast %d", m_reuse_source, m_multicast);
 
-	ServerMediaSession* sms = NULL;
-	if(sms_param->videoEnable && sms_param->videoType == RTSPSRV_VIDEO_TYPE_H264)
-	{
-		sms = ServerMediaSession::createNew(*(rtsp_server->m_env),
-		sms_param->streamName, sms_param->streamName, "H.264 video elementary stream", True);
-
-		sms->addSubsession(H264VideoLiveServerMediaSubsession::createNew(*(rtsp_server->m_env),
-		 reuseFirstSource, sms_param->shmId, sms_param->shmName,
-		 sms_param->streamBufSize, sms_param->frameRate,
-		 sms_param->suggest_buffer_region_size, sms_param->suggest_buffer_item_count));
-	}else if(sms_param->videoEnable && sms_param->videoType == RTSPSRV_VIDEO_TYPE_H265){
-		sms = ServerMediaSession::createNew(*(rtsp_server->m_env),
-		 sms_param->streamName, sms_param->streamName, "H.265 video elementary stream", True);
-		sms->addSubsession(H265VideoLiveServerMediaSubsession::createNew(*(rtsp_server->m_env),
-		 reuseFirstSource, sms_param->shmId, sms_param->shmName,
-		 sms_param->streamBufSize, sms_param->frameRate,
-		 sms_param->suggest_buffer_region_size, sms_param->suggest_buffer_item_count));
-	}else{
-		SC_LOGE("Stream <%s> recv unsupport video type :%d.", sms_param->streamName, sms_param->videoType);
+	return true;
+}
+
+void CRtspServer::WakeHandler(void* param, int /*mask*/)
+{
+	CRtspServer* rtsp_server = (CRtspServer*)param;
+	uint64_t value;
+
+	// 只用来让 doEventLoop 检查 m_watchVariable
+	while(read(rtsp_server->m_wake_fd, &value, sizeof(value)) > 0);
+}
+
+void CRtspServer::IncomingConnectionHandler(void* param, int /*mask*/)
+{
+	CRtspServer* rtsp_server = (CRtspServer*)param;
+	struct sockaddr_in clientAddr;
+	SOCKLEN_T clientAddrLen = sizeof clientAddr;
+
+	int clientSocket = accept(rtsp_server->m_listen_sock, (struct sockaddr*)&clientAddr, &clientAddrLen);
+	if (clientSocket < 0) {
+		if (errno != EWOULDBLOCK)
+			SC_LOGE("rtsp acceptor accept failed, %s", strerror(errno));
 		return;
 	}
+	ignoreSigPipeOnSocket(clientSocket); // so that clients on the same host that are killed don't also kill us
+	makeSocketNonBlocking(clientSocket);
+
+	PendingConn* conn = new PendingConn;
+	conn->sock = clientSocket;
+	conn->addr = clientAddr;
+	conn->waitMs = 0;
+	conn->retryTask = NULL;
+	conn->server = rtsp_server;
+	rtsp_server->m_pending_conns->Add((char const*)conn, conn);
+	rtsp_server->m_env->taskScheduler().turnOnBackgroundReadHandling(clientSocket, PendingConnReadable, conn);
+}
 
-	if(sms_param->audioEnable)
-	{
-		int index = GetSamplingFrequencyIndex(sms_param->audioSampleRate);
-		if(sms_param->audioType == RTSPSRV_AUDIO_TYPE_LPCM)
-		{
-			sms->addSubsession(LPCMAudioLiveServerMediaSubsession::createNew(*(rtsp_server->m_env),
-			 reuseFirstSource, sms_param->audioBitPerSample, index, sms_param->audioChannels));
-		}
-		else if(sms_param->audioType == RTSPSRV_AUDIO_TYPE_PCMA)
-		{
-			sms->addSubsession(PCMAAudioLiveServerMediaSubsession::createNew(*(rtsp_server->m_env),
-			 reuseFirstSource, sms_param->audioBitPerSample, index, sms_param->audioChannels));
-		}else{
-			SC_LOGE("Stream <%s> recv unsupport audio type :%d.", sms_param->streamName, sms_param->audioType);
+void CRtspServer::PendingConnReadable(void* param, int /*mask*/)
+{
+	PendingConn* conn = (PendingConn*)param;
+	conn->server->PeekPendingConn(conn);
+}
+
+void CRtspServer::PendingConnRetry(void* param)
+{
+	PendingConn* conn = (PendingConn*)param;
+	conn->retryTask = NULL;
+	conn->server->PeekPendingConn(conn);
+}
+
+// 不取走数据，只查看第一行请求，例如:
+//   DESCRIBE rtsp://192.168.1.10:554/stream_chn0.h264 RTSP/1.0
+//   GET /stream_chn0.h264 HTTP/1.0 (RTSP over HTTP，GET 和 POST 两个连接都会交给同一个工作线程)
+void CRtspServer::PeekPendingConn(PendingConn* conn)
+{
+	char buf[512];
+	int n = recv(conn->sock, buf, sizeof(buf) - 1, MSG_PEEK);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		ClosePendingConn(conn);
+		return;
+	}
+	if (n < 0) n = 0;
+	buf[n] = '\0';
+
+	char* eol = strpbrk(buf, "\r\n");
+	if (eol == NULL && n < (int)sizeof(buf) - 1) {
+		// 第一行还没收全，数据留在 socket 里会让 select 一直返回可读，改为定时重试
+		m_env->taskScheduler().turnOffBackgroundReadHandling(conn->sock);
+		if (conn->waitMs >= RTSPSERVER_PEEK_TIMEOUT_MS) {
+			SC_LOGW("rtsp acceptor close idle connection from %s", inet_ntoa(conn->addr.sin_addr));
+			ClosePendingConn(conn);
 			return;
 		}
+		conn->waitMs += RTSPSERVER_PEEK_RETRY_MS;
+		conn->retryTask = m_env->taskScheduler().scheduleDelayedTask(
+			RTSPSERVER_PEEK_RETRY_MS * 1000, (TaskFunc*)PendingConnRetry, conn);
+		return;
+	}
+	if (eol != NULL) *eol = '\0';
+
+	// 跳过请求方法，取出 URL 中 "rtsp://host:port/" 之后的部分
+	char* url = strchr(buf, ' ');
+	char* suffix = (char*)"";
+	if (url != NULL) {
+		while (*url == ' ') ++url;
+		char* end = strchr(url, ' ');
+		if (end != NULL) *end = '\0';
+		char* scheme = strstr(url, "://");
+		if (scheme != NULL) url = strchr(scheme + 3, '/');
+		if (url != NULL) {
+			while (*url == '/') ++url;
+			suffix = url;
+		}
 	}
 
-	rtsp_server->m_rtspServer->addServerMediaSession(sms);
-
-	char* url = rtsp_server->m_rtspServer->rtspURL(sms);
-	SC_LOGI("Play <%s> stream using the URL %s", sms_param->streamName, url);
-	delete[] url;
+	// 不认识的码流(例如 "OPTIONS *")交给 0 号工作线程，由它回复 404
+	int worker = LookupOwner(suffix, false);
+	if (worker < 0) worker = 0;
 
-	return;
+	m_env->taskScheduler().turnOffBackgroundReadHandling(conn->sock);
+	m_pending_conns->Remove((char const*)conn);
+	if (!m_workers[worker]->PostConnection(conn->sock, conn->addr))
+		::closeSocket(conn->sock);
+	delete conn;
+}
 
+void CRtspServer::ClosePendingConn(PendingConn* conn)
+{
+	m_env->taskScheduler().turnOffBackgroundReadHandling(conn->sock);
+	m_env->taskScheduler().unscheduleDelayedTask(conn->retryTask);
+	m_pending_conns->Remove((char const*)conn);
+	::closeSocket(conn->sock);
+	delete conn;
 }
-void CRtspServer::DynamicDelSmsInternal(CRtspServer *rtsp_server, struct SmsParam *sms_param){
-	SC_LOGI("start delete sms:[%s].", sms_param->streamName);
-	ServerMediaSession* sms = rtsp_server->m_rtspServer->lookupServerMediaSession(sms_param->streamName);
-	if(sms != NULL){
-		rtsp_server->m_rtspServer->deleteServerMediaSession(sms);
-	}else{
-		SC_LOGE("delete sms:[%s] faild: not found.", sms_param->streamName);
+
+// exact 为 false 时 urlSuffix 是 URL 中码流名开始的部分，码流名之后可以是 "/track1" 或者 "?..."
+int CRtspServer::LookupOwner(const char* urlSuffix, bool exact)
+{
+	int worker = -1;
+	size_t matched = 0;
+
+	pthread_mutex_lock(&m_owner_lock);
+	for(int i = 0; i < m_owner_count; i++)
+	{
+		size_t len = strlen(m_owners[i].streamName);
+		if(strncmp(urlSuffix, m_owners[i].streamName, len) != 0)
+			continue;
+		char next = urlSuffix[len];
+		if(next != '\0' && (exact || (next != '/' && next != '?')))
+			continue;
+		// 码流名之间有前缀关系时取最长的
+		if(worker < 0 || len > matched)
+		{
+			worker = m_owners[i].worker;
+			matched = len;
+		}
 	}
+	pthread_mutex_unlock(&m_owner_lock);
+
+	return worker;
 }
 
-void CRtspServer::AsyncProcessSms(void *param){
-	CRtspServer *rtsp_server = (CRtspServer *)param;
-	if(rtsp_server == NULL){
-		SC_LOGE("rtsp server is null.");
-		return;
-	}
+// 新码流分配给码流数最少的工作线程
+int CRtspServer::AssignOwner(const char* streamName)
+{
+	int counts[RTSPSERVER_MAX_WORKERS] = {0};
+	int worker = -1;
 
-	cqueue* c_queue = &rtsp_server->m_sms_action_queue;
-	SC_LOGI("AsyncProcessSms start.");
-	while(1){
-		//触发一次 会把之前得剩余操作都完成
-		if(cqueue_is_empty(c_queue)){
+	pthread_mutex_lock(&m_owner_lock);
+	for(int i = 0; i < m_owner_count; i++)
+	{
+		if(strcmp(m_owners[i].streamName, streamName) == 0)
+		{
+			worker = m_owners[i].worker;
 			break;
 		}
-		void *queue_node = cqueue_dequeue(c_queue);
-		if(queue_node == NULL){
-			SC_LOGE("smsparam is null.");
-			continue;
+		counts[m_owners[i].worker]++;
+	}
+	if(worker < 0 && m_owner_count < RTSPSERVER_MAX_SMS)
+	{
+		worker = 0;
+		for(int i = 1; i < m_worker_threads; i++)
+		{
+			if(counts[i] < counts[worker])
+				worker = i;
 		}
+		snprintf(m_owners[m_owner_count].streamName, sizeof(m_owners[m_owner_count].streamName),
+			"%s", streamName);
+		m_owners[m_owner_count].worker = worker;
+		m_owner_count++;
+	}
+	pthread_mutex_unlock(&m_owner_lock);
 
-		SmsParam *sms_param = (SmsParam *)queue_node;
-		if(sms_param->actionType == 0){
-			DynamicDelSmsInternal(rtsp_server, sms_param);
-		}else if(sms_param->actionType == 1){
-			DynamicAddSmsInternal(rtsp_server, sms_param);
-		}else{
-			SC_LOGE("unsupport action type %d, so ignore it .", sms_param->actionType);
-		}
+	return worker;
+}
 
-		//必须释放
-		free(queue_node);
+void CRtspServer::RemoveOwner(const char* streamName)
+{
+	pthread_mutex_lock(&m_owner_lock);
+	for(int i = 0; i < m_owner_count; i++)
+	{
+		if(strcmp(m_owners[i].streamName, streamName) == 0)
+		{
+			m_owners[i] = m_owners[--m_owner_count];
+			break;
+		}
 	}
-	SC_LOGI("AsyncProcessSms end.");
+	pthread_mutex_unlock(&m_owner_lock);
 }
 
 bool CRtspServer::DynamicProcessSmsCommonProcess(int actionType, const char*streamName,
@@ -375,10 +590,10 @@ bool CRtspServer::DynamicProcessSmsCommonProcess(int actionType, const char*stre
 	char *shmId, char *shmName, int streamBufSize, int frameRate,
 	int suggest_buffer_region_size, int suggest_buffer_item_count){
 
-	//异步得方式：删除sms
+	//异步得方式：由码流所属的工作线程添加/删除sms
 	SmsParam *sms_param = (SmsParam *)malloc(sizeof(SmsParam));
 	if(sms_param == NULL){
-		SC_LOGE("Stop <%s> stream failed, malloc failed, so ignore it.");
+		SC_LOGE("Stop <%s> stream failed, malloc failed, so ignore it.", streamName);
 		return false;
 	}
 
@@ -410,19 +625,39 @@ bool CRtspServer::DynamicProcessSmsCommonProcess(int actionType, const char*stre
 	sms_param->frameRate = frameRate;
 	sms_param->suggest_buffer_item_count = suggest_buffer_item_count;
 	sms_param->suggest_buffer_region_size = suggest_buffer_region_size;
+	sms_param->reuseSource = m_reuse_source;
+	sms_param->multicast = m_multicast;
+	sms_param->multicastAddr = m_multicast_addr;
+	sms_param->multicastTTL = m_multicast_ttl;
+	// 每路码流使用 4 个端口: 视频和音频各一对 RTP/RTCP
+	sms_param->multicastPort = m_multicast_port;
+	if(actionType == 1 && m_multicast)
+		sms_param->multicastPort += 4 * (m_multicast_index++ % RTSPSERVER_MULTICAST_MAX_STREAMS);
+
+	int worker;
+	if(actionType == 1)
+		worker = AssignOwner(sms_param->streamName);
+	else
+		worker = LookupOwner(sms_param->streamName, true);
+	if(worker < 0){
+		free(sms_param);
+		SC_LOGE("Stream <%s> has no worker, at most %d streams.", streamName, RTSPSERVER_MAX_SMS);
+		return false;
+	}
 
-	int ret = cqueue_enqueue(&m_sms_action_queue, sms_param);
-	if(ret != 0){
+	if(!m_workers[worker]->PostSms(sms_param)){
 		free(sms_param);
-		SC_LOGE("enqueue faild: %d.", ret);
+		if(actionType == 1)
+			RemoveOwner(streamName);
 		return false;
 	}
-	m_env->taskScheduler().triggerEvent(m_process_sms, this);
+	if(actionType == 0)
+		RemoveOwner(streamName);
 
 	//check for debug
-	bool is_completed = CheckAsyncProcessSmsIsComplete(&m_sms_action_queue);
+	bool is_completed = m_workers[worker]->WaitSmsComplete();
 	if(!is_completed){
-		SC_LOGW("rtsp server sms async process del sms not completed.");
+		SC_LOGW("rtsp server sms async process not completed.");
 	}
 	return true;
-}
\ No newline at end of file
+}
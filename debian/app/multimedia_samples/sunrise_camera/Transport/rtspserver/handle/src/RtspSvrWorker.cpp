@@ -0,0 +1,446 @@
+#include "RtspSvrWorker.hh"
+#include "GroupsockHelper.hh"
+#include "EpollTaskScheduler.hh"
+#include "H264VideoLiveServerMediaSubsession.hh"
+#include "H265VideoLiveServerMediaSubsession.hh"
+#include "LPCMAudioLiveServerMediaSubsession.hh"
+#include "PCMAAudioLiveServerMediaSubsession.hh"
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include "utils/utils_log.h"
+#include "utils/common_utils.h"
+#include "rtsp_server_default_param.h"
+
+static int const samplingFrequencyTable[16] =
+{
+	96000, 88200, 64000, 48000,
+	44100, 32000, 24000, 22050,
+	16000, 12000, 11025, 8000,
+	7350, 0, 0, 0
+};
+
+static int GetSamplingFrequencyIndex(int sampleate)
+{
+	int index = 0;
+	unsigned int i = 0;
+	for(i = 0; i < ARRAY_SIZE(samplingFrequencyTable); i++)
+	{
+		if(samplingFrequencyTable[i] == sampleate)
+		{
+			index = i;
+			break;
+		}
+	}
+
+	return index;
+}
+
+////////// CRtspWorkerServer //////////
+
+CRtspWorkerServer* CRtspWorkerServer::createNew(UsageEnvironment& env, portNumBits port,
+	UserAuthenticationDatabase* authDatabase)
+{
+	return new CRtspWorkerServer(env, Port(port), authDatabase);
+}
+
+CRtspWorkerServer::CRtspWorkerServer(UsageEnvironment& env, Port port,
+	UserAuthenticationDatabase* authDatabase)
+	: RTSPServer(env, -1, port, authDatabase, 65)
+{
+}
+
+void CRtspWorkerServer::Adopt(int sock, struct sockaddr_in addr)
+{
+	// 接收线程已经设置了非阻塞和忽略 SIGPIPE
+	increaseSendBufferTo(envir(), sock, 50*1024);
+	(void)createNewClientConnection(sock, addr);
+}
+
+int CRtspWorkerServer::SetUpListenSocket(UsageEnvironment& env, Port& port)
+{
+	return setUpOurSocket(env, port);
+}
+
+////////// CRtspWorker //////////
+
+CRtspWorker::CRtspWorker(int index, portNumBits port)
+	:m_index(index),m_port(port),m_listen(false),m_authDB(NULL),m_state(0),
+	m_watchVariable(0),m_scheduler(NULL),m_env(NULL),m_rtspServer(NULL),
+	m_pThread(0),m_wake_fd(-1),m_pool_report_task(NULL),
+	m_pool_bytes_in_use(0),m_pool_bytes_cached(0)
+{
+	cqueue_init(&m_sms_queue);
+	cqueue_init(&m_conn_queue);
+}
+
+CRtspWorker::~CRtspWorker()
+{
+	if(m_env != NULL)
+	{
+		Destory();
+	}
+	cqueue_destory(&m_sms_queue);
+	cqueue_destory(&m_conn_queue);
+}
+
+TaskScheduler* CRtspWorker::CreateScheduler(bool useEpoll)
+{
+	if(useEpoll)
+	{
+		TaskScheduler* scheduler = EpollTaskScheduler::createNew();
+		if(scheduler != NULL)
+			return scheduler;
+		SC_LOGW("create epoll task scheduler failed, use select.");
+	}
+
+	return BasicTaskScheduler::createNew();
+}
+
+bool CRtspWorker::Create(bool listen, bool useEpoll, UserAuthenticationDatabase* authDB)
+{
+	if(m_env != NULL)
+	{
+		SC_LOGE("rtsp worker %d is already Create yet", m_index);
+		return false;
+	}
+
+	m_listen = listen;
+	m_authDB = authDB;
+	m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(m_wake_fd < 0)
+	{
+		SC_LOGE("rtsp worker %d eventfd failed, %s", m_index, strerror(errno));
+		return false;
+	}
+	m_scheduler = CreateScheduler(useEpoll);
+	m_env = BasicUsageEnvironment::createNew(*m_scheduler);
+	// 不用 live555 的 event trigger: triggerEvent 不是线程安全的，也不会唤醒阻塞中的 select
+	m_scheduler->turnOnBackgroundReadHandling(m_wake_fd, WakeHandler, this);
+
+	return true;
+}
+
+bool CRtspWorker::Destory()
+{
+	if(m_state == 1)
+	{
+		Stop();
+	}
+
+	if(m_env == NULL)
+	{
+		SC_LOGE("rtsp worker %d is already Destory yet, call Destory error!", m_index);
+		return false;
+	}
+
+	m_scheduler->turnOffBackgroundReadHandling(m_wake_fd);
+	close(m_wake_fd); m_wake_fd = -1;
+	m_env->reclaim(); m_env = NULL;
+	delete m_scheduler; m_scheduler = NULL;
+
+	return true;
+}
+
+void* CRtspWorker::ThreadWorkerProcImpl(void* arg)
+{
+	CRtspWorker* worker = (CRtspWorker*)arg;
+
+	worker->ThreadWorker();
+
+	return NULL;
+}
+
+void CRtspWorker::ThreadWorker()
+{
+	char name[16];
+
+	if(m_listen)
+		snprintf(name, sizeof(name), "rtsp server");
+	else
+		snprintf(name, sizeof(name), "rtsp worker%d", m_index);
+	prctl(PR_SET_NAME, name);
+
+	if(m_listen)
+		m_rtspServer = RTSPServer::createNew(*m_env, m_port, m_authDB);
+	else
+		m_rtspServer = CRtspWorkerServer::createNew(*m_env, m_port, m_authDB);
+	if (m_rtspServer == NULL) {
+		SC_LOGE("rtsp worker %d create rtsp server error, port:%d, %s",
+			m_index, m_port, m_env->getResultMsg());
+		m_state = -1;
+		return;
+	}
+
+	SC_LOGI("rtsp worker %d Start At Port: %d", m_index, m_port);
+	if(m_index == 0)
+		ReportOutBufferPool(this);
+	m_state = 1;
+	m_env->taskScheduler().doEventLoop(&m_watchVariable);
+}
+
+bool CRtspWorker::Start()
+{
+	if(m_env == NULL)
+	{
+		SC_LOGE("rtsp worker %d is not Create yet, call Create first!", m_index);
+		return false;
+	}
+
+	if(m_state == 1)
+	{
+		SC_LOGE("rtsp worker %d is already start, call Start error!", m_index);
+		return false;
+	}
+
+	m_state = 0;
+	m_watchVariable = 0;
+	if(pthread_create(&m_pThread, NULL, ThreadWorkerProcImpl, this))
+	{
+		SC_LOGE("rtsp worker %d pthread_create false!", m_index);
+		return false;
+	}
+
+	// 等待线程创建好 RTSPServer，代表该工作线程已经启动完成
+	while(m_state == 0) usleep(5);
+	if(m_state != 1)
+	{
+		::pthread_join(m_pThread, 0);
+		m_pThread = 0;
+		return false;
+	}
+
+	return true;
+}
+
+bool CRtspWorker::Stop()
+{
+	if(m_state != 1)
+	{
+		SC_LOGE("rtsp worker %d is stop, call stop error!", m_index);
+		return false;
+	}
+
+	m_watchVariable = 1;
+	uint64_t one = 1;
+	if(write(m_wake_fd, &one, sizeof(one)) < 0)
+		SC_LOGW("rtsp worker %d wake failed, %s", m_index, strerror(errno));
+	::pthread_join(m_pThread, 0);
+	m_pThread = 0;
+
+	// 线程退出前没有处理的连接直接关闭
+	void* node;
+	while((node = cqueue_dequeue(&m_conn_queue)) != NULL)
+	{
+		close(((ConnParam*)node)->sock);
+		free(node);
+	}
+	while((node = cqueue_dequeue(&m_sms_queue)) != NULL)
+		free(node);
+
+	m_env->taskScheduler().unscheduleDelayedTask(m_pool_report_task);
+	Medium::close(m_rtspServer); m_rtspServer = NULL;
+	m_state = 0;
+
+	return true;
+}
+
+bool CRtspWorker::PostSms(SmsParam* sms_param)
+{
+	int ret = cqueue_enqueue(&m_sms_queue, sms_param);
+	if(ret != 0){
+		SC_LOGE("rtsp worker %d enqueue sms faild: %d.", m_index, ret);
+		return false;
+	}
+
+	uint64_t one = 1;
+	if(write(m_wake_fd, &one, sizeof(one)) < 0)
+		SC_LOGW("rtsp worker %d wake failed, %s", m_index, strerror(errno));
+	return true;
+}
+
+bool CRtspWorker::PostConnection(int sock, struct sockaddr_in addr)
+{
+	ConnParam *conn = (ConnParam *)malloc(sizeof(ConnParam));
+	if(conn == NULL){
+		SC_LOGE("rtsp worker %d malloc connection failed.", m_index);
+		return false;
+	}
+	conn->sock = sock;
+	conn->addr = addr;
+
+	int ret = cqueue_enqueue(&m_conn_queue, conn);
+	if(ret != 0){
+		free(conn);
+		SC_LOGE("rtsp worker %d enqueue connection faild: %d.", m_index, ret);
+		return false;
+	}
+
+	uint64_t one = 1;
+	if(write(m_wake_fd, &one, sizeof(one)) < 0)
+		SC_LOGW("rtsp worker %d wake failed, %s", m_index, strerror(errno));
+	return true;
+}
+
+bool CRtspWorker::WaitSmsComplete()
+{
+	int check_period_ms = 100;
+	//等待1s 查询是否处理完毕
+	for(int i = 0; i< 10; i++){
+		if(i == 0){
+			usleep(1 * 1000); //wait 1ms
+		}else{
+			usleep(check_period_ms * 1000); //wait 100ms
+		}
+		int is_empty = cqueue_is_empty(&m_sms_queue);
+		if(is_empty){
+			SC_LOGI("rtsp worker %d sms async process consumed %d ms", m_index, check_period_ms * i + 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+void CRtspWorker::WakeHandler(void* param, int /*mask*/)
+{
+	CRtspWorker* worker = (CRtspWorker*)param;
+	uint64_t value;
+
+	while(read(worker->m_wake_fd, &value, sizeof(value)) > 0);
+	worker->ProcessQueues();
+}
+
+void CRtspWorker::ProcessQueues()
+{
+	void *queue_node;
+
+	//唤醒一次 会把之前得剩余操作都完成
+	while((queue_node = cqueue_dequeue(&m_sms_queue)) != NULL){
+		SmsParam *sms_param = (SmsParam *)queue_node;
+		if(sms_param->actionType == 0){
+			DelSms(sms_param);
+		}else if(sms_param->actionType == 1){
+			AddSms(sms_param);
+		}else{
+			SC_LOGE("unsupport action type %d, so ignore it .", sms_param->actionType);
+		}
+
+		//必须释放
+		free(queue_node);
+	}
+
+	while((queue_node = cqueue_dequeue(&m_conn_queue)) != NULL){
+		ConnParam *conn = (ConnParam *)queue_node;
+		if(m_listen)
+			close(conn->sock);
+		else
+			((CRtspWorkerServer*)m_rtspServer)->Adopt(conn->sock, conn->addr);
+		free(queue_node);
+	}
+}
+
+void CRtspWorker::AddSms(SmsParam *sms_param)
+{
+	// 共享码流源时同一路码流只有一个 shm 读端、一次 NALU 解析和 RTP 打包，
+	// 发送给所有客户端(单播时每个客户端一个目的地址，组播时一个组播地址)
+	Boolean reuseFirstSource = sms_param->reuseSource || sms_param->multicast;
+	// RTP 发送缓存的大小由各个 subsession 根据码流的分辨率和码率设置(见 createNewRTPSink)，
+	// 不再统一使用 4MB 的 OutPacketBuffer::maxSize
+
+	ServerMediaSession* sms = NULL;
+	OnDemandServerMediaSubsession* video_subsession = NULL;
+	OnDemandServerMediaSubsession* audio_subsession = NULL;
+	if(sms_param->videoEnable && sms_param->videoType == RTSPSRV_VIDEO_TYPE_H264)
+	{
+		sms = ServerMediaSession::createNew(*m_env,
+		sms_param->streamName, sms_param->streamName, "H.264 video elementary stream", True);
+
+		video_subsession = H264VideoLiveServerMediaSubsession::createNew(*m_env,
+		 reuseFirstSource, sms_param->shmId, sms_param->shmName,
+		 sms_param->streamBufSize, sms_param->frameRate,
+		 sms_param->suggest_buffer_region_size, sms_param->suggest_buffer_item_count);
+		sms->addSubsession(video_subsession);
+	}else if(sms_param->videoEnable && sms_param->videoType == RTSPSRV_VIDEO_TYPE_H265){
+		sms = ServerMediaSession::createNew(*m_env,
+		 sms_param->streamName, sms_param->streamName, "H.265 video elementary stream", True);
+		video_subsession = H265VideoLiveServerMediaSubsession::createNew(*m_env,
+		 reuseFirstSource, sms_param->shmId, sms_param->shmName,
+		 sms_param->streamBufSize, sms_param->frameRate,
+		 sms_param->suggest_buffer_region_size, sms_param->suggest_buffer_item_count);
+		sms->addSubsession(video_subsession);
+	}else{
+		SC_LOGE("Stream <%s> recv unsupport video type :%d.", sms_param->streamName, sms_param->videoType);
+		return;
+	}
+
+	if(sms_param->audioEnable)
+	{
+		int index = GetSamplingFrequencyIndex(sms_param->audioSampleRate);
+		if(sms_param->audioType == RTSPSRV_AUDIO_TYPE_LPCM)
+		{
+			audio_subsession = LPCMAudioLiveServerMediaSubsession::createNew(*m_env,
+			 reuseFirstSource, sms_param->audioBitPerSample, index, sms_param->audioChannels);
+			sms->addSubsession(audio_subsession);
+		}
+		else if(sms_param->audioType == RTSPSRV_AUDIO_TYPE_PCMA)
+		{
+			audio_subsession = PCMAAudioLiveServerMediaSubsession::createNew(*m_env,
+			 reuseFirstSource, sms_param->audioBitPerSample, index, sms_param->audioChannels);
+			sms->addSubsession(audio_subsession);
+		}else{
+			SC_LOGE("Stream <%s> recv unsupport audio type :%d.", sms_param->streamName, sms_param->audioType);
+			return;
+		}
+	}
+
+	if(sms_param->multicast)
+	{
+		// 每路码流使用 4 个端口: 视频和音频各一对 RTP/RTCP(RTCP 和 RTP 复用时只用到偶数端口)
+		netAddressBits group = sms_param->multicastAddr;
+		if(group == 0)
+			group = chooseRandomIPv4SSMAddress(*m_env);
+		portNumBits port = sms_param->multicastPort;
+		video_subsession->setMulticastDestination(group, port, sms_param->multicastTTL);
+		if(audio_subsession != NULL)
+			audio_subsession->setMulticastDestination(group, port + 2, sms_param->multicastTTL);
+
+		struct in_addr addr;
+		addr.s_addr = group;
+		SC_LOGI("Stream <%s> multicast to %s:%d ttl %d.", sms_param->streamName,
+			inet_ntoa(addr), port, sms_param->multicastTTL);
+	}
+
+	m_rtspServer->addServerMediaSession(sms);
+
+	char* url = m_rtspServer->rtspURL(sms);
+	SC_LOGI("Play <%s> stream on worker %d using the URL %s", sms_param->streamName, m_index, url);
+	delete[] url;
+}
+
+void CRtspWorker::DelSms(SmsParam *sms_param)
+{
+	SC_LOGI("start delete sms:[%s] on worker %d.", sms_param->streamName, m_index);
+	ServerMediaSession* sms = m_rtspServer->lookupServerMediaSession(sms_param->streamName);
+	if(sms != NULL){
+		m_rtspServer->deleteServerMediaSession(sms);
+	}else{
+		SC_LOGE("delete sms:[%s] faild: not found.", sms_param->streamName);
+	}
+}
+
+void CRtspWorker::ReportOutBufferPool(void *param)
+{
+	CRtspWorker *worker = (CRtspWorker *)param;
+	unsigned buffers_in_use, bytes_in_use, buffers_cached, bytes_cached;
+
+	// 缓存池由所有工作线程共享，只在 0 号线程打印
+	OutPacketBuffer::getPoolStats(buffers_in_use, bytes_in_use, buffers_cached, bytes_cached);
+	if(bytes_in_use != worker->m_pool_bytes_in_use || bytes_cached != worker->m_pool_bytes_cached){
+		SC_LOGI("rtp out buffer pool: %u buffers %u KB in use, %u buffers %u KB cached.",
+			buffers_in_use, bytes_in_use / 1024, buffers_cached, bytes_cached / 1024);
+		worker->m_pool_bytes_in_use = bytes_in_use;
+		worker->m_pool_bytes_cached = bytes_cached;
+	}
+
+	worker->m_pool_report_task = worker->m_env->taskScheduler().scheduleDelayedTask(
+		RTSPSERVER_POOL_REPORT_INTERVAL_US, (TaskFunc*)ReportOutBufferPool, worker);
+}
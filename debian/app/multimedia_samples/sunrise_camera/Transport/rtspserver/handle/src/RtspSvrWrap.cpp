@@ -88,3 +88,40 @@ int rtspsvr_wrap_del_sms(void* instance, const char* streamName)
 		return -1;
 }
 
+int rtspsvr_wrap_set_cast(void* instance, int reuseSource, int multicast,
+	const char* multicastAddr, int multicastPort, int multicastTTL)
+{
+	bool result = ((CRtspServer*)instance)->SetCastMode(reuseSource, multicast,
+		multicastAddr, multicastPort, multicastTTL);
+	if(result)
+		return 0;
+	else
+		return -1;
+}
+
+int rtspsvr_wrap_set_workers(void* instance, int workerThreads)
+{
+	bool result = ((CRtspServer*)instance)->SetWorkerThreads(workerThreads);
+	if(result)
+		return 0;
+	else
+		return -1;
+}
+
+int rtspsvr_wrap_set_epoll(void* instance, int useEpoll)
+{
+	bool result = ((CRtspServer*)instance)->SetEpoll(useEpoll);
+	if(result)
+		return 0;
+	else
+		return -1;
+}
+
+int rtspsvr_wrap_set_tcp_send_queue(void* instance, int sizeKB)
+{
+	bool result = ((CRtspServer*)instance)->SetTcpSendQueue(sizeKB);
+	if(result)
+		return 0;
+	else
+		return -1;
+}
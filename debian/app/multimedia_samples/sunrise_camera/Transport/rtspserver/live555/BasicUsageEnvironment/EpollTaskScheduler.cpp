@@ -0,0 +1,299 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// Copyright (c) 1996-2019 Live Networks, Inc.  All rights reserved.
+// Basic Usage Environment: A task scheduler that uses Linux "epoll()" instead of "select()"
+// Implementation
+
+#include "EpollTaskScheduler.hh"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef MILLION
+#define MILLION 1000000
+#endif
+
+// A timer that's already armed to fire no more than this much later than needed is left alone,
+// so that we don't have to rearm it on every "SingleStep()":
+#define TIMER_SLACK_US 50
+
+// The "epoll_event" data for a socket is its socket number (low 32 bits) and the generation of
+// its handler (high 32 bits):
+#define EPOLL_DATA(socketNum, generation) ((((u_int64_t)(generation))<<32) | (u_int32_t)(socketNum))
+
+static unsigned epollEventsFor(int conditionSet) {
+  unsigned events = 0;
+  if (conditionSet&SOCKET_READABLE) events |= EPOLLIN;
+  if (conditionSet&SOCKET_WRITABLE) events |= EPOLLOUT;
+  if (conditionSet&SOCKET_EXCEPTION) events |= EPOLLPRI;
+  return events;
+}
+
+////////// EpollTaskScheduler //////////
+
+EpollTaskScheduler* EpollTaskScheduler::createNew() {
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  int eventFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+
+  do {
+    if (epollFd < 0 || timerFd < 0 || eventFd < 0) break;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.u64 = EPOLL_DATA(timerFd, 0);
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &ev) < 0) break;
+    ev.data.u64 = EPOLL_DATA(eventFd, 0);
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &ev) < 0) break;
+
+    return new EpollTaskScheduler(epollFd, timerFd, eventFd);
+  } while (0);
+
+  perror("EpollTaskScheduler::createNew() failed");
+  if (epollFd >= 0) close(epollFd);
+  if (timerFd >= 0) close(timerFd);
+  if (eventFd >= 0) close(eventFd);
+  return NULL;
+}
+
+EpollTaskScheduler::EpollTaskScheduler(int epollFd, int timerFd, int eventFd)
+  : fEpollFd(epollFd), fTimerFd(timerFd), fEventFd(eventFd), fTimerIsArmed(False),
+    fSocketHandlers(NULL), fNumSocketHandlers(0), fNumFileHandlers(0) {
+  fTimerDeadline.tv_sec = fTimerDeadline.tv_usec = 0;
+}
+
+EpollTaskScheduler::~EpollTaskScheduler() {
+  close(fEventFd);
+  close(fTimerFd);
+  close(fEpollFd);
+  delete[] fSocketHandlers;
+}
+
+void EpollTaskScheduler::armTimer(DelayInterval const& timeToDelay) {
+  struct timeval now, deadline;
+  gettimeofday(&now, NULL);
+  deadline.tv_sec = now.tv_sec + timeToDelay.seconds();
+  deadline.tv_usec = now.tv_usec + timeToDelay.useconds();
+  if (deadline.tv_usec >= MILLION) {
+    ++deadline.tv_sec;
+    deadline.tv_usec -= MILLION;
+  }
+
+  if (fTimerIsArmed) {
+    // If the timer will fire before (or only slightly after) this deadline, leave it alone.
+    // (If it fires too early - e.g., because the task that it was armed for got unscheduled -
+    //  we'll just rearm it then.)
+    int64_t late = (int64_t)(fTimerDeadline.tv_sec - deadline.tv_sec)*MILLION
+      + (fTimerDeadline.tv_usec - deadline.tv_usec);
+    if (late <= TIMER_SLACK_US) return;
+  }
+
+  struct itimerspec its;
+  memset(&its, 0, sizeof its);
+  its.it_value.tv_sec = timeToDelay.seconds();
+  its.it_value.tv_nsec = timeToDelay.useconds()*1000;
+  if (timerfd_settime(fTimerFd, 0, &its, NULL) == 0) {
+    fTimerIsArmed = True;
+    fTimerDeadline = deadline;
+  }
+}
+
+void EpollTaskScheduler::SingleStep(unsigned maxDelayTime) {
+  DelayInterval timeToDelay = fDelayQueue.timeToNextAlarm();
+  // Also check our "maxDelayTime" parameter (if it's > 0):
+  if (maxDelayTime > 0) {
+    DelayInterval const maxDelay(maxDelayTime/MILLION, maxDelayTime%MILLION);
+    if (maxDelay < timeToDelay) timeToDelay = maxDelay;
+  }
+
+  int timeoutMs = -1; // the timer (if armed) wakes us up
+  if (timeToDelay.seconds() == 0 && timeToDelay.useconds() == 0) {
+    timeoutMs = 0;
+  } else if (fNumFileHandlers > 0 || fTriggersAwaitingHandling != 0) {
+    timeoutMs = 0; // there's something to handle right away
+  } else if (timeToDelay.seconds() <= MILLION) {
+    // (Otherwise there's no delayed task; a very large delay means 'wait forever'.)
+    armTimer(timeToDelay);
+  }
+
+  // Note: The events are kept on the stack, in case a handler calls "doEventLoop()" reentrantly.
+  struct epoll_event events[EPOLL_TASK_SCHEDULER_MAX_EVENTS];
+  int numEvents = epoll_wait(fEpollFd, events, EPOLL_TASK_SCHEDULER_MAX_EVENTS, timeoutMs);
+  if (numEvents < 0) {
+    if (errno != EINTR && errno != EAGAIN) {
+      // Unexpected error - treat this as fatal:
+      perror("EpollTaskScheduler::SingleStep(): epoll_wait() fails");
+      internalError();
+    }
+    numEvents = 0;
+  }
+
+  // Call the handler function for each ready socket:
+  for (int i = 0; i < numEvents; ++i) {
+    int sock = (int)(u_int32_t)events[i].data.u64;
+    if (sock == fTimerFd || sock == fEventFd) {
+      u_int64_t count;
+      while (read(sock, &count, sizeof count) > 0) {}
+      if (sock == fTimerFd) fTimerIsArmed = False;
+      continue;
+    }
+    handleSocket(sock, (unsigned)(events[i].data.u64>>32), events[i].events);
+  }
+
+  // Regular files are always ready (as they would be with "select()"):
+  for (int sock = 0; fNumFileHandlers > 0 && sock < fNumSocketHandlers; ++sock) {
+    if (fSocketHandlers[sock].isFile) {
+      handleSocket(sock, fSocketHandlers[sock].generation, EPOLLIN|EPOLLOUT);
+    }
+  }
+
+  // Also handle any newly-triggered events (Note that we do this *after* calling the socket handlers,
+  // in case a triggered event handler modifies the set of readable sockets.)
+  handleTriggers();
+
+  // Also handle any delayed event that may have come due.
+  fDelayQueue.handleAlarm();
+}
+
+void EpollTaskScheduler::handleSocket(int socketNum, unsigned generation, unsigned events) {
+  if (socketNum < 0 || socketNum >= fNumSocketHandlers) return;
+
+  // Copy the handler, because the handler table may change (or move) while the handler runs:
+  SocketHandler handler = fSocketHandlers[socketNum];
+  if (handler.generation != generation || handler.conditionSet == 0 || handler.handlerProc == NULL) {
+    return; // the socket was removed (and perhaps reused) since this event was reported
+  }
+
+  int resultConditionSet = 0;
+  if (events&(EPOLLIN|EPOLLHUP|EPOLLERR)) resultConditionSet |= SOCKET_READABLE;
+  if (events&(EPOLLOUT|EPOLLERR)) resultConditionSet |= SOCKET_WRITABLE;
+  if (events&EPOLLPRI) resultConditionSet |= SOCKET_EXCEPTION;
+  resultConditionSet &= handler.conditionSet;
+  if (resultConditionSet != 0) {
+    fLastHandledSocketNum = socketNum;
+    (*handler.handlerProc)(handler.clientData, resultConditionSet);
+  }
+}
+
+void EpollTaskScheduler::handleTriggers() {
+  if (fTriggersAwaitingHandling == 0) return;
+
+  EventTriggerId triggers = __sync_fetch_and_and(&fTriggersAwaitingHandling, 0);
+  EventTriggerId mask = 0x80000000;
+  for (unsigned i = 0; i < MAX_NUM_EVENT_TRIGGERS; ++i) {
+    if ((triggers&mask) != 0 && fTriggeredEventHandlers[i] != NULL) {
+      (*fTriggeredEventHandlers[i])(fTriggeredEventClientDatas[i]);
+    }
+    mask >>= 1;
+  }
+}
+
+void EpollTaskScheduler::triggerEvent(EventTriggerId eventTriggerId, void* clientData) {
+  // First, record the "clientData".  (Note that we allow "eventTriggerId" to be a combination of bits for multiple events.)
+  EventTriggerId mask = 0x80000000;
+  for (unsigned i = 0; i < MAX_NUM_EVENT_TRIGGERS; ++i) {
+    if ((eventTriggerId&mask) != 0) {
+      fTriggeredEventClientDatas[i] = clientData;
+    }
+    mask >>= 1;
+  }
+
+  // Then, note this event as being ready to be handled, and wake up the event loop.
+  // (This may be called from an external thread.)
+  __sync_fetch_and_or(&fTriggersAwaitingHandling, eventTriggerId);
+  u_int64_t one = 1;
+  if (write(fEventFd, &one, sizeof one) < 0) {} // can fail only if the counter is saturated, which still wakes us up
+}
+
+void EpollTaskScheduler
+  ::setBackgroundHandling(int socketNum, int conditionSet, BackgroundHandlerProc* handlerProc, void* clientData) {
+  if (socketNum < 0) return;
+
+  if (conditionSet == 0) {
+    if (socketNum >= fNumSocketHandlers || fSocketHandlers[socketNum].conditionSet == 0) return;
+
+    SocketHandler& handler = fSocketHandlers[socketNum];
+    if (handler.isFile) {
+      --fNumFileHandlers;
+    } else {
+      struct epoll_event ev; // (not used, but pre-2.6.9 kernels require it)
+      epoll_ctl(fEpollFd, EPOLL_CTL_DEL, socketNum, &ev); // fails harmlessly if the socket was already closed
+    }
+    handler.conditionSet = 0;
+    handler.handlerProc = NULL;
+    handler.clientData = NULL;
+    handler.isFile = False;
+    ++handler.generation; // so that any already-reported events for this socket get ignored
+    return;
+  }
+
+  if (socketNum >= fNumSocketHandlers) {
+    // Grow the handler table:
+    int newNumSocketHandlers = fNumSocketHandlers > 0 ? 2*fNumSocketHandlers : 64;
+    while (newNumSocketHandlers <= socketNum) newNumSocketHandlers *= 2;
+    SocketHandler* newSocketHandlers = new SocketHandler[newNumSocketHandlers];
+    memset(newSocketHandlers, 0, newNumSocketHandlers*sizeof (SocketHandler));
+    if (fSocketHandlers != NULL) {
+      memcpy(newSocketHandlers, fSocketHandlers, fNumSocketHandlers*sizeof (SocketHandler));
+    }
+    delete[] fSocketHandlers;
+    fSocketHandlers = newSocketHandlers;
+    fNumSocketHandlers = newNumSocketHandlers;
+  }
+
+  SocketHandler& handler = fSocketHandlers[socketNum];
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof ev);
+  ev.events = epollEventsFor(conditionSet);
+  ev.data.u64 = EPOLL_DATA(socketNum, handler.generation);
+  if (handler.conditionSet == 0) {
+    if (epoll_ctl(fEpollFd, EPOLL_CTL_ADD, socketNum, &ev) < 0) {
+      if (errno == EPERM) {
+	// A regular file (which "epoll()" doesn't support):
+	handler.isFile = True;
+	++fNumFileHandlers;
+      } else if (errno != EEXIST || epoll_ctl(fEpollFd, EPOLL_CTL_MOD, socketNum, &ev) < 0) {
+	perror("EpollTaskScheduler::setBackgroundHandling(): epoll_ctl() fails");
+	return;
+      }
+    }
+  } else if (!handler.isFile && epollEventsFor(handler.conditionSet) != ev.events) {
+    epoll_ctl(fEpollFd, EPOLL_CTL_MOD, socketNum, &ev);
+  }
+
+  handler.conditionSet = conditionSet;
+  handler.handlerProc = handlerProc;
+  handler.clientData = clientData;
+}
+
+void EpollTaskScheduler::moveSocketHandling(int oldSocketNum, int newSocketNum) {
+  if (oldSocketNum < 0 || newSocketNum < 0) return; // sanity check
+  if (oldSocketNum >= fNumSocketHandlers || fSocketHandlers[oldSocketNum].conditionSet == 0) return;
+
+  SocketHandler handler = fSocketHandlers[oldSocketNum];
+  setBackgroundHandling(oldSocketNum, 0, NULL, NULL);
+  setBackgroundHandling(newSocketNum, handler.conditionSet, handler.handlerProc, handler.clientData);
+}
+
+#endif
@@ -0,0 +1,89 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// Copyright (c) 1996-2019 Live Networks, Inc.  All rights reserved.
+// Basic Usage Environment: A task scheduler that uses Linux "epoll()" instead of "select()"
+// C++ header
+
+#ifndef _EPOLL_TASK_SCHEDULER_HH
+#define _EPOLL_TASK_SCHEDULER_HH
+
+#ifndef _BASIC_USAGE_ENVIRONMENT0_HH
+#include "BasicUsageEnvironment0.hh"
+#endif
+
+#if defined(__linux__)
+
+#define EPOLL_TASK_SCHEDULER_MAX_EVENTS 64
+
+class EpollTaskScheduler: public BasicTaskScheduler0 {
+public:
+  static EpollTaskScheduler* createNew();
+      // Returns NULL if the kernel objects ("epoll", "timerfd", "eventfd") can't be created.
+      // Unlike "BasicTaskScheduler":
+      // - There is no "FD_SETSIZE" limit on socket numbers, and the cost of each wakeup depends
+      //   only on the number of ready sockets, not on the number (or the largest) of handled sockets.
+      // - Every ready socket is handled in each "SingleStep()", not just one.
+      // - Delayed tasks are timed by a "timerfd" (microsecond resolution), and "triggerEvent()"
+      //   wakes the event loop through an "eventfd", so no periodic 'scheduler tick' is needed,
+      //   and "triggerEvent()" may safely be called from other threads.
+      // Readiness is level-triggered (as with "select()"), because the library's socket handlers
+      // read just one packet or request per call, and rely on being called again.
+  virtual ~EpollTaskScheduler();
+
+  // Redefined virtual functions:
+  virtual void triggerEvent(EventTriggerId eventTriggerId, void* clientData = NULL);
+
+protected:
+  EpollTaskScheduler(int epollFd, int timerFd, int eventFd);
+      // called only by "createNew()"
+
+protected:
+  // Redefined virtual functions:
+  virtual void SingleStep(unsigned maxDelayTime);
+
+  virtual void setBackgroundHandling(int socketNum, int conditionSet, BackgroundHandlerProc* handlerProc, void* clientData);
+  virtual void moveSocketHandling(int oldSocketNum, int newSocketNum);
+
+private:
+  void armTimer(DelayInterval const& timeToDelay);
+  void handleSocket(int socketNum, unsigned generation, unsigned events);
+  void handleTriggers();
+
+private:
+  int fEpollFd;
+  int fTimerFd;
+  int fEventFd;
+
+  // The timer's current deadline (if "fTimerIsArmed"):
+  Boolean fTimerIsArmed;
+  struct timeval fTimerDeadline;
+
+  // Socket handlers, indexed by socket number:
+  struct SocketHandler {
+    int conditionSet; // 0 if none
+    BackgroundHandlerProc* handlerProc;
+    void* clientData;
+    unsigned generation; // changes whenever the socket is removed, so that stale events get ignored
+    Boolean isFile; // regular files can't be used with "epoll()"; they're always treated as ready
+  };
+  SocketHandler* fSocketHandlers;
+  int fNumSocketHandlers; // the size of the "fSocketHandlers" array
+  unsigned fNumFileHandlers;
+};
+
+#endif
+
+#endif
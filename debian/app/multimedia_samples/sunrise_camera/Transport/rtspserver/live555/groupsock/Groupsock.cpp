@@ -31,12 +31,14 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 
 OutputSocket::OutputSocket(UsageEnvironment& env)
   : Socket(env, 0 /* let kernel choose port */),
-    fSourcePort(0), fLastSentTTL(256/*hack: a deliberately invalid value*/) {
+    fSourcePort(0), fLastSentTTL(256/*hack: a deliberately invalid value*/),
+    fCanSendBatches(True), fHaveCheckedGSO(False), fUseGSO(False) {
 }
 
 OutputSocket::OutputSocket(UsageEnvironment& env, Port port)
   : Socket(env, port),
-    fSourcePort(0), fLastSentTTL(256/*hack: a deliberately invalid value*/) {
+    fSourcePort(0), fLastSentTTL(256/*hack: a deliberately invalid value*/),
+    fCanSendBatches(True), fHaveCheckedGSO(False), fUseGSO(False) {
 }
 
 OutputSocket::~OutputSocket() {
@@ -68,6 +70,41 @@ Boolean OutputSocket::write(netAddressBits address, portNumBits portNum, u_int8_
   return True;
 }
 
+Boolean OutputSocket::writeBatch(netAddressBits address, portNumBits portNum, u_int8_t ttl,
+				 unsigned char* const* packets, unsigned const* packetSizes, unsigned numPackets) {
+  unsigned numSent = 0;
+  if (numPackets == 0) return True;
+
+  if ((unsigned)ttl != fLastSentTTL || sourcePortNum() == 0) {
+    // Send the first packet normally, so that our TTL (and source port) get set up:
+    if (!write(address, portNum, ttl, packets[0], packetSizes[0])) return False;
+    numSent = 1;
+  }
+
+  if (fCanSendBatches && numSent < numPackets) {
+    if (!fHaveCheckedGSO) {
+      fUseGSO = socketSupportsGSO(socketNum());
+      fHaveCheckedGSO = True;
+    }
+
+    struct in_addr destAddr; destAddr.s_addr = address;
+    int result = writeSocketBatch(env(), socketNum(), destAddr, portNum,
+				  &packets[numSent], &packetSizes[numSent], numPackets - numSent, fUseGSO);
+    if (result < 0) {
+      fCanSendBatches = False; // from now on, send one packet at a time (below)
+    } else {
+      numSent += result;
+      if (numSent < numPackets) return False;
+    }
+  }
+
+  for (; numSent < numPackets; ++numSent) {
+    if (!write(address, portNum, ttl, packets[numSent], packetSizes[numSent])) return False;
+  }
+
+  return True;
+}
+
 // By default, we don't do reads:
 Boolean OutputSocket
 ::handleRead(unsigned char* /*buffer*/, unsigned /*bufferMaxSize*/,
@@ -303,6 +340,43 @@ Boolean Groupsock::output(UsageEnvironment& env, unsigned char* buffer, unsigned
   return False;
 }
 
+Boolean Groupsock::outputBatch(UsageEnvironment& env,
+			       unsigned char* const* packets, unsigned const* packetSizes, unsigned numPackets) {
+  if (!members().IsEmpty() || DebugLevel >= 3) {
+    // Relaying to members (and per-packet debugging output) is done by "output()", one packet at a time:
+    Boolean success = True;
+    for (unsigned i = 0; i < numPackets; ++i) {
+      if (!output(env, packets[i], packetSizes[i])) success = False;
+    }
+    return success;
+  }
+
+  do {
+    // Send all of the packets to each destination in turn:
+    Boolean writeSuccess = True;
+    for (destRecord* dests = fDests; dests != NULL; dests = dests->fNext) {
+      if (!writeBatch(dests->fGroupEId.groupAddress().s_addr, dests->fGroupEId.portNum(), dests->fGroupEId.ttl(),
+		      packets, packetSizes, numPackets)) {
+	writeSuccess = False;
+	break;
+      }
+    }
+    if (!writeSuccess) break;
+    for (unsigned i = 0; i < numPackets; ++i) {
+      statsOutgoing.countPacket(packetSizes[i]);
+      statsGroupOutgoing.countPacket(packetSizes[i]);
+    }
+    return True;
+  } while (0);
+
+  if (DebugLevel >= 0) { // this is a fatal error
+    UsageEnvironment::MsgString msg = strDup(env.getResultMsg());
+    env.setResultMsg("Groupsock write failed: ", msg);
+    delete[] (char*)msg;
+  }
+  return False;
+}
+
 Boolean Groupsock::handleRead(unsigned char* buffer, unsigned bufferMaxSize,
 			      unsigned& bytesRead,
 			      struct sockaddr_in& fromAddressAndPort) {
@@ -43,6 +43,20 @@ extern "C" int initializeWinsockIfNecessary();
 #define USE_SIGNALS 1
 #endif
 #include <stdio.h>
+#if defined(__linux__) && !defined(NO_SENDMMSG)
+// Batched sending of datagrams ("sendmmsg()", and - optionally - UDP generic segmentation offload):
+#define USE_SENDMMSG 1
+#include <netinet/udp.h>
+#ifndef NO_UDP_GSO
+#define USE_UDP_GSO 1
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 // supported by Linux kernels 4.18 and later
+#endif
+#endif
+#endif
 
 // By default, use INADDR_ANY for the sending and receiving interfaces:
 netAddressBits SendingInterfaceAddr = INADDR_ANY;
@@ -410,6 +424,110 @@ Boolean writeSocket(UsageEnvironment& env,
   return False;
 }
 
+#ifdef USE_SENDMMSG
+#define MAX_MESSAGES_PER_SENDMMSG 64 // also the maximum number of packets per "sendmmsg()" call
+#define MAX_GSO_SEGMENTS 64 // the kernel's "UDP_MAX_SEGMENTS"
+#define MAX_GSO_PAYLOAD_SIZE 65000 // leaves room for the IP and UDP headers within a 64 KByte datagram
+#endif
+
+int writeSocketBatch(UsageEnvironment& env,
+		     int socket, struct in_addr address, portNumBits portNum,
+		     unsigned char* const* packets, unsigned const* packetSizes, unsigned numPackets,
+		     Boolean& useGSO) {
+#ifdef USE_SENDMMSG
+  MAKE_SOCKADDR_IN(dest, address.s_addr, portNum);
+  struct mmsghdr msgs[MAX_MESSAGES_PER_SENDMMSG];
+  struct iovec iovs[MAX_MESSAGES_PER_SENDMMSG];
+#ifdef USE_UDP_GSO
+  union {
+    char buf[CMSG_SPACE(sizeof (u_int16_t))];
+    struct cmsghdr align;
+  } controls[MAX_MESSAGES_PER_SENDMMSG];
+#else
+  useGSO = False;
+#endif
+  unsigned numPacketsSent = 0;
+
+  while (numPacketsSent < numPackets) {
+    // Build up to MAX_MESSAGES_PER_SENDMMSG messages.  With GSO, each message carries a run of
+    // packets of the same size (the last of which may be shorter), one "iovec" per packet:
+    unsigned numMsgs = 0, numIovs = 0;
+    unsigned i = numPacketsSent;
+    while (i < numPackets && numIovs < MAX_MESSAGES_PER_SENDMMSG) {
+      struct msghdr& hdr = msgs[numMsgs].msg_hdr;
+      memset(&hdr, 0, sizeof hdr);
+      hdr.msg_name = &dest;
+      hdr.msg_namelen = sizeof dest;
+      hdr.msg_iov = &iovs[numIovs];
+
+      unsigned const segmentSize = packetSizes[i];
+      unsigned numSegments = 0, payloadSize = 0;
+      do {
+	iovs[numIovs].iov_base = packets[i];
+	iovs[numIovs].iov_len = packetSizes[i];
+	payloadSize += packetSizes[i];
+	++numIovs; ++numSegments;
+	if (packetSizes[i++] < segmentSize) break; // a shorter packet ends the run
+      } while (useGSO && i < numPackets && numIovs < MAX_MESSAGES_PER_SENDMMSG
+	       && numSegments < MAX_GSO_SEGMENTS && packetSizes[i] <= segmentSize
+	       && payloadSize + packetSizes[i] <= MAX_GSO_PAYLOAD_SIZE);
+      hdr.msg_iovlen = numSegments;
+
+#ifdef USE_UDP_GSO
+      if (numSegments > 1) {
+	hdr.msg_control = controls[numMsgs].buf;
+	hdr.msg_controllen = sizeof controls[numMsgs].buf;
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof (u_int16_t));
+	u_int16_t gsoSize = (u_int16_t)segmentSize;
+	memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof gsoSize);
+      }
+#endif
+      ++numMsgs;
+    }
+
+    unsigned numMsgsSent = 0;
+    while (numMsgsSent < numMsgs) {
+      int result = sendmmsg(socket, &msgs[numMsgsSent], numMsgs - numMsgsSent, 0);
+      if (result < 0) {
+	if (errno == EINTR) continue;
+	if (errno == ENOSYS && numPacketsSent == 0) return -1; // no "sendmmsg()" in this kernel
+	if (useGSO && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+	  // The kernel (or the outgoing device) can't segment for us.  Stop using GSO, and
+	  // rebuild the remaining messages with one packet each:
+	  useGSO = False;
+	  break;
+	}
+	char tmpBuf[100];
+	sprintf(tmpBuf, "writeSocketBatch(%d), sendmmsg() error: sent %u of %u packets: ", socket, numPacketsSent, numPackets);
+	socketErr(env, tmpBuf);
+	return numPacketsSent;
+      }
+
+      for (int j = 0; j < result; ++j) numPacketsSent += msgs[numMsgsSent + j].msg_hdr.msg_iovlen;
+      numMsgsSent += result;
+    }
+  }
+
+  return numPacketsSent;
+#else
+  useGSO = False;
+  return -1;
+#endif
+}
+
+Boolean socketSupportsGSO(int socket) {
+#ifdef USE_UDP_GSO
+  int gsoSize = 0;
+  SOCKLEN_T optLen = sizeof gsoSize;
+  return getsockopt(socket, SOL_UDP, UDP_SEGMENT, (char*)&gsoSize, &optLen) == 0;
+#else
+  return False;
+#endif
+}
+
 void ignoreSigPipeOnSocket(int socketNum) {
   #ifdef USE_SIGNALS
   #ifdef SO_NOSIGPIPE
@@ -47,6 +47,9 @@ public:
 		unsigned char* buffer, unsigned bufferSize) {
     return write(addressAndPort.sin_addr.s_addr, addressAndPort.sin_port, ttl, buffer, bufferSize);
   }
+  Boolean writeBatch(netAddressBits address, portNumBits portNum/*in network order*/, u_int8_t ttl,
+		     unsigned char* const* packets, unsigned const* packetSizes, unsigned numPackets);
+      // Like "write()", but for several packets at once (using "sendmmsg()" where available)
 
 protected:
   OutputSocket(UsageEnvironment& env, Port port);
@@ -61,6 +64,8 @@ private: // redefined virtual function
 private:
   Port fSourcePort;
   unsigned fLastSentTTL;
+  Boolean fCanSendBatches; // set to False if the OS turns out not to support batched sends
+  Boolean fHaveCheckedGSO, fUseGSO;
 };
 
 class destRecord {
@@ -130,6 +135,10 @@ public:
 
   virtual Boolean output(UsageEnvironment& env, unsigned char* buffer, unsigned bufferSize,
 			 DirectedNetInterface* interfaceNotToFwdBackTo = NULL);
+  Boolean outputBatch(UsageEnvironment& env,
+		      unsigned char* const* packets, unsigned const* packetSizes, unsigned numPackets);
+      // Sends several packets - in order - to each destination.  Equivalent to calling "output()"
+      // for each packet, but with far fewer system calls.
 
   DirectedNetInterfaceSet& members() { return fMembers; }
 
@@ -43,6 +43,20 @@ Boolean writeSocket(UsageEnvironment& env,
 		    unsigned char* buffer, unsigned bufferSize);
     // An optimized version of "writeSocket" that omits the "setsockopt()" call to set the TTL.
 
+int writeSocketBatch(UsageEnvironment& env,
+		     int socket, struct in_addr address, portNumBits portNum/*network byte order*/,
+		     unsigned char* const* packets, unsigned const* packetSizes, unsigned numPackets,
+		     Boolean& useGSO);
+    // Sends "numPackets" datagrams - all to the same destination - using as few system calls
+    // as possible ("sendmmsg()").  If "useGSO" is True, then each run of equal-sized packets is
+    // handed to the kernel as a single 'UDP_SEGMENT' (generic segmentation offload) message.
+    // ("useGSO" is set to False if the kernel turns out not to support this for this socket.)
+    // Returns the number of packets that were sent, or -1 if batched sending is not supported
+    // at all (in which case the caller should use "writeSocket()" instead).
+
+Boolean socketSupportsGSO(int socket);
+    // Returns True iff the kernel supports UDP generic segmentation offload on this socket.
+
 void ignoreSigPipeOnSocket(int socketNum);
 
 unsigned getSendBufferSize(UsageEnvironment& env, int socket);
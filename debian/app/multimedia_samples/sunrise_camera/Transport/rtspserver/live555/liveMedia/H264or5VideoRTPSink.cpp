@@ -116,7 +116,7 @@ Boolean H264or5VideoRTPSink::continuePlaying() {
   // First, check whether we have a 'fragmenter' class set up yet.
   // If not, create it now:
   if (fOurFragmenter == NULL) {
-    fOurFragmenter = new H264or5Fragmenter(fHNumber, envir(), fSource, OutPacketBuffer::maxSize,
+    fOurFragmenter = new H264or5Fragmenter(fHNumber, envir(), fSource, outBufferSize(),
 					   ourMaxPacketSize() - 12/*RTP hdr size*/);
   } else {
     fOurFragmenter->reassignInputSource(fSource);
@@ -164,12 +164,12 @@ H264or5Fragmenter::H264or5Fragmenter(int hNumber,
   : FramedFilter(env, inputSource),
     fHNumber(hNumber),
     fInputBufferSize(inputBufferMax+1), fMaxOutputPacketSize(maxOutputPacketSize) {
-  fInputBuffer = new unsigned char[fInputBufferSize];
+  fInputBuffer = OutPacketBuffer::allocateBuffer(fInputBufferSize);
   reset();
 }
 
 H264or5Fragmenter::~H264or5Fragmenter() {
-  delete[] fInputBuffer;
+  OutPacketBuffer::releaseBuffer(fInputBuffer, fInputBufferSize);
   detachInputSource(); // so that the subsequent ~FramedFilter() doesn't delete it
 }
 
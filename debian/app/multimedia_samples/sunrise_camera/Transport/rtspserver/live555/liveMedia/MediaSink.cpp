@@ -21,6 +21,9 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 #include "MediaSink.hh"
 #include "GroupsockHelper.hh"
 #include <string.h>
+#ifndef NO_POOL_LOCKING
+#include <pthread.h>
+#endif
 
 ////////// MediaSink //////////
 
@@ -113,6 +116,111 @@ Boolean MediaSink::isRTPSink() const {
 // yaqiang.li 提高最大buffer size，支持高码率图像，解决马赛克问题
 unsigned OutPacketBuffer::maxSize = 600000; // by default
 
+unsigned OutPacketBuffer::maxCachedBytes = 16*1024*1024; // by default
+
+// The pool's buffer sizes: 4 sizes per power of 2 (so that rounding up wastes at most 25%),
+// from 16 KBytes to 64 MBytes.  Larger buffers are not pooled.
+#define POOL_MIN_SIZE_LOG2 14
+#define POOL_MAX_SIZE_LOG2 26
+#define POOL_NUM_SIZES ((POOL_MAX_SIZE_LOG2-POOL_MIN_SIZE_LOG2)*4 + 1)
+
+static unsigned char* poolFreeLists[POOL_NUM_SIZES]; // linked through each buffer's first bytes
+static unsigned poolNumBuffersInUse = 0, poolNumBytesInUse = 0;
+static unsigned poolNumBuffersCached = 0, poolNumBytesCached = 0;
+
+// The pool is shared by all "UsageEnvironment"s in the process, which may each run their event
+// loop in a different thread.  (Define NO_POOL_LOCKING if only one thread ever uses liveMedia.)
+#ifndef NO_POOL_LOCKING
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_POOL pthread_mutex_lock(&poolMutex)
+#define UNLOCK_POOL pthread_mutex_unlock(&poolMutex)
+#else
+#define LOCK_POOL
+#define UNLOCK_POOL
+#endif
+
+static int poolSizeIndex(unsigned& bufferSize) {
+  // Rounds "bufferSize" up to the next pool size, and returns its index (or -1 if it's too big):
+  if (bufferSize <= (1u<<POOL_MIN_SIZE_LOG2)) {
+    bufferSize = 1u<<POOL_MIN_SIZE_LOG2;
+    return 0;
+  }
+  if (bufferSize > (1u<<POOL_MAX_SIZE_LOG2)) return -1;
+
+  unsigned log2 = POOL_MIN_SIZE_LOG2;
+  while ((2u<<log2) < bufferSize) ++log2; // now 2^log2 < bufferSize <= 2^(log2+1)
+  unsigned const step = 1u<<(log2-2);
+  unsigned const numSteps = (bufferSize + step-1)/step; // 5, 6, 7 or 8
+  bufferSize = numSteps*step;
+  return (log2-POOL_MIN_SIZE_LOG2)*4 + (numSteps-4);
+}
+
+unsigned char* OutPacketBuffer::allocateBuffer(unsigned& bufferSize) {
+  unsigned char* buffer = NULL;
+  int index = poolSizeIndex(bufferSize);
+
+  LOCK_POOL;
+  if (index >= 0 && poolFreeLists[index] != NULL) {
+    buffer = poolFreeLists[index];
+    memcpy(&poolFreeLists[index], buffer, sizeof (unsigned char*));
+    --poolNumBuffersCached;
+    poolNumBytesCached -= bufferSize;
+  }
+  ++poolNumBuffersInUse;
+  poolNumBytesInUse += bufferSize;
+  UNLOCK_POOL;
+
+  if (buffer == NULL) buffer = new unsigned char[bufferSize];
+  return buffer;
+}
+
+void OutPacketBuffer::releaseBuffer(unsigned char* buffer, unsigned bufferSize) {
+  if (buffer == NULL) return;
+  int index = poolSizeIndex(bufferSize);
+
+  LOCK_POOL;
+  --poolNumBuffersInUse;
+  poolNumBytesInUse -= bufferSize;
+  if (index >= 0 && poolNumBytesCached + bufferSize <= maxCachedBytes) {
+    memcpy(buffer, &poolFreeLists[index], sizeof (unsigned char*));
+    poolFreeLists[index] = buffer;
+    ++poolNumBuffersCached;
+    poolNumBytesCached += bufferSize;
+    buffer = NULL;
+  }
+  UNLOCK_POOL;
+
+  delete[] buffer; // if it wasn't cached
+}
+
+void OutPacketBuffer::releaseCachedBuffers() {
+  unsigned char* freeLists[POOL_NUM_SIZES];
+
+  LOCK_POOL;
+  memcpy(freeLists, poolFreeLists, sizeof poolFreeLists);
+  memset(poolFreeLists, 0, sizeof poolFreeLists);
+  poolNumBuffersCached = poolNumBytesCached = 0;
+  UNLOCK_POOL;
+
+  for (unsigned i = 0; i < POOL_NUM_SIZES; ++i) {
+    while (freeLists[i] != NULL) {
+      unsigned char* buffer = freeLists[i];
+      memcpy(&freeLists[i], buffer, sizeof (unsigned char*));
+      delete[] buffer;
+    }
+  }
+}
+
+void OutPacketBuffer::getPoolStats(unsigned& numBuffersInUse, unsigned& numBytesInUse,
+				   unsigned& numBuffersCached, unsigned& numBytesCached) {
+  LOCK_POOL;
+  numBuffersInUse = poolNumBuffersInUse;
+  numBytesInUse = poolNumBytesInUse;
+  numBuffersCached = poolNumBuffersCached;
+  numBytesCached = poolNumBytesCached;
+  UNLOCK_POOL;
+}
+
 OutPacketBuffer
 ::OutPacketBuffer(unsigned preferredPacketSize, unsigned maxPacketSize, unsigned maxBufferSize)
   : fPreferred(preferredPacketSize), fMax(maxPacketSize),
@@ -120,14 +228,15 @@ OutPacketBuffer
   if (maxBufferSize == 0) maxBufferSize = maxSize;
   unsigned maxNumPackets = (maxBufferSize + (maxPacketSize-1))/maxPacketSize;
   fLimit = maxNumPackets*maxPacketSize;
-  fBuf = new unsigned char[fLimit];
+  fBufSize = fLimit;
+  fBuf = allocateBuffer(fBufSize);
   resetPacketStart();
   resetOffset();
   resetOverflowData();
 }
 
 OutPacketBuffer::~OutPacketBuffer() {
-  delete[] fBuf;
+  releaseBuffer(fBuf, fBufSize);
 }
 
 void OutPacketBuffer::enqueue(unsigned char const* from, unsigned numBytes) {
@@ -24,14 +24,30 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 
 ////////// MultiFramedRTPSink //////////
 
+#ifndef RTP_SEND_BATCH_MAX_PACKETS
+#define RTP_SEND_BATCH_MAX_PACKETS 64
+      // The maximum number of RTP packets (all from the same frame) that are sent together,
+      // using a single "sendmmsg()" call.  (Define this as 0 to send each packet as soon as it's built.)
+#endif
+
 void MultiFramedRTPSink::setPacketSizes(unsigned preferredPacketSize,
 					unsigned maxPacketSize) {
   if (preferredPacketSize > maxPacketSize || preferredPacketSize == 0) return;
       // sanity check
 
   delete fOutBuf;
-  fOutBuf = new OutPacketBuffer(preferredPacketSize, maxPacketSize);
+  fOutBuf = new OutPacketBuffer(preferredPacketSize, maxPacketSize, fOutBufferSize);
+  fOurPreferredPacketSize = preferredPacketSize;
   fOurMaxPacketSize = maxPacketSize; // save value, in case subclasses need it
+  fRTPInterface.setPacketBatching(maxPacketSize, RTP_SEND_BATCH_MAX_PACKETS);
+}
+
+void MultiFramedRTPSink::setOutBufferSize(unsigned bufferSize) {
+  if (bufferSize == fOutBufferSize) return;
+
+  // Replace our output buffer with one of the new size:
+  fOutBufferSize = bufferSize;
+  setPacketSizes(fOurPreferredPacketSize, fOurMaxPacketSize);
 }
 
 #ifndef RTP_PAYLOAD_MAX_SIZE
@@ -51,7 +67,8 @@ MultiFramedRTPSink::MultiFramedRTPSink(UsageEnvironment& env,
 				       unsigned numChannels)
   : RTPSink(env, rtpGS, rtpPayloadType, rtpTimestampFrequency,
 	    rtpPayloadFormatName, numChannels),
-    fOutBuf(NULL), fCurFragmentationOffset(0), fPreviousFrameEndedFragmentation(False),
+    fOutBuf(NULL), fOutBufferSize(0), fIsAwaitingFrame(False),
+    fCurFragmentationOffset(0), fPreviousFrameEndedFragmentation(False),
     fOnSendErrorFunc(NULL), fOnSendErrorData(NULL) {
   setPacketSizes((RTP_PAYLOAD_PREFERRED_SIZE), (RTP_PAYLOAD_MAX_SIZE));
 }
@@ -161,6 +178,7 @@ Boolean MultiFramedRTPSink::continuePlaying() {
 }
 
 void MultiFramedRTPSink::stopPlaying() {
+  sendQueuedPackets();
   fOutBuf->resetPacketStart();
   fOutBuf->resetOffset();
   fOutBuf->resetOverflowData();
@@ -220,8 +238,15 @@ void MultiFramedRTPSink::packFrame() {
   } else {
     // Normal case: we need to read a new frame from the source
     if (fSource == NULL) return;
+    fIsAwaitingFrame = True;
     fSource->getNextFrame(fOutBuf->curPtr(), fOutBuf->totalBytesAvailable(),
 			  afterGettingFrame, this, ourHandleClosure, this);
+    if (fIsAwaitingFrame) {
+      // The source will deliver this frame later (rather than immediately), so send the packets
+      // that we've queued now.  (While the source keeps delivering immediately - e.g., the
+      // fragments of a large NAL unit - the packets for the whole frame get sent together.)
+      sendQueuedPackets();
+    }
   }
 }
 
@@ -239,6 +264,7 @@ void MultiFramedRTPSink
 ::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
 		     struct timeval presentationTime,
 		     unsigned durationInMicroseconds) {
+  fIsAwaitingFrame = False;
   if (fIsFirstPacket) {
     // Record the fact that we're starting to play now:
     gettimeofday(&fNextSendTime, NULL);
@@ -368,7 +394,7 @@ void MultiFramedRTPSink::sendPacketIfNecessary() {
 #ifdef TEST_LOSS
     if ((our_random()%10) != 0) // simulate 10% packet loss #####
 #endif
-      if (!fRTPInterface.sendPacket(fOutBuf->packet(), fOutBuf->curPacketSize())) {
+      if (!fRTPInterface.queuePacket(fOutBuf->packet(), fOutBuf->curPacketSize())) {
 	// if failure handler has been specified, call it
 	if (fOnSendErrorFunc != NULL) (*fOnSendErrorFunc)(fOnSendErrorData);
       }
@@ -398,6 +424,7 @@ void MultiFramedRTPSink::sendPacketIfNecessary() {
 
   if (fNoFramesLeft) {
     // We're done:
+    sendQueuedPackets();
     onSourceClosure();
   } else {
     // We have more frames left to send.  Figure out when the next frame
@@ -411,11 +438,21 @@ void MultiFramedRTPSink::sendPacketIfNecessary() {
       uSecondsToGo = 0;
     }
 
+    // Don't hold queued packets while we wait:
+    if (uSecondsToGo > 0) sendQueuedPackets();
+
     // Delay this amount of time:
     nextTask() = envir().taskScheduler().scheduleDelayedTask(uSecondsToGo, (TaskFunc*)sendNext, this);
   }
 }
 
+void MultiFramedRTPSink::sendQueuedPackets() {
+  if (!fRTPInterface.flushPackets()) {
+    // if failure handler has been specified, call it
+    if (fOnSendErrorFunc != NULL) (*fOnSendErrorFunc)(fOnSendErrorData);
+  }
+}
+
 // The following is called after each delay between packet sends:
 void MultiFramedRTPSink::sendNext(void* firstArg) {
   MultiFramedRTPSink* sink = (MultiFramedRTPSink*)firstArg;
@@ -426,6 +463,7 @@ void MultiFramedRTPSink::ourHandleClosure(void* clientData) {
   MultiFramedRTPSink* sink = (MultiFramedRTPSink*)clientData;
   // There are no frames left, but we may have a partially built packet
   //  to send
+  sink->fIsAwaitingFrame = False;
   sink->fNoFramesLeft = True;
   sink->sendPacketIfNecessary();
 }
@@ -30,7 +30,8 @@ OnDemandServerMediaSubsession
   : ServerMediaSubsession(env),
     fSDPLines(NULL), fReuseFirstSource(reuseFirstSource),
     fMultiplexRTCPWithRTP(multiplexRTCPWithRTP), fLastStreamToken(NULL),
-    fAppHandlerTask(NULL), fAppHandlerClientData(NULL) {
+    fAppHandlerTask(NULL), fAppHandlerClientData(NULL),
+    fMulticastAddress(0), fMulticastRTPPortNum(0), fMulticastTTL(255) {
   fDestinationsHashTable = HashTable::create(ONE_WORD_HASH_KEYS);
   if (fMultiplexRTCPWithRTP) {
     fInitialPortNum = initialPortNum;
@@ -90,14 +91,21 @@ void OnDemandServerMediaSubsession
 		      unsigned char rtpChannelId,
 		      unsigned char rtcpChannelId,
 		      netAddressBits& destinationAddress,
-		      u_int8_t& /*destinationTTL*/,
+		      u_int8_t& destinationTTL,
 		      Boolean& isMulticast,
 		      Port& serverRTPPort,
 		      Port& serverRTCPPort,
 		      void*& streamToken) {
-  if (destinationAddress == 0) destinationAddress = clientAddress;
+  if (fMulticastAddress != 0 && tcpSocketNum < 0) {
+    // UDP clients all receive the stream from our multicast group:
+    destinationAddress = fMulticastAddress;
+    destinationTTL = fMulticastTTL;
+    isMulticast = True;
+  } else {
+    if (destinationAddress == 0) destinationAddress = clientAddress;
+    isMulticast = False;
+  }
   struct in_addr destinationAddr; destinationAddr.s_addr = destinationAddress;
-  isMulticast = False;
 
   if (fLastStreamToken != NULL && fReuseFirstSource) {
     // Special case: Rather than creating a new 'StreamState',
@@ -120,7 +128,33 @@ void OnDemandServerMediaSubsession
     Groupsock* rtpGroupsock = NULL;
     Groupsock* rtcpGroupsock = NULL;
 
-    if (clientRTPPort.num() != 0 || tcpSocketNum >= 0) { // Normal case: Create destinations
+    if (fMulticastAddress != 0) {
+      // Multicast case: The (shared) stream is sent to our group, at a fixed port number.
+      // (A TCP client might be the first to ask for the stream; it still gets created this way,
+      // so that any later UDP clients can share it.)
+      struct in_addr groupAddr; groupAddr.s_addr = fMulticastAddress;
+
+      serverRTPPort = fMulticastRTPPortNum;
+      rtpGroupsock = createGroupsock(groupAddr, serverRTPPort);
+      rtpGroupsock->changeDestinationParameters(groupAddr, 0, fMulticastTTL);
+      if (fMultiplexRTCPWithRTP) {
+	serverRTCPPort = serverRTPPort;
+	rtcpGroupsock = rtpGroupsock;
+      } else {
+	serverRTCPPort = fMulticastRTPPortNum+1;
+	rtcpGroupsock = createGroupsock(groupAddr, serverRTCPPort);
+	rtcpGroupsock->changeDestinationParameters(groupAddr, 0, fMulticastTTL);
+      }
+
+      unsigned char rtpPayloadType = 96 + trackNumber()-1; // if dynamic
+      rtpSink = createNewRTPSink(rtpGroupsock, rtpPayloadType, mediaSource);
+      if (rtpSink != NULL && rtpSink->estimatedBitrate() > 0) streamBitrate = rtpSink->estimatedBitrate();
+
+      // Note: Unlike the unicast case, we keep each groupsock's (group) destination.
+      unsigned rtpBufSize = streamBitrate * 25 / 2; // 1 kbps * 0.1 s = 12.5 bytes
+      if (rtpBufSize < 50 * 1024) rtpBufSize = 50 * 1024;
+      increaseSendBufferTo(envir(), rtpGroupsock->socketNum(), rtpBufSize);
+    } else if (clientRTPPort.num() != 0 || tcpSocketNum >= 0) { // Normal case: Create destinations
       portNumBits serverPortNum;
       if (clientRTCPPort.num() == 0) {
 	// We're streaming raw UDP (not RTP). Create a single groupsock:
@@ -197,7 +231,9 @@ void OnDemandServerMediaSubsession
 
   // Record these destinations as being for this client session id:
   Destinations* destinations;
-  if (tcpSocketNum < 0) { // UDP
+  if (tcpSocketNum < 0 && isMulticast) { // UDP (multicast)
+    destinations = new Destinations(destinationAddr, serverRTPPort, serverRTCPPort);
+  } else if (tcpSocketNum < 0) { // UDP
     destinations = new Destinations(destinationAddr, clientRTPPort, clientRTCPPort);
   } else { // TCP
     destinations = new Destinations(tcpSocketNum, rtpChannelId, rtcpChannelId);
@@ -217,13 +253,16 @@ void OnDemandServerMediaSubsession::startStream(unsigned clientSessionId,
   Destinations* destinations
     = (Destinations*)(fDestinationsHashTable->Lookup((char const*)clientSessionId));
   if (streamState != NULL) {
+    // If the (shared) stream is already being sent to other clients, then this client joins it
+    // mid-stream, and we must not reset its timestamp base (which those clients are using):
+    Boolean joiningSharedStream = streamState->isCurrentlyPlaying();
     streamState->startPlaying(destinations, clientSessionId,
 			      rtcpRRHandler, rtcpRRHandlerClientData,
 			      serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
     RTPSink* rtpSink = streamState->rtpSink(); // alias
     if (rtpSink != NULL) {
       rtpSeqNum = rtpSink->currentSeqNo();
-      rtpTimestamp = rtpSink->presetNextTimestamp();
+      rtpTimestamp = rtpSink->presetNextTimestamp(!joiningSharedStream);
     }
   }
 }
@@ -407,6 +446,19 @@ RTCPInstance* OnDemandServerMediaSubsession
   return RTCPInstance::createNew(envir(), RTCPgs, totSessionBW, cname, sink, NULL/*we're a server*/);
 }
 
+void OnDemandServerMediaSubsession
+::setMulticastDestination(netAddressBits groupAddress, portNumBits rtpPortNum, u_int8_t ttl) {
+  fMulticastAddress = groupAddress;
+  // Make sure the RTP port number is even (unless RTCP is multiplexed with it):
+  fMulticastRTPPortNum = fMultiplexRTCPWithRTP ? rtpPortNum : (rtpPortNum&~1);
+  fMulticastTTL = ttl;
+  fReuseFirstSource = True;
+
+  // Describe the group (rather than a dummy address) in our SDP description:
+  setServerAddressAndPortForSDP(fMulticastAddress, fMulticastRTPPortNum);
+  delete[] fSDPLines; fSDPLines = NULL;
+}
+
 void OnDemandServerMediaSubsession
 ::setRTCPAppPacketHandler(RTCPAppHandlerFunc* handler, void* clientData) {
   fAppHandlerTask = handler;
@@ -431,12 +483,14 @@ void OnDemandServerMediaSubsession
   AddressString ipAddressStr(fServerAddressForSDP);
   char* rtpmapLine = rtpSink->rtpmapLine();
   char const* rtcpmuxLine = fMultiplexRTCPWithRTP ? "a=rtcp-mux\r\n" : "";
+  char ttlStr[5]; // "/<ttl>" for a multicast address; empty otherwise
+  if (fMulticastAddress != 0) sprintf(ttlStr, "/%u", fMulticastTTL); else ttlStr[0] = '\0';
   char const* rangeLine = rangeSDPLine();
   char const* auxSDPLine = getAuxSDPLine(rtpSink, inputSource);
   if (auxSDPLine == NULL) auxSDPLine = "";
   char const* const sdpFmt =
     "m=%s %u RTP/AVP %d\r\n"
-    "c=IN IP4 %s\r\n"
+    "c=IN IP4 %s%s\r\n"
     "b=AS:%u\r\n"
     "%s"
     "%s"
@@ -445,7 +499,7 @@ void OnDemandServerMediaSubsession
     "a=control:%s\r\n";
   unsigned sdpFmtSize = strlen(sdpFmt)
     + strlen(mediaType) + 5 /* max short len */ + 3 /* max char len */
-    + strlen(ipAddressStr.val())
+    + strlen(ipAddressStr.val()) + strlen(ttlStr)
     + 20 /* max int len */
     + strlen(rtpmapLine)
     + strlen(rtcpmuxLine)
@@ -457,7 +511,7 @@ void OnDemandServerMediaSubsession
 	  mediaType, // m= <media>
 	  fPortNumForSDP, // m= <port>
 	  rtpPayloadType, // m= <fmt list>
-	  ipAddressStr.val(), // c= address
+	  ipAddressStr.val(), ttlStr, // c= address[/ttl]
 	  estBitrate, // b=AS:<bandwidth>
 	  rtpmapLine, // a=rtpmap:... (if present)
 	  rtcpmuxLine, // a=rtcp-mux:... (if present)
@@ -533,10 +587,13 @@ void StreamState
     }
   } else {
     // Tell the RTP and RTCP 'groupsocks' about this destination
-    // (in case they don't already have it):
-    if (fRTPgs != NULL) fRTPgs->addDestination(dests->addr, dests->rtpPort, clientSessionId);
-    if (fRTCPgs != NULL && !(fRTCPgs == fRTPgs && dests->rtcpPort.num() == dests->rtpPort.num())) {
-      fRTCPgs->addDestination(dests->addr, dests->rtcpPort, clientSessionId);
+    // (in case they don't already have it).
+    // (A multicast stream's 'groupsocks' already send to the group, for all clients.)
+    if (fMaster.fMulticastAddress == 0) {
+      if (fRTPgs != NULL) fRTPgs->addDestination(dests->addr, dests->rtpPort, clientSessionId);
+      if (fRTCPgs != NULL && !(fRTCPgs == fRTPgs && dests->rtcpPort.num() == dests->rtpPort.num())) {
+	fRTCPgs->addDestination(dests->addr, dests->rtcpPort, clientSessionId);
+      }
     }
     if (fRTCPInstance != NULL) {
       fRTCPInstance->setSpecificRRHandler(dests->addr.s_addr, dests->rtcpPort,
@@ -23,6 +23,11 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 #include "RTPInterface.hh"
 #include <GroupsockHelper.hh>
 #include <stdio.h>
+#include <string.h>
+#if !defined(__WIN32__) && !defined(_WIN32)
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#endif
 
 ////////// Helper Functions - Definition //////////
 
@@ -45,6 +50,35 @@ static HashTable* socketHashTable(UsageEnvironment& env, Boolean createIfNotPres
   return (HashTable*)(ourTables->socketTable);
 }
 
+#ifndef RTPINTERFACE_TCP_SEND_QUEUE_MAX_SIZE
+#define RTPINTERFACE_TCP_SEND_QUEUE_MAX_SIZE (1024*1024)
+#endif
+#ifndef RTPINTERFACE_TCP_SEND_STALL_TIMEOUT_MS
+#define RTPINTERFACE_TCP_SEND_STALL_TIMEOUT_MS 10000
+#endif
+#ifndef RTPINTERFACE_TCP_REPORT_INTERVAL_SECS
+#define RTPINTERFACE_TCP_REPORT_INTERVAL_SECS 10
+#endif
+#define RTPINTERFACE_TCP_MAX_IOVECS 64
+
+// The kinds of data in a RTP-over-TCP send queue, in the order in which they get dropped:
+enum { TCP_PACKET_NONREF, TCP_PACKET_REF, TCP_PACKET_KEY, // video
+       TCP_PACKET_OTHER, // audio, RTCP, or video that we can't classify
+       TCP_PACKET_RESPONSE }; // RTSP responses; never dropped
+
+enum { VIDEO_CODEC_NONE, VIDEO_CODEC_H264, VIDEO_CODEC_H265 };
+
+// A packet (including its '$' framing header), or RTSP response, waiting to be sent over a TCP connection.
+// The data follows the structure itself, in the same allocation.
+struct TCPQueuedPacket {
+  TCPQueuedPacket* next;
+  unsigned size, numBytesSent;
+  u_int32_t rtpTimestamp;
+  u_int8_t streamChannelId, kind;
+
+  u_int8_t* data() { return (u_int8_t*)(this+1); }
+};
+
 class SocketDescriptor {
 public:
   SocketDescriptor(UsageEnvironment& env, int socketNum);
@@ -60,10 +94,32 @@ public:
     fServerRequestAlternativeByteHandlerClientData = clientData;
   }
 
+  Boolean sendPacket(RTPInterface* rtpInterface, u_int8_t streamChannelId, u_int8_t const* packet, unsigned packetSize);
+      // Returns False if the connection has failed (or has stalled for too long); True if the packet was sent, queued,
+      // or deliberately dropped.
+  Boolean sendResponse(u_int8_t const* data, unsigned dataSize);
+  TCPSendQueueStats const& sendQueueStats() const { return fStats; }
+
 private:
   static void tcpReadHandler(SocketDescriptor*, int mask);
   Boolean tcpReadHandler1(int mask);
 
+  // Sending:
+  Boolean writeData(u_int8_t const* header, unsigned headerSize, u_int8_t const* data, unsigned dataSize,
+		    unsigned& numBytesWritten);
+  void enqueue(u_int8_t const* header, unsigned headerSize, u_int8_t const* data, unsigned dataSize,
+	       unsigned numBytesAlreadySent, u_int8_t streamChannelId, u_int8_t kind, u_int32_t rtpTimestamp);
+  Boolean admitPacket(u_int8_t streamChannelId, u_int8_t kind, u_int32_t rtpTimestamp, unsigned size);
+  void dropQueuedPackets(u_int8_t maxKind);
+  void startAwaitingKeyFrame(u_int8_t streamChannelId, u_int32_t rtpTimestamp);
+  Boolean flushSendQueue();
+  void flushUndroppableData();
+  void clearSendQueue();
+  void setWriteHandling(Boolean handleWrites);
+  Boolean fitsInSendQueue(unsigned size) const {
+    return fStats.queuedBytes + size <= RTPInterface::tcpSendQueueMaxSize;
+  }
+
 private:
   UsageEnvironment& fEnv;
   int fOurSocketNum;
@@ -73,6 +129,22 @@ private:
   u_int8_t fStreamChannelId, fSizeByte1;
   Boolean fReadErrorOccurred, fDeleteMyselfNext, fAreInReadHandlerLoop;
   enum { AWAITING_DOLLAR, AWAITING_STREAM_CHANNEL_ID, AWAITING_SIZE1, AWAITING_SIZE2, AWAITING_PACKET_DATA } fTCPReadingState;
+
+  // The send queue (if the socket's send buffer has filled up):
+  TCPQueuedPacket* fSendQueueHead;
+  TCPQueuedPacket* fSendQueueTail;
+  TCPSendQueueStats fStats;
+  Boolean fWriteErrorOccurred, fAreHandlingWrites;
+  struct timeval fLastWriteProgressTime, fLastReportTime;
+
+  // Per-channel state of the drop policy (allocated when we first drop video):
+  enum { NOT_DROPPING, DROPPING_NONREF_FRAME, AWAITING_KEY_FRAME };
+  struct ChannelDropState {
+    u_int32_t rtpTimestamp; // of the frame whose remaining packets are being dropped
+    u_int8_t mode;
+  };
+  ChannelDropState* fChannelDropStates; // indexed by stream channel id
+  unsigned fNumChannelsDropping;
 };
 
 static SocketDescriptor* lookupSocketDescriptor(UsageEnvironment& env, int sockNum, Boolean createIfNotFound = True) {
@@ -114,12 +186,18 @@ static void removeSocketDescription(UsageEnvironment& env, int sockNum) {
 
 ////////// RTPInterface - Implementation //////////
 
+unsigned RTPInterface::tcpSendQueueMaxSize = RTPINTERFACE_TCP_SEND_QUEUE_MAX_SIZE;
+TCPSendQueueReportFunc* RTPInterface::fTCPSendQueueReportFunc = NULL;
+
 RTPInterface::RTPInterface(Medium* owner, Groupsock* gs)
   : fOwner(owner), fGS(gs),
     fTCPStreams(NULL),
     fNextTCPReadSize(0), fNextTCPReadStreamSocketNum(-1),
     fNextTCPReadStreamChannelId(0xFF), fReadHandlerProc(NULL),
-    fAuxReadHandlerFunc(NULL), fAuxReadHandlerClientData(NULL) {
+    fAuxReadHandlerFunc(NULL), fAuxReadHandlerClientData(NULL),
+    fBatchBuffer(NULL), fBatchPackets(NULL), fBatchPacketSizes(NULL),
+    fBatchSlotSize(0), fBatchMaxPackets(0), fBatchNumPackets(0),
+    fVideoCodec(VIDEO_CODEC_NONE), fKeyFrameRequestHandler(NULL), fKeyFrameRequestClientData(NULL) {
   // Make the socket non-blocking, even though it will be read from only asynchronously, when packets arrive.
   // The reason for this is that, in some OSs, reads on a blocking socket can (allegedly) sometimes block,
   // even if the socket was previously reported (e.g., by "select()") as having data available.
@@ -131,6 +209,7 @@ RTPInterface::RTPInterface(Medium* owner, Groupsock* gs)
 RTPInterface::~RTPInterface() {
   stopNetworkReading();
   delete fTCPStreams;
+  delete[] fBatchBuffer; delete[] fBatchPackets; delete[] fBatchPacketSizes;
 }
 
 void RTPInterface::setStreamSocket(int sockNum,
@@ -213,9 +292,43 @@ void RTPInterface::clearServerRequestAlternativeByteHandler(UsageEnvironment& en
   setServerRequestAlternativeByteHandler(env, socketNum, NULL, NULL);
 }
 
+void RTPInterface::setPayloadFormatName(char const* rtpPayloadFormatName) {
+  if (rtpPayloadFormatName == NULL) {
+    fVideoCodec = VIDEO_CODEC_NONE;
+  } else if (strcmp(rtpPayloadFormatName, "H264") == 0) {
+    fVideoCodec = VIDEO_CODEC_H264;
+  } else if (strcmp(rtpPayloadFormatName, "H265") == 0) {
+    fVideoCodec = VIDEO_CODEC_H265;
+  } else {
+    fVideoCodec = VIDEO_CODEC_NONE;
+  }
+}
+
+Boolean RTPInterface::getTCPSendQueueStats(UsageEnvironment& env, int socketNum, TCPSendQueueStats& stats) {
+  SocketDescriptor* socketDescriptor = lookupSocketDescriptor(env, socketNum, False);
+  if (socketDescriptor == NULL) return False;
+
+  stats = socketDescriptor->sendQueueStats();
+  return True;
+}
+
+Boolean RTPInterface::sendDataOverStreamSocket(UsageEnvironment& env, int socketNum,
+					       u_int8_t const* data, unsigned dataSize) {
+  SocketDescriptor* socketDescriptor = lookupSocketDescriptor(env, socketNum, False);
+  if (socketDescriptor == NULL) {
+    // The socket isn't being used for RTP-over-TCP, so just send the data normally:
+    return send(socketNum, (char const*)data, dataSize, 0/*flags*/) == (int)dataSize;
+  }
+
+  return socketDescriptor->sendResponse(data, dataSize);
+}
+
 Boolean RTPInterface::sendPacket(unsigned char* packet, unsigned packetSize) {
   Boolean success = True; // we'll return False instead if any of the sends fail
 
+  // Make sure that any queued packets go out first:
+  if (!flushPackets()) success = False;
+
   // Normal case: Send as a UDP packet:
   if (!fGS->output(envir(), packet, packetSize)) success = False;
 
@@ -232,6 +345,68 @@ Boolean RTPInterface::sendPacket(unsigned char* packet, unsigned packetSize) {
   return success;
 }
 
+void RTPInterface::setPacketBatching(unsigned maxPacketSize, unsigned maxPacketsPerBatch) {
+  flushPackets();
+  delete[] fBatchBuffer; delete[] fBatchPackets; delete[] fBatchPacketSizes;
+  fBatchBuffer = NULL; fBatchPackets = NULL; fBatchPacketSizes = NULL;
+  fBatchSlotSize = fBatchMaxPackets = 0;
+  if (maxPacketSize == 0 || maxPacketsPerBatch <= 1) return;
+
+  fBatchSlotSize = maxPacketSize;
+  fBatchMaxPackets = maxPacketsPerBatch;
+  fBatchBuffer = new unsigned char[fBatchSlotSize*fBatchMaxPackets];
+  fBatchPackets = new unsigned char*[fBatchMaxPackets];
+  fBatchPacketSizes = new unsigned[fBatchMaxPackets];
+
+  // Make sure that a whole batch fits in the socket's send buffer
+  // (otherwise the tail of a burst would be dropped by our non-blocking socket):
+  if (fGS->socketNum() >= 0) {
+    increaseSendBufferTo(envir(), fGS->socketNum(), 2*fBatchSlotSize*fBatchMaxPackets);
+  }
+}
+
+Boolean RTPInterface::queuePacket(unsigned char* packet, unsigned packetSize) {
+  if (fBatchBuffer == NULL || packetSize > fBatchSlotSize || fGS->socketNum() < 0) {
+    // We're not batching (or can't batch this packet):
+    return sendPacket(packet, packetSize);
+  }
+
+  Boolean success = True; // we'll return False instead if any of the sends fail
+
+  // Copy the packet into the next slot of our arena.  We can't just keep a pointer to
+  // the caller's buffer: "MultiFramedRTPSink" builds its next packet in the same
+  // "OutPacketBuffer", with the new RTP header written over the tail of this packet
+  // (see "adjustPacketStart()"), before the batch gets flushed.  The copy is at most
+  // one slot (<= the MTU), and costs far less than the per-packet system call it saves.
+  unsigned char* slot = &fBatchBuffer[fBatchNumPackets*fBatchSlotSize];
+  memmove(slot, packet, packetSize);
+  fBatchPackets[fBatchNumPackets] = slot;
+  fBatchPacketSizes[fBatchNumPackets] = packetSize;
+  if (++fBatchNumPackets == fBatchMaxPackets) {
+    if (!flushPackets()) success = False;
+  }
+
+  // Packets sent over our TCP sockets (if any) are not batched:
+  tcpStreamRecord* nextStream;
+  for (tcpStreamRecord* stream = fTCPStreams; stream != NULL; stream = nextStream) {
+    nextStream = stream->fNext; // Set this now, in case the following deletes "stream":
+    if (!sendRTPorRTCPPacketOverTCP(packet, packetSize,
+				    stream->fStreamSocketNum, stream->fStreamChannelId)) {
+      success = False;
+    }
+  }
+
+  return success;
+}
+
+Boolean RTPInterface::flushPackets() {
+  if (fBatchNumPackets == 0) return True;
+
+  unsigned numPackets = fBatchNumPackets;
+  fBatchNumPackets = 0;
+  return fGS->outputBatch(envir(), fBatchPackets, fBatchPacketSizes, numPackets);
+}
+
 void RTPInterface
 ::startNetworkReading(TaskScheduler::BackgroundHandlerProc* handlerProc) {
   // Normal case: Arrange to read UDP packets:
@@ -321,6 +496,20 @@ Boolean RTPInterface::sendRTPorRTCPPacketOverTCP(u_int8_t* packet, unsigned pack
 #endif
   // Send a RTP/RTCP packet over TCP, using the encoding defined in RFC 2326, section 10.12:
   //     $<streamChannelId><packetSize><packet>
+  // Normally, this is done by the socket's "SocketDescriptor", which never blocks (see "sendPacket()" below):
+  SocketDescriptor* socketDescriptor = lookupSocketDescriptor(envir(), socketNum, False);
+  if (socketDescriptor != NULL) {
+    if (socketDescriptor->sendPacket(this, streamChannelId, packet, packetSize)) return True;
+
+    // The TCP connection has failed (or has stopped accepting data), so stop using it (for both RTP and RTCP):
+#ifdef DEBUG_SEND
+    fprintf(stderr, "sendRTPorRTCPPacketOverTCP: failed! (errno %d); no longer using socket %d\n", envir().getErrno(), socketNum); fflush(stderr);
+#endif
+    removeStreamSocket(socketNum, 0xFF);
+    return False;
+  }
+
+  // Otherwise (we're no longer reading from the socket), send the packet directly.
   // (If the initial "send()" of '$<streamChannelId><packetSize>' succeeds, then we force
   // the subsequent "send()" for the <packet> data to succeed, even if we have to do so with
   // a blocking "send()".)
@@ -393,17 +582,88 @@ Boolean RTPInterface::sendDataOverTCP(int socketNum, u_int8_t const* data, unsig
   return True;
 }
 
+u_int8_t RTPInterface::classifyPacket(u_int8_t const* packet, unsigned packetSize, u_int32_t& rtpTimestamp) const {
+  rtpTimestamp = 0;
+  if (fVideoCodec == VIDEO_CODEC_NONE || packetSize < 12) return TCP_PACKET_OTHER;
+  rtpTimestamp = (packet[4]<<24)|(packet[5]<<16)|(packet[6]<<8)|packet[7];
+
+  // Skip over the RTP header (including any CSRCs and header extension):
+  unsigned headerSize = 12 + 4*(packet[0]&0x0F);
+  if ((packet[0]&0x10) != 0 && headerSize + 4 <= packetSize) {
+    headerSize += 4 + 4*((packet[headerSize+2]<<8)|packet[headerSize+3]);
+  }
+  if (headerSize + 2 > packetSize) return TCP_PACKET_OTHER;
+  u_int8_t const* payload = &packet[headerSize];
+  unsigned payloadSize = packetSize - headerSize;
+
+  if (fVideoCodec == VIDEO_CODEC_H264) {
+    // (RFC 6184) The NRI bits of the payload header are the (largest) "nal_ref_idc" of the NAL unit(s) within:
+    u_int8_t nalRefIdc = (payload[0]&0x60)>>5;
+    u_int8_t nalUnitType = payload[0]&0x1F;
+    if (nalUnitType == 28 || nalUnitType == 29) { // FU-A or FU-B
+      nalUnitType = payload[1]&0x1F;
+    } else if (nalUnitType == 24 && payloadSize >= 4) { // STAP-A: use the first NAL unit
+      nalUnitType = payload[3]&0x1F;
+    }
+    if (nalUnitType == 5/*IDR*/ || nalUnitType == 7/*SPS*/ || nalUnitType == 8/*PPS*/) return TCP_PACKET_KEY;
+    return nalRefIdc == 0 ? TCP_PACKET_NONREF : TCP_PACKET_REF;
+  } else {
+    // (RFC 7798)
+    u_int8_t nalUnitType = (payload[0]&0x7E)>>1;
+    if (nalUnitType == 49 && payloadSize >= 3) { // FU
+      nalUnitType = payload[2]&0x3F;
+    } else if (nalUnitType == 48 && payloadSize >= 5) { // AP (without DONL): use the first NAL unit
+      nalUnitType = (payload[4]&0x7E)>>1;
+    }
+    if ((nalUnitType >= 16 && nalUnitType <= 23)/*IRAP*/ || (nalUnitType >= 32 && nalUnitType <= 34)/*VPS,SPS,PPS*/) {
+      return TCP_PACKET_KEY;
+    }
+    if (nalUnitType <= 15) {
+      // A VCL NAL unit; the 'sub-layer non-reference' pictures (TRAIL_N, TSA_N, etc.) have even types:
+      return (nalUnitType&1) != 0 ? TCP_PACKET_REF : TCP_PACKET_NONREF;
+    }
+    return TCP_PACKET_NONREF; // SEI, AUD etc.
+  }
+}
+
+void RTPInterface::requestKeyFrame() {
+  if (fKeyFrameRequestHandler != NULL) (*fKeyFrameRequestHandler)(fKeyFrameRequestClientData);
+}
+
 SocketDescriptor::SocketDescriptor(UsageEnvironment& env, int socketNum)
   :fEnv(env), fOurSocketNum(socketNum),
     fSubChannelHashTable(HashTable::create(ONE_WORD_HASH_KEYS)),
    fServerRequestAlternativeByteHandler(NULL), fServerRequestAlternativeByteHandlerClientData(NULL),
-   fReadErrorOccurred(False), fDeleteMyselfNext(False), fAreInReadHandlerLoop(False), fTCPReadingState(AWAITING_DOLLAR) {
+   fReadErrorOccurred(False), fDeleteMyselfNext(False), fAreInReadHandlerLoop(False), fTCPReadingState(AWAITING_DOLLAR),
+   fSendQueueHead(NULL), fSendQueueTail(NULL), fWriteErrorOccurred(False), fAreHandlingWrites(False),
+   fChannelDropStates(NULL), fNumChannelsDropping(0) {
+#ifdef TCP_NODELAY
+  // We write each packet (with its framing header) using a single system call, so there's nothing for
+  // Nagle's algorithm to coalesce; it would only delay the last packet of each frame:
+  int one = 1;
+  setsockopt(socketNum, IPPROTO_TCP, TCP_NODELAY, (char const*)&one, sizeof one);
+#endif
+  memset(&fStats, 0, sizeof fStats);
+  fLastWriteProgressTime.tv_sec = fLastWriteProgressTime.tv_usec = 0;
+  fLastReportTime.tv_sec = fLastReportTime.tv_usec = 0;
 }
 
 SocketDescriptor::~SocketDescriptor() {
   fEnv.taskScheduler().turnOffBackgroundReadHandling(fOurSocketNum);
   removeSocketDescription(fEnv, fOurSocketNum);
 
+  fAreHandlingWrites = False; // (because we've just turned off all handling of the socket)
+
+  // Before the RTSP server takes back the socket, finish sending any partially-sent packet (so that its next
+  // response isn't interleaved with it), and any responses that are still queued.  Other packets are discarded:
+  flushUndroppableData();
+  clearSendQueue();
+  delete[] fChannelDropStates;
+  if (RTPInterface::fTCPSendQueueReportFunc != NULL
+      && fStats.numDroppedNonRefPackets + fStats.numDroppedGOPPackets + fStats.numDroppedOtherPackets > 0) {
+    (*RTPInterface::fTCPSendQueueReportFunc)(fOurSocketNum, fStats);
+  }
+
   if (fSubChannelHashTable != NULL) {
     // Remove knowledge of this socket from any "RTPInterface"s that are using it:
     HashTable::Iterator* iter = HashTable::Iterator::create(*fSubChannelHashTable);
@@ -475,10 +735,18 @@ void SocketDescriptor
 }
 
 void SocketDescriptor::tcpReadHandler(SocketDescriptor* socketDescriptor, int mask) {
+  // (We also handle the socket becoming writable, if we have queued data to send.)
+  socketDescriptor->fAreInReadHandlerLoop = True;
+  if ((mask&SOCKET_WRITABLE) != 0 && !socketDescriptor->flushSendQueue()) {
+    // A write error is handled like a read error: we stop using the socket, and tell the RTSP server:
+    socketDescriptor->fReadErrorOccurred = True;
+    socketDescriptor->fDeleteMyselfNext = True;
+  }
+  if ((mask&(SOCKET_READABLE|SOCKET_EXCEPTION)) == 0) mask = 0; // we don't need to read
+
   // Call the read handler until it returns false, with a limit to avoid starving other sockets
   unsigned count = 2000;
-  socketDescriptor->fAreInReadHandlerLoop = True;
-  while (!socketDescriptor->fDeleteMyselfNext && socketDescriptor->tcpReadHandler1(mask) && --count > 0) {}
+  while (mask != 0 && !socketDescriptor->fDeleteMyselfNext && socketDescriptor->tcpReadHandler1(mask) && --count > 0) {}
   socketDescriptor->fAreInReadHandlerLoop = False;
   if (socketDescriptor->fDeleteMyselfNext) delete socketDescriptor;
 }
@@ -606,6 +874,356 @@ Boolean SocketDescriptor::tcpReadHandler1(int mask) {
 }
 
 
+Boolean SocketDescriptor::sendPacket(RTPInterface* rtpInterface, u_int8_t streamChannelId,
+				    u_int8_t const* packet, unsigned packetSize) {
+  if (fWriteErrorOccurred) return False;
+
+  u_int8_t framingHeader[4];
+  framingHeader[0] = '$';
+  framingHeader[1] = streamChannelId;
+  framingHeader[2] = (u_int8_t) ((packetSize&0xFF00)>>8);
+  framingHeader[3] = (u_int8_t) (packetSize&0xFF);
+  unsigned size = 4 + packetSize;
+
+  // We need to look at the packet only if it might have to be dropped:
+  u_int32_t rtpTimestamp = 0;
+  u_int8_t kind = TCP_PACKET_OTHER;
+  Boolean isClassified = False;
+  if (fNumChannelsDropping > 0) {
+    kind = rtpInterface->classifyPacket(packet, packetSize, rtpTimestamp);
+    isClassified = True;
+    if (!admitPacket(streamChannelId, kind, rtpTimestamp, size)) return True;
+  }
+
+  if (fSendQueueHead == NULL) {
+    // The common case: Try to send the packet now:
+    unsigned numBytesWritten;
+    if (!writeData(framingHeader, 4, packet, packetSize, numBytesWritten)) {
+      fWriteErrorOccurred = True;
+      return False;
+    }
+    if (numBytesWritten == size) return True;
+
+    if (!isClassified) kind = rtpInterface->classifyPacket(packet, packetSize, rtpTimestamp);
+    if (numBytesWritten > 0) {
+      // The rest of the packet must be sent before anything else, so it can't be dropped:
+      enqueue(framingHeader, 4, packet, packetSize, numBytesWritten, streamChannelId, kind, rtpTimestamp);
+      return True;
+    }
+  } else {
+    struct timeval timeNow;
+    gettimeofday(&timeNow, NULL);
+    if ((timeNow.tv_sec - fLastWriteProgressTime.tv_sec)*1000
+	+ (timeNow.tv_usec - fLastWriteProgressTime.tv_usec)/1000 > RTPINTERFACE_TCP_SEND_STALL_TIMEOUT_MS) {
+      // The client has stopped reading.  Assume that the TCP connection is 'hanging' indefinitely:
+      fWriteErrorOccurred = True;
+      setWriteHandling(False);
+      return False;
+    }
+    if (!isClassified) kind = rtpInterface->classifyPacket(packet, packetSize, rtpTimestamp);
+  }
+
+  if (isClassified || admitPacket(streamChannelId, kind, rtpTimestamp, size)) {
+    enqueue(framingHeader, 4, packet, packetSize, 0, streamChannelId, kind, rtpTimestamp);
+  }
+  return True;
+}
+
+Boolean SocketDescriptor::sendResponse(u_int8_t const* data, unsigned dataSize) {
+  unsigned numBytesWritten = 0;
+  if (fSendQueueHead == NULL || fWriteErrorOccurred) {
+    if (!writeData(NULL, 0, data, dataSize, numBytesWritten)) return False;
+    if (numBytesWritten == dataSize || fWriteErrorOccurred) return numBytesWritten == dataSize;
+  }
+
+  enqueue(NULL, 0, data, dataSize, numBytesWritten, 0xFF, TCP_PACKET_RESPONSE, 0);
+  return True;
+}
+
+Boolean SocketDescriptor::writeData(u_int8_t const* header, unsigned headerSize, u_int8_t const* data, unsigned dataSize,
+				    unsigned& numBytesWritten) {
+  // Write the header and data with a single system call:
+  struct iovec iov[2];
+  unsigned numIovecs = 0;
+  if (headerSize > 0) {
+    iov[numIovecs].iov_base = (void*)header; iov[numIovecs].iov_len = headerSize; ++numIovecs;
+  }
+  iov[numIovecs].iov_base = (void*)data; iov[numIovecs].iov_len = dataSize; ++numIovecs;
+
+  int result = writev(fOurSocketNum, iov, numIovecs);
+  if (result < 0) {
+    numBytesWritten = 0;
+    int err = fEnv.getErrno();
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR; // we can try again later
+  }
+
+  numBytesWritten = (unsigned)result;
+  return True;
+}
+
+void SocketDescriptor::enqueue(u_int8_t const* header, unsigned headerSize, u_int8_t const* data, unsigned dataSize,
+			       unsigned numBytesAlreadySent, u_int8_t streamChannelId, u_int8_t kind, u_int32_t rtpTimestamp) {
+  unsigned size = headerSize + dataSize;
+  TCPQueuedPacket* queuedPacket = (TCPQueuedPacket*)malloc(sizeof (TCPQueuedPacket) + size);
+  if (queuedPacket == NULL) return;
+  queuedPacket->next = NULL;
+  queuedPacket->size = size;
+  queuedPacket->numBytesSent = numBytesAlreadySent;
+  queuedPacket->rtpTimestamp = rtpTimestamp;
+  queuedPacket->streamChannelId = streamChannelId;
+  queuedPacket->kind = kind;
+  if (headerSize > 0) memmove(queuedPacket->data(), header, headerSize);
+  memmove(queuedPacket->data() + headerSize, data, dataSize);
+
+  if (fSendQueueHead == NULL) {
+    fSendQueueHead = queuedPacket;
+    gettimeofday(&fLastWriteProgressTime, NULL); // the 'stall' timer starts now
+  } else {
+    fSendQueueTail->next = queuedPacket;
+  }
+  fSendQueueTail = queuedPacket;
+
+  fStats.queuedBytes += size - numBytesAlreadySent;
+  ++fStats.queuedPackets;
+  if (fStats.queuedBytes > fStats.maxQueuedBytes) fStats.maxQueuedBytes = fStats.queuedBytes;
+
+  setWriteHandling(True);
+}
+
+Boolean SocketDescriptor::admitPacket(u_int8_t streamChannelId, u_int8_t kind, u_int32_t rtpTimestamp, unsigned size) {
+  // Returns False if the packet is to be dropped.
+  // First, continue any dropping that's already under way on this (video) channel:
+  if (kind <= TCP_PACKET_KEY && fChannelDropStates != NULL) {
+    ChannelDropState& state = fChannelDropStates[streamChannelId];
+    if (state.mode == DROPPING_NONREF_FRAME) {
+      if (kind == TCP_PACKET_NONREF && rtpTimestamp == state.rtpTimestamp) {
+	++fStats.numDroppedNonRefPackets;
+	return False;
+      }
+      state.mode = NOT_DROPPING; --fNumChannelsDropping;
+    } else if (state.mode == AWAITING_KEY_FRAME) {
+      // (Any remaining packets of the frame that we were dropping when we started waiting also get dropped.)
+      if (kind != TCP_PACKET_KEY || rtpTimestamp == state.rtpTimestamp) {
+	++fStats.numDroppedGOPPackets;
+	return False;
+      }
+      state.mode = NOT_DROPPING; --fNumChannelsDropping;
+    }
+  }
+
+  if (kind == TCP_PACKET_RESPONSE || fitsInSendQueue(size)) return True;
+
+  // The queue is full.  Make room by dropping queued non-reference video frames:
+  dropQueuedPackets(TCP_PACKET_NONREF);
+  if (fitsInSendQueue(size)) return True;
+  if (kind == TCP_PACKET_NONREF) {
+    // Drop this frame instead:
+    ChannelDropState& state = fChannelDropStates[streamChannelId];
+    if (state.mode == NOT_DROPPING) ++fNumChannelsDropping;
+    state.mode = DROPPING_NONREF_FRAME;
+    state.rtpTimestamp = rtpTimestamp;
+    ++fStats.numDroppedNonRefPackets;
+    return False;
+  }
+
+  // That wasn't enough, so drop all queued video, and then drop video until the next key frame:
+  dropQueuedPackets(TCP_PACKET_KEY);
+  if (kind <= TCP_PACKET_KEY && fChannelDropStates[streamChannelId].mode == AWAITING_KEY_FRAME) {
+    ChannelDropState& state = fChannelDropStates[streamChannelId];
+    if (kind != TCP_PACKET_KEY || rtpTimestamp == state.rtpTimestamp) {
+      ++fStats.numDroppedGOPPackets;
+      return False;
+    }
+    // This packet begins a new key frame:
+    state.mode = NOT_DROPPING; --fNumChannelsDropping;
+  }
+  if (fitsInSendQueue(size)) return True;
+
+  // Finally, drop queued audio and RTCP packets:
+  dropQueuedPackets(TCP_PACKET_OTHER);
+  if (fitsInSendQueue(size)) return True;
+
+  // The packet itself is too large for the queue:
+  if (kind <= TCP_PACKET_KEY) {
+    startAwaitingKeyFrame(streamChannelId, rtpTimestamp);
+    ++fStats.numDroppedGOPPackets;
+  } else {
+    ++fStats.numDroppedOtherPackets;
+  }
+  return False;
+}
+
+void SocketDescriptor::dropQueuedPackets(u_int8_t maxKind) {
+  if (fChannelDropStates == NULL) {
+    fChannelDropStates = new ChannelDropState[256];
+    memset(fChannelDropStates, 0, 256*sizeof (ChannelDropState));
+  }
+
+  TCPQueuedPacket** queuedPacketPtr = &fSendQueueHead;
+  TCPQueuedPacket* prev = NULL;
+  while (*queuedPacketPtr != NULL) {
+    TCPQueuedPacket* queuedPacket = *queuedPacketPtr;
+    if (queuedPacket->kind > maxKind || queuedPacket->numBytesSent > 0) {
+      // We can't drop this packet (or a partially-sent packet):
+      prev = queuedPacket;
+      queuedPacketPtr = &queuedPacket->next;
+      continue;
+    }
+
+    // Drop this packet, and remember to drop the rest of its frame (or GOP):
+    ChannelDropState& state = fChannelDropStates[queuedPacket->streamChannelId];
+    if (queuedPacket->kind == TCP_PACKET_NONREF) {
+      if (state.mode != AWAITING_KEY_FRAME) {
+	if (state.mode == NOT_DROPPING) ++fNumChannelsDropping;
+	state.mode = DROPPING_NONREF_FRAME;
+	state.rtpTimestamp = queuedPacket->rtpTimestamp;
+      }
+      ++fStats.numDroppedNonRefPackets;
+    } else if (queuedPacket->kind <= TCP_PACKET_KEY) {
+      startAwaitingKeyFrame(queuedPacket->streamChannelId, queuedPacket->rtpTimestamp);
+      ++fStats.numDroppedGOPPackets;
+    } else {
+      ++fStats.numDroppedOtherPackets;
+    }
+
+    *queuedPacketPtr = queuedPacket->next;
+    if (fSendQueueTail == queuedPacket) fSendQueueTail = prev;
+    fStats.queuedBytes -= queuedPacket->size;
+    --fStats.queuedPackets;
+    free(queuedPacket);
+  }
+
+  if (fSendQueueHead == NULL) setWriteHandling(False);
+}
+
+void SocketDescriptor::startAwaitingKeyFrame(u_int8_t streamChannelId, u_int32_t rtpTimestamp) {
+  ChannelDropState& state = fChannelDropStates[streamChannelId];
+  Boolean wasAwaitingKeyFrame = state.mode == AWAITING_KEY_FRAME;
+  if (state.mode == NOT_DROPPING) ++fNumChannelsDropping;
+  state.mode = AWAITING_KEY_FRAME;
+  state.rtpTimestamp = rtpTimestamp; // the most recent frame that we've dropped
+  if (wasAwaitingKeyFrame) return;
+
+  // Ask the source for a key frame, so that we don't have to wait for a whole GOP:
+  RTPInterface* rtpInterface = lookupRTPInterface(streamChannelId);
+  if (rtpInterface != NULL && rtpInterface->fKeyFrameRequestHandler != NULL) {
+    ++fStats.numKeyFrameRequests;
+    rtpInterface->requestKeyFrame();
+  }
+
+  if (RTPInterface::fTCPSendQueueReportFunc != NULL) {
+    struct timeval timeNow;
+    gettimeofday(&timeNow, NULL);
+    if (fLastReportTime.tv_sec == 0 || timeNow.tv_sec - fLastReportTime.tv_sec >= RTPINTERFACE_TCP_REPORT_INTERVAL_SECS) {
+      fLastReportTime = timeNow;
+      (*RTPInterface::fTCPSendQueueReportFunc)(fOurSocketNum, fStats);
+    }
+  }
+}
+
+Boolean SocketDescriptor::flushSendQueue() {
+  // Returns False if there was an error writing to the socket
+  while (fSendQueueHead != NULL && !fWriteErrorOccurred) {
+    struct iovec iov[RTPINTERFACE_TCP_MAX_IOVECS];
+    unsigned numIovecs = 0, numBytesToWrite = 0;
+    for (TCPQueuedPacket* queuedPacket = fSendQueueHead;
+	 queuedPacket != NULL && numIovecs < RTPINTERFACE_TCP_MAX_IOVECS; queuedPacket = queuedPacket->next) {
+      iov[numIovecs].iov_base = queuedPacket->data() + queuedPacket->numBytesSent;
+      iov[numIovecs].iov_len = queuedPacket->size - queuedPacket->numBytesSent;
+      numBytesToWrite += iov[numIovecs].iov_len;
+      ++numIovecs;
+    }
+
+    int result = writev(fOurSocketNum, iov, numIovecs);
+    if (result < 0) {
+      int err = fEnv.getErrno();
+      if (err == EAGAIN || err == EWOULDBLOCK || err == EINTR) break; // try again when the socket is writable
+#ifdef DEBUG_SEND
+      fprintf(stderr, "SocketDescriptor(socket %d)::flushSendQueue(): writev() failed (errno %d)\n", fOurSocketNum, err);
+#endif
+      fWriteErrorOccurred = True;
+      break;
+    }
+    if (result > 0) gettimeofday(&fLastWriteProgressTime, NULL);
+
+    // Remove the packets that have now been completely sent:
+    unsigned numBytesWritten = (unsigned)result;
+    while (numBytesWritten > 0) {
+      TCPQueuedPacket* queuedPacket = fSendQueueHead;
+      unsigned numBytesRemaining = queuedPacket->size - queuedPacket->numBytesSent;
+      if (numBytesWritten < numBytesRemaining) {
+	queuedPacket->numBytesSent += numBytesWritten;
+	fStats.queuedBytes -= numBytesWritten;
+	break;
+      }
+
+      numBytesWritten -= numBytesRemaining;
+      fStats.queuedBytes -= numBytesRemaining;
+      --fStats.queuedPackets;
+      fSendQueueHead = queuedPacket->next;
+      if (fSendQueueHead == NULL) fSendQueueTail = NULL;
+      free(queuedPacket);
+    }
+    if ((unsigned)result < numBytesToWrite) break; // the socket's send buffer is full again
+  }
+
+  if (fSendQueueHead == NULL || fWriteErrorOccurred) setWriteHandling(False);
+  return !fWriteErrorOccurred;
+}
+
+void SocketDescriptor::flushUndroppableData() {
+  if (fWriteErrorOccurred) return;
+
+  // Drop everything except a partially-sent packet, and responses:
+  TCPQueuedPacket** queuedPacketPtr = &fSendQueueHead;
+  fSendQueueTail = NULL;
+  while (*queuedPacketPtr != NULL) {
+    TCPQueuedPacket* queuedPacket = *queuedPacketPtr;
+    if (queuedPacket->numBytesSent > 0 || queuedPacket->kind == TCP_PACKET_RESPONSE) {
+      fSendQueueTail = queuedPacket;
+      queuedPacketPtr = &queuedPacket->next;
+    } else {
+      *queuedPacketPtr = queuedPacket->next;
+      fStats.queuedBytes -= queuedPacket->size;
+      --fStats.queuedPackets;
+      free(queuedPacket);
+    }
+  }
+  if (fSendQueueHead == NULL) return;
+
+  // Then send what's left, blocking if necessary (but with a timeout):
+  makeSocketBlocking(fOurSocketNum, RTPINTERFACE_BLOCKING_WRITE_TIMEOUT_MS);
+  while (flushSendQueue() && fSendQueueHead != NULL) {
+    struct timeval timeNow;
+    gettimeofday(&timeNow, NULL);
+    if ((timeNow.tv_sec - fLastWriteProgressTime.tv_sec)*1000
+	+ (timeNow.tv_usec - fLastWriteProgressTime.tv_usec)/1000 > RTPINTERFACE_BLOCKING_WRITE_TIMEOUT_MS) break;
+  }
+  makeSocketNonBlocking(fOurSocketNum);
+}
+
+void SocketDescriptor::clearSendQueue() {
+  while (fSendQueueHead != NULL) {
+    TCPQueuedPacket* next = fSendQueueHead->next;
+    free(fSendQueueHead);
+    fSendQueueHead = next;
+  }
+  fSendQueueTail = NULL;
+  fStats.queuedBytes = fStats.queuedPackets = 0;
+}
+
+void SocketDescriptor::setWriteHandling(Boolean handleWrites) {
+  if (handleWrites == fAreHandlingWrites) return;
+  fAreHandlingWrites = handleWrites;
+
+  TaskScheduler::BackgroundHandlerProc* handler
+    = (TaskScheduler::BackgroundHandlerProc*)&tcpReadHandler;
+  int conditionSet = SOCKET_READABLE|SOCKET_EXCEPTION;
+  if (handleWrites) conditionSet |= SOCKET_WRITABLE;
+  fEnv.taskScheduler().setBackgroundHandling(fOurSocketNum, conditionSet, handler, this);
+}
+
+
 ////////// tcpStreamRecord implementation //////////
 
 tcpStreamRecord
@@ -55,6 +55,7 @@ RTPSink::RTPSink(UsageEnvironment& env,
     fNumChannels(numChannels), fEstimatedBitrate(0) {
   fRTPPayloadFormatName
     = strDup(rtpPayloadFormatName == NULL ? "???" : rtpPayloadFormatName);
+  fRTPInterface.setPayloadFormatName(rtpPayloadFormatName);
   gettimeofday(&fCreationTime, NULL);
   fTotalOctetCountStartTime = fCreationTime;
   resetPresentationTimes();
@@ -97,12 +98,12 @@ u_int32_t RTPSink::convertToRTPTimestamp(struct timeval tv) {
   return rtpTimestamp;
 }
 
-u_int32_t RTPSink::presetNextTimestamp() {
+u_int32_t RTPSink::presetNextTimestamp(Boolean resetTimestampBase) {
   struct timeval timeNow;
   gettimeofday(&timeNow, NULL);
 
   u_int32_t tsNow = convertToRTPTimestamp(timeNow);
-  if (!groupsockBeingUsed().hasMultipleDestinations()) {
+  if (resetTimestampBase && !groupsockBeingUsed().hasMultipleDestinations()) {
     // Don't adjust the timestamp stream if we already have another destination ongoing
     fTimestampBase = tsNow;
     fNextTimestampHasBeenPreset = True;
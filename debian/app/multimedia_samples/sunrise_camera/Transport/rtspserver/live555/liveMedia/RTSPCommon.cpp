@@ -334,11 +334,23 @@ Boolean RTSPOptionIsSupported(char const* commandName, char const* optionsRespon
   return False;
 }
 
+// Each thread that runs an RTSP server's event loop gets its own "Date:" buffer:
+#if defined(__WIN32__) || defined(_WIN32)
+#define DATE_HEADER_THREAD_LOCAL __declspec(thread)
+#else
+#define DATE_HEADER_THREAD_LOCAL __thread
+#endif
+
 char const* dateHeader() {
-  static char buf[200];
+  static DATE_HEADER_THREAD_LOCAL char buf[200];
 #if !defined(_WIN32_WCE)
   time_t tt = time(NULL);
+#if defined(__WIN32__) || defined(_WIN32)
   strftime(buf, sizeof buf, "Date: %a, %b %d %Y %H:%M:%S GMT\r\n", gmtime(&tt));
+#else
+  struct tm tmBuf;
+  strftime(buf, sizeof buf, "Date: %a, %b %d %Y %H:%M:%S GMT\r\n", gmtime_r(&tt, &tmBuf));
+#endif
 #else
   // WinCE apparently doesn't have "time()", "strftime()", or "gmtime()",
   // so generate the "Date:" header a different, WinCE-specific way.
@@ -865,7 +865,8 @@ void RTSPServer::RTSPClientConnection::handleRequestBytes(int newBytesRead) {
 #ifdef DEBUG
     fprintf(stderr, "sending response: %s", fResponseBuffer);
 #endif
-    send(fClientOutputSocket, (char const*)fResponseBuffer, strlen((char*)fResponseBuffer), 0);
+    // (The response is sent after any RTP or RTCP packets that are queued on the same TCP connection.)
+    RTPInterface::sendDataOverStreamSocket(envir(), fClientOutputSocket, fResponseBuffer, strlen((char*)fResponseBuffer));
 
     if (playAfterSetup) {
       // The client has asked for streaming to commence now, rather than after a
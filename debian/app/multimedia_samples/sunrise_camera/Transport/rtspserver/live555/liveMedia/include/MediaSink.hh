@@ -78,6 +78,19 @@ public:
   static unsigned maxSize;
   static void increaseMaxSizeTo(unsigned newMaxSize) { if (newMaxSize > OutPacketBuffer::maxSize) OutPacketBuffer::maxSize = newMaxSize; }
 
+  // Output buffers are drawn from a shared pool, so that the (large) buffers that are freed when a
+  // client disconnects get reused by the next client, rather than going back to the heap:
+  static unsigned char* allocateBuffer(unsigned& bufferSize);
+      // rounds "bufferSize" up to one of the pool's sizes (at most 25% larger)
+  static void releaseBuffer(unsigned char* buffer, unsigned bufferSize);
+      // "bufferSize" must be the (rounded-up) size returned by "allocateBuffer()"
+  static void releaseCachedBuffers(); // returns all unused buffers to the heap
+  static void getPoolStats(unsigned& numBuffersInUse, unsigned& numBytesInUse,
+			   unsigned& numBuffersCached, unsigned& numBytesCached);
+  static unsigned maxCachedBytes;
+      // unused buffers beyond this total size are returned to the heap (default: 16 MBytes)
+  // Note: The pool is shared (under a mutex) by all threads that run an event loop.
+
   unsigned char* curPtr() const {return &fBuf[fPacketStart + fCurOffset];}
   unsigned totalBytesAvailable() const {
     return fLimit - (fPacketStart + fCurOffset);
@@ -126,6 +139,7 @@ public:
 private:
   unsigned fPacketStart, fCurOffset, fPreferred, fMax, fLimit;
   unsigned char* fBuf;
+  unsigned fBufSize; // the size of "fBuf" (from the pool); >= "fLimit"
 
   unsigned fOverflowDataOffset, fOverflowDataSize;
   struct timeval fOverflowPresentationTime;
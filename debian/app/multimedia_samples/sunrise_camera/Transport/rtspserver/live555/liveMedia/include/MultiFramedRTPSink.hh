@@ -29,6 +29,13 @@ along with this library; if not, write to the Free Software Foundation, Inc.,
 class MultiFramedRTPSink: public RTPSink {
 public:
   void setPacketSizes(unsigned preferredPacketSize, unsigned maxPacketSize);
+  void setOutBufferSize(unsigned bufferSize);
+      // Sets the size of our output buffer - which must hold the largest frame that our source
+      // delivers - instead of using the global default "OutPacketBuffer::maxSize".
+      // (Call this before we start playing.)
+  unsigned outBufferSize() const {
+    return fOutBufferSize == 0 ? OutPacketBuffer::maxSize : fOutBufferSize;
+  }
 
   typedef void (onSendErrorFunc)(void* clientData);
   void setOnSendErrorFunc(onSendErrorFunc* onSendErrorFunc, void* onSendErrorFuncData) {
@@ -101,6 +108,7 @@ private:
   void buildAndSendPacket(Boolean isFirstPacket);
   void packFrame();
   void sendPacketIfNecessary();
+  void sendQueuedPackets();
   static void sendNext(void* firstArg);
   friend void sendNext(void*);
 
@@ -117,8 +125,10 @@ private:
 
 private:
   OutPacketBuffer* fOutBuf;
+  unsigned fOutBufferSize; // 0 means "OutPacketBuffer::maxSize"
 
   Boolean fNoFramesLeft;
+  Boolean fIsAwaitingFrame; // True while the source has yet to deliver the frame that we asked for
   unsigned fNumFramesUsedSoFar;
   unsigned fCurFragmentationOffset;
   Boolean fPreviousFrameEndedFragmentation;
@@ -131,7 +141,7 @@ private:
   unsigned fCurFrameSpecificHeaderPosition;
   unsigned fCurFrameSpecificHeaderSize; // size in bytes of cur frame-specific header
   unsigned fTotalFrameSpecificHeaderSizes; // size of all frame-specific hdrs in pkt
-  unsigned fOurMaxPacketSize;
+  unsigned fOurPreferredPacketSize, fOurMaxPacketSize;
 
   onSendErrorFunc* fOnSendErrorFunc;
   void* fOnSendErrorData;
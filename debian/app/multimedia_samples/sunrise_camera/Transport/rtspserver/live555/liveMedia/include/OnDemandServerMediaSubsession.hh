@@ -109,6 +109,17 @@ public:
   void multiplexRTCPWithRTP() { fMultiplexRTCPWithRTP = True; }
     // An alternative to passing the "multiplexRTCPWithRTP" parameter as True in the constructor
 
+  void setMulticastDestination(netAddressBits groupAddress/*network byte order*/,
+			       portNumBits rtpPortNum/*host byte order*/, u_int8_t ttl);
+    // Makes all UDP clients receive the stream from a single multicast group, instead of each
+    // getting its own unicast copy.  (This implies "reuseFirstSource".)  The stream is still
+    // created 'on demand': it starts with the first client's "PLAY", and stops after the last
+    // client's "TEARDOWN".  Clients that use RTP-over-TCP continue to be served by unicast, from
+    // the same (shared) stream.
+    // "groupAddress" should normally be a SSM (232.0.0.0/8) address; see "chooseRandomIPv4SSMAddress()".
+    // Must be called before the first client connects.
+  Boolean isMulticast() const { return fMulticastAddress != 0; }
+
   void setRTCPAppPacketHandler(RTCPAppHandlerFunc* handler, void* clientData);
     // Sets a handler to be called if a RTCP "APP" packet arrives from any future client.
     // (Any current clients are not affected; any "APP" packets from them will continue to be
@@ -142,6 +153,9 @@ private:
   char fCNAME[100]; // for RTCP
   RTCPAppHandlerFunc* fAppHandlerTask;
   void* fAppHandlerClientData;
+  netAddressBits fMulticastAddress; // 0 unless "setMulticastDestination()" was called
+  portNumBits fMulticastRTPPortNum;
+  u_int8_t fMulticastTTL;
   friend class StreamState;
 };
 
@@ -191,6 +205,7 @@ public:
   void reclaim();
 
   unsigned& referenceCount() { return fReferenceCount; }
+  Boolean isCurrentlyPlaying() const { return fAreCurrentlyPlaying; }
 
   Port const& serverRTPPort() const { return fServerRTPPort; }
   Port const& serverRTCPPort() const { return fServerRTCPPort; }
@@ -40,6 +40,22 @@ typedef void ServerRequestAlternativeByteHandler(void* instance, u_int8_t reques
 // the same TCP connection.  A RTSP server implementation would supply a function like this - as a parameter to
 // "ServerMediaSubsession::startStream()".
 
+// Counters for the queue of data waiting to be sent over a RTP-over-TCP connection.
+// (All of the "RTPInterface"s that share a TCP connection - e.g., the RTP and RTCP channels of each
+//  track of a RTSP session - share one queue.)
+struct TCPSendQueueStats {
+  unsigned queuedBytes, queuedPackets; // the current depth of the queue
+  unsigned maxQueuedBytes; // the largest depth seen so far
+  unsigned numDroppedNonRefPackets; // video packets of non-reference frames, dropped first when the queue is full
+  unsigned numDroppedGOPPackets; // video packets dropped while waiting for the next key frame
+  unsigned numDroppedOtherPackets; // audio or RTCP packets that didn't fit even after dropping video
+  unsigned numKeyFrameRequests;
+};
+
+typedef void TCPSendQueueReportFunc(int socketNum, TCPSendQueueStats const& stats);
+    // Called when a RTP-over-TCP connection first starts dropping whole GOPs (at most every
+    // "RTPINTERFACE_TCP_REPORT_INTERVAL_SECS" seconds), and when it is closed after having dropped packets.
+
 class tcpStreamRecord {
 public:
   tcpStreamRecord(int streamSocketNum, unsigned char streamChannelId,
@@ -66,7 +82,35 @@ public:
 						     ServerRequestAlternativeByteHandler* handler, void* clientData);
   static void clearServerRequestAlternativeByteHandler(UsageEnvironment& env, int socketNum);
 
+  // Sending over TCP never blocks.  If the socket's send buffer is full, packets wait (in arrival order) in a
+  // queue of up to "tcpSendQueueMaxSize" bytes, shared by all interfaces that use the socket.  When this fills
+  // up, queued packets of non-reference video frames are dropped first; if that's not enough, all queued video
+  // is dropped, and the stream's video packets continue to be dropped until the next key frame (which is
+  // requested using the handler set by "setKeyFrameRequestHandler()").
+  static unsigned tcpSendQueueMaxSize; // default: RTPINTERFACE_TCP_SEND_QUEUE_MAX_SIZE
+  void setPayloadFormatName(char const* rtpPayloadFormatName);
+      // Tells us how to find frame boundaries and frame types in our packets.  ("H264" and "H265" video
+      // packets are dropped by frame type; all others are treated alike.)  Called by "RTPSink".
+  void setKeyFrameRequestHandler(TaskFunc* handler, void* clientData) {
+    fKeyFrameRequestHandler = handler; fKeyFrameRequestClientData = clientData;
+  }
+  static Boolean getTCPSendQueueStats(UsageEnvironment& env, int socketNum, TCPSendQueueStats& stats);
+      // Returns False if "socketNum" is not being used for RTP-over-TCP
+  static void setTCPSendQueueReportFunc(TCPSendQueueReportFunc* func) { fTCPSendQueueReportFunc = func; }
+  static Boolean sendDataOverStreamSocket(UsageEnvironment& env, int socketNum, u_int8_t const* data, unsigned dataSize);
+      // Used by a RTSP server to send a response over a TCP connection that may also be carrying RTP and RTCP.
+      // The data is queued - after any queued packets - rather than interleaved with them, and is never dropped.
+
   Boolean sendPacket(unsigned char* packet, unsigned packetSize);
+
+  // Batched sending of RTP packets over UDP.  (Packets sent over TCP are never batched.)
+  void setPacketBatching(unsigned maxPacketSize, unsigned maxPacketsPerBatch);
+      // Allocates an arena for up to "maxPacketsPerBatch" packets.  (0 disables batching.)
+  Boolean queuePacket(unsigned char* packet, unsigned packetSize);
+      // Like "sendPacket()", except that - if batching is enabled - UDP packets are copied into
+      // our arena, and are not sent until "flushPackets()" is called (or the arena becomes full).
+  Boolean flushPackets();
+      // Sends - in order - all packets that have been queued, with as few system calls as possible.
   void startNetworkReading(TaskScheduler::BackgroundHandlerProc*
                            handlerProc);
   Boolean handleRead(unsigned char* buffer, unsigned bufferMaxSize,
@@ -101,6 +145,8 @@ private:
   Boolean sendRTPorRTCPPacketOverTCP(unsigned char* packet, unsigned packetSize,
 				     int socketNum, unsigned char streamChannelId);
   Boolean sendDataOverTCP(int socketNum, u_int8_t const* data, unsigned dataSize, Boolean forceSendToSucceed);
+  u_int8_t classifyPacket(u_int8_t const* packet, unsigned packetSize, u_int32_t& rtpTimestamp) const;
+  void requestKeyFrame();
 
 private:
   friend class SocketDescriptor;
@@ -116,6 +162,18 @@ private:
 
   AuxHandlerFunc* fAuxReadHandlerFunc;
   void* fAuxReadHandlerClientData;
+
+  // The arena used for batched sending:
+  unsigned char* fBatchBuffer;
+  unsigned char** fBatchPackets;
+  unsigned* fBatchPacketSizes;
+  unsigned fBatchSlotSize, fBatchMaxPackets, fBatchNumPackets;
+
+  // Used by the RTP-over-TCP drop policy:
+  u_int8_t fVideoCodec;
+  TaskFunc* fKeyFrameRequestHandler;
+  void* fKeyFrameRequestClientData;
+  static TCPSendQueueReportFunc* fTCPSendQueueReportFunc;
 };
 
 #endif
@@ -54,9 +54,12 @@ public:
       // optional SDP line (e.g. a=fmtp:...)
 
   u_int16_t currentSeqNo() const { return fSeqNo; }
-  u_int32_t presetNextTimestamp();
+  u_int32_t presetNextTimestamp(Boolean resetTimestampBase = True);
       // ensures that the next timestamp to be used will correspond to
       // the current 'wall clock' time.
+      // If "resetTimestampBase" is False, the timestamp stream is left unchanged, and we just return
+      // the current 'wall clock' time as a RTP timestamp.  (Use this when a client joins a stream
+      // that's already being sent to other clients.)
 
   RTPTransmissionStatsDB& transmissionStatsDB() const {
     return *fTransmissionStatsDB;
@@ -84,6 +87,11 @@ public:
   void removeStreamSocket(int sockNum, unsigned char streamChannelId) {
     fRTPInterface.removeStreamSocket(sockNum, streamChannelId);
   }
+  void setKeyFrameRequestHandler(TaskFunc* handler, void* clientData) {
+    fRTPInterface.setKeyFrameRequestHandler(handler, clientData);
+  }
+      // "handler" is called when video packets have had to be dropped from a RTP-over-TCP connection,
+      // and a new key frame is needed (see "RTPInterface").
   unsigned& estimatedBitrate() { return fEstimatedBitrate; } // kbps; usually 0 (i.e., unset)
 
   u_int32_t SSRC() const {return fSSRC;}
@@ -5,6 +5,23 @@
 #define RTSPSERVER_CONF_FILE		RTSPSERVER_CONF_PATH"rtspserver.json"
 #define RTSPSERVER_CONF_DEFAULT  	RTSPSERVER_CONF_PATH"rtspserver.json.default"
 
+// RTP 发送缓存(OutPacketBuffer)的大小: 视频按码流的分辨率和码率计算，音频帧很小，使用固定值
+#define RTSPSERVER_AUDIO_OUT_BUFFER_SIZE	(64 * 1024)
+#define RTSPSERVER_MIN_OUT_BUFFER_SIZE		(64 * 1024)
+// 打印发送缓存池使用情况的周期
+#define RTSPSERVER_POOL_REPORT_INTERVAL_US	(10 * 1000 * 1000)
+// 组播的默认配置，每路码流占用 4 个端口(视频和音频各一对 RTP/RTCP)
+#define RTSPSERVER_MULTICAST_PORT			20000
+#define RTSPSERVER_MULTICAST_TTL			16
+#define RTSPSERVER_MULTICAST_MAX_STREAMS	32
+// 多线程模式下最多的工作线程数，每个线程运行一个 live555 事件循环
+#define RTSPSERVER_MAX_WORKERS				8
+// 最多同时添加的码流数
+#define RTSPSERVER_MAX_SMS					32
+
+// RTP over TCP 每个连接的发送队列上限，超过后按帧类型丢弃视频
+#define RTSPSERVER_TCP_SEND_QUEUE_KB		1024
+
 typedef enum
 {
 	RTSPSRV_AUDIO_TYPE_LPCM,
@@ -50,11 +67,25 @@ typedef struct
 	int suggest_buffer_region_size;
 }rtspserver_info_t;
 
+// rtsp server 的全局配置，对所有码流生效，从 rtspserver.json 读取
+typedef struct
+{
+	int		worker_threads;		// 运行 live555 事件循环的线程数，0: 和 CPU 核数相同
+	int		epoll;				// 1: 事件循环使用 epoll，0: 使用 live555 默认的 select
+	int		reuse_source;		// 1: 同一路码流的所有客户端共享一个码流源和一次 RTP 打包
+	int		multicast;			// 1: UDP 客户端从 SSM 组播接收码流，TCP 客户端仍然单播
+	char	multicast_addr[32];	// 组播地址，为空时每路码流随机选择一个 232.x.x.x 的地址
+	int		multicast_port;		// 第一路码流的 RTP 端口，后面的码流依次加 4
+	int		multicast_ttl;
+	int		tcp_send_queue_kb;	// RTP over TCP 每个客户端的发送队列大小(KB)
+}rtspserver_svr_info_t;
+
 #ifdef __cplusplus
 extern "C"{
 #endif
 int rtspserver_param_init(rtspserver_info_t* info);
 int rtspserver_param_save(rtspserver_info_t* info);
+int rtspserver_svr_param_init(rtspserver_svr_info_t* svr);
 
 #ifdef __cplusplus
 }
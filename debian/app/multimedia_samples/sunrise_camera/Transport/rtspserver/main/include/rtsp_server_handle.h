@@ -23,6 +23,7 @@ typedef struct
 	int					state;
 	void* 				instance;
 	rtspserver_info_t	params[32]; // 保存各sms配置
+	rtspserver_svr_info_t	svr; // 全局配置(工作线程数、共享码流源/组播)
 }rtsp_server_t;
 
 int rtsp_server_init();
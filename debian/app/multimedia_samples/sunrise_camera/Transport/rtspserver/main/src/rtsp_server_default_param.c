@@ -9,6 +9,7 @@
 
 #include "utils/utils_log.h"
 #include "utils/common_utils.h"
+#include "utils/cJSON.h"
 
 #include "rtsp_server_default_param.h"
 
@@ -43,5 +44,102 @@ int rtspserver_param_save(rtspserver_info_t* info)
 	return 0;
 }
 
+static void rtspserver_svr_param_default(rtspserver_svr_info_t* svr)
+{
+	memset(svr, 0, sizeof(rtspserver_svr_info_t));
+	svr->worker_threads = 1;
+	svr->epoll = 1;
+	svr->reuse_source = 1;
+	svr->multicast = 0;
+	svr->multicast_port = RTSPSERVER_MULTICAST_PORT;
+	svr->multicast_ttl = RTSPSERVER_MULTICAST_TTL;
+	svr->tcp_send_queue_kb = RTSPSERVER_TCP_SEND_QUEUE_KB;
+}
+
+static void rtspserver_svr_get_int(cJSON* root, const char* key, int* value)
+{
+	cJSON* item = cJSON_GetObjectItem(root, key);
+	if (item != NULL && cJSON_IsNumber(item))
+		*value = item->valueint;
+}
+
+/* 配置文件示例:
+ * {
+ *     "worker_threads": 4,
+ *     "epoll": 1,
+ *     "reuse_source": 1,
+ *     "multicast": 1,
+ *     "multicast_addr": "232.10.20.30",
+ *     "multicast_port": 20000,
+ *     "multicast_ttl": 16,
+ *     "tcp_send_queue_kb": 1024
+ * }
+ * 没有配置文件或者没有配置的项使用默认值
+ */
+int rtspserver_svr_param_init(rtspserver_svr_info_t* svr)
+{
+	FILE* fd = NULL;
+	long file_size = 0;
+	char* str_json = NULL;
+	cJSON* root = NULL;
+	cJSON* item = NULL;
 
+	rtspserver_svr_param_default(svr);
 
+	if (is_file_exist(RTSPSERVER_CONF_FILE) != 0)
+		return 0;
+
+	fd = fopen(RTSPSERVER_CONF_FILE, "r");
+	if (fd == NULL) {
+		SC_LOGW("open %s failed, use default config.", RTSPSERVER_CONF_FILE);
+		return 0;
+	}
+	fseek(fd, 0, SEEK_END);
+	file_size = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	str_json = (char*)malloc(file_size + 1);
+	if (str_json == NULL) {
+		fclose(fd);
+		return -1;
+	}
+	file_size = fread(str_json, 1, file_size, fd);
+	str_json[file_size] = '\0';
+	fclose(fd);
+
+	root = cJSON_Parse(str_json);
+	free(str_json);
+	if (root == NULL) {
+		SC_LOGW("parse %s failed, use default config.", RTSPSERVER_CONF_FILE);
+		return 0;
+	}
+
+	rtspserver_svr_get_int(root, "worker_threads", &svr->worker_threads);
+	rtspserver_svr_get_int(root, "epoll", &svr->epoll);
+	rtspserver_svr_get_int(root, "reuse_source", &svr->reuse_source);
+	rtspserver_svr_get_int(root, "multicast", &svr->multicast);
+	rtspserver_svr_get_int(root, "multicast_port", &svr->multicast_port);
+	rtspserver_svr_get_int(root, "multicast_ttl", &svr->multicast_ttl);
+	rtspserver_svr_get_int(root, "tcp_send_queue_kb", &svr->tcp_send_queue_kb);
+	item = cJSON_GetObjectItem(root, "multicast_addr");
+	if (item != NULL && cJSON_IsString(item) && item->valuestring != NULL)
+		snprintf(svr->multicast_addr, sizeof(svr->multicast_addr), "%s", item->valuestring);
+	cJSON_Delete(root);
+
+	if (svr->multicast_port <= 0 || svr->multicast_port > 65535 - 4 * RTSPSERVER_MULTICAST_MAX_STREAMS)
+		svr->multicast_port = RTSPSERVER_MULTICAST_PORT;
+	if (svr->worker_threads < 0)
+		svr->worker_threads = 1;
+	else if (svr->worker_threads > RTSPSERVER_MAX_WORKERS)
+		svr->worker_threads = RTSPSERVER_MAX_WORKERS;
+	if (svr->multicast_ttl <= 0 || svr->multicast_ttl > 255)
+		svr->multicast_ttl = RTSPSERVER_MULTICAST_TTL;
+	// 队列至少要能放下一个最大的 RTP over TCP 包
+	if (svr->tcp_send_queue_kb < 128)
+		svr->tcp_send_queue_kb = 128;
+
+	SC_LOGI("rtsp server config: %d worker threads, %s, reuse source %d, multicast %d [%s:%d ttl %d], tcp send queue %dKB",
+		svr->worker_threads, svr->epoll ? "epoll" : "select", svr->reuse_source, svr->multicast,
+		svr->multicast_addr[0] ? svr->multicast_addr : "random ssm",
+		svr->multicast_port, svr->multicast_ttl, svr->tcp_send_queue_kb);
+	return 0;
+}
@@ -34,7 +34,14 @@ int rtsp_server_init()
 int rtsp_server_prepare()
 {
 	rtsp_server_t *handle = &s_rtsp_server_handle;
+	rtspserver_svr_param_init(&handle->svr);
+	rtspsvr_wrap_set_workers(handle->instance, handle->svr.worker_threads);
+	rtspsvr_wrap_set_epoll(handle->instance, handle->svr.epoll);
+	rtspsvr_wrap_set_tcp_send_queue(handle->instance, handle->svr.tcp_send_queue_kb);
 	rtspsvr_wrap_prepare(handle->instance, 554);
+	rtspsvr_wrap_set_cast(handle->instance, handle->svr.reuse_source,
+		handle->svr.multicast, handle->svr.multicast_addr,
+		handle->svr.multicast_port, handle->svr.multicast_ttl);
 
 	handle->state = RTSP_SRV_STATE_PREPARE;
 	return 0;
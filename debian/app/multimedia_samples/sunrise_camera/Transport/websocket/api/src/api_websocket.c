@@ -18,6 +18,7 @@ static sdk_cmd_reg_t cmd_reg[] =
 	{SDK_CMD_WEBSOCKET_PARAM_SET,		websocket_cmd_impl,				1},
 	{SDK_CMD_WEBSOCKET_UPLOAD_FILE,		websocket_cmd_impl,				1},
 	{SDK_CMD_WEBSOCKET_SEND_MSG,		websocket_cmd_impl,				1},
+	{SDK_CMD_WEBSOCKET_SEND_ALOG_RESULT,	websocket_cmd_impl,			1},
 };
 
 int websocket_cmd_register()
@@ -66,6 +67,11 @@ int websocket_cmd_impl(SDK_CMD_E cmd, void* param)
 			ret = websocket_send_message((char*)param);
 			break;
 		}
+		case SDK_CMD_WEBSOCKET_SEND_ALOG_RESULT:
+		{
+			ret = websocket_send_alog_result((T_SDK_WEBSOCKET_ALOG_RESULT*)param);
+			break;
+		}
 #if 0
 		case SDK_CMD_WEBSOCKET_PARAM_GET:
 		{
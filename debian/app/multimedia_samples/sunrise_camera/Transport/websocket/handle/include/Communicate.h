@@ -27,5 +27,8 @@ SOFTWARE.
 
 ws_connection_close encodeMessage(ws_message *m);
 ws_connection_close encodeBinary(ws_message *m);
+int encodeHeader(char *header, char opcode, uint64_t len);
 ws_connection_close communicate(ws_client *n, char *next, uint64_t next_len);
+ws_connection_close parseFrame(ws_client *n, char *buffer, uint64_t length,
+		uint64_t *used, int *complete);
 #endif
@@ -97,6 +97,52 @@ typedef struct {
 	char *hybi00;
 } ws_message;
 
+#define WS_MAX_STREAMS 64 		/* Max streams pushed to one client */
+#define WS_OUT_QUEUE_MAX (1024 * 1024) 	/* Max bytes queued for one client */
+#define WS_FRAME_IOV_MAX (NALU_INDEX_MAX_COUNT * 3) 	/* header, payload, trailer */
+
+/**
+ * Encoded data waiting in the output queue of a client.
+ */
+typedef struct ws_out_n {
+	uint64_t len;
+	uint64_t sent;
+	struct ws_out_n *next;
+	char data[];
+} ws_out;
+
+/**
+ * One video frame being sent to a client. The payload points straight into
+ * the shm ring, the frame is posted once everything has been written. The
+ * writer never waits for readers, so the frame is checked with
+ * shm_stream_front_valid before every write.
+ */
+typedef struct {
+	shm_stream_t *source; 		/* NULL if no frame is staged */
+	int started; 				/* Some bytes of the frame are already sent */
+	int iov_count;
+	int iov_pos;
+	int nalu_count;
+	struct iovec iov[WS_FRAME_IOV_MAX];
+	char header[NALU_INDEX_MAX_COUNT][WS_HEADER_MAX + 12];
+} ws_frame_out;
+
+typedef enum {
+	WS_EVENT_LISTEN,
+	WS_EVENT_WAKE,
+	WS_EVENT_CLIENT,
+	WS_EVENT_STREAM
+} ws_event_type;
+
+/**
+ * The data attached to every fd registered in the epoll reactor.
+ */
+typedef struct {
+	ws_event_type type;
+	int index; 					/* Stream index, only for WS_EVENT_STREAM */
+	struct ws_client_n *client;
+} ws_event;
+
 typedef struct ws_client_n {
 	int socket_id;
 	char *client_ip;
@@ -104,15 +150,36 @@ typedef struct ws_client_n {
 	pthread_t thread_id;
 	ws_header *headers;
 	ws_message *message;
-	tsThread stream_thread;
 	int32_t stream_count; // 使能多少路码流
 	int32_t venc_chns_status; // 编码通道使能状态，对比的bit位为1，则说明使能了对应编码通道
-	shm_stream_t* shm_source[64]; // 支持传输多路码流
-	int32_t stream_chn[64]; // fShmSource 对应的编码通道号
+	shm_stream_t* shm_source[WS_MAX_STREAMS]; // 支持传输多路码流
+	int32_t stream_chn[WS_MAX_STREAMS]; // fShmSource 对应的编码通道号
+	int stream_fd[WS_MAX_STREAMS]; // 码流的 eventfd，-1 表示只能轮询
+	int stream_next; // 下一次优先读取的码流，多路码流轮流发送
 	struct ws_client_n *next;
 
 	int codec_type;
 	char *codec_type_string;
+	int alog_result_binary; 	// 客户端协商后使用二进制格式接收检测结果
+
+	/* 以下只由 reactor 线程访问 */
+	char *in_buf; 				// 非阻塞接收缓存，握手前存放请求头，握手后存放未解析完的帧
+	uint64_t in_len;
+	uint64_t in_size;
+	int handshaked;
+	uint64_t handshake_deadline; 	// 握手截止时间(单调时钟 ms)，超时还没握手的连接会被关闭
+	int closing;
+	int epoll_out; 				// 是否监听了 EPOLLOUT
+	int wake_fd; 				// reactor 的 eventfd，其他线程排队发送数据后用来唤醒 reactor
+	ws_event sock_event;
+	ws_event stream_event[WS_MAX_STREAMS];
+
+	/* 发送相关，受 out_lock 保护，所有线程写 socket 都要先持有 out_lock */
+	pthread_mutex_t out_lock;
+	ws_out *out_first;
+	ws_out *out_last;
+	uint64_t out_bytes;
+	ws_frame_out frame;
 } ws_client;
 
 typedef struct {
@@ -134,6 +201,7 @@ void list_remove_all(ws_list *l);
 void list_print(ws_list *l);
 void list_multicast(ws_list *l, ws_client *n);
 void list_multicast_one(ws_list *l, ws_client *n, ws_message *m);
+void list_multicast_one_iov(ws_list *l, ws_client *n, const struct iovec *iov, int iovcnt);
 void list_multicast_all(ws_list *l, ws_message *m);
 
 /**
@@ -141,6 +209,12 @@ void list_multicast_all(ws_list *l, ws_message *m);
  */
 void ws_closeframe(ws_client *n, ws_connection_close c);
 void ws_send(ws_client *n, ws_message *m);
+int ws_sendv(ws_client *n, const struct iovec *iov, int iovcnt);
+int ws_send_text(ws_client *n, const char *message, uint64_t length);
+int ws_encode_frame_header(ws_client *n, char *header, uint64_t len);
+int ws_client_write(ws_client *n, const struct iovec *iov, int iovcnt);
+int ws_client_flush(ws_client *n);
+void ws_frame_detach(ws_client *n);
 
 /**
  * New structures.
@@ -155,4 +229,5 @@ ws_message *message_new();
 void header_free(ws_header *h);
 void message_free(ws_message *m);
 void client_free(ws_client *n);
+void client_stream_free(ws_client *n);
 #endif
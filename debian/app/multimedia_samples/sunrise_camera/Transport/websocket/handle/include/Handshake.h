@@ -29,6 +29,7 @@ SOFTWARE.
 #define ERROR_BAD "HTTP/1.1 400 Bad Request\r\n\r\n"
 #define ERROR_NOT_IMPL "HTTP/1.1 501 Not Implemented\r\n\r\n"
 #define ERROR_FORBIDDEN "HTTP/1.1 403 Forbidden\r\n\r\n"
+#define ERROR_TIMEOUT "HTTP/1.1 408 Request Timeout\r\n\r\n"
 #define ERROR_VERSION "HTTP/1.1 426 Upgrade Required\r\nSec-WebSocket-Version: 13, 8, 7\r\n\r\n"
 
 #define ACCEPT_HEADER_V1 "HTTP/1.1 101 Web Socket Protocol Handshake\r\n"
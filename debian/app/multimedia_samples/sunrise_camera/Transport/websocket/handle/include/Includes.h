@@ -41,10 +41,13 @@ SOFTWARE.
 #include <netinet/in.h> 		/* sockaddr_in, inet_ntoa */
 #include <arpa/inet.h> 			/* htonl, htons, inet_ntoa */
 #include <sys/stat.h> 			/* stat */
+#include <sys/uio.h> 			/* writev, struct iovec */
 
 #define KEYSIZE 16 				/* The size of the key in Hybi-00 */
 #define BUFFERSIZE 8192 		/* Buffer size = 8KB */
 #define MAXMESSAGE 1048576 		/* Max size message = 1MB */
+#define WS_HEADER_MAX 10 		/* Max size of a RFC6455 server frame header */
+#define WS_IOV_MAX 8 			/* Max iovec count of one scatter-gather frame */
 #define ORIGIN_REQUIRED 0 		/* If this value is other than 0, client must 
 								   supply origin in header */
 
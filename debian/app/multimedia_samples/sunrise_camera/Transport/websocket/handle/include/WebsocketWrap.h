@@ -34,6 +34,9 @@ extern "C"
 typedef struct {
 	ws_list *m_list;
 	int m_port;
+	int m_epoll_fd; 		// reactor 的 epoll，监听 socket、客户端和码流 eventfd
+	int m_wake_fd; 			// 其他线程向客户端输出队列添加数据后写此 eventfd 唤醒 reactor
+	ws_client *m_pending; 	// 还没有完成握手的客户端，只由 reactor 线程访问
 	tsThread ws_server_thread;
 } ws_wrap_t;
 
@@ -41,9 +44,13 @@ ws_wrap_t *ws_wrap_instace();
 void ws_wrap_destory(ws_wrap_t *instance);
 int ws_wrap_start(int port_num);
 int ws_send_message(const char *message, uint64_t length);
+int ws_send_alog_result(const char *json, uint64_t json_len, const void *bin, uint64_t bin_len);
 int ws_send_binary(ws_client *n, unsigned char *message, uint64_t length);
 int ws_send_nalu_to_wfs(ws_client *n, uint32_t header_info,
 		uint64_t timestamp, unsigned char *message, uint64_t length);
+void ws_frame_finish(ws_client *n, shm_stream_t *source);
+int ws_client_stream_start(ws_client *n);
+void ws_client_stream_stop(ws_client *n);
 
 #ifdef __cplusplus
 }
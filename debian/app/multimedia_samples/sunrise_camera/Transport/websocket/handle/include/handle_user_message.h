@@ -4,5 +4,6 @@
 #define WS_MAX_BUFFER 10 * 1024
 
 int handle_user_msg(ws_list *l, ws_client *n, char *msg);
+int ws_push_stream(ws_client *n, int index);
 
 #endif
@@ -341,53 +341,49 @@ ws_connection_close getWholeMessage(char *buffer, uint64_t buffer_length,
 |					  Payload Data continued ...				|
 +---------------------------------------------------------------+
 */
+/**
+ * Writes the RFC6455 frame header for a payload of len bytes into header,
+ * which must hold at least WS_HEADER_MAX bytes.
+ *
+ * @param type(char *) header [Destination of the frame header]
+ * @param type(char) opcode [FIN bit and opcode of the frame]
+ * @param type(uint64_t) len [Length of the payload]
+ * @return type(int) [Length of the frame header]
+ */
+int encodeHeader(char *header, char opcode, uint64_t len) {
+	header[0] = opcode;
+	if (len <= 125) {
+		header[1] = len;
+		return 2;
+	} else if (len <= 65535) {
+		uint16_t sz16 = htons(len);
+		header[1] = 126;
+		memcpy(header + 2, &sz16, sizeof(uint16_t));
+		return 4;
+	} else {
+		uint64_t sz64 = ntohl64(len);
+		header[1] = 127;
+		memcpy(header + 2, &sz64, sizeof(uint64_t));
+		return 10;
+	}
+}
+
 ws_connection_close _encodeMessage(ws_message *m, char opcode) {
-	uint64_t length = m->len;
+	char header[WS_HEADER_MAX];
+	int header_len = encodeHeader(header, opcode, m->len);
 
 	/**
 	 * RFC6455 message encoding
 	 */
-	if (m->len <= 125) {
-		length += 2;
-		m->enc = (char *) malloc(sizeof(char) * length);
-		if (m->enc == NULL) {
-			printf("6: Couldn't allocate memory.\n\n");
-			fflush(stdout);
-			return CLOSE_UNEXPECTED;
-		}
-		m->enc[0] = opcode;
-		m->enc[1] = m->len;
-		memcpy(m->enc + 2, m->msg, m->len);
-	} else if (m->len <= 65535) {
-		uint16_t sz16;
-		length += 4;
-		m->enc = (char *) malloc(sizeof(char) * length);
-		if (m->enc == NULL) {
-			printf("7: Couldn't allocate memory.\n\n");
-			fflush(stdout);
-			return CLOSE_UNEXPECTED;
-		}
-		m->enc[0] = opcode;
-		m->enc[1] = 126;
-		sz16 = htons(m->len);
-		memcpy(m->enc + 2, &sz16, sizeof(uint16_t));
-		memcpy(m->enc + 4, m->msg, m->len);
-	} else {
-		uint64_t sz64;
-		length += 10;
-		m->enc = (char *) malloc(sizeof(char) * length);
-		if (m->enc == NULL) {
-			printf("8: Couldn't allocate memory.\n\n");
-			fflush(stdout);
-			return CLOSE_UNEXPECTED;
-		}
-		m->enc[0] = opcode;
-		m->enc[1] = 127;
-		sz64 = ntohl64(m->len);
-		memcpy(m->enc + 2, &sz64, sizeof(uint64_t));
-		memcpy(m->enc + 10, m->msg, m->len);
+	m->enc = (char *) malloc(sizeof(char) * (m->len + header_len));
+	if (m->enc == NULL) {
+		printf("6: Couldn't allocate memory.\n\n");
+		fflush(stdout);
+		return CLOSE_UNEXPECTED;
 	}
-	m->enc_len = length;
+	memcpy(m->enc, header, header_len);
+	memcpy(m->enc + header_len, m->msg, m->len);
+	m->enc_len = m->len + header_len;
 
 	/**
 	 * Hybi-00 message encoding
@@ -416,6 +412,199 @@ ws_connection_close encodeBinary(ws_message *m) {
 
 
 
+/**
+ * Parses the next frame from the data received so far, without blocking.
+ * Fragmented messages are collected in n->message until the final frame
+ * arrives.
+ *
+ * @param type(ws_client *) n [Client]
+ * @param type(char *) buffer [The data received so far]
+ * @param type(uint64_t) length [Length of the data]
+ * @param type(uint64_t *) used [Bytes consumed, 0 if the frame is incomplete]
+ * @param type(int *) complete [1 if n->message holds a whole text message]
+ * @return type(ws_connection_close) [CONTINUE or the reason to close]
+ */
+ws_connection_close parseFrame(ws_client *n, char *buffer, uint64_t length,
+		uint64_t *used, int *complete) {
+	uint64_t payload, i;
+	int skip, length7;
+	char mask[4];
+	char *temp;
+	ws_message *m;
+	ws_connection_close status;
+
+	*used = 0;
+	*complete = 0;
+	if (length == 0) {
+		return CONTINUE;
+	}
+
+	if ( n->headers->type == HYBI00 ) {
+		/**
+		 * Messages are put between '\x00' and '\xFF', '\xFF' first means
+		 * that the client wished to shut down.
+		 */
+		if (buffer[0] == '\xFF') {
+			printf("Client:\n"
+				  "\tSocket: %d\n"
+				  "\tAddress: %s\n"
+				  "reports that he is shutting down.\n\n", n->socket_id,
+				  (char *) n->client_ip);
+			fflush(stdout);
+			return CLOSE_NORMAL;
+		} else if (buffer[0] != '\x00') {
+			return CLOSE_PROTOCOL;
+		}
+
+		temp = memchr(buffer + 1, '\xFF', length - 1);
+		if (temp == NULL) {
+			return length > MAXMESSAGE ? CLOSE_BIG : CONTINUE;
+		}
+		payload = temp - buffer - 1;
+
+		n->message = message_new();
+		if (n->message == NULL || (n->message->msg = malloc(payload + 1)) == NULL) {
+			printf("4: Couldn't allocate memory.\n\n");
+			fflush(stdout);
+			return CLOSE_UNEXPECTED;
+		}
+		memcpy(n->message->msg, buffer + 1, payload);
+		n->message->msg[payload] = '\0';
+		n->message->len = payload;
+		*used = payload + 2;
+
+		if ( (status = encodeMessage(n->message)) != CONTINUE) {
+			return status;
+		}
+		*complete = 1;
+		return CONTINUE;
+	} else if ( n->headers->type != HYBI07 && n->headers->type != RFC6455
+			&& n->headers->type != HYBI10 ) {
+		return CLOSE_PROTOCOL;
+	}
+
+	if (length < 2) {
+		return CONTINUE;
+	}
+	if (!(buffer[1] & 0x80)) {
+		printf("Message didn't have masked data, received: 0x%x\n\n",
+				buffer[1]);
+		fflush(stdout);
+		return CLOSE_PROTOCOL;
+	}
+
+	length7 = buffer[1] & 0x7f;
+	skip = length7 <= 125 ? 6 : (length7 == 126 ? 8 : 14);
+	if (length < (uint64_t) skip) {
+		return CONTINUE;
+	}
+
+	if (length7 <= 125) {
+		payload = length7;
+	} else if (length7 == 126) {
+		uint16_t sz16;
+		memcpy(&sz16, buffer + 2, sizeof(uint16_t));
+		payload = ntohs(sz16);
+	} else {
+		uint64_t sz64;
+		memcpy(&sz64, buffer + 2, sizeof(uint64_t));
+		payload = ntohl64(sz64);
+	}
+	memcpy(mask, buffer + skip - 4, sizeof(mask));
+
+	if (payload > MAXMESSAGE) {
+		printf("Message received was bigger than MAXMESSAGE.");
+		fflush(stdout);
+		return CLOSE_BIG;
+	}
+	if (length < skip + payload) {
+		return CONTINUE;
+	}
+	*used = skip + payload;
+
+	/**
+	 * Control frames may come between the fragments of a message.
+	 */
+	if (buffer[0] & 0x08) {
+		if ((buffer[0] & 0x0f) == 0x08) {
+			/**
+			 * CLOSE: client wants to close connection, so we do.
+			 **/
+			printf("Client:\n"
+				  "\tSocket: %d\n"
+				  "\tAddress: %s\n"
+				  "reports that he is shutting down.\n\n", n->socket_id,
+				  (char *) n->client_ip);
+			fflush(stdout);
+			return CLOSE_NORMAL;
+		}
+		/**
+		 * PING/PONG: the client is still alive, nothing to do.
+		 **/
+		return CONTINUE;
+	}
+
+	if ((buffer[0] & 0x0f) != 0) {
+		if (n->message != NULL) {
+			return CLOSE_PROTOCOL;
+		}
+		n->message = message_new();
+		if (n->message == NULL) {
+			return CLOSE_UNEXPECTED;
+		}
+		memcpy(n->message->opcode, buffer, sizeof(n->message->opcode));
+	} else if (n->message == NULL) {
+		return CLOSE_PROTOCOL;
+	}
+	m = n->message;
+
+	if (m->len + payload > MAXMESSAGE) {
+		printf("Message received was bigger than MAXMESSAGE.");
+		fflush(stdout);
+		return CLOSE_BIG;
+	}
+	temp = realloc(m->msg, m->len + payload + 1);
+	if (temp == NULL) {
+		printf("2: Couldn't allocate memory.\n\n");
+		fflush(stdout);
+		return CLOSE_UNEXPECTED;
+	}
+	m->msg = temp;
+
+	/**
+	 * Remove the masking from the data.
+	 */
+	for (i = 0; i < payload; i++) {
+		m->msg[m->len + i] = buffer[skip + i] ^ mask[i % 4];
+	}
+	m->len += payload;
+	m->msg[m->len] = '\0';
+
+	if (!(buffer[0] & 0x80)) {
+		return CONTINUE;
+	}
+
+	if ((m->opcode[0] & 0x0f) == 0x02) {
+		printf("Binary data arrived\n\n");
+		fflush(stdout);
+		return CLOSE_TYPE;
+	} else if ((m->opcode[0] & 0x0f) != 0x01) {
+		printf("Something very strange happened, received opcode: 0x%x\n\n",
+				m->opcode[0]);
+		fflush(stdout);
+		return CLOSE_UNEXPECTED;
+	}
+
+	/**
+	 * TEXT: encode the message to make it ready to be send to all others.
+	 **/
+	if ( (status = encodeMessage(m)) != CONTINUE) {
+		return status;
+	}
+	*complete = 1;
+	return CONTINUE;
+}
+
 ws_connection_close communicate(ws_client *n, char *next, uint64_t next_len) {
 	int buffer_length = 0;
 	uint64_t buf_len;
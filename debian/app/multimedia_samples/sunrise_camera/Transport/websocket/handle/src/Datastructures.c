@@ -21,6 +21,7 @@ SOFTWARE.
 ******************************************************************************/
 
 #include "Datastructures.h"
+#include "Communicate.h"
 
 /**
  * Creates a new list structure.
@@ -261,6 +262,49 @@ void list_multicast_one(ws_list *l, ws_client *n, ws_message *m) {
 	pthread_mutex_unlock(&l->lock);
 }
 
+/**
+ * Sends one binary frame, whose payload is scattered over iov, to one specific
+ * client. The payload is written straight from the given buffers.
+ *
+ * @param type(ws_list *) l [List containing clients]
+ * @param type(ws_client *) n [Client]
+ * @param type(const struct iovec *) iov [Payload buffers]
+ * @param type(int) iovcnt [Number of payload buffers]
+ */
+void list_multicast_one_iov(ws_list *l, ws_client *n, const struct iovec *iov, int iovcnt) {
+	ws_client *p;
+	int i = 0;
+	pthread_mutex_lock(&l->lock);
+	uint64_t start = get_timestamp_ms();
+	p = l->first;
+
+	if (p == NULL || n == NULL) {
+		pthread_mutex_unlock(&l->lock);
+		return;
+	}
+
+	do {
+		if (p == n) {
+			ws_sendv(p, iov, iovcnt);
+			i++;
+			break;
+		}
+		p = p->next;
+	} while (p != NULL);
+
+	//网络异常的情况下，打印日志，方便定位问题
+	uint64_t end = get_timestamp_ms();
+	int diff = end - start;
+	if(diff > 30){
+		uint64_t len = 0;
+		for (int j = 0; j < iovcnt; j++)
+			len += iov[j].iov_len;
+		SC_LOGW("%d ms, data len:%llu, client count: %d", diff, (unsigned long long)len, i);
+	}
+
+	pthread_mutex_unlock(&l->lock);
+}
+
 /**
  * Multicasts message to all client in the list.
  *
@@ -332,33 +376,419 @@ void ws_closeframe(ws_client *n, ws_connection_close s) {
 		 * TODO:
 		 * 		- Use ws_connection_close
 		 */
-		send(n->socket_id, frame, 2, 0);
+		send(n->socket_id, frame, 2, MSG_NOSIGNAL);
 	} else if (n->headers->type == HYBI00) {
 		frame[0] = '\xFF';
 		frame[1] = '\x00';
-		send(n->socket_id, frame, 2, 0);
-		pthread_cancel(n->thread_id);
+		send(n->socket_id, frame, 2, MSG_NOSIGNAL);
 	}
 }
 
 /**
- * Function which do the actual sending of messages.
+ * Function which do the actual sending of messages. The encoded message is
+ * written right away if the socket accepts it, what is left is queued and
+ * sent by the reactor when the socket becomes writable.
  *
  * @param type(ws_client *) n [Client]
  * @param type(ws_message *) m [Message structure, that will be sent]
  */
 void ws_send(ws_client *n, ws_message *m) {
+	struct iovec iov;
+
 	if ( n->headers->type == HYBI00 ) {
 		/**
 		 * Adds 2 to the length of the message, as we have to put '\x00' and
 		 * '\xFF' in the front and end of the message.
 		 */
-		send(n->socket_id, m->hybi00, m->len+2, 0);
-	} else if ( n->headers->type == HIXIE75 ) {
+		iov.iov_base = m->hybi00;
+		iov.iov_len = m->len+2;
+	} else if ( n->headers->type == HYBI07 || n->headers->type == RFC6455
+			|| n->headers->type == HYBI10) {
+		iov.iov_base = m->enc;
+		iov.iov_len = m->enc_len;
+	} else {
+		return;
+	}
+	ws_client_write(n, &iov, 1);
+}
 
+/**
+ * Writes the header of a frame with the given opcode carrying len bytes.
+ */
+static int ws_encode_header(ws_client *n, char *header, char opcode, uint64_t len) {
+	if ( n->headers->type == HYBI00 ) {
+		header[0] = '\x00';
+		return 1;
 	} else if ( n->headers->type == HYBI07 || n->headers->type == RFC6455
 			|| n->headers->type == HYBI10) {
-		send(n->socket_id, m->enc, m->enc_len, 0);
+		return encodeHeader(header, opcode, len);
+	}
+	return -1;
+}
+
+/**
+ * Writes the header of a binary frame carrying len bytes. For Hybi-00 this
+ * is the leading '\x00', the caller has to append the trailing '\xFF'.
+ *
+ * @param type(ws_client *) n [Client]
+ * @param type(char *) header [At least WS_HEADER_MAX bytes]
+ * @param type(uint64_t) len [Length of the payload]
+ * @return type(int) [Length of the header, -1 if the client type is unknown]
+ */
+int ws_encode_frame_header(ws_client *n, char *header, uint64_t len) {
+	return ws_encode_header(n, header, '\x82', len);
+}
+
+/**
+ * Non-blocking scatter-gather send, never raises SIGPIPE.
+ */
+static ssize_t ws_sendmsg(int fd, struct iovec *iov, int iovcnt) {
+	struct msghdr msg;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	do {
+		ret = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+/**
+ * Skips the first len bytes of the buffers.
+ */
+static void ws_iov_advance(struct iovec **iov, int *iovcnt, size_t len) {
+	while (*iovcnt > 0 && len >= (*iov)->iov_len) {
+		len -= (*iov)->iov_len;
+		(*iov)++;
+		(*iovcnt)--;
+	}
+	if (*iovcnt > 0) {
+		(*iov)->iov_base = (char *) (*iov)->iov_base + len;
+		(*iov)->iov_len -= len;
+	}
+}
+
+/**
+ * Copies the buffers into a new output queue entry.
+ */
+static ws_out *ws_out_new(const struct iovec *iov, int iovcnt) {
+	uint64_t len = 0;
+	ws_out *o;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+	o = (ws_out *) malloc(sizeof(ws_out) + len);
+	if (o == NULL) {
+		return NULL;
+	}
+	o->len = len;
+	o->sent = 0;
+	o->next = NULL;
+	for (i = 0, len = 0; i < iovcnt; i++) {
+		memcpy(o->data + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	return o;
+}
+
+/**
+ * Writes one whole websocket frame to the client, in any thread. If the
+ * socket is busy, the rest of the frame is copied to the output queue and
+ * the reactor is woken up to send it.
+ *
+ * @param type(ws_client *) n [Client]
+ * @param type(const struct iovec *) iov [The encoded frame]
+ * @param type(int) iovcnt [Number of buffers, at most WS_IOV_MAX]
+ * @return type(int) [0 on success, -1 if the frame is dropped]
+ */
+int ws_client_write(ws_client *n, const struct iovec *iov, int iovcnt) {
+	struct iovec frame[WS_IOV_MAX];
+	struct iovec *p = frame;
+	uint64_t len = 0;
+	ssize_t ret = 0;
+	ws_out *o;
+	int i;
+
+	if (iovcnt > WS_IOV_MAX) {
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++) {
+		frame[i] = iov[i];
+		len += iov[i].iov_len;
+	}
+
+	pthread_mutex_lock(&n->out_lock);
+	if (n->out_first == NULL && !n->frame.started) {
+		ret = ws_sendmsg(n->socket_id, frame, iovcnt);
+		if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			pthread_mutex_unlock(&n->out_lock);
+			return -1;
+		}
+		if (ret > 0) {
+			ws_iov_advance(&p, &iovcnt, ret);
+		}
+		if (iovcnt == 0) {
+			pthread_mutex_unlock(&n->out_lock);
+			return 0;
+		}
+	}
+
+	// 已经发出部分数据时必须把剩余部分放入队列，否则后续帧的格式会错乱
+	if (ret <= 0 && n->out_bytes + len > WS_OUT_QUEUE_MAX) {
+		pthread_mutex_unlock(&n->out_lock);
+		SC_LOGW("client %s is too slow, drop message len:%llu, queued:%llu.",
+			n->client_ip, (unsigned long long) len, (unsigned long long) n->out_bytes);
+		return -1;
+	}
+	o = ws_out_new(p, iovcnt);
+	if (o == NULL) {
+		pthread_mutex_unlock(&n->out_lock);
+		return -1;
+	}
+	if (n->out_last != NULL) {
+		n->out_last = n->out_last->next = o;
+	} else {
+		n->out_first = n->out_last = o;
+	}
+	n->out_bytes += o->len;
+	pthread_mutex_unlock(&n->out_lock);
+
+	if (n->wake_fd >= 0) {
+		uint64_t one = 1;
+		if (write(n->wake_fd, &one, sizeof(one)) < 0) {
+			SC_LOGW("wake up reactor failed: %s", strerror(errno));
+		}
+	}
+	return 0;
+}
+
+/**
+ * Sends one frame whose payload is scattered over iov. The frame header is
+ * built on the stack and written together with the payload.
+ */
+static int ws_sendv_opcode(ws_client *n, char opcode, const struct iovec *iov, int iovcnt) {
+	struct iovec frame[WS_IOV_MAX];
+	char header[WS_HEADER_MAX];
+	char trailer = '\xFF';
+	uint64_t len = 0;
+	int i, count = 0;
+
+	if (iovcnt > WS_IOV_MAX - 2) {
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
+	frame[count].iov_base = header;
+	frame[count].iov_len = ws_encode_header(n, header, opcode, len);
+	if ((int) frame[count++].iov_len < 0) {
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++) {
+		frame[count++] = iov[i];
+	}
+	if ( n->headers->type == HYBI00 ) {
+		frame[count].iov_base = &trailer;
+		frame[count++].iov_len = 1;
+	}
+
+	return ws_client_write(n, frame, count);
+}
+
+/**
+ * Sends one binary frame whose payload is scattered over iov. The frame
+ * header is built on the stack and written together with the payload, so
+ * the payload is neither allocated nor copied unless the socket is busy.
+ *
+ * @param type(ws_client *) n [Client]
+ * @param type(const struct iovec *) iov [Payload buffers]
+ * @param type(int) iovcnt [Number of payload buffers, at most WS_IOV_MAX - 2]
+ * @return type(int) [0 on success, -1 on error]
+ */
+int ws_sendv(ws_client *n, const struct iovec *iov, int iovcnt) {
+	return ws_sendv_opcode(n, '\x82', iov, iovcnt);
+}
+
+/**
+ * Sends one text frame straight from the given buffer, the message is
+ * neither allocated nor copied unless the socket is busy.
+ *
+ * @param type(ws_client *) n [Client]
+ * @param type(const char *) message [The text, not necessarily terminated]
+ * @param type(uint64_t) length [Length of the text]
+ * @return type(int) [0 on success, -1 on error]
+ */
+int ws_send_text(ws_client *n, const char *message, uint64_t length) {
+	struct iovec iov;
+
+	iov.iov_base = (void *) message;
+	iov.iov_len = length;
+	return ws_sendv_opcode(n, '\x81', &iov, 1);
+}
+
+/**
+ * Returns 1 if nothing of the websocket message at iov_pos is sent yet, so
+ * the rest of the staged frame can be dropped without breaking the framing.
+ */
+static int ws_frame_at_boundary(ws_frame_out *f) {
+	int i;
+
+	if (f->iov_pos >= f->iov_count) {
+		return 1;
+	}
+	for (i = 0; i < f->nalu_count; i++) {
+		if (f->iov[f->iov_pos].iov_base == f->header[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Sends the staged video frame. Returns 0 when the whole frame is written
+ * (or dropped), 1 when the socket is busy and -1 on error.
+ */
+static int ws_frame_write(ws_client *n) {
+	ws_frame_out *f = &n->frame;
+	struct iovec *p = &f->iov[f->iov_pos];
+	int count = f->iov_count - f->iov_pos;
+	ssize_t ret;
+
+	while (count > 0) {
+		// 负载直接指向共享内存，写端不会等待读端，每次写之前都要确认这一帧还没有被覆盖
+		if (!shm_stream_front_valid(f->source)) {
+			if (ws_frame_at_boundary(f)) {
+				SC_LOGW("client %s is too slow, drop the rest of the frame.", n->client_ip);
+				return 0;
+			}
+			// 已经发出了部分消息，剩下的数据已经无效，只能断开
+			SC_LOGE("client %s is too slow, frame is covered while sending.", n->client_ip);
+			return -1;
+		}
+		ret = ws_sendmsg(n->socket_id, p, count);
+		if (ret < 0) {
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+		}
+		f->started = 1;
+		ws_iov_advance(&p, &count, ret);
+		f->iov_pos = f->iov_count - count;
+	}
+	return 0;
+}
+
+/**
+ * Releases the staged video frame.
+ */
+static void ws_frame_release(ws_client *n) {
+	if (n->frame.source != NULL) {
+		shm_stream_post(n->frame.source);
+	}
+	n->frame.source = NULL;
+	n->frame.started = 0;
+	n->frame.iov_count = 0;
+	n->frame.iov_pos = 0;
+	n->frame.nalu_count = 0;
+}
+
+/**
+ * Writes as much pending data as the socket accepts, in the reactor thread
+ * with out_lock held. A frame that is partly sent always goes first, then
+ * the output queue, then the staged video frame.
+ *
+ * @param type(ws_client *) n [Client]
+ * @return type(int) [0 when nothing is pending, 1 when the socket is busy,
+ * 					 -1 on error]
+ */
+int ws_client_flush(ws_client *n) {
+	ws_out *o;
+	ssize_t ret;
+	int status;
+
+	while (1) {
+		if (n->frame.source != NULL && (n->frame.started || n->out_first == NULL)) {
+			if ((status = ws_frame_write(n)) != 0) {
+				return status;
+			}
+			ws_frame_release(n);
+			continue;
+		}
+
+		o = n->out_first;
+		if (o == NULL) {
+			return 0;
+		}
+		do {
+			ret = send(n->socket_id, o->data + o->sent, o->len - o->sent,
+					MSG_DONTWAIT | MSG_NOSIGNAL);
+		} while (ret < 0 && errno == EINTR);
+		if (ret < 0) {
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+		}
+		o->sent += ret;
+		if (o->sent < o->len) {
+			return 1;
+		}
+		n->out_first = o->next;
+		if (n->out_first == NULL) {
+			n->out_last = NULL;
+		}
+		n->out_bytes -= o->len;
+		free(o);
+	}
+}
+
+/**
+ * Drops the staged video frame before its stream is destroyed, with
+ * out_lock held. The unsent part of a frame that is partly sent is moved to
+ * the head of the output queue, so the client still receives whole frames.
+ * If that part is already covered by the writer, the client is closed.
+ *
+ * @param type(ws_client *) n [Client]
+ */
+void ws_frame_detach(ws_client *n) {
+	ws_frame_out *f = &n->frame;
+	ws_out *o;
+
+	if (f->source != NULL && f->started && !ws_frame_at_boundary(f)
+			&& !shm_stream_front_valid(f->source)) {
+		// 剩下的数据已经被写端覆盖，无法补全消息
+		SC_LOGE("client %s frame is covered while sending.", n->client_ip);
+		n->closing = 1;
+	} else if (f->source != NULL && f->started && f->iov_pos < f->iov_count) {
+		o = ws_out_new(&f->iov[f->iov_pos], f->iov_count - f->iov_pos);
+		if (o != NULL) {
+			o->next = n->out_first;
+			n->out_first = o;
+			if (n->out_last == NULL) {
+				n->out_last = o;
+			}
+			n->out_bytes += o->len;
+		}
+	}
+	ws_frame_release(n);
+}
+
+/**
+ * Destroys the shm readers of all the streams pushed to the client.
+ *
+ * @param type(ws_client *) n [Client]
+ */
+void client_stream_free(ws_client *n) {
+	pthread_mutex_lock(&n->out_lock);
+	ws_frame_detach(n);
+	pthread_mutex_unlock(&n->out_lock);
+
+	for (int i = 0; i < WS_MAX_STREAMS; i++) {
+		if (n->shm_source[i] != NULL) {
+			shm_stream_destory(n->shm_source[i]); // 销毁共享内存读句柄，同时关闭其 eventfd
+			n->shm_source[i] = NULL;
+		}
+		n->stream_fd[i] = -1;
 	}
 }
 
@@ -373,6 +803,7 @@ ws_client *client_new (int sock, char *addr) {
 	ws_client *n = (ws_client *) malloc(sizeof(ws_client));
 
 	if (n != NULL) {
+		memset(n, 0, sizeof(ws_client));
 		n->socket_id = sock;
 		n->client_ip = addr;
 		n->string = NULL;
@@ -380,6 +811,11 @@ ws_client *client_new (int sock, char *addr) {
 		n->headers = NULL;
 		n->message = NULL;
 		n->next = NULL;
+		n->wake_fd = -1;
+		for (int i = 0; i < WS_MAX_STREAMS; i++) {
+			n->stream_fd[i] = -1;
+		}
+		pthread_mutex_init(&n->out_lock, NULL);
 	}
 
 	return n;
@@ -523,4 +959,22 @@ void client_free(ws_client *n) {
 		free(n->message);
 		n->message = NULL;
 	}
+
+	if (n->in_buf != NULL) {
+		free(n->in_buf);
+		n->in_buf = NULL;
+	}
+
+	client_stream_free(n);
+
+	pthread_mutex_lock(&n->out_lock);
+	while (n->out_first != NULL) {
+		ws_out *o = n->out_first;
+		n->out_first = o->next;
+		free(o);
+	}
+	n->out_last = NULL;
+	n->out_bytes = 0;
+	pthread_mutex_unlock(&n->out_lock);
+	pthread_mutex_destroy(&n->out_lock);
 }
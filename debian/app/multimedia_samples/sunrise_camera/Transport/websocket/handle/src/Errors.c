@@ -57,7 +57,7 @@ void handshake_error(const char *message, const char *status, ws_client *n) {
 			message);
 	fflush(stdout);	
 
-	send(n->socket_id, status, strlen(status), 0);
+	send(n->socket_id, status, strlen(status), MSG_NOSIGNAL);
 	shutdown(n->socket_id, SHUT_RDWR);
 	
 	if (n != NULL) {
@@ -767,7 +767,7 @@ int sendHandshake(ws_client *n) {
 		}
 	}
 
-	send(n->socket_id, response, length, 0);
+	send(n->socket_id, response, length, MSG_NOSIGNAL);
 
 	if (response != NULL) {
 		free(response);
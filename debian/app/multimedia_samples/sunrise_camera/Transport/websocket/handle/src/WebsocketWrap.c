@@ -21,7 +21,9 @@
  ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/prctl.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "Handshake.h"
 #include "Errors.h"
@@ -30,6 +32,9 @@
 #include "WebsocketWrap.h"
 
 #define PORT 4567
+#define WS_EPOLL_EVENTS 64 			/* Max events handled per epoll_wait */
+#define WS_HANDSHAKE_MAX (64 * 1024) 	/* Max size of the request headers */
+#define WS_HANDSHAKE_TIMEOUT_MS 5000 	/* Max time to receive the request headers */
 
 static ws_wrap_t *g_ws_instance = NULL;
 
@@ -45,6 +50,9 @@ ws_wrap_t *ws_wrap_instace()
 		 */
 		g_ws_instance->m_list = list_new();
 		g_ws_instance->m_port = PORT; // 默认4567端口
+		g_ws_instance->m_epoll_fd = -1;
+		g_ws_instance->m_wake_fd = -1;
+		g_ws_instance->m_pending = NULL;
 	}
 
 	return g_ws_instance;
@@ -58,6 +66,11 @@ void ws_wrap_destory(ws_wrap_t *instance)
 		list_free(instance->m_list);
 		instance->m_list = NULL;
 	}
+	if (instance->m_wake_fd >= 0)
+	{
+		close(instance->m_wake_fd);
+		instance->m_wake_fd = -1;
+	}
 	if (instance)
 		free(instance);
 }
@@ -85,292 +98,593 @@ void sigint_handler(int sig)
 }
 
 /**
- * Shuts down a client in a safe way. This is only used for Hybi-00.
+ * Sends a text message to all clients, straight from the given buffer.
  */
-void cleanup_client(void *args)
+int ws_send_message(const char *message, uint64_t length)
 {
-	ws_client *n = args;
-	if (n != NULL)
-	{
-		printf("Shutting client down..\n\n> ");
-		fflush(stdout);
-		list_remove(g_ws_instance->m_list, n);
+	ws_list *l;
+	ws_client *p;
+
+	if (g_ws_instance == NULL)
+		return -1;
+
+	l = g_ws_instance->m_list;
+	pthread_mutex_lock(&l->lock);
+	for (p = l->first; p != NULL; p = p->next) {
+		ws_send_text(p, message, length);
 	}
+	pthread_mutex_unlock(&l->lock);
+	return 0;
 }
 
-int ws_send_message(const char *message, uint64_t length)
+/**
+ * Sends an algorithm result to all clients. Clients that negotiated the
+ * binary format get bin instead of json when it is available.
+ */
+int ws_send_alog_result(const char *json, uint64_t json_len, const void *bin, uint64_t bin_len)
 {
-	ws_connection_close status;
-	ws_message *m = message_new();
-	m->len = length;
+	ws_list *l;
+	struct iovec iov;
+	ws_client *p;
 
-	char *temp = malloc(sizeof(char) * (m->len + 1));
-	if (temp == NULL)
-	{
+	if (g_ws_instance == NULL)
 		return -1;
+
+	l = g_ws_instance->m_list;
+	iov.iov_base = (void *) bin;
+	iov.iov_len = bin_len;
+
+	pthread_mutex_lock(&l->lock);
+	for (p = l->first; p != NULL; p = p->next) {
+		// Hybi-00 不支持二进制帧
+		if (bin != NULL && p->alog_result_binary && p->headers->type != HYBI00) {
+			ws_sendv(p, &iov, 1);
+		} else {
+			ws_send_text(p, json, json_len);
+		}
 	}
-	memset(temp, '\0', (m->len + 1));
-	memcpy(temp, message, m->len);
-	m->msg = temp;
-	temp = NULL;
+	pthread_mutex_unlock(&l->lock);
+	return 0;
+}
 
-	if ((status = encodeMessage(m)) != CONTINUE)
-	{
-		message_free(m);
-		free(m);
+int ws_send_nalu_to_wfs(ws_client *n, uint32_t header_info, uint64_t timestamp, unsigned char *message, uint64_t length)
+{
+	// 在 reactor 线程中持有 out_lock 调用，只把 nalu 挂到待发送的帧上
+	// websocket 头和 wfs 头(header_info + timestamp)放在帧结构里，nalu 数据直接从共享内存发送，不做拷贝
+	static char trailer = '\xFF';
+	ws_frame_out *f = &n->frame;
+	char *header;
+	int len;
+
+	if (f->nalu_count >= NALU_INDEX_MAX_COUNT)
+		return -1;
+
+	header = f->header[f->nalu_count];
+	len = ws_encode_frame_header(n, header, sizeof(header_info) + sizeof(timestamp) + length);
+	if (len < 0)
 		return -1;
+	memcpy(header + len, &header_info, sizeof(header_info));
+	len += sizeof(header_info);
+	memcpy(header + len, &timestamp, sizeof(timestamp));
+	len += sizeof(timestamp);
+	f->nalu_count++;
+
+	f->iov[f->iov_count].iov_base = header;
+	f->iov[f->iov_count++].iov_len = len;
+	f->iov[f->iov_count].iov_base = message;
+	f->iov[f->iov_count++].iov_len = length;
+	if (n->headers->type == HYBI00)
+	{
+		f->iov[f->iov_count].iov_base = &trailer;
+		f->iov[f->iov_count++].iov_len = 1;
 	}
+	return 0;
+}
 
-	list_multicast_all(g_ws_instance->m_list, m);
-	message_free(m);
-	free(m);
+void ws_frame_finish(ws_client *n, shm_stream_t *source)
+{
+	// 有 nalu 待发送时，帧发送完毕后由 ws_client_flush 释放，否则直接释放
+	if (n->frame.iov_count > 0)
+		n->frame.source = source;
+	else
+		shm_stream_post(source);
+}
+
+int ws_send_binary(ws_client *n, unsigned char *message, uint64_t length)
+{
+	struct iovec iov;
+
+	iov.iov_base = message;
+	iov.iov_len = length;
+
+	list_multicast_one_iov(g_ws_instance->m_list, n, &iov, 1);
 	return 0;
 }
 
-int ws_send_nalu_to_wfs(ws_client *n, uint32_t header_info, uint64_t timestamp, unsigned char *message, uint64_t length)
+/**
+ * 更新客户端 socket 在 epoll 中监听的事件，有数据待发送时才监听 EPOLLOUT
+ */
+static void ws_client_watch(ws_wrap_t *ws_wrap, ws_client *n, int out)
 {
-	ws_connection_close status;
-	ws_message *m = message_new();
-	m->len = length + sizeof(header_info) + sizeof(timestamp);
+	struct epoll_event ev;
+
+	if (n->epoll_out == out)
+		return;
 
-	char *temp = malloc(sizeof(char) * (m->len + 1));
-	if (temp == NULL)
+	ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+	ev.data.ptr = &n->sock_event;
+	if (epoll_ctl(ws_wrap->m_epoll_fd, EPOLL_CTL_MOD, n->socket_id, &ev) < 0)
 	{
-		return -1;
+		printf("epoll_ctl client %d failed: %s\n", n->socket_id, strerror(errno));
+		return;
 	}
-	memset(temp, '\0', (m->len + 1));
-
-	// 将 header_info 写入 temp
-	memcpy(temp, &header_info, sizeof(header_info));
-	// 将 timestamp 写入 temp
-	memcpy(temp + sizeof(header_info), &timestamp, sizeof(timestamp));
-	// 将消息数据复制到 temp 的后面
-	memcpy(temp + sizeof(header_info) + sizeof(timestamp), message, length);
+	n->epoll_out = out;
+}
 
-	m->msg = temp;
-	temp = NULL;
+/**
+ * 尽可能多地发送客户端的待发送数据，输出队列为空后轮流从各路码流中取帧发送，
+ * 直到 socket 写满或者没有新帧
+ */
+static void ws_client_pump(ws_wrap_t *ws_wrap, ws_client *n)
+{
+	int status, pushed, index, i;
 
-	if ((status = encodeBinary(m)) != CONTINUE)
+	pthread_mutex_lock(&n->out_lock);
+	while ((status = ws_client_flush(n)) == 0)
 	{
-		message_free(m);
-		free(m);
-		return -1;
+		pushed = 0;
+		for (i = 0; i < n->stream_count && i < WS_MAX_STREAMS && !pushed; i++)
+		{
+			index = (n->stream_next + i) % n->stream_count;
+			if (n->shm_source[index] != NULL && ws_push_stream(n, index) != 0)
+			{
+				n->stream_next = index + 1;
+				pushed = 1;
+			}
+		}
+		if (!pushed)
+			break;
 	}
+	pthread_mutex_unlock(&n->out_lock);
 
-	list_multicast_one(g_ws_instance->m_list, n, m);
-	message_free(m);
-	free(m);
-	return 0;
+	if (status < 0)
+	{
+		n->closing = 1;
+		return;
+	}
+	ws_client_watch(ws_wrap, n, status == 1);
 }
 
-int ws_send_binary(ws_client *n, unsigned char *message, uint64_t length)
+/**
+ * 发送所有已连接客户端的待发送数据，返回是否存在需要轮询的码流(没有 eventfd)
+ */
+static int ws_client_pump_all(ws_wrap_t *ws_wrap)
 {
-	ws_connection_close status;
-	ws_message *m = message_new();
-	m->len = length;
+	ws_client *n;
+	int poll = 0, i;
 
-	char *temp = malloc(sizeof(char) * (m->len + 1));
-	if (temp == NULL)
+	pthread_mutex_lock(&ws_wrap->m_list->lock);
+	for (n = ws_wrap->m_list->first; n != NULL; n = n->next)
 	{
-		return -1;
+		if (n->closing)
+			continue;
+		ws_client_pump(ws_wrap, n);
+		for (i = 0; i < WS_MAX_STREAMS && !poll; i++)
+		{
+			if (n->shm_source[i] != NULL && n->stream_fd[i] < 0)
+				poll = 1;
+		}
 	}
-	memset(temp, '\0', (m->len + 1));
-	memcpy(temp, message, m->len);
-	m->msg = temp;
-	temp = NULL;
+	pthread_mutex_unlock(&ws_wrap->m_list->lock);
+	return poll;
+}
+
+int ws_client_stream_start(ws_client *n)
+{
+	struct epoll_event ev;
+	int fd, i;
 
-	if ((status = encodeBinary(m)) != CONTINUE)
+	// 码流有新帧时写端会写 eventfd 唤醒 reactor，创建 eventfd 失败的码流由 reactor 定时轮询
+	n->stream_next = 0;
+	for (i = 0; i < n->stream_count && i < WS_MAX_STREAMS; i++)
 	{
-		message_free(m);
-		free(m);
-		return -1;
+		if (n->shm_source[i] == NULL || n->stream_fd[i] >= 0)
+			continue;
+		fd = shm_stream_notify_fd(n->shm_source[i]);
+		if (fd < 0)
+			continue;
+
+		n->stream_event[i].type = WS_EVENT_STREAM;
+		n->stream_event[i].index = i;
+		n->stream_event[i].client = n;
+		ev.events = EPOLLIN;
+		ev.data.ptr = &n->stream_event[i];
+		if (epoll_ctl(g_ws_instance->m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		{
+			printf("epoll_ctl stream fd %d failed: %s\n", fd, strerror(errno));
+			continue;
+		}
+		n->stream_fd[i] = fd;
 	}
-
-	list_multicast_one(g_ws_instance->m_list, n, m);
-	message_free(m);
-	free(m);
 	return 0;
 }
 
-void *handleClient(void *args)
+void ws_client_stream_stop(ws_client *n)
+{
+	for (int i = 0; i < WS_MAX_STREAMS; i++)
+	{
+		if (n->stream_fd[i] >= 0)
+			epoll_ctl(g_ws_instance->m_epoll_fd, EPOLL_CTL_DEL, n->stream_fd[i], NULL);
+	}
+	client_stream_free(n);
+}
+
+/**
+ * 从 socket 读取一次数据追加到接收缓存
+ * 返回读到的字节数，0 表示暂时没有数据，-1 表示连接断开或出错
+ */
+static int ws_client_recv(ws_client *n, uint64_t limit)
 {
-	pthread_detach(pthread_self());
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-	pthread_cleanup_push(&cleanup_client, args);
+	ssize_t ret;
+	char *tmp;
+
+	if (n->in_len >= limit)
+		return -1;
 
-	int buffer_length = 0, string_length = 1, reads = 1;
+	if (n->in_size - n->in_len < BUFFERSIZE)
+	{
+		tmp = realloc(n->in_buf, n->in_size + BUFFERSIZE + 1);
+		if (tmp == NULL)
+			return -1;
+		n->in_buf = tmp;
+		n->in_size += BUFFERSIZE;
+	}
 
-	ws_client *n = args;
-	n->thread_id = pthread_self();
+	do
+	{
+		ret = recv(n->socket_id, n->in_buf + n->in_len, n->in_size - n->in_len, MSG_DONTWAIT);
+	} while (ret < 0 && errno == EINTR);
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+	if (ret <= 0)
+		return -1;
+
+	n->in_len += ret;
+	n->in_buf[n->in_len] = '\0';
+	return ret;
+}
+
+/**
+ * 请求头接收完整时返回请求头(hybi-00 还包括其后的 8 字节 key3)的长度，否则返回 0
+ */
+static uint64_t ws_handshake_length(ws_client *n)
+{
+	char *end, *key1;
+	uint64_t length;
+	char c;
+
+	if ((end = strstr(n->in_buf, "\r\n\r\n")) != NULL)
+		length = end - n->in_buf + 4;
+	else if ((end = strstr(n->in_buf, "\n\n")) != NULL)
+		length = end - n->in_buf + 2;
+	else
+		return 0;
+
+	c = n->in_buf[length];
+	n->in_buf[length] = '\0';
+	key1 = strstr(n->in_buf, "Sec-WebSocket-Key1");
+	n->in_buf[length] = c;
+	if (key1 != NULL)
+		length += 8;
+
+	return length <= n->in_len ? length : 0;
+}
 
-	char buffer[BUFFERSIZE];
-	n->string = (char *)malloc(sizeof(char));
+static void ws_pending_remove(ws_wrap_t *ws_wrap, ws_client *n)
+{
+	ws_client **p;
 
-	if (n->string == NULL)
+	for (p = &ws_wrap->m_pending; *p != NULL; p = &(*p)->next)
 	{
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		handshake_error("Couldn't allocate memory.", ERROR_INTERNAL, n);
-		pthread_exit((void *)EXIT_FAILURE);
+		if (*p == n)
+		{
+			*p = n->next;
+			n->next = NULL;
+			break;
+		}
 	}
+}
 
-	prctl(PR_SET_NAME, "websocket_server");
+/**
+ * 关闭超过截止时间还没有完成握手的客户端，避免只连接不发请求头的客户端一直占用 socket 和接收缓存
+ */
+static void ws_pending_expire(ws_wrap_t *ws_wrap)
+{
+	uint64_t now = get_monotonic_ns() / 1000000;
+	ws_client **p = &ws_wrap->m_pending;
+	ws_client *n;
 
-	printf("Client connected with the following information:\n"
-		   "\tSocket: %d\n"
-		   "\tAddress: %s\n\n",
-		   n->socket_id, (char *)n->client_ip);
-	printf("Checking whether client is valid ...\n\n");
-	fflush(stdout);
+	while ((n = *p) != NULL)
+	{
+		if (now < n->handshake_deadline)
+		{
+			p = &n->next;
+			continue;
+		}
+		*p = n->next;
+		n->next = NULL;
+		handshake_error("Handshake timed out.", ERROR_TIMEOUT, n);
+	}
+}
 
-	/**
-	 * Getting headers and doing reallocation if headers is bigger than our
-	 * allocated memory.
-	 */
-	do
+/**
+ * 非阻塞握手，返回 0 表示请求头还没收完，1 表示握手完成，-1 表示握手失败并且 n 已经释放
+ */
+static int ws_client_handshake(ws_wrap_t *ws_wrap, ws_client *n)
+{
+	uint64_t length = 0;
+	int first, ret;
+
+	while (length == 0)
 	{
-		memset(buffer, '\0', BUFFERSIZE);
-		if ((buffer_length = recv(n->socket_id, buffer, BUFFERSIZE, 0)) <= 0)
+		first = (n->in_len == 0);
+		ret = ws_client_recv(n, WS_HANDSHAKE_MAX);
+		if (ret == 0)
+			return 0;
+
+		if (ret < 0)
 		{
-			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+			ws_pending_remove(ws_wrap, n);
 			handshake_error("Didn't receive any headers from the client.",
 							ERROR_BAD, n);
-			pthread_exit((void *)EXIT_FAILURE);
+			return -1;
 		}
 
-		if (reads == 1 && strlen(buffer) < 14)
+		if (first && strnlen(n->in_buf, n->in_len) < 14)
 		{
+			ws_pending_remove(ws_wrap, n);
 			handshake_error("SSL request is not supported yet.",
 							ERROR_NOT_IMPL, n);
-			pthread_exit((void *)EXIT_FAILURE);
+			return -1;
 		}
 
-		string_length += buffer_length;
+		length = ws_handshake_length(n);
+	}
 
-		char *tmp = realloc(n->string, string_length);
-		if (tmp == NULL)
-		{
-			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-			handshake_error("Couldn't reallocate memory.", ERROR_INTERNAL, n);
-			pthread_exit((void *)EXIT_FAILURE);
-		}
-		n->string = tmp;
-		tmp = NULL;
+	ws_pending_remove(ws_wrap, n);
 
-		memset(n->string + (string_length - buffer_length - 1), '\0',
-			   buffer_length + 1);
-		memcpy(n->string + (string_length - buffer_length - 1), buffer,
-			   buffer_length);
-		reads++;
-	} while (strncmp("\r\n\r\n", n->string + (string_length - 5), 4) != 0 && strncmp("\n\n", n->string + (string_length - 3), 2) != 0 && strncmp("\r\n\r\n", n->string + (string_length - 8 - 5), 4) != 0 && strncmp("\n\n", n->string + (string_length - 8 - 3), 2) != 0);
+	n->string = (char *)malloc(length + 1);
+	n->headers = header_new();
+	if (n->string == NULL || n->headers == NULL)
+	{
+		handshake_error("Couldn't allocate memory.", ERROR_INTERNAL, n);
+		return -1;
+	}
+	memcpy(n->string, n->in_buf, length);
+	n->string[length] = '\0';
 
 	printf("User connected with the following headers:\n%s\n\n", n->string);
 	fflush(stdout);
 
-	ws_header *h = header_new();
+	/**
+	 * parseHeaders and sendHandshake free the client when they fail.
+	 */
+	if (parseHeaders(n->string, n) < 0)
+		return -1;
+
+	if (sendHandshake(n) < 0)
+		return -1;
+
+	// 请求头之后已经收到的数据留给帧解析
+	memmove(n->in_buf, n->in_buf + length, n->in_len - length);
+	n->in_len -= length;
+	n->in_buf[n->in_len] = '\0';
+	n->handshaked = 1;
+
+	list_add(ws_wrap->m_list, n);
+
+	printf("Client has been validated and is now connected\n\n");
+	return 1;
+}
+
+/**
+ * 解析接收缓存中所有完整的帧并处理收到的消息
+ */
+static void ws_client_parse(ws_wrap_t *ws_wrap, ws_client *n)
+{
+	ws_connection_close status;
+	uint64_t pos = 0, used;
+	int complete;
 
-	if (h == NULL)
+	while (!n->closing && pos < n->in_len)
 	{
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		handshake_error("Couldn't allocate memory.", ERROR_INTERNAL, n);
-		pthread_exit((void *)EXIT_FAILURE);
+		status = parseFrame(n, n->in_buf + pos, n->in_len - pos, &used, &complete);
+		if (status != CONTINUE)
+		{
+			printf("communicate disconnected: %d\n", status);
+			n->closing = 1;
+			break;
+		}
+		if (used == 0)
+			break;
+		pos += used;
+		if (!complete)
+			continue;
+
+		if (n->headers->protocol == WS_CHAT)
+		{
+			list_multicast(ws_wrap->m_list, n);
+		}
+		else if (n->headers->protocol == WS_ECHO)
+		{
+			list_multicast_one(ws_wrap->m_list, n, n->message);
+		}
+
+		handle_user_msg(ws_wrap->m_list, n, n->message->msg);
+		message_free(n->message);
+		free(n->message);
+		n->message = NULL;
+	}
+
+	if (pos > 0)
+	{
+		memmove(n->in_buf, n->in_buf + pos, n->in_len - pos);
+		n->in_len -= pos;
+		n->in_buf[n->in_len] = '\0';
 	}
+}
 
-	n->headers = h;
+static void ws_client_read(ws_wrap_t *ws_wrap, ws_client *n)
+{
+	int ret;
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	if (parseHeaders(n->string, n) < 0)
+	if (!n->handshaked)
 	{
-		pthread_exit((void *)EXIT_FAILURE);
+		ret = ws_client_handshake(ws_wrap, n);
+		if (ret <= 0)
+			return;
 	}
 
-	if (sendHandshake(n) < 0 && n->headers->type != UNKNOWN)
+	do
 	{
-		pthread_exit((void *)EXIT_FAILURE);
+		ws_client_parse(ws_wrap, n);
+		if (n->closing)
+			return;
+		ret = ws_client_recv(n, MAXMESSAGE + BUFFERSIZE);
+	} while (ret > 0);
+
+	if (ret < 0)
+	{
+		n->closing = 1;
+		return;
 	}
+	// 新的请求可能开启了推流，或者产生了回复
+	ws_client_pump(ws_wrap, n);
+}
 
-	list_add(g_ws_instance->m_list, n);
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+static void ws_client_close(ws_wrap_t *ws_wrap, ws_client *n)
+{
+	epoll_ctl(ws_wrap->m_epoll_fd, EPOLL_CTL_DEL, n->socket_id, NULL);
+	ws_client_stream_stop(n);
 
-	printf("Client has been validated and is now connected\n\n");
-	/*printf("> ");*/
-	/*fflush(stdout);*/
+	printf("Shutting client down..\n\n");
+	list_remove(ws_wrap->m_list, n);
+}
 
-	uint64_t next_len = 0;
-	char next[BUFFERSIZE];
-	memset(next, '\0', BUFFERSIZE);
+/**
+ * 关闭所有标记为 closing 的客户端，在处理完一批 epoll 事件之后调用，
+ * 保证同一批事件中不会访问已经释放的客户端
+ */
+static void ws_client_close_all(ws_wrap_t *ws_wrap)
+{
+	ws_client *n;
 
 	while (1)
 	{
-		ws_connection_close ret = communicate(n, next, next_len);
-		if (ret != CONTINUE)
-		{
-			printf("communicate disconnected: %d\n", ret);
+		pthread_mutex_lock(&ws_wrap->m_list->lock);
+		for (n = ws_wrap->m_list->first; n != NULL && !n->closing; n = n->next)
+			;
+		pthread_mutex_unlock(&ws_wrap->m_list->lock);
+
+		if (n == NULL)
 			break;
-		}
+		ws_client_close(ws_wrap, n);
+	}
+}
 
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		if (n->headers->protocol == WS_CHAT)
+static void ws_server_accept(ws_wrap_t *ws_wrap, int server_socket)
+{
+	struct sockaddr_in client_addr;
+	socklen_t client_length;
+	struct epoll_event ev;
+	int client_socket;
+
+	while (1)
+	{
+		client_length = sizeof(client_addr);
+
+		/**
+		 * If a client connects, we observe it here.
+		 */
+		client_socket = accept(server_socket, (struct sockaddr *)&client_addr,
+							   &client_length);
+		if (client_socket < 0)
 		{
-			list_multicast(g_ws_instance->m_list, n);
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				printf("accept failed: %s\n", strerror(errno));
+			return;
 		}
-		else if (n->headers->protocol == WS_ECHO)
+		fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+		fcntl(client_socket, F_SETFD, FD_CLOEXEC);
+
+		/**
+		 * Save some information about the client, which we will
+		 * later use to identify him with.
+		 */
+		char *temp = (char *)inet_ntoa(client_addr.sin_addr);
+		char *addr = (char *)malloc(sizeof(char) * (strlen(temp) + 1));
+		if (addr == NULL)
 		{
-			list_multicast_one(g_ws_instance->m_list, n, n->message);
-		}
-#if 0
-		} else {
-			list_multicast_one(g_ws_instance->m_list, n, n->message);
+			close(client_socket);
+			continue;
 		}
-#endif
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		memset(addr, '\0', strlen(temp) + 1);
+		memcpy(addr, temp, strlen(temp));
 
-		if (n->message != NULL)
+		ws_client *n = client_new(client_socket, addr);
+		if (n == NULL)
 		{
-			handle_user_msg(g_ws_instance->m_list, n, n->message->msg);
-			memset(next, '\0', BUFFERSIZE);
-			memcpy(next, n->message->next, n->message->next_len);
-			next_len = n->message->next_len;
-			message_free(n->message);
-			free(n->message);
-			n->message = NULL;
+			printf("client_new failed.\n");
+			free(addr);
+			close(client_socket);
+			continue;
 		}
-	}
+		n->wake_fd = ws_wrap->m_wake_fd;
+		n->sock_event.type = WS_EVENT_CLIENT;
+		n->sock_event.client = n;
 
-	// 如果推流线程存在就退出
-	if (n->stream_thread.pThread_Id != 0)
-		mThreadStop(&n->stream_thread);
+		ev.events = EPOLLIN;
+		ev.data.ptr = &n->sock_event;
+		if (epoll_ctl(ws_wrap->m_epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) < 0)
+		{
+			printf("epoll_ctl client %d failed: %s\n", client_socket, strerror(errno));
+			client_free(n);
+			close(client_socket);
+			free(n);
+			continue;
+		}
 
-	printf("Shutting client down..\n\n");
+		// 握手完成前放在 m_pending 中，握手完成后才加入客户端列表
+		n->handshake_deadline = get_monotonic_ns() / 1000000 + WS_HANDSHAKE_TIMEOUT_MS;
+		n->next = ws_wrap->m_pending;
+		ws_wrap->m_pending = n;
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	if (g_ws_instance->m_list != NULL && n != NULL)
-	{
-		list_remove(g_ws_instance->m_list, n);
+		printf("Client connected with the following information:\n"
+			   "\tSocket: %d\n"
+			   "\tAddress: %s\n\n",
+			   n->socket_id, (char *)n->client_ip);
+		printf("Checking whether client is valid ...\n\n");
+		fflush(stdout);
 	}
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-
-	pthread_cleanup_pop(0);
-	pthread_exit((void *)EXIT_SUCCESS);
 }
 
 static void *_ws_wrap_start(void *ptr)
 {
 	tsThread *privThread = (tsThread *)ptr;
-	int server_socket, client_socket, on = 1;
+	int server_socket, on = 1;
 	ws_wrap_t *ws_wrap = (ws_wrap_t *)privThread->pvThreadData;
 	int port = ws_wrap->m_port;
+	struct sockaddr_in server_addr;
+	struct epoll_event ev, events[WS_EPOLL_EVENTS];
+	ws_event listen_event, wake_event;
+	ws_event *e;
+	ws_client *n;
+	int count, poll = 0, wake, i;
+	uint64_t value;
 
 	mThreadSetName(privThread, __func__);
 
-	struct sockaddr_in server_addr, client_addr;
-	socklen_t client_length;
-	pthread_t pthread_id;
-	pthread_attr_t pthread_attr;
-
 	printf("Server: \t\tStarted\n");
 	fflush(stdout);
 
@@ -383,7 +697,7 @@ static void *_ws_wrap_start(void *ptr)
 	/**
 	 * Opening server socket.
 	 */
-	if ((server_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	if ((server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
 	{
 		server_error(strerror(errno), server_socket, ws_wrap->m_list);
 		goto exit;
@@ -439,74 +753,100 @@ static void *_ws_wrap_start(void *ptr)
 	fflush(stdout);
 
 	/**
-	 * Attributes for the threads we will create when a new client connects.
+	 * One epoll reactor serves the listen socket, all the clients and all
+	 * the streams pushed to them.
 	 */
-	pthread_attr_init(&pthread_attr);
-	pthread_attr_setdetachstate(&pthread_attr, PTHREAD_CREATE_DETACHED);
-	pthread_attr_setstacksize(&pthread_attr, 524288);
+	ws_wrap->m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	ws_wrap->m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ws_wrap->m_epoll_fd < 0 || ws_wrap->m_wake_fd < 0)
+	{
+		printf("Create epoll failed: %s\n", strerror(errno));
+		goto close_epoll;
+	}
+
+	listen_event.type = WS_EVENT_LISTEN;
+	listen_event.client = NULL;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_event;
+	epoll_ctl(ws_wrap->m_epoll_fd, EPOLL_CTL_ADD, server_socket, &ev);
+
+	wake_event.type = WS_EVENT_WAKE;
+	wake_event.client = NULL;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &wake_event;
+	epoll_ctl(ws_wrap->m_epoll_fd, EPOLL_CTL_ADD, ws_wrap->m_wake_fd, &ev);
 
 	printf("Server is now waiting for clients to connect ...\n\n");
 	fflush(stdout);
 
-	/**
-	 * Do not wait for the thread to terminate.
-	 */
-	/*pthread_detach(pthread_id);*/
-
 	while (privThread->eState == E_THREAD_RUNNING)
 	{
-		client_length = sizeof(client_addr);
-
-		/**
-		 * If a client connects, we observe it here.
-		 */
-		if ((client_socket = accept(server_socket,
-									(struct sockaddr *)&client_addr,
-									&client_length)) < 0)
-		{
-			server_error(strerror(errno), server_socket, ws_wrap->m_list);
-			break;
-		}
-
-		/**
-		 * Save some information about the client, which we will
-		 * later use to identify him with.
-		 */
-		char *temp = (char *)inet_ntoa(client_addr.sin_addr);
-		char *addr = (char *)malloc(sizeof(char) * (strlen(temp) + 1));
-		if (addr == NULL)
+		// 有需要轮询的码流时缩短超时，否则只需要定时检查线程状态
+		count = epoll_wait(ws_wrap->m_epoll_fd, events, WS_EPOLL_EVENTS, poll ? 10 : 100);
+		if (count < 0 && errno != EINTR)
 		{
-			server_error(strerror(errno), server_socket, ws_wrap->m_list);
+			printf("epoll_wait failed: %s\n", strerror(errno));
 			break;
 		}
-		memset(addr, '\0', strlen(temp) + 1);
-		memcpy(addr, temp, strlen(temp));
 
-		ws_client *n = client_new(client_socket, addr);
-		if(n == NULL){
-			printf("client_new failed so exit(-1) .\n");
-			exit(-1);
-		}
-		/**
-		 * Create client thread, which will take care of handshake and all
-		 * communication with the client.
-		 */
-		if ((pthread_create(&pthread_id, &pthread_attr, handleClient,
-							(void *)n)) < 0)
+		wake = poll;
+		for (i = 0; i < count; i++)
 		{
-			server_error(strerror(errno), server_socket, ws_wrap->m_list);
-			printf("error pthread create failed\n");
-			exit(-1);
-			break;
+			e = (ws_event *)events[i].data.ptr;
+			switch (e->type)
+			{
+			case WS_EVENT_LISTEN:
+				ws_server_accept(ws_wrap, server_socket);
+				break;
+			case WS_EVENT_WAKE:
+				// 其他线程向输出队列添加了数据
+				if (read(ws_wrap->m_wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+					printf("read wake fd failed: %s\n", strerror(errno));
+				wake = 1;
+				break;
+			case WS_EVENT_CLIENT:
+				n = e->client;
+				if (n->closing)
+					break;
+				if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+					ws_client_read(ws_wrap, n);
+				if (n->handshaked && !n->closing && (events[i].events & EPOLLOUT))
+					ws_client_pump(ws_wrap, n);
+				break;
+			case WS_EVENT_STREAM:
+				n = e->client;
+				if (n->closing || n->shm_source[e->index] == NULL)
+					break;
+				shm_stream_notify_clear(n->shm_source[e->index]);
+				ws_client_pump(ws_wrap, n);
+				break;
+			}
 		}
 
-		pthread_detach(pthread_id);
+		if (wake)
+			poll = ws_client_pump_all(ws_wrap);
+		ws_client_close_all(ws_wrap);
+		// epoll_wait 最多等待 100 ms，截止时间的误差不会超过这个值
+		if (ws_wrap->m_pending != NULL)
+			ws_pending_expire(ws_wrap);
 	}
 	printf("Server is exit ... (websocket)\n\n");
 	fflush(stdout);
 
+	// 释放还没有完成握手的客户端，已连接的客户端由 ws_wrap_destory 释放
+	while ((n = ws_wrap->m_pending) != NULL)
+	{
+		ws_wrap->m_pending = n->next;
+		client_free(n);
+		close(n->socket_id);
+		free(n);
+	}
+
+close_epoll:
 	close(server_socket);
-	pthread_attr_destroy(&pthread_attr);
+	if (ws_wrap->m_epoll_fd >= 0)
+		close(ws_wrap->m_epoll_fd);
+	ws_wrap->m_epoll_fd = -1;
 exit:
 	mThreadFinish(privThread);
 	return NULL;
@@ -19,6 +19,7 @@
 #include "utils/stream_manager.h"
 #include "utils/cJSON.h"
 #include "utils/time_utils.h"
+#include "utils/latency_stats.h"
 
 #include "Handshake.h"
 #include "Errors.h"
@@ -38,6 +39,9 @@ typedef enum {
 	WS_CMD_GET_CONFIG,
 	WS_CMD_SAVE_CONFIG,
 	WS_CMD_RECOVERY_CONFIG,
+	WS_CMD_ALOG_RESULT, 			// 只由设备推送算法结果
+	WS_CMD_SET_ALOG_RESULT_FORMAT, 	// param 为 1 时检测结果改用二进制格式发送
+	WS_CMD_GET_LATENCY_STATS,		// 获取最近一次各阶段耗时统计
 } WS_CMD_KIND;
 
 void ws_send_respose(ws_list *ws_lst, ws_client *ws_clt, char *msg)
@@ -90,189 +94,126 @@ void save_video_data2file_for_debug(char* name, int nal_unit_type, unsigned char
 		}
 	}
 }
-static int ws_send_h265_shm_stream_to_wfs(ws_client *ws_clt, shm_stream_t *shm_source, unsigned char *data, unsigned int *nalu_len){
+static int ws_send_h265_shm_stream_to_wfs(ws_client *ws_clt, shm_stream_t *shm_source){
 #if 0
 	frame_info info;
 	unsigned int length = 0;
-	unsigned int frame_size = 0;
-
-	if (shm_stream_front(shm_source, &info, &data, &length) == 0) {
-		NALU_t nalu;
-		frame_size = length;
-
-		int ret = get_annexb_nalu(data + *nalu_len, frame_size - *nalu_len, &nalu, 1);
-		if (ret < 0) {
-			SC_LOGE("[%s][%d] shm_source: %p data: %p length: %u *nalu_len: %d readers:%d",
-					__func__, __LINE__, shm_source, data, length, *nalu_len, shm_stream_readers(shm_source));
-			*nalu_len = 0;
-			return 0;
-		}
-		if (ret > 0) *nalu_len += nalu.len + nalu.startcodeprefix_len;    //记录nalu偏移总长
-
+	unsigned char *data = NULL;
+	shm_nalu_iter_t iter;
+	NALU_index_t *nalu;
+	int nalu_count;
+
+	iter.count = 0;
+	iter.pos = 0;
+	if (shm_stream_front_nalu(shm_source, &info, &data, &length, &iter, 1) != 0)
+		return 0;
+
+	nalu_count = iter.count;
+	if (nalu_count <= 0) {
+		SC_LOGE("[%s][%d] shm_source: %p data: %p length: %u readers:%d",
+				__func__, __LINE__, shm_source, data, length, shm_stream_readers(shm_source));
+		shm_stream_post(shm_source);
+		return -1;
+	}
+	while ((nalu = shm_stream_next_nalu(&iter)) != NULL) {
 		//只发送sps pps i p nalu, 其他抛弃
-		if ( nalu.nal_unit_type == 1 || nalu.nal_unit_type == 32 ||
-			nalu.nal_unit_type == 33 || nalu.nal_unit_type == 34 ||
-			nalu.nal_unit_type == 19)
-		{
-			frame_size = nalu.len;
-
-			// 发送数据, 需要发送带头信息的数据给 wfs
-			ws_send_nalu_to_wfs(ws_clt, ws_get_stream_index(info.key, ws_clt->stream_chn, ws_clt->stream_count), info.pts,
-				nalu.buf - nalu.startcodeprefix_len, nalu.len + nalu.startcodeprefix_len);
-			if (nalu.nal_unit_type == 1 || nalu.nal_unit_type == 19)
-			{
-				*nalu_len = 0;
-				int remains = shm_stream_remains(shm_source);
-				if(remains > 10)
-					SC_LOGI("shm_source:%p, framer video pts:%llu length:%d frame_size:%d remains:%d",
-						shm_source, info.pts, length, frame_size, remains);
-
-				//该帧发送完毕，包括sps pps等nalu拆分完毕，可以释放
-				shm_stream_post(shm_source);
-			}
+		if ( nalu->nal_unit_type != 1 && nalu->nal_unit_type != 32 &&
+			nalu->nal_unit_type != 33 && nalu->nal_unit_type != 34 &&
+			nalu->nal_unit_type != 19) {
+			SC_LOGW("shm_source:%p recv no support type: %d.", shm_source, nalu->nal_unit_type);
+			continue;
 		}
-		else {
-			SC_LOGW("shm_source:%p recv no support type: %d.", nalu.nal_unit_type);
-			*nalu_len = 0;
-			shm_stream_post(shm_source);
-		}
-	}else{
-		usleep(20);
+		// 发送数据, 需要发送带头信息的数据给 wfs
+		ws_send_nalu_to_wfs(ws_clt, ws_get_stream_index(info.key, ws_clt->stream_chn, ws_clt->stream_count), info.pts,
+			data + nalu->offset - nalu->startcodeprefix_len, nalu->len + nalu->startcodeprefix_len);
 	}
+	int remains = shm_stream_remains(shm_source);
+	if(remains > 10)
+		SC_LOGI("shm_source:%p, framer video pts:%llu length:%d remains:%d",
+			shm_source, info.pts, length, remains);
+
+	// 该帧的 nalu 都已挂到待发送帧上，由 reactor 发送完毕后再释放
+	ws_frame_finish(ws_clt, shm_source);
+	return length;
 #else
 	frame_info info;
 	unsigned int length = 0;
 	unsigned int frame_size = 0;
+	unsigned char *data = NULL;
 	if (shm_stream_front(shm_source, &info, &data, &length) == 0) {
 		frame_size = length;
 		shm_stream_post(shm_source);
 	}
-#endif
 	return frame_size;
+#endif
 }
 
 
-static int ws_send_h264_shm_stream_to_wfs(ws_client *ws_clt, shm_stream_t *shm_source, unsigned char *data, unsigned int *nalu_len)
+static int ws_send_h264_shm_stream_to_wfs(ws_client *ws_clt, shm_stream_t *shm_source)
 {
-
 	frame_info info;
 	unsigned int length = 0;
-	unsigned int frame_size = 0;
-
-	if (shm_stream_front(shm_source, &info, &data, &length) == 0) {
-		NALU_t nalu;
-		frame_size = length;
-		int ret = get_annexb_nalu(data + *nalu_len, frame_size - *nalu_len, &nalu, 0);
-		if (ret < 0) {
-			int remains = shm_stream_remains(shm_source);
-
-			SC_LOGE("shm_source [%s] data: %p length: %u *nalu_len: %d readers:%d, remains:%d.",
-					 shm_source->name, data, length, *nalu_len, shm_stream_readers(shm_source), remains);
-			*nalu_len = 0;
-			shm_stream_post(shm_source);
-			return -1;
-		}
-
-		if (ret > 0){ //记录nalu偏移总长
-			*nalu_len += nalu.len + nalu.startcodeprefix_len;
-		}
-		// SC_LOGI("nal_unit_type:%d data:%p buf:%p len:%u, *nalu_len:%d, %d\n", nalu.nal_unit_type, data,
-		// 			nalu.buf, nalu.len, *nalu_len, length);
+	unsigned char *data = NULL;
+	shm_nalu_iter_t iter;
+	NALU_index_t *nalu;
+	int nalu_count;
+
+	iter.count = 0;
+	iter.pos = 0;
+	if (shm_stream_front_nalu(shm_source, &info, &data, &length, &iter, 0) != 0)
+		return 0;
+
+	// NALU 索引由写端在 put 时解析，整帧发送完毕后再释放
+	nalu_count = iter.count;
+	if (nalu_count <= 0) {
+		int remains = shm_stream_remains(shm_source);
+
+		SC_LOGE("shm_source [%s] data: %p length: %u readers:%d, remains:%d.",
+				 shm_source->name, data, length, shm_stream_readers(shm_source), remains);
+		shm_stream_post(shm_source);
+		return -1;
+	}
 
+	while ((nalu = shm_stream_next_nalu(&iter)) != NULL) {
 		//只发送sps pps i p nalu, 其他抛弃
-		if (nalu.nal_unit_type == 7 || nalu.nal_unit_type == 8
-			|| nalu.nal_unit_type == 1 || nalu.nal_unit_type == 5)
-		{
-			frame_size = nalu.len;
-
-			//在使用 nalu 内存前做如下检测
-			//码流数据在大压力的情况下，可能会被覆盖，所以此处判断web 发送的数据范围是否合法
-			//数据被覆盖后，发送出去也没问题，但是要保证程序不会奔溃
-			unsigned char *encode_data_stream_start = nalu.buf - nalu.startcodeprefix_len;
-			int32_t encode_data_stream_len = nalu.len + nalu.startcodeprefix_len;
-			ret = nalu_is_beyond_source_data_range(encode_data_stream_start, encode_data_stream_len, data, length, shm_source->name);
-			if(ret != 0){
-				SC_LOGE("shm_source [%s] data range is error, so ignore this pkt.", shm_source->name);
-				*nalu_len = 0;
-				shm_stream_post(shm_source);
-				return -1;
-			}
-			// 发送数据, 需要发送带头信息的数据给 wfs
-			ws_send_nalu_to_wfs(ws_clt, ws_get_stream_index(info.key, ws_clt->stream_chn, ws_clt->stream_count), info.pts,
-				encode_data_stream_start, encode_data_stream_len);
-			if (nalu.nal_unit_type == 1 || nalu.nal_unit_type == 5)
-			{
-				*nalu_len = 0;
-				int remains = shm_stream_remains(shm_source);
-				if(remains > 10)
-					SC_LOGI("shm_source [%s], framer video pts:%llu length:%d frame_size:%d remains:%d",
-						shm_source->name, info.pts, length, frame_size, remains);
-
-				//该帧发送完毕，包括sps pps等nalu拆分完毕，可以释放
-				shm_stream_post(shm_source);
-			}
-			// 会出现只有 7 和 8 类型的包
-			else if ((nalu.nal_unit_type == 7 || nalu.nal_unit_type == 8) && length == nalu.len + 4) {
-				*nalu_len = 0;
-				//该帧发送完毕，包括sps pps等nalu拆分完毕，可以释放
-				shm_stream_post(shm_source);
-			}else{
-				SC_LOGD("recv nal_type: %d, so not post .\n", nalu.nal_unit_type);
-			}
-		}
 		// 调试过程中遇到出现 type == 23 的情况，不解析直接抛弃掉
-		else {
-			*nalu_len = 0;
-			shm_stream_post(shm_source);
-		}
+		if (nalu->nal_unit_type != 7 && nalu->nal_unit_type != 8
+			&& nalu->nal_unit_type != 1 && nalu->nal_unit_type != 5)
+			continue;
+
+		// 发送数据, 需要发送带头信息的数据给 wfs
+		ws_send_nalu_to_wfs(ws_clt, ws_get_stream_index(info.key, ws_clt->stream_chn, ws_clt->stream_count), info.pts,
+			data + nalu->offset - nalu->startcodeprefix_len, nalu->len + nalu->startcodeprefix_len);
 	}
-	return frame_size;
+
+	int remains = shm_stream_remains(shm_source);
+	if(remains > 10)
+		SC_LOGI("shm_source [%s], framer video pts:%llu length:%d nalu count:%d remains:%d",
+			shm_source->name, info.pts, length, nalu_count, remains);
+
+	// 该帧的 nalu 都已挂到待发送帧上，由 reactor 发送完毕后再释放，发送期间被写端覆盖时由 ws_client_flush 丢弃
+	ws_frame_finish(ws_clt, shm_source);
+	return length;
 }
-static int ws_send_mjpeg_shm_stream_to_wfs(ws_client *ws_clt, shm_stream_t *shm_source, unsigned char *data, unsigned int *nalu_len)
+static int ws_send_mjpeg_shm_stream_to_wfs(ws_client *ws_clt, shm_stream_t *shm_source)
 {
 	return 0;
 }
 
-static void *ws_push_stream_thread(void *ptr)
+/**
+ * 从第 index 路码流中取一帧挂到客户端的待发送帧上，在 reactor 线程中持有 out_lock 调用
+ * 返回 0 表示没有新帧
+ */
+int ws_push_stream(ws_client *ws_clt, int index)
 {
-	tsThread *privThread = (tsThread*)ptr;
-	ws_client *ws_clt = (ws_client*)privThread->pvThreadData;
-
-	unsigned char* data[32] = {NULL};
-	unsigned int nalu_len[32] = {0};
-
-	SC_LOGI("thread [ws_push_stream_thread] start .");
-	// 设置线程名，方便知道退出的是什么线程
-	mThreadSetName(privThread, __func__);
-
-	while (privThread->eState == E_THREAD_RUNNING) {
-		int ret = 0;
-		// 从共享内存中读取码流数据
-		for (int i = 0; i < ws_clt->stream_count; i++) {
-			if(ws_clt->codec_type == T_SDK_RTSP_VIDEO_TYPE_H264){
-				ret |= ws_send_h264_shm_stream_to_wfs(ws_clt, ws_clt->shm_source[i], data[i], &nalu_len[i]);
-			}else if(ws_clt->codec_type == T_SDK_RTSP_VIDEO_TYPE_H265) {
-				ret |= ws_send_h265_shm_stream_to_wfs(ws_clt, ws_clt->shm_source[i], data[i], &nalu_len[i]);
-			}else if(ws_clt->codec_type == T_SDK_RTSP_VIDEO_TYPE_MJPEG){
-				ret |= ws_send_mjpeg_shm_stream_to_wfs(ws_clt, ws_clt->shm_source[i], data[i], &nalu_len[i]);
-			}else{
-				//do no nothing;
-			}
-		}
-
-		if(ret == 0){ // 没有读取到数据, 延迟10ms 防止线程空转导致CPU 100%
-			usleep(1 * 1000);
-		}
+	if (ws_clt->codec_type == T_SDK_RTSP_VIDEO_TYPE_H264) {
+		return ws_send_h264_shm_stream_to_wfs(ws_clt, ws_clt->shm_source[index]);
+	} else if (ws_clt->codec_type == T_SDK_RTSP_VIDEO_TYPE_H265) {
+		return ws_send_h265_shm_stream_to_wfs(ws_clt, ws_clt->shm_source[index]);
+	} else if (ws_clt->codec_type == T_SDK_RTSP_VIDEO_TYPE_MJPEG) {
+		return ws_send_mjpeg_shm_stream_to_wfs(ws_clt, ws_clt->shm_source[index]);
 	}
-	for (int i = 0; i < ws_clt->stream_count; i++) {
-		if (ws_clt->shm_source[i] != NULL) {
-			shm_stream_destory(ws_clt->shm_source[i]); // 销毁共享内存读句柄
-			ws_clt->shm_source[i] = NULL;
-		}
-	}
-	SC_LOGI("thread [ws_push_stream_thread] end .");
-	mThreadFinish(privThread);
-	return NULL;
+	return 0;
 }
 
 static int _do_start_stream(ws_client *ws_clt)
@@ -349,10 +290,8 @@ static int _do_start_stream(ws_client *ws_clt)
 		}
 	}
 
-	memset(&ws_clt->stream_thread, 0, sizeof(tsThread));
-	ws_clt->stream_thread.pvThreadData = (void*)ws_clt;
-	mThreadStart(ws_push_stream_thread, &ws_clt->stream_thread, E_THREAD_JOINABLE);
-	return 0;
+	// 码流由 websocket 的 reactor 线程发送，不再为每个客户端创建推流线程
+	return ws_client_stream_start(ws_clt);
 }
 
 static int _do_add_sms(int channel)
@@ -553,7 +492,7 @@ int handle_user_msg(ws_list *ws_lst, ws_client *ws_clt, char *msg)
 		case WS_CMD_STOP_STREAM:
 			SC_LOGI("================= Stop Websocket Video Stream ====================");
 			SC_LOGI("stop ws venc stream for %d channels", cJSON_GetObjectItem(root, "param")->valueint);
-			mThreadStop(&ws_clt->stream_thread);
+			ws_client_stream_stop(ws_clt);
 			break;
 		case WS_CMD_SYNC_TIME:
 			SC_LOGD("sync pc time to : %d", cJSON_GetObjectItem(root, "param")->valueint);
@@ -607,6 +546,29 @@ int handle_user_msg(ws_list *ws_lst, ws_client *ws_clt, char *msg)
 			ws_send_respose(ws_lst, ws_clt, ws_msg);
 			break;
 		}
+		case WS_CMD_SET_ALOG_RESULT_FORMAT:
+		{
+			cJSON *format = cJSON_GetObjectItemCaseSensitive(root, "param");
+			if (!cJSON_IsNumber(format)) {
+				SC_LOGE("WS_CMD_SET_ALOG_RESULT_FORMAT: Invalid param received");
+				break;
+			}
+			ws_clt->alog_result_binary = format->valueint == 1;
+			SC_LOGI("client %s alog result format: %s", ws_clt->client_ip,
+				ws_clt->alog_result_binary ? "binary" : "json");
+			break;
+		}
+		case WS_CMD_GET_LATENCY_STATS:
+		{
+			char stats_str[WS_MAX_BUFFER] = {0};
+			if (latency_stats_to_json(stats_str, sizeof(stats_str)) < 0) {
+				SC_LOGE("WS_CMD_GET_LATENCY_STATS: latency stats too large");
+				break;
+			}
+			sprintf(ws_msg, "{\"kind\":%d,\"latency_stats\": %s}", WS_CMD_GET_LATENCY_STATS, stats_str);
+			ws_send_respose(ws_lst, ws_clt, ws_msg);
+			break;
+		}
 		case WS_CMD_UNDEFINE:
 		default:
 			SC_LOGE("WS cmder undefined");
@@ -1,6 +1,8 @@
 #ifndef WEBSOCKET_HANDLE_H
 #define WEBSOCKET_HANDLE_H
 
+#include "communicate/sdk_common_struct.h"
+
 #ifdef __cplusplus
 extern "C"{
 #endif
@@ -26,6 +28,7 @@ int websocket_start();
 int websocket_stop();
 int websocket_upload_file(char *file_name);
 int websocket_send_message(char *msg);
+int websocket_send_alog_result(T_SDK_WEBSOCKET_ALOG_RESULT *result);
 int websocket_register_callback();
 int websocket_unregister_callback();
 
@@ -63,6 +63,13 @@ int websocket_send_message(char *msg)
 	return 0;
 }
 
+int websocket_send_alog_result(T_SDK_WEBSOCKET_ALOG_RESULT *result)
+{
+	if (result == NULL || result->json_len == 0)
+		return -1;
+	return ws_send_alog_result(result->json, result->json_len, result->bin, result->bin_len);
+}
+
 int websocket_register_callback()
 {
 	return 0;
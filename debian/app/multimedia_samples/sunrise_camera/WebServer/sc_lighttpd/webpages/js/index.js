@@ -98,7 +98,9 @@ const REQUEST_TYPES = {
 	GET_CONFIG: 7,
 	SAVE_CONFIGS: 8,
 	RECOVERY_CONFIGS: 9,
-	ALOG_RESULT: 10
+	ALOG_RESULT: 10,
+	SET_ALOG_RESULT_FORMAT: 11,
+	GET_LATENCY_STATS: 12
 };
 
 window.onload = function() {
@@ -1293,11 +1295,19 @@ function ws_onopen() {
 	console.log("currentTime:", currentTime);
 	ws_send_cmd(REQUEST_TYPES.SYNC_TIME, Number(currentTime)); // 时间同步
 
+	// 检测结果使用二进制格式接收，比 json 更小，也不需要 JSON.parse
+	ws_send_cmd(REQUEST_TYPES.SET_ALOG_RESULT_FORMAT, socket.alog_result_binary ? 1 : 0);
+
 	// 请求类型 kind 7 获取设备信息，如软件版本、芯片类型等
 	// 之后接收到设备能力信息后，根据能力集信息进行UI显示调整
 	ws_send_cmd(REQUEST_TYPES.GET_CONFIG); // 获取配置
 }
 
+// 调试用，在浏览器控制台调用，设备返回最近一次各阶段耗时统计(每 5 秒更新)
+function get_latency_stats() {
+	ws_send_cmd(REQUEST_TYPES.GET_LATENCY_STATS);
+}
+
 function handle_ws_recv(params) {
 	// console.log(params);
 	if (params.kind == REQUEST_TYPES.APP_SWITCH && params.Status == 200) {
@@ -1331,5 +1341,7 @@ function handle_ws_recv(params) {
 		if (Wfs.isSupported()) {
 			start_stream(g_current_layout);
 		}
+	} else if (params.kind == REQUEST_TYPES.GET_LATENCY_STATS) {
+		console.table(params.latency_stats.stages);
 	}
 }
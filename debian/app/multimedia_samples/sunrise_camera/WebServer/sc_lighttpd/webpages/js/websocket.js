@@ -34,6 +34,8 @@ var socket = {
 	smart_fps: new Array(64).fill(null),
 	// 记录接收到的第一帧码流的时间戳
 	stream_first_timestamp: new Array(64).fill(BigInt(-1)),
+	// 是否使用二进制格式接收检测结果
+	alog_result_binary: true,
 
 	/**
 	 * 初始化连接
@@ -171,6 +173,12 @@ var socket = {
 			}
 		} else { // ArrayBuffer Blob
 			var copy = new Uint8Array(message.data);
+
+			// 二进制格式的检测结果，以 "BDET" 开头
+			if (copy.length >= 20 && copy[0] == 0x42 && copy[1] == 0x44 && copy[2] == 0x45 && copy[3] == 0x54) {
+				handle_ws_recv(socket.parse_detection_result(message.data));
+				return;
+			}
 			// console.log("收到编码数据: " + copy.length + " copy: " + copy.slice(0, 32))
 
 			// 获取0-3字节
@@ -201,6 +209,38 @@ var socket = {
 		}
 	},
 
+	/**
+	 * 解析二进制格式的检测结果，转换成和 json 格式相同的对象
+	 * 格式见 bpu_result.h，全部为小端
+	 * @param {*} data ArrayBuffer
+	 */
+	parse_detection_result: function (data) {
+		var view = new DataView(data);
+		var decoder = new TextDecoder();
+		var params = {
+			kind: REQUEST_TYPES.ALOG_RESULT,
+			pipeline: view.getUint32(4, true),
+			timestamp: Number(view.getBigUint64(8, true)),
+			detection_result: []
+		};
+		var count = view.getUint32(16, true);
+		var offset = 20;
+
+		for (var i = 0; i < count && offset + 24 <= data.byteLength; i++) {
+			var name_len = view.getUint8(offset + 22);
+			params.detection_result.push({
+				bbox: [view.getFloat32(offset, true), view.getFloat32(offset + 4, true),
+					view.getFloat32(offset + 8, true), view.getFloat32(offset + 12, true)],
+				// 和 json 格式一样保留 6 位小数
+				score: Math.round(view.getFloat32(offset + 16, true) * 1e6) / 1e6,
+				id: view.getUint16(offset + 20, true),
+				name: decoder.decode(new Uint8Array(data, offset + 24, name_len))
+			});
+			offset += 24 + name_len;
+		}
+		return params;
+	},
+
 	/**
 	 * 心跳
 	 */
@@ -2,22 +2,42 @@
 #define C_MAP_H
 #include "lock_utils.h"
 
+#define CMAP_PKEY_MAX 64
+
 typedef union
 {
 	int i_key;
-	char p_key[64];
+	char p_key[CMAP_PKEY_MAX];
 }cmap_key;
 
 typedef struct cmapnode_s{
 	cmap_key key;
 	void* data;
-	struct cmapnode_s *next;
 }cmapnode;
+
+struct cmap_table_s;
+struct cmap_intern_set_s;
+
+/**
+ * 开放寻址(线性探测)哈希表:
+ * 1. 节点按插入顺序紧凑存放在 entries 数组里，cmap_index_get 直接按下标返回；
+ *    删除时用最后一个节点填补空位，所以删除后遍历顺序会变化
+ * 2. 索引表保存 entries 下标 + 1，0 表示空槽，删除时向前移动后续槽位，不留墓碑
+ * 3. 写操作(插入、删除、清空)由 lock 串行，并用 seq 做顺序锁: 写之前 seq 变为奇数，写完变为偶数
+ * 4. 读操作(find、index_get、size)不加锁，读完后 seq 有变化就重试
+ * 5. 扩容时旧表挂在 retired 链表上，读操作期间 readers 加 1，写操作看到没有读者时才释放旧表，
+ *    容量每次翻倍，没来得及释放的旧表加起来也比当前表小
+ * 6. 字符串 key 插入时驻留(intern)，同一个字符串只保存一份，按引用它的节点计数，最后一个节点删除时释放；
+ *    cmap_pkey_intern 返回过的字符串调用者可能还在用，直到 cmap_destory 才释放
+ */
 typedef struct
 {
-	cmapnode *front;
-	cmapnode *rear;
+	struct cmap_table_s *table;
+	struct cmap_table_s *retired;
+	struct cmap_intern_set_s *interns;
+	unsigned int seq;
 	int size;
+	int readers;	//正在读的线程数，为 0 时才能释放 retired
 	CMtx lock;
 }cmap;
 
@@ -31,17 +51,23 @@ void cmap_clear(cmap *q);
 int cmap_destory(cmap *q);
 int cmap_is_empty(cmap *q);
 int cmap_ikey_insert(cmap *q, int key, void* e);
-//将释放节点数据内存
+//不释放节点数据内存
 int cmap_ikey_erase(cmap *q, int key);
 void* cmap_ikey_find(cmap *q, int key);
+//key 长度不能超过 CMAP_PKEY_MAX - 1
 int cmap_pkey_insert(cmap *q, const char* key, void* e);
-//将释放节点数据内存
+//不释放节点数据内存
 int cmap_pkey_erase(cmap *q, const char* key);
 void* cmap_pkey_find(cmap *q, const char* key);
+//返回驻留后的 key，同一个字符串总是返回同一个指针，失败返回 NULL
+const char* cmap_pkey_intern(cmap *q, const char* key);
+//key 必须是 cmap_pkey_intern 返回的指针，只比较指针，不计算哈希和比较字符串
+void* cmap_pkey_find_interned(cmap *q, const char* key);
+//返回的节点在下一次插入、删除之前有效
 cmapnode* cmap_index_get(cmap *q, int index);
 int cmap_size(cmap *q);
 #ifdef __cplusplus
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
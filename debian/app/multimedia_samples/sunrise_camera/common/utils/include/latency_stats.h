@@ -0,0 +1,66 @@
+#ifndef LATENCY_STATS_H_
+#define LATENCY_STATS_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * 按阶段统计耗时:
+ * 1. 每个阶段用名字注册，同一个名字返回同一个 id，注册只在初始化时做一次
+ * 2. 每个线程记录到自己的直方图里，不加锁；直方图按 2 的幂分段，每段 16 个桶，误差不超过 6.25%
+ * 3. latency_stats_snapshot 合并所有线程的直方图，得到上一次快照以来的统计，
+ *    可以输出成文本(latency_stats_dump_file)或者 json(latency_stats_to_json)
+ * 时间统一使用 CLOCK_MONOTONIC 的纳秒(get_monotonic_ns)
+ */
+
+#define LATENCY_STAGE_MAX		32
+#define LATENCY_STAGE_NAME_MAX	24
+#define LATENCY_STATS_FILE		"/tmp/sunrise_camera_latency.txt"
+
+typedef struct
+{
+	char		name[LATENCY_STAGE_NAME_MAX];
+	uint64_t	count;		// 快照间隔内的次数
+	uint64_t	total;		// 启动以来的总次数
+	uint64_t	mean_ns;
+	uint64_t	p50_ns;
+	uint64_t	p90_ns;
+	uint64_t	p99_ns;
+	uint64_t	max_ns;
+} latency_stage_summary_t;
+
+typedef struct
+{
+	uint64_t	time_ns;		// 快照时间
+	uint64_t	interval_ns;	// 和上一次快照的间隔
+	int32_t		stage_count;
+	latency_stage_summary_t	stages[LATENCY_STAGE_MAX];
+} latency_snapshot_t;
+
+/**
+ * 注册一个阶段
+ * @return 阶段 id，阶段个数超过 LATENCY_STAGE_MAX 时返回 -1，记录时忽略
+ */
+int32_t latency_stats_stage(const char *name);
+// 记录一次耗时，stage 为 latency_stats_stage 的返回值
+void latency_stats_record(int32_t stage, uint64_t ns);
+// 记录从 start_ns 到现在的耗时
+void latency_stats_record_since(int32_t stage, uint64_t start_ns);
+
+// 合并所有线程的直方图，生成新的快照，snapshot 可以为 NULL
+void latency_stats_snapshot(latency_snapshot_t *snapshot);
+// 获取最近一次快照，不生成新的快照
+void latency_stats_last_snapshot(latency_snapshot_t *snapshot);
+// 生成新的快照并写入文本文件
+int32_t latency_stats_dump_file(const char *path);
+// 最近一次快照转成 json，返回写入的长度，缓冲区不够时返回 -1
+int32_t latency_stats_to_json(char *buf, int32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LATENCY_STATS_H_
@@ -14,14 +14,36 @@ typedef enum
 
 typedef struct
 {
-    void **apvBuffer;
+    void *pvData;
+    uint64_t u64Seq;            // 等于 2 * 位置时可写，等于 2 * 位置 + 1 时可读，
+                                // 用奇偶区分，容量为 1 时也不会混淆
+} tsQueueCell;
+
+/**
+ * 有界多生产者多消费者无锁队列(Vyukov):
+ * 1. 入队、出队只用 CAS 抢占位置，不加锁
+ * 2. 队列空或满时才在 futex 上睡眠，入队、出队后只在有等待者时唤醒一个
+ * 3. 超时使用 CLOCK_MONOTONIC，不受系统时间调整影响
+ * 4. 和原来一样，长度为 u32Length 的队列最多存 u32Length - 1 个，长度为 1 时存不下任何数据，
+ *    mQueueEnqueue 会一直等待、mQueueEnqueueEx 返回 E_QUEUE_ERROR_FULL，调用者需要存 N 个时传 N + 1
+ */
+typedef struct
+{
+    tsQueueCell *psCells;
     uint32_t u32Length;
-    uint32_t u32Front;
-    uint32_t u32Rear;
+    uint32_t u32Capacity;       // u32Length - 1，可以为 0
+
+    // 入队、出队位置放在不同的 cache line，避免生产者和消费者互相干扰
+    uint8_t au8Pad0[64];
+    uint64_t u64EnqueuePos;
+    uint8_t au8Pad1[64];
+    uint64_t u64DequeuePos;
+    uint8_t au8Pad2[64];
 
-    pthread_mutex_t mutex;
-    pthread_cond_t cond_space_available;
-    pthread_cond_t cond_data_available;
+    uint32_t u32DataFutex;      // 有数据入队时加 1
+    uint32_t u32DataWaiters;    // 等待数据的线程数，见 mQueueNotify
+    uint32_t u32SpaceFutex;     // 有数据出队时加 1
+    uint32_t u32SpaceWaiters;   // 等待空间的线程数，见 mQueueNotify
 } tsQueue;
 
 teQueueStatus mQueueCreate(tsQueue *psQueue, uint32_t u32Length);
@@ -33,4 +55,4 @@ teQueueStatus mQueueDequeueTimed(tsQueue *psQueue, uint32_t u32WaitTimeMil, void
 int mQueueIsFull(tsQueue *psQueue);
 int mQueueIsEmpty(tsQueue *psQueue);
 
-#endif // MQUEUE_H_
\ No newline at end of file
+#endif // MQUEUE_H_
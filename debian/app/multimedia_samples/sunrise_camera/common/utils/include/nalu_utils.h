@@ -16,9 +16,22 @@ typedef struct
 	unsigned short lost_packets;  //! true, if packet loss is detected
 } NALU_t;
 
+#define NALU_INDEX_MAX_COUNT	64		//! 一帧中最多索引的 NALU 个数
+
+typedef struct
+{
+	unsigned int offset;          //! Offset of the NAL unit in the access unit (Excluding the start code)
+	unsigned int len;             //! Length of the NAL unit (Excluding the start code)
+	unsigned char startcodeprefix_len; //! 3 or 4
+	unsigned char nal_unit_type;  //! NALU_TYPE_xxxx
+	unsigned short reserved;
+} NALU_index_t;
+
 int find_start_code2(unsigned char *data);
 int find_start_code3(unsigned char *data);
 int get_annexb_nalu(unsigned char *frame, int length, NALU_t *nalu, int is_h265);
+int find_annexb_start_code(const unsigned char *data, int from, int length);
+int get_annexb_nalu_index(unsigned char *frame, int length, NALU_index_t *index, int max_count, int is_h265);
 int nalu_is_beyond_source_data_range(unsigned char *nalu_start, int32_t nalu_length,
 	unsigned char *src_start, int32_t src_length, const char* tag_for_debug);
 
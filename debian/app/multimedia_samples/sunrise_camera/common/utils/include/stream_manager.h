@@ -2,6 +2,7 @@
 #define STREAM_MANAGER_H
 
 #include "lock_utils.h"
+#include "nalu_utils.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -19,8 +20,11 @@ typedef enum{
 	SHM_STREAM_READ = 1,
 	SHM_STREAM_WRITE,
 	SHM_STREAM_WRITE_BLOCK,
+	SHM_STREAM_WRITE_SPMC,	//	无锁单生产者多消费者写模式，读端自动跟随，仍使用 SHM_STREAM_READ
 }SHM_STREAM_MODE_E;
 
+#define SHM_STREAM_NALU_MAX		16		//	每帧随 info 保存的最大 NALU 个数，超过时由读端自行解析
+
 typedef enum{
 	SHM_STREAM_MMAP = 1,
 	SHM_STREAM_MALLOC,
@@ -37,7 +41,8 @@ typedef struct
 	unsigned int		framerate;	// or samplerate
 	unsigned int		width;
 	unsigned int		height;
-	char reserved[12];
+	unsigned long long	capture_ns;	// 采集时间(CLOCK_MONOTONIC 纳秒)，用来统计采集到发送的延时，0 表示没有
+	char reserved[4];
 }frame_info;
 
 typedef int (*shm_stream_info_callback)(frame_info info, unsigned char* data, unsigned int length);
@@ -48,9 +53,15 @@ typedef struct
 	unsigned int	index;	//	当前读写info_array下标
 	unsigned int	offset;	//	当前数据存储偏移 只用作写模式
 	unsigned int	users;	//	读用户数
+	unsigned int	lockfree;	//	只在 user[0] 有效，1 表示写端以 SHM_STREAM_WRITE_SPMC 模式工作
+	unsigned long long	pos;	//	只在 user[0] 有效，无锁模式下已占用的数据区总字节数(单调递增)
+	int				notify_fd;	//	读端的 eventfd，写端发布新帧时写入，0 表示未使用
 	shm_stream_info_callback	callback;
 }shm_user_t;
 
+// 外部缓冲区归还回调，opaque 和 data 为 shm_stream_put_external 传入的参数
+typedef void (*shm_stream_buffer_release)(void* opaque, unsigned char* data);
+
 typedef enum{
 	DATA_ACCESS_STATUS_IDEL = 0,
 	DATA_ACCESS_STATUS_ACCESSING,
@@ -61,9 +72,27 @@ typedef struct
 	unsigned int	offset;		//	数据存储偏移
 	unsigned int	lenght;		//	数据长度
 	SHM_STREAM_DATA_ACCESS_STATUS_E access_status; // 当前是否正在读取
+	unsigned int	seq;		//	无锁模式下的帧序号 + 1，0 表示写端正在写入
+	unsigned long long	pos;	//	无锁模式下数据在数据区的单调位置，用于检测数据被覆盖
+	unsigned char*	ext_data;	//	外部缓冲区地址，不为 NULL 时数据不在数据区
+	shm_stream_buffer_release	ext_release;	//	外部缓冲区归还回调
+	void*			ext_opaque;	//	外部缓冲区归还回调参数
+	unsigned long long	ext_ref;	//	高 32 位为 seq，16-31 位为正在使用的读端数，低 16 位为还没越过该帧的读端数
+	unsigned int	nalu_count;	//	写端解析的 NALU 个数，0 表示没有索引
+	NALU_index_t	nalus[SHM_STREAM_NALU_MAX];	//	写端解析的 NALU 索引，偏移相对帧数据起始
 	frame_info		info;		//	数据info
 }shm_info_t;
 
+// 读端遍历当前帧 NALU 的迭代器，由 shm_stream_front_nalu 填充
+typedef struct
+{
+	NALU_index_t	nalus[NALU_INDEX_MAX_COUNT];
+	int				count;		//	当前帧 NALU 个数
+	int				pos;		//	下一个要返回的 NALU 下标
+	unsigned char*	data;		//	当前帧数据地址，用于判断 front 到的是否还是同一帧
+	unsigned int	length;
+}shm_nalu_iter_t;
+
 typedef struct
 {
 //private
@@ -79,6 +108,13 @@ typedef struct
 	SHM_STREAM_MODE_E mode;
 	SHM_STREAM_TYPE_E type;
 	unsigned int info_count;
+	unsigned int reserve_offset;	//	shm_stream_reserve 预留的数据偏移
+	unsigned int reserve_length;	//	shm_stream_reserve 预留的长度，0 表示没有预留
+	unsigned long long reserve_pos;	//	无锁模式下预留数据的单调位置
+	int holding;				//	无锁模式下读端是否持有 hold_seq 帧的外部缓冲区引用
+	unsigned int hold_seq;
+	int hold_pinned;			//	持有的是外部缓冲区帧，写端不会归还
+	int notify_fd;				//	读端通过 shm_stream_notify_fd 创建的 eventfd，-1 表示未创建
 }shm_stream_t;
 
 
@@ -87,15 +123,28 @@ shm_stream_t* shm_stream_create(char* id, const char* name, int users, int infos
 void shm_stream_destory(shm_stream_t* handle);
 
 int shm_stream_put(shm_stream_t* handle, frame_info info, unsigned char* data, unsigned int length);
+int shm_stream_put_annexb(shm_stream_t* handle, frame_info info, unsigned char* data, unsigned int length, int is_h265);
+int shm_stream_reserve(shm_stream_t* handle, unsigned int length, unsigned char** data);
+int shm_stream_commit(shm_stream_t* handle, frame_info info);
+int shm_stream_put_external(shm_stream_t* handle, frame_info info, unsigned char* data, unsigned int length,
+	shm_stream_buffer_release release, void* opaque);
+int shm_stream_put_external_annexb(shm_stream_t* handle, frame_info info, unsigned char* data, unsigned int length,
+	int is_h265, shm_stream_buffer_release release, void* opaque);
 int shm_stream_get(shm_stream_t* handle, frame_info* info, unsigned char** data, unsigned int* length);
 int shm_stream_front(shm_stream_t* handle, frame_info* info, unsigned char** data, unsigned int* length);
+int shm_stream_front_nalu(shm_stream_t* handle, frame_info* info, unsigned char** data, unsigned int* length,
+	shm_nalu_iter_t* iter, int is_h265);
+NALU_index_t* shm_stream_next_nalu(shm_nalu_iter_t* iter);
 int shm_stream_post(shm_stream_t* handle);
+int shm_stream_front_valid(shm_stream_t* handle);
 int shm_stream_sync(shm_stream_t* handle);
 int shm_stream_remains(shm_stream_t* handle);
 int shm_stream_readers(shm_stream_t* handle);
 int shm_stream_info_callback_register(shm_stream_t* handle, shm_stream_info_callback callback);
 int shm_stream_info_callback_unregister(shm_stream_t* handle);
 int shm_stream_is_already_create(char* id, char* name, int max_users);
+int shm_stream_notify_fd(shm_stream_t* handle);
+void shm_stream_notify_clear(shm_stream_t* handle);
 //private
 void* shm_stream_malloc(shm_stream_t* handle, const char* name, unsigned int size);
 int   shm_stream_malloc_fix(shm_stream_t* handle, char* id, const char* name, int users, void* addr);
@@ -43,6 +43,8 @@ typedef struct log_ctrl_s
 	char	file[128];
 	int		level;
 	int		wt;
+	unsigned long	size;	// 当前文件大小，超过 MAX_LOG_FILESIZE 时轮转
+	unsigned int	id;		// 创建时分配的序号，写线程用来识别已经销毁的 ctrl
 }log_ctrl;
 
 log_ctrl* log_ctrl_instance_create(char* file, int level, int wt);
@@ -53,23 +55,36 @@ int log_ctrl_level_get(log_ctrl* log);
 int  log_ctrl_wt_set(log_ctrl* log,int wt);
 int  log_ctrl_file_write(log_ctrl* log, char* data, int len);
 int  log_ctrl_print(log_ctrl* log, int level, const char* t, ...);
+// 把各线程缓冲区里还没写出的日志同步写出，退出时调用
+void log_ctrl_flush(void);
+// 崩溃处理(信号处理函数)里调用，不加锁，只用 write 写出缓冲区里的日志
+void log_ctrl_crash_flush(void);
+
+// 编译期日志等级，高于这个等级的 SC_LOGx / SC_CLOGx 不会编译进代码，参数也不会求值
+#ifndef SC_LOG_COMPILE_LEVEL
+#define SC_LOG_COMPILE_LEVEL	LOG_TRACE
+#endif
+#define SC_LOG_PRINT(c, level, t, ...) do { \
+	if ((level) <= SC_LOG_COMPILE_LEVEL) \
+		log_ctrl_print(c, level, t, ##__VA_ARGS__); \
+} while(0)
 
 // 以下宏定义中的 "[%s][%04d]" t "" 的t前后需要加空格，否则编译的时候会报以下error
 // utils_log.h:60:74: error: unable to find string literal operator ‘operator""t’
 // with ‘const char [11]’, ‘long unsigned int’ arguments
-#define SC_LOGT(t, ...) 	log_ctrl_print(NULL, LOG_TRACE, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_LOGD(t, ...) 	log_ctrl_print(NULL, LOG_DEBUG, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_LOGI(t, ...) 	log_ctrl_print(NULL, LOG_INFO,  "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_LOGW(t, ...) 	log_ctrl_print(NULL, LOG_WARN,  "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_LOGE(t, ...) 	log_ctrl_print(NULL, LOG_ERR,   "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_LOGM(t, ...) 	log_ctrl_print(NULL, LOG_EMERG, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_LOGT(t, ...) 	SC_LOG_PRINT(NULL, LOG_TRACE, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_LOGD(t, ...) 	SC_LOG_PRINT(NULL, LOG_DEBUG, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_LOGI(t, ...) 	SC_LOG_PRINT(NULL, LOG_INFO,  "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_LOGW(t, ...) 	SC_LOG_PRINT(NULL, LOG_WARN,  "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_LOGE(t, ...) 	SC_LOG_PRINT(NULL, LOG_ERR,   "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_LOGM(t, ...) 	SC_LOG_PRINT(NULL, LOG_EMERG, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
 
-#define SC_CLOGT(c, t, ...) 	log_ctrl_print(c, LOG_TRACE, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_CLOGD(c, t, ...) 	log_ctrl_print(c, LOG_DEBUG, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_CLOGI(c, t, ...) 	log_ctrl_print(c, LOG_INFO,  "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_CLOGW(c, t, ...) 	log_ctrl_print(c, LOG_WARN,  "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_CLOGE(c, t, ...) 	log_ctrl_print(c, LOG_ERR,   "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define SC_CLOGM(c, t, ...) 	log_ctrl_print(c, LOG_EMERG, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_CLOGT(c, t, ...) 	SC_LOG_PRINT(c, LOG_TRACE, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_CLOGD(c, t, ...) 	SC_LOG_PRINT(c, LOG_DEBUG, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_CLOGI(c, t, ...) 	SC_LOG_PRINT(c, LOG_INFO,  "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_CLOGW(c, t, ...) 	SC_LOG_PRINT(c, LOG_WARN,  "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_CLOGE(c, t, ...) 	SC_LOG_PRINT(c, LOG_ERR,   "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define SC_CLOGM(c, t, ...) 	SC_LOG_PRINT(c, LOG_EMERG, "[%s][%04d]" t "", __FUNCTION__, __LINE__, ##__VA_ARGS__)
 
 #define SC_ERR_CON_EQ(ret, a, str) do { \
 	if ((ret) != (a)) { \
@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <sched.h>
 
 #include "cmap.h"
 
@@ -8,240 +10,600 @@
 extern "C"{
 #endif
 
+#define CMAP_INIT_CAPACITY 8
+
+typedef struct
+{
+	unsigned int hash;
+	int is_pkey;
+	const char* ikey;	//字符串 key 的驻留指针
+	cmapnode node;
+}cmap_entry;
+
+typedef struct cmap_table_s
+{
+	struct cmap_table_s *next;	//retired 链表
+	int capacity;				//entries 个数
+	unsigned int mask;			//索引表大小 - 1，索引表大小是 capacity 的 2 倍
+	cmap_entry *entries;
+	int *index;
+}cmap_table;
+
+typedef struct
+{
+	unsigned int hash;
+	int refs;		//引用这个字符串的节点个数
+	int pinned;		//cmap_pkey_intern 返回过，不再释放
+	char str[];
+}cmap_istr;
+
+//驻留字符串集合，只在持有 lock 时访问
+typedef struct cmap_intern_set_s
+{
+	int count;
+	unsigned int mask;
+	cmap_istr **slots;
+}cmap_intern_set;
+
+typedef struct
+{
+	unsigned int hash;
+	int is_pkey;
+	int i_key;
+	const char* p_key;
+	const char* ikey;	//不为 NULL 时只比较驻留指针
+}cmap_lookup_key;
+
+static unsigned int cmap_hash_str(const char* s)
+{
+	unsigned int h = 2166136261u;
+	while (*s)
+	{
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static unsigned int cmap_hash_int(int key)
+{
+	unsigned int h = (unsigned int)key;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+static void cmap_seq_begin(cmap *q)
+{
+	__atomic_store_n(&q->seq, q->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void cmap_seq_end(cmap *q)
+{
+	__atomic_store_n(&q->seq, q->seq + 1, __ATOMIC_RELEASE);
+}
+
+static unsigned int cmap_read_begin(cmap *q)
+{
+	unsigned int seq;
+	while ((seq = __atomic_load_n(&q->seq, __ATOMIC_ACQUIRE)) & 1)
+		sched_yield();
+	return seq;
+}
+
+//读到的数据被写端修改过时返回 1，需要重读
+static int cmap_read_retry(cmap *q, unsigned int seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&q->seq, __ATOMIC_RELAXED) != seq;
+}
+
+//读操作开始，之后读到的表在 cmap_read_end 之前不会被释放
+static void cmap_read_enter(cmap *q)
+{
+	__atomic_add_fetch(&q->readers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void cmap_read_leave(cmap *q)
+{
+	__atomic_sub_fetch(&q->readers, 1, __ATOMIC_RELEASE);
+}
+
+//没有读者时释放扩容留下的旧表，调用前需要持有 lock
+//新表已经用 SEQ_CST 发布，这里看到 readers 为 0 之后开始的读操作只会读到新表
+static void cmap_retired_reclaim(cmap *q)
+{
+	cmap_table *t;
+
+	if (!q->retired || __atomic_load_n(&q->readers, __ATOMIC_SEQ_CST) != 0)
+		return;
+	while (q->retired)
+	{
+		t = q->retired;
+		q->retired = t->next;
+		free(t);
+	}
+}
+
+static cmap_table* cmap_table_create(int capacity)
+{
+	unsigned int slots = (unsigned int)capacity * 2;
+	cmap_table* t = (cmap_table*)calloc(1, sizeof(cmap_table)
+		+ sizeof(cmap_entry) * capacity + sizeof(int) * slots);
+	if (!t)
+		return NULL;
+	t->capacity = capacity;
+	t->mask = slots - 1;
+	t->entries = (cmap_entry*)(t + 1);
+	t->index = (int*)(t->entries + capacity);
+	return t;
+}
+
+//返回 entries 下标，没找到返回 -1，slot 返回命中或者探测结束的槽位
+//读端调用时可能读到写到一半的数据，探测次数有上限，结果由 seq 校验
+static int cmap_lookup(cmap_table *t, const cmap_lookup_key *k, unsigned int *slot)
+{
+	unsigned int i = k->hash & t->mask;
+	unsigned int n;
+
+	for (n = 0; n <= t->mask; n++, i = (i + 1) & t->mask)
+	{
+		int idx = __atomic_load_n(&t->index[i], __ATOMIC_RELAXED);
+		if (idx == 0 || idx > t->capacity)
+			break;
+
+		cmap_entry *e = &t->entries[idx - 1];
+		if (__atomic_load_n(&e->hash, __ATOMIC_RELAXED) != k->hash || e->is_pkey != k->is_pkey)
+			continue;
+		if ((!k->is_pkey && e->node.key.i_key == k->i_key)
+			|| (k->ikey && __atomic_load_n(&e->ikey, __ATOMIC_RELAXED) == k->ikey)
+			|| (k->is_pkey && !k->ikey && strncmp(e->node.key.p_key, k->p_key, CMAP_PKEY_MAX) == 0))
+		{
+			*slot = i;
+			return idx - 1;
+		}
+	}
+	*slot = i;
+	return -1;
+}
+
+//把 entries 下标 idx 放进索引表，只在新表发布之前或者 seq 写区间里调用
+static void cmap_index_put(cmap_table *t, int idx)
+{
+	unsigned int i = t->entries[idx].hash & t->mask;
+	while (t->index[i] != 0)
+		i = (i + 1) & t->mask;
+	__atomic_store_n(&t->index[i], idx + 1, __ATOMIC_RELAXED);
+}
+
+//删除槽位 slot，把后面探测链上的槽位前移，不留墓碑
+static void cmap_index_remove(cmap_table *t, unsigned int slot)
+{
+	unsigned int i = slot, j = slot;
+	for (;;)
+	{
+		j = (j + 1) & t->mask;
+		int idx = t->index[j];
+		if (idx == 0)
+			break;
+		unsigned int home = t->entries[idx - 1].hash & t->mask;
+		//j 上的节点理想位置不在 (i, j] 之间，移到空出来的 i
+		if (((j - home) & t->mask) >= ((j - i) & t->mask))
+		{
+			__atomic_store_n(&t->index[i], idx, __ATOMIC_RELAXED);
+			i = j;
+		}
+	}
+	__atomic_store_n(&t->index[i], 0, __ATOMIC_RELAXED);
+}
+
+//容量翻倍，新表建好后才发布，旧表挂到 retired 链表
+static cmap_table* cmap_table_grow(cmap *q)
+{
+	cmap_table *old = q->table;
+	cmap_table *t = cmap_table_create(old->capacity * 2);
+	int i;
+
+	if (!t)
+		return NULL;
+	memcpy(t->entries, old->entries, sizeof(cmap_entry) * q->size);
+	for (i = 0; i < q->size; i++)
+		cmap_index_put(t, i);
+
+	__atomic_store_n(&q->table, t, __ATOMIC_SEQ_CST);
+	old->next = q->retired;
+	q->retired = old;
+	return t;
+}
+
+//调用前需要持有 lock
+static const char* cmap_intern_locked(cmap *q, const char* key, unsigned int hash)
+{
+	cmap_intern_set *set = q->interns;
+	cmap_istr *s;
+	unsigned int i;
+
+	if (!set)
+	{
+		set = (cmap_intern_set*)calloc(1, sizeof(cmap_intern_set));
+		if (!set)
+			return NULL;
+		set->mask = CMAP_INIT_CAPACITY * 2 - 1;
+		set->slots = (cmap_istr**)calloc(set->mask + 1, sizeof(cmap_istr*));
+		if (!set->slots)
+		{
+			free(set);
+			return NULL;
+		}
+		q->interns = set;
+	}
+
+	for (i = hash & set->mask; set->slots[i]; i = (i + 1) & set->mask)
+	{
+		if (set->slots[i]->hash == hash && strcmp(set->slots[i]->str, key) == 0)
+			return set->slots[i]->str;
+	}
+
+	if ((unsigned int)(set->count + 1) * 2 > set->mask + 1)
+	{
+		unsigned int mask = set->mask * 2 + 1;
+		cmap_istr **slots = (cmap_istr**)calloc(mask + 1, sizeof(cmap_istr*));
+		unsigned int j;
+		if (!slots)
+			return NULL;
+		for (j = 0; j <= set->mask; j++)
+		{
+			if (!set->slots[j])
+				continue;
+			for (i = set->slots[j]->hash & mask; slots[i]; i = (i + 1) & mask)
+				;
+			slots[i] = set->slots[j];
+		}
+		free(set->slots);
+		set->slots = slots;
+		set->mask = mask;
+		for (i = hash & set->mask; set->slots[i]; i = (i + 1) & set->mask)
+			;
+	}
+
+	s = (cmap_istr*)malloc(sizeof(cmap_istr) + strlen(key) + 1);
+	if (!s)
+		return NULL;
+	s->hash = hash;
+	s->refs = 0;
+	s->pinned = 0;
+	strcpy(s->str, key);
+	set->slots[i] = s;
+	set->count++;
+	return s->str;
+}
+
+static cmap_istr* cmap_istr_of(const char* str)
+{
+	return (cmap_istr*)(str - offsetof(cmap_istr, str));
+}
+
+//没有节点引用、也没有返回给调用者的驻留字符串从集合里删除并释放，调用前需要持有 lock
+//读端只比较驻留指针、不访问字符串内容，引用它的节点都已经删除，释放后不会被读到
+static void cmap_intern_release_locked(cmap *q, const char* str)
+{
+	cmap_intern_set *set = q->interns;
+	cmap_istr *s = cmap_istr_of(str);
+	unsigned int i, j;
+
+	if (s->refs > 0 || s->pinned)
+		return;
+	for (i = s->hash & set->mask; set->slots[i] != s; i = (i + 1) & set->mask)
+		;
+	//和 cmap_index_remove 一样前移后续槽位，不留墓碑
+	for (j = i;;)
+	{
+		j = (j + 1) & set->mask;
+		if (!set->slots[j])
+			break;
+		unsigned int home = set->slots[j]->hash & set->mask;
+		if (((j - home) & set->mask) >= ((j - i) & set->mask))
+		{
+			set->slots[i] = set->slots[j];
+			i = j;
+		}
+	}
+	set->slots[i] = NULL;
+	set->count--;
+	free(s);
+}
+
+static int cmap_insert(cmap *q, const cmap_lookup_key *k, void* e)
+{
+	cmap_table *t = q->table;
+	cmap_entry *ent;
+	unsigned int slot;
+
+	if (cmap_lookup(t, k, &slot) >= 0)
+		return -2;
+	if (q->size >= t->capacity)
+	{
+		t = cmap_table_grow(q);
+		if (!t)
+			return -1;
+	}
+
+	cmap_seq_begin(q);
+	ent = &t->entries[q->size];
+	ent->hash = k->hash;
+	ent->is_pkey = k->is_pkey;
+	ent->ikey = k->ikey;
+	memset(&ent->node.key, 0, sizeof(cmap_key));
+	if (k->is_pkey)
+		strcpy(ent->node.key.p_key, k->ikey);
+	else
+		ent->node.key.i_key = k->i_key;
+	ent->node.data = e;
+	cmap_index_put(t, q->size);
+	__atomic_store_n(&q->size, q->size + 1, __ATOMIC_RELAXED);
+	cmap_seq_end(q);
+	if (k->is_pkey)
+		cmap_istr_of(k->ikey)->refs++;
+	cmap_retired_reclaim(q);
+
+	return 0;
+}
+
+static int cmap_erase(cmap *q, const cmap_lookup_key *k)
+{
+	cmap_table *t = q->table;
+	unsigned int slot;
+	int idx = cmap_lookup(t, k, &slot);
+	int last = q->size - 1;
+	const char* ikey;
+
+	if (idx < 0)
+		return -1;
+
+	ikey = t->entries[idx].ikey;
+	cmap_seq_begin(q);
+	cmap_index_remove(t, slot);
+	//最后一个节点移到空出来的位置，保持 entries 紧凑
+	if (idx != last)
+	{
+		unsigned int i = t->entries[last].hash & t->mask;
+		while (t->index[i] != last + 1)
+			i = (i + 1) & t->mask;
+		t->entries[idx] = t->entries[last];
+		__atomic_store_n(&t->index[i], idx + 1, __ATOMIC_RELAXED);
+	}
+	memset(&t->entries[last], 0, sizeof(cmap_entry));
+	__atomic_store_n(&q->size, last, __ATOMIC_RELAXED);
+	cmap_seq_end(q);
+	if (ikey)
+	{
+		cmap_istr_of(ikey)->refs--;
+		cmap_intern_release_locked(q, ikey);
+	}
+	cmap_retired_reclaim(q);
+
+	return 0;
+}
+
+static void* cmap_find(cmap *q, const cmap_lookup_key *k)
+{
+	void* v;
+	unsigned int seq, slot;
+
+	cmap_read_enter(q);
+	do
+	{
+		seq = cmap_read_begin(q);
+		cmap_table *t = __atomic_load_n(&q->table, __ATOMIC_SEQ_CST);
+		int idx = cmap_lookup(t, k, &slot);
+		v = idx < 0 ? NULL : __atomic_load_n(&t->entries[idx].node.data, __ATOMIC_RELAXED);
+	} while (cmap_read_retry(q, seq));
+	cmap_read_leave(q);
+
+	return v;
+}
+
+static void cmap_free_data(cmap *q)
+{
+	int i;
+	for (i = 0; i < q->size; i++)
+	{
+		if (q->table->entries[i].node.data)
+			free(q->table->entries[i].node.data);
+	}
+}
 
 void cmap_init(cmap *p)
 {
-	p->front = (cmapnode *)malloc(sizeof(cmapnode));
-	p->front->data = NULL;
-	p->rear = p->front;
-	p->size = 0;
-	p->front->key.i_key = 0xffffffff;
-	memset(p->front->key.p_key, 0, 64);
-	(p->front)->next = 0;
+	memset(p, 0, sizeof(cmap));
+	p->table = cmap_table_create(CMAP_INIT_CAPACITY);
 	p->lock = cmtx_create();
 }
 
 void cmap_clear(cmap *q)
 {
+	cmap_table *t;
+
+	cmap_entry *ents;
+	int i, size;
+
 	cmtx_enter(q->lock);
-	while (cmap_is_empty(q) != 1)
+	t = q->table;
+	size = q->size;
+	//清空之后才能释放驻留字符串，先复制出还引用的 key
+	ents = (cmap_entry*)malloc(sizeof(cmap_entry) * (size > 0 ? size : 1));
+	if (ents)
+		memcpy(ents, t->entries, sizeof(cmap_entry) * size);
+	cmap_seq_begin(q);
+	cmap_free_data(q);
+	memset(t->entries, 0, sizeof(cmap_entry) * t->capacity);
+	memset(t->index, 0, sizeof(int) * (t->mask + 1));
+	__atomic_store_n(&q->size, 0, __ATOMIC_RELAXED);
+	cmap_seq_end(q);
+	for (i = 0; ents && i < size; i++)
 	{
-		q->rear = q->front->next;
-		if(q->front->data)
-			free(q->front->data);
-		free(q->front);
-		q->front = q->rear;
+		if (!ents[i].ikey)
+			continue;
+		cmap_istr_of(ents[i].ikey)->refs--;
+		cmap_intern_release_locked(q, ents[i].ikey);
 	}
-	if(q->front->data)
-		free(q->front->data);
-		
-	q->front->data = NULL;
-	q->rear = q->front;
-	q->front->key.i_key = 0xffffffff;
-	memset(q->front->key.p_key, 0, 64);
-	q->size = 0;
+	free(ents);
+	cmap_retired_reclaim(q);
 	cmtx_leave(q->lock);
 }
 
 int cmap_destory(cmap *q)
 {
+	cmap_table *t;
+	unsigned int i;
+
 	cmtx_enter(q->lock);
-	while (q->front)
+	cmap_free_data(q);
+	free(q->table);
+	q->table = NULL;
+	while (q->retired)
+	{
+		t = q->retired;
+		q->retired = t->next;
+		free(t);
+	}
+	if (q->interns)
 	{
-		q->rear = q->front->next;
-		if(q->front->data)
-			free(q->front->data);
-		free(q->front);
-		q->front = q->rear;
+		for (i = 0; i <= q->interns->mask; i++)
+			free(q->interns->slots[i]);
+		free(q->interns->slots);
+		free(q->interns);
+		q->interns = NULL;
 	}
 	q->size = 0;
 	cmtx_leave(q->lock);
-	
+
 	cmtx_delete(q->lock);
 	return 0;
 }
 
 int cmap_is_empty(cmap *q)
 {
-	int v;
-	if (q->front == q->rear) 
-		v = 1;
-	else              
-		v = 0;
-	return v;
+	return cmap_size(q) == 0 ? 1 : 0;
 }
 
 int cmap_ikey_insert(cmap *q, int key, void* e)
 {
-	if(cmap_ikey_find(q, key) != 0) return -2;
+	cmap_lookup_key k = {cmap_hash_int(key), 0, key, NULL, NULL};
+	int ret;
 
 	cmtx_enter(q->lock);
-	q->rear->next = (cmapnode *)malloc(sizeof(cmapnode));
-	q->rear = q->rear->next;
-	if (!q->rear) 
-	{
-		cmtx_leave(q->lock);
-		return -1;
-	}
-	q->rear->data = e;
-	q->rear->key.i_key = key;
-	q->rear->next = 0;
-	q->size += 1;
+	ret = cmap_insert(q, &k, e);
 	cmtx_leave(q->lock);
 
-	return 0;
+	return ret;
 }
 
 void* cmap_ikey_find(cmap *q, int key)
 {
-	void* v = 0;
-	cmtx_enter(q->lock);
-	cmapnode* p = q->front->next;
-	while (p)
-	{	
-		if(p->key.i_key == key)
-		{
-			v = p->data;
-			break;
-		}
-		p = p->next;
-	}
-	cmtx_leave(q->lock);
-
-	return v;
+	cmap_lookup_key k = {cmap_hash_int(key), 0, key, NULL, NULL};
+	return cmap_find(q, &k);
 }
 
 int cmap_ikey_erase(cmap *q, int key)
 {
+	cmap_lookup_key k = {cmap_hash_int(key), 0, key, NULL, NULL};
+	int ret;
+
 	cmtx_enter(q->lock);
-	cmapnode* t = q->front;
-	cmapnode* p = q->front->next;
-	while (p)
-	{	
-		if(p->key.i_key == key)
-		{
-			t->next = p->next;
-			if(q->rear == p)
-			{
-				q->rear = t;
-			}
-			
-			free(p);
-
-			q->size -= 1;
-			cmtx_leave(q->lock);
-			return 0;
-		}
-		t = p;
-		p = p->next;
-	}
+	ret = cmap_erase(q, &k);
 	cmtx_leave(q->lock);
 
-	return -1;
+	return ret;
 }
 
 int cmap_pkey_insert(cmap *q, const char* key, void* e)
 {
-	if(cmap_pkey_find(q, key) != 0) return -2;
+	cmap_lookup_key k = {0, 1, 0, key, NULL};
+	int ret;
 
-	cmtx_enter(q->lock);
-	q->rear->next = (cmapnode *)malloc(sizeof(cmapnode));
-	q->rear = q->rear->next;
-	if (!q->rear)
-	{
-		cmtx_leave(q->lock);
+	if (strlen(key) >= CMAP_PKEY_MAX)
 		return -1;
-	}
-	else
-	{
-		q->rear->data = e;
-		strcpy(q->rear->key.p_key, key);
-		q->rear->next = 0;
-		q->size += 1;
 
-		cmtx_leave(q->lock);
-		
-		return 0;
-	}
+	k.hash = cmap_hash_str(key);
+	cmtx_enter(q->lock);
+	k.ikey = cmap_intern_locked(q, key, k.hash);
+	ret = k.ikey ? cmap_insert(q, &k, e) : -1;
+	if (ret != 0 && k.ikey)
+		cmap_intern_release_locked(q, k.ikey);
+	cmtx_leave(q->lock);
 
+	return ret;
 }
 
-//将释放节点数据内存
 int cmap_pkey_erase(cmap *q, const char* key)
 {
+	cmap_lookup_key k = {cmap_hash_str(key), 1, 0, key, NULL};
+	int ret;
+
 	cmtx_enter(q->lock);
-	cmapnode* t = q->front;
-	cmapnode* p = q->front->next;
-	while (p)
-	{	
-		if(strcmp(p->key.p_key, key) == 0)
-		{
-			t->next = p->next;
-			if(q->rear == p)
-			{
-				q->rear = t;
-			}
-			
-			free(p);
-			q->size -= 1;
-			
-			cmtx_leave(q->lock);
-			return 0;
-		}
-		t = p;
-		p = p->next;
-	}
+	ret = cmap_erase(q, &k);
 	cmtx_leave(q->lock);
-	
-	return -1;
+
+	return ret;
 }
 
 void* cmap_pkey_find(cmap *q, const char* key)
 {
+	cmap_lookup_key k = {cmap_hash_str(key), 1, 0, key, NULL};
+	return cmap_find(q, &k);
+}
+
+const char* cmap_pkey_intern(cmap *q, const char* key)
+{
+	const char* v;
+
+	if (strlen(key) >= CMAP_PKEY_MAX)
+		return NULL;
+
 	cmtx_enter(q->lock);
-	void* v = 0;
-	cmapnode* p = q->front->next;
-	while (p)
-	{	
-		if(strcmp(p->key.p_key, key) == 0)
-		{
-			v = p->data;
-			break;
-		}
-		p = p->next;
-	}
+	v = cmap_intern_locked(q, key, cmap_hash_str(key));
+	if (v)
+		cmap_istr_of(v)->pinned = 1;
 	cmtx_leave(q->lock);
-	
+
 	return v;
 }
 
+void* cmap_pkey_find_interned(cmap *q, const char* key)
+{
+	const cmap_istr *s = cmap_istr_of(key);
+	cmap_lookup_key k = {s->hash, 1, 0, key, key};
+	return cmap_find(q, &k);
+}
+
 cmapnode* cmap_index_get(cmap *q, int index)
 {
-	cmapnode* v = 0;
-	int idx = 0;
-	cmtx_enter(q->lock);
-	cmapnode* p = q->front->next;
-	while (p)
-	{	
-		if(idx == index)
-		{
-			v = p;
-			break;
-		}
-		p = p->next;
-		idx++;
-	}
-	cmtx_leave(q->lock);
+	cmapnode* v;
+	unsigned int seq;
+
+	cmap_read_enter(q);
+	do
+	{
+		seq = cmap_read_begin(q);
+		cmap_table *t = __atomic_load_n(&q->table, __ATOMIC_SEQ_CST);
+		v = (index >= 0 && index < __atomic_load_n(&q->size, __ATOMIC_RELAXED)
+			&& index < t->capacity) ? &t->entries[index].node : NULL;
+	} while (cmap_read_retry(q, seq));
+	cmap_read_leave(q);
 
 	return v;
 }
 
 int cmap_size(cmap *q)
 {
-	return q->size;
+	return __atomic_load_n(&q->size, __ATOMIC_RELAXED);
 }
 
 #ifdef __cplusplus
 }
 #endif
-
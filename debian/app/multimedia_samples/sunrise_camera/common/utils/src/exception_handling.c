@@ -23,6 +23,7 @@
 #include <linux/unistd.h>
 
 #include "exception_handling.h"
+#include "utils_log.h"
 
 #define BUFFER_SIZE     1024
 #define FUNCNAME_SIZE   64
@@ -1111,6 +1112,8 @@ static void print_backtrace(struct ucontext_t *ct)
 static void exception_handing(int signo,
 		siginfo_t* info, void* ct)
 {
+	// 先写出还在缓冲区里的日志，方便对照崩溃前的打印
+	log_ctrl_crash_flush();
 	print_except_header(signo);
 	print_backtrace((struct ucontext_t *)ct);
 
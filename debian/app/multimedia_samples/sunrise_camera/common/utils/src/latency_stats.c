@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "utils_log.h"
+#include "time_utils.h"
+#include "latency_stats.h"
+
+/**
+ * 直方图分桶(对数线性):
+ * 1. 小于 16ns 的值每个值一个桶
+ * 2. 其余值按最高位 e 分段，每段取最高位后面 4 位作为段内下标，共 16 个桶，
+ *    桶宽是值的 1/16 ~ 1/32，取桶中点作为统计值
+ * 3. 超过 2^41ns(约 36 分钟)的值记入最后一个桶
+ * 每个线程每个阶段一个直方图，只有本线程写，写用 relaxed 原子操作，
+ * 快照时其他线程只读，计数可能差一两次但不会读到撕裂的值
+ * 计数用 32 位，快照时按差值计算，单个快照间隔内不超过 2^32 次就不会出错
+ */
+#define LATENCY_SUB_BITS		4
+#define LATENCY_SUB_COUNT		(1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS		41
+#define LATENCY_MAX_VALUE		((1ULL << LATENCY_MAX_BITS) - 1)
+#define LATENCY_BUCKETS			((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT)
+
+typedef struct
+{
+	uint32_t	counts[LATENCY_BUCKETS];
+	uint64_t	count;
+	uint64_t	sum_ns;
+} latency_hist_t;
+
+typedef struct latency_thread_s
+{
+	struct latency_thread_s	*next;
+	latency_hist_t			*hists[LATENCY_STAGE_MAX];
+} latency_thread_t;
+
+typedef struct
+{
+	uint32_t	counts[LATENCY_BUCKETS];
+	uint64_t	count;
+	uint64_t	sum_ns;
+} latency_total_t;
+
+static pthread_mutex_t s_latency_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t s_latency_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_latency_key;
+static __thread latency_thread_t *s_latency_thread = NULL;
+
+static char s_stage_names[LATENCY_STAGE_MAX][LATENCY_STAGE_NAME_MAX];
+static int32_t s_stage_count = 0;
+
+static latency_thread_t *s_threads = NULL;			// 正在运行的线程
+static latency_total_t s_retired[LATENCY_STAGE_MAX];	// 已退出线程的累计值
+static latency_total_t s_previous[LATENCY_STAGE_MAX];	// 上一次快照时的累计值
+static latency_snapshot_t s_last_snapshot;
+
+static inline uint32_t latency_bucket_index(uint64_t ns)
+{
+	uint32_t e;
+
+	if (ns > LATENCY_MAX_VALUE)
+		ns = LATENCY_MAX_VALUE;
+	if (ns < LATENCY_SUB_COUNT)
+		return (uint32_t)ns;
+	e = 63 - __builtin_clzll(ns);
+	return (e - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT
+		+ ((ns >> (e - LATENCY_SUB_BITS)) & (LATENCY_SUB_COUNT - 1));
+}
+
+// 桶的中点，upper 为真时返回桶的上界
+static uint64_t latency_bucket_value(uint32_t index, int32_t upper)
+{
+	uint32_t e, sub;
+	uint64_t width;
+
+	if (index < LATENCY_SUB_COUNT)
+		return index;
+	e = index / LATENCY_SUB_COUNT + LATENCY_SUB_BITS - 1;
+	sub = index % LATENCY_SUB_COUNT;
+	width = 1ULL << (e - LATENCY_SUB_BITS);
+	return ((uint64_t)(LATENCY_SUB_COUNT + sub) << (e - LATENCY_SUB_BITS)) + (upper ? width - 1 : width / 2);
+}
+
+static void latency_total_add(latency_total_t *total, latency_hist_t *hist)
+{
+	int32_t i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+		total->counts[i] += __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+	total->count += __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+	total->sum_ns += __atomic_load_n(&hist->sum_ns, __ATOMIC_RELAXED);
+}
+
+// 线程退出时把直方图合并到 s_retired
+static void latency_thread_exit(void *arg)
+{
+	latency_thread_t *thread = (latency_thread_t *)arg;
+	latency_thread_t **pp;
+	int32_t i;
+
+	pthread_mutex_lock(&s_latency_lock);
+	for (pp = &s_threads; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == thread) {
+			*pp = thread->next;
+			break;
+		}
+	}
+	for (i = 0; i < LATENCY_STAGE_MAX; i++) {
+		if (thread->hists[i] == NULL)
+			continue;
+		latency_total_add(&s_retired[i], thread->hists[i]);
+		free(thread->hists[i]);
+	}
+	pthread_mutex_unlock(&s_latency_lock);
+
+	free(thread);
+}
+
+static void latency_key_create(void)
+{
+	pthread_key_create(&s_latency_key, latency_thread_exit);
+}
+
+static latency_hist_t *latency_hist_create(int32_t stage)
+{
+	latency_thread_t *thread = s_latency_thread;
+	latency_hist_t *hist;
+
+	if (thread == NULL) {
+		thread = calloc(1, sizeof(latency_thread_t));
+		if (thread == NULL)
+			return NULL;
+		pthread_once(&s_latency_once, latency_key_create);
+		pthread_setspecific(s_latency_key, thread);
+
+		pthread_mutex_lock(&s_latency_lock);
+		thread->next = s_threads;
+		s_threads = thread;
+		pthread_mutex_unlock(&s_latency_lock);
+		s_latency_thread = thread;
+	}
+
+	hist = calloc(1, sizeof(latency_hist_t));
+	if (hist == NULL)
+		return NULL;
+	// 快照线程在锁里读 hists，这里发布后才能被看到
+	__atomic_store_n(&thread->hists[stage], hist, __ATOMIC_RELEASE);
+	return hist;
+}
+
+int32_t latency_stats_stage(const char *name)
+{
+	int32_t i, stage = -1;
+
+	if (name == NULL)
+		return -1;
+
+	pthread_mutex_lock(&s_latency_lock);
+	for (i = 0; i < s_stage_count; i++) {
+		if (strncmp(s_stage_names[i], name, LATENCY_STAGE_NAME_MAX - 1) == 0) {
+			stage = i;
+			break;
+		}
+	}
+	if (stage < 0 && s_stage_count < LATENCY_STAGE_MAX) {
+		stage = s_stage_count;
+		snprintf(s_stage_names[stage], LATENCY_STAGE_NAME_MAX, "%s", name);
+		__atomic_store_n(&s_stage_count, stage + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&s_latency_lock);
+
+	if (stage < 0)
+		SC_LOGW("latency stage %s ignored, too many stages", name);
+	return stage;
+}
+
+void latency_stats_record(int32_t stage, uint64_t ns)
+{
+	latency_hist_t *hist;
+	uint32_t index;
+
+	if (stage < 0 || stage >= LATENCY_STAGE_MAX)
+		return;
+
+	hist = s_latency_thread ? s_latency_thread->hists[stage] : NULL;
+	if (hist == NULL) {
+		hist = latency_hist_create(stage);
+		if (hist == NULL)
+			return;
+	}
+
+	index = latency_bucket_index(ns);
+	__atomic_store_n(&hist->counts[index], hist->counts[index] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->count, hist->count + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->sum_ns, hist->sum_ns + ns, __ATOMIC_RELAXED);
+}
+
+void latency_stats_record_since(int32_t stage, uint64_t start_ns)
+{
+	uint64_t now_ns = get_monotonic_ns();
+
+	latency_stats_record(stage, now_ns > start_ns ? now_ns - start_ns : 0);
+}
+
+static uint64_t latency_percentile(const uint32_t *counts, uint64_t count, uint32_t percent)
+{
+	uint64_t target, seen = 0;
+	int32_t i;
+
+	target = (count * percent + 99) / 100;
+	if (target == 0)
+		target = 1;
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= target)
+			return latency_bucket_value(i, 0);
+	}
+	return latency_bucket_value(LATENCY_BUCKETS - 1, 0);
+}
+
+static void latency_stage_summarize(int32_t stage, latency_stage_summary_t *summary)
+{
+	latency_total_t current;
+	uint32_t delta[LATENCY_BUCKETS];
+	latency_thread_t *thread;
+	latency_hist_t *hist;
+	int32_t i;
+
+	memcpy(&current, &s_retired[stage], sizeof(current));
+	for (thread = s_threads; thread != NULL; thread = thread->next) {
+		hist = __atomic_load_n(&thread->hists[stage], __ATOMIC_ACQUIRE);
+		if (hist != NULL)
+			latency_total_add(&current, hist);
+	}
+
+	memset(summary, 0, sizeof(*summary));
+	snprintf(summary->name, sizeof(summary->name), "%s", s_stage_names[stage]);
+	summary->total = current.count;
+	summary->count = current.count - s_previous[stage].count;
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		delta[i] = current.counts[i] - s_previous[stage].counts[i];
+		if (delta[i] != 0)
+			summary->max_ns = latency_bucket_value(i, 1);
+	}
+	if (summary->count != 0) {
+		summary->mean_ns = (current.sum_ns - s_previous[stage].sum_ns) / summary->count;
+		summary->p50_ns = latency_percentile(delta, summary->count, 50);
+		summary->p90_ns = latency_percentile(delta, summary->count, 90);
+		summary->p99_ns = latency_percentile(delta, summary->count, 99);
+	}
+
+	memcpy(&s_previous[stage], &current, sizeof(current));
+}
+
+void latency_stats_snapshot(latency_snapshot_t *snapshot)
+{
+	uint64_t now_ns = get_monotonic_ns();
+	int32_t i;
+
+	pthread_mutex_lock(&s_latency_lock);
+	s_last_snapshot.interval_ns = s_last_snapshot.time_ns ? now_ns - s_last_snapshot.time_ns : 0;
+	s_last_snapshot.time_ns = now_ns;
+	s_last_snapshot.stage_count = s_stage_count;
+	for (i = 0; i < s_stage_count; i++)
+		latency_stage_summarize(i, &s_last_snapshot.stages[i]);
+	if (snapshot != NULL)
+		memcpy(snapshot, &s_last_snapshot, sizeof(*snapshot));
+	pthread_mutex_unlock(&s_latency_lock);
+}
+
+void latency_stats_last_snapshot(latency_snapshot_t *snapshot)
+{
+	if (snapshot == NULL)
+		return;
+
+	pthread_mutex_lock(&s_latency_lock);
+	memcpy(snapshot, &s_last_snapshot, sizeof(*snapshot));
+	pthread_mutex_unlock(&s_latency_lock);
+}
+
+int32_t latency_stats_dump_file(const char *path)
+{
+	static latency_snapshot_t snapshot;
+	char tmp_path[256], time_buffer[32];
+	latency_stage_summary_t *stage;
+	FILE *fp;
+	int32_t i;
+
+	if (path == NULL)
+		path = LATENCY_STATS_FILE;
+
+	latency_stats_snapshot(&snapshot);
+
+	// 先写临时文件再改名，读文件的一方不会读到写了一半的内容
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	fp = fopen(tmp_path, "w");
+	if (fp == NULL) {
+		SC_LOGE("open %s failed", tmp_path);
+		return -1;
+	}
+
+	get_world_time_string(time_buffer, sizeof(time_buffer));
+	fprintf(fp, "# %s interval %.3fs\n", time_buffer, snapshot.interval_ns / 1e9);
+	fprintf(fp, "%-24s %8s %10s %10s %10s %10s %10s %10s\n",
+		"stage", "count", "total", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+	for (i = 0; i < snapshot.stage_count; i++) {
+		stage = &snapshot.stages[i];
+		fprintf(fp, "%-24s %8llu %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			stage->name, (unsigned long long)stage->count, (unsigned long long)stage->total,
+			stage->mean_ns / 1e3, stage->p50_ns / 1e3, stage->p90_ns / 1e3,
+			stage->p99_ns / 1e3, stage->max_ns / 1e3);
+	}
+	fclose(fp);
+
+	if (rename(tmp_path, path) != 0) {
+		SC_LOGE("rename %s to %s failed", tmp_path, path);
+		return -1;
+	}
+	return 0;
+}
+
+int32_t latency_stats_to_json(char *buf, int32_t size)
+{
+	static latency_snapshot_t snapshot;
+	latency_stage_summary_t *stage;
+	int32_t i, len;
+
+	if (buf == NULL || size <= 0)
+		return -1;
+
+	latency_stats_last_snapshot(&snapshot);
+
+	len = snprintf(buf, size, "{\"interval_ms\":%llu,\"stages\":[",
+		(unsigned long long)(snapshot.interval_ns / 1000000));
+	for (i = 0; i < snapshot.stage_count && len < size; i++) {
+		stage = &snapshot.stages[i];
+		len += snprintf(buf + len, size - len,
+			"%s{\"name\":\"%s\",\"count\":%llu,\"total\":%llu,\"mean_us\":%.1f,"
+			"\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}",
+			i == 0 ? "" : ",", stage->name,
+			(unsigned long long)stage->count, (unsigned long long)stage->total,
+			stage->mean_ns / 1e3, stage->p50_ns / 1e3, stage->p90_ns / 1e3,
+			stage->p99_ns / 1e3, stage->max_ns / 1e3);
+	}
+	if (len < size)
+		len += snprintf(buf + len, size - len, "]}");
+	if (len >= size)
+		return -1;
+	return len;
+}
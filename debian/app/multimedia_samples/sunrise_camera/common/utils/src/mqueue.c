@@ -1,16 +1,146 @@
-#include <pthread.h>
-#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <signal.h>
 #include <time.h>
 #include <errno.h>
-#include <sys/time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "mqueue.h"
 
+/*******************************************************************************
+** 函 数 名  : mQueueFutexWait
+** 功能描述  : 在 pu32Futex 上等待，值不等于 u32Val 时立即返回，psDeadline 是
+			   CLOCK_MONOTONIC 的绝对时间，NULL 表示一直等待
+** 返 回 值  : 0 被唤醒或者值已经变化，ETIMEDOUT 超时
+*******************************************************************************/
+static int mQueueFutexWait(uint32_t *pu32Futex, uint32_t u32Val, const struct timespec *psDeadline)
+{
+	if (syscall(SYS_futex, pu32Futex, FUTEX_WAIT_BITSET_PRIVATE, u32Val, psDeadline,
+		NULL, FUTEX_BITSET_MATCH_ANY) == 0)
+		return 0;
+
+	// EAGAIN: 值已经变化; EINTR: 被信号打断(mThreadStop)，都回去重试
+	return errno == ETIMEDOUT ? ETIMEDOUT : 0;
+}
+
+// 等待计数: 低 16 位是还没有被唤醒的等待者，高 16 位是已经唤醒但还没有返回的等待者，
+// 唤醒过的等待者不再重复唤醒，避免每次入队、出队都做一次 futex 系统调用
+#define QUEUE_WAITER_ONE	1u
+#define QUEUE_SIGNAL_ONE	(1u << 16)
+
+static void mQueueWaitBegin(uint32_t *pu32Waiters)
+{
+	__atomic_add_fetch(pu32Waiters, QUEUE_WAITER_ONE, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void mQueueWaitEnd(uint32_t *pu32Waiters)
+{
+	uint32_t u32Val = __atomic_load_n(pu32Waiters, __ATOMIC_RELAXED);
+	uint32_t u32New;
+
+	// 优先消耗一个唤醒，被唤醒的和超时返回的等待者可以互换，总数不变
+	do {
+		u32New = u32Val >= QUEUE_SIGNAL_ONE ? u32Val - QUEUE_SIGNAL_ONE : u32Val - QUEUE_WAITER_ONE;
+	} while (!__atomic_compare_exchange_n(pu32Waiters, &u32Val, u32New, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*******************************************************************************
+** 函 数 名  : mQueueNotify
+** 功能描述  : 有还没被唤醒的等待者时唤醒一个
+*******************************************************************************/
+static void mQueueNotify(uint32_t *pu32Futex, uint32_t *pu32Waiters)
+{
+	uint32_t u32Val;
+
+	// 和 mQueueWaitBegin 的 fence 配对: 要么这里看到等待者，要么等待方
+	// 重试时看到刚写入的数据，不会丢失唤醒
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	u32Val = __atomic_load_n(pu32Waiters, __ATOMIC_RELAXED);
+	do {
+		if ((u32Val & (QUEUE_SIGNAL_ONE - 1)) == 0)
+			return;
+	} while (!__atomic_compare_exchange_n(pu32Waiters, &u32Val, u32Val - QUEUE_WAITER_ONE + QUEUE_SIGNAL_ONE,
+		1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	__atomic_add_fetch(pu32Futex, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, pu32Futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static int mQueueTryEnqueue(tsQueue *psQueue, void *pvData)
+{
+	uint64_t u64Pos = __atomic_load_n(&psQueue->u64EnqueuePos, __ATOMIC_RELAXED);
+
+	// 长度为 1 的队列和原来一样存不下任何数据
+	if (psQueue->u32Capacity == 0)
+		return 0;
+
+	for (;;)
+	{
+		tsQueueCell *psCell = &psQueue->psCells[u64Pos % psQueue->u32Capacity];
+		uint64_t u64Seq = __atomic_load_n(&psCell->u64Seq, __ATOMIC_ACQUIRE);
+		int64_t i64Diff = (int64_t)(u64Seq - 2 * u64Pos);
+
+		if (i64Diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&psQueue->u64EnqueuePos, &u64Pos, u64Pos + 1,
+				1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				psCell->pvData = pvData;
+				__atomic_store_n(&psCell->u64Seq, 2 * u64Pos + 1, __ATOMIC_RELEASE);
+				return 1;
+			}
+		}
+		else if (i64Diff < 0)
+		{
+			// 这个位置上一轮的数据还没有被取走，队列已满
+			return 0;
+		}
+		else
+		{
+			u64Pos = __atomic_load_n(&psQueue->u64EnqueuePos, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static int mQueueTryDequeue(tsQueue *psQueue, void **ppvData)
+{
+	uint64_t u64Pos = __atomic_load_n(&psQueue->u64DequeuePos, __ATOMIC_RELAXED);
+
+	if (psQueue->u32Capacity == 0)
+		return 0;
+
+	for (;;)
+	{
+		tsQueueCell *psCell = &psQueue->psCells[u64Pos % psQueue->u32Capacity];
+		uint64_t u64Seq = __atomic_load_n(&psCell->u64Seq, __ATOMIC_ACQUIRE);
+		int64_t i64Diff = (int64_t)(u64Seq - (2 * u64Pos + 1));
+
+		if (i64Diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&psQueue->u64DequeuePos, &u64Pos, u64Pos + 1,
+				1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				*ppvData = psCell->pvData;
+				__atomic_store_n(&psCell->u64Seq, 2 * (u64Pos + psQueue->u32Capacity), __ATOMIC_RELEASE);
+				return 1;
+			}
+		}
+		else if (i64Diff < 0)
+		{
+			// 这个位置还没有写入，队列为空
+			return 0;
+		}
+		else
+		{
+			u64Pos = __atomic_load_n(&psQueue->u64DequeuePos, __ATOMIC_RELAXED);
+		}
+	}
+}
+
 /*******************************************************************************
 ** 函 数 名  : mQueueCreate
 ** 功能描述  : 创建消息队列
@@ -20,19 +150,22 @@
 *******************************************************************************/
 teQueueStatus mQueueCreate(tsQueue *psQueue, uint32_t u32Length)
 {
-	psQueue->apvBuffer = malloc(sizeof(void *) * u32Length);
-	if (!psQueue->apvBuffer){
-		return E_QUEUE_ERROR_NO_MEM;
-	}
+	uint32_t i;
 
+	memset(psQueue, 0, sizeof(tsQueue));
 	psQueue->u32Length = u32Length;
-	//psQueue->u32Size = u32bufferSize;
-	psQueue->u32Front = 0;
-	psQueue->u32Rear = 0;
+	psQueue->u32Capacity = u32Length > 0 ? u32Length - 1 : 0;
 
-	pthread_mutex_init(&psQueue->mutex, NULL);
-	pthread_cond_init(&psQueue->cond_space_available, NULL);
-	pthread_cond_init(&psQueue->cond_data_available, NULL);
+	// 容量为 0 时也分配一个，psCells 为 NULL 表示队列没有创建
+	psQueue->psCells = malloc(sizeof(tsQueueCell) * (psQueue->u32Capacity > 0 ? psQueue->u32Capacity : 1));
+	if (!psQueue->psCells){
+		return E_QUEUE_ERROR_NO_MEM;
+	}
+	for (i = 0; i < psQueue->u32Capacity; i++)
+	{
+		psQueue->psCells[i].pvData = NULL;
+		psQueue->psCells[i].u64Seq = 2 * i;
+	}
 
 	return E_QUEUE_OK;
 }
@@ -45,37 +178,40 @@ teQueueStatus mQueueCreate(tsQueue *psQueue, uint32_t u32Length)
 *******************************************************************************/
 teQueueStatus mQueueDestroy(tsQueue *psQueue)
 {
-	if (NULL == psQueue->apvBuffer){
+	if (NULL == psQueue->psCells){
 		return E_QUEUE_ERROR_FAILED;
 	}
-	free(psQueue->apvBuffer);
-
-	pthread_mutex_destroy(&psQueue->mutex);
-	pthread_cond_destroy(&psQueue->cond_space_available);
-	pthread_cond_destroy(&psQueue->cond_data_available);
+	free(psQueue->psCells);
+	psQueue->psCells = NULL;
 
 	return E_QUEUE_OK;
 }
 
 /*******************************************************************************
 ** 函 数 名  : mQueueEnqueue
-** 功能描述  : 入队函数，如果空间已满，需要等待空间释放，然后广播队列中有数
-			   据可用，入队的内存需要手动申请，然后在出队地方释放
+** 功能描述  : 入队函数，如果空间已满，需要等待空间释放，然后唤醒一个等待数
+			   据的线程，入队的内存需要手动申请，然后在出队地方释放
 ** 输入参数  : tsQueue *psQueue
 			 : void *pvData
 ** 返 回 值  :
 *******************************************************************************/
 teQueueStatus mQueueEnqueue(tsQueue *psQueue, void *pvData)
 {
-	pthread_mutex_lock(&psQueue->mutex);
-	while (((psQueue->u32Rear + 1)%psQueue->u32Length) == psQueue->u32Front)
-		pthread_cond_wait(&psQueue->cond_space_available, &psQueue->mutex);
-	psQueue->apvBuffer[psQueue->u32Rear] = pvData;
+	while (!mQueueTryEnqueue(psQueue, pvData))
+	{
+		uint32_t u32Key = __atomic_load_n(&psQueue->u32SpaceFutex, __ATOMIC_ACQUIRE);
 
-	psQueue->u32Rear = (psQueue->u32Rear+1) % psQueue->u32Length;
+		mQueueWaitBegin(&psQueue->u32SpaceWaiters);
+		if (mQueueTryEnqueue(psQueue, pvData))
+		{
+			mQueueWaitEnd(&psQueue->u32SpaceWaiters);
+			break;
+		}
+		mQueueFutexWait(&psQueue->u32SpaceFutex, u32Key, NULL);
+		mQueueWaitEnd(&psQueue->u32SpaceWaiters);
+	}
 
-	pthread_cond_broadcast(&psQueue->cond_data_available);
-	pthread_mutex_unlock(&psQueue->mutex);
+	mQueueNotify(&psQueue->u32DataFutex, &psQueue->u32DataWaiters);
 	return E_QUEUE_OK;
 }
 
@@ -88,48 +224,63 @@ teQueueStatus mQueueEnqueue(tsQueue *psQueue, void *pvData)
 *******************************************************************************/
 teQueueStatus mQueueEnqueueEx(tsQueue *psQueue, void *pvData)
 {
-	pthread_mutex_lock(&psQueue->mutex);
-	while (((psQueue->u32Rear + 1)%psQueue->u32Length) == psQueue->u32Front) {
-		pthread_cond_broadcast(&psQueue->cond_data_available);
-		pthread_mutex_unlock(&psQueue->mutex);
+	if (!mQueueTryEnqueue(psQueue, pvData))
 		return E_QUEUE_ERROR_FULL;
-	}
-	psQueue->apvBuffer[psQueue->u32Rear] = pvData;
-
-	psQueue->u32Rear = (psQueue->u32Rear+1) % psQueue->u32Length;
 
-	pthread_cond_broadcast(&psQueue->cond_data_available);
-	pthread_mutex_unlock(&psQueue->mutex);
+	mQueueNotify(&psQueue->u32DataFutex, &psQueue->u32DataWaiters);
 	return E_QUEUE_OK;
 }
 
+/*******************************************************************************
+** 函 数 名  : mQueueDequeueWait
+** 功能描述  : 出队，队列为空时等待到 psDeadline，NULL 表示一直等待
+*******************************************************************************/
+static teQueueStatus mQueueDequeueWait(tsQueue *psQueue, const struct timespec *psDeadline, void **ppvData)
+{
+	while (!mQueueTryDequeue(psQueue, ppvData))
+	{
+		uint32_t u32Key = __atomic_load_n(&psQueue->u32DataFutex, __ATOMIC_ACQUIRE);
+		int ret = 0;
+
+		mQueueWaitBegin(&psQueue->u32DataWaiters);
+		if (mQueueTryDequeue(psQueue, ppvData))
+		{
+			mQueueWaitEnd(&psQueue->u32DataWaiters);
+			break;
+		}
+		ret = mQueueFutexWait(&psQueue->u32DataFutex, u32Key, psDeadline);
+		mQueueWaitEnd(&psQueue->u32DataWaiters);
+
+		if (ret == ETIMEDOUT)
+		{
+			// 超时的同时可能刚好有数据入队，最后再取一次
+			if (mQueueTryDequeue(psQueue, ppvData))
+				break;
+			return E_QUEUE_ERROR_TIMEOUT;
+		}
+	}
+
+	mQueueNotify(&psQueue->u32SpaceFutex, &psQueue->u32SpaceWaiters);
+	return E_QUEUE_OK;
+}
 
 /*******************************************************************************
 ** 函 数 名  : mQueueDequeue
-** 功能描述  : 出队函数，需要等待队列中有数据可用，读出数据后需要广播队列中
-			   空间可用，调用出队函数的地方需要释放入队分配的内存
+** 功能描述  : 出队函数，需要等待队列中有数据可用，读出数据后唤醒一个等待空
+			   间的线程，调用出队函数的地方需要释放入队分配的内存
 ** 输入参数  : tsQueue *psQueue
 			 : void **ppvData
 ** 返 回 值  :
 *******************************************************************************/
 teQueueStatus mQueueDequeue(tsQueue *psQueue, void **ppvData)
 {
-	pthread_mutex_lock(&psQueue->mutex);
-	while (psQueue->u32Front == psQueue->u32Rear)
-		pthread_cond_wait(&psQueue->cond_data_available, &psQueue->mutex);
-
-	*ppvData = psQueue->apvBuffer[psQueue->u32Front];
-
-	psQueue->u32Front = (psQueue->u32Front + 1) % psQueue->u32Length;
-	pthread_cond_broadcast(&psQueue->cond_space_available);
-	pthread_mutex_unlock(&psQueue->mutex);
-	return E_QUEUE_OK;
+	return mQueueDequeueWait(psQueue, NULL, ppvData);
 }
 
 /*******************************************************************************
 ** 函 数 名  : mQueueDequeueTimed
 ** 功能描述  : 具有延时等待功能的出队函数，可以设置等待时间然后返回，避免阻
-			   塞
+			   塞，等待时间为 0 时只尝试一次
 ** 输入参数  : tsQueue *psQueue
 			 : uint32_t u32WaitTimeout
 			 : void **ppvData
@@ -137,62 +288,39 @@ teQueueStatus mQueueDequeue(tsQueue *psQueue, void **ppvData)
 *******************************************************************************/
 teQueueStatus mQueueDequeueTimed(tsQueue *psQueue, uint32_t u32WaitTimeMil, void **ppvData)
 {
-	pthread_mutex_lock(&psQueue->mutex);
-	while (psQueue->u32Front == psQueue->u32Rear)
-	{
-		struct timeval sNow;
-		struct timespec sTimeout;
-
-		memset(&sNow, 0, sizeof(struct timeval));
-		gettimeofday(&sNow, NULL);
-		sTimeout.tv_sec = sNow.tv_sec + (u32WaitTimeMil/1000);
-		sTimeout.tv_nsec = (sNow.tv_usec + ((u32WaitTimeMil % 1000) * 1000)) * 1000;
-		if (sTimeout.tv_nsec > 1000000000)
-		{
-			sTimeout.tv_sec++;
-			sTimeout.tv_nsec -= 1000000000;
-		}
-		/*printf("Dequeue timed: now    %lu s, %lu ns\n", sNow.tv_sec, sNow.tv_usec * 1000);*/
-		/*printf("Dequeue timed: until  %lu s, %lu ns\n", sTimeout.tv_sec, sTimeout.tv_nsec);*/
-
-		switch (pthread_cond_timedwait(&psQueue->cond_data_available, &psQueue->mutex, &sTimeout))
-		{
-			case (0):
-				break;
-
-			case (ETIMEDOUT):
-				pthread_mutex_unlock(&psQueue->mutex);
-				return E_QUEUE_ERROR_TIMEOUT;
-				break;
+	struct timespec sDeadline;
 
-			default:
-				pthread_mutex_unlock(&psQueue->mutex);
-				return E_QUEUE_ERROR_FAILED;
-		}
+	if (mQueueTryDequeue(psQueue, ppvData))
+	{
+		mQueueNotify(&psQueue->u32SpaceFutex, &psQueue->u32SpaceWaiters);
+		return E_QUEUE_OK;
 	}
+	if (u32WaitTimeMil == 0)
+		return E_QUEUE_ERROR_TIMEOUT;
 
-	*ppvData = psQueue->apvBuffer[psQueue->u32Front];
+	clock_gettime(CLOCK_MONOTONIC, &sDeadline);
+	sDeadline.tv_sec += u32WaitTimeMil / 1000;
+	sDeadline.tv_nsec += (u32WaitTimeMil % 1000) * 1000000;
+	if (sDeadline.tv_nsec >= 1000000000)
+	{
+		sDeadline.tv_sec++;
+		sDeadline.tv_nsec -= 1000000000;
+	}
 
-	psQueue->u32Front = (psQueue->u32Front + 1) % psQueue->u32Length;
-	pthread_cond_broadcast(&psQueue->cond_space_available);
-	pthread_mutex_unlock(&psQueue->mutex);
-	return E_QUEUE_OK;
+	return mQueueDequeueWait(psQueue, &sDeadline, ppvData);
 }
+
 int mQueueIsEmpty(tsQueue *psQueue){
-	pthread_mutex_lock(&psQueue->mutex);
-	if (psQueue->u32Rear == psQueue->u32Front) {
-		pthread_mutex_unlock(&psQueue->mutex);
-		return 1;
-	}
-	pthread_mutex_unlock(&psQueue->mutex);
-	return 0;
+	uint64_t u64Dequeue = __atomic_load_n(&psQueue->u64DequeuePos, __ATOMIC_ACQUIRE);
+	uint64_t u64Enqueue = __atomic_load_n(&psQueue->u64EnqueuePos, __ATOMIC_ACQUIRE);
+
+	return u64Enqueue <= u64Dequeue ? 1 : 0;
 }
 
 int mQueueIsFull(tsQueue *psQueue)
 {
-	if (((psQueue->u32Rear + 1)%psQueue->u32Length) == psQueue->u32Front) {
-		return 1;
-	}
-	return 0;
-}
+	uint64_t u64Dequeue = __atomic_load_n(&psQueue->u64DequeuePos, __ATOMIC_ACQUIRE);
+	uint64_t u64Enqueue = __atomic_load_n(&psQueue->u64EnqueuePos, __ATOMIC_ACQUIRE);
 
+	return u64Enqueue - u64Dequeue >= psQueue->u32Capacity ? 1 : 0;
+}
@@ -168,6 +168,15 @@ const char *mThreadStateString(int state){
 teThreadStatus mThreadStop(tsThread *psThreadInfo)
 {
 	if (psThreadInfo->eState == E_THREAD_STOPPED) {
+		// 线程自己调用 mThreadFinish 退出了，可 join 的线程还要在这里回收
+		if (psThreadInfo->pThread_Id != 0 && psThreadInfo->pThread_Id != (pthread_t)-1
+			&& psThreadInfo->eThreadDetachState == E_THREAD_JOINABLE) {
+			if (pthread_join(psThreadInfo->pThread_Id, NULL))
+				printf("Could not join thread:%s\n", strerror(errno));
+			psThreadInfo->pThread_Id = -1;
+			printf("Joined finished Thread %s\n", psThreadInfo->pThread_Name);
+			return  E_THREAD_OK;
+		}
 		printf("Stopping Thread %s, found thread is not runing, so return.\n", psThreadInfo->pThread_Name);
 		return  E_THREAD_OK; // 有可能是重复调用退出线程，也有可能是调用退出一个没有启动的线程
 	}
@@ -1,4 +1,10 @@
 #include <stdlib.h>
+#include <stdint.h>
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "nalu_utils.h"
 #include "utils_log.h"
 
@@ -14,90 +20,136 @@ int find_start_code3(unsigned char *data)
 	else return 1;
 }
 
-int get_annexb_nalu(unsigned char *frame, int length, NALU_t *nalu, int is_h265)
+static int find_annexb_start_code_scalar(const unsigned char *data, int from, int length)
 {
-	int info2, info3;
-	int pos = 0;
-	int start_code_found, rewind;
-	int i = 0;
+	int i = from;
 
-	nalu->startcodeprefix_len = 3;      //Initialize the bits prefix as 3 bytes
-
-	info2 = find_start_code2(frame);    //Check whether Buf is 0x000001
-	if (info2 != 1)
+	while (i + 2 < length)
 	{
-		info3 = find_start_code3(frame);//Check whether Buf is 0x00000001
-		if (info3 != 1)              //If not the return -1
-		{
-			printf("error frame data: ");
-			// for (i = 0; i < length; i++) {
-			for (i = 0; i < 32; i++) {
-				printf("%02x ", frame[i]);
-			}
-			printf(" ... ... len:%u\n", length);
-			return -1;
-		}
+		if (data[i + 2] > 1)
+			i += 3;     //data[i+2] 不可能是起始码中的任何一个字节
+		else if (data[i + 2] == 0)
+			i++;
+		else if (data[i] == 0 && data[i + 1] == 0)
+			return i;
 		else
-		{
-			//If Buf is 0x00000001,set the prefix length to 4 bytes
-			pos = 4;
-			nalu->startcodeprefix_len = 4;
-		}
+			i += 3;
+	}
+	return -1;
+}
+
+/*
+	返回 data[from, length) 中第一个 0x000001 的位置，没有找到返回 -1
+	每次比较 16/32 个位置：data[i] == 0 && data[i+1] == 0 && data[i+2] == 1，尾部不足一个向量的部分用标量处理
+*/
+int find_annexb_start_code(const unsigned char *data, int from, int length)
+{
+	int i = from;
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+	const uint8x16_t zero = vdupq_n_u8(0);
+	const uint8x16_t one = vdupq_n_u8(1);
+	for (; i + 18 <= length; i += 16)
+	{
+		uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(data + i), zero),
+			vceqq_u8(vld1q_u8(data + i + 1), zero)), vceqq_u8(vld1q_u8(data + i + 2), one));
+		// 每个字节压缩成 4 bit，得到 64 bit 的位置掩码
+		uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+		if (bits)
+			return i + (__builtin_ctzll(bits) >> 2);
 	}
-	else
+#elif defined(__AVX2__)
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+	for (; i + 34 <= length; i += 32)
 	{
-		//If Buf is 0x000001,set the prefix length to 3 bytes
-		pos = 3;
-		nalu->startcodeprefix_len = 3;
+		__m256i m = _mm256_and_si256(_mm256_and_si256(
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), zero),
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i + 1)), zero)),
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i + 2)), one));
+		unsigned int bits = (unsigned int)_mm256_movemask_epi8(m);
+		if (bits)
+			return i + __builtin_ctz(bits);
 	}
-	//Search for next character sign bit
-	start_code_found = 0;
-	info2 = 0;
-	info3 = 0;
+#elif defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	for (; i + 18 <= length; i += 16)
+	{
+		__m128i m = _mm_and_si128(_mm_and_si128(
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), zero),
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + 1)), zero)),
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + 2)), one));
+		unsigned int bits = (unsigned int)_mm_movemask_epi8(m);
+		if (bits)
+			return i + __builtin_ctz(bits);
+	}
+#endif
+	return find_annexb_start_code_scalar(data, i, length);
+}
 
-	while (!start_code_found)
+/*
+	一次扫描得到一帧(access unit)中所有 NALU 的位置，返回索引到的 NALU 个数，
+	帧不是以起始码开始时返回 -1，NALU 个数超过 max_count 时只返回前 max_count 个
+*/
+int get_annexb_nalu_index(unsigned char *frame, int length, NALU_index_t *index, int max_count, int is_h265)
+{
+	int count = 0;
+	int start, next, end;
+	int pos = find_annexb_start_code(frame, 0, length < 4 ? length : 4);
+
+	if (pos < 0 || (pos == 1 && frame[0] != 0))
+		return -1;
+
+	index[0].startcodeprefix_len = pos == 1 ? 4 : 3;
+	while (pos >= 0 && count < max_count)
 	{
-		if (pos > length)
-		{
-			nalu->len = (pos - 1) - nalu->startcodeprefix_len;
-			//memcpy (nalu->buf, &frame[nalu->startcodeprefix_len], nalu->len);
-			nalu->buf = &frame[nalu->startcodeprefix_len];
-			nalu->forbidden_bit = nalu->buf[0] & 0x80;     // 1 bit--10000000
-			nalu->nal_reference_idc = nalu->buf[0] & 0x60; // 2 bit--01100000
-			if(is_h265){
-				nalu->nal_unit_type = ((nalu->buf[0]) & 0x7e) >> 1;   // 5 bit--00011111
-			}else{
-				nalu->nal_unit_type = (nalu->buf[0]) & 0x1f;   // 5 bit--00011111
-			}
-
-			return pos - 1;
-		}
-		pos++;
-		info3 = find_start_code3(&frame[pos - 4]);		     //Check whether Buf is 0x00000001
-		if (info3 != 1)
-			info2 = find_start_code2(&frame[pos - 3]);           //Check whether Buf is 0x000001
-		start_code_found = (info2 == 1 || info3 == 1);
+		start = pos + 3;
+		next = find_annexb_start_code(frame, start, length);
+		end = next < 0 ? length : next;
+		// 4 字节起始码 0x00000001 的第一个 0 属于下一个 NALU
+		if (next > start && frame[next - 1] == 0)
+			end--;
+
+		index[count].offset = start;
+		index[count].len = end > start ? end - start : 0;
+		if (index[count].len > 0)
+			index[count].nal_unit_type = is_h265 ? (frame[start] & 0x7e) >> 1 : frame[start] & 0x1f;
+		else
+			index[count].nal_unit_type = 0;
+		index[count].reserved = 0;
+		count++;
+
+		if (next >= 0 && count < max_count)
+			index[count].startcodeprefix_len = end != next ? 4 : 3;
+		pos = next;
 	}
+	return count;
+}
 
-	// Here, we have found another start code (and read length of startcode bytes more than we should
-	// have.  Hence, go back in the file
-	rewind = (info3 == 1) ? -4 : -3;
+int get_annexb_nalu(unsigned char *frame, int length, NALU_t *nalu, int is_h265)
+{
+	NALU_index_t index;
+	int i = 0;
 
-	// Here the Start code, the complete NALU, and the next start code is in the Buf.
-	// The size of Buf is pos, pos+rewind are the number of bytes excluding the next
-	// start code, and (pos+rewind)-startcodeprefix_len is the size of the NALU excluding the start code
-	nalu->len = (pos + rewind) - nalu->startcodeprefix_len;
-	//memcpy (nalu->buf, &frame[nalu->startcodeprefix_len], nalu->len);//Copy one complete NALU excluding start prefix 0x000001 and 0x00000001
-	nalu->buf = &frame[nalu->startcodeprefix_len];
+	if (get_annexb_nalu_index(frame, length, &index, 1, is_h265) != 1)
+	{
+		printf("error frame data: ");
+		for (i = 0; i < 32 && i < length; i++) {
+			printf("%02x ", frame[i]);
+		}
+		printf(" ... ... len:%u\n", length);
+		return -1;
+	}
+
+	nalu->startcodeprefix_len = index.startcodeprefix_len;
+	nalu->len = index.len;
+	nalu->buf = &frame[index.offset];
 	nalu->forbidden_bit = nalu->buf[0] & 0x80;                     //1 bit
 	nalu->nal_reference_idc = nalu->buf[0] & 0x60;                 // 2 bit
-	if(is_h265){
-		nalu->nal_unit_type = ((nalu->buf[0]) & 0x7e) >> 1;   // 5 bit--00011111
-	}else{
-		nalu->nal_unit_type = (nalu->buf[0]) & 0x1f;   // 5 bit--00011111
-	}
+	nalu->nal_unit_type = index.nal_unit_type;
 
-	return (pos + rewind);                                           //Return the length of bytes from between one NALU and the next NALU
+	return index.offset + index.len;                               //Return the length of bytes from between one NALU and the next NALU
 }
 
 int nalu_is_beyond_source_data_range(unsigned char *nalu_start, int32_t nalu_length,
@@ -6,6 +6,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 
 #include "stream_manager.h"
 #include "utils_log.h"
@@ -24,6 +26,337 @@ static CMtx s_shmmap_lock = NULL;
 */
 static pthread_rwlock_t s_shm_rwlock;
 
+// 把 info 中写端解析的 NALU 索引装入迭代器，仍是迭代中的同一帧时保持遍历位置
+static void shm_stream_nalu_load(shm_info_t* slot, unsigned char* data, unsigned int length, shm_nalu_iter_t* iter)
+{
+	if(iter->pos > 0 && iter->pos < iter->count && iter->data == data && iter->length == length)
+		return;
+	iter->count = slot->nalu_count <= SHM_STREAM_NALU_MAX ? slot->nalu_count : 0;
+	memcpy(iter->nalus, slot->nalus, iter->count * sizeof(NALU_index_t));
+	iter->pos = 0;
+	iter->data = data;
+	iter->length = length;
+}
+
+/**
+ * 无锁单生产者多消费者(SPMC)模式：
+ * 1. user[0].index 为写端单调递增的帧序号(下一个要写的位置)，user[i].index 为读端单调递增的帧序号，
+ *    均不取模，下标 = 序号 % max_frames
+ * 2. 写端先把 info 的 seq 置 0 并占用数据区 (user[0].pos)，再写入数据，
+ *    最后以 release 语义发布 seq = 帧序号 + 1 和 user[0].index
+ * 3. 读端以 acquire 语义读取 user[0].index，读取 info 后再次校验 seq 与 pos，
+ *    seq 不匹配说明该 info 已被覆盖，pos 落后超过数据区大小说明数据已被覆盖
+ * 4. 整个过程不使用 handle->mtx 和 s_shm_rwlock，一个读端卡住不会影响写端和其他读端
+ * 5. 外部缓冲区帧(shm_stream_put_external)不占用数据区，ext_ref 高 32 位为 seq，低 16 位为还没越过该帧的读端数，
+ *    16-31 位为正在使用该缓冲区(front/get 之后还没有 post)的读端数，读端读位置越过该帧时减引用，都减到 0 时调用 release 归还
+ * 6. 写端复用 info 时只归还没有读端正在使用的外部缓冲区，有读端正在使用的 info 跳过，跳过的帧序号读端读到时 seq 不匹配，
+ *    直接跳过；写端销毁时有读端正在使用的外部缓冲区由最后一个使用者归还
+*/
+#define SHM_EXT_REF_MASK	0xffffULL			// 还没越过该帧的读端数
+#define SHM_EXT_PIN_ONE		(1ULL << 16)		// 正在使用该缓冲区的读端数
+#define SHM_EXT_PIN_MASK	(0xffffULL << 16)
+
+static inline int shm_stream_is_spmc(shm_stream_t* handle)
+{
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	return __atomic_load_n(&users[0].lockfree, __ATOMIC_ACQUIRE) == 1;
+}
+
+// 调用前需要保证已读取了 info 的内容，返回 1 表示内容有效
+static inline int shm_stream_spmc_valid(shm_stream_t* handle, shm_info_t* slot, unsigned int seq)
+{
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq + 1)
+		return 0;
+	if(slot->ext_data == NULL && __atomic_load_n(&users[0].pos, __ATOMIC_RELAXED) > slot->pos + handle->size)
+		return 0;
+	return 1;
+}
+
+// 读端释放对帧 seq 的外部缓冲区引用，pinned 为 1 时同时结束对缓冲区的使用
+static void shm_stream_spmc_unref(shm_stream_t* handle, unsigned int seq, int pinned)
+{
+	shm_info_t* slot = &((shm_info_t*)handle->info_array)[seq % handle->max_frames];
+	unsigned long long ref = __atomic_load_n(&slot->ext_ref, __ATOMIC_ACQUIRE);
+	unsigned long long next;
+	shm_stream_buffer_release release;
+	unsigned char* data;
+	void* opaque;
+
+	do{
+		if((unsigned int)(ref >> 32) != seq + 1)
+			return;
+		release = slot->ext_release;
+		data = slot->ext_data;
+		opaque = slot->ext_opaque;
+		if(pinned){
+			// 写端销毁时已经清掉了没越过该帧的读端数，只剩正在使用的读端数
+			next = ref - SHM_EXT_PIN_ONE - ((ref & SHM_EXT_REF_MASK) != 0 ? 1 : 0);
+		}else{
+			if((ref & SHM_EXT_REF_MASK) == 0)
+				return;
+			next = ref - 1;
+		}
+	}while(!__atomic_compare_exchange_n(&slot->ext_ref, &ref, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE));
+
+	if((next & (SHM_EXT_REF_MASK | SHM_EXT_PIN_MASK)) == 0 && release != NULL)
+		release(opaque, data);
+}
+
+// 读端开始使用帧 seq 的外部缓冲区，写端已经收回该缓冲区时返回 -1
+static int shm_stream_spmc_pin(shm_stream_t* handle, unsigned int seq)
+{
+	shm_info_t* slot = &((shm_info_t*)handle->info_array)[seq % handle->max_frames];
+	unsigned long long ref = __atomic_load_n(&slot->ext_ref, __ATOMIC_ACQUIRE);
+
+	do{
+		if((unsigned int)(ref >> 32) != seq + 1 || (ref & SHM_EXT_REF_MASK) == 0)
+			return -1;
+	}while(!__atomic_compare_exchange_n(&slot->ext_ref, &ref, ref + SHM_EXT_PIN_ONE, 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE));
+	return 0;
+}
+
+static void shm_stream_spmc_release_hold(shm_stream_t* handle)
+{
+	if(!handle->holding)
+		return;
+	handle->holding = 0;
+	shm_stream_spmc_unref(handle, handle->hold_seq, handle->hold_pinned);
+}
+
+// 释放 [from, to) 范围内各帧的引用，读端持有的帧在范围内时只释放一次
+static void shm_stream_spmc_unref_range(shm_stream_t* handle, unsigned int from, unsigned int to)
+{
+	unsigned int hold_seq = handle->hold_seq;
+	int held = handle->holding && hold_seq - from < to - from;
+	unsigned int i, seq;
+
+	if(held)
+		shm_stream_spmc_release_hold(handle);
+	if(to - from <= handle->max_frames){
+		for(; from != to; from++){
+			if(!held || from != hold_seq)
+				shm_stream_spmc_unref(handle, from, 0);
+		}
+		return;
+	}
+	// 范围超过 max_frames 时按 info 查找，被其他读端占用而跳过复用的 info 可能保存着更早的帧
+	for(i = 0; i < handle->max_frames; i++){
+		seq = (unsigned int)(__atomic_load_n(&((shm_info_t*)handle->info_array)[i].ext_ref, __ATOMIC_ACQUIRE) >> 32) - 1;
+		if(seq - from < to - from && (!held || seq != hold_seq))
+			shm_stream_spmc_unref(handle, seq, 0);
+	}
+}
+
+// 持有帧 seq 直到 post 或下一次 get，外部缓冲区帧同时标记为正在使用，写端不会归还，已被收回时返回 -1
+static int shm_stream_spmc_hold(shm_stream_t* handle, unsigned int seq, int external)
+{
+	if(handle->holding && handle->hold_seq == seq)
+		return 0;
+	shm_stream_spmc_release_hold(handle);
+	if(external && shm_stream_spmc_pin(handle, seq) != 0)
+		return -1;
+	handle->holding = 1;
+	handle->hold_seq = seq;
+	handle->hold_pinned = external;
+	return 0;
+}
+
+/**
+ * 写端复用 info 前，归还其中还没被读完的外部缓冲区，返回 0 表示可以复用
+ * 有读端正在使用时不能归还，返回 -1；detach 为 1 时(写端销毁)清掉还没越过该帧的读端数，
+ * 由最后一个正在使用的读端归还
+*/
+static int shm_stream_spmc_reclaim(shm_info_t* slot, int detach)
+{
+	unsigned long long ref = __atomic_load_n(&slot->ext_ref, __ATOMIC_ACQUIRE);
+	unsigned long long next;
+
+	do{
+		if((ref & SHM_EXT_PIN_MASK) == 0)
+			next = 0;
+		else if(detach)
+			next = ref & ~SHM_EXT_REF_MASK;
+		else
+			return -1;
+	}while(!__atomic_compare_exchange_n(&slot->ext_ref, &ref, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE));
+
+	if(next != 0)
+		return -1;
+	if((ref & SHM_EXT_REF_MASK) != 0 && slot->ext_release != NULL)
+		slot->ext_release(slot->ext_opaque, slot->ext_data);
+	slot->ext_data = NULL;
+	slot->ext_release = NULL;
+	slot->ext_opaque = NULL;
+	return 0;
+}
+
+// 作废并取得写位置的 info，读端正在使用外部缓冲区的 info 跳过，全部被占用时返回 NULL
+static shm_info_t* shm_stream_spmc_next_slot(shm_stream_t* handle)
+{
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	shm_info_t* infos = (shm_info_t*)handle->info_array;
+	shm_info_t* slot;
+	unsigned int i;
+
+	for(i = 0; i < handle->max_frames; i++){
+		slot = &infos[users[0].index % handle->max_frames];
+		// 先作废该 info，之后的写入对读端来说都是无效数据
+		__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		if(shm_stream_spmc_reclaim(slot, 0) == 0)
+			return slot;
+		__atomic_store_n(&users[0].index, users[0].index + 1, __ATOMIC_RELEASE);
+	}
+	SC_LOGW("[%s] writer:%s all %u infos are used by readers.", handle->name, users[0].id, handle->max_frames);
+	return NULL;
+}
+
+static int shm_stream_spmc_reserve(shm_stream_t* handle, unsigned int length, unsigned char** data)
+{
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	unsigned long long pos = users[0].pos;
+	unsigned int offset = users[0].offset;
+
+	if(shm_stream_spmc_next_slot(handle) == NULL)
+		return -1;
+
+	if(length + offset > handle->size){	//数据存储区不够存储了， 从头存储
+		if(handle->info_count < handle->max_frames){
+			SC_LOGW("[%s] writer:%s data region is overflow, info max count is %d, current info index is %d, count is %d.",
+				handle->name, users[0].id, handle->max_frames, users[0].index % handle->max_frames, handle->info_count);
+		}
+		pos += handle->size - offset;
+		offset = 0;
+		handle->info_count = 0;
+	}
+
+	// 占用数据区，之后的写入对读端来说都是无效数据
+	__atomic_store_n(&users[0].pos, pos + length, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	handle->reserve_offset = offset;
+	handle->reserve_pos = pos;
+	*data = (unsigned char*)(handle->base_addr + offset);
+	return 0;
+}
+
+static int shm_stream_spmc_publish(shm_stream_t* handle, frame_info* info, unsigned int length,
+	const NALU_index_t* nalus, unsigned int nalu_count)
+{
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	shm_info_t* infos = (shm_info_t*)handle->info_array;
+	unsigned int seq = users[0].index;
+	shm_info_t* slot = &infos[seq % handle->max_frames];
+
+	memcpy(&slot->info, info, sizeof(frame_info));
+	slot->lenght = length;
+	slot->offset = handle->reserve_offset;
+	slot->pos = handle->reserve_pos;
+	slot->nalu_count = nalu_count;
+	if(nalu_count > 0)
+		memcpy(slot->nalus, nalus, nalu_count * sizeof(NALU_index_t));
+	if(slot->ext_data == NULL){
+		users[0].offset = handle->reserve_offset + length;
+		__atomic_store_n(&users[0].pos, handle->reserve_pos + length, __ATOMIC_RELAXED);
+		handle->info_count++;
+	}
+
+	// 发布
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&users[0].index, seq + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// 读取当前读位置的帧，is_get 为 1 时同时移动读位置，iter 不为 NULL 时同时读取 NALU 索引
+static int shm_stream_spmc_read(shm_stream_t* handle, frame_info* info, unsigned char** data, unsigned int* length,
+	int is_get, shm_nalu_iter_t* iter)
+{
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	shm_info_t* infos = (shm_info_t*)handle->info_array;
+	shm_user_t* reader = &users[handle->index];
+	unsigned int head, tail;
+	shm_info_t* slot;
+	int external;
+
+	*length = 0;
+	for(;;)
+	{
+		head = __atomic_load_n(&users[0].index, __ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&reader->index, __ATOMIC_RELAXED);
+		if(head == tail)
+			return -1;
+
+		// 读端落后超过整个 info 数组，跳到仍然有效的最旧一帧
+		if(head - tail >= handle->max_frames){
+			SC_LOGW("[%s] reader:%s is overrun, skip %u frames.",
+				handle->name, reader->id, head - tail - (handle->max_frames - 1));
+			shm_stream_spmc_unref_range(handle, tail, head - (handle->max_frames - 1));
+			tail = head - (handle->max_frames - 1);
+			__atomic_store_n(&reader->index, tail, __ATOMIC_RELAXED);
+		}
+
+		slot = &infos[tail % handle->max_frames];
+		if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1){
+			// 写端正在覆盖这一帧，重新读取写位置
+			__atomic_store_n(&reader->index, tail + 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		memcpy(info, &slot->info, sizeof(frame_info));
+		external = slot->ext_data != NULL;
+		*data = external ? slot->ext_data : (unsigned char*)(handle->base_addr + slot->offset);
+		*length = slot->lenght;
+		if(iter != NULL)
+			shm_stream_nalu_load(slot, *data, *length, iter);
+
+		// 持有外部缓冲区的引用，直到 post 或下一次 get，校验之后写端收回了外部缓冲区同样作废这一帧
+		if(!shm_stream_spmc_valid(handle, slot, tail) || shm_stream_spmc_hold(handle, tail, external) != 0){
+			SC_LOGI("[%s] reader:%s frame %u is covered by writer.", handle->name, reader->id, tail);
+			*length = 0;
+			shm_stream_spmc_unref_range(handle, tail, tail + 1);
+			__atomic_store_n(&reader->index, tail + 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		break;
+	}
+
+	if(is_get)
+		__atomic_store_n(&reader->index, tail + 1, __ATOMIC_RELEASE);
+	else	// 多个读端会同时写同一个 info 的访问状态，无锁模式下只做参考
+		__atomic_store_n(&slot->access_status, DATA_ACCESS_STATUS_ACCESSING, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int shm_stream_spmc_post(shm_stream_t* handle)
+{
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	shm_info_t* infos = (shm_info_t*)handle->info_array;
+	shm_user_t* reader = &users[handle->index];
+	unsigned int head = __atomic_load_n(&users[0].index, __ATOMIC_ACQUIRE);
+	unsigned int tail = __atomic_load_n(&reader->index, __ATOMIC_RELAXED);
+	shm_info_t* slot = &infos[tail % handle->max_frames];
+	int held;
+
+	if(head == tail)
+		return 0;
+
+	__atomic_store_n(&slot->access_status, DATA_ACCESS_STATUS_IDEL, __ATOMIC_RELAXED);
+	if(!shm_stream_spmc_valid(handle, slot, tail)){
+		SC_LOGW("[%s] writer:%s covered reader:%s at index:%d, and reader is reading.",
+			handle->name, users[0].id, reader->id, tail % handle->max_frames);
+	}
+	__atomic_store_n(&reader->index, tail + 1, __ATOMIC_RELEASE);
+
+	held = handle->holding && handle->hold_seq == tail;
+	shm_stream_spmc_release_hold(handle);
+	if(!held)
+		shm_stream_spmc_unref(handle, tail, 0);
+	return 0;
+}
+
 // 如果要多个模块共享同一块内存，id要不一样，name、user、infos参数需要一样
 // mode和type根据具体读写情况配置
 shm_stream_t* shm_stream_create(char* id, const char* name, int users, int infos, int size, SHM_STREAM_MODE_E mode, SHM_STREAM_TYPE_E type)
@@ -49,6 +382,7 @@ shm_stream_t* shm_stream_create(char* id, const char* name, int users, int infos
 	}
 
 	handle->mtx = cmtx_create();
+	handle->notify_fd = -1;
 	handle->mode = mode;
 	handle->type = type;
 	handle->max_frames = infos;
@@ -65,13 +399,15 @@ shm_stream_t* shm_stream_create(char* id, const char* name, int users, int infos
 	cmtx_enter(handle->mtx);
 	shm_user_t* user = (shm_user_t*)handle->user_array;
 
-	if(mode == SHM_STREAM_WRITE || mode == SHM_STREAM_WRITE_BLOCK)
+	if(mode == SHM_STREAM_WRITE || mode == SHM_STREAM_WRITE_BLOCK || mode == SHM_STREAM_WRITE_SPMC)
 	{
 		handle->index = 0;
 		//写模式默认使用user[0]
 		user[0].index = 0;
 		user[0].offset = 0;
 		user[0].users = 0;
+		user[0].pos = 0;
+		__atomic_store_n(&user[0].lockfree, mode == SHM_STREAM_WRITE_SPMC ? 1 : 0, __ATOMIC_RELEASE);
 
 		snprintf(user[0].id, 32, "%s", id);
 		for(i=1; i<users; i++)	//	初始化其他模式的读下标
@@ -139,9 +475,33 @@ void shm_stream_destory(shm_stream_t* handle)
 	if(handle->mode == SHM_STREAM_READ)
 		user[0].users--;
 
+	if(shm_stream_is_spmc(handle)){
+		if(handle->mode == SHM_STREAM_READ){
+			// 读端退出，释放还未读取的外部缓冲区引用，front 后没有 post 的帧在范围内，先按范围释放
+			shm_stream_spmc_unref_range(handle, user[handle->index].index,
+				__atomic_load_n(&user[0].index, __ATOMIC_ACQUIRE));
+			shm_stream_spmc_release_hold(handle);
+		}else{
+			// 读端正在使用的外部缓冲区不能归还，交给最后一个使用者归还
+			for(unsigned int i = 0; i < handle->max_frames; i++){
+				if(shm_stream_spmc_reclaim(&((shm_info_t*)handle->info_array)[i], 1) != 0)
+					SC_LOGW("[%s] info %u is still used by readers.", handle->name, i);
+			}
+		}
+	}
+
 	SC_LOGI("[%s] name:%s handle addr: %p, index: %d, writer user count:%d",
 		user[handle->index].id, handle->name, handle, handle->index, user[0].users);
 
+	if(handle->notify_fd >= 0){
+		// 写锁保证写端不会再向即将关闭的 fd 写入
+		pthread_rwlock_wrlock(&s_shm_rwlock);
+		user[handle->index].notify_fd = 0;
+		pthread_rwlock_unlock(&s_shm_rwlock);
+		close(handle->notify_fd);
+		handle->notify_fd = -1;
+	}
+
 	memset(user[handle->index].id, 0, 32);
 	if(handle->type == SHM_STREAM_MMAP)
 		shm_stream_unmap(handle);
@@ -194,14 +554,114 @@ int shm_stream_info_callback_unregister(shm_stream_t* handle)
 	return 0;
 }
 
+// 唤醒所有注册了 eventfd 的读端，由写端在发布新帧后调用
+static void shm_stream_notify_readers(shm_stream_t* handle)
+{
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	uint64_t one = 1;
+	int i, fd;
 
-int shm_stream_put(shm_stream_t* handle, frame_info info, unsigned char* data, unsigned int length)
+	if(handle->type != SHM_STREAM_MALLOC)
+		return;
+	pthread_rwlock_rdlock(&s_shm_rwlock);
+	for(i = 1; i < handle->max_users; i++){
+		fd = __atomic_load_n(&users[i].notify_fd, __ATOMIC_RELAXED);
+		if(fd > 0 && write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			SC_LOGW("[%s] notify reader:%s fd:%d failed, %s", handle->name, users[i].id, fd, strerror(errno));
+	}
+	pthread_rwlock_unlock(&s_shm_rwlock);
+}
+
+/**
+ * 读端获取新帧通知用的 eventfd，写端每发布一帧该 fd 变为可读，可交给 select/epoll 等待，
+ * 被唤醒后调用 shm_stream_notify_clear 清除，再读取数据
+ * 1. 只支持 SHM_STREAM_MALLOC(同进程内)，失败返回 -1，调用者需要回退为轮询
+ * 2. fd 由 shm_stream_destory 关闭
+*/
+int shm_stream_notify_fd(shm_stream_t* handle)
 {
-	if(handle == NULL) return -1;
+	if(handle == NULL || handle->mode != SHM_STREAM_READ || handle->type != SHM_STREAM_MALLOC)
+		return -1;
+	if(handle->notify_fd >= 0)
+		return handle->notify_fd;
+
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(fd <= 0){
+		SC_LOGE("[%s] eventfd failed, %s", handle->name, strerror(errno));
+		if(fd == 0)
+			close(fd);
+		return -1;
+	}
+	handle->notify_fd = fd;
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	__atomic_store_n(&users[handle->index].notify_fd, fd, __ATOMIC_RELEASE);
+	return fd;
+}
+
+void shm_stream_notify_clear(shm_stream_t* handle)
+{
+	uint64_t count;
+
+	if(handle == NULL || handle->notify_fd < 0)
+		return;
+	if(read(handle->notify_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		SC_LOGW("[%s] read notify fd:%d failed, %s", handle->name, handle->notify_fd, strerror(errno));
+}
+
+/**
+ * 预留写入空间，生产者可以直接把数据写入(或 DMA 到) *data 指向的数据区，写完后调用 shm_stream_commit 发布
+ * 1. 返回 -1 表示没有读用户或 length 超过数据区大小，此时不需要生产数据
+ * 2. 预留到提交期间读端看不到该帧，所以写数据不需要持锁
+*/
+int shm_stream_reserve(shm_stream_t* handle, unsigned int length, unsigned char** data)
+{
+	if(handle == NULL || data == NULL) return -1;
 	//如果没有人想要数据 则不put
 	if(shm_stream_readers(handle) == 0){
 		return -1;
 	}
+
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	if(length > handle->size){
+		SC_LOGE("[%s] writer:%s frame length %u is bigger than data region %u.",
+			handle->name, users[0].id, length, handle->size);
+		return -1;
+	}
+
+	if(handle->mode == SHM_STREAM_WRITE_SPMC){
+		if(shm_stream_spmc_reserve(handle, length, data) != 0)
+			return -1;
+		handle->reserve_length = length;
+		return 0;
+	}
+	handle->reserve_length = length;
+
+	cmtx_enter(handle->mtx);
+	if(length + users[0].offset > handle->size) 	//数据存储区不够存储了， 从头存储
+		handle->reserve_offset = 0;
+	else
+		handle->reserve_offset = users[0].offset;
+	*data = (unsigned char*)(handle->base_addr + handle->reserve_offset);
+	cmtx_leave(handle->mtx);
+	return 0;
+}
+
+static int shm_stream_commit_frame(shm_stream_t* handle, frame_info* info, const NALU_index_t* nalus, unsigned int nalu_count)
+{
+	if(handle == NULL) return -1;
+	if(handle->reserve_length == 0 || info->length > handle->reserve_length){
+		SC_LOGE("[%s] commit length %u without reserve or bigger than reserved %u.",
+			handle->name, info->length, handle->reserve_length);
+		return -1;
+	}
+	handle->reserve_length = 0;
+
+	if(handle->mode == SHM_STREAM_WRITE_SPMC){
+		shm_stream_spmc_publish(handle, info, info->length, nalus, nalu_count);
+		shm_stream_notify_readers(handle);
+		return 0;
+	}
+
 	cmtx_enter(handle->mtx);
 	unsigned int head;
 	shm_user_t* users = (shm_user_t*)handle->user_array;
@@ -209,12 +669,13 @@ int shm_stream_put(shm_stream_t* handle, frame_info info, unsigned char* data, u
 
 	pthread_rwlock_wrlock(&s_shm_rwlock);
 	head = users[0].index % handle->max_frames;
-	memcpy(&infos[head].info, &info, sizeof(frame_info));
-	infos[head].lenght = length;
-	if(length + users[0].offset > handle->size){ 	//数据存储区不够存储了， 从头存储
-
-		infos[head].offset = 0;
-		users[0].offset = 0;
+	memcpy(&infos[head].info, info, sizeof(frame_info));
+	infos[head].lenght = info->length;
+	infos[head].offset = handle->reserve_offset;
+	infos[head].nalu_count = nalu_count;
+	if(nalu_count > 0)
+		memcpy(infos[head].nalus, nalus, nalu_count * sizeof(NALU_index_t));
+	if(handle->reserve_offset != users[0].offset){ 	//数据存储区不够存储了， 从头存储
 		if(handle->info_count < handle->max_frames){
 			SC_LOGW("[%s] writer:%s data region is overflow, info max count is %d, current info index is %d, count is %d.",
 				handle->name, users[0].id, handle->max_frames, head, handle->info_count);
@@ -224,13 +685,9 @@ int shm_stream_put(shm_stream_t* handle, frame_info info, unsigned char* data, u
 		}
 		handle->info_count = 0;
 	}
-	else{
-		infos[head].offset = users[0].offset;
-	}
-	char* dst_data_addr = handle->base_addr+infos[head].offset;
 
 	//生产者下次操作的位置
-	users[0].offset += length;
+	users[0].offset = handle->reserve_offset + info->length;
 	users[0].index = (users[0].index + 1 ) % handle->max_frames;
 
 	//检测：消费者正在读取的数据区是否被生产者覆盖掉
@@ -269,7 +726,7 @@ int shm_stream_put(shm_stream_t* handle, frame_info info, unsigned char* data, u
 		1. 写的过程中，被读走(读线程已经饥饿很久了，马上拷贝数据，但是数据正在拷贝的过程中)
 			a. 触发场景：数据发送快的情况，很快发送完了，等待Info更
 			b. 是否频繁：正常情况也会发生，比较频繁
-			c. 如何处理：加锁，避免发生
+			c. 如何处理：数据在 reserve 之后、commit 更新下标之前写入，读端在此之前看不到该帧，不需要加锁
 
 		2. 读的过程中，被写覆盖 ：
 			a. 触发场景：数据发送不过来，整个FIFO存满了数据， 新数据覆盖旧数据
@@ -278,17 +735,124 @@ int shm_stream_put(shm_stream_t* handle, frame_info info, unsigned char* data, u
 				是否需要加锁：没必要 （代码改动大，且意义不大, 增加日志）
 				处理方法：增加打印信息
 	*/
-	memcpy(dst_data_addr, data, length);
 	handle->info_count++;
 	pthread_rwlock_unlock(&s_shm_rwlock);
 
 	cmtx_leave(handle->mtx);
+	shm_stream_notify_readers(handle);
 	return 0;
 }
 
+/**
+ * 发布 shm_stream_reserve 预留的帧，info.length 为实际写入长度，不能超过预留长度
+*/
+int shm_stream_commit(shm_stream_t* handle, frame_info info)
+{
+	return shm_stream_commit_frame(handle, &info, NULL, 0);
+}
+
+int shm_stream_put(shm_stream_t* handle, frame_info info, unsigned char* data, unsigned int length)
+{
+	unsigned char* dst_data_addr = NULL;
+
+	if(shm_stream_reserve(handle, length, &dst_data_addr) != 0)
+		return -1;
+	memcpy(dst_data_addr, data, length);
+	info.length = length;
+	return shm_stream_commit_frame(handle, &info, NULL, 0);
+}
+
+/**
+ * 写入一帧 H264/H265 Annex-B 码流，同时把 NALU 索引保存到 info 中
+ * 写端只解析一次，所有读端通过 shm_stream_front_nalu 直接使用，不需要各自再解析
+*/
+int shm_stream_put_annexb(shm_stream_t* handle, frame_info info, unsigned char* data, unsigned int length, int is_h265)
+{
+	NALU_index_t nalus[SHM_STREAM_NALU_MAX + 1];
+	unsigned char* dst_data_addr = NULL;
+	int nalu_count;
+
+	if(shm_stream_reserve(handle, length, &dst_data_addr) != 0)
+		return -1;
+	memcpy(dst_data_addr, data, length);
+
+	// NALU 个数超过 SHM_STREAM_NALU_MAX 时不保存索引，由读端自行解析
+	nalu_count = get_annexb_nalu_index(data, length, nalus, SHM_STREAM_NALU_MAX + 1, is_h265);
+	if(nalu_count < 0 || nalu_count > SHM_STREAM_NALU_MAX)
+		nalu_count = 0;
+	info.length = length;
+	return shm_stream_commit_frame(handle, &info, nalus, nalu_count);
+}
+
+static int shm_stream_put_external_frame(shm_stream_t* handle, frame_info* info, unsigned char* data, unsigned int length,
+	shm_stream_buffer_release release, void* opaque, const NALU_index_t* nalus, unsigned int nalu_count)
+{
+	if(handle == NULL || data == NULL) return -1;
+	if(handle->mode != SHM_STREAM_WRITE_SPMC || handle->type != SHM_STREAM_MALLOC){
+		SC_LOGE("[%s] external buffer only support spmc malloc stream.", handle->name);
+		return -1;
+	}
+
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	unsigned int readers = (unsigned int)shm_stream_readers(handle);
+	shm_info_t* slot;
+	unsigned int seq;
+	if(readers == 0)
+		return -1;
+
+	slot = shm_stream_spmc_next_slot(handle);
+	if(slot == NULL)
+		return -1;
+	seq = users[0].index;
+
+	slot->ext_data = data;
+	slot->ext_release = release;
+	slot->ext_opaque = opaque;
+	__atomic_store_n(&slot->ext_ref, ((unsigned long long)(seq + 1) << 32) | readers, __ATOMIC_RELEASE);
+
+	handle->reserve_offset = 0;
+	handle->reserve_pos = 0;
+	info->length = length;
+	shm_stream_spmc_publish(handle, info, length, nalus, nalu_count);
+	shm_stream_notify_readers(handle);
+	return 0;
+}
+
+/**
+ * 发布一个由外部(如编码器)持有的缓冲区，不拷贝数据
+ * 1. 只支持 SHM_STREAM_WRITE_SPMC + SHM_STREAM_MALLOC，指针只在本进程有效
+ * 2. 返回 0 表示缓冲区已交给 stream_manager，最后一个读端 post(或写端复用该 info、写端销毁)时调用 release 归还，
+ *    读端正在使用时写端不会归还；返回 -1 表示没有读用户、不支持或 info 都被读端占用，缓冲区仍由调用者负责归还
+ * 3. release 在读端线程或写端线程里调用，不能阻塞
+*/
+int shm_stream_put_external(shm_stream_t* handle, frame_info info, unsigned char* data, unsigned int length,
+	shm_stream_buffer_release release, void* opaque)
+{
+	return shm_stream_put_external_frame(handle, &info, data, length, release, opaque, NULL, 0);
+}
+
+// 与 shm_stream_put_external 相同，同时保存 H264/H265 Annex-B 码流的 NALU 索引，见 shm_stream_put_annexb
+int shm_stream_put_external_annexb(shm_stream_t* handle, frame_info info, unsigned char* data, unsigned int length,
+	int is_h265, shm_stream_buffer_release release, void* opaque)
+{
+	NALU_index_t nalus[SHM_STREAM_NALU_MAX + 1];
+	int nalu_count;
+
+	if(handle == NULL || data == NULL) return -1;
+	if(shm_stream_readers(handle) == 0)
+		return -1;
+
+	nalu_count = get_annexb_nalu_index(data, length, nalus, SHM_STREAM_NALU_MAX + 1, is_h265);
+	if(nalu_count < 0 || nalu_count > SHM_STREAM_NALU_MAX)
+		nalu_count = 0;
+	return shm_stream_put_external_frame(handle, &info, data, length, release, opaque, nalus, nalu_count);
+}
+
 int shm_stream_get(shm_stream_t* handle, frame_info* info, unsigned char** data, unsigned int* length)
 {
 	if(handle == NULL) return -1;
+	if(shm_stream_is_spmc(handle))
+		return shm_stream_spmc_read(handle, info, data, length, 1, NULL);
 
 	unsigned int tail, head;
 
@@ -321,9 +885,12 @@ int shm_stream_get(shm_stream_t* handle, frame_info* info, unsigned char** data,
 	}
 }
 
-int shm_stream_front(shm_stream_t* handle, frame_info* info, unsigned char** data, unsigned int* length)
+static int shm_stream_front_frame(shm_stream_t* handle, frame_info* info, unsigned char** data, unsigned int* length,
+	shm_nalu_iter_t* iter)
 {
 	if(handle == NULL) return -1;
+	if(shm_stream_is_spmc(handle))
+		return shm_stream_spmc_read(handle, info, data, length, 0, iter);
 
 	unsigned int tail, head;
 
@@ -341,6 +908,8 @@ int shm_stream_front(shm_stream_t* handle, frame_info* info, unsigned char** dat
 		*data = (unsigned char*)(handle->base_addr + infos[tail].offset);
 		/*SC_LOGI("handle->base_addr: %p, infos[tail].offset: %d", handle->base_addr, infos[tail].offset);*/
 		*length = infos[tail].lenght;
+		if(iter != NULL)
+			shm_stream_nalu_load(&infos[tail], *data, *length, iter);
 
 		infos[tail].access_status = DATA_ACCESS_STATUS_ACCESSING;
 		pthread_rwlock_unlock(&s_shm_rwlock);
@@ -358,6 +927,40 @@ int shm_stream_front(shm_stream_t* handle, frame_info* info, unsigned char** dat
 	return 0;
 }
 
+int shm_stream_front(shm_stream_t* handle, frame_info* info, unsigned char** data, unsigned int* length)
+{
+	return shm_stream_front_frame(handle, info, data, length, NULL);
+}
+
+/**
+ * 与 shm_stream_front 相同，同时把当前帧的 NALU 索引装入 iter，之后用 shm_stream_next_nalu 遍历
+ * 1. 写端通过 shm_stream_put_annexb 写入时直接使用写端的索引，否则在这里解析一次
+ * 2. 当前帧没遍历完时再次调用不会重置遍历位置，遍历完后 shm_stream_post 释放该帧
+ * 3. iter->count 为 0 表示该帧不是 Annex-B 码流
+*/
+int shm_stream_front_nalu(shm_stream_t* handle, frame_info* info, unsigned char** data, unsigned int* length,
+	shm_nalu_iter_t* iter, int is_h265)
+{
+	if(iter == NULL) return -1;
+	if(shm_stream_front_frame(handle, info, data, length, iter) != 0)
+		return -1;
+
+	if(iter->pos == 0 && iter->count == 0){
+		iter->count = get_annexb_nalu_index(*data, *length, iter->nalus, NALU_INDEX_MAX_COUNT, is_h265);
+		if(iter->count < 0)
+			iter->count = 0;
+	}
+	return 0;
+}
+
+// 返回当前帧的下一个 NALU，遍历完返回 NULL
+NALU_index_t* shm_stream_next_nalu(shm_nalu_iter_t* iter)
+{
+	if(iter == NULL || iter->pos >= iter->count)
+		return NULL;
+	return &iter->nalus[iter->pos++];
+}
+
 /*
 	1. 关于读写下标更新，实际能存储数据包的最大个数 < handle->max_frames 的情况分析：
 		a. 问题：是否会出现 读者 访问 如下区间的数据： [实际存储数据包最大个数 , handle->max_frames]
@@ -373,6 +976,8 @@ int shm_stream_front(shm_stream_t* handle, frame_info* info, unsigned char** dat
 int shm_stream_post(shm_stream_t* handle)
 {
 	if(handle == NULL) return -1;
+	if(shm_stream_is_spmc(handle))
+		return shm_stream_spmc_post(handle);
 
 	unsigned int tail, head;
 
@@ -396,6 +1001,26 @@ int shm_stream_post(shm_stream_t* handle)
 	return 0;
 }
 
+/**
+ * 返回 1 表示 shm_stream_front 取得、还没有 post 的帧仍然有效，0 表示已经被写端覆盖
+ * 1. 无锁模式下写端不会等待读端，读端在 post 之前分多次使用数据时，每次使用前都要检查
+ * 2. 外部缓冲区帧在 post 之前写端不会归还，始终有效
+ * 3. 加锁模式下写端覆盖时只打印警告，这里无法判断，返回 1
+*/
+int shm_stream_front_valid(shm_stream_t* handle)
+{
+	if(handle == NULL) return 0;
+	if(!shm_stream_is_spmc(handle))
+		return 1;
+
+	shm_user_t* users = (shm_user_t*)handle->user_array;
+	unsigned int tail = __atomic_load_n(&users[handle->index].index, __ATOMIC_RELAXED);
+
+	if(handle->holding && handle->hold_seq == tail && handle->hold_pinned)
+		return 1;
+	return shm_stream_spmc_valid(handle, &((shm_info_t*)handle->info_array)[tail % handle->max_frames], tail);
+}
+
 int shm_stream_sync(shm_stream_t* handle)
 {
 	if(handle == NULL) return -1;
@@ -403,6 +1028,16 @@ int shm_stream_sync(shm_stream_t* handle)
 	unsigned int tail, head;
 	shm_user_t *user;
 
+	if(shm_stream_is_spmc(handle)){
+		user = (shm_user_t*)handle->user_array;
+		head = __atomic_load_n(&user[0].index, __ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&user[handle->index].index, __ATOMIC_RELAXED);
+		__atomic_store_n(&user[handle->index].index, head, __ATOMIC_RELEASE);
+		shm_stream_spmc_unref_range(handle, tail, head);
+		shm_stream_spmc_release_hold(handle);
+		return 0;
+	}
+
 	cmtx_enter(handle->mtx);
 	user = (shm_user_t*)handle->user_array;
 	head = user[0].index % handle->max_frames;
@@ -421,12 +1056,17 @@ int shm_stream_remains(shm_stream_t* handle)
 	if(handle == NULL) return -1;
 
     int ret;
-	cmtx_enter(handle->mtx);
-
 	unsigned int tail, head;
 	shm_user_t *user;
 
 	user = (shm_user_t*)handle->user_array;
+	if(shm_stream_is_spmc(handle)){
+		head = __atomic_load_n(&user[0].index, __ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&user[handle->index].index, __ATOMIC_RELAXED);
+		return (head - tail) < handle->max_frames ? (int)(head - tail) : (int)(handle->max_frames - 1);
+	}
+
+	cmtx_enter(handle->mtx);
 	head = user[0].index % handle->max_frames;
 	tail = user[handle->index].index % handle->max_frames;
 
@@ -442,9 +1082,11 @@ int shm_stream_readers(shm_stream_t* handle)
 	if(handle == NULL) return -1;
 
 	int ret;
-	cmtx_enter(handle->mtx);
-
 	shm_user_t* user = (shm_user_t*)handle->user_array;
+	if(shm_stream_is_spmc(handle))
+		return (int)__atomic_load_n(&user[0].users, __ATOMIC_RELAXED);
+
+	cmtx_enter(handle->mtx);
 	ret = user[0].users;
 
 	cmtx_leave(handle->mtx);
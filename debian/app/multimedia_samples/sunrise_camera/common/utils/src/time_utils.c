@@ -11,22 +11,12 @@ uint64_t get_timestamp_ms() {
     return timestamp;
 }
 
-void time_statistics_at_beginning_of_loop(struct TimeStatistics *statistics){
-    statistics->start_ms = get_timestamp_ms();
-    statistics->loop_period_ms = statistics->start_ms - statistics->last_ms;
-    statistics->last_ms = statistics->start_ms;
-}
-void time_statistics_at_ending_of_loop(struct TimeStatistics *statistics){
-    statistics->end_ms = get_timestamp_ms();
-}
-void time_statistics_info_show(struct TimeStatistics *statistics, const char *tag, bool is_open){
-    if(!is_open)
-        return;
+uint64_t get_monotonic_ns() {
 
-    int64_t period_ms = statistics->loop_period_ms;
-    int64_t consume_ms = statistics->end_ms - statistics->start_ms;
+    struct timespec ts;
 
-    SC_LOGI("[%s] period %lldms consume %lldms.", tag, period_ms, consume_ms);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
 }
 
 void get_world_time_string(char *time_buffer, int time_buffer_size){
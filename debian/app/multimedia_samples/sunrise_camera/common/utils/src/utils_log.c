@@ -1,3 +1,4 @@
+
 /**************************************************************************
  * 	FileName:		gos_log.c
  *	Description:	日志
@@ -11,11 +12,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <time.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
 #include <unistd.h>
 #include <pthread.h>
 
@@ -24,12 +35,89 @@
 extern "C"{
 #endif
 
-static char s_log_buffer[MAX_LOG_BUFSIZE] = {0};
-static pthread_mutex_t s_buffer_mtx = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * 异步日志:
+ * 1. 每个线程第一次打印时分配一个单生产者单消费者的环形缓冲区，log_ctrl_print 只在本线程的
+ *    缓冲区里格式化消息，不加锁、不做文件 IO，缓冲区满时丢弃并计数
+ * 2. 后台写线程按时间戳合并所有线程的消息，时间前缀按秒缓存，每批用 writev 一次写出
+ * 3. 日志文件超过 MAX_LOG_FILESIZE 时 rename 成 .bak 再新建，不再复制文件内容
+ * 4. 写线程没有启动或者缓冲区分配失败时退回到同步打印
+ * 5. 记录里保存 ctrl 的指针和序号，ctrl 销毁后还没写出的记录只打印到标准输出
+ * 6. 线程退出后缓冲区留给新线程复用，不释放，崩溃处理时不加锁也能安全地遍历所有缓冲区
+ */
+#define LOG_RING_SIZE		(16 * 1024)		// 每个线程的缓冲区大小，必须是 2 的幂
+#define LOG_RING_MAX		256				// 最多同时存在的线程缓冲区个数
+#define LOG_BATCH_MAX		64				// 每次 writev 最多写出的消息条数
+#define LOG_IDLE_WAIT_MS	100
+#define LOG_RECORD_PAD		0xff			// 缓冲区尾部放不下一条消息时的填充记录
+#define LOG_CTRL_MAX		16				// 最多同时存在的日志文件个数
+#ifndef IOV_MAX
+#define IOV_MAX				1024
+#endif
+
+typedef struct
+{
+	uint32_t	len;		// 整条记录的长度(包括记录头)，8 字节对齐
+	uint8_t		level;
+	uint8_t		reserved[3];
+	uint64_t	ts_us;		// gettimeofday 的时间
+	log_ctrl*	ctrl;		// 输出到哪个日志文件，NULL 表示只打印到标准输出
+	uint32_t	msg_len;	// 消息长度，包括末尾的换行符
+	uint32_t	ctrl_id;	// ctrl 的序号，ctrl 已经销毁(或者地址被新的 ctrl 复用)时不写文件
+}log_record;
+
+typedef struct
+{
+	uint32_t	head;		// 写线程读到的位置，单调递增，不取模
+	uint32_t	tail;		// 生产者写到的位置
+	uint32_t	dropped;	// 缓冲区满丢弃的消息数，写线程读出后清零
+	int			orphan;		// 所属线程已经退出，取完数据后可以给新线程复用
+	pid_t		tid;
+	char		data[LOG_RING_SIZE] __attribute__((aligned(8)));	// 记录头按 8 字节访问
+}log_ring;
+
+typedef struct
+{
+	log_record*	rec;
+	log_ring*	ring;
+	log_ctrl*	ctrl;		// 还存在的 ctrl，已经销毁时为 NULL
+	uint32_t	end;		// 记录结束的位置，写出之后 head 移到这里
+	char		prefix[32];	// "YYYY/MM/DD HH:MM:SS.mmm LEVEL "
+	int			prefix_len;
+}log_batch_item;
 
 static log_ctrl* s_log_ctrl = NULL;
 static int s_log_level = LOG_INFO;
 
+static pthread_once_t s_log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_ring_key;
+static __thread log_ring* s_thread_ring = NULL;
+static pthread_mutex_t s_rings_mtx = PTHREAD_MUTEX_INITIALIZER;	// 保护 s_rings，只在分配缓冲区时使用
+static log_ring* s_rings[LOG_RING_MAX];	// 只增加不删除，s_ring_count 之前的元素都有效
+static int s_ring_count = 0;
+static pthread_mutex_t s_drain_mtx = PTHREAD_MUTEX_INITIALIZER;	// 写线程和 log_ctrl_flush 互斥，同时保护 s_ctrls
+static log_ctrl* s_ctrls[LOG_CTRL_MAX];	// 还没有销毁的 ctrl
+static unsigned int s_ctrl_serial = 0;
+static int s_crash_flushing = 0;		// 崩溃处理已经开始写出，写线程不再取数据
+static int s_wake_fd = -1;
+static int s_writer_idle = 0;
+static int s_writer_running = 0;
+static uint64_t s_total_dropped = 0;
+
+// 时间前缀按秒缓存
+static time_t s_cached_sec = -1;
+static char s_cached_time[24];
+
+static const char* log_level_color(int level)
+{
+	return level==LOG_TRACE? "":(level==LOG_DEBUG? LIGHT_GREEN:(level==LOG_INFO? LIGHT_CYAN:(level==LOG_WARN?YELLOW:LIGHT_RED)));
+}
+
+static const char* log_level_name(int level)
+{
+	return level==LOG_TRACE? "TRACE":(level==LOG_DEBUG? "DEBUG":(level==LOG_INFO? "!INFO":(level==LOG_WARN? "!WARN":"ERROR")));
+}
+
 log_ctrl* log_ctrl_instance_create(char* file, int level, int wt)
 {
 	if(s_log_ctrl == NULL)
@@ -40,10 +128,51 @@ log_ctrl* log_ctrl_instance_create(char* file, int level, int wt)
 	return s_log_ctrl;
 }
 
+// 在 s_ctrls 里登记，调用前需要持有 s_drain_mtx
+static int log_ctrl_register(log_ctrl* log)
+{
+	int i;
+
+	for(i = 0; i < LOG_CTRL_MAX; i++)
+	{
+		if(s_ctrls[i] == NULL)
+		{
+			log->id = ++s_ctrl_serial;
+			s_ctrls[i] = log;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// ctrl 还没有销毁时返回 1，调用前需要持有 s_drain_mtx
+static int log_ctrl_alive(log_ctrl* log)
+{
+	int i;
+
+	for(i = 0; log != NULL && i < LOG_CTRL_MAX; i++)
+	{
+		if(s_ctrls[i] == log)
+			return 1;
+	}
+	return 0;
+}
+
+// 记录对应的 ctrl，已经销毁时返回 NULL，调用前需要持有 s_drain_mtx
+static log_ctrl* log_record_ctrl(log_record* rec)
+{
+	if(!log_ctrl_alive(rec->ctrl) || rec->ctrl->id != rec->ctrl_id)
+		return NULL;
+	return rec->ctrl;
+}
+
 log_ctrl* log_ctrl_create(char* file, int level, int wt)
 {
 	log_ctrl* log = (log_ctrl*)malloc(sizeof(log_ctrl));
+	struct stat statbuff;
 
+	if(log == NULL)
+		return NULL;
 	log->fd = fopen(file, "a");
 	if(log->fd == NULL)
 	{
@@ -55,14 +184,47 @@ log_ctrl* log_ctrl_create(char* file, int level, int wt)
 	strcpy(log->file, file);
 	log->level = level;
 	log->wt = wt;
+	log->size = 0;
+	if(fstat(fileno(log->fd), &statbuff) >= 0)
+		log->size = statbuff.st_size;
+
+	pthread_mutex_lock(&s_drain_mtx);
+	if(log_ctrl_register(log) != 0)
+	{
+		pthread_mutex_unlock(&s_drain_mtx);
+		fclose(log->fd);
+		free(log);
+		printf("log_ctrl_create error, more than %d log files\n", LOG_CTRL_MAX);
+		return NULL;
+	}
+	pthread_mutex_unlock(&s_drain_mtx);
 
 	return log;
 }
 
 void log_ctrl_destory(log_ctrl* log)
 {
+	int i;
+
+	if(log == NULL)
+		return;
+	// 之后打印的消息不再使用这个 ctrl
+	if(__atomic_load_n(&s_log_ctrl, __ATOMIC_ACQUIRE) == log)
+		__atomic_store_n(&s_log_ctrl, NULL, __ATOMIC_SEQ_CST);
+	// 缓冲区里可能还有写到这个文件的消息
+	log_ctrl_flush();
+
+	// 在写线程的锁里注销，之后才取出的记录找不到这个 ctrl，只打印到标准输出
+	pthread_mutex_lock(&s_drain_mtx);
+	for(i = 0; i < LOG_CTRL_MAX; i++)
+	{
+		if(s_ctrls[i] == log)
+			s_ctrls[i] = NULL;
+	}
 	if(log->fd != NULL)
 		fclose(log->fd);
+	log->fd = NULL;
+	pthread_mutex_unlock(&s_drain_mtx);
 
 	free(log);
 }
@@ -107,165 +269,587 @@ int  log_ctrl_wt_set(log_ctrl* log,int wt)
 	return 0;
 }
 
-int log_ctrl_file_copy(log_ctrl* log)
+static int log_writev_all(int fd, struct iovec* iov, int cnt)
+{
+	while(cnt > 0)
+	{
+		ssize_t n = writev(fd, iov, cnt > IOV_MAX ? IOV_MAX : cnt);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		while(cnt > 0 && (size_t)n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if(cnt > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+// 文件超过 MAX_LOG_FILESIZE 时改名成 .bak，重新创建日志文件
+static void log_ctrl_file_rotate(log_ctrl* log)
 {
-	char buff[1024];
-	int len;
-	FILE *in,*out;
 	char bak[128] = {0};
 
+	if(log->size <= MAX_LOG_FILESIZE)
+		return;
+
+	if(log->fd != NULL)
+		fclose(log->fd);
 	snprintf(bak, sizeof(bak), "%.123s.bak", log->file);
-	in = fopen(log->file,"r+");
-	if(in == NULL)
-		return -1;
+	rename(log->file, bak);
+	log->fd = fopen(log->file, "a");
+	log->size = 0;
+}
 
-	out = fopen(bak,"w+");
-	if(out == NULL)
-	{
-		fclose(in);
-		return -1;
-	}
+static int log_ctrl_file_writev(log_ctrl* log, struct iovec* iov, int cnt)
+{
+	int i;
 
-	while((len = fread(buff,1,sizeof(buff),in)) != 0)
-	{
-		fwrite(buff,1,len,out);
-	}
+	if(log->fd == NULL)
+		log->fd = fopen(log->file, "a");
+	if(log->fd == NULL)
+		return -1;
 
-	fclose(out);
-	fclose(in);
+	for(i = 0; i < cnt; i++)
+		log->size += iov[i].iov_len;
+	if(log_writev_all(fileno(log->fd), iov, cnt) != 0)
+		return -1;
 
+	log_ctrl_file_rotate(log);
 	return 0;
 }
 
 int log_ctrl_file_write(log_ctrl* log, char* data, int len)
 {
+	struct iovec iov;
+
 	if(log == NULL)
-	{
 		return -1;
+
+	iov.iov_base = data;
+	iov.iov_len = len;
+	return log_ctrl_file_writev(log, &iov, 1);
+}
+
+static int log_format_prefix(char* buf, int size, uint64_t ts_us, int level)
+{
+	time_t sec = (time_t)(ts_us / 1000000);
+
+	if(sec != s_cached_sec)
+	{
+		struct tm tm;
+		localtime_r(&sec, &tm);
+		strftime(s_cached_time, sizeof(s_cached_time), "%Y/%m/%d %H:%M:%S", &tm);
+		s_cached_sec = sec;
 	}
-	else if(log->fd == NULL)
+	return snprintf(buf, size, "%s.%03d %s ", s_cached_time, (int)(ts_us % 1000000 / 1000),
+		log_level_name(level));
+}
+
+// 从 pos 开始取下一条记录，跳过缓冲区尾部的填充记录，没有数据时返回 NULL
+static log_record* log_ring_peek(log_ring* ring, uint32_t* pos)
+{
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	while(*pos != tail)
 	{
-		log->fd = fopen(log->file, "a+");
+		log_record* rec = (log_record*)&ring->data[*pos & (LOG_RING_SIZE - 1)];
+		if(rec->level != LOG_RECORD_PAD)
+			return rec;
+		*pos += rec->len;
 	}
+	return NULL;
+}
 
-	fwrite(data, 1, len, log->fd);
-	fflush(log->fd);
+static void log_write_batch(log_batch_item* items, int count)
+{
+	static struct iovec iov[LOG_BATCH_MAX * 4];
+	int cnt = 0, i, j;
 
-	//检测文件大小 是否备份刷新
-	int fd = fileno(log->fd);
-	unsigned long filesize = 0;
-	struct stat statbuff;
-	if(fstat(fd, &statbuff) >= 0)
+	for(i = 0; i < count; i++)
 	{
-		filesize = statbuff.st_size;
+		log_record* rec = items[i].rec;
+		iov[cnt].iov_base = (void*)log_level_color(rec->level);
+		iov[cnt++].iov_len = strlen(log_level_color(rec->level));
+		iov[cnt].iov_base = items[i].prefix;
+		iov[cnt++].iov_len = items[i].prefix_len;
+		iov[cnt].iov_base = (char*)(rec + 1);
+		iov[cnt++].iov_len = rec->msg_len;
+		iov[cnt].iov_base = (void*)CNONE;
+		iov[cnt++].iov_len = strlen(CNONE);
 	}
+	log_writev_all(STDOUT_FILENO, iov, cnt);
 
-	if(filesize > MAX_LOG_FILESIZE)
+	// 写文件的消息不带颜色，连续写到同一个文件的消息合并成一次 writev
+	for(i = 0; i < count; i = j)
 	{
-		fclose(log->fd);
-		int ret = log_ctrl_file_copy(log);
-		if(ret == 0)
-			log->fd = fopen(log->file, "w+");
-		else
-			log->fd = fopen(log->file, "a+");
+		log_ctrl* ctrl = items[i].ctrl;
+		cnt = 0;
+		for(j = i; j < count && items[j].ctrl == ctrl; j++)
+		{
+			if(ctrl == NULL || ctrl->wt == 0)
+				continue;
+			iov[cnt].iov_base = items[j].prefix;
+			iov[cnt++].iov_len = items[j].prefix_len;
+			iov[cnt].iov_base = (char*)(items[j].rec + 1);
+			iov[cnt++].iov_len = items[j].rec->msg_len;
+		}
+		if(cnt > 0)
+			log_ctrl_file_writev(ctrl, iov, cnt);
 	}
 
-	return 0;
+	// 写出之后才释放缓冲区空间
+	for(i = 0; i < count; i++)
+		__atomic_store_n(&items[i].ring->head, items[i].end, __ATOMIC_RELEASE);
 }
 
-int  log_ctrl_print(log_ctrl* log, int level, const char* t, ...)
+// 报告缓冲区满丢弃的消息数
+static void log_report_dropped(log_ring** rings, int count)
 {
-	log_ctrl* ctrl = NULL;
-	if(log != NULL)
+	struct timeval v;
+	char line[160];
+	int i, len;
+
+	for(i = 0; i < count; i++)
 	{
-		ctrl = log;
+		uint32_t dropped = __atomic_exchange_n(&rings[i]->dropped, 0, __ATOMIC_RELAXED);
+		if(dropped == 0)
+			continue;
+		s_total_dropped += dropped;
+		gettimeofday(&v, 0);
+		len = log_format_prefix(line, sizeof(line), (uint64_t)v.tv_sec * 1000000 + v.tv_usec, LOG_WARN);
+		len += snprintf(line + len, sizeof(line) - len, "[log] thread %d ring full, dropped %u messages (total %llu)\n",
+			(int)rings[i]->tid, dropped, (unsigned long long)s_total_dropped);
+
+		struct iovec iov[3] = {{(void*)YELLOW, strlen(YELLOW)}, {line, (size_t)len}, {(void*)CNONE, strlen(CNONE)}};
+		log_writev_all(STDOUT_FILENO, iov, 3);
+		if(s_log_ctrl != NULL && s_log_ctrl->wt)
+			log_ctrl_file_write(s_log_ctrl, line, len);
 	}
-	else if(s_log_ctrl != NULL)
+}
+
+// 把所有线程缓冲区里的消息按时间顺序写出，返回写出的条数，调用前需要持有 s_drain_mtx
+static int log_drain(void)
+{
+	// 只在持有 s_drain_mtx 时调用，用静态数组，不占用调用线程的栈
+	static log_ring* rings[LOG_RING_MAX];
+	static log_record* heads[LOG_RING_MAX];
+	static uint32_t pos[LOG_RING_MAX];
+	static log_batch_item items[LOG_BATCH_MAX];
+	int count, i, total = 0, n = 0;
+
+	pthread_mutex_lock(&s_rings_mtx);
+	count = s_ring_count;
+	memcpy(rings, s_rings, sizeof(log_ring*) * count);
+	pthread_mutex_unlock(&s_rings_mtx);
+
+	for(i = 0; i < count; i++)
 	{
-		ctrl = s_log_ctrl;
+		pos[i] = rings[i]->head;
+		heads[i] = log_ring_peek(rings[i], &pos[i]);
 	}
 
-	if(ctrl != NULL)
+	for(;;)
 	{
-		if(level <= ctrl->level)
+		int min = -1;
+		for(i = 0; i < count; i++)
+		{
+			if(heads[i] != NULL && (min < 0 || heads[i]->ts_us < heads[min]->ts_us))
+				min = i;
+		}
+
+		if(min >= 0)
 		{
-			if(ctrl->wt == 0)
+			log_record* rec = heads[min];
+			pos[min] += rec->len;
+			items[n].rec = rec;
+			items[n].ring = rings[min];
+			items[n].ctrl = log_record_ctrl(rec);
+			items[n].end = pos[min];
+			items[n].prefix_len = log_format_prefix(items[n].prefix, sizeof(items[n].prefix),
+				rec->ts_us, rec->level);
+			n++;
+			heads[min] = log_ring_peek(rings[min], &pos[min]);
+		}
+
+		if(n > 0 && (n == LOG_BATCH_MAX || min < 0))
+		{
+			log_write_batch(items, n);
+			total += n;
+			n = 0;
+		}
+		if(min < 0)
+			break;
+	}
+
+	log_report_dropped(rings, count);
+
+	return total;
+}
+
+static int log_rings_empty(void)
+{
+	int i, empty = 1;
+
+	pthread_mutex_lock(&s_rings_mtx);
+	for(i = 0; i < s_ring_count && empty; i++)
+		empty = s_rings[i]->head == __atomic_load_n(&s_rings[i]->tail, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&s_rings_mtx);
+
+	return empty;
+}
+
+static void* log_writer_proc(void* arg)
+{
+	struct pollfd pfd;
+	uint64_t value;
+	sigset_t set;
+	int n;
+
+	(void)arg;
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	prctl(PR_SET_NAME, "log_writer");
+
+	pfd.fd = s_wake_fd;
+	pfd.events = POLLIN;
+	for(;;)
+	{
+		// 崩溃处理正在不加锁地写出，不能再同时取数据
+		if(__atomic_load_n(&s_crash_flushing, __ATOMIC_SEQ_CST))
+		{
+			poll(NULL, 0, LOG_IDLE_WAIT_MS);
+			continue;
+		}
+		pthread_mutex_lock(&s_drain_mtx);
+		n = log_drain();
+		pthread_mutex_unlock(&s_drain_mtx);
+		if(n > 0)
+			continue;
+
+		// 先标记空闲再检查一次，避免生产者在标记之前写入后没有唤醒
+		__atomic_store_n(&s_writer_idle, 1, __ATOMIC_SEQ_CST);
+		if(log_rings_empty())
+		{
+			if(poll(&pfd, 1, LOG_IDLE_WAIT_MS) > 0)
 			{
-				struct timeval v;
-				gettimeofday(&v, 0);
-				struct tm *p = localtime(&v.tv_sec);
-				char fmt[256] = {0}; //限制t不能太大
-				sprintf(fmt, "%s%04d/%02d/%02d %02d:%02d:%02d.%03d %s %s\n"CNONE,level==LOG_TRACE? "":(level==LOG_DEBUG? LIGHT_GREEN:(level==LOG_INFO? LIGHT_CYAN:(level==LOG_WARN?YELLOW:LIGHT_RED)))
-						, 1900 + p->tm_year, 1 + p->tm_mon, p->tm_mday, p->tm_hour, p->tm_min, p->tm_sec, (int)(v.tv_usec/1000)
-						, level==LOG_TRACE? "TRACE":(level==LOG_DEBUG? "DEBUG":(level==LOG_INFO? "!INFO":(level==LOG_WARN? "!WARN":"ERROR"))), t);
-
-				va_list params;
-				va_start(params, t);
-				vfprintf(stdout, fmt, params);
-				va_end(params);
-				fflush(stdout);
+				if(read(s_wake_fd, &value, sizeof(value)) < 0)
+					value = 0;
 			}
-			else
-			{
+		}
+		__atomic_store_n(&s_writer_idle, 0, __ATOMIC_SEQ_CST);
+	}
 
-				struct timeval v;
-				gettimeofday(&v, 0);
-				struct tm *p = localtime(&v.tv_sec);
-				char fmt[256] = {0}; //限制t不能太大
-				sprintf(fmt, "%04d/%02d/%02d %02d:%02d:%02d.%03d %s %s\n"
-						, 1900 + p->tm_year, 1 + p->tm_mon, p->tm_mday, p->tm_hour, p->tm_min, p->tm_sec, (int)(v.tv_usec/1000)
-						, level==LOG_TRACE? "TRACE":(level==LOG_DEBUG? "DEBUG":(level==LOG_INFO? "!INFO":(level==LOG_WARN? "!WARN":"ERROR"))), t);
-
-				char fmt0[256] = {0}; //限制t不能太大
-				sprintf(fmt0, "%s%04d/%02d/%02d %02d:%02d:%02d.%03d %s %s\n"CNONE,level==LOG_TRACE? "":(level==LOG_DEBUG? LIGHT_GREEN:(level==LOG_INFO? LIGHT_CYAN:(level==LOG_WARN?YELLOW:LIGHT_RED)))
-						, 1900 + p->tm_year, 1 + p->tm_mon, p->tm_mday, p->tm_hour, p->tm_min, p->tm_sec, (int)(v.tv_usec/1000)
-						, level==LOG_TRACE? "TRACE":(level==LOG_DEBUG? "DEBUG":(level==LOG_INFO? "!INFO":(level==LOG_WARN? "!WARN":"ERROR"))), t);
-
-				//这里需要上锁
-				va_list params;
-				va_start(params, t);
-
-				pthread_mutex_lock(&s_buffer_mtx);
-				memset(s_log_buffer, 0, MAX_LOG_BUFSIZE);
-				vsnprintf(s_log_buffer, MAX_LOG_BUFSIZE, fmt, params);
-				log_ctrl_file_write(ctrl, s_log_buffer, strlen(s_log_buffer));
-				pthread_mutex_unlock(&s_buffer_mtx);
-
-				va_end(params);
-
-				va_list params0;
-				va_start(params0, t);
-				vfprintf(stdout, fmt0, params0);
-				va_end(params0);
-				fflush(stdout);
-			}
+	return NULL;
+}
+
+static void log_ring_release(void* arg)
+{
+	log_ring* ring = (log_ring*)arg;
+	__atomic_store_n(&ring->orphan, 1, __ATOMIC_RELEASE);
+}
+
+static void log_atexit(void)
+{
+	log_ctrl_flush();
+}
+
+static void log_init_once(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	if(pthread_key_create(&s_ring_key, log_ring_release) != 0)
+		return;
+	s_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(s_wake_fd < 0)
+		return;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if(pthread_create(&thread, &attr, log_writer_proc, NULL) == 0)
+	{
+		s_writer_running = 1;
+		atexit(log_atexit);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+// 本线程的缓冲区，第一次调用时分配，返回 NULL 表示需要同步打印
+static log_ring* log_ring_get(void)
+{
+	static __thread int s_thread_sync = 0;
+	log_ring* ring = s_thread_ring;
+	int i;
+
+	if(ring != NULL || s_thread_sync)
+		return ring;
+
+	pthread_once(&s_log_once, log_init_once);
+	s_thread_sync = 1;
+	if(!s_writer_running)
+		return NULL;
+
+	// 优先复用已经退出的线程留下的、数据已经写出的缓冲区
+	pthread_mutex_lock(&s_rings_mtx);
+	for(i = 0; i < s_ring_count; i++)
+	{
+		if(__atomic_load_n(&s_rings[i]->orphan, __ATOMIC_ACQUIRE)
+			&& __atomic_load_n(&s_rings[i]->head, __ATOMIC_ACQUIRE) == s_rings[i]->tail)
+		{
+			ring = s_rings[i];
+			break;
 		}
 	}
-	else
+	if(ring == NULL && s_ring_count < LOG_RING_MAX)
 	{
-		if(level <= s_log_level)
+		ring = (log_ring*)calloc(1, sizeof(log_ring));
+		if(ring != NULL)
 		{
-			struct timeval v;
-			gettimeofday(&v, 0);
-			struct tm *p = localtime(&v.tv_sec);
-			char fmt[256] = {0}; //限制t不能太大
-			sprintf(fmt, "%s%04d/%02d/%02d %02d:%02d:%02d.%03d %s %s\n"CNONE,level==LOG_TRACE? "":(level==LOG_DEBUG? LIGHT_GREEN:(level==LOG_INFO? LIGHT_CYAN:(level==LOG_WARN?YELLOW:LIGHT_RED)))
-					, 1900 + p->tm_year, 1 + p->tm_mon, p->tm_mday, p->tm_hour, p->tm_min, p->tm_sec, (int)(v.tv_usec/1000)
-					, level==LOG_TRACE? "TRACE":(level==LOG_DEBUG? "DEBUG":(level==LOG_INFO? "!INFO":(level==LOG_WARN? "!WARN":"ERROR"))), t);
-
-			va_list params;
-			va_start(params, t);
-			vfprintf(stdout, fmt, params);
-			va_end(params);
-			fflush(stdout);
+			s_rings[s_ring_count] = ring;
+			__atomic_store_n(&s_ring_count, s_ring_count + 1, __ATOMIC_RELEASE);
 		}
+	}
+	if(ring != NULL)
+	{
+		ring->tid = (pid_t)syscall(SYS_gettid);
+		__atomic_store_n(&ring->orphan, 0, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&s_rings_mtx);
+	if(ring == NULL)
+		return NULL;
 
-		return 0;
+	pthread_setspecific(s_ring_key, ring);
+	s_thread_ring = ring;
+	return ring;
+}
+
+static int log_format_message(char* msg, const char* t, va_list params)
+{
+	int len = vsnprintf(msg, MAX_LOG_BUFSIZE - 1, t, params);
+	if(len < 0)
+		return -1;
+	if(len > MAX_LOG_BUFSIZE - 2)
+		len = MAX_LOG_BUFSIZE - 2;
+	msg[len++] = '\n';
+	return len;
+}
+
+static void log_ring_put(log_ring* ring, log_ctrl* ctrl, int level, const char* t, va_list params)
+{
+	char msg[MAX_LOG_BUFSIZE];
+	struct timeval v;
+	log_record* rec;
+	int len = log_format_message(msg, t, params);
+	uint32_t rec_len, tail, head, off, pad = 0;
+
+	if(len < 0)
+		return;
+	gettimeofday(&v, 0);
+
+	rec_len = (sizeof(log_record) + len + 7) & ~7u;
+	tail = ring->tail;
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	off = tail & (LOG_RING_SIZE - 1);
+	if(off + rec_len > LOG_RING_SIZE)
+		pad = LOG_RING_SIZE - off;
+	if(tail + pad + rec_len - head > LOG_RING_SIZE)
+	{
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if(pad)
+	{
+		rec = (log_record*)&ring->data[off];
+		rec->len = pad;
+		rec->level = LOG_RECORD_PAD;
+		tail += pad;
+	}
+	rec = (log_record*)&ring->data[tail & (LOG_RING_SIZE - 1)];
+	rec->len = rec_len;
+	rec->level = level;
+	rec->ts_us = (uint64_t)v.tv_sec * 1000000 + v.tv_usec;
+	rec->ctrl = ctrl;
+	rec->ctrl_id = ctrl != NULL ? ctrl->id : 0;
+	rec->msg_len = len;
+	memcpy(rec + 1, msg, len);
+	__atomic_store_n(&ring->tail, tail + rec_len, __ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(&s_writer_idle, __ATOMIC_SEQ_CST))
+	{
+		uint64_t one = 1;
+		if(write(s_wake_fd, &one, sizeof(one)) < 0)
+			return;
+	}
+}
+
+// 写线程不可用时直接打印，和写线程互斥，保证输出不交错
+static void log_print_sync(log_ctrl* ctrl, int level, const char* t, va_list params)
+{
+	char msg[MAX_LOG_BUFSIZE];
+	char prefix[32];
+	struct timeval v;
+	int len = log_format_message(msg, t, params);
+	int prefix_len;
+
+	if(len < 0)
+		return;
+	gettimeofday(&v, 0);
+
+	pthread_mutex_lock(&s_drain_mtx);
+	prefix_len = log_format_prefix(prefix, sizeof(prefix), (uint64_t)v.tv_sec * 1000000 + v.tv_usec, level);
+	struct iovec iov[4] = {
+		{(void*)log_level_color(level), strlen(log_level_color(level))},
+		{prefix, (size_t)prefix_len},
+		{msg, (size_t)len},
+		{(void*)CNONE, strlen(CNONE)}};
+	log_writev_all(STDOUT_FILENO, iov, 4);
+	if(log_ctrl_alive(ctrl) && ctrl->wt)
+		log_ctrl_file_writev(ctrl, &iov[1], 2);
+	pthread_mutex_unlock(&s_drain_mtx);
+}
+
+void log_ctrl_flush(void)
+{
+	pthread_mutex_lock(&s_drain_mtx);
+	while(log_drain() > 0)
+		;
+	pthread_mutex_unlock(&s_drain_mtx);
+}
+
+static int log_crash_append(char* buf, int len, int size, const char* str)
+{
+	while(*str != '\0' && len < size)
+		buf[len++] = *str++;
+	return len;
+}
+
+static int log_crash_append_uint(char* buf, int len, int size, uint64_t value, int width)
+{
+	char digits[24];
+	int n = 0;
+
+	do
+	{
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	}while(value != 0 && n < (int)sizeof(digits));
+	while(n < width && n < (int)sizeof(digits))
+		digits[n++] = '0';
+	while(n > 0 && len < size)
+		buf[len++] = digits[--n];
+	return len;
+}
+
+static void log_crash_write(int fd, const char* buf, int len)
+{
+	ssize_t n;
+
+	while(len > 0)
+	{
+		n = write(fd, buf, len);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return;
+		buf += n;
+		len -= n;
 	}
+}
+
+/**
+ * 崩溃处理里写出缓冲区里的日志，只使用异步信号安全的操作:
+ * 1. 不加锁，缓冲区只增加不释放，不加锁遍历也不会访问到已经释放的内存
+ * 2. 时间前缀直接输出 "秒.毫秒"，不调用 localtime_r
+ * 3. 只写默认日志文件(s_log_ctrl)，其他日志文件的消息只打印到标准输出
+ * 写线程看到 s_crash_flushing 后不再取数据，已经在写的一批可能会重复输出
+ */
+void log_ctrl_crash_flush(void)
+{
+	static log_ring* rings[LOG_RING_MAX];
+	static log_record* heads[LOG_RING_MAX];
+	static uint32_t pos[LOG_RING_MAX];
+	static char line[MAX_LOG_BUFSIZE + 64];
+	log_ctrl* ctrl = __atomic_load_n(&s_log_ctrl, __ATOMIC_ACQUIRE);
+	int count, i, min, len, color_len;
+
+	if(__atomic_exchange_n(&s_crash_flushing, 1, __ATOMIC_SEQ_CST))
+		return;
+
+	count = __atomic_load_n(&s_ring_count, __ATOMIC_ACQUIRE);
+	for(i = 0; i < count; i++)
+	{
+		rings[i] = s_rings[i];
+		pos[i] = __atomic_load_n(&rings[i]->head, __ATOMIC_ACQUIRE);
+		heads[i] = log_ring_peek(rings[i], &pos[i]);
+	}
+
+	for(;;)
+	{
+		min = -1;
+		for(i = 0; i < count; i++)
+		{
+			if(heads[i] != NULL && (min < 0 || heads[i]->ts_us < heads[min]->ts_us))
+				min = i;
+		}
+		if(min < 0)
+			break;
+
+		log_record* rec = heads[min];
+		len = log_crash_append(line, 0, sizeof(line), log_level_color(rec->level));
+		color_len = len;
+		len = log_crash_append_uint(line, len, sizeof(line), rec->ts_us / 1000000, 1);
+		len = log_crash_append(line, len, sizeof(line), ".");
+		len = log_crash_append_uint(line, len, sizeof(line), rec->ts_us % 1000000 / 1000, 3);
+		len = log_crash_append(line, len, sizeof(line), " ");
+		len = log_crash_append(line, len, sizeof(line), log_level_name(rec->level));
+		len = log_crash_append(line, len, sizeof(line), " ");
+		if(rec->msg_len <= sizeof(line) - len - sizeof(CNONE))
+		{
+			memcpy(line + len, rec + 1, rec->msg_len);
+			len += rec->msg_len;
+		}
+		log_crash_write(STDOUT_FILENO, line, len);
+		log_crash_write(STDOUT_FILENO, CNONE, sizeof(CNONE) - 1);
+		if(ctrl != NULL && rec->ctrl == ctrl && rec->ctrl_id == ctrl->id && ctrl->wt && ctrl->fd != NULL)
+			log_crash_write(fileno(ctrl->fd), line + color_len, len - color_len);
+
+		pos[min] += rec->len;
+		__atomic_store_n(&rings[min]->head, pos[min], __ATOMIC_RELEASE);
+		heads[min] = log_ring_peek(rings[min], &pos[min]);
+	}
+}
+
+int  log_ctrl_print(log_ctrl* log, int level, const char* t, ...)
+{
+	log_ctrl* ctrl = log != NULL ? log : __atomic_load_n(&s_log_ctrl, __ATOMIC_ACQUIRE);
+	log_ring* ring = NULL;
+	va_list params;
+
+	if(level > (ctrl != NULL ? ctrl->level : s_log_level))
+		return 0;
+
+	ring = log_ring_get();
+	va_start(params, t);
+	if(ring != NULL)
+		log_ring_put(ring, ctrl, level, t, params);
+	else
+		log_print_sync(ctrl, level, t, params);
+	va_end(params);
 
 	return 0;
 }
 #ifdef __cplusplus
 }
 #endif
-
@@ -188,6 +188,7 @@ typedef enum
 	SDK_CMD_WEBSOCKET_PARAM_SET,
 	SDK_CMD_WEBSOCKET_UPLOAD_FILE,
 	SDK_CMD_WEBSOCKET_SEND_MSG,
+	SDK_CMD_WEBSOCKET_SEND_ALOG_RESULT,	// T_SDK_WEBSOCKET_ALOG_RESULT
 
 	SDK_CMD_NULL,
 }SDK_CMD_E;
@@ -712,6 +712,14 @@ typedef struct {
 	char chip_type[16];
 } T_SDK_CHIP_TYPE;
 
+// 算法结果，json 发给所有客户端，协商了二进制格式的客户端改为接收 bin
+typedef struct {
+	const char		*json;
+	unsigned int	json_len;
+	const void		*bin;		// NULL 表示没有二进制格式
+	unsigned int	bin_len;
+} T_SDK_WEBSOCKET_ALOG_RESULT;
+
 #if defined (__cplusplus)
 }
 #endif
@@ -3,6 +3,8 @@ GLOBAL_INSTALL_DIR := $(PRO_ROOT)sunrise_camera
 COMPILE_PREFIX := /opt/gcc-ubuntu-9.3.0-2020.03-x86_64-aarch64-linux-gnu/bin/aarch64-linux-gnu-
 export LD_LIBRARY_PATH=/opt/gcc-ubuntu-9.3.0-2020.03-x86_64-aarch64-linux-gnu/lib/x86_64-linux-gnu
 CFLAGS_EX  := -Wall -O3 -fstack-protector
+# 编译期日志等级(3: INFO)，SC_LOGD / SC_LOGT 不编译进代码，调试时改成 5
+CFLAGS_EX  += -DSC_LOG_COMPILE_LEVEL=3
 
 APPSDK_DIR ?= $(PRO_ROOT)../../appsdk
 dir_test = $(shell if [ -d $(APPSDK_DIR) ]; then echo "exist"; else echo "noexist"; fi)
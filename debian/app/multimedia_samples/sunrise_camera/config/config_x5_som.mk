@@ -7,6 +7,8 @@ else
 endif
 COMPILE_PREFIX := $(CROSS_COMPILE)
 CFLAGS_EX  := -Wall -g -O2 -fstack-protector -Wno-error=unused-result
+# 编译期日志等级(3: INFO)，SC_LOGD / SC_LOGT 不编译进代码，调试时改成 5
+CFLAGS_EX  += -DSC_LOG_COMPILE_LEVEL=3
 
 CHIP_ID ?= CHIP_X5_SOM
 ############################################################
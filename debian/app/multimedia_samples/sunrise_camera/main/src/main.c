@@ -20,6 +20,7 @@
 
 #include "utils/exception_handling.h"
 #include "utils/utils_log.h"
+#include "utils/latency_stats.h"
 
 static int32_t _do_add_sms(int32_t channel)
 {
@@ -389,6 +390,8 @@ loop:
 	while(1)
 	{
 		usleep(5*1000*1000);
+		// 各阶段耗时统计，每 5 秒生成一次快照写到文件，websocket 查询返回的也是这次快照
+		latency_stats_dump_file(LATENCY_STATS_FILE);
 	}
 
 	return 0;